@@ -22,6 +22,7 @@
 #include <openssl/rand.h>
 
 #include <algorithm>
+#include <utility>
 
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "absl/memory/memory.h"
@@ -55,11 +56,15 @@ ClientEkepHandshaker::ClientEkepHandshaker(const EkepHandshakerOptions &options)
       self_assertions_(options.self_assertions),
       accepted_peer_assertions_(options.accepted_peer_assertions),
       available_cipher_suites_({CURVE25519_SHA256}),
-      available_record_protocols_({ALTSRP_AES128_GCM}),
+      available_record_protocols_(options.record_protocols),
+      self_max_record_frame_size_(options.max_record_frame_size),
       available_ekep_versions_({"EKEP v1"}),
       additional_authenticated_data_(options.additional_authenticated_data),
       selected_cipher_suite_(UNKNOWN_HANDSHAKE_CIPHER),
       selected_record_protocol_(UNKNOWN_RECORD_PROTOCOL),
+      session_cache_(options.session_cache),
+      session_cache_key_(options.session_cache_key),
+      is_resuming_(false),
       expected_message_type_(SERVER_PRECOMMIT),
       handshaker_state_(EkepHandshaker::HandshakeState::NOT_STARTED) {}
 
@@ -152,6 +157,8 @@ ClientEkepHandshaker::Result ClientEkepHandshaker::HandleHandshakeMessage(
              selected_cipher_suite_, selected_record_protocol_, primary_secret_)
              .ok()) {
       handshaker_state_ = HandshakeState::ABORTED;
+    } else {
+      CacheSession();
     }
   }
 
@@ -219,6 +226,14 @@ Status ClientEkepHandshaker::HandleServerPrecommit(
                                   ProtoEnumValueName(record_protocol)));
   }
 
+  uint32_t max_record_frame_size =
+      server_precommit.selected_max_record_frame_size();
+  if (!SetSelectedMaxRecordFrameSize(max_record_frame_size)) {
+    return EkepError(Abort::PROTOCOL_ERROR,
+                     absl::StrCat("Selected max record frame size is invalid: ",
+                                  max_record_frame_size));
+  }
+
   // Verify that the server sent an adequately-sized challenge.
   if (server_precommit.challenge().size() != kEkepChallengeSize) {
     return EkepError(Abort::PROTOCOL_ERROR,
@@ -226,6 +241,30 @@ Status ClientEkepHandshaker::HandleServerPrecommit(
                                   server_precommit.challenge().size()));
   }
 
+  // If the server accepted the offered session, neither participant presents
+  // assertions.
+  if (server_precommit.resumption_accepted()) {
+    if (!offered_session_.has_value()) {
+      return EkepError(Abort::PROTOCOL_ERROR,
+                       "Server resumed a session that was not offered by the "
+                       "client");
+    }
+    if (offered_session_->cipher_suite != selected_cipher_suite_) {
+      return EkepError(Abort::PROTOCOL_ERROR,
+                       "Server resumed a session with a different cipher "
+                       "suite");
+    }
+    if (!server_precommit.server_requests().empty() ||
+        !server_precommit.server_offers().empty()) {
+      return EkepError(Abort::PROTOCOL_ERROR,
+                       "Server exchanged assertion offers or requests in a "
+                       "resumed handshake");
+    }
+    is_resuming_ = true;
+    return WriteClientId(server_precommit.server_requests().cbegin(),
+                         server_precommit.server_requests().cend(), output);
+  }
+
   // Verify that the server requested a non-empty subset of the assertions that
   // were offered by the client.
   if (server_precommit.server_requests().empty()) {
@@ -282,6 +321,16 @@ Status ClientEkepHandshaker::HandleServerId(const google::protobuf::Message &mes
   }
   const ServerId &server_id = *server_id_ptr;
 
+  // In a resumed handshake, the server's identities are those of the resumed
+  // session.
+  if (is_resuming_) {
+    if (!server_id.assertions().empty()) {
+      return EkepError(Abort::BAD_ASSERTION,
+                       "Server provided assertions in a resumed handshake");
+    }
+    ResumeSession(*offered_session_);
+  }
+
   // The server's assertions should all be bound to a data blob containing a
   // hash of the transcript up to and including the ClientId message, and the
   // server's public key.
@@ -330,6 +379,12 @@ Status ClientEkepHandshaker::HandleServerId(const google::protobuf::Message &mes
   // and the server's public key.
   std::string transcript_hash;
   ASYLO_RETURN_IF_ERROR(GetTranscriptHash(&transcript_hash));
+  if (is_resuming_) {
+    return DeriveResumedSecrets(selected_cipher_suite_, transcript_hash,
+                                server_public_key, dh_private_key_,
+                                offered_session_->resumption_secret,
+                                &primary_secret_, &authenticator_secret_);
+  }
   return DeriveSecrets(selected_cipher_suite_, transcript_hash,
                        server_public_key, dh_private_key_, &primary_secret_,
                        &authenticator_secret_);
@@ -383,6 +438,10 @@ Status ClientEkepHandshaker::WriteClientPrecommit(std::string *output) {
     ekep_version->set_name(version_name);
   }
 
+  if (self_max_record_frame_size_ != 0) {
+    client_precommit.set_max_record_frame_size(self_max_record_frame_size_);
+  }
+
   if (!additional_authenticated_data_.empty()) {
     client_precommit.mutable_options()->set_data(
         additional_authenticated_data_);
@@ -394,6 +453,16 @@ Status ClientEkepHandshaker::WriteClientPrecommit(std::string *output) {
   }
   client_precommit.set_challenge(challenge.data(), challenge.size());
 
+  // Offer to resume the cached session with the server, if there is one. The
+  // assertion offers and requests below allow the server to fall back to a
+  // full handshake.
+  if (session_cache_ && !session_cache_key_.empty()) {
+    offered_session_ = session_cache_->Lookup(session_cache_key_);
+    if (offered_session_.has_value()) {
+      client_precommit.set_resumption_ticket(offered_session_->ticket);
+    }
+  }
+
   for (const AssertionDescription &description : self_assertions_) {
     // Note that assertion generators were verified during creation of the
     // handshaker so there is no need to check whether the call to
@@ -504,6 +573,23 @@ Status ClientEkepHandshaker::WriteClientFinish(std::string *output) {
   return WriteFrameAndUpdateTranscript(CLIENT_FINISH, client_finish, output);
 }
 
+void ClientEkepHandshaker::CacheSession() {
+  // A resumed handshake does not establish a new session, so that the cached
+  // session keeps its original expiry.
+  if (!session_cache_ || session_cache_key_.empty() || is_resuming_) {
+    return;
+  }
+
+  EkepSession session;
+  Status status =
+      DeriveSession(selected_cipher_suite_, primary_secret_, &session);
+  if (!status.ok()) {
+    LOG(WARNING) << "Failed to derive resumable session: " << status;
+    return;
+  }
+  session_cache_->Insert(session_cache_key_, std::move(session));
+}
+
 bool ClientEkepHandshaker::SetSelectedEkepVersion(
     const std::string &ekep_version) {
   // Verify that the selected EKEP version was offered by the client.
@@ -545,4 +631,18 @@ bool ClientEkepHandshaker::SetSelectedRecordProtocol(
   return true;
 }
 
+bool ClientEkepHandshaker::SetSelectedMaxRecordFrameSize(
+    size_t max_record_frame_size) {
+  // A server may decline to negotiate a frame size. Otherwise, verify that the
+  // selected frame size does not exceed the size offered by the client.
+  if (max_record_frame_size != 0 &&
+      (max_record_frame_size < EkepHandshaker::kMinRecordFrameSize ||
+       max_record_frame_size > self_max_record_frame_size_)) {
+    return false;
+  }
+
+  SetMaxRecordFrameSize(max_record_frame_size);
+  return true;
+}
+
 }  // namespace asylo
@@ -26,8 +26,10 @@
 
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/message.h>
+#include "absl/types/optional.h"
 #include "asylo/grpc/auth/core/ekep_handshaker.h"
 #include "asylo/grpc/auth/core/ekep_handshaker_util.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
 #include "asylo/util/cleansing_types.h"
 
 namespace asylo {
@@ -36,6 +38,12 @@ namespace asylo {
 // handshake. It handles ServerPrecommit, ServerId, and ServerFinish messages
 // from the server and sends ClientPrecommit, ClientId, and ClientFinish
 // messages to the server.
+//
+// If configured with a session cache, the client offers to resume its cached
+// session with the server. If the server accepts, neither participant presents
+// assertions, and the server's identities are those of the cached session.
+// Otherwise, the client performs a full handshake and caches the resulting
+// session.
 class ClientEkepHandshaker final : public EkepHandshaker {
  public:
   // Creates a ClientEkepHandshaker configured with the given |options|, if
@@ -106,6 +114,10 @@ class ClientEkepHandshaker final : public EkepHandshaker {
   // transcript.
   Status WriteClientFinish(std::string *output);
 
+  // Caches the session established by a completed full handshake, if the
+  // handshaker is configured with a session cache.
+  void CacheSession();
+
   // Sets the handshaker's selected EKEP version to |ekep_version|. Returns
   // false if |ekep_version| is not a valid EKEP version for this handshaker.
   bool SetSelectedEkepVersion(const std::string &ekep_version);
@@ -119,6 +131,11 @@ class ClientEkepHandshaker final : public EkepHandshaker {
   // handshaker.
   bool SetSelectedRecordProtocol(RecordProtocol record_protocol);
 
+  // Sets the handshaker's maximum record frame size to |max_record_frame_size|.
+  // Returns false if |max_record_frame_size| is not a valid frame size for this
+  // handshaker.
+  bool SetSelectedMaxRecordFrameSize(size_t max_record_frame_size);
+
   // A list of assertions offered by the client.
   const std::vector<AssertionDescription> self_assertions_;
 
@@ -133,6 +150,10 @@ class ClientEkepHandshaker final : public EkepHandshaker {
   // preferred.
   const std::vector<RecordProtocol> available_record_protocols_;
 
+  // The largest record protocol frame size supported by the client, or zero if
+  // the client does not negotiate a frame size.
+  const size_t self_max_record_frame_size_;
+
   // A list of supported protocol versions in order of most recent to least
   // recent.
   const std::vector<std::string> available_ekep_versions_;
@@ -157,6 +178,20 @@ class ClientEkepHandshaker final : public EkepHandshaker {
   // validation of the ServerPrecommit message.
   std::string selected_ekep_version_;
 
+  // Cache of resumable sessions, or nullptr if sessions are not resumed.
+  const std::shared_ptr<EkepSessionCache> session_cache_;
+
+  // The key under which the session with the server is cached.
+  const std::string session_cache_key_;
+
+  // The cached session offered to the server, if any. This field is populated
+  // when the ClientPrecommit message is written.
+  absl::optional<EkepSession> offered_session_;
+
+  // Whether the server accepted the offered session. This field is populated
+  // after validation of the ServerPrecommit message.
+  bool is_resuming_;
+
   // The client's ephemeral Diffie-Hellman key-pair.
   std::vector<uint8_t> dh_public_key_;
   CleansingVector<uint8_t> dh_private_key_;
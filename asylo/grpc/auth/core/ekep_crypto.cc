@@ -25,8 +25,11 @@
 #include <openssl/mem.h>
 #include <openssl/rand.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 #include <memory>
+#include <string>
 
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
@@ -37,6 +40,7 @@
 #include "asylo/grpc/auth/core/ekep_errors.h"
 #include "asylo/util/proto_enum_util.h"
 #include "asylo/util/status.h"
+#include "asylo/util/status_macros.h"
 
 namespace asylo {
 namespace {
@@ -45,6 +49,8 @@ constexpr size_t kEkepSecretSize =
     (kEkepPrimarySecretSize + kEkepAuthenticatorSecretSize);
 
 constexpr char kEkepHkdfSalt[] = "EKEP Handshake v1";
+constexpr char kEkepHkdfSaltResumedHandshake[] = "EKEP Resumed Handshake v1";
+constexpr char kEkepHkdfSaltResumption[] = "EKEP Resumption v1";
 constexpr char kEkepHkdfSaltRecordProtocol[] = "EKEP Record Protocol v1";
 constexpr char kServerAuthenticatedText[] = "EKEP Handshake v1: Server Finish";
 constexpr char kClientAuthenticatedText[] = "EKEP Handshake v1: Client Finish";
@@ -79,17 +85,20 @@ Status Hmac(const HandshakeCipher &ciphersuite, ByteContainerView key,
   return absl::OkStatus();
 }
 
-}  // namespace
-
-Status DeriveSecrets(const HandshakeCipher &ciphersuite,
-                     ByteContainerView transcript_hash,
-                     ByteContainerView peer_dh_public_key,
-                     ByteContainerView self_dh_private_key,
-                     CleansingVector<uint8_t> *primary_secret,
-                     CleansingVector<uint8_t> *authenticator_secret) {
-  const EVP_MD *digest = nullptr;
-  CleansingVector<uint8_t> shared_secret;
-
+// Computes the Diffie-Hellman shared secret of |peer_dh_public_key| and
+// |self_dh_private_key| for the given |ciphersuite| and writes it to
+// |shared_secret|. On success, also sets |digest| to the hash function of
+// |ciphersuite|.
+//
+// If the ciphersuite is unsupported, returns BAD_HANDSHAKE_CIPHER.
+// If the peer's public key has an invalid size, returns PROTOCOL_ERROR.
+// If self's private key has an invalid size, returns INTERNAL_ERROR.
+// Returns INTERNAL_ERROR on other errors.
+Status ComputeSharedSecret(const HandshakeCipher &ciphersuite,
+                           ByteContainerView peer_dh_public_key,
+                           ByteContainerView self_dh_private_key,
+                           CleansingVector<uint8_t> *shared_secret,
+                           const EVP_MD **digest) {
   // Generate the shared secret and initialize a hash function for HKDF based on
   // the ciphersuite.
   switch (ciphersuite) {
@@ -107,28 +116,37 @@ Status DeriveSecrets(const HandshakeCipher &ciphersuite,
       }
 
       // Compute the shared secret.
-      shared_secret.resize(X25519_SHARED_KEY_LEN);
-      if (!X25519(shared_secret.data(), self_dh_private_key.data(),
+      shared_secret->resize(X25519_SHARED_KEY_LEN);
+      if (!X25519(shared_secret->data(), self_dh_private_key.data(),
                   peer_dh_public_key.data())) {
         LOG(ERROR) << "X25519 failed: " << BsslLastErrorString();
         return EkepError(Abort::INTERNAL_ERROR, "Internal error");
       }
 
       // Initialize a SHA256-digest for HKDF.
-      digest = EVP_sha256();
-      break;
+      *digest = EVP_sha256();
+      return absl::OkStatus();
     default:
       return EkepError(
           Abort::BAD_HANDSHAKE_CIPHER,
           "Ciphersuite not supported: " + ProtoEnumValueName(ciphersuite));
   }
+}
 
+// Derives the EKEP primary and authenticator secrets from
+// |input_key_material| using HKDF initialized with |digest|, the given |salt|,
+// and |transcript_hash| as the context information.
+Status DeriveHandshakeSecrets(const EVP_MD *digest,
+                              ByteContainerView input_key_material,
+                              const std::string &salt,
+                              ByteContainerView transcript_hash,
+                              CleansingVector<uint8_t> *primary_secret,
+                              CleansingVector<uint8_t> *authenticator_secret) {
   // Derive the primary and authenticator secrets using HKDF.
-  std::string salt(kEkepHkdfSalt);
   CleansingVector<uint8_t> output_key;
   output_key.resize(kEkepSecretSize);
-  if (!HKDF(output_key.data(), kEkepSecretSize, digest, shared_secret.data(),
-            shared_secret.size(),
+  if (!HKDF(output_key.data(), kEkepSecretSize, digest,
+            input_key_material.data(), input_key_material.size(),
             reinterpret_cast<const uint8_t *>(salt.data()), salt.size(),
             transcript_hash.data(), transcript_hash.size())) {
     LOG(ERROR) << "HKDF failed: " << BsslLastErrorString();
@@ -146,6 +164,87 @@ Status DeriveSecrets(const HandshakeCipher &ciphersuite,
   return absl::OkStatus();
 }
 
+}  // namespace
+
+Status DeriveSecrets(const HandshakeCipher &ciphersuite,
+                     ByteContainerView transcript_hash,
+                     ByteContainerView peer_dh_public_key,
+                     ByteContainerView self_dh_private_key,
+                     CleansingVector<uint8_t> *primary_secret,
+                     CleansingVector<uint8_t> *authenticator_secret) {
+  const EVP_MD *digest = nullptr;
+  CleansingVector<uint8_t> shared_secret;
+  ASYLO_RETURN_IF_ERROR(ComputeSharedSecret(ciphersuite, peer_dh_public_key,
+                                            self_dh_private_key,
+                                            &shared_secret, &digest));
+  return DeriveHandshakeSecrets(digest, shared_secret, kEkepHkdfSalt,
+                                transcript_hash, primary_secret,
+                                authenticator_secret);
+}
+
+Status DeriveResumedSecrets(const HandshakeCipher &ciphersuite,
+                            ByteContainerView transcript_hash,
+                            ByteContainerView peer_dh_public_key,
+                            ByteContainerView self_dh_private_key,
+                            ByteContainerView resumption_secret,
+                            CleansingVector<uint8_t> *primary_secret,
+                            CleansingVector<uint8_t> *authenticator_secret) {
+  if (resumption_secret.size() != kEkepResumptionSecretSize) {
+    LOG(ERROR) << "Resumption secret has incorrect size: "
+               << resumption_secret.size();
+    return EkepError(Abort::INTERNAL_ERROR, "Internal error");
+  }
+
+  const EVP_MD *digest = nullptr;
+  CleansingVector<uint8_t> input_key_material;
+  ASYLO_RETURN_IF_ERROR(ComputeSharedSecret(ciphersuite, peer_dh_public_key,
+                                            self_dh_private_key,
+                                            &input_key_material, &digest));
+
+  // Bind the secrets to the resumed session by appending its resumption
+  // secret to the shared secret.
+  std::copy(resumption_secret.cbegin(), resumption_secret.cend(),
+            std::back_inserter(input_key_material));
+  return DeriveHandshakeSecrets(digest, input_key_material,
+                                kEkepHkdfSaltResumedHandshake, transcript_hash,
+                                primary_secret, authenticator_secret);
+}
+
+Status DeriveResumptionSecret(const HandshakeCipher &ciphersuite,
+                              ByteContainerView transcript_hash,
+                              ByteContainerView primary_secret,
+                              CleansingVector<uint8_t> *resumption_secret,
+                              std::string *session_ticket) {
+  const EVP_MD *digest = nullptr;
+  switch (ciphersuite) {
+    case CURVE25519_SHA256:
+      digest = EVP_sha256();
+      break;
+    default:
+      return EkepError(
+          Abort::BAD_HANDSHAKE_CIPHER,
+          "Ciphersuite not supported: " + ProtoEnumValueName(ciphersuite));
+  }
+
+  // Derive the resumption secret and session ticket using HKDF.
+  std::string salt(kEkepHkdfSaltResumption);
+  CleansingVector<uint8_t> output_key;
+  output_key.resize(kEkepResumptionSecretSize + kEkepSessionTicketSize);
+  if (!HKDF(output_key.data(), output_key.size(), digest,
+            primary_secret.data(), primary_secret.size(),
+            reinterpret_cast<const uint8_t *>(salt.data()), salt.size(),
+            transcript_hash.data(), transcript_hash.size())) {
+    LOG(ERROR) << "HKDF failed: " << BsslLastErrorString();
+    return EkepError(Abort::INTERNAL_ERROR, "Internal error");
+  }
+
+  resumption_secret->assign(output_key.cbegin(),
+                            output_key.cbegin() + kEkepResumptionSecretSize);
+  session_ticket->assign(output_key.cbegin() + kEkepResumptionSecretSize,
+                         output_key.cend());
+  return absl::OkStatus();
+}
+
 Status DeriveRecordProtocolKey(const HandshakeCipher &ciphersuite,
                                const RecordProtocol &record_protocol,
                                ByteContainerView transcript_hash,
@@ -168,14 +267,12 @@ Status DeriveRecordProtocolKey(const HandshakeCipher &ciphersuite,
   switch (record_protocol) {
     case ALTSRP_AES128_GCM:
       record_protocol_key->resize(kAltsRecordProtocolAes128GcmKeySize);
-      // Randomize the key bytes just in case the key is mistakenly used even
-      // when the key derivation fails. The byte-sequence in uninitialized
-      // memory could be predictable and, as a result, an attacker may be able
-      // to recover data that is encrypted by a key whose underlying bytes are
-      // uninitialized. Initializing the key with a truly random value makes it
-      // impossible for an attacker to recover any data that is mistakenly
-      // encrypted with the key.
-      RAND_bytes(record_protocol_key->data(), record_protocol_key->size());
+      break;
+    case ALTSRP_AES256_GCM:
+      record_protocol_key->resize(kAltsRecordProtocolAes256GcmKeySize);
+      break;
+    case ALTSRP_CHACHA20_POLY1305:
+      record_protocol_key->resize(kAltsRecordProtocolChaCha20Poly1305KeySize);
       break;
     default:
       return EkepError(Abort::BAD_RECORD_PROTOCOL,
@@ -183,6 +280,14 @@ Status DeriveRecordProtocolKey(const HandshakeCipher &ciphersuite,
                            ProtoEnumValueName(record_protocol));
   }
 
+  // Randomize the key bytes just in case the key is mistakenly used even when
+  // the key derivation fails. The byte-sequence in uninitialized memory could
+  // be predictable and, as a result, an attacker may be able to recover data
+  // that is encrypted by a key whose underlying bytes are uninitialized.
+  // Initializing the key with a truly random value makes it impossible for an
+  // attacker to recover any data that is mistakenly encrypted with the key.
+  RAND_bytes(record_protocol_key->data(), record_protocol_key->size());
+
   std::string salt(kEkepHkdfSaltRecordProtocol);
   if (!HKDF(record_protocol_key->data(), record_protocol_key->size(), digest,
             primary_secret.data(), primary_secret.size(),
@@ -21,6 +21,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "asylo/crypto/util/byte_container_view.h"
@@ -33,6 +34,10 @@ namespace asylo {
 constexpr size_t kEkepPrimarySecretSize = 64;
 constexpr size_t kEkepAuthenticatorSecretSize = 64;
 constexpr size_t kAltsRecordProtocolAes128GcmKeySize = 16;
+constexpr size_t kAltsRecordProtocolAes256GcmKeySize = 32;
+constexpr size_t kAltsRecordProtocolChaCha20Poly1305KeySize = 32;
+constexpr size_t kEkepResumptionSecretSize = 64;
+constexpr size_t kEkepSessionTicketSize = 32;
 
 // Derives EKEP secrets based on the selected |ciphersuite| and the input
 // |transcript_hash|, |peer_dh_public_key|, and |self_dh_private_key|. On
@@ -55,6 +60,40 @@ Status DeriveSecrets(const HandshakeCipher &ciphersuite,
                      CleansingVector<uint8_t> *primary_secret,
                      CleansingVector<uint8_t> *authenticator_secret);
 
+// Derives EKEP secrets for a resumed handshake. This is the same as
+// DeriveSecrets(), except that the HKDF input key material is the
+// Diffie-Hellman shared secret followed by |resumption_secret|, and a distinct
+// HKDF salt is used. The resulting secrets can only be derived by a peer that
+// holds the resumption secret of the resumed session.
+//
+// Returns the same errors as DeriveSecrets(). Additionally, if
+// |resumption_secret| has an invalid size, returns INTERNAL_ERROR.
+Status DeriveResumedSecrets(const HandshakeCipher &ciphersuite,
+                            ByteContainerView transcript_hash,
+                            ByteContainerView peer_dh_public_key,
+                            ByteContainerView self_dh_private_key,
+                            ByteContainerView resumption_secret,
+                            CleansingVector<uint8_t> *primary_secret,
+                            CleansingVector<uint8_t> *authenticator_secret);
+
+// Derives the resumption secret and the session ticket of a completed
+// handshake using HKDF initialized with the hash function from |ciphersuite|,
+// the input key material |primary_secret|, and the final |transcript_hash|. On
+// success, writes the resumption secret to |resumption_secret| and the session
+// ticket to |session_ticket|.
+//
+// Note that |primary_secret| is a ByteContainerView, which does not enforce
+// any data safety policy on the underlying container. The caller should take
+// care to pass their primary secret using a self-cleansing container.
+//
+// If the ciphersuite is unsupported, returns BAD_HANDSHAKE_CIPHER.
+// Returns INTERNAL_ERROR on other errors.
+Status DeriveResumptionSecret(const HandshakeCipher &ciphersuite,
+                              ByteContainerView transcript_hash,
+                              ByteContainerView primary_secret,
+                              CleansingVector<uint8_t> *resumption_secret,
+                              std::string *session_ticket);
+
 // Derives a record protocol key for the given |record_protocol| using HKDF
 // initialized with the hash function from |ciphersuite| and the input key
 // material |primary_secret|. On success, writes the record protocol key to
@@ -60,6 +60,31 @@ constexpr char kTestAuthenticatorSecret[] =
     "24fcb3c5716e4d9fec12571677d5346138b608d846b09a374b84581761d6eae5"
     "b7460dbf84dad1b7a30dcb8ad9190b5a7a519c74a316724a3460c3ca94efd2fc";
 
+// Test vector for EKEP resumption-secret derivation.
+//   Inputs:
+//     kTestPrimarySecret, kTestTranscriptHash
+//   Outputs:
+//     kTestResumptionSecret, kTestSessionTicket
+constexpr char kTestResumptionSecret[] =
+    "379d6f9ab7985fe433e362737aea298fed336bc8c942218be40b1af3b8b8a453"
+    "1909ed0bb69847928fc84806bb3e82da2287729c78f7fdf37e2ce2ef3657e949";
+
+constexpr char kTestSessionTicket[] =
+    "bfcbd3ab6b857ce5187d7baf40b60f7c4f1477bb3d5af245a147e8a652b4029f";
+
+// Test vector for EKEP resumed-handshake secret derivation.
+//   Inputs:
+//     kTestPrivKey, kTestPubKey, kTestTranscriptHash, kTestResumptionSecret
+//   Outputs:
+//     kTestResumedPrimarySecret, kTestResumedAuthenticatorSecret
+constexpr char kTestResumedPrimarySecret[] =
+    "8f0dabadbb6a80f72d02cbd26c92eda78f70e507c99c44c389f15818e613ed56"
+    "19518e198cc266c8e34b5f65fa2b591d40e0ddda3c9c11229a851af2f2f9950a";
+
+constexpr char kTestResumedAuthenticatorSecret[] =
+    "7c40b080ef0f3bcaad9e795f25e16c086eedf0eecc6bb8c5623e7d0a8dba3fdc"
+    "c83ec876a5052579b2c6e3dfa52f21dd5f95c2eba32fed58808305de5fe492f1";
+
 // Test vector for record protocol key derivation.
 //   Inputs:
 //     kTestPrimarySecret, kTestTranscriptHash
@@ -67,6 +92,14 @@ constexpr char kTestAuthenticatorSecret[] =
 //     kTestRecordProtocolKey
 constexpr char kTestRecordProtocolKey[] = "c7e0f5436c0fe4efdb6327469651b9fe";
 
+// Test vector for derivation of a 256-bit record protocol key.
+//   Inputs:
+//     kTestPrimarySecret, kTestTranscriptHash
+//   Outputs:
+//     kTestRecordProtocolKey256
+constexpr char kTestRecordProtocolKey256[] =
+    "c7e0f5436c0fe4efdb6327469651b9fe0b50787e2c74e2211e57ae267fac1399";
+
 // Test vector for server handshake-authenticator computation.
 //   Inputs:
 //     kTestAuthenticatorSecret
@@ -185,6 +218,150 @@ TEST(EkepCryptoTest, DeriveSecretsWithCurve25519Sha256) {
   EXPECT_EQ(*actual_authenticator_secret, expected_authenticator_secret);
 }
 
+// Verify that DeriveResumedSecrets fails and returns BAD_HANDSHAKE_CIPHER when
+// passed an unsupported ciphersuite.
+TEST(EkepCryptoTest, DeriveResumedSecretsBadCiphersuite) {
+  std::string transcript_hash;
+  std::vector<uint8_t> peer_dh_public_key;
+  CleansingVector<uint8_t> self_dh_private_key;
+  CleansingVector<uint8_t> resumption_secret;
+  CleansingVector<uint8_t> authenticator_secret;
+  CleansingVector<uint8_t> primary_secret;
+
+  Status status = DeriveResumedSecrets(
+      UNKNOWN_HANDSHAKE_CIPHER, transcript_hash, peer_dh_public_key,
+      self_dh_private_key, resumption_secret, &primary_secret,
+      &authenticator_secret);
+  EXPECT_THAT(status, Not(IsOk()));
+  EXPECT_THAT(status, EkepErrorIs(Abort::BAD_HANDSHAKE_CIPHER));
+}
+
+// Verify that DeriveResumedSecrets fails and returns INTERNAL_ERROR when passed
+// a resumption secret that has an invalid size.
+TEST(EkepCryptoTest, DeriveResumedSecretsBadResumptionSecretSize) {
+  std::string transcript_hash;
+
+  SafeBytes<X25519_PUBLIC_VALUE_LEN> peer_dh_public_key =
+      TrivialRandomObject<SafeBytes<X25519_PUBLIC_VALUE_LEN>>();
+  SafeBytes<X25519_PRIVATE_KEY_LEN> self_dh_private_key =
+      TrivialRandomObject<SafeBytes<X25519_PRIVATE_KEY_LEN>>();
+
+  // Resumption secret is empty.
+  CleansingVector<uint8_t> resumption_secret;
+
+  CleansingVector<uint8_t> authenticator_secret;
+  CleansingVector<uint8_t> primary_secret;
+
+  Status status = DeriveResumedSecrets(
+      CURVE25519_SHA256, transcript_hash, peer_dh_public_key,
+      self_dh_private_key, resumption_secret, &primary_secret,
+      &authenticator_secret);
+  EXPECT_THAT(status, Not(IsOk()));
+  EXPECT_THAT(status, EkepErrorIs(Abort::INTERNAL_ERROR));
+}
+
+// Verify success of DeriveResumedSecrets using the ciphersuite consisting of
+// Curve25519 and SHA256.
+TEST(EkepCryptoTest, DeriveResumedSecretsWithCurve25519Sha256) {
+  UnsafeBytes<kSha256DigestLength> transcript_hash;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestTranscriptHash, &transcript_hash));
+
+  UnsafeBytes<X25519_PUBLIC_VALUE_LEN> peer_dh_public_key;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestPubKey, &peer_dh_public_key));
+
+  SafeBytes<X25519_PRIVATE_KEY_LEN> self_dh_private_key;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestPrivKey, &self_dh_private_key));
+
+  SafeBytes<kEkepResumptionSecretSize> resumption_secret;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestResumptionSecret, &resumption_secret));
+
+  SafeBytes<kEkepPrimarySecretSize> expected_primary_secret;
+  ASYLO_ASSERT_OK(SetTrivialObjectFromHexString(kTestResumedPrimarySecret,
+                                                &expected_primary_secret));
+
+  SafeBytes<kEkepAuthenticatorSecretSize> expected_authenticator_secret;
+  ASYLO_ASSERT_OK(SetTrivialObjectFromHexString(
+      kTestResumedAuthenticatorSecret, &expected_authenticator_secret));
+
+  CleansingVector<uint8_t> authenticator_secret;
+  CleansingVector<uint8_t> primary_secret;
+
+  ASYLO_ASSERT_OK(DeriveResumedSecrets(
+      CURVE25519_SHA256, transcript_hash, peer_dh_public_key,
+      self_dh_private_key, resumption_secret, &primary_secret,
+      &authenticator_secret));
+
+  // Verify that the primary secret is as expected.
+  SafeBytes<kEkepPrimarySecretSize> *actual_primary_secret =
+      SafeBytes<kEkepPrimarySecretSize>::Place(&primary_secret,
+                                               /*offset=*/0);
+  EXPECT_EQ(*actual_primary_secret, expected_primary_secret);
+
+  // Verify that the authenticator secret is as expected.
+  SafeBytes<kEkepAuthenticatorSecretSize> *actual_authenticator_secret =
+      SafeBytes<kEkepAuthenticatorSecretSize>::Place(&authenticator_secret,
+                                                     /*offset=*/0);
+  EXPECT_EQ(*actual_authenticator_secret, expected_authenticator_secret);
+}
+
+// Verify that DeriveResumptionSecret fails and returns BAD_HANDSHAKE_CIPHER
+// when passed an unsupported ciphersuite.
+TEST(EkepCryptoTest, DeriveResumptionSecretBadCiphersuite) {
+  std::string transcript_hash;
+  std::vector<uint8_t> primary_secret;
+  CleansingVector<uint8_t> resumption_secret;
+  std::string session_ticket;
+
+  Status status =
+      DeriveResumptionSecret(UNKNOWN_HANDSHAKE_CIPHER, transcript_hash,
+                             primary_secret, &resumption_secret,
+                             &session_ticket);
+  EXPECT_THAT(status, Not(IsOk()));
+  EXPECT_THAT(status, EkepErrorIs(Abort::BAD_HANDSHAKE_CIPHER));
+}
+
+// Verify success of DeriveResumptionSecret using the ciphersuite consisting of
+// Curve25519 and SHA256.
+TEST(EkepCryptoTest, DeriveResumptionSecretWithCurve25519Sha256) {
+  UnsafeBytes<kSha256DigestLength> transcript_hash;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestTranscriptHash, &transcript_hash));
+
+  SafeBytes<kEkepPrimarySecretSize> primary_secret;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestPrimarySecret, &primary_secret));
+
+  SafeBytes<kEkepResumptionSecretSize> expected_resumption_secret;
+  ASYLO_ASSERT_OK(SetTrivialObjectFromHexString(kTestResumptionSecret,
+                                                &expected_resumption_secret));
+
+  UnsafeBytes<kEkepSessionTicketSize> expected_session_ticket;
+  ASYLO_ASSERT_OK(SetTrivialObjectFromHexString(kTestSessionTicket,
+                                                &expected_session_ticket));
+
+  CleansingVector<uint8_t> resumption_secret;
+  std::string session_ticket;
+  ASYLO_ASSERT_OK(DeriveResumptionSecret(CURVE25519_SHA256, transcript_hash,
+                                         primary_secret, &resumption_secret,
+                                         &session_ticket));
+
+  // Verify that the resumption secret is as expected.
+  SafeBytes<kEkepResumptionSecretSize> *actual_resumption_secret =
+      SafeBytes<kEkepResumptionSecretSize>::Place(&resumption_secret,
+                                                  /*offset=*/0);
+  EXPECT_EQ(*actual_resumption_secret, expected_resumption_secret);
+
+  // Verify that the session ticket is as expected.
+  EXPECT_EQ(session_ticket,
+            std::string(reinterpret_cast<const char *>(
+                            expected_session_ticket.data()),
+                        expected_session_ticket.size()));
+}
+
 // Verify that DeriveRecordProtocolKey fails and returns BAD_HANDSHAKE_CIPHER
 // when passed an unsupported ciphersuite.
 TEST(EkepCryptoTest, DeriveRecordProtocolKeyBadCiphersuite) {
@@ -240,6 +417,38 @@ TEST(EkepCryptoTest, DeriveRecordProtocolKeySealAes128Gcm) {
   EXPECT_EQ(*actual_key, expected_key);
 }
 
+// Verify success of DeriveRecordProtocolKey when using the ciphersuite
+// consisting of Curve25519 and SHA256, and the record protocols that use
+// 256-bit keys.
+TEST(EkepCryptoTest, DeriveRecordProtocolKey256) {
+  UnsafeBytes<kSha256DigestLength> transcript_hash;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestTranscriptHash, &transcript_hash));
+
+  SafeBytes<kEkepPrimarySecretSize> primary_secret;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestPrimarySecret, &primary_secret));
+
+  SafeBytes<kAltsRecordProtocolAes256GcmKeySize> expected_key;
+  ASYLO_ASSERT_OK(
+      SetTrivialObjectFromHexString(kTestRecordProtocolKey256, &expected_key));
+
+  for (RecordProtocol record_protocol :
+       {ALTSRP_AES256_GCM, ALTSRP_CHACHA20_POLY1305}) {
+    CleansingVector<uint8_t> key;
+    ASYLO_ASSERT_OK(DeriveRecordProtocolKey(CURVE25519_SHA256, record_protocol,
+                                            transcript_hash, primary_secret,
+                                            &key));
+
+    // Verify that the record protocol key is as expected.
+    ASSERT_EQ(key.size(), expected_key.size());
+    SafeBytes<kAltsRecordProtocolAes256GcmKeySize> *actual_key =
+        SafeBytes<kAltsRecordProtocolAes256GcmKeySize>::Place(&key,
+                                                              /*offset=*/0);
+    EXPECT_EQ(*actual_key, expected_key);
+  }
+}
+
 // Verify that ComputeClientHandshakeAuthenticator fails and returns
 // BAD_HANDSHAKER_CIPHER when passed an unsupported ciphersuite.
 TEST(EkepCryptoTest, ComputeClientHandshakeAuthenticatorBadCipherSuite) {
@@ -243,8 +243,30 @@ StatusOr<CleansingVector<uint8_t>> EkepHandshaker::GetRecordProtocolKey() {
   return record_protocol_key_;
 }
 
+StatusOr<size_t> EkepHandshaker::GetMaxRecordFrameSize() {
+  if (!IsHandshakeCompleted()) {
+    return Status(::absl::StatusCode::kFailedPrecondition,
+                  "Cannot retrieve record frame size before handshake is "
+                  "complete");
+  }
+
+  return max_record_frame_size_;
+}
+
+StatusOr<bool> EkepHandshaker::WasSessionResumed() {
+  if (!IsHandshakeCompleted()) {
+    return Status(::absl::StatusCode::kFailedPrecondition,
+                  "Cannot determine session resumption before handshake is "
+                  "complete");
+  }
+
+  return session_resumed_;
+}
+
 EkepHandshaker::EkepHandshaker(int max_frame_size)
-    : max_frame_size_(max_frame_size) {
+    : max_frame_size_(max_frame_size),
+      max_record_frame_size_(0),
+      session_resumed_(false) {
   peer_identities_ = absl::make_unique<EnclaveIdentities>();
 }
 
@@ -339,6 +361,10 @@ void EkepHandshaker::SetRecordProtocol(RecordProtocol record_protocol) {
   record_protocol_ = record_protocol;
 }
 
+void EkepHandshaker::SetMaxRecordFrameSize(size_t max_record_frame_size) {
+  max_record_frame_size_ = max_record_frame_size;
+}
+
 Status EkepHandshaker::DeriveAndSetRecordProtocolKey(
     HandshakeCipher cipher_suite, RecordProtocol record_protocol,
     ByteContainerView primary_secret) {
@@ -349,6 +375,27 @@ Status EkepHandshaker::DeriveAndSetRecordProtocolKey(
                                  &record_protocol_key_);
 }
 
+void EkepHandshaker::ResumeSession(const EkepSession &session) {
+  session_resumed_ = true;
+  for (const EnclaveIdentity &identity :
+       session.peer_identities.identities()) {
+    AddPeerIdentity(identity);
+  }
+}
+
+Status EkepHandshaker::DeriveSession(HandshakeCipher cipher_suite,
+                                     ByteContainerView primary_secret,
+                                     EkepSession *session) {
+  std::string final_transcript_hash;
+  ASYLO_RETURN_IF_ERROR(GetTranscriptHash(&final_transcript_hash));
+  ASYLO_RETURN_IF_ERROR(DeriveResumptionSecret(
+      cipher_suite, final_transcript_hash, primary_secret,
+      &session->resumption_secret, &session->ticket));
+  session->cipher_suite = cipher_suite;
+  session->peer_identities = *peer_identities_;
+  return absl::OkStatus();
+}
+
 bool EkepHandshaker::SetTranscriptHashFunction(HashInterface *hash) {
   return transcript_.SetHasher(hash);
 }
@@ -25,6 +25,7 @@
 #include <google/protobuf/message.h>
 #include "asylo/crypto/hash_interface.h"
 #include "asylo/crypto/util/byte_container_view.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
 #include "asylo/grpc/auth/core/handshake.pb.h"
 #include "asylo/grpc/auth/core/transcript.h"
 #include "asylo/grpc/auth/util/multi_buffer_input_stream.h"
@@ -85,6 +86,12 @@ class EkepHandshaker {
   // attack on an EkepHandshaker.
   static constexpr size_t kFrameSizeLimit = 1 << 30;  // 1 GB
 
+  // The bounds on a negotiated record protocol frame size. These match the
+  // frame sizes accepted by the zero-copy frame protectors that implement the
+  // record protocols.
+  static constexpr size_t kMinRecordFrameSize = 1024;              // 1 KB
+  static constexpr size_t kMaxRecordFrameSize = 16 * 1024 * 1024;  // 16 MB
+
   virtual ~EkepHandshaker() = default;
 
   // Performs the next handshake step for this handshaker. This step processes a
@@ -154,6 +161,17 @@ class EkepHandshaker {
   // GoogleError::FAILED_PRECONDITION.
   StatusOr<CleansingVector<uint8_t>> GetRecordProtocolKey();
 
+  // Returns the negotiated maximum record protocol frame size, given that the
+  // handshake has successfully completed. Returns zero if the participants did
+  // not negotiate a frame size. If the handshake has not yet completed, returns
+  // GoogleError::FAILED_PRECONDITION.
+  StatusOr<size_t> GetMaxRecordFrameSize();
+
+  // Returns whether the handshake resumed a session from an earlier handshake,
+  // given that the handshake has successfully completed. If the handshake has
+  // not yet completed, returns GoogleError::FAILED_PRECONDITION.
+  StatusOr<bool> WasSessionResumed();
+
  protected:
   enum class HandshakeState {
     NOT_STARTED = 0,
@@ -201,12 +219,26 @@ class EkepHandshaker {
   // Sets the record protocol to use after the handshake completes.
   void SetRecordProtocol(RecordProtocol record_protocol);
 
+  // Sets the maximum frame size to use with the record protocol after the
+  // handshake completes. Zero indicates that no frame size was negotiated.
+  void SetMaxRecordFrameSize(size_t max_record_frame_size);
+
+  // Marks the handshake as a resumption of |session| and adds the identities
+  // of |session| to the list of peer identities.
+  void ResumeSession(const EkepSession &session);
+
   // Derives and sets the record protocol key using the given |cipher_suite|,
   // |record_protocol|, |primary_secret|, and the current handshake transcript.
   Status DeriveAndSetRecordProtocolKey(HandshakeCipher cipher_suite,
                                        RecordProtocol record_protocol,
                                        ByteContainerView primary_secret);
 
+  // Derives a resumable session from the completed handshake using the given
+  // |cipher_suite|, |primary_secret|, the current handshake transcript, and the
+  // peer's identities, and writes it to |session|.
+  Status DeriveSession(HandshakeCipher cipher_suite,
+                       ByteContainerView primary_secret, EkepSession *session);
+
   // Returns true if the handshake is in progress. A handshake is in progress if
   // the ClientPrecommit message has been sent and the handshake is neither
   // completed nor aborted.
@@ -286,6 +318,13 @@ class EkepHandshaker {
 
   // The key used in the record protocol.
   CleansingVector<uint8_t> record_protocol_key_;
+
+  // The maximum frame size used in the record protocol, or zero if no frame
+  // size was negotiated.
+  size_t max_record_frame_size_;
+
+  // Whether the handshake resumed a session from an earlier handshake.
+  bool session_resumed_;
 };
 
 }  // namespace asylo
@@ -0,0 +1,410 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/grpc/auth/core/ekep_handshaker.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "asylo/grpc/auth/core/client_ekep_handshaker.h"
+#include "asylo/grpc/auth/core/ekep_crypto.h"
+#include "asylo/grpc/auth/core/ekep_handshaker_util.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
+#include "asylo/grpc/auth/core/handshake.pb.h"
+#include "asylo/grpc/auth/core/server_ekep_handshaker.h"
+#include "asylo/identity/descriptions.h"
+#include "asylo/identity/enclave_assertion_authority_config.pb.h"
+#include "asylo/identity/identity.pb.h"
+#include "asylo/identity/init.h"
+#include "asylo/test/util/enclave_assertion_authority_configs.h"
+#include "asylo/test/util/status_matchers.h"
+#include "asylo/util/cleansing_types.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Ne;
+using ::testing::Not;
+using ::testing::SizeIs;
+
+constexpr char kServerName[] = "server.example.com:443";
+
+// The results of a handshake between a client and a server handshaker.
+struct HandshakeResults {
+  EkepHandshaker::Result client_result;
+  EkepHandshaker::Result server_result;
+};
+
+// Initializes the null assertion authorities used by the handshakers.
+Status InitializeNullAssertionAuthorities() {
+  std::vector<EnclaveAssertionAuthorityConfig> authority_configs = {
+      GetNullAssertionAuthorityTestConfig()};
+  return InitializeEnclaveAssertionAuthorities(authority_configs.cbegin(),
+                                               authority_configs.cend());
+}
+
+// Returns handshaker options that use null assertions in both directions and
+// the given |session_cache|.
+EkepHandshakerOptions MakeOptions(
+    std::shared_ptr<EkepSessionCache> session_cache) {
+  AssertionDescription null_assertion_description;
+  SetNullAssertionDescription(&null_assertion_description);
+
+  EkepHandshakerOptions options;
+  options.self_assertions = {null_assertion_description};
+  options.accepted_peer_assertions = {null_assertion_description};
+  options.session_cache = std::move(session_cache);
+  options.session_cache_key = kServerName;
+  return options;
+}
+
+// Runs a handshake between |client| and |server| by passing the frames written
+// by each handshaker to the other, until neither has a frame to send.
+HandshakeResults RunHandshake(EkepHandshaker *client, EkepHandshaker *server) {
+  HandshakeResults results;
+  std::string client_output;
+  std::string server_output;
+  results.client_result = client->NextHandshakeStep(nullptr, 0, &client_output);
+  results.server_result = EkepHandshaker::Result::IN_PROGRESS;
+  while (!client_output.empty()) {
+    results.server_result = server->NextHandshakeStep(
+        client_output.data(), client_output.size(), &server_output);
+    client_output.clear();
+    if (server_output.empty() ||
+        results.client_result != EkepHandshaker::Result::IN_PROGRESS) {
+      break;
+    }
+    results.client_result = client->NextHandshakeStep(
+        server_output.data(), server_output.size(), &client_output);
+    if (results.server_result != EkepHandshaker::Result::IN_PROGRESS) {
+      break;
+    }
+  }
+  return results;
+}
+
+class EkepHandshakerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASYLO_ASSERT_OK(InitializeNullAssertionAuthorities());
+    client_cache_ = std::make_shared<EkepSessionCache>(absl::Hours(1));
+    server_cache_ = std::make_shared<EkepSessionCache>(absl::Hours(1));
+  }
+
+  // Runs a handshake between new client and server handshakers that use the
+  // client and server session caches, and expects it to complete. Sets
+  // |resumed| to whether each handshaker resumed a session, and |key| to the
+  // record protocol key.
+  void RunCompletedHandshake(bool *client_resumed, bool *server_resumed,
+                             CleansingVector<uint8_t> *key) {
+    std::unique_ptr<EkepHandshaker> client =
+        ClientEkepHandshaker::Create(MakeOptions(client_cache_));
+    std::unique_ptr<EkepHandshaker> server =
+        ServerEkepHandshaker::Create(MakeOptions(server_cache_));
+    ASSERT_TRUE(client);
+    ASSERT_TRUE(server);
+
+    HandshakeResults results = RunHandshake(client.get(), server.get());
+    ASSERT_THAT(results.client_result, Eq(EkepHandshaker::Result::COMPLETED));
+    ASSERT_THAT(results.server_result, Eq(EkepHandshaker::Result::COMPLETED));
+
+    ASYLO_ASSERT_OK_AND_ASSIGN(*client_resumed, client->WasSessionResumed());
+    ASYLO_ASSERT_OK_AND_ASSIGN(*server_resumed, server->WasSessionResumed());
+
+    // Both participants authenticated one null identity from the peer, either
+    // directly or through the resumed session.
+    std::unique_ptr<EnclaveIdentities> client_peer_identities;
+    ASYLO_ASSERT_OK_AND_ASSIGN(client_peer_identities,
+                               client->GetPeerIdentities());
+    EXPECT_THAT(client_peer_identities->identities(), SizeIs(1));
+    std::unique_ptr<EnclaveIdentities> server_peer_identities;
+    ASYLO_ASSERT_OK_AND_ASSIGN(server_peer_identities,
+                               server->GetPeerIdentities());
+    EXPECT_THAT(server_peer_identities->identities(), SizeIs(1));
+
+    CleansingVector<uint8_t> server_key;
+    ASYLO_ASSERT_OK_AND_ASSIGN(*key, client->GetRecordProtocolKey());
+    ASYLO_ASSERT_OK_AND_ASSIGN(server_key, server->GetRecordProtocolKey());
+    EXPECT_THAT(*key, Eq(server_key));
+  }
+
+  std::shared_ptr<EkepSessionCache> client_cache_;
+  std::shared_ptr<EkepSessionCache> server_cache_;
+};
+
+// Verify that handshakers without a session cache always perform a full
+// handshake.
+TEST_F(EkepHandshakerTest, FullHandshakeWithoutSessionCache) {
+  for (int i = 0; i < 2; ++i) {
+    std::unique_ptr<EkepHandshaker> client =
+        ClientEkepHandshaker::Create(MakeOptions(nullptr));
+    std::unique_ptr<EkepHandshaker> server =
+        ServerEkepHandshaker::Create(MakeOptions(nullptr));
+    ASSERT_TRUE(client);
+    ASSERT_TRUE(server);
+
+    HandshakeResults results = RunHandshake(client.get(), server.get());
+    ASSERT_THAT(results.client_result, Eq(EkepHandshaker::Result::COMPLETED));
+    ASSERT_THAT(results.server_result, Eq(EkepHandshaker::Result::COMPLETED));
+    EXPECT_THAT(client->WasSessionResumed(), IsOkAndHolds(false));
+    EXPECT_THAT(server->WasSessionResumed(), IsOkAndHolds(false));
+  }
+}
+
+// Verify that a full handshake caches its session on both sides, and that the
+// next handshake resumes it with a fresh record protocol key.
+TEST_F(EkepHandshakerTest, ResumesCachedSession) {
+  bool client_resumed;
+  bool server_resumed;
+  CleansingVector<uint8_t> full_key;
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &full_key));
+  EXPECT_FALSE(client_resumed);
+  EXPECT_FALSE(server_resumed);
+  EXPECT_THAT(client_cache_->size(), Eq(1));
+  EXPECT_THAT(server_cache_->size(), Eq(1));
+
+  CleansingVector<uint8_t> resumed_key;
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &resumed_key));
+  EXPECT_TRUE(client_resumed);
+  EXPECT_TRUE(server_resumed);
+  EXPECT_THAT(resumed_key, Ne(full_key));
+
+  // Resumption does not establish new sessions.
+  EXPECT_THAT(client_cache_->size(), Eq(1));
+  EXPECT_THAT(server_cache_->size(), Eq(1));
+}
+
+// Verify that the handshake falls back to a full handshake if the server does
+// not hold the client's session, and that the client then caches the new
+// session.
+TEST_F(EkepHandshakerTest, FallsBackToFullHandshakeForUnknownTicket) {
+  bool client_resumed;
+  bool server_resumed;
+  CleansingVector<uint8_t> key;
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &key));
+  absl::optional<EkepSession> first_session =
+      client_cache_->Lookup(kServerName);
+  ASSERT_TRUE(first_session.has_value());
+
+  server_cache_ = std::make_shared<EkepSessionCache>(absl::Hours(1));
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &key));
+  EXPECT_FALSE(client_resumed);
+  EXPECT_FALSE(server_resumed);
+
+  absl::optional<EkepSession> second_session =
+      client_cache_->Lookup(kServerName);
+  ASSERT_TRUE(second_session.has_value());
+  EXPECT_THAT(second_session->ticket, Ne(first_session->ticket));
+  EXPECT_TRUE(server_cache_->Lookup(second_session->ticket).has_value());
+}
+
+// Verify that the server does not resume an expired session.
+TEST_F(EkepHandshakerTest, DoesNotResumeExpiredSession) {
+  server_cache_ = std::make_shared<EkepSessionCache>(absl::ZeroDuration());
+
+  bool client_resumed;
+  bool server_resumed;
+  CleansingVector<uint8_t> key;
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &key));
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &key));
+  EXPECT_FALSE(client_resumed);
+  EXPECT_FALSE(server_resumed);
+}
+
+// Verify that a resumed handshake fails if the participants hold different
+// resumption secrets for the same ticket.
+TEST_F(EkepHandshakerTest, ResumedHandshakeFailsWithWrongResumptionSecret) {
+  bool client_resumed;
+  bool server_resumed;
+  CleansingVector<uint8_t> key;
+  ASSERT_NO_FATAL_FAILURE(
+      RunCompletedHandshake(&client_resumed, &server_resumed, &key));
+
+  absl::optional<EkepSession> session = client_cache_->Lookup(kServerName);
+  ASSERT_TRUE(session.has_value());
+  session->resumption_secret[0] ^= 1;
+  std::string ticket = session->ticket;
+  server_cache_->Insert(ticket, std::move(session).value());
+
+  std::unique_ptr<EkepHandshaker> client =
+      ClientEkepHandshaker::Create(MakeOptions(client_cache_));
+  std::unique_ptr<EkepHandshaker> server =
+      ServerEkepHandshaker::Create(MakeOptions(server_cache_));
+  ASSERT_TRUE(client);
+  ASSERT_TRUE(server);
+
+  HandshakeResults results = RunHandshake(client.get(), server.get());
+  EXPECT_THAT(results.client_result, Eq(EkepHandshaker::Result::ABORTED));
+  EXPECT_THAT(results.server_result,
+              Not(Eq(EkepHandshaker::Result::COMPLETED)));
+}
+
+// Runs a full handshake between a client and a server handshaker created
+// from |client_options| and |server_options|, and expects it to complete.
+void RunHandshakeWithOptions(const EkepHandshakerOptions &client_options,
+                             const EkepHandshakerOptions &server_options,
+                             std::unique_ptr<EkepHandshaker> *client,
+                             std::unique_ptr<EkepHandshaker> *server) {
+  *client = ClientEkepHandshaker::Create(client_options);
+  *server = ServerEkepHandshaker::Create(server_options);
+  ASSERT_TRUE(*client);
+  ASSERT_TRUE(*server);
+
+  HandshakeResults results = RunHandshake(client->get(), server->get());
+  ASSERT_THAT(results.client_result, Eq(EkepHandshaker::Result::COMPLETED));
+  ASSERT_THAT(results.server_result, Eq(EkepHandshaker::Result::COMPLETED));
+}
+
+// Verify that the server selects the client's most preferred record protocol
+// that the server supports, and that the record protocol key has the size of
+// that protocol's key.
+TEST_F(EkepHandshakerTest, SelectsClientPreferredRecordProtocol) {
+  EkepHandshakerOptions client_options = MakeOptions(nullptr);
+  client_options.record_protocols = {ALTSRP_CHACHA20_POLY1305,
+                                     ALTSRP_AES128_GCM};
+  EkepHandshakerOptions server_options = MakeOptions(nullptr);
+  server_options.record_protocols = {ALTSRP_AES128_GCM, ALTSRP_AES256_GCM,
+                                     ALTSRP_CHACHA20_POLY1305};
+
+  std::unique_ptr<EkepHandshaker> client;
+  std::unique_ptr<EkepHandshaker> server;
+  ASSERT_NO_FATAL_FAILURE(RunHandshakeWithOptions(
+      client_options, server_options, &client, &server));
+  EXPECT_THAT(client->GetRecordProtocol(),
+              IsOkAndHolds(ALTSRP_CHACHA20_POLY1305));
+  EXPECT_THAT(server->GetRecordProtocol(),
+              IsOkAndHolds(ALTSRP_CHACHA20_POLY1305));
+
+  CleansingVector<uint8_t> key;
+  ASYLO_ASSERT_OK_AND_ASSIGN(key, client->GetRecordProtocolKey());
+  EXPECT_THAT(key, SizeIs(kAltsRecordProtocolChaCha20Poly1305KeySize));
+}
+
+// Verify that the handshake fails if the participants share no record
+// protocol.
+TEST_F(EkepHandshakerTest, FailsWithoutCommonRecordProtocol) {
+  EkepHandshakerOptions client_options = MakeOptions(nullptr);
+  client_options.record_protocols = {ALTSRP_AES256_GCM};
+  EkepHandshakerOptions server_options = MakeOptions(nullptr);
+  server_options.record_protocols = {ALTSRP_AES128_GCM};
+
+  std::unique_ptr<EkepHandshaker> client =
+      ClientEkepHandshaker::Create(client_options);
+  std::unique_ptr<EkepHandshaker> server =
+      ServerEkepHandshaker::Create(server_options);
+  ASSERT_TRUE(client);
+  ASSERT_TRUE(server);
+
+  HandshakeResults results = RunHandshake(client.get(), server.get());
+  EXPECT_THAT(results.server_result, Eq(EkepHandshaker::Result::ABORTED));
+}
+
+// Verify that the participants agree on the smaller of their max record frame
+// sizes, and that no frame size is negotiated unless both offer one.
+TEST_F(EkepHandshakerTest, NegotiatesMaxRecordFrameSize) {
+  struct FrameSizeCase {
+    size_t client_frame_size;
+    size_t server_frame_size;
+    size_t negotiated_frame_size;
+  };
+  constexpr size_t kSmall = 64 * 1024;
+  constexpr size_t kLarge = 1024 * 1024;
+  for (const FrameSizeCase &test_case : std::vector<FrameSizeCase>{
+           {kSmall, kLarge, kSmall},
+           {kLarge, kSmall, kSmall},
+           {kLarge, kLarge, kLarge},
+           {0, kLarge, 0},
+           {kLarge, 0, 0},
+           {0, 0, 0},
+       }) {
+    EkepHandshakerOptions client_options = MakeOptions(nullptr);
+    client_options.max_record_frame_size = test_case.client_frame_size;
+    EkepHandshakerOptions server_options = MakeOptions(nullptr);
+    server_options.max_record_frame_size = test_case.server_frame_size;
+
+    std::unique_ptr<EkepHandshaker> client;
+    std::unique_ptr<EkepHandshaker> server;
+    ASSERT_NO_FATAL_FAILURE(RunHandshakeWithOptions(
+        client_options, server_options, &client, &server));
+    EXPECT_THAT(client->GetMaxRecordFrameSize(),
+                IsOkAndHolds(test_case.negotiated_frame_size));
+    EXPECT_THAT(server->GetMaxRecordFrameSize(),
+                IsOkAndHolds(test_case.negotiated_frame_size));
+  }
+}
+
+// Verify that the max record frame size is unavailable before the handshake
+// completes.
+TEST_F(EkepHandshakerTest, MaxRecordFrameSizeUnavailableBeforeCompletion) {
+  std::unique_ptr<EkepHandshaker> client =
+      ClientEkepHandshaker::Create(MakeOptions(nullptr));
+  ASSERT_TRUE(client);
+  EXPECT_THAT(client->GetMaxRecordFrameSize(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+// Measures the rate of EKEP handshakes between a client and a server
+// handshaker. If |state.range(0)| is non-zero, every handshake after the first
+// resumes the session of the first.
+void BM_Handshake(benchmark::State &state) {
+  if (!InitializeNullAssertionAuthorities().ok()) {
+    state.SkipWithError("Failed to initialize assertion authorities");
+    return;
+  }
+  std::shared_ptr<EkepSessionCache> client_cache;
+  std::shared_ptr<EkepSessionCache> server_cache;
+  if (state.range(0)) {
+    client_cache = std::make_shared<EkepSessionCache>(absl::Hours(1));
+    server_cache = std::make_shared<EkepSessionCache>(absl::Hours(1));
+  }
+  EkepHandshakerOptions client_options = MakeOptions(client_cache);
+  EkepHandshakerOptions server_options = MakeOptions(server_cache);
+
+  for (auto _ : state) {
+    std::unique_ptr<EkepHandshaker> client =
+        ClientEkepHandshaker::Create(client_options);
+    std::unique_ptr<EkepHandshaker> server =
+        ServerEkepHandshaker::Create(server_options);
+    HandshakeResults results = RunHandshake(client.get(), server.get());
+    if (results.client_result != EkepHandshaker::Result::COMPLETED ||
+        results.server_result != EkepHandshaker::Result::COMPLETED) {
+      state.SkipWithError("Handshake failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_Handshake)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace asylo
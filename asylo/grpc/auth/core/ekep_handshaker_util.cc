@@ -18,6 +18,10 @@
 
 #include "asylo/grpc/auth/core/ekep_handshaker_util.h"
 
+#include <openssl/aead.h>
+
+#include <algorithm>
+
 #include <google/protobuf/util/message_differencer.h>
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
@@ -26,10 +30,18 @@
 #include "asylo/identity/attestation/enclave_assertion_generator.h"
 #include "asylo/identity/attestation/enclave_assertion_verifier.h"
 #include "asylo/identity/enclave_assertion_authority.h"
+#include "asylo/util/proto_enum_util.h"
 #include "asylo/util/status.h"
 
 namespace asylo {
 
+std::vector<RecordProtocol> DefaultRecordProtocols() {
+  if (EVP_has_aes_hardware()) {
+    return {ALTSRP_AES128_GCM, ALTSRP_AES256_GCM, ALTSRP_CHACHA20_POLY1305};
+  }
+  return {ALTSRP_CHACHA20_POLY1305, ALTSRP_AES128_GCM, ALTSRP_AES256_GCM};
+}
+
 const EnclaveAssertionGenerator *GetEnclaveAssertionGenerator(
     const AssertionDescription &description) {
   std::string authority_id =
@@ -62,6 +74,31 @@ Status EkepHandshakerOptions::Validate() const {
         "max_frame_size");
   }
 
+  if (record_protocols.empty()) {
+    return absl::InvalidArgumentError(
+        "Must supply at least one record protocol");
+  }
+  std::vector<RecordProtocol> supported_record_protocols =
+      DefaultRecordProtocols();
+  for (RecordProtocol record_protocol : record_protocols) {
+    if (std::find(supported_record_protocols.cbegin(),
+                  supported_record_protocols.cend(),
+                  record_protocol) == supported_record_protocols.cend()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Record protocol not supported: ",
+                       ProtoEnumValueName(record_protocol)));
+    }
+  }
+
+  if (max_record_frame_size != 0 &&
+      (max_record_frame_size < EkepHandshaker::kMinRecordFrameSize ||
+       max_record_frame_size > EkepHandshaker::kMaxRecordFrameSize)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "max_record_frame_size must be zero or between ",
+        EkepHandshaker::kMinRecordFrameSize, " and ",
+        EkepHandshaker::kMaxRecordFrameSize));
+  }
+
   if (self_assertions.empty()) {
     return absl::InvalidArgumentError(
         "Must supply at least one self assertion");
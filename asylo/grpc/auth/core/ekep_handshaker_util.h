@@ -19,9 +19,12 @@
 #ifndef ASYLO_GRPC_AUTH_CORE_EKEP_HANDSHAKER_UTIL_H_
 #define ASYLO_GRPC_AUTH_CORE_EKEP_HANDSHAKER_UTIL_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
+#include "asylo/grpc/auth/core/handshake.pb.h"
 #include "asylo/identity/attestation/enclave_assertion_generator.h"
 #include "asylo/identity/attestation/enclave_assertion_verifier.h"
 #include "asylo/identity/identity.pb.h"
@@ -29,6 +32,11 @@
 
 namespace asylo {
 
+// Returns the record protocols supported by EKEP handshakers, in the default
+// order of preference. AES-GCM is preferred if the platform has hardware AES
+// support, and ChaCha20-Poly1305 is preferred otherwise.
+std::vector<RecordProtocol> DefaultRecordProtocols();
+
 // Configuration options for an EKEP handshake. These options can be validated
 // by calling Validate(). See the comment above Validate() for restrictions on
 // field values.
@@ -45,6 +53,28 @@ struct EkepHandshakerOptions {
   // Additional data presented by the EKEP participant during the handshake.
   std::string additional_authenticated_data;
 
+  // Sessions that the EKEP participant may resume. If set, each full handshake
+  // records its session in the cache, and a handshake resumes a cached session
+  // when both participants hold it. If nullptr, every handshake is a full
+  // handshake.
+  std::shared_ptr<EkepSessionCache> session_cache;
+
+  // The key under which a client caches its session with the server, such as
+  // the server's address. Ignored by servers, which cache sessions under their
+  // tickets. A client with an empty key does not resume sessions.
+  std::string session_cache_key;
+
+  // Record protocols supported by the EKEP participant, in order of
+  // preference. The client's order of preference determines the record
+  // protocol that is selected.
+  std::vector<RecordProtocol> record_protocols = DefaultRecordProtocols();
+
+  // The size in bytes of the largest record protocol frame that the EKEP
+  // participant sends or receives. The participants use the smaller of their
+  // sizes. If zero, the participant does not negotiate a frame size, and the
+  // frame protector's default is used.
+  size_t max_record_frame_size = 0;
+
   // Validates the handshaker options. All of the following conditions must
   // hold, otherwise returns INVALID_ARGUMENT:
   //   * max_frame_size is non-zero and does not exceed
@@ -57,6 +87,11 @@ struct EkepHandshakerOptions {
   //   appropriate assertion-verification library available
   //   * The size of additional_authenticated_data is less than or equal to
   //   max_frame_size
+  //   * record_protocols is non-empty and contains only record protocols
+  //   returned by DefaultRecordProtocols()
+  //   * max_record_frame_size is zero, or is between
+  //   EkepHandshaker::kMinRecordFrameSize and
+  //   EkepHandshaker::kMaxRecordFrameSize
   Status Validate() const;
 };
 
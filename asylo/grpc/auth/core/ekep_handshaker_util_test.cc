@@ -21,6 +21,7 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "asylo/grpc/auth/core/ekep_handshaker.h"
+#include "asylo/grpc/auth/core/handshake.pb.h"
 #include "asylo/identity/attestation/null/null_identity_util.h"
 #include "asylo/identity/descriptions.h"
 #include "asylo/identity/identity.pb.h"
@@ -29,7 +30,9 @@
 namespace asylo {
 namespace {
 
+using ::testing::ElementsAreArray;
 using ::testing::Not;
+using ::testing::UnorderedElementsAre;
 
 const char kBadAuthorityType[] = "unknown authority";
 
@@ -94,6 +97,43 @@ TEST_F(EkepHandshakerUtilTest, ValidateBadFrameSize) {
   EXPECT_THAT(options.Validate(), Not(IsOk()));
 }
 
+// Verify that Validate fails on a set of options with an invalid maximum record
+// frame size.
+TEST_F(EkepHandshakerUtilTest, ValidateBadRecordFrameSize) {
+  EkepHandshakerOptions options = default_options_;
+
+  options.max_record_frame_size = EkepHandshaker::kMinRecordFrameSize - 1;
+  EXPECT_THAT(options.Validate(), Not(IsOk()));
+
+  options.max_record_frame_size = EkepHandshaker::kMaxRecordFrameSize + 1;
+  EXPECT_THAT(options.Validate(), Not(IsOk()));
+
+  options.max_record_frame_size = EkepHandshaker::kMaxRecordFrameSize;
+  EXPECT_THAT(options.Validate(), IsOk());
+}
+
+// Verify that Validate fails on a set of options with no record protocols or
+// with an unsupported record protocol.
+TEST_F(EkepHandshakerUtilTest, ValidateBadRecordProtocols) {
+  EkepHandshakerOptions options = default_options_;
+
+  options.record_protocols.clear();
+  EXPECT_THAT(options.Validate(), Not(IsOk()));
+
+  options.record_protocols = {ALTSRP_AES128_GCM, UNKNOWN_RECORD_PROTOCOL};
+  EXPECT_THAT(options.Validate(), Not(IsOk()));
+}
+
+// Verify that the default record protocols include every record protocol
+// supported by EKEP handshakers.
+TEST_F(EkepHandshakerUtilTest, DefaultRecordProtocols) {
+  EXPECT_THAT(DefaultRecordProtocols(),
+              UnorderedElementsAre(ALTSRP_AES128_GCM, ALTSRP_AES256_GCM,
+                                   ALTSRP_CHACHA20_POLY1305));
+  EXPECT_THAT(default_options_.record_protocols,
+              ElementsAreArray(DefaultRecordProtocols()));
+}
+
 // Verify that Validate fails on a set of options with additional authenticated
 // data that is larger than half the maximum frame size.
 TEST_F(EkepHandshakerUtilTest, ValidateBadAadSize) {
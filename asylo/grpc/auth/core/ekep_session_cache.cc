@@ -0,0 +1,89 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace asylo {
+
+constexpr size_t EkepSessionCache::kDefaultMaxSessions;
+
+EkepSessionCache::EkepSessionCache(absl::Duration ticket_lifetime,
+                                   size_t max_sessions)
+    : ticket_lifetime_(ticket_lifetime),
+      max_sessions_(std::max<size_t>(max_sessions, 1)) {}
+
+void EkepSessionCache::Insert(const std::string &key, EkepSession session) {
+  absl::Time now = absl::Now();
+  absl::MutexLock lock(&mu_);
+  sessions_.erase(key);
+  if (sessions_.size() >= max_sessions_) {
+    MakeRoom(now);
+  }
+  sessions_[key] = {std::move(session), now + ticket_lifetime_};
+}
+
+absl::optional<EkepSession> EkepSessionCache::Lookup(const std::string &key) {
+  absl::Time now = absl::Now();
+  absl::MutexLock lock(&mu_);
+  auto it = sessions_.find(key);
+  if (it == sessions_.end()) {
+    return absl::nullopt;
+  }
+  if (it->second.expiration <= now) {
+    sessions_.erase(it);
+    return absl::nullopt;
+  }
+  return it->second.session;
+}
+
+void EkepSessionCache::Erase(const std::string &key) {
+  absl::MutexLock lock(&mu_);
+  sessions_.erase(key);
+}
+
+size_t EkepSessionCache::size() const {
+  absl::MutexLock lock(&mu_);
+  return sessions_.size();
+}
+
+void EkepSessionCache::MakeRoom(absl::Time now) {
+  // Remove all expired sessions.
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    if (it->second.expiration <= now) {
+      sessions_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  if (sessions_.size() < max_sessions_) {
+    return;
+  }
+
+  // All sessions are live, so remove the one closest to expiry. Since every
+  // session has the same lifetime, this is also the oldest session.
+  auto oldest = std::min_element(
+      sessions_.begin(), sessions_.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.second.expiration < rhs.second.expiration;
+      });
+  sessions_.erase(oldest);
+}
+
+}  // namespace asylo
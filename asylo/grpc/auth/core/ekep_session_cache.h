@@ -0,0 +1,113 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_GRPC_AUTH_CORE_EKEP_SESSION_CACHE_H_
+#define ASYLO_GRPC_AUTH_CORE_EKEP_SESSION_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "asylo/grpc/auth/core/handshake.pb.h"
+#include "asylo/identity/identity.pb.h"
+#include "asylo/util/cleansing_types.h"
+
+namespace asylo {
+
+// State retained from a completed EKEP handshake that allows a later handshake
+// with the same peer to be resumed without presenting assertions.
+struct EkepSession {
+  // The ticket that the client presents to resume the session.
+  std::string ticket;
+
+  // The cipher suite negotiated by the handshake that established the session.
+  HandshakeCipher cipher_suite = UNKNOWN_HANDSHAKE_CIPHER;
+
+  // The secret that binds a resumed handshake to the session.
+  CleansingVector<uint8_t> resumption_secret;
+
+  // The peer's identities, as authenticated by the handshake that established
+  // the session.
+  EnclaveIdentities peer_identities;
+};
+
+// EkepSessionCache is a thread-safe cache of EKEP sessions that may be resumed.
+// A client handshaker caches its session with a server under a name for the
+// server, and a server handshaker caches its sessions under their tickets.
+//
+// Each session expires a fixed lifetime after the full handshake that
+// established it. Resuming a session does not extend its lifetime, which bounds
+// how long the identities authenticated by that handshake are trusted. If the
+// cache is full, expired sessions are removed first, followed by the sessions
+// closest to expiry.
+class EkepSessionCache {
+ public:
+  // The maximum number of sessions held by a cache, unless otherwise
+  // specified.
+  static constexpr size_t kDefaultMaxSessions = 1024;
+
+  // Creates a cache of at most |max_sessions| sessions that each expire
+  // |ticket_lifetime| after they are inserted.
+  explicit EkepSessionCache(absl::Duration ticket_lifetime,
+                            size_t max_sessions = kDefaultMaxSessions);
+
+  EkepSessionCache(const EkepSessionCache &other) = delete;
+  EkepSessionCache &operator=(const EkepSessionCache &other) = delete;
+
+  // Inserts |session| under |key|, replacing any session already cached under
+  // |key|.
+  void Insert(const std::string &key, EkepSession session);
+
+  // Returns the unexpired session cached under |key|, or absl::nullopt if there
+  // is no such session.
+  absl::optional<EkepSession> Lookup(const std::string &key);
+
+  // Removes the session cached under |key|, if any.
+  void Erase(const std::string &key);
+
+  // Returns the number of sessions in the cache, including expired sessions
+  // that have not yet been removed.
+  size_t size() const;
+
+  // Returns the lifetime of sessions in the cache.
+  absl::Duration ticket_lifetime() const { return ticket_lifetime_; }
+
+ private:
+  struct Entry {
+    EkepSession session;
+    absl::Time expiration;
+  };
+
+  // Removes entries to make room for one more entry.
+  void MakeRoom(absl::Time now) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const absl::Duration ticket_lifetime_;
+  const size_t max_sessions_;
+
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<std::string, Entry> sessions_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace asylo
+
+#endif  // ASYLO_GRPC_AUTH_CORE_EKEP_SESSION_CACHE_H_
@@ -0,0 +1,130 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
+
+#include <cstdint>
+#include <string>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "asylo/grpc/auth/core/handshake.pb.h"
+#include "asylo/identity/identity.pb.h"
+#include "asylo/test/util/proto_matchers.h"
+#include "asylo/util/cleansing_types.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::Eq;
+
+constexpr char kKey1[] = "key 1";
+constexpr char kKey2[] = "key 2";
+constexpr char kKey3[] = "key 3";
+
+// Returns a session whose ticket and resumption secret are derived from
+// |ticket|.
+EkepSession MakeSession(const std::string &ticket) {
+  EkepSession session;
+  session.ticket = ticket;
+  session.cipher_suite = CURVE25519_SHA256;
+  session.resumption_secret.assign(ticket.cbegin(), ticket.cend());
+  session.peer_identities.add_identities()->set_identity(ticket);
+  return session;
+}
+
+// Verifies that |session| is the session created by MakeSession(|ticket|).
+void ExpectSession(const absl::optional<EkepSession> &session,
+                   const std::string &ticket) {
+  ASSERT_TRUE(session.has_value());
+  EXPECT_THAT(session->ticket, Eq(ticket));
+  EXPECT_THAT(session->cipher_suite, Eq(CURVE25519_SHA256));
+  EXPECT_THAT(session->resumption_secret,
+              Eq(CleansingVector<uint8_t>(ticket.cbegin(), ticket.cend())));
+  EXPECT_THAT(session->peer_identities,
+              EqualsProto(MakeSession(ticket).peer_identities));
+}
+
+TEST(EkepSessionCacheTest, LookupReturnsInsertedSession) {
+  EkepSessionCache cache(absl::Hours(1));
+  cache.Insert(kKey1, MakeSession("ticket 1"));
+  cache.Insert(kKey2, MakeSession("ticket 2"));
+
+  EXPECT_THAT(cache.size(), Eq(2));
+  ExpectSession(cache.Lookup(kKey1), "ticket 1");
+  ExpectSession(cache.Lookup(kKey2), "ticket 2");
+  EXPECT_FALSE(cache.Lookup(kKey3).has_value());
+}
+
+TEST(EkepSessionCacheTest, InsertReplacesSessionWithSameKey) {
+  EkepSessionCache cache(absl::Hours(1));
+  cache.Insert(kKey1, MakeSession("ticket 1"));
+  cache.Insert(kKey1, MakeSession("ticket 2"));
+
+  EXPECT_THAT(cache.size(), Eq(1));
+  ExpectSession(cache.Lookup(kKey1), "ticket 2");
+}
+
+TEST(EkepSessionCacheTest, LookupRemovesExpiredSession) {
+  EkepSessionCache cache(absl::ZeroDuration());
+  cache.Insert(kKey1, MakeSession("ticket 1"));
+
+  EXPECT_THAT(cache.size(), Eq(1));
+  EXPECT_FALSE(cache.Lookup(kKey1).has_value());
+  EXPECT_THAT(cache.size(), Eq(0));
+}
+
+TEST(EkepSessionCacheTest, InsertEvictsOldestSessionWhenFull) {
+  EkepSessionCache cache(absl::Hours(1), /*max_sessions=*/2);
+  cache.Insert(kKey1, MakeSession("ticket 1"));
+  absl::SleepFor(absl::Milliseconds(1));
+  cache.Insert(kKey2, MakeSession("ticket 2"));
+  cache.Insert(kKey3, MakeSession("ticket 3"));
+
+  EXPECT_THAT(cache.size(), Eq(2));
+  EXPECT_FALSE(cache.Lookup(kKey1).has_value());
+  ExpectSession(cache.Lookup(kKey2), "ticket 2");
+  ExpectSession(cache.Lookup(kKey3), "ticket 3");
+}
+
+TEST(EkepSessionCacheTest, InsertEvictsExpiredSessionsWhenFull) {
+  EkepSessionCache cache(absl::ZeroDuration(), /*max_sessions=*/2);
+  cache.Insert(kKey1, MakeSession("ticket 1"));
+  cache.Insert(kKey2, MakeSession("ticket 2"));
+  cache.Insert(kKey3, MakeSession("ticket 3"));
+
+  EXPECT_THAT(cache.size(), Eq(1));
+}
+
+TEST(EkepSessionCacheTest, EraseRemovesSession) {
+  EkepSessionCache cache(absl::Hours(1));
+  cache.Insert(kKey1, MakeSession("ticket 1"));
+  cache.Insert(kKey2, MakeSession("ticket 2"));
+  cache.Erase(kKey1);
+  cache.Erase(kKey3);
+
+  EXPECT_THAT(cache.size(), Eq(1));
+  EXPECT_FALSE(cache.Lookup(kKey1).has_value());
+  ExpectSession(cache.Lookup(kKey2), "ticket 2");
+}
+
+}  // namespace
+}  // namespace asylo
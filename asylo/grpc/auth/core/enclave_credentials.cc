@@ -19,14 +19,31 @@
 #include "asylo/grpc/auth/core/enclave_credentials.h"
 
 #include <iterator>
+#include <memory>
 #include <utility>
 
+#include "absl/time/time.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
 #include "asylo/grpc/auth/core/enclave_security_connector.h"
 #include "asylo/grpc/auth/enclave_credentials_options.h"
 #include "src/core/lib/channel/channel_args.h"
 #include "src/core/lib/gprpp/ref_counted_ptr.h"
 #include "src/core/lib/security/credentials/credentials.h"
 
+namespace {
+
+// Returns a session cache with the given |ticket_lifetime|, or nullptr if
+// |ticket_lifetime| disables session resumption.
+std::shared_ptr<asylo::EkepSessionCache> CreateSessionCache(
+    absl::Duration ticket_lifetime) {
+  if (ticket_lifetime <= absl::ZeroDuration()) {
+    return nullptr;
+  }
+  return std::make_shared<asylo::EkepSessionCache>(ticket_lifetime);
+}
+
+}  // namespace
+
 // Creates a grpc_enclave_channel_security_connector object.
 grpc_core::RefCountedPtr<grpc_channel_security_connector>
 grpc_enclave_channel_credentials::create_security_connector(
@@ -54,7 +71,9 @@ grpc_enclave_channel_credentials::grpc_enclave_channel_credentials(
       accepted_peer_assertions(
           std::make_move_iterator(options.accepted_peer_assertions.begin()),
           std::make_move_iterator(options.accepted_peer_assertions.end())),
-      peer_acl(std::move(options.peer_acl)) {}
+      peer_acl(std::move(options.peer_acl)),
+      session_cache(CreateSessionCache(options.session_ticket_lifetime)),
+      max_record_frame_size(options.max_record_frame_size) {}
 
 grpc_enclave_server_credentials::grpc_enclave_server_credentials(
     asylo::EnclaveCredentialsOptions options)
@@ -66,4 +85,6 @@ grpc_enclave_server_credentials::grpc_enclave_server_credentials(
       accepted_peer_assertions(
           std::make_move_iterator(options.accepted_peer_assertions.begin()),
           std::make_move_iterator(options.accepted_peer_assertions.end())),
-      peer_acl(std::move(options.peer_acl)) {}
+      peer_acl(std::move(options.peer_acl)),
+      session_cache(CreateSessionCache(options.session_ticket_lifetime)),
+      max_record_frame_size(options.max_record_frame_size) {}
@@ -19,10 +19,12 @@
 #ifndef ASYLO_GRPC_AUTH_CORE_ENCLAVE_CREDENTIALS_H_
 #define ASYLO_GRPC_AUTH_CORE_ENCLAVE_CREDENTIALS_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "absl/types/optional.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
 #include "asylo/grpc/auth/enclave_credentials_options.h"
 #include "asylo/identity/identity.pb.h"
 #include "asylo/identity/identity_acl.pb.h"
@@ -58,6 +60,13 @@ struct grpc_enclave_channel_credentials final
 
   // Optional ACL enforced on the server's identity.
   absl::optional<asylo::IdentityAclPredicate> peer_acl;
+
+  // Sessions with servers that the client may resume, keyed by server address.
+  // Null if session resumption is disabled.
+  std::shared_ptr<asylo::EkepSessionCache> session_cache;
+
+  // Max record protocol frame size proposed by the client, or 0 if unset.
+  size_t max_record_frame_size;
 };
 
 struct grpc_enclave_server_credentials final : public grpc_server_credentials {
@@ -81,6 +90,13 @@ struct grpc_enclave_server_credentials final : public grpc_server_credentials {
 
   // Optional ACL enforced on the client's identity.
   absl::optional<asylo::IdentityAclPredicate> peer_acl;
+
+  // Sessions with clients that the server may resume, keyed by session ticket.
+  // Null if session resumption is disabled.
+  std::shared_ptr<asylo::EkepSessionCache> session_cache;
+
+  // Max record protocol frame size proposed by the server, or 0 if unset.
+  size_t max_record_frame_size;
 };
 
 #endif  // ASYLO_GRPC_AUTH_CORE_ENCLAVE_CREDENTIALS_H_
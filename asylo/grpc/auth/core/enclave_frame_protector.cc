@@ -0,0 +1,587 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/grpc/auth/core/enclave_frame_protector.h"
+
+#include <openssl/aead.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "asylo/grpc/auth/core/ekep_handshaker.h"
+#include "include/grpc/slice.h"
+#include "include/grpc/slice_buffer.h"
+#include "include/grpc/support/alloc.h"
+#include "include/grpc/support/log.h"
+#include "include/grpc/support/string_util.h"
+#include "src/core/tsi/alts/crypt/gsec.h"
+#include "src/core/tsi/alts/zero_copy_frame_protector/alts_grpc_privacy_integrity_record_protocol.h"
+#include "src/core/tsi/alts/zero_copy_frame_protector/alts_grpc_record_protocol.h"
+#include "src/core/tsi/alts/zero_copy_frame_protector/alts_zero_copy_grpc_protector.h"
+
+namespace asylo {
+namespace {
+
+// The max protected frame size that is used if the caller does not specify one.
+// This matches the default of the ALTS frame protectors.
+constexpr size_t kDefaultRecordFrameSize = 16 * 1024;
+
+// The size of the length field at the start of each ALTS record protocol frame.
+constexpr size_t kFrameLengthFieldSize = 4;
+
+// The number of bytes of the ALTS record protocol counter that may overflow.
+// The counter is used as the AEAD nonce.
+constexpr size_t kCounterOverflowSize = 5;
+
+// --- gsec_aead_crypter implementation. ---
+
+// Implementation of gsec_aead_crypter that uses a BoringSSL EVP_AEAD. The AEAD
+// context is initialized once with the key, so no key schedule is computed per
+// frame.
+//
+// gsec_aead_crypter_destroy() frees the crypter with gpr_free(), so crypters
+// are allocated with gpr_malloc() and destructed in place.
+struct EvpAeadCrypter {
+  gsec_aead_crypter base;
+  bssl::ScopedEVP_AEAD_CTX context;
+  size_t key_length;
+};
+
+grpc_status_code CrypterError(grpc_status_code status, const char *message,
+                              char **error_details) {
+  if (error_details != nullptr) {
+    *error_details = gpr_strdup(message);
+  }
+  return status;
+}
+
+const EVP_AEAD *GetAead(const gsec_aead_crypter *crypter) {
+  return EVP_AEAD_CTX_aead(
+      reinterpret_cast<const EvpAeadCrypter *>(crypter)->context.get());
+}
+
+// Appends the contents of the |vec_length| buffers in |vec| to |output|.
+void AppendIovec(const struct iovec *vec, size_t vec_length,
+                 std::vector<uint8_t> *output) {
+  for (size_t i = 0; i < vec_length; ++i) {
+    const uint8_t *base = static_cast<const uint8_t *>(vec[i].iov_base);
+    output->insert(output->end(), base, base + vec[i].iov_len);
+  }
+}
+
+grpc_status_code evp_aead_crypter_encrypt_iovec(
+    gsec_aead_crypter *crypter, const uint8_t *nonce, size_t nonce_length,
+    const struct iovec *aad_vec, size_t aad_vec_length,
+    const struct iovec *plaintext_vec, size_t plaintext_vec_length,
+    struct iovec ciphertext_vec, size_t *ciphertext_bytes_written,
+    char **error_details) {
+  if (ciphertext_bytes_written == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "ciphertext_bytes_written is nullptr.", error_details);
+  }
+  *ciphertext_bytes_written = 0;
+
+  size_t plaintext_length = 0;
+  for (size_t i = 0; i < plaintext_vec_length; ++i) {
+    plaintext_length += plaintext_vec[i].iov_len;
+  }
+  size_t tag_length = EVP_AEAD_max_overhead(GetAead(crypter));
+  if (ciphertext_vec.iov_len < plaintext_length + tag_length) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "ciphertext is too small to hold a tag.",
+                        error_details);
+  }
+
+  // Gather the plaintext into the ciphertext buffer and seal it in place.
+  uint8_t *out = static_cast<uint8_t *>(ciphertext_vec.iov_base);
+  size_t offset = 0;
+  for (size_t i = 0; i < plaintext_vec_length; ++i) {
+    memcpy(out + offset, plaintext_vec[i].iov_base, plaintext_vec[i].iov_len);
+    offset += plaintext_vec[i].iov_len;
+  }
+  std::vector<uint8_t> aad;
+  AppendIovec(aad_vec, aad_vec_length, &aad);
+
+  EvpAeadCrypter *self = reinterpret_cast<EvpAeadCrypter *>(crypter);
+  size_t out_tag_length = 0;
+  if (!EVP_AEAD_CTX_seal_scatter(
+          self->context.get(), out, out + plaintext_length, &out_tag_length,
+          ciphertext_vec.iov_len - plaintext_length, nonce, nonce_length, out,
+          plaintext_length, /*extra_in=*/nullptr, /*extra_in_len=*/0,
+          aad.data(), aad.size())) {
+    return CrypterError(GRPC_STATUS_INTERNAL, "Encryption failed.",
+                        error_details);
+  }
+  *ciphertext_bytes_written = plaintext_length + out_tag_length;
+  return GRPC_STATUS_OK;
+}
+
+grpc_status_code evp_aead_crypter_decrypt_iovec(
+    gsec_aead_crypter *crypter, const uint8_t *nonce, size_t nonce_length,
+    const struct iovec *aad_vec, size_t aad_vec_length,
+    const struct iovec *ciphertext_vec, size_t ciphertext_vec_length,
+    struct iovec plaintext_vec, size_t *plaintext_bytes_written,
+    char **error_details) {
+  if (plaintext_bytes_written == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "plaintext_bytes_written is nullptr.", error_details);
+  }
+  *plaintext_bytes_written = 0;
+
+  size_t total_length = 0;
+  for (size_t i = 0; i < ciphertext_vec_length; ++i) {
+    total_length += ciphertext_vec[i].iov_len;
+  }
+  size_t tag_length = EVP_AEAD_max_overhead(GetAead(crypter));
+  if (total_length < tag_length) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "ciphertext is too small to hold a tag.",
+                        error_details);
+  }
+  size_t ciphertext_length = total_length - tag_length;
+  if (plaintext_vec.iov_len < ciphertext_length) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "plaintext is too small.", error_details);
+  }
+
+  // Gather the ciphertext into the plaintext buffer and the tag into |tag|, and
+  // open the ciphertext in place.
+  uint8_t *out = static_cast<uint8_t *>(plaintext_vec.iov_base);
+  std::vector<uint8_t> tag(tag_length);
+  size_t offset = 0;
+  for (size_t i = 0; i < ciphertext_vec_length; ++i) {
+    const uint8_t *base =
+        static_cast<const uint8_t *>(ciphertext_vec[i].iov_base);
+    for (size_t consumed = 0; consumed < ciphertext_vec[i].iov_len;) {
+      size_t remaining = ciphertext_vec[i].iov_len - consumed;
+      size_t copy_length;
+      if (offset < ciphertext_length) {
+        copy_length = std::min(remaining, ciphertext_length - offset);
+        memcpy(out + offset, base + consumed, copy_length);
+      } else {
+        copy_length = remaining;
+        memcpy(tag.data() + offset - ciphertext_length, base + consumed,
+               copy_length);
+      }
+      consumed += copy_length;
+      offset += copy_length;
+    }
+  }
+  std::vector<uint8_t> aad;
+  AppendIovec(aad_vec, aad_vec_length, &aad);
+
+  EvpAeadCrypter *self = reinterpret_cast<EvpAeadCrypter *>(crypter);
+  if (!EVP_AEAD_CTX_open_gather(self->context.get(), out, nonce, nonce_length,
+                                out, ciphertext_length, tag.data(), tag.size(),
+                                aad.data(), aad.size())) {
+    memset(out, 0, ciphertext_length);
+    return CrypterError(GRPC_STATUS_INTERNAL, "Checking tag failed.",
+                        error_details);
+  }
+  *plaintext_bytes_written = ciphertext_length;
+  return GRPC_STATUS_OK;
+}
+
+grpc_status_code evp_aead_crypter_max_ciphertext_and_tag_length(
+    const gsec_aead_crypter *crypter, size_t plaintext_length,
+    size_t *max_ciphertext_and_tag_length, char **error_details) {
+  if (max_ciphertext_and_tag_length == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "max_ciphertext_and_tag_length is nullptr.",
+                        error_details);
+  }
+  *max_ciphertext_and_tag_length =
+      plaintext_length + EVP_AEAD_max_overhead(GetAead(crypter));
+  return GRPC_STATUS_OK;
+}
+
+grpc_status_code evp_aead_crypter_max_plaintext_length(
+    const gsec_aead_crypter *crypter, size_t ciphertext_and_tag_length,
+    size_t *max_plaintext_length, char **error_details) {
+  if (max_plaintext_length == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "max_plaintext_length is nullptr.", error_details);
+  }
+  size_t tag_length = EVP_AEAD_max_overhead(GetAead(crypter));
+  if (ciphertext_and_tag_length < tag_length) {
+    *max_plaintext_length = 0;
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "ciphertext_and_tag_length is smaller than tag_length.",
+                        error_details);
+  }
+  *max_plaintext_length = ciphertext_and_tag_length - tag_length;
+  return GRPC_STATUS_OK;
+}
+
+grpc_status_code evp_aead_crypter_nonce_length(
+    const gsec_aead_crypter *crypter, size_t *nonce_length,
+    char **error_details) {
+  if (nonce_length == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT,
+                        "nonce_length is nullptr.", error_details);
+  }
+  *nonce_length = EVP_AEAD_nonce_length(GetAead(crypter));
+  return GRPC_STATUS_OK;
+}
+
+grpc_status_code evp_aead_crypter_key_length(const gsec_aead_crypter *crypter,
+                                             size_t *key_length,
+                                             char **error_details) {
+  if (key_length == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT, "key_length is nullptr.",
+                        error_details);
+  }
+  *key_length = reinterpret_cast<const EvpAeadCrypter *>(crypter)->key_length;
+  return GRPC_STATUS_OK;
+}
+
+grpc_status_code evp_aead_crypter_tag_length(const gsec_aead_crypter *crypter,
+                                             size_t *tag_length,
+                                             char **error_details) {
+  if (tag_length == nullptr) {
+    return CrypterError(GRPC_STATUS_INVALID_ARGUMENT, "tag_length is nullptr.",
+                        error_details);
+  }
+  *tag_length = EVP_AEAD_max_overhead(GetAead(crypter));
+  return GRPC_STATUS_OK;
+}
+
+void evp_aead_crypter_destruct(gsec_aead_crypter *crypter) {
+  reinterpret_cast<EvpAeadCrypter *>(crypter)->~EvpAeadCrypter();
+}
+
+const gsec_aead_crypter_vtable evp_aead_crypter_vtable = {
+    evp_aead_crypter_encrypt_iovec,
+    evp_aead_crypter_decrypt_iovec,
+    evp_aead_crypter_max_ciphertext_and_tag_length,
+    evp_aead_crypter_max_plaintext_length,
+    evp_aead_crypter_nonce_length,
+    evp_aead_crypter_key_length,
+    evp_aead_crypter_tag_length,
+    evp_aead_crypter_destruct,
+};
+
+// Creates a gsec_aead_crypter that uses |aead| with the |key_size|-byte |key|,
+// and places the result in |crypter|.
+tsi_result evp_aead_crypter_create(const EVP_AEAD *aead, const uint8_t *key,
+                                   size_t key_size,
+                                   gsec_aead_crypter **crypter) {
+  if (key_size != EVP_AEAD_key_length(aead)) {
+    gpr_log(GPR_ERROR, "Invalid record protocol key size: %zu", key_size);
+    return TSI_INVALID_ARGUMENT;
+  }
+  EvpAeadCrypter *evp_crypter =
+      new (gpr_malloc(sizeof(EvpAeadCrypter))) EvpAeadCrypter();
+  evp_crypter->base.vtable = &evp_aead_crypter_vtable;
+  evp_crypter->key_length = key_size;
+  if (!EVP_AEAD_CTX_init(evp_crypter->context.get(), aead, key, key_size,
+                         EVP_AEAD_DEFAULT_TAG_LENGTH, /*impl=*/nullptr)) {
+    gsec_aead_crypter_destroy(&evp_crypter->base);
+    return TSI_INTERNAL_ERROR;
+  }
+  *crypter = &evp_crypter->base;
+  return TSI_OK;
+}
+
+// Creates an ALTS record protocol object that protects (if |is_protect| is
+// true) or unprotects frames using |aead| with the |key_size|-byte |key|, and
+// places the result in |record_protocol|.
+tsi_result create_record_protocol(const EVP_AEAD *aead, const uint8_t *key,
+                                  size_t key_size, bool is_client,
+                                  bool is_protect,
+                                  alts_grpc_record_protocol **record_protocol) {
+  gsec_aead_crypter *crypter = nullptr;
+  tsi_result result = evp_aead_crypter_create(aead, key, key_size, &crypter);
+  if (result != TSI_OK) {
+    return result;
+  }
+  result = alts_grpc_privacy_integrity_record_protocol_create(
+      crypter, kCounterOverflowSize, is_client, is_protect, record_protocol);
+  if (result != TSI_OK) {
+    gsec_aead_crypter_destroy(crypter);
+  }
+  return result;
+}
+
+}  // namespace
+
+// --- tsi_zero_copy_grpc_protector implementation. ---
+
+// C++ implementation of a zero-copy gRPC frame protector that uses the ALTS
+// record protocol frame format. Protection of individual frames is delegated to
+// ALTS record protocol objects.
+class EnclaveZeroCopyGrpcProtector {
+ public:
+  EnclaveZeroCopyGrpcProtector(alts_grpc_record_protocol *record_protocol,
+                               alts_grpc_record_protocol *unrecord_protocol,
+                               size_t max_protected_frame_size)
+      : record_protocol_(record_protocol),
+        unrecord_protocol_(unrecord_protocol),
+        max_protected_frame_size_(max_protected_frame_size),
+        max_unprotected_data_size_(
+            alts_grpc_record_protocol_max_unprotected_data_size(
+                record_protocol, max_protected_frame_size)),
+        parsed_frame_size_(0) {
+    grpc_slice_buffer_init(&unprotected_staging_sb_);
+    grpc_slice_buffer_init(&protected_sb_);
+    grpc_slice_buffer_init(&protected_staging_sb_);
+  }
+
+  EnclaveZeroCopyGrpcProtector(const EnclaveZeroCopyGrpcProtector &) = delete;
+  EnclaveZeroCopyGrpcProtector &operator=(
+      const EnclaveZeroCopyGrpcProtector &) = delete;
+
+  ~EnclaveZeroCopyGrpcProtector() {
+    alts_grpc_record_protocol_destroy(record_protocol_);
+    alts_grpc_record_protocol_destroy(unrecord_protocol_);
+    grpc_slice_buffer_destroy(&unprotected_staging_sb_);
+    grpc_slice_buffer_destroy(&protected_sb_);
+    grpc_slice_buffer_destroy(&protected_staging_sb_);
+  }
+
+  // Protects all data in |unprotected_slices|, splitting it into frames of at
+  // most the max protected frame size, and appends the frames to
+  // |protected_slices|.
+  tsi_result Protect(grpc_slice_buffer *unprotected_slices,
+                     grpc_slice_buffer *protected_slices) {
+    while (unprotected_slices->length > max_unprotected_data_size_) {
+      grpc_slice_buffer_move_first(unprotected_slices,
+                                   max_unprotected_data_size_,
+                                   &unprotected_staging_sb_);
+      tsi_result result = alts_grpc_record_protocol_protect(
+          record_protocol_, &unprotected_staging_sb_, protected_slices);
+      if (result != TSI_OK) {
+        return result;
+      }
+    }
+    return alts_grpc_record_protocol_protect(
+        record_protocol_, unprotected_slices, protected_slices);
+  }
+
+  // Buffers the data in |protected_slices| and unprotects every complete frame
+  // into |unprotected_slices|. Data of incomplete frames remains buffered until
+  // the rest of the frame arrives.
+  tsi_result Unprotect(grpc_slice_buffer *protected_slices,
+                       grpc_slice_buffer *unprotected_slices) {
+    grpc_slice_buffer_move_into(protected_slices, &protected_sb_);
+    uint32_t frame_size = 0;
+    while (protected_sb_.length >= kFrameLengthFieldSize) {
+      if (!ReadFrameSize(&frame_size)) {
+        grpc_slice_buffer_reset_and_unref(&protected_sb_);
+        return TSI_DATA_CORRUPTED;
+      }
+      if (protected_sb_.length < frame_size) {
+        break;
+      }
+      grpc_slice_buffer_move_first(&protected_sb_, frame_size,
+                                   &protected_staging_sb_);
+      parsed_frame_size_ = 0;
+      tsi_result result = alts_grpc_record_protocol_unprotect(
+          unrecord_protocol_, &protected_staging_sb_, unprotected_slices);
+      if (result != TSI_OK) {
+        grpc_slice_buffer_reset_and_unref(&protected_sb_);
+        return result;
+      }
+    }
+    return TSI_OK;
+  }
+
+  size_t max_protected_frame_size() const { return max_protected_frame_size_; }
+
+ private:
+  // Sets |frame_size| to the total size of the next frame in |protected_sb_|,
+  // including its length field. Returns false if the frame is not a valid ALTS
+  // record protocol frame or is larger than the largest supported frame.
+  bool ReadFrameSize(uint32_t *frame_size) {
+    if (parsed_frame_size_ != 0) {
+      *frame_size = parsed_frame_size_;
+      return true;
+    }
+    uint8_t length_field[kFrameLengthFieldSize];
+    size_t offset = 0;
+    for (size_t i = 0; i < protected_sb_.count && offset < sizeof(length_field);
+         ++i) {
+      size_t copy_length = std::min(GRPC_SLICE_LENGTH(protected_sb_.slices[i]),
+                                    sizeof(length_field) - offset);
+      memcpy(length_field + offset,
+             GRPC_SLICE_START_PTR(protected_sb_.slices[i]), copy_length);
+      offset += copy_length;
+    }
+    uint32_t frame_length = static_cast<uint32_t>(length_field[0]) |
+                            static_cast<uint32_t>(length_field[1]) << 8 |
+                            static_cast<uint32_t>(length_field[2]) << 16 |
+                            static_cast<uint32_t>(length_field[3]) << 24;
+
+    // Peers that did not negotiate a frame size may use any frame size that the
+    // record protocol supports, so the largest supported frame is accepted.
+    if (frame_length == 0 ||
+        frame_length >
+            EkepHandshaker::kMaxRecordFrameSize - kFrameLengthFieldSize) {
+      gpr_log(GPR_ERROR, "Invalid record protocol frame length: %u",
+              frame_length);
+      return false;
+    }
+    parsed_frame_size_ = frame_length + kFrameLengthFieldSize;
+    *frame_size = parsed_frame_size_;
+    return true;
+  }
+
+  // Record protocol objects for protecting and unprotecting frames.
+  alts_grpc_record_protocol *record_protocol_;
+  alts_grpc_record_protocol *unrecord_protocol_;
+
+  // The max size of a protected frame, and the max amount of data that fits in
+  // a frame of that size.
+  const size_t max_protected_frame_size_;
+  const size_t max_unprotected_data_size_;
+
+  // Staging buffer for the data of a single frame that is being protected.
+  grpc_slice_buffer unprotected_staging_sb_;
+
+  // Buffer for protected data that has not been unprotected yet, and staging
+  // buffer for a single frame that is being unprotected.
+  grpc_slice_buffer protected_sb_;
+  grpc_slice_buffer protected_staging_sb_;
+
+  // The size of the frame at the start of |protected_sb_|, or 0 if it has not
+  // been parsed yet.
+  uint32_t parsed_frame_size_;
+};
+
+// Implementation of tsi_zero_copy_grpc_protector that delegates all calls to an
+// EnclaveZeroCopyGrpcProtector object.
+struct tsi_enclave_zero_copy_grpc_protector {
+  tsi_zero_copy_grpc_protector base;
+  std::unique_ptr<EnclaveZeroCopyGrpcProtector> impl;
+};
+
+tsi_result enclave_zero_copy_grpc_protector_protect(
+    tsi_zero_copy_grpc_protector *self, grpc_slice_buffer *unprotected_slices,
+    grpc_slice_buffer *protected_slices) {
+  if (self == nullptr || unprotected_slices == nullptr ||
+      protected_slices == nullptr) {
+    return TSI_INVALID_ARGUMENT;
+  }
+  tsi_enclave_zero_copy_grpc_protector *protector =
+      reinterpret_cast<tsi_enclave_zero_copy_grpc_protector *>(self);
+  return protector->impl->Protect(unprotected_slices, protected_slices);
+}
+
+tsi_result enclave_zero_copy_grpc_protector_unprotect(
+    tsi_zero_copy_grpc_protector *self, grpc_slice_buffer *protected_slices,
+    grpc_slice_buffer *unprotected_slices) {
+  if (self == nullptr || protected_slices == nullptr ||
+      unprotected_slices == nullptr) {
+    return TSI_INVALID_ARGUMENT;
+  }
+  tsi_enclave_zero_copy_grpc_protector *protector =
+      reinterpret_cast<tsi_enclave_zero_copy_grpc_protector *>(self);
+  return protector->impl->Unprotect(protected_slices, unprotected_slices);
+}
+
+void enclave_zero_copy_grpc_protector_destroy(
+    tsi_zero_copy_grpc_protector *self) {
+  tsi_enclave_zero_copy_grpc_protector *protector =
+      reinterpret_cast<tsi_enclave_zero_copy_grpc_protector *>(self);
+  delete protector;
+}
+
+tsi_result enclave_zero_copy_grpc_protector_max_frame_size(
+    tsi_zero_copy_grpc_protector *self, size_t *max_frame_size) {
+  if (self == nullptr || max_frame_size == nullptr) {
+    return TSI_INVALID_ARGUMENT;
+  }
+  tsi_enclave_zero_copy_grpc_protector *protector =
+      reinterpret_cast<tsi_enclave_zero_copy_grpc_protector *>(self);
+  *max_frame_size = protector->impl->max_protected_frame_size();
+  return TSI_OK;
+}
+
+const tsi_zero_copy_grpc_protector_vtable zero_copy_grpc_protector_vtable = {
+    enclave_zero_copy_grpc_protector_protect,
+    enclave_zero_copy_grpc_protector_unprotect,
+    enclave_zero_copy_grpc_protector_destroy,
+    enclave_zero_copy_grpc_protector_max_frame_size,
+};
+
+}  // namespace asylo
+
+tsi_result tsi_enclave_zero_copy_grpc_protector_create(
+    asylo::RecordProtocol record_protocol, const uint8_t *key, size_t key_size,
+    bool is_client, size_t *max_protected_frame_size,
+    tsi_zero_copy_grpc_protector **protector) {
+  if (key == nullptr || protector == nullptr) {
+    return TSI_INVALID_ARGUMENT;
+  }
+
+  const EVP_AEAD *aead = nullptr;
+  switch (record_protocol) {
+    case asylo::ALTSRP_AES128_GCM:
+      return alts_zero_copy_grpc_protector_create(
+          key, key_size, /*is_rekey=*/false, is_client,
+          /*is_integrity_only=*/false, /*enable_extra_copy=*/false,
+          max_protected_frame_size, protector);
+    case asylo::ALTSRP_AES256_GCM:
+      aead = EVP_aead_aes_256_gcm();
+      break;
+    case asylo::ALTSRP_CHACHA20_POLY1305:
+      aead = EVP_aead_chacha20_poly1305();
+      break;
+    default:
+      gpr_log(GPR_ERROR, "Unsupported record protocol: %d", record_protocol);
+      return TSI_UNIMPLEMENTED;
+  }
+
+  size_t frame_size = asylo::kDefaultRecordFrameSize;
+  if (max_protected_frame_size != nullptr) {
+    frame_size = std::min(
+        std::max(*max_protected_frame_size,
+                 asylo::EkepHandshaker::kMinRecordFrameSize),
+        asylo::EkepHandshaker::kMaxRecordFrameSize);
+    *max_protected_frame_size = frame_size;
+  }
+
+  alts_grpc_record_protocol *record_protocol_object = nullptr;
+  tsi_result result = asylo::create_record_protocol(
+      aead, key, key_size, is_client, /*is_protect=*/true,
+      &record_protocol_object);
+  if (result != TSI_OK) {
+    return result;
+  }
+  alts_grpc_record_protocol *unrecord_protocol_object = nullptr;
+  result = asylo::create_record_protocol(aead, key, key_size, is_client,
+                                         /*is_protect=*/false,
+                                         &unrecord_protocol_object);
+  if (result != TSI_OK) {
+    alts_grpc_record_protocol_destroy(record_protocol_object);
+    return result;
+  }
+
+  asylo::tsi_enclave_zero_copy_grpc_protector *enclave_protector =
+      new asylo::tsi_enclave_zero_copy_grpc_protector();
+  enclave_protector->base.vtable = &asylo::zero_copy_grpc_protector_vtable;
+  enclave_protector->impl =
+      absl::make_unique<asylo::EnclaveZeroCopyGrpcProtector>(
+          record_protocol_object, unrecord_protocol_object, frame_size);
+  *protector = &enclave_protector->base;
+  return TSI_OK;
+}
@@ -0,0 +1,51 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_GRPC_AUTH_CORE_ENCLAVE_FRAME_PROTECTOR_H_
+#define ASYLO_GRPC_AUTH_CORE_ENCLAVE_FRAME_PROTECTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "asylo/grpc/auth/core/handshake.pb.h"
+#include "src/core/tsi/transport_security_grpc.h"
+
+// Creates a zero-copy gRPC frame protector that protects frames using
+// |record_protocol| with the |key_size|-byte |key|, and places the result in
+// |protector|. |is_client| indicates whether the protector is used by the
+// client or the server of the channel.
+//
+// All record protocols use the ALTS record protocol frame format. Frames are
+// protected in place in the slices that gRPC passes to the protector, without
+// being copied into an intermediate frame buffer. ALTSRP_AES128_GCM frames are
+// protected by the ALTS zero-copy frame protector. ALTSRP_AES256_GCM and
+// ALTSRP_CHACHA20_POLY1305 frames are protected with BoringSSL AEADs, which use
+// hardware acceleration where the platform supports it.
+//
+// If |max_protected_frame_size| is non-null, it specifies the maximum size of a
+// protected frame. The size is clamped to the range
+// [asylo::EkepHandshaker::kMinRecordFrameSize,
+// asylo::EkepHandshaker::kMaxRecordFrameSize], and |max_protected_frame_size|
+// is set to the size that is used. Otherwise, a default frame size of 16 KB is
+// used.
+tsi_result tsi_enclave_zero_copy_grpc_protector_create(
+    asylo::RecordProtocol record_protocol, const uint8_t *key, size_t key_size,
+    bool is_client, size_t *max_protected_frame_size,
+    tsi_zero_copy_grpc_protector **protector);
+
+#endif  // ASYLO_GRPC_AUTH_CORE_ENCLAVE_FRAME_PROTECTOR_H_
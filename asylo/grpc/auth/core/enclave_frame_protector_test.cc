@@ -0,0 +1,315 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/grpc/auth/core/enclave_frame_protector.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "asylo/grpc/auth/core/ekep_handshaker.h"
+#include "asylo/grpc/auth/core/handshake.pb.h"
+#include "include/grpc/grpc.h"
+#include "include/grpc/slice.h"
+#include "include/grpc/slice_buffer.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Ne;
+using ::testing::Values;
+
+constexpr size_t kKeySize = 32;
+constexpr size_t kAes128KeySize = 16;
+
+// Returns the key size used by |record_protocol|.
+size_t KeySize(RecordProtocol record_protocol) {
+  return record_protocol == ALTSRP_AES128_GCM ? kAes128KeySize : kKeySize;
+}
+
+// Returns a message of |size| bytes.
+std::string MakeMessage(size_t size) {
+  std::string message(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    message[i] = static_cast<char>(i % 251);
+  }
+  return message;
+}
+
+// Appends |data| to |buffer| in slices of at most |slice_size| bytes.
+void AppendSlices(const std::string &data, size_t slice_size,
+                  grpc_slice_buffer *buffer) {
+  for (size_t offset = 0; offset < data.size(); offset += slice_size) {
+    size_t length = std::min(slice_size, data.size() - offset);
+    grpc_slice_buffer_add(
+        buffer, grpc_slice_from_copied_buffer(data.data() + offset, length));
+  }
+}
+
+// Returns the contents of |buffer|.
+std::string SliceBufferToString(const grpc_slice_buffer &buffer) {
+  std::string data;
+  for (size_t i = 0; i < buffer.count; ++i) {
+    data.append(
+        reinterpret_cast<const char *>(GRPC_SLICE_START_PTR(buffer.slices[i])),
+        GRPC_SLICE_LENGTH(buffer.slices[i]));
+  }
+  return data;
+}
+
+// A client and a server frame protector that share a record protocol key.
+class ProtectorPair {
+ public:
+  ProtectorPair() = default;
+
+  ~ProtectorPair() {
+    tsi_zero_copy_grpc_protector_destroy(client_);
+    tsi_zero_copy_grpc_protector_destroy(server_);
+  }
+
+  // Creates the protectors. The client uses |client_record_protocol| and the
+  // server uses |server_record_protocol|. Both use a max frame size of
+  // |frame_size|.
+  tsi_result Create(RecordProtocol client_record_protocol,
+                    RecordProtocol server_record_protocol, size_t frame_size) {
+    std::vector<uint8_t> key(KeySize(client_record_protocol), 0x5a);
+    size_t client_frame_size = frame_size;
+    tsi_result result = tsi_enclave_zero_copy_grpc_protector_create(
+        client_record_protocol, key.data(), key.size(), /*is_client=*/true,
+        &client_frame_size, &client_);
+    if (result != TSI_OK) {
+      return result;
+    }
+    key.resize(KeySize(server_record_protocol), 0x5a);
+    size_t server_frame_size = frame_size;
+    return tsi_enclave_zero_copy_grpc_protector_create(
+        server_record_protocol, key.data(), key.size(), /*is_client=*/false,
+        &server_frame_size, &server_);
+  }
+
+  tsi_zero_copy_grpc_protector *client() { return client_; }
+  tsi_zero_copy_grpc_protector *server() { return server_; }
+
+ private:
+  tsi_zero_copy_grpc_protector *client_ = nullptr;
+  tsi_zero_copy_grpc_protector *server_ = nullptr;
+};
+
+// Protects |message| with |sender| and unprotects the result with |receiver|,
+// delivering the protected data in slices of |slice_size| bytes. Places the
+// unprotected data in |received|.
+tsi_result RoundTrip(const std::string &message, size_t slice_size,
+                     tsi_zero_copy_grpc_protector *sender,
+                     tsi_zero_copy_grpc_protector *receiver,
+                     std::string *received) {
+  grpc_slice_buffer unprotected;
+  grpc_slice_buffer protected_data;
+  grpc_slice_buffer delivered;
+  grpc_slice_buffer output;
+  grpc_slice_buffer_init(&unprotected);
+  grpc_slice_buffer_init(&protected_data);
+  grpc_slice_buffer_init(&delivered);
+  grpc_slice_buffer_init(&output);
+
+  AppendSlices(message, message.size() + 1, &unprotected);
+  tsi_result result = tsi_zero_copy_grpc_protector_protect(
+      sender, &unprotected, &protected_data);
+  if (result == TSI_OK) {
+    AppendSlices(SliceBufferToString(protected_data), slice_size, &delivered);
+    result =
+        tsi_zero_copy_grpc_protector_unprotect(receiver, &delivered, &output);
+    *received = SliceBufferToString(output);
+  }
+
+  grpc_slice_buffer_destroy(&unprotected);
+  grpc_slice_buffer_destroy(&protected_data);
+  grpc_slice_buffer_destroy(&delivered);
+  grpc_slice_buffer_destroy(&output);
+  return result;
+}
+
+class EnclaveFrameProtectorTest
+    : public ::testing::TestWithParam<RecordProtocol> {
+ protected:
+  static void SetUpTestSuite() { grpc_init(); }
+  static void TearDownTestSuite() { grpc_shutdown(); }
+};
+
+// Verifies that messages protected by one side are unprotected by the other,
+// including messages that span several frames.
+TEST_P(EnclaveFrameProtectorTest, RoundTrip) {
+  ProtectorPair protectors;
+  ASSERT_THAT(protectors.Create(GetParam(), GetParam(),
+                                EkepHandshaker::kMinRecordFrameSize),
+              Eq(TSI_OK));
+
+  for (size_t size : {1, 1000, 100000}) {
+    std::string message = MakeMessage(size);
+    std::string received;
+    EXPECT_THAT(RoundTrip(message, message.size(), protectors.client(),
+                          protectors.server(), &received),
+                Eq(TSI_OK));
+    EXPECT_THAT(received, Eq(message));
+    EXPECT_THAT(RoundTrip(message, message.size(), protectors.server(),
+                          protectors.client(), &received),
+                Eq(TSI_OK));
+    EXPECT_THAT(received, Eq(message));
+  }
+}
+
+// Verifies that frames split across many small slices are reassembled.
+TEST_P(EnclaveFrameProtectorTest, RoundTripInSmallSlices) {
+  ProtectorPair protectors;
+  ASSERT_THAT(protectors.Create(GetParam(), GetParam(),
+                                EkepHandshaker::kMinRecordFrameSize),
+              Eq(TSI_OK));
+
+  std::string message = MakeMessage(5000);
+  std::string received;
+  EXPECT_THAT(RoundTrip(message, /*slice_size=*/3, protectors.client(),
+                        protectors.server(), &received),
+              Eq(TSI_OK));
+  EXPECT_THAT(received, Eq(message));
+}
+
+// Verifies that a modified frame fails to unprotect.
+TEST_P(EnclaveFrameProtectorTest, TamperedFrameFails) {
+  ProtectorPair protectors;
+  ASSERT_THAT(protectors.Create(GetParam(), GetParam(),
+                                EkepHandshaker::kMinRecordFrameSize),
+              Eq(TSI_OK));
+
+  grpc_slice_buffer unprotected;
+  grpc_slice_buffer protected_data;
+  grpc_slice_buffer output;
+  grpc_slice_buffer_init(&unprotected);
+  grpc_slice_buffer_init(&protected_data);
+  grpc_slice_buffer_init(&output);
+
+  AppendSlices(MakeMessage(100), 100, &unprotected);
+  ASSERT_THAT(tsi_zero_copy_grpc_protector_protect(
+                  protectors.client(), &unprotected, &protected_data),
+              Eq(TSI_OK));
+  std::string frame = SliceBufferToString(protected_data);
+  frame[frame.size() / 2] ^= 1;
+  grpc_slice_buffer_reset_and_unref(&protected_data);
+  AppendSlices(frame, frame.size(), &protected_data);
+  EXPECT_THAT(tsi_zero_copy_grpc_protector_unprotect(
+                  protectors.server(), &protected_data, &output),
+              Ne(TSI_OK));
+
+  grpc_slice_buffer_destroy(&unprotected);
+  grpc_slice_buffer_destroy(&protected_data);
+  grpc_slice_buffer_destroy(&output);
+}
+
+// Verifies that the max frame size is clamped to the supported range.
+TEST_P(EnclaveFrameProtectorTest, MaxFrameSizeIsClamped) {
+  std::vector<uint8_t> key(KeySize(GetParam()), 0x5a);
+  for (size_t requested : {size_t{1}, size_t{1} << 30}) {
+    size_t frame_size = requested;
+    tsi_zero_copy_grpc_protector *protector = nullptr;
+    ASSERT_THAT(tsi_enclave_zero_copy_grpc_protector_create(
+                    GetParam(), key.data(), key.size(), /*is_client=*/true,
+                    &frame_size, &protector),
+                Eq(TSI_OK));
+    EXPECT_THAT(frame_size, Eq(requested == 1
+                                   ? EkepHandshaker::kMinRecordFrameSize
+                                   : EkepHandshaker::kMaxRecordFrameSize));
+
+    size_t protector_frame_size = 0;
+    EXPECT_THAT(tsi_zero_copy_grpc_protector_max_frame_size(
+                    protector, &protector_frame_size),
+                Eq(TSI_OK));
+    EXPECT_THAT(protector_frame_size, Eq(frame_size));
+    tsi_zero_copy_grpc_protector_destroy(protector);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(AllRecordProtocols, EnclaveFrameProtectorTest,
+                         Values(ALTSRP_AES128_GCM, ALTSRP_AES256_GCM,
+                                ALTSRP_CHACHA20_POLY1305));
+
+// Verifies that peers that use different record protocols cannot communicate.
+TEST(EnclaveFrameProtectorErrorTest, MismatchedRecordProtocolsFail) {
+  grpc_init();
+  {
+    ProtectorPair protectors;
+    ASSERT_THAT(protectors.Create(ALTSRP_AES256_GCM, ALTSRP_CHACHA20_POLY1305,
+                                  EkepHandshaker::kMinRecordFrameSize),
+                Eq(TSI_OK));
+    std::string received;
+    EXPECT_THAT(RoundTrip(MakeMessage(100), 100, protectors.client(),
+                          protectors.server(), &received),
+                Ne(TSI_OK));
+  }
+  grpc_shutdown();
+}
+
+// Verifies that a key of the wrong size is rejected.
+TEST(EnclaveFrameProtectorErrorTest, BadKeySizeFails) {
+  std::vector<uint8_t> key(kAes128KeySize, 0x5a);
+  tsi_zero_copy_grpc_protector *protector = nullptr;
+  EXPECT_THAT(tsi_enclave_zero_copy_grpc_protector_create(
+                  ALTSRP_CHACHA20_POLY1305, key.data(), key.size(),
+                  /*is_client=*/true, /*max_protected_frame_size=*/nullptr,
+                  &protector),
+              Ne(TSI_OK));
+}
+
+// Measures the throughput of protecting and unprotecting 1 MB of data with the
+// record protocol in the first argument and the max frame size in the second
+// argument.
+void BM_ProtectUnprotect(benchmark::State &state) {
+  grpc_init();
+  {
+    ProtectorPair protectors;
+    if (protectors.Create(static_cast<RecordProtocol>(state.range(0)),
+                          static_cast<RecordProtocol>(state.range(0)),
+                          state.range(1)) != TSI_OK) {
+      state.SkipWithError("Failed to create frame protectors");
+    } else {
+      std::string message = MakeMessage(1024 * 1024);
+      std::string received;
+      for (auto _ : state) {
+        if (RoundTrip(message, message.size(), protectors.client(),
+                      protectors.server(), &received) != TSI_OK) {
+          state.SkipWithError("Round trip failed");
+          break;
+        }
+      }
+      state.SetBytesProcessed(state.iterations() * message.size());
+    }
+  }
+  grpc_shutdown();
+}
+BENCHMARK(BM_ProtectUnprotect)
+    ->Args({ALTSRP_AES128_GCM, 16 * 1024})
+    ->Args({ALTSRP_AES128_GCM, 1024 * 1024})
+    ->Args({ALTSRP_AES256_GCM, 16 * 1024})
+    ->Args({ALTSRP_AES256_GCM, 1024 * 1024})
+    ->Args({ALTSRP_CHACHA20_POLY1305, 16 * 1024})
+    ->Args({ALTSRP_CHACHA20_POLY1305, 1024 * 1024});
+
+}  // namespace
+}  // namespace asylo
@@ -189,7 +189,8 @@ class grpc_enclave_channel_security_connector final
         /*is_client=*/true, absl::MakeSpan(channel_creds->self_assertions),
         absl::MakeSpan(channel_creds->accepted_peer_assertions),
         channel_creds->additional_authenticated_data, channel_creds->peer_acl,
-        &tsi_handshaker);
+        channel_creds->session_cache, target_,
+        channel_creds->max_record_frame_size, &tsi_handshaker);
     if (result != TSI_OK) {
       gpr_log(GPR_ERROR, "Enclave handshaker creation failed with error %s.",
               tsi_result_to_string(result));
@@ -239,7 +240,8 @@ class grpc_enclave_server_security_connector final
         /*is_client=*/false, absl::MakeSpan(server_creds->self_assertions),
         absl::MakeSpan(server_creds->accepted_peer_assertions),
         server_creds->additional_authenticated_data, server_creds->peer_acl,
-        &tsi_handshaker);
+        server_creds->session_cache, /*session_cache_key=*/"",
+        server_creds->max_record_frame_size, &tsi_handshaker);
     if (result != TSI_OK) {
       gpr_log(GPR_ERROR, "Enclave handshaker creation failed with error %s.",
               tsi_result_to_string(result));
@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <google/protobuf/io/coded_stream.h>
@@ -31,6 +32,8 @@
 #include "asylo/grpc/auth/core/client_ekep_handshaker.h"
 #include "asylo/grpc/auth/core/ekep_handshaker.h"
 #include "asylo/grpc/auth/core/ekep_handshaker_util.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
+#include "asylo/grpc/auth/core/enclave_frame_protector.h"
 #include "asylo/grpc/auth/core/handshake.pb.h"
 #include "asylo/grpc/auth/core/server_ekep_handshaker.h"
 #include "asylo/identity/delegating_identity_expectation_matcher.h"
@@ -44,6 +47,7 @@
 #include "src/core/lib/surface/api_trace.h"
 #include "src/core/tsi/alts/frame_protector/alts_frame_protector.h"
 #include "src/core/tsi/transport_security.h"
+#include "src/core/tsi/transport_security_grpc.h"
 #include "src/core/tsi/transport_security_interface.h"
 
 namespace asylo {
@@ -51,6 +55,28 @@ namespace {
 
 constexpr int kEnclavePeerPropertyCount = 4;
 
+// Returns the max frame size to pass to a frame protector, given the
+// |max_record_frame_size| negotiated during the handshake and the
+// |max_output_protected_frame_size| requested by gRPC, which may be null. If no
+// frame size was negotiated, the requested frame size is used. Otherwise, the
+// requested frame size is bounded by the negotiated frame size, and the
+// negotiated frame size, stored in |negotiated_frame_size|, is used if gRPC did
+// not request a frame size.
+size_t *BoundFrameSize(size_t max_record_frame_size,
+                       size_t *max_output_protected_frame_size,
+                       size_t *negotiated_frame_size) {
+  if (max_record_frame_size == 0) {
+    return max_output_protected_frame_size;
+  }
+  if (max_output_protected_frame_size == nullptr) {
+    *negotiated_frame_size = max_record_frame_size;
+    return negotiated_frame_size;
+  }
+  *max_output_protected_frame_size =
+      std::min(*max_output_protected_frame_size, max_record_frame_size);
+  return max_output_protected_frame_size;
+}
+
 }  // namespace
 
 // --- tsi_handshaker_result implementation. ---
@@ -61,25 +87,51 @@ class TsiEnclaveHandshakerResult {
   TsiEnclaveHandshakerResult(
       bool is_client, RecordProtocol record_protocol,
       const CleansingVector<uint8_t> &record_protocol_key,
+      size_t max_record_frame_size,
       std::unique_ptr<EnclaveIdentities> peer_identities,
       std::string unused_bytes)
       : is_client_(is_client),
         record_protocol_(record_protocol),
         record_protocol_key_(record_protocol_key),
+        max_record_frame_size_(max_record_frame_size),
         peer_identities_(std::move(peer_identities)),
         unused_bytes_(std::move(unused_bytes)) {}
 
+  // Creates a zero-copy frame protector that uses a max frame size of
+  // |max_output_protected_frame_size|, if non-null, bounded by the negotiated
+  // max frame size, and places the result in |protector|.
+  tsi_result CreateZeroCopyGrpcProtector(
+      size_t *max_output_protected_frame_size,
+      tsi_zero_copy_grpc_protector **protector) {
+    size_t negotiated_frame_size = 0;
+    return tsi_enclave_zero_copy_grpc_protector_create(
+        record_protocol_, record_protocol_key_.data(),
+        record_protocol_key_.size(), is_client_,
+        BoundFrameSize(max_record_frame_size_, max_output_protected_frame_size,
+                       &negotiated_frame_size),
+        protector);
+  }
+
   // Creates a frame protector that uses a max frame size of
-  // |max_output_protected_frame_size|, if non-null, and places the result in
-  // |protector|.
+  // |max_output_protected_frame_size|, if non-null, bounded by the negotiated
+  // max frame size, and places the result in |protector|. Only
+  // ALTSRP_AES128_GCM is supported by this frame protector, since gRPC prefers
+  // the zero-copy frame protector.
   tsi_result CreateFrameProtector(size_t *max_output_protected_frame_size,
                                   tsi_frame_protector **protector) {
+    size_t negotiated_frame_size = 0;
     switch (record_protocol_) {
       case ALTSRP_AES128_GCM:
         return alts_create_frame_protector(
             record_protocol_key_.data(), record_protocol_key_.size(),
-            is_client_, /*is_rekey=*/false, max_output_protected_frame_size,
+            is_client_, /*is_rekey=*/false,
+            BoundFrameSize(max_record_frame_size_,
+                           max_output_protected_frame_size,
+                           &negotiated_frame_size),
             protector);
+      case ALTSRP_AES256_GCM:
+      case ALTSRP_CHACHA20_POLY1305:
+        return TSI_UNIMPLEMENTED;
       default:
         return TSI_INTERNAL_ERROR;
     }
@@ -163,6 +215,10 @@ class TsiEnclaveHandshakerResult {
   // The record protocol key to use for frame protection.
   CleansingVector<uint8_t> record_protocol_key_;
 
+  // The max frame size negotiated during the handshake, or 0 if none was
+  // negotiated.
+  size_t max_record_frame_size_;
+
   // The peer's enclave identities.
   std::unique_ptr<EnclaveIdentities> peer_identities_;
 
@@ -185,6 +241,16 @@ tsi_result enclave_handshaker_result_extract_peer(
   return result->impl->ExtractPeer(peer);
 }
 
+tsi_result enclave_handshaker_result_create_zero_copy_grpc_protector(
+    const tsi_handshaker_result *self, size_t *max_output_protected_frame_size,
+    tsi_zero_copy_grpc_protector **protector) {
+  const tsi_enclave_handshaker_result *result =
+      reinterpret_cast<const tsi_enclave_handshaker_result *>(self);
+
+  return result->impl->CreateZeroCopyGrpcProtector(
+      max_output_protected_frame_size, protector);
+}
+
 tsi_result enclave_handshaker_result_create_frame_protector(
     const tsi_handshaker_result *self, size_t *max_output_protected_frame_size,
     tsi_frame_protector **protector) {
@@ -212,7 +278,7 @@ void enclave_handshaker_result_destroy(tsi_handshaker_result *self) {
 
 const tsi_handshaker_result_vtable handshaker_result_vtable = {
     enclave_handshaker_result_extract_peer,
-    nullptr /* create_zero_copy_grpc_protector */,
+    enclave_handshaker_result_create_zero_copy_grpc_protector,
     enclave_handshaker_result_create_frame_protector,
     enclave_handshaker_result_get_unused_bytes,
     enclave_handshaker_result_destroy,
@@ -320,6 +386,13 @@ tsi_result enclave_handshaker_next(
         return TSI_INTERNAL_ERROR;
       }
 
+      StatusOr<size_t> frame_size_result = handshaker->GetMaxRecordFrameSize();
+      if (!frame_size_result.ok()) {
+        gpr_log(GPR_ERROR, "Failed to retrieve max record frame size: %s",
+                std::string(frame_size_result.status().message()).c_str());
+        return TSI_INTERNAL_ERROR;
+      }
+
       StatusOr<std::unique_ptr<EnclaveIdentities>> identities_result =
           handshaker->GetPeerIdentities();
       if (!identities_result.ok()) {
@@ -341,7 +414,8 @@ tsi_result enclave_handshaker_next(
       tsi_result result = enclave_handshaker_result_create(
           absl::make_unique<TsiEnclaveHandshakerResult>(
               tsi_handshaker->is_client, record_protocol_result.value(),
-              key_result.value(), std::move(identities),
+              key_result.value(), frame_size_result.value(),
+              std::move(identities),
               unused_bytes_result.value()),
           handshaker_result);
       if (result == TSI_OK) {
@@ -404,14 +478,18 @@ tsi_result tsi_enclave_handshaker_create(
     absl::Span<asylo::AssertionDescription> accepted_peer_assertions,
     absl::string_view additional_authenticated_data,
     const absl::optional<asylo::IdentityAclPredicate> &peer_acl,
+    std::shared_ptr<asylo::EkepSessionCache> session_cache,
+    absl::string_view session_cache_key, size_t max_record_frame_size,
     tsi_handshaker **handshaker) {
   GRPC_API_TRACE(
       "tsi_enclave_handshaker_create(is_client=%d, self_assertions=%p, "
       "accepted_peer_assertions=%p, additional_authenticated_data=%p, "
-      "peer_acl=%d, handshaker=%p)",
-      6,
+      "peer_acl=%d, session_cache=%p, max_record_frame_size=%zu, "
+      "handshaker=%p)",
+      8,
       (is_client, self_assertions.data(), accepted_peer_assertions.data(),
-       additional_authenticated_data.data(), peer_acl.has_value(), handshaker));
+       additional_authenticated_data.data(), peer_acl.has_value(),
+       session_cache.get(), max_record_frame_size, handshaker));
 
   // Convert arguments to handshaker options.
   asylo::EkepHandshakerOptions options;
@@ -420,6 +498,9 @@ tsi_result tsi_enclave_handshaker_create(
   options.self_assertions = {self_assertions.cbegin(), self_assertions.cend()};
   options.accepted_peer_assertions = {accepted_peer_assertions.cbegin(),
                                       accepted_peer_assertions.cend()};
+  options.session_cache = std::move(session_cache);
+  options.session_cache_key = std::string(session_cache_key);
+  options.max_record_frame_size = max_record_frame_size;
 
   if (!options.additional_authenticated_data.empty()) {
     gpr_log(GPR_DEBUG, "additional authenticated data: %s",
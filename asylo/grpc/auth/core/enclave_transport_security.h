@@ -19,9 +19,12 @@
 #ifndef ASYLO_GRPC_AUTH_CORE_ENCLAVE_TRANSPORT_SECURITY_H_
 #define ASYLO_GRPC_AUTH_CORE_ENCLAVE_TRANSPORT_SECURITY_H_
 
+#include <memory>
+
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
 #include "asylo/identity/identity.pb.h"
 #include "asylo/identity/identity_acl.pb.h"
 #include "src/core/tsi/transport_security_interface.h"
@@ -47,11 +50,19 @@
 //   the handshake
 //   * |peer_acl| is the ACL evaluated using the authenticated peer's
 //   identities.
+//   * |session_cache| holds the sessions that the handshaker may resume, or is
+//   nullptr if session resumption is disabled
+//   * |session_cache_key| is the key under which a client handshaker caches its
+//   session with the server, and is ignored by server handshakers
+//   * |max_record_frame_size| is the max record protocol frame size that the
+//   handshaker proposes to the peer, or 0 to leave the frame size to gRPC
 tsi_result tsi_enclave_handshaker_create(
     bool is_client, absl::Span<asylo::AssertionDescription> self_assertions,
     absl::Span<asylo::AssertionDescription> accepted_peer_assertions,
     absl::string_view additional_authenticated_data,
     const absl::optional<asylo::IdentityAclPredicate> &peer_acl,
+    std::shared_ptr<asylo::EkepSessionCache> session_cache,
+    absl::string_view session_cache_key, size_t max_record_frame_size,
     tsi_handshaker **handshaker);
 
 #endif  // ASYLO_GRPC_AUTH_CORE_ENCLAVE_TRANSPORT_SECURITY_H_
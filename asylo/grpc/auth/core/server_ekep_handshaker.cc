@@ -21,9 +21,13 @@
 #include <openssl/curve25519.h>
 #include <openssl/rand.h>
 
+#include <algorithm>
+#include <utility>
+
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "asylo/crypto/sha256_hash.h"
 #include "asylo/util/logging.h"
 #include "asylo/grpc/auth/core/ekep_crypto.h"
@@ -61,11 +65,14 @@ ServerEkepHandshaker::ServerEkepHandshaker(const EkepHandshakerOptions &options)
       self_assertions_(options.self_assertions),
       accepted_peer_assertions_(options.accepted_peer_assertions),
       available_cipher_suites_({CURVE25519_SHA256}),
-      available_record_protocols_({ALTSRP_AES128_GCM}),
+      available_record_protocols_(options.record_protocols),
+      self_max_record_frame_size_(options.max_record_frame_size),
       available_ekep_versions_({"EKEP v1"}),
       additional_authenticated_data_(options.additional_authenticated_data),
       selected_cipher_suite_(UNKNOWN_HANDSHAKE_CIPHER),
       selected_record_protocol_(UNKNOWN_RECORD_PROTOCOL),
+      selected_max_record_frame_size_(0),
+      session_cache_(options.session_cache),
       expected_message_type_(CLIENT_PRECOMMIT),
       // The handshake is in progress for the server because it relies on the
       // client to act first.
@@ -162,6 +169,8 @@ ServerEkepHandshaker::Result ServerEkepHandshaker::HandleHandshakeMessage(
              selected_cipher_suite_, selected_record_protocol_, primary_secret_)
              .ok()) {
       handshaker_state_ = HandshakeState::ABORTED;
+    } else {
+      CacheSession();
     }
   }
 
@@ -225,12 +234,33 @@ Status ServerEkepHandshaker::HandleClientPrecommit(
                      "No compatible record_protocol");
   }
 
+  // Choose the smaller of the client's and the server's record frame sizes.
+  if (!SetSelectedMaxRecordFrameSize(
+          client_precommit.max_record_frame_size())) {
+    return EkepError(Abort::PROTOCOL_ERROR,
+                     absl::StrCat("Received an invalid max record frame size: ",
+                                  client_precommit.max_record_frame_size()));
+  }
+
   // Verify that the client sent an adequately-sized challenge.
   if (client_precommit.challenge().size() != kEkepChallengeSize) {
     return EkepError(Abort::PROTOCOL_ERROR,
                      "Received a challenge with incorrect size");
   }
 
+  // Resume the session identified by the client's ticket if it is cached and
+  // was established with the selected cipher suite. Otherwise, fall back to a
+  // full handshake.
+  if (session_cache_ && client_precommit.has_resumption_ticket()) {
+    resumed_session_ =
+        session_cache_->Lookup(client_precommit.resumption_ticket());
+    if (resumed_session_.has_value() &&
+        resumed_session_->cipher_suite == selected_cipher_suite_) {
+      return WriteServerPrecommit(output);
+    }
+    resumed_session_.reset();
+  }
+
   for (const AssertionOffer &offer : client_precommit.client_offers()) {
     const AssertionDescription &offer_desc = offer.description();
     // Request any assertion that the peer offered and that this handshaker is
@@ -281,6 +311,16 @@ Status ServerEkepHandshaker::HandleClientId(const google::protobuf::Message &mes
   }
   const ClientId &client_id = *client_id_ptr;
 
+  // In a resumed handshake, the client's identities are those of the resumed
+  // session.
+  if (resumed_session_.has_value()) {
+    if (!client_id.assertions().empty()) {
+      return EkepError(Abort::BAD_ASSERTION,
+                       "Client provided assertions in a resumed handshake");
+    }
+    ResumeSession(*resumed_session_);
+  }
+
   // The client's assertions should all be bound to a data blob containing a
   // hash of the transcript up to and including the ServerPrecommit message, and
   // the server's public key.
@@ -363,6 +403,10 @@ Status ServerEkepHandshaker::WriteServerPrecommit(std::string *output) {
       selected_ekep_version_);
   server_precommit.set_selected_cipher_suite(selected_cipher_suite_);
   server_precommit.set_selected_record_protocol(selected_record_protocol_);
+  if (selected_max_record_frame_size_ != 0) {
+    server_precommit.set_selected_max_record_frame_size(
+        selected_max_record_frame_size_);
+  }
 
   if (!additional_authenticated_data_.empty()) {
     server_precommit.mutable_options()->set_data(
@@ -375,6 +419,12 @@ Status ServerEkepHandshaker::WriteServerPrecommit(std::string *output) {
   }
   server_precommit.set_challenge(challenge.data(), challenge.size());
 
+  // A resumed handshake exchanges no assertions, in which case there are no
+  // promised or expected assertions below.
+  if (resumed_session_.has_value()) {
+    server_precommit.set_resumption_accepted(true);
+  }
+
   for (const AssertionRequest &request : promised_assertions_) {
     const AssertionDescription &description = request.description();
     // Note that assertion generators were verified during creation of the
@@ -468,9 +518,16 @@ Status ServerEkepHandshaker::WriteServerFinish(std::string *output) {
   std::string transcript_hash;
   ASYLO_RETURN_IF_ERROR(GetTranscriptHash(&transcript_hash));
 
-  ASYLO_RETURN_IF_ERROR(
-      DeriveSecrets(selected_cipher_suite_, transcript_hash, client_public_key_,
-                    dh_private_key_, &primary_secret_, &authenticator_secret_));
+  if (resumed_session_.has_value()) {
+    ASYLO_RETURN_IF_ERROR(DeriveResumedSecrets(
+        selected_cipher_suite_, transcript_hash, client_public_key_,
+        dh_private_key_, resumed_session_->resumption_secret, &primary_secret_,
+        &authenticator_secret_));
+  } else {
+    ASYLO_RETURN_IF_ERROR(DeriveSecrets(
+        selected_cipher_suite_, transcript_hash, client_public_key_,
+        dh_private_key_, &primary_secret_, &authenticator_secret_));
+  }
 
   CleansingVector<uint8_t> authenticator;
   ASYLO_RETURN_IF_ERROR(ComputeServerHandshakeAuthenticator(
@@ -483,6 +540,24 @@ Status ServerEkepHandshaker::WriteServerFinish(std::string *output) {
   return WriteFrameAndUpdateTranscript(SERVER_FINISH, server_finish, output);
 }
 
+void ServerEkepHandshaker::CacheSession() {
+  // A resumed handshake does not establish a new session, so that the cached
+  // session keeps its original expiry.
+  if (!session_cache_ || resumed_session_.has_value()) {
+    return;
+  }
+
+  EkepSession session;
+  Status status =
+      DeriveSession(selected_cipher_suite_, primary_secret_, &session);
+  if (!status.ok()) {
+    LOG(WARNING) << "Failed to derive resumable session: " << status;
+    return;
+  }
+  std::string ticket = session.ticket;
+  session_cache_->Insert(ticket, std::move(session));
+}
+
 bool ServerEkepHandshaker::SetSelectedEkepVersion(
     const google::protobuf::RepeatedPtrField<EkepVersion> &ekep_versions) {
   // Choose the first compatible EKEP version available.
@@ -527,4 +602,20 @@ bool ServerEkepHandshaker::SetSelectedRecordProtocol(
   return true;
 }
 
+bool ServerEkepHandshaker::SetSelectedMaxRecordFrameSize(
+    uint32_t max_record_frame_size) {
+  // A frame size is only negotiated if both participants offer one.
+  if (max_record_frame_size == 0 || self_max_record_frame_size_ == 0) {
+    selected_max_record_frame_size_ = 0;
+  } else if (max_record_frame_size < EkepHandshaker::kMinRecordFrameSize) {
+    return false;
+  } else {
+    selected_max_record_frame_size_ =
+        std::min<size_t>(max_record_frame_size, self_max_record_frame_size_);
+  }
+
+  SetMaxRecordFrameSize(selected_max_record_frame_size_);
+  return true;
+}
+
 }  // namespace asylo
@@ -26,8 +26,10 @@
 
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/message.h>
+#include "absl/types/optional.h"
 #include "asylo/grpc/auth/core/ekep_handshaker.h"
 #include "asylo/grpc/auth/core/ekep_handshaker_util.h"
+#include "asylo/grpc/auth/core/ekep_session_cache.h"
 #include "asylo/util/cleansing_types.h"
 
 namespace asylo {
@@ -36,6 +38,12 @@ namespace asylo {
 // handshake. It handles ClientPrecommit, ClientId, and ClientFinish messages
 // from the client and sends ServerPrecommit, ServerId, and ServerFinish
 // messages to the client.
+//
+// If configured with a session cache, the server accepts a client's offer to
+// resume a cached session that was established with the selected cipher suite.
+// In that case, neither participant presents assertions, and the client's
+// identities are those of the cached session. Otherwise, the server performs a
+// full handshake and caches the resulting session.
 class ServerEkepHandshaker final : public EkepHandshaker {
  public:
   // Creates a ServerEkepHandshaker configured with the given |options|, if
@@ -100,6 +108,10 @@ class ServerEkepHandshaker final : public EkepHandshaker {
   // transcript.
   Status WriteServerFinish(std::string *output);
 
+  // Caches the session established by a completed full handshake, if the
+  // handshaker is configured with a session cache.
+  void CacheSession();
+
   // Sets the handshaker's selected EKEP version to first compatible EKEP
   // version in |ekep_versions|. Returns false if there is no compatible EKEP
   // version in |ekep_versions|.
@@ -117,6 +129,12 @@ class ServerEkepHandshaker final : public EkepHandshaker {
   bool SetSelectedRecordProtocol(
       const google::protobuf::RepeatedField<int> &record_protocols);
 
+  // Sets the handshaker's maximum record frame size to the smaller of
+  // |max_record_frame_size|, which is offered by the client, and the server's
+  // own frame size. Returns false if |max_record_frame_size| is not a valid
+  // frame size.
+  bool SetSelectedMaxRecordFrameSize(uint32_t max_record_frame_size);
+
   // A list of assertions offered by the server.
   const std::vector<AssertionDescription> self_assertions_;
 
@@ -129,6 +147,10 @@ class ServerEkepHandshaker final : public EkepHandshaker {
   // A list of supported record protocols.
   const std::vector<RecordProtocol> available_record_protocols_;
 
+  // The largest record protocol frame size supported by the server, or zero if
+  // the server does not negotiate a frame size.
+  const size_t self_max_record_frame_size_;
+
   // A list of supported protocol versions in order of most recent to least
   // recent.
   const std::vector<std::string> available_ekep_versions_;
@@ -153,10 +175,23 @@ class ServerEkepHandshaker final : public EkepHandshaker {
   // message.
   RecordProtocol selected_record_protocol_;
 
+  // The selected maximum record protocol frame size, or zero if no frame size
+  // was negotiated. This field is populated after validation of the
+  // ClientPrecommit message.
+  size_t selected_max_record_frame_size_;
+
   // The selected EKEP version for the handshake. This field is populated after
   // validation of the ClientPrecommit message.
   std::string selected_ekep_version_;
 
+  // Cache of resumable sessions, or nullptr if sessions are not resumed.
+  const std::shared_ptr<EkepSessionCache> session_cache_;
+
+  // The cached session that the client offered and the server accepted, if
+  // any. This field is populated after validation of the ClientPrecommit
+  // message.
+  absl::optional<EkepSession> resumed_session_;
+
   // The server's ephemeral Diffie-Hellman key-pair.
   std::vector<uint8_t> dh_public_key_;
   CleansingVector<uint8_t> dh_private_key_;
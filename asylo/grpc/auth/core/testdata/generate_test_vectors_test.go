@@ -76,13 +76,64 @@ func deriveSecrets() ([]byte, []byte) {
 	return primarySecret, authSecret
 }
 
-// DeriveRecordProtocolKey generates an ALTSRP AES128 GCM record protocol key
-// using the given primary secret.
-func deriveRecordProtocolKey(primarySecret []byte) []byte {
+// deriveResumedSecrets generates an EKEP primary and authenticator secret for
+// a resumed handshake using Curve25519, SHA256, and the given resumption
+// secret.
+func deriveResumedSecrets(resumptionSecret []byte) ([]byte, []byte) {
+	// Compute the shared secret and append the resumption secret.
+	var secret [32]byte
+	curve25519.ScalarMult(&secret, &privKey, &pubKey)
+	ikm := append(secret[:], resumptionSecret...)
+	hash := sha256.New
+	salt := []byte("EKEP Resumed Handshake v1")
+	hkdf := hkdf.New(hash, ikm, salt, info[:])
+
+	// Generate the primary and authenticator secrets.
+	primarySecret := make([]byte, 64)
+	authSecret := make([]byte, 64)
+
+	n, err := io.ReadFull(hkdf, primarySecret)
+	if n != len(primarySecret) || err != nil {
+		log.Fatalf("io.ReadFull(%v, %v) = _, %v", hkdf, primarySecret, err)
+	}
+
+	n, err = io.ReadFull(hkdf, authSecret)
+	if n != len(authSecret) || err != nil {
+		log.Fatalf("io.ReadFull(%v, %v) = _, %v", hkdf, authSecret, err)
+	}
+	return primarySecret, authSecret
+}
+
+// deriveResumptionSecret generates an EKEP resumption secret and session
+// ticket using the given primary secret.
+func deriveResumptionSecret(primarySecret []byte) ([]byte, []byte) {
+	hash := sha256.New
+	salt := []byte("EKEP Resumption v1")
+	hkdf := hkdf.New(hash, primarySecret, salt, info[:])
+
+	resumptionSecret := make([]byte, 64)
+	ticket := make([]byte, 32)
+
+	n, err := io.ReadFull(hkdf, resumptionSecret)
+	if n != len(resumptionSecret) || err != nil {
+		log.Fatalf("io.ReadFull(%v, %v) = _, %v", hkdf, resumptionSecret, err)
+	}
+
+	n, err = io.ReadFull(hkdf, ticket)
+	if n != len(ticket) || err != nil {
+		log.Fatalf("io.ReadFull(%v, %v) = _, %v", hkdf, ticket, err)
+	}
+	return resumptionSecret, ticket
+}
+
+// DeriveRecordProtocolKey generates a record protocol key of keySize bytes
+// using the given primary secret. ALTSRP AES128 GCM uses 16-byte keys, and
+// ALTSRP AES256 GCM and ALTSRP CHACHA20 POLY1305 use 32-byte keys.
+func deriveRecordProtocolKey(primarySecret []byte, keySize int) []byte {
 	hash := sha256.New
 	salt := []byte("EKEP Record Protocol v1")
 	hkdf := hkdf.New(hash, primarySecret, salt, info[:])
-	key := make([]byte, 16)
+	key := make([]byte, keySize)
 
 	n, err := io.ReadFull(hkdf, key)
 	if n != len(key) || err != nil {
@@ -129,12 +180,14 @@ func main() {
 	fmt.Printf("Authenticator secret:\n%s\n\n", hex.EncodeToString(authSecret))
 
 	// EKEP record protocol secrets
-	key := deriveRecordProtocolKey(primarySecret)
+	key := deriveRecordProtocolKey(primarySecret, 16)
+	key256 := deriveRecordProtocolKey(primarySecret, 32)
 
 	fmt.Println(">>EKEP Record Protocol Key<<")
 	fmt.Printf("Primary secret:\n%s\n", hex.EncodeToString(primarySecret[:]))
 	fmt.Printf("HKDF info:\n%s\n", hex.EncodeToString(info[:]))
-	fmt.Printf("Record protocol key:\n%s\n\n", hex.EncodeToString(key[:]))
+	fmt.Printf("Record protocol key:\n%s\n", hex.EncodeToString(key[:]))
+	fmt.Printf("256-bit record protocol key:\n%s\n\n", hex.EncodeToString(key256[:]))
 
 	// EKEP server handshake authenticator
 	serverAuthn := computeServerHandshakeAuthenticator(authSecret)
@@ -149,4 +202,24 @@ func main() {
 	fmt.Println(">>EKEP Client Handshake Authenticator<<")
 	fmt.Printf("Authenticator secret:\n%s\n", hex.EncodeToString(authSecret))
 	fmt.Printf("Client handshake authenticator:\n%s\n\n", hex.EncodeToString(clientAuthn))
+
+	// EKEP resumption secret and session ticket
+	resumptionSecret, ticket := deriveResumptionSecret(primarySecret)
+
+	fmt.Println(">>EKEP Resumption Secret<<")
+	fmt.Printf("Primary secret:\n%s\n", hex.EncodeToString(primarySecret))
+	fmt.Printf("HKDF info:\n%s\n", hex.EncodeToString(info[:]))
+	fmt.Printf("Resumption secret:\n%s\n", hex.EncodeToString(resumptionSecret))
+	fmt.Printf("Session ticket:\n%s\n\n", hex.EncodeToString(ticket))
+
+	// EKEP primary and authenticator secrets of a resumed handshake
+	resumedPrimarySecret, resumedAuthSecret := deriveResumedSecrets(resumptionSecret)
+
+	fmt.Println(">>EKEP Resumed Secret Derivation<<")
+	fmt.Printf("Public key:\n%s\n", hex.EncodeToString(pubKey[:]))
+	fmt.Printf("Private key:\n%s\n", hex.EncodeToString(privKey[:]))
+	fmt.Printf("Resumption secret:\n%s\n", hex.EncodeToString(resumptionSecret))
+	fmt.Printf("HKDF info:\n%s\n", hex.EncodeToString(info[:]))
+	fmt.Printf("Primary secret:\n%s\n", hex.EncodeToString(resumedPrimarySecret))
+	fmt.Printf("Authenticator secret:\n%s\n\n", hex.EncodeToString(resumedAuthSecret))
 }
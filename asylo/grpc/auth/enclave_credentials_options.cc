@@ -17,6 +17,9 @@
  */
 #include "asylo/grpc/auth/enclave_credentials_options.h"
 
+#include <algorithm>
+
+#include "absl/time/time.h"
 #include "asylo/identity/identity_acl.pb.h"
 
 namespace asylo {
@@ -48,6 +51,10 @@ EnclaveCredentialsOptions &EnclaveCredentialsOptions::Add(
       peer_acl = additional.peer_acl;
     }
   }
+  session_ticket_lifetime =
+      std::max(session_ticket_lifetime, additional.session_ticket_lifetime);
+  max_record_frame_size =
+      std::max(max_record_frame_size, additional.max_record_frame_size);
 
   return *this;
 }
@@ -19,8 +19,10 @@
 #ifndef ASYLO_GRPC_AUTH_ENCLAVE_CREDENTIALS_OPTIONS_H_
 #define ASYLO_GRPC_AUTH_ENCLAVE_CREDENTIALS_OPTIONS_H_
 
+#include <cstddef>
 #include <string>
 
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "asylo/identity/assertion_description_util.h"
 #include "asylo/identity/identity.pb.h"
@@ -53,6 +55,22 @@ struct EnclaveCredentialsOptions {
   /// authenticated peer's identities will cause gRPC channel establishment to
   /// fail.
   absl::optional<IdentityAclPredicate> peer_acl;
+
+  /// How long a session established by a full handshake can be resumed by
+  /// later handshakes between the same credentials objects. A resumed
+  /// handshake skips assertion generation and verification, and authenticates
+  /// the peer with the identities from the full handshake. A zero or negative
+  /// lifetime disables resumption, so every gRPC channel performs a full
+  /// handshake. Both the client and the server must enable resumption.
+  absl::Duration session_ticket_lifetime = absl::ZeroDuration();
+
+  /// The max record protocol frame size, in bytes, that the credential holder
+  /// proposes during the handshake. The client and the server use the smaller
+  /// of their proposals. Larger frames amortize the per-frame cost of record
+  /// protection over more data. If either side leaves the frame size at zero,
+  /// the frame size is left to gRPC. Non-zero values must be between 1 KB and
+  /// 16 MB.
+  size_t max_record_frame_size = 0;
 };
 
 }  // namespace asylo
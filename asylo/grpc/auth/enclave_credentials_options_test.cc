@@ -20,6 +20,7 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "absl/time/time.h"
 #include "asylo/grpc/auth/null_credentials_options.h"
 #include "asylo/grpc/auth/sgx_local_credentials_options.h"
 #include "asylo/identity/descriptions.h"
@@ -30,6 +31,7 @@
 namespace asylo {
 namespace {
 
+using ::testing::Eq;
 using ::testing::Test;
 using ::testing::UnorderedElementsAre;
 
@@ -151,5 +153,33 @@ TEST_F(EnclaveCredentialsOptionsTest, CombineIdentityAclPredicates) {
   EXPECT_THAT(lhs.Add(rhs).peer_acl, Optional(EqualsProto(combined)));
 }
 
+/// Verifies that combining options keeps the longest session ticket lifetime,
+/// so that resumption stays enabled if either options object enables it.
+TEST_F(EnclaveCredentialsOptionsTest, CombineSessionTicketLifetimes) {
+  EnclaveCredentialsOptions lhs = BidirectionalSgxLocalCredentialsOptions();
+  EXPECT_THAT(lhs.session_ticket_lifetime, Eq(absl::ZeroDuration()));
+
+  EnclaveCredentialsOptions rhs = BidirectionalNullCredentialsOptions();
+  rhs.session_ticket_lifetime = absl::Minutes(5);
+  EXPECT_THAT(lhs.Add(rhs).session_ticket_lifetime, Eq(absl::Minutes(5)));
+
+  rhs.session_ticket_lifetime = absl::Minutes(1);
+  EXPECT_THAT(lhs.Add(rhs).session_ticket_lifetime, Eq(absl::Minutes(5)));
+}
+
+/// Verifies that combining options keeps the larger max record frame size, so
+/// that a frame size set by either options object is kept.
+TEST_F(EnclaveCredentialsOptionsTest, CombineMaxRecordFrameSizes) {
+  EnclaveCredentialsOptions lhs = BidirectionalSgxLocalCredentialsOptions();
+  EXPECT_THAT(lhs.max_record_frame_size, Eq(0));
+
+  EnclaveCredentialsOptions rhs = BidirectionalNullCredentialsOptions();
+  rhs.max_record_frame_size = 1024 * 1024;
+  EXPECT_THAT(lhs.Add(rhs).max_record_frame_size, Eq(1024 * 1024));
+
+  rhs.max_record_frame_size = 64 * 1024;
+  EXPECT_THAT(lhs.Add(rhs).max_record_frame_size, Eq(1024 * 1024));
+}
+
 }  // namespace
 }  // namespace asylo
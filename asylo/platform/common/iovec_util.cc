@@ -0,0 +1,52 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/common/iovec_util.h"
+
+#include <errno.h>
+
+#include <climits>
+#include <cstddef>
+
+namespace asylo {
+
+ssize_t IovecLength(const struct iovec *iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > kMaxIovecCount) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (iovcnt > 0 && !iov) {
+    errno = EFAULT;
+    return -1;
+  }
+  size_t length = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    if (!iov[i].iov_base && iov[i].iov_len > 0) {
+      errno = EFAULT;
+      return -1;
+    }
+    if (iov[i].iov_len > SSIZE_MAX - length) {
+      errno = EINVAL;
+      return -1;
+    }
+    length += iov[i].iov_len;
+  }
+  return length;
+}
+
+}  // namespace asylo
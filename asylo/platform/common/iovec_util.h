@@ -0,0 +1,40 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_COMMON_IOVEC_UTIL_H_
+#define ASYLO_PLATFORM_COMMON_IOVEC_UTIL_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace asylo {
+
+// Maximum number of buffers in a vector passed to vectored I/O, IOV_MAX on
+// Linux.
+constexpr int kMaxIovecCount = 1024;
+
+// Returns the total length of the buffers in |iov|, or -1 and sets errno if
+// |iov| and |iovcnt| do not describe a valid vector, as readv() and writev()
+// do on Linux: EINVAL if |iovcnt| is negative or above kMaxIovecCount, or if
+// the total length overflows ssize_t, and EFAULT if |iov| or the base of a
+// non-empty buffer is null.
+ssize_t IovecLength(const struct iovec *iov, int iovcnt);
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_COMMON_IOVEC_UTIL_H_
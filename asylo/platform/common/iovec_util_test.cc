@@ -0,0 +1,67 @@
+/*
+ *
+ * Copyright 2020 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/common/iovec_util.h"
+
+#include <errno.h>
+
+#include <climits>
+#include <cstdint>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+namespace asylo {
+namespace {
+
+using ::testing::Eq;
+
+TEST(IovecUtilTest, SumsBufferLengths) {
+  char buffer[16];
+  struct iovec iov[3] = {{buffer, 4}, {nullptr, 0}, {buffer + 4, 12}};
+  EXPECT_THAT(IovecLength(iov, 3), Eq(16));
+  EXPECT_THAT(IovecLength(iov, 0), Eq(0));
+  EXPECT_THAT(IovecLength(nullptr, 0), Eq(0));
+}
+
+TEST(IovecUtilTest, RejectsInvalidCounts) {
+  char buffer[1];
+  struct iovec iov = {buffer, sizeof(buffer)};
+  EXPECT_THAT(IovecLength(&iov, -1), Eq(-1));
+  EXPECT_THAT(errno, Eq(EINVAL));
+  EXPECT_THAT(IovecLength(&iov, kMaxIovecCount + 1), Eq(-1));
+  EXPECT_THAT(errno, Eq(EINVAL));
+}
+
+TEST(IovecUtilTest, RejectsNullBuffers) {
+  EXPECT_THAT(IovecLength(nullptr, 1), Eq(-1));
+  EXPECT_THAT(errno, Eq(EFAULT));
+  struct iovec iov = {nullptr, 1};
+  EXPECT_THAT(IovecLength(&iov, 1), Eq(-1));
+  EXPECT_THAT(errno, Eq(EFAULT));
+}
+
+TEST(IovecUtilTest, RejectsOverflowingLengths) {
+  char buffer[1];
+  struct iovec iov[2] = {{buffer, SSIZE_MAX}, {buffer, 1}};
+  EXPECT_THAT(IovecLength(iov, 2), Eq(-1));
+  EXPECT_THAT(errno, Eq(EINVAL));
+}
+
+}  // namespace
+}  // namespace asylo
@@ -57,10 +57,6 @@ namespace asylo {
 // RingBuffer<kCapacity>::TypeVersion() == instance->InstanceVersion();
 //
 
-// Exposes NonBlockingRead/Write for testing.
-template <size_t kCapacity>
-class RingBufferForTest;
-
 template <size_t kCapacity>
 class RingBuffer {
  public:
@@ -177,9 +173,6 @@ class RingBuffer {
            offsetof(RingBuffer, buffer_) << 40 | sizeof(RingBuffer) << 48;
   }
 
- private:
-  friend class RingBufferForTest<kCapacity>;
-
   // Reads up to |nbyte| bytes without blocking, returning the number
   // successfully read.
   size_t NonBlockingRead(uint8_t *buf, size_t nbyte) {
@@ -248,6 +241,7 @@ class RingBuffer {
     return size;
   }
 
+ private:
   const uint64_t instance_version_;         // Layout of the struct.
   std::atomic<uint32_t> closed_for_read_;   // Reader is done reading.
   std::atomic<uint32_t> closed_for_write_;  // Writer is done writing.
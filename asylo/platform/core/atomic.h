@@ -99,6 +99,13 @@ inline void AtomicStore(
   __atomic_store_n(location, value, internal::GetGCCMemOrder(memorder));
 }
 
+// Returns the value at `location`.
+template <typename T>
+inline T AtomicLoad(volatile T *location, std::memory_order memorder =
+                                              std::memory_order_seq_cst) {
+  return __atomic_load_n(location, internal::GetGCCMemOrder(memorder));
+}
+
 // The size of an x86-64 cache line.
 //
 constexpr size_t kCacheLineSize = 64;
@@ -16,8 +16,12 @@
  *
  */
 
+#include <pthread.h>
+
+#include <cstdint>
 #include <thread>
 
+#include <benchmark/benchmark.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "asylo/platform/core/trusted_mutex.h"
@@ -37,7 +41,15 @@ class LockTest : public ::testing::Test {
   LockType non_recursive_;
 };
 
-typedef ::testing::Types<TrustedSpinLock, TrustedMutex> Implementations;
+// A TrustedMutex which hands itself over to parked waiters on unlock.
+class FairTrustedMutex : public TrustedMutex {
+ public:
+  explicit FairTrustedMutex(bool is_recursive)
+      : TrustedMutex(is_recursive, /*is_fair=*/true) {}
+};
+
+typedef ::testing::Types<TrustedSpinLock, TrustedMutex, FairTrustedMutex>
+    Implementations;
 
 TYPED_TEST_SUITE(LockTest, Implementations);
 
@@ -109,5 +121,57 @@ TYPED_TEST(LockTest, NonRecursiveManyThreadsTest) {
   EXPECT_EQ(shared_counter, 0);
 }
 
+// Adapts a pthread mutex to the interface of the locks above, as a baseline for
+// the benchmarks below.
+class PthreadMutex {
+ public:
+  explicit PthreadMutex(bool is_recursive) {}
+  void Lock() { pthread_mutex_lock(&mutex_); }
+  void Unlock() { pthread_mutex_unlock(&mutex_); }
+
+ private:
+  pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+};
+
+// Measures a lock contended by all benchmark threads, each of which holds it
+// for |state.range(0)| iterations of busy work per acquisition.
+template <typename LockType>
+void BM_ContendedLock(benchmark::State &state) {
+  // Shared by every run of the benchmark, and intentionally leaked.
+  static LockType *lock = new LockType(/*is_recursive=*/false);
+  static uint64_t shared_counter = 0;
+  const int64_t critical_section = state.range(0);
+  for (auto _ : state) {
+    lock->Lock();
+    for (int64_t i = 0; i < critical_section; ++i) {
+      benchmark::DoNotOptimize(++shared_counter);
+    }
+    ++shared_counter;
+    lock->Unlock();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_ContendedLock, TrustedSpinLock)
+    ->Arg(0)
+    ->Arg(256)
+    ->ThreadRange(2, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ContendedLock, TrustedMutex)
+    ->Arg(0)
+    ->Arg(256)
+    ->ThreadRange(2, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ContendedLock, FairTrustedMutex)
+    ->Arg(0)
+    ->Arg(256)
+    ->ThreadRange(2, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ContendedLock, PthreadMutex)
+    ->Arg(0)
+    ->Arg(256)
+    ->ThreadRange(2, 64)
+    ->UseRealTime();
+
 }  // namespace
 }  // namespace asylo
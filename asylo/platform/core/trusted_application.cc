@@ -35,6 +35,7 @@
 #include "asylo/platform/core/entry_selectors.h"
 #include "asylo/platform/core/shared_name_kind.h"
 #include "asylo/platform/core/trusted_global_state.h"
+#include "asylo/platform/host_call/trusted/switchless.h"
 #include "asylo/platform/posix/io/io_manager.h"
 #include "asylo/platform/posix/io/native_paths.h"
 #include "asylo/platform/posix/io/random_devices.h"
@@ -215,6 +216,15 @@ Status TrustedApplication::InitializeInternal(const EnclaveConfig &config) {
                  << status;
   }
   SetEnclaveConfig(config);
+  if (config.switchless_host_call_config().enabled()) {
+    // System calls keep using regular enclave exits if this fails.
+    primitives::PrimitiveStatus switchless_status =
+        host_call::InitializeSwitchlessHostCalls();
+    if (!switchless_status.ok()) {
+      LOG(WARNING) << "Initialization of switchless host calls failed: "
+                   << switchless_status.error_message();
+    }
+  }
   // This call can fail, but it should not stop the enclave from running.
   status = InitializeEnclaveAssertionAuthorities(
       config.enclave_assertion_authority_configs().begin(),
@@ -18,75 +18,132 @@
 
 #include "asylo/platform/core/trusted_mutex.h"
 
+#include <atomic>
+#include <cstdint>
+
 #include "asylo/platform/core/atomic.h"
-#include "asylo/platform/core/trusted_spin_lock.h"
 #include "asylo/platform/host_call/trusted/host_calls.h"
+#include "asylo/platform/primitives/trusted_primitives.h"
+#include "asylo/platform/primitives/trusted_runtime.h"
 
 namespace asylo {
 
 namespace {
-// Value below was roughly experimentally determined using test/lock_test on SGX
-// hardware.
-static constexpr int64_t kLockAttemptThreshhold = 10000;
+
+// A contended Lock() pauses for 1, 2, 4, ..., kMaxSpinBackoff iterations
+// between attempts to take the mutex, then parks on the host. An enclave exit
+// costs several thousand cycles, so spinning for a comparable time first lets
+// short critical sections complete without one.
+constexpr int kMaxSpinBackoff = 1024;
+
 }  // namespace
 
-TrustedMutex::TrustedMutex(bool is_recursive = false)
-    : trusted_spin_lock_(is_recursive),
-      wait_queue_(enc_untrusted_create_wait_queue()),
-      number_threads_asleep_(0) {
-  // ensure that waiting is currently disabled
-  enc_untrusted_disable_waiting(wait_queue_);
+TrustedMutex::TrustedMutex(bool is_recursive, bool is_fair)
+    : state_(kUnlocked),
+      waiters_(0),
+      owner_(kInvalidThread),
+      recursive_lock_count_(0),
+      is_recursive_(is_recursive),
+      is_fair_(is_fair),
+      futex_(enc_untrusted_create_wait_queue()) {}
+
+TrustedMutex::~TrustedMutex() { enc_untrusted_destroy_wait_queue(futex_); }
+
+bool TrustedMutex::Acquire(uint32_t from) {
+  if (!AtomicCompareExchange(&state_, &from, kLocked, /*weak=*/false,
+                             std::memory_order_acquire,
+                             std::memory_order_relaxed)) {
+    return false;
+  }
+  owner_ = enc_thread_self();
+  recursive_lock_count_ = 1;
+  return true;
 }
 
 void TrustedMutex::Lock() {
+  if (TryLock()) {
+    return;
+  }
+  for (int backoff = 1; backoff <= kMaxSpinBackoff; backoff <<= 1) {
+    for (int i = 0; i < backoff; ++i) {
+      enc_pause();
+    }
+    // Only attempt the compare and swap once the mutex looks free, so spinning
+    // waiters share the cache line holding |state_| rather than contending for
+    // it.
+    if (AtomicLoad(&state_, std::memory_order_relaxed) == kUnlocked &&
+        Acquire(kUnlocked)) {
+      return;
+    }
+  }
+  LockSlow();
+}
+
+void TrustedMutex::LockSlow() {
+  // Registering as a waiter before checking |state_| guarantees that either
+  // this thread observes the mutex released, or the releasing thread observes
+  // the waiter and wakes it.
+  AtomicIncrement(&waiters_);
   while (true) {
-    for (int i = 0; i < kLockAttemptThreshhold; i++) {
-      if (TryLock()) {
-        return;
+    // The futex word must be read before |state_|, so that a release between
+    // the two reads changes it and the wait below returns immediately.
+    int32_t sequence = AtomicLoad(futex_);
+    uint32_t state = AtomicLoad(&state_);
+    if (state != kLocked) {
+      if (Acquire(state)) {
+        break;
       }
-      enc_pause();
+      continue;
     }
-    // This increment and decrement can be relaxed, as the thread
-    // count doesn't serve as a lock word for any other data.
-    AtomicIncrement(&number_threads_asleep_, std::memory_order_relaxed);
-    enc_untrusted_thread_wait(wait_queue_);
-    AtomicDecrement(&number_threads_asleep_, std::memory_order_relaxed);
+    enc_untrusted_sys_futex_wait(futex_, sequence, /*timeout_microsec=*/0);
   }
+  AtomicDecrement(&waiters_);
 }
 
-bool TrustedMutex::Owned() const { return trusted_spin_lock_.Owned(); }
+bool TrustedMutex::Owned() const { return owner_ == enc_thread_self(); }
 
 bool TrustedMutex::TryLock() {
-  if (trusted_spin_lock_.TryLock()) {
-    // Lock is acquired, allow other threads to wait.
-    // No need to enable waiting unless lock is changing states from
-    // unlocked to locked.
-    if (trusted_spin_lock_.LockDepthIsOne()) {
-      enc_untrusted_enable_waiting(wait_queue_);
-    }
+  if (is_recursive_ && owner_ == enc_thread_self()) {
+    recursive_lock_count_++;
     return true;
   }
-  return false;
+  // A stale read of |state_| at worst makes TryLock fail spuriously or fall
+  // through to the compare and swap, which is correctly synchronized.
+  return AtomicLoad(&state_, std::memory_order_relaxed) == kUnlocked &&
+         Acquire(kUnlocked);
 }
 
 void TrustedMutex::Unlock() {
-  // Make sure to do no extra work if this is a nested recursive
-  // unlock, which won't actually leave the lock unlocked.
-  bool getting_unlocked = trusted_spin_lock_.LockDepthIsOne();
-  if (getting_unlocked) {
-    // Lock is now unlocked, disable waiting
-    enc_untrusted_disable_waiting(wait_queue_);
+  // It is a fatal error to attempt to unlock a mutex the calling thread does
+  // not own.
+  if (owner_ != enc_thread_self()) {
+    primitives::TrustedPrimitives::DebugPuts(
+        "TrustedMutex::Unlock called by thread that does not own it.");
+    return;
   }
-  trusted_spin_lock_.Unlock();
-  // While it would be safe to notify the queue unconditionally, it
-  // requires an enclave exit, which is expensive. In practice, we
-  // only need to wake up another thread if the lock has changed state
-  // to Unlocked, and there is a thread waiting on the queue.
-  if (getting_unlocked && number_threads_asleep_ > 0) {
-    enc_untrusted_notify(wait_queue_);
+
+  recursive_lock_count_--;
+  if (recursive_lock_count_ > 0) {
+    return;
   }
-}
+  owner_ = kInvalidThread;
 
-TrustedMutex::~TrustedMutex() { enc_untrusted_destroy_wait_queue(wait_queue_); }
+  // Registered waiters only leave |waiters_| after acquiring the mutex, which
+  // cannot happen while this thread holds it, so a fair hand-off is always
+  // claimed by one of them.
+  if (is_fair_ && AtomicLoad(&waiters_) > 0) {
+    AtomicStore(&state_, kHandedOff, std::memory_order_release);
+  } else {
+    AtomicStore(&state_, kUnlocked);
+    // While it would be safe to wake the host futex unconditionally, it
+    // requires an enclave exit, which is expensive, so only do so if a thread
+    // is parked or about to park.
+    if (AtomicLoad(&waiters_) == 0) {
+      return;
+    }
+  }
+  AtomicIncrement(futex_);
+  enc_untrusted_sys_futex_wake(futex_, 1);
+}
 
 }  // namespace asylo
@@ -19,24 +19,38 @@
 #ifndef ASYLO_PLATFORM_CORE_TRUSTED_MUTEX_H_
 #define ASYLO_PLATFORM_CORE_TRUSTED_MUTEX_H_
 
-#include "asylo/platform/core/trusted_spin_lock.h"
+#include <cstdint>
+
+#include "asylo/platform/core/atomic.h"
 
 namespace asylo {
 
-// A mutex implementation depending on untrusted resources guarded by a trusted
-// spin lock.
+// An adaptive mutex which spins inside the enclave and then parks on a host
+// futex.
+//
+// The lock word and the owner live in trusted memory and are the source of
+// truth for locking. A contended Lock() first spins with bounded exponential
+// backoff, reading the lock word before attempting to take it so waiters do not
+// contend on its cache line. If the mutex is still held it then registers as a
+// waiter and sleeps on a futex word in untrusted memory. The futex word is only
+// a wake-up hint: the host can delay or spuriously wake a waiter but cannot
+// grant it the mutex. Unlock() exits the enclave only when a waiter is parked
+// or about to park, so an uncontended mutex never leaves the enclave.
 //
-// A TrustedMutex object is a thread-synchronization primitive that depends
-// on resources outside the enclave for efficiency, and uses a spin lock inside
-// the enclave for security.
-class TrustedMutex {
+// The 'alignas' keeps the trusted lock state on its own cache line.
+class alignas(kCacheLineSize) TrustedMutex {
  public:
   // Initializes an unlocked mutex. If |is_recursive| is true, then the mutex is
   // a recursive lock and may 1) be locked more than once by the caller and 2)
   // does not become free until it is unlocked a corresponding number of times.
   // This optional functionality is provided for compatibility with
   // pthread_mutex.
-  explicit TrustedMutex(bool is_recursive);
+  //
+  // If |is_fair| is true, Unlock() hands the mutex directly to a parked waiter
+  // when there is one rather than releasing it, so threads which repeatedly
+  // re-acquire the mutex cannot starve the waiters. This trades throughput for
+  // bounded waiting.
+  explicit TrustedMutex(bool is_recursive, bool is_fair = false);
 
   ~TrustedMutex();
 
@@ -59,16 +73,42 @@ class TrustedMutex {
   void Unlock();
 
  private:
-  // The source of truth for locking.
-  TrustedSpinLock trusted_spin_lock_;
-  // A pointer to an untrusted wait queue maintained by the OS. Likely
-  // implemented via the futex syscall, with the pointer to the 4 byte
-  // futex word.
-  int32_t *const wait_queue_;
-  // By keeping track of the number of threads asleep on the wait
-  // queue, we can avoid an expensive wake operation in some common
-  // cases.
-  volatile uint32_t number_threads_asleep_;
+  // Values of |state_|.
+  //
+  // The mutex is unlocked.
+  constexpr static uint32_t kUnlocked = 0;
+  //
+  // The mutex is locked.
+  constexpr static uint32_t kLocked = 1;
+  //
+  // The mutex has been released to the parked waiters by a fair Unlock(), and
+  // may only be acquired by one of them.
+  constexpr static uint32_t kHandedOff = 2;
+
+  // Atomically changes |state_| from |from| to kLocked and records the calling
+  // thread as the owner, returning true on success.
+  bool Acquire(uint32_t from);
+
+  // Blocks on the host until the mutex is acquired by the calling thread.
+  void LockSlow();
+
+  // The lock word, one of the values above.
+  volatile uint32_t state_;
+  // The number of threads parked, or about to park, on |futex_|.
+  volatile uint32_t waiters_;
+  // The enc_thread_self() value of the thread that owns the lock, or
+  // kInvalidThread if the mutex is unlocked.
+  volatile uint64_t owner_;
+  // The number of times this lock has been locked recursively.
+  uint64_t recursive_lock_count_;
+  // True if this mutex has been configured as a recursive lock.
+  const bool is_recursive_;
+  // True if Unlock() hands the mutex over to parked waiters.
+  const bool is_fair_;
+  // A futex word in untrusted memory which parked waiters sleep on. It is
+  // incremented by every Unlock() that wakes a waiter, so a waiter which
+  // observed its value before the mutex was released does not go to sleep.
+  int32_t *const futex_;
 };
 
 }  // namespace asylo
@@ -24,9 +24,15 @@
 #include <openssl/evp.h>
 #include <openssl/mem.h>
 #include <openssl/rand.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <functional>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
@@ -85,6 +91,97 @@ bool GenerateDerivedKey(const GcmCryptorKey &wrapping_key,
   return true;
 }
 
+// Owns an AES-256-GCM context, which is set up again for each new key.
+class AeadContext {
+ public:
+  AeadContext() : initialized_(false) {}
+  ~AeadContext() { Cleanup(); }
+
+  bool Init(const GcmCryptorKey &key) {
+    Cleanup();
+    if (!EVP_AEAD_CTX_init(&context_, EVP_aead_aes_256_gcm(),
+                           reinterpret_cast<const uint8_t *>(key.data()),
+                           kKeyLength, kTagLength, nullptr)) {
+      LOG(ERROR) << "EVP_AEAD_CTX_init failed: " << BsslLastErrorString();
+      return false;
+    }
+    initialized_ = true;
+    return true;
+  }
+
+  const EVP_AEAD_CTX *get() const { return &context_; }
+
+ private:
+  void Cleanup() {
+    if (initialized_) {
+      EVP_AEAD_CTX_cleanup(&context_);
+      initialized_ = false;
+    }
+  }
+
+  EVP_AEAD_CTX context_;
+  bool initialized_;
+};
+
+// Maximum number of threads among which a batch of blocks is split.
+std::atomic<size_t> max_batch_threads(1);
+
+// Minimum number of bytes of a batch processed by each thread. Smaller shares
+// are not worth the cost of starting a thread.
+constexpr size_t kMinBytesPerThread = 64 * 1024;
+
+// A share of a batch processed by one thread.
+struct Shard {
+  const std::function<bool(size_t, size_t)> *process;
+  size_t begin;
+  size_t end;
+  bool result;
+};
+
+void *RunShard(void *arg) {
+  Shard *shard = static_cast<Shard *>(arg);
+  shard->result = (*shard->process)(shard->begin, shard->end);
+  return nullptr;
+}
+
+// Calls |process| on consecutive ranges covering the |count| blocks of a
+// batch, in parallel when the batch is large enough and more than one thread
+// is allowed. Returns whether all calls succeeded.
+bool ProcessBlocks(size_t count, size_t block_length,
+                   const std::function<bool(size_t, size_t)> &process) {
+  const size_t num_shards =
+      std::max<size_t>(std::min(max_batch_threads.load(),
+                                count * block_length / kMinBytesPerThread),
+                       1);
+  if (num_shards == 1) {
+    return process(0, count);
+  }
+
+  std::vector<Shard> shards(num_shards);
+  std::vector<pthread_t> threads(num_shards);
+  std::vector<bool> started(num_shards, false);
+  for (size_t i = 0; i < num_shards; i++) {
+    shards[i] = {&process, count * i / num_shards, count * (i + 1) / num_shards,
+                 false};
+  }
+  // The calling thread processes the first shard, as well as any shard for
+  // which a thread could not be started.
+  for (size_t i = 1; i < num_shards; i++) {
+    started[i] =
+        pthread_create(&threads[i], nullptr, RunShard, &shards[i]) == 0;
+  }
+  bool result = process(shards[0].begin, shards[0].end);
+  for (size_t i = 1; i < num_shards; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], nullptr);
+    } else {
+      RunShard(&shards[i]);
+    }
+    result = result && shards[i].result;
+  }
+  return result;
+}
+
 }  // namespace
 
 GcmCryptor::GcmCryptor(size_t block_length, const GcmCryptorKey &gcm_key,
@@ -149,13 +246,24 @@ bool GcmCryptor::EncryptBlock(const uint8_t *plaintext_data, uint8_t *token,
     LOG(ERROR) << "Invalid input to GcmCryptor::EncryptBlock.";
     return false;
   }
+  return EncryptBlocks(1, &plaintext_data, &token, &ciphertext_data);
+}
 
-  absl::MutexLock lock(&mu_);
+bool GcmCryptor::DecryptBlock(const uint8_t *ciphertext_data,
+                              const uint8_t *token, uint8_t *plaintext_data) {
+  if (ciphertext_data == nullptr || token == nullptr ||
+      plaintext_data == nullptr) {
+    LOG(ERROR) << "Invalid input to GcmCryptor::DecryptBlock.";
+    return false;
+  }
+  return DecryptBlocks(1, &ciphertext_data, &token, &plaintext_data);
+}
 
+bool GcmCryptor::GenerateToken(bool *new_key) {
+  *new_key = false;
   if (1 != RAND_bytes(next_token_.nonce, kNonceLength)) {
-    LOG(ERROR)
-        << "Failed to generate random nonce for GcmCryptor::EncryptBlock: "
-        << BsslLastErrorString();
+    LOG(ERROR) << "Failed to generate random nonce for GcmCryptor: "
+               << BsslLastErrorString();
     return false;
   }
 
@@ -163,106 +271,152 @@ bool GcmCryptor::EncryptBlock(const uint8_t *plaintext_data, uint8_t *token,
     key_id_counter_ = 0;
 
     if (1 != RAND_bytes(next_token_.key_id, kKeyIdLength)) {
-      LOG(ERROR)
-          << "Failed to generate random token for GcmCryptor::EncryptBlock: "
-          << BsslLastErrorString();
+      LOG(ERROR) << "Failed to generate random token for GcmCryptor: "
+                 << BsslLastErrorString();
       return false;
     }
 
     if (!GenerateDerivedGcmKey(next_token_.key_id, &next_derived_key_)) {
-      LOG(ERROR) << "Failed to derive key for GcmCryptor::EncryptBlock: "
+      LOG(ERROR) << "Failed to derive key for GcmCryptor: "
                  << BsslLastErrorString();
       return false;
     }
+    *new_key = true;
   }
 
   // Increment the key reuse counter only if the key was successfully generated.
   key_id_counter_++;
+  return true;
+}
 
-  EVP_AEAD_CTX context;
-  if (!EVP_AEAD_CTX_init(
-          &context, EVP_aead_aes_256_gcm(),
-          reinterpret_cast<const uint8_t *>(next_derived_key_.data()),
-          kKeyLength, kTagLength, nullptr)) {
-    LOG(ERROR) << "EVP_AEAD_CTX_init failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
-    return false;
+bool GcmCryptor::EncryptBlocks(size_t count,
+                               const uint8_t *const plaintext_data[],
+                               uint8_t *const tokens[],
+                               uint8_t *const ciphertext_data[]) {
+  if (count == 0) {
+    return true;
   }
-
-  size_t ciphertext_length;
-  size_t max_ciphertext_length = kBlockLength + kTagLength;
-  if (!EVP_AEAD_CTX_seal(&context, ciphertext_data, &ciphertext_length,
-                         max_ciphertext_length, next_token_.nonce, kNonceLength,
-                         plaintext_data, kBlockLength, nullptr, 0)) {
-    LOG(ERROR) << "EVP_AEAD_CTX_seal failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
+  if (plaintext_data == nullptr || tokens == nullptr ||
+      ciphertext_data == nullptr) {
+    LOG(ERROR) << "Invalid input to GcmCryptor::EncryptBlocks.";
     return false;
   }
 
-  if (ciphertext_length != max_ciphertext_length) {
-    LOG(ERROR) << "EVP_AEAD_CTX_seal failed to encrypt complete plaintext, "
-               << "expected ciphertext_length = " << max_ciphertext_length
-               << ", encountered ciphertext_length = " << ciphertext_length;
-    EVP_AEAD_CTX_cleanup(&context);
-    return false;
+  // Assign a token and a derived key to each block while holding the lock, so
+  // that blocks are encrypted as if one at a time, then encrypt without it.
+  std::vector<GcmCryptorKey> keys;
+  std::vector<size_t> key_indices(count);
+  {
+    absl::MutexLock lock(&mu_);
+    for (size_t i = 0; i < count; i++) {
+      bool new_key;
+      if (!GenerateToken(&new_key)) {
+        return false;
+      }
+      if (new_key || keys.empty()) {
+        keys.push_back(next_derived_key_);
+      }
+      key_indices[i] = keys.size() - 1;
+      memcpy(tokens[i], next_token_.data(), kTokenLength);
+    }
   }
 
-  memcpy(token, next_token_.data(), kTokenLength);
-
-  EVP_AEAD_CTX_cleanup(&context);
-  return true;
+  const size_t block_length = kBlockLength;
+  return ProcessBlocks(
+      count, block_length, [&](size_t begin, size_t end) {
+        AeadContext context;
+        size_t context_key = keys.size();
+        for (size_t i = begin; i < end; i++) {
+          if (key_indices[i] != context_key) {
+            context_key = key_indices[i];
+            if (!context.Init(keys[context_key])) {
+              return false;
+            }
+          }
+          // The token begins with the nonce.
+          size_t ciphertext_length;
+          size_t max_ciphertext_length = block_length + kTagLength;
+          if (!EVP_AEAD_CTX_seal(context.get(), ciphertext_data[i],
+                                 &ciphertext_length, max_ciphertext_length,
+                                 tokens[i], kNonceLength, plaintext_data[i],
+                                 block_length, nullptr, 0)) {
+            LOG(ERROR) << "EVP_AEAD_CTX_seal failed: " << BsslLastErrorString();
+            return false;
+          }
+          if (ciphertext_length != max_ciphertext_length) {
+            LOG(ERROR)
+                << "EVP_AEAD_CTX_seal failed to encrypt complete plaintext, "
+                << "expected ciphertext_length = " << max_ciphertext_length
+                << ", encountered ciphertext_length = " << ciphertext_length;
+            return false;
+          }
+        }
+        return true;
+      });
 }
 
-bool GcmCryptor::DecryptBlock(const uint8_t *ciphertext_data,
-                              const uint8_t *token, uint8_t *plaintext_data) {
-  if (ciphertext_data == nullptr || token == nullptr ||
-      plaintext_data == nullptr) {
-    LOG(ERROR) << "Invalid input to GcmCryptor::DecryptBlock.";
-    return false;
+bool GcmCryptor::DecryptBlocks(size_t count,
+                               const uint8_t *const ciphertext_data[],
+                               const uint8_t *const tokens[],
+                               uint8_t *const plaintext_data[]) {
+  if (count == 0) {
+    return true;
   }
-
-  const Token *tok = reinterpret_cast<const Token *>(token);
-
-  GcmCryptorKey derived_key;
-  if (!GenerateDerivedGcmKey(tok->key_id, &derived_key)) {
-    LOG(ERROR) << "Failed to derive key for GcmCryptor::DecryptBlock: "
-               << BsslLastErrorString();
-    return false;
-  }
-
-  EVP_AEAD_CTX context;
-  if (!EVP_AEAD_CTX_init(&context, EVP_aead_aes_256_gcm(),
-                         reinterpret_cast<const uint8_t *>(derived_key.data()),
-                         kKeyLength, kTagLength, nullptr)) {
-    LOG(ERROR) << "EVP_AEAD_CTX_init failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
-    return false;
-  }
-
-  size_t plaintext_length;
-  if (!EVP_AEAD_CTX_open(&context, plaintext_data, &plaintext_length,
-                         kBlockLength, tok->nonce, kNonceLength,
-                         ciphertext_data, kBlockLength + kTagLength, nullptr,
-                         0)) {
-    LOG(ERROR) << "EVP_AEAD_CTX_open failed: " << BsslLastErrorString();
-    EVP_AEAD_CTX_cleanup(&context);
+  if (ciphertext_data == nullptr || tokens == nullptr ||
+      plaintext_data == nullptr) {
+    LOG(ERROR) << "Invalid input to GcmCryptor::DecryptBlocks.";
     return false;
   }
 
-  if (plaintext_length != kBlockLength) {
-    LOG(ERROR) << "EVP_AEAD_CTX_open failed to decrypt complete ciphertext, "
-               << "expected plaintext_length = " << kBlockLength
-               << ", encountered plaintext_length = " << plaintext_length;
-    EVP_AEAD_CTX_cleanup(&context);
-    return false;
-  }
+  const size_t block_length = kBlockLength;
+  return ProcessBlocks(count, block_length, [&](size_t begin, size_t end) {
+    AeadContext context;
+    const uint8_t *context_key_id = nullptr;
+    for (size_t i = begin; i < end; i++) {
+      const Token *tok = reinterpret_cast<const Token *>(tokens[i]);
+
+      // Blocks encrypted together usually share a key ID, so only derive a key
+      // when it changes.
+      if (!context_key_id ||
+          memcmp(context_key_id, tok->key_id, kKeyIdLength) != 0) {
+        GcmCryptorKey derived_key;
+        if (!GenerateDerivedGcmKey(tok->key_id, &derived_key)) {
+          LOG(ERROR) << "Failed to derive key for GcmCryptor::DecryptBlocks: "
+                     << BsslLastErrorString();
+          return false;
+        }
+        if (!context.Init(derived_key)) {
+          return false;
+        }
+        context_key_id = tok->key_id;
+      }
+
+      size_t plaintext_length;
+      if (!EVP_AEAD_CTX_open(context.get(), plaintext_data[i],
+                             &plaintext_length, block_length, tok->nonce,
+                             kNonceLength, ciphertext_data[i],
+                             block_length + kTagLength, nullptr, 0)) {
+        LOG(ERROR) << "EVP_AEAD_CTX_open failed: " << BsslLastErrorString();
+        return false;
+      }
+      if (plaintext_length != block_length) {
+        LOG(ERROR)
+            << "EVP_AEAD_CTX_open failed to decrypt complete ciphertext, "
+            << "expected plaintext_length = " << block_length
+            << ", encountered plaintext_length = " << plaintext_length;
+        return false;
+      }
+    }
+    return true;
+  });
+}
 
-  EVP_AEAD_CTX_cleanup(&context);
-  return true;
+void GcmCryptor::SetMaxBatchThreads(size_t max_threads) {
+  max_batch_threads.store(std::max<size_t>(max_threads, 1));
 }
 
 bool GcmCryptor::GenerateDerivedGcmKey(const uint8_t *key_id,
-                                       GcmCryptorKey *dk) {
+                                       GcmCryptorKey *dk) const {
   return GenerateDerivedKey(kGcmKey, key_id, dk);
 }
 
@@ -287,14 +441,14 @@ GcmCryptor *GcmCryptorRegistry::GetGcmCryptor(size_t block_length,
                                               const GcmCryptorKey &key) {
   absl::MutexLock lock(&mu_);
 
-  auto it = cryptor_registry_.find(key);
-  if (it != cryptor_registry_.end()) {
-    return it->second.get();
+  // Files with different block lengths may share a key, so cryptors are
+  // registered per block length.
+  std::unique_ptr<GcmCryptor> &cryptor =
+      cryptor_registry_[key][block_length];
+  if (!cryptor) {
+    cryptor = GcmCryptor::Create(block_length, key);
   }
-
-  auto result =
-      cryptor_registry_.emplace(key, GcmCryptor::Create(block_length, key));
-  return result.first->second.get();
+  return cryptor.get();
 }
 
 }  // namespace gcmlib
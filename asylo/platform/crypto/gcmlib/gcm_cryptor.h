@@ -68,6 +68,28 @@ class GcmCryptor {
   bool DecryptBlock(const uint8_t *ciphertext_data, const uint8_t *token,
                     uint8_t *plaintext_data);
 
+  // Encrypts |count| blocks as EncryptBlock does, reading the |i|th plaintext
+  // block from |plaintext_data[i]| and writing its token and ciphertext to
+  // |tokens[i]| and |ciphertext_data[i]|. Keys are derived and AES-GCM is set
+  // up once per run of blocks sharing a key rather than once per block, and
+  // large batches are split among threads as set by SetMaxBatchThreads().
+  // Returns false if any block fails, in which case the output is undefined.
+  bool EncryptBlocks(size_t count, const uint8_t *const plaintext_data[],
+                     uint8_t *const tokens[], uint8_t *const ciphertext_data[]);
+
+  // Decrypts |count| blocks as DecryptBlock does, with the same batching as
+  // EncryptBlocks. Returns false if any block fails to decrypt or verify, in
+  // which case the output is undefined.
+  bool DecryptBlocks(size_t count, const uint8_t *const ciphertext_data[],
+                     const uint8_t *const tokens[],
+                     uint8_t *const plaintext_data[]);
+
+  // Sets the maximum number of threads, including the calling thread, among
+  // which EncryptBlocks and DecryptBlocks split a large batch. Each extra
+  // thread is started with pthread_create, so enclaves should only raise this
+  // from the default of 1 when they have threads to spare.
+  static void SetMaxBatchThreads(size_t max_threads);
+
   // Generates auth tag, in particular CMAC, for the specified data. Returns
   // true on success, false on failure.
   bool GetAuthTag(uint8_t out[16], const uint8_t *in, size_t in_len) const;
@@ -86,7 +108,11 @@ class GcmCryptor {
 
   GcmCryptor(size_t block_length, const GcmCryptorKey &gcm_key,
              const GcmCryptorKey &cmac_key);
-  bool GenerateDerivedGcmKey(const uint8_t *key_id, GcmCryptorKey *dk);
+  bool GenerateDerivedGcmKey(const uint8_t *key_id, GcmCryptorKey *dk) const;
+
+  // Generates the next token, along with a new derived key every kKeyIdCycle
+  // tokens. Sets |new_key| if the derived key changed.
+  bool GenerateToken(bool *new_key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   const size_t kBlockLength;
   const GcmCryptorKey kGcmKey;
@@ -109,7 +135,8 @@ class GcmCryptorRegistry {
     return *instance;
   }
 
-  // Accessor to the instance of GCM cryptor associated with a given key.
+  // Accessor to the instance of GCM cryptor associated with a given key and
+  // block length.
   GcmCryptor *GetGcmCryptor(size_t block_length, const GcmCryptorKey &key)
       ABSL_LOCKS_EXCLUDED(mu_);
 
@@ -140,8 +167,10 @@ class GcmCryptorRegistry {
   // primitives interface where system calls might not be available, so we use
   // std::unordered_map instead of absl::flat_hash_map to prevent unsafe system
   // calls made by absl based containers.
-  std::unordered_map<GcmCryptorKey, std::unique_ptr<GcmCryptor>,
-                     SafeBytesHasher>
+  std::unordered_map<
+      GcmCryptorKey,
+      std::unordered_map<size_t, std::unique_ptr<GcmCryptor>>,
+      SafeBytesHasher>
       cryptor_registry_ ABSL_GUARDED_BY(mu_);
   absl::Mutex mu_;
 };
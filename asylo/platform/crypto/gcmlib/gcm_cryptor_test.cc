@@ -20,6 +20,9 @@
 
 #include <openssl/rand.h>
 
+#include <vector>
+
+#include <benchmark/benchmark.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "asylo/crypto/util/bytes.h"
@@ -195,6 +198,99 @@ TEST(GcmCryptorTest, DecryptWithAlteredCiphertextFails) {
       decryptor->DecryptBlock(encryptor_buffer, token, decryptor_buffer));
 }
 
+// Buffers for a batch of blocks, and pointers to each block in them.
+struct Batch {
+  Batch(size_t count, size_t block_length)
+      : plaintext(count * block_length),
+        ciphertext(count * (block_length + kTagLength)),
+        tokens(count * kTokenLength),
+        decrypted(count * block_length) {
+    for (size_t i = 0; i < count; i++) {
+      plaintext_blocks.push_back(&plaintext[i * block_length]);
+      ciphertext_blocks.push_back(&ciphertext[i * (block_length + kTagLength)]);
+      token_blocks.push_back(&tokens[i * kTokenLength]);
+      decrypted_blocks.push_back(&decrypted[i * block_length]);
+    }
+  }
+
+  std::vector<uint8_t> plaintext;
+  std::vector<uint8_t> ciphertext;
+  std::vector<uint8_t> tokens;
+  std::vector<uint8_t> decrypted;
+  std::vector<const uint8_t *> plaintext_blocks;
+  std::vector<uint8_t *> ciphertext_blocks;
+  std::vector<uint8_t *> token_blocks;
+  std::vector<uint8_t *> decrypted_blocks;
+};
+
+// Tests batches are interchangeable with single blocks, including batches that
+// span several key IDs and are split among threads.
+TEST(GcmCryptorTest, DecryptBlocksAfterEncryptBlocksReturnsOriginalTexts) {
+  GcmCryptorKey key;
+  ASSERT_EQ(RAND_bytes(key.data(), key.size()), 1);
+  auto encryptor = GcmCryptor::Create(kBlockLength, key);
+  auto decryptor = GcmCryptor::Create(kBlockLength, key);
+  for (size_t max_threads : {1, 4}) {
+    GcmCryptor::SetMaxBatchThreads(max_threads);
+    // Large enough to be split among four threads.
+    const size_t kNumBlocks = 8 * kKeyIdCycle + 7;
+    Batch batch(kNumBlocks, kBlockLength);
+    ASSERT_EQ(RAND_bytes(batch.plaintext.data(), batch.plaintext.size()), 1);
+
+    // Start the batch in the middle of a key ID cycle.
+    uint8_t token[kTokenLength];
+    uint8_t ciphertext[kBlockLength + kTagLength];
+    ASSERT_TRUE(encryptor->EncryptBlock(batch.plaintext_blocks[0], token,
+                                        ciphertext));
+    ASSERT_TRUE(encryptor->EncryptBlocks(
+        kNumBlocks, batch.plaintext_blocks.data(), batch.token_blocks.data(),
+        batch.ciphertext_blocks.data()));
+    size_t key_ids = 1;
+    for (size_t i = 1; i < kNumBlocks; i++) {
+      EXPECT_NE(memcmp(batch.token_blocks[i - 1], batch.token_blocks[i],
+                       kNonceLength),
+                0);
+      key_ids += memcmp(batch.token_blocks[i - 1] + kNonceLength,
+                        batch.token_blocks[i] + kNonceLength,
+                        kKeyIdLength) != 0;
+    }
+    // The first kKeyIdCycle - 1 blocks share the key ID of the single block.
+    EXPECT_EQ(key_ids, 9);
+
+    ASSERT_TRUE(decryptor->DecryptBlocks(
+        kNumBlocks, batch.ciphertext_blocks.data(), batch.token_blocks.data(),
+        batch.decrypted_blocks.data()));
+    EXPECT_EQ(batch.plaintext, batch.decrypted);
+
+    uint8_t decrypted[kBlockLength];
+    ASSERT_TRUE(decryptor->DecryptBlock(batch.ciphertext_blocks[kNumBlocks - 1],
+                                        batch.token_blocks[kNumBlocks - 1],
+                                        decrypted));
+    EXPECT_EQ(memcmp(batch.plaintext_blocks[kNumBlocks - 1], decrypted,
+                     kBlockLength),
+              0);
+  }
+  GcmCryptor::SetMaxBatchThreads(1);
+}
+
+// Tests a batch fails to decrypt when any of its blocks was altered.
+TEST(GcmCryptorTest, DecryptBlocksWithAlteredBlockFails) {
+  GcmCryptorKey key;
+  ASSERT_EQ(RAND_bytes(key.data(), key.size()), 1);
+  auto cryptor = GcmCryptor::Create(kBlockLength, key);
+  const size_t kNumBlocks = 64;
+  Batch batch(kNumBlocks, kBlockLength);
+  ASSERT_EQ(RAND_bytes(batch.plaintext.data(), batch.plaintext.size()), 1);
+  ASSERT_TRUE(cryptor->EncryptBlocks(
+      kNumBlocks, batch.plaintext_blocks.data(), batch.token_blocks.data(),
+      batch.ciphertext_blocks.data()));
+
+  ++batch.ciphertext_blocks[kNumBlocks / 2][0];
+  EXPECT_FALSE(cryptor->DecryptBlocks(
+      kNumBlocks, batch.ciphertext_blocks.data(), batch.token_blocks.data(),
+      batch.decrypted_blocks.data()));
+}
+
 // Tests GCM cryptor registry returns consistent instance of GCM cryptor.
 TEST(GcmCryptorTest, GetGcmCryptorIsConsistent) {
   GcmCryptorKey key;
@@ -209,5 +305,54 @@ TEST(GcmCryptorTest, GetGcmCryptorIsConsistent) {
   EXPECT_EQ(c1, c2);
 }
 
+constexpr size_t kBenchmarkLength = 1024 * 1024;
+
+// Encrypts and decrypts kBenchmarkLength bytes in blocks of |state.range(0)|
+// bytes, one block at a time.
+void BM_EncryptDecryptBlock(benchmark::State &state) {
+  const size_t block_length = state.range(0);
+  const size_t count = kBenchmarkLength / block_length;
+  GcmCryptorKey key;
+  RAND_bytes(key.data(), key.size());
+  auto cryptor = GcmCryptor::Create(block_length, key);
+  Batch batch(count, block_length);
+  for (auto _ : state) {
+    for (size_t i = 0; i < count; i++) {
+      cryptor->EncryptBlock(batch.plaintext_blocks[i], batch.token_blocks[i],
+                            batch.ciphertext_blocks[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+      cryptor->DecryptBlock(batch.ciphertext_blocks[i], batch.token_blocks[i],
+                            batch.decrypted_blocks[i]);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * 2 * kBenchmarkLength);
+}
+
+// Encrypts and decrypts kBenchmarkLength bytes in blocks of |state.range(0)|
+// bytes as one batch, split among up to |state.range(1)| threads.
+void BM_EncryptDecryptBlocks(benchmark::State &state) {
+  const size_t block_length = state.range(0);
+  const size_t count = kBenchmarkLength / block_length;
+  GcmCryptor::SetMaxBatchThreads(state.range(1));
+  GcmCryptorKey key;
+  RAND_bytes(key.data(), key.size());
+  auto cryptor = GcmCryptor::Create(block_length, key);
+  Batch batch(count, block_length);
+  for (auto _ : state) {
+    cryptor->EncryptBlocks(count, batch.plaintext_blocks.data(),
+                           batch.token_blocks.data(),
+                           batch.ciphertext_blocks.data());
+    cryptor->DecryptBlocks(count, batch.ciphertext_blocks.data(),
+                           batch.token_blocks.data(),
+                           batch.decrypted_blocks.data());
+  }
+  state.SetBytesProcessed(state.iterations() * 2 * kBenchmarkLength);
+  GcmCryptor::SetMaxBatchThreads(1);
+}
+
+BENCHMARK(BM_EncryptDecryptBlock)->Arg(128)->Arg(4096);
+BENCHMARK(BM_EncryptDecryptBlocks)->ArgsProduct({{128, 4096}, {1, 2, 4}});
+
 }  // namespace
 }  // namespace asylo
@@ -139,9 +139,30 @@ static constexpr uint64_t kSysFutexWakeHandler =
 static constexpr uint64_t kLocalLifetimeAllocHandler =
     primitives::kSelectorHostCall + 30;
 
+// Exit handler constant for the handler returning the switchless host call
+// ring. Only registered when switchless host calls are enabled for an enclave.
+static constexpr uint64_t kSwitchlessRingHandler =
+    primitives::kSelectorHostCall + 31;
+
+// Exit handler constant for |SystemCallBatchHandler|.
+static constexpr uint64_t kSystemCallBatchHandler =
+    primitives::kSelectorHostCall + 32;
+
+// Exit handler constant for |WriteWithUntrustedPtrHandler|.
+static constexpr uint64_t kWriteWithUntrustedPtr =
+    primitives::kSelectorHostCall + 33;
+
+// Exit handler constant for |RecvWithUntrustedPtrHandler|.
+static constexpr uint64_t kRecvWithUntrustedPtr =
+    primitives::kSelectorHostCall + 34;
+
+// Exit handler constant for |SendWithUntrustedPtrHandler|.
+static constexpr uint64_t kSendWithUntrustedPtr =
+    primitives::kSelectorHostCall + 35;
+
 // Assert that the largest host call handler lies in
 // [kSelectorHostCall, kSelectorRemote).
-static_assert(kLocalLifetimeAllocHandler < primitives::kSelectorRemote,
+static_assert(kSendWithUntrustedPtr < primitives::kSelectorRemote,
               "Cannot have host call handler constant spill over into "
               "|kSelectorRemote|.");
 
@@ -0,0 +1,109 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_HOST_CALL_SWITCHLESS_RING_H_
+#define ASYLO_PLATFORM_HOST_CALL_SWITCHLESS_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace asylo {
+namespace host_call {
+
+// This file declares the layout of the request ring shared between trusted
+// threads and the untrusted worker threads servicing switchless host calls.
+// The ring is allocated in untrusted memory by the untrusted side, so every
+// field (including the slot states) may be modified by an attacker at any
+// time. Trusted code must read each field exactly once and validate it before
+// use.
+
+// Magic value stored at the head of a well-formed ring.
+static constexpr uint64_t kSwitchlessRingMagic = 0x41534c5953574c53;
+
+// Maximum size of a serialized system call request that can be posted to a
+// slot. Larger requests fall back to a regular enclave exit.
+static constexpr size_t kSwitchlessRequestCapacity = 4096;
+
+// Slot states. A slot cycles through
+//   kSlotFree -> kSlotReserved -> kSlotPosted -> kSlotClaimed -> kSlotDone
+// and back to kSlotFree. A trusted thread may also cancel a posted slot which
+// no worker has claimed yet by moving it from kSlotPosted back to kSlotFree.
+enum SwitchlessSlotState : uint32_t {
+  kSlotFree = 0,      // Available for a trusted thread to reserve.
+  kSlotReserved = 1,  // Owned by a trusted thread writing a request.
+  kSlotPosted = 2,    // Request ready, waiting for a worker.
+  kSlotClaimed = 3,   // A worker is executing the request.
+  kSlotDone = 4,      // Response ready, waiting for the trusted thread.
+};
+
+// A single request/response slot.
+struct alignas(64) SwitchlessSlot {
+  // Current SwitchlessSlotState of the slot.
+  std::atomic<uint32_t> state;
+
+  // Status code of the host-side dispatch, 0 on success. Written by the worker
+  // before it publishes kSlotDone.
+  int32_t status_code;
+
+  // Number of valid bytes in |request|. Written by the trusted thread before it
+  // publishes kSlotPosted.
+  uint64_t request_size;
+
+  // Serialized response owned by the untrusted side and valid until the slot
+  // is reused. Written by the worker before it publishes kSlotDone.
+  uint8_t *response;
+  uint64_t response_size;
+
+  // Allocated size of |response|. Only used by the untrusted side, which
+  // reuses the buffer across requests to avoid an allocation per call.
+  uint64_t response_capacity;
+
+  // Serialized system call request.
+  uint8_t request[kSwitchlessRequestCapacity];
+};
+
+// Ring header followed in memory by |slot_count| SwitchlessSlot entries.
+struct alignas(64) SwitchlessRing {
+  uint64_t magic;
+  uint64_t slot_count;
+
+  // Hint used by trusted threads to spread reservations across slots.
+  std::atomic<uint64_t> next_slot;
+
+  SwitchlessSlot *slots() {
+    return reinterpret_cast<SwitchlessSlot *>(this + 1);
+  }
+
+  // Returns the number of bytes needed for a ring with |slot_count| slots.
+  static constexpr size_t AllocationSize(size_t slot_count) {
+    return sizeof(SwitchlessRing) + slot_count * sizeof(SwitchlessSlot);
+  }
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "Switchless slot state must be lock free to be shared across "
+              "the enclave boundary.");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Switchless ring hint must be lock free to be shared across the "
+              "enclave boundary.");
+
+}  // namespace host_call
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_HOST_CALL_SWITCHLESS_RING_H_
@@ -0,0 +1,238 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/host_call/trusted/bulk_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/flags/flag.h"
+#include "absl/strings/str_cat.h"
+#include "asylo/platform/host_call/trusted/host_calls.h"
+#include "asylo/platform/system_call/sysno.h"
+#include "asylo/test/util/test_flags.h"
+
+namespace asylo {
+namespace host_call {
+namespace {
+
+// Transfer sizes exercised by the tests and benchmarks.
+constexpr size_t kSmallTransfer = kBulkIoThreshold / 2;
+constexpr size_t kLargeTransfer = 3 * 1024 * 1024 + 17;
+
+std::vector<uint8_t> MakePattern(size_t size) {
+  std::vector<uint8_t> pattern(size);
+  for (size_t i = 0; i < size; ++i) {
+    pattern[i] = static_cast<uint8_t>(i * 31 + 7);
+  }
+  return pattern;
+}
+
+class BulkIoTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = absl::StrCat(absl::GetFlag(FLAGS_test_tmpdir), "/bulk_io_test");
+    fd_ = enc_untrusted_open(path_.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    ASSERT_GE(fd_, 0);
+  }
+
+  void TearDown() override {
+    enc_untrusted_close(fd_);
+    enc_untrusted_unlink(path_.c_str());
+  }
+
+  std::string path_;
+  int fd_;
+};
+
+// Writes through the bulk path and reads back through the serialized system
+// call path, and vice versa, checking both agree byte for byte.
+TEST_F(BulkIoTest, BulkAndSerializedPathsAgree) {
+  for (size_t size : {kBulkIoThreshold, kLargeTransfer}) {
+    std::vector<uint8_t> pattern = MakePattern(size);
+    std::vector<uint8_t> received(size);
+
+    ASSERT_EQ(BulkPwrite(fd_, pattern.data(), size, 0), size);
+    ASSERT_EQ(EnsureInitializedAndDispatchSyscall(system_call::kSYS_pread64,
+                                                  fd_, received.data(), size,
+                                                  0),
+              size);
+    EXPECT_EQ(received, pattern);
+
+    std::fill(received.begin(), received.end(), 0);
+    ASSERT_EQ(BulkPread(fd_, received.data(), size, 0), size);
+    EXPECT_EQ(received, pattern);
+  }
+}
+
+// Checks that read and write through the public host calls advance the file
+// offset and that a read past the end of the file is short.
+TEST_F(BulkIoTest, ReadAndWriteAdvanceOffset) {
+  std::vector<uint8_t> pattern = MakePattern(kLargeTransfer);
+  ASSERT_EQ(enc_untrusted_write(fd_, pattern.data(), kSmallTransfer),
+            kSmallTransfer);
+  ASSERT_EQ(enc_untrusted_write(fd_, pattern.data() + kSmallTransfer,
+                                kLargeTransfer - kSmallTransfer),
+            kLargeTransfer - kSmallTransfer);
+  ASSERT_EQ(enc_untrusted_lseek(fd_, 0, SEEK_SET), 0);
+
+  std::vector<uint8_t> received(kLargeTransfer + kBulkIoThreshold);
+  ASSERT_EQ(enc_untrusted_read(fd_, received.data(), received.size()),
+            kLargeTransfer);
+  received.resize(kLargeTransfer);
+  EXPECT_EQ(received, pattern);
+}
+
+// Splits |buffer| into |count| buffers of uneven lengths, including an empty
+// one.
+std::vector<struct iovec> SplitIntoIovec(std::vector<uint8_t> *buffer,
+                                         int count) {
+  std::vector<struct iovec> iov;
+  size_t offset = 0;
+  for (int i = 0; i < count; ++i) {
+    size_t length = i == count - 1 ? buffer->size() - offset
+                                   : (buffer->size() - offset) * i / count;
+    iov.push_back({buffer->data() + offset, length});
+    offset += length;
+  }
+  return iov;
+}
+
+// Writes and reads vectors through both the small and the bulk path, checking
+// they transfer the buffers in order, at the file offset or at the given
+// offset.
+TEST_F(BulkIoTest, VectoredIo) {
+  for (size_t size : {kSmallTransfer, kLargeTransfer}) {
+    ASSERT_EQ(enc_untrusted_ftruncate(fd_, 0), 0);
+    ASSERT_EQ(enc_untrusted_lseek(fd_, 0, SEEK_SET), 0);
+    std::vector<uint8_t> pattern = MakePattern(size);
+    std::vector<struct iovec> iov = SplitIntoIovec(&pattern, 5);
+    ASSERT_EQ(enc_untrusted_writev(fd_, iov.data(), iov.size()), size);
+    ASSERT_EQ(enc_untrusted_pwritev(fd_, iov.data(), iov.size(), size), size);
+    EXPECT_EQ(enc_untrusted_lseek(fd_, 0, SEEK_CUR), size);
+
+    std::vector<uint8_t> received(size);
+    ASSERT_EQ(enc_untrusted_pread64(fd_, received.data(), size, size), size);
+    EXPECT_EQ(received, pattern);
+
+    // Read into buffers larger than the rest of the file, so that the read is
+    // short and fills the leading buffers only.
+    received.assign(size + kBulkIoThreshold, 0);
+    std::vector<struct iovec> received_iov = SplitIntoIovec(&received, 7);
+    ASSERT_EQ(enc_untrusted_preadv(fd_, received_iov.data(),
+                                   received_iov.size(), size),
+              size);
+    EXPECT_TRUE(std::equal(pattern.begin(), pattern.end(), received.begin()));
+    ASSERT_EQ(enc_untrusted_lseek(fd_, 0, SEEK_SET), 0);
+    received.assign(size, 0);
+    received_iov = SplitIntoIovec(&received, 3);
+    ASSERT_EQ(
+        enc_untrusted_readv(fd_, received_iov.data(), received_iov.size()),
+        size);
+    EXPECT_EQ(received, pattern);
+    EXPECT_EQ(enc_untrusted_lseek(fd_, 0, SEEK_CUR), size);
+  }
+}
+
+// Checks that malformed vectors are rejected without a host call.
+TEST_F(BulkIoTest, RejectsInvalidVectors) {
+  std::vector<uint8_t> buffer(kSmallTransfer);
+  struct iovec iov = {buffer.data(), buffer.size()};
+  EXPECT_EQ(enc_untrusted_writev(fd_, &iov, -1), -1);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(enc_untrusted_preadv(fd_, &iov, 1, -1), -1);
+  EXPECT_EQ(errno, EINVAL);
+  struct iovec overflowing[2] = {{buffer.data(), SSIZE_MAX},
+                                 {buffer.data(), 1}};
+  EXPECT_EQ(enc_untrusted_readv(fd_, overflowing, 2), -1);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(enc_untrusted_writev(fd_, nullptr, 0), 0);
+}
+
+// Checks that errors from the host are reported through errno.
+TEST_F(BulkIoTest, ReportsHostErrors) {
+  std::vector<uint8_t> buffer(kBulkIoThreshold);
+  EXPECT_EQ(BulkRead(-1, buffer.data(), buffer.size()), -1);
+  EXPECT_EQ(errno, EBADF);
+  EXPECT_EQ(BulkPwrite(fd_, buffer.data(), buffer.size(), -1), -1);
+  EXPECT_EQ(errno, EINVAL);
+}
+
+// The benchmarks below move |state.range(0)| bytes per iteration through either
+// the serialized system call path or the bulk path, so that their throughput
+// can be compared across transfer sizes.
+void BM_SerializedRead(benchmark::State &state) {
+  int fd = enc_untrusted_open("/dev/zero", O_RDONLY);
+  std::vector<uint8_t> buffer(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(EnsureInitializedAndDispatchSyscall(
+        system_call::kSYS_read, fd, buffer.data(), buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  enc_untrusted_close(fd);
+}
+
+void BM_BulkRead(benchmark::State &state) {
+  int fd = enc_untrusted_open("/dev/zero", O_RDONLY);
+  std::vector<uint8_t> buffer(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(BulkRead(fd, buffer.data(), buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  enc_untrusted_close(fd);
+}
+
+void BM_SerializedWrite(benchmark::State &state) {
+  int fd = enc_untrusted_open("/dev/null", O_WRONLY);
+  std::vector<uint8_t> buffer = MakePattern(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(EnsureInitializedAndDispatchSyscall(
+        system_call::kSYS_write, fd, buffer.data(), buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  enc_untrusted_close(fd);
+}
+
+void BM_BulkWrite(benchmark::State &state) {
+  int fd = enc_untrusted_open("/dev/null", O_WRONLY);
+  std::vector<uint8_t> buffer = MakePattern(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(BulkWrite(fd, buffer.data(), buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  enc_untrusted_close(fd);
+}
+
+BENCHMARK(BM_SerializedRead)->RangeMultiplier(4)->Range(1 << 10, 16 << 20);
+BENCHMARK(BM_BulkRead)->RangeMultiplier(4)->Range(1 << 10, 16 << 20);
+BENCHMARK(BM_SerializedWrite)->RangeMultiplier(4)->Range(1 << 10, 16 << 20);
+BENCHMARK(BM_BulkWrite)->RangeMultiplier(4)->Range(1 << 10, 16 << 20);
+
+}  // namespace
+}  // namespace host_call
+}  // namespace asylo
@@ -154,6 +154,12 @@ constexpr uint64_t kTestGetSockOpt = kHostLibCSelector + 12;
 constexpr uint64_t kTestGetAddrInfo = kHostLibCSelector + 13;
 constexpr uint64_t kTestClockGettime = kHostLibCSelector + 14;
 
+// Installs the switchless host call ring inside the enclave.
+constexpr uint64_t kTestInitializeSwitchless = kHostLibCSelector + 15;
+
+// Submits a batch of system calls with enc_untrusted_submit_batch().
+constexpr uint64_t kTestSubmitBatch = kHostLibCSelector + 16;
+
 }  // namespace host_call
 }  // namespace asylo
 
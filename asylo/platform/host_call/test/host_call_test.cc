@@ -50,6 +50,7 @@
 #include "asylo/platform/common/time_util.h"
 #include "asylo/platform/host_call/test/enclave_test_selectors.h"
 #include "asylo/platform/host_call/untrusted/host_call_handlers_initializer.h"
+#include "asylo/platform/host_call/untrusted/switchless_host_call_server.h"
 #include "asylo/platform/primitives/extent.h"
 #include "asylo/platform/primitives/test/test_backend.h"
 #include "asylo/platform/primitives/untrusted_primitives.h"
@@ -278,6 +279,66 @@ TEST_F(HostCallTest, TestGetpid) {
   EXPECT_THAT(out.next<pid_t>(), Eq(getpid()));
 }
 
+// Tests that system calls are serviced by the switchless workers once the
+// enclave has installed the switchless ring, and still return correct results.
+TEST_F(HostCallTest, TestSwitchlessGetpid) {
+  SwitchlessHostCallConfig config;
+  config.set_enabled(true);
+  config.set_ring_slots(4);
+  config.set_worker_threads(2);
+  auto server_result = EnableSwitchlessHostCalls(client_, config);
+  ASYLO_ASSERT_OK(server_result);
+  std::shared_ptr<SwitchlessHostCallServer> server = server_result.value();
+
+  MessageWriter init_in;
+  MessageReader init_out;
+  ASYLO_ASSERT_OK(
+      client_->EnclaveCall(kTestInitializeSwitchless, &init_in, &init_out));
+  ASSERT_THAT(init_out, SizeIs(1));
+  ASSERT_TRUE(init_out.next<bool>());
+
+  // Requests not claimed in time fall back to regular exits, so issue several
+  // calls and only require that some were serviced by the workers.
+  for (int i = 0; i < 100; ++i) {
+    MessageWriter in;
+    MessageReader out;
+    ASYLO_ASSERT_OK(client_->EnclaveCall(kTestGetPid, &in, &out));
+    ASSERT_THAT(out, SizeIs(1));
+    EXPECT_THAT(out.next<pid_t>(), Eq(getpid()));
+  }
+  EXPECT_THAT(server->requests_handled(), Gt(0));
+}
+
+// Tests that system calls outside the switchless allowlist, such as the
+// thread-affine getrusage(), always take a regular exit.
+TEST_F(HostCallTest, TestSwitchlessSkipsDisallowedSystemCalls) {
+  SwitchlessHostCallConfig config;
+  config.set_enabled(true);
+  config.set_ring_slots(4);
+  config.set_worker_threads(2);
+  auto server_result = EnableSwitchlessHostCalls(client_, config);
+  ASYLO_ASSERT_OK(server_result);
+  std::shared_ptr<SwitchlessHostCallServer> server = server_result.value();
+
+  MessageWriter init_in;
+  MessageReader init_out;
+  ASYLO_ASSERT_OK(
+      client_->EnclaveCall(kTestInitializeSwitchless, &init_in, &init_out));
+  ASSERT_THAT(init_out, SizeIs(1));
+  ASSERT_TRUE(init_out.next<bool>());
+
+  uint64_t requests_handled = server->requests_handled();
+  for (int i = 0; i < 10; ++i) {
+    MessageWriter in;
+    in.Push<int>(RUSAGE_SELF);
+    MessageReader out;
+    ASYLO_ASSERT_OK(client_->EnclaveCall(kTestGetRusage, &in, &out));
+    ASSERT_THAT(out, SizeIs(2));
+    EXPECT_THAT(out.next<int>(), Eq(0));
+  }
+  EXPECT_THAT(server->requests_handled(), Eq(requests_handled));
+}
+
 // Tests enc_untrusted_getppid() by calling it from inside the enclave and
 // verifying its return value against ppid obtained from native system call.
 TEST_F(HostCallTest, TestGetPpid) {
@@ -820,6 +881,39 @@ TEST_F(HostCallTest, TestWrite) {
   EXPECT_THAT(read_buf, StrEq(write_buf));
 }
 
+// Tests enc_untrusted_submit_batch() by issuing two writes and a getpid from
+// inside the enclave in a single batch, and verifying that the writes were
+// performed in order and every result was returned.
+TEST_F(HostCallTest, TestSubmitBatch) {
+  std::string test_file =
+      absl::StrCat(absl::GetFlag(FLAGS_test_tmpdir), "/test_file.tmp");
+
+  int fd =
+      open(test_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  platform::storage::FdCloser fd_closer(fd);
+  ASSERT_GE(fd, 0);
+
+  std::string first = "batched ";
+  std::string second = "writes";
+  MessageWriter in;
+  in.Push<int>(/*value=fd=*/fd);
+  in.PushString(first.data(), first.size());
+  in.PushString(second.data(), second.size());
+
+  MessageReader out;
+  ASYLO_ASSERT_OK(client_->EnclaveCall(kTestSubmitBatch, &in, &out));
+  ASSERT_THAT(out, SizeIs(3));  // One result per batched system call.
+  EXPECT_THAT(out.next<int64_t>(), Eq(first.size()));
+  EXPECT_THAT(out.next<int64_t>(), Eq(second.size()));
+  EXPECT_THAT(out.next<int64_t>(), Eq(getpid()));
+
+  ASSERT_THAT(lseek(fd, 0, SEEK_SET), Eq(0));
+  char read_buf[20] = {};
+  EXPECT_THAT(read(fd, read_buf, first.size() + second.size()),
+              Eq(first.size() + second.size()));
+  EXPECT_THAT(read_buf, StrEq(first + second));
+}
+
 // Tests enc_untrusted_symlink() by attempting to create a symlink from inside
 // the enclave and verifying that the created symlink is accessible.
 TEST_F(HostCallTest, TestSymlink) {
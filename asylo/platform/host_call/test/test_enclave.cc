@@ -31,6 +31,7 @@
 #include "asylo/platform/host_call/test/enclave_test_selectors.h"
 #include "asylo/platform/host_call/trusted/host_call_dispatcher.h"
 #include "asylo/platform/host_call/trusted/host_calls.h"
+#include "asylo/platform/host_call/trusted/switchless.h"
 #include "asylo/platform/primitives/primitive_status.h"
 #include "asylo/platform/primitives/trusted_primitives.h"
 #include "asylo/platform/primitives/trusted_runtime.h"
@@ -1118,6 +1119,39 @@ PrimitiveStatus TestFXattr(void *context, MessageReader *in,
   return PrimitiveStatus::OkStatus();
 }
 
+PrimitiveStatus TestInitializeSwitchless(void *context, MessageReader *in,
+                                         MessageWriter *out) {
+  ASYLO_RETURN_IF_READER_NOT_EMPTY(*in);
+  ASYLO_RETURN_IF_ERROR(InitializeSwitchlessHostCalls());
+  out->Push<bool>(SwitchlessHostCallsEnabled());
+  return PrimitiveStatus::OkStatus();
+}
+
+PrimitiveStatus TestSubmitBatch(void *context, MessageReader *in,
+                                MessageWriter *out) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*in, 3);
+  int fd = in->next<int>();
+  const auto first = in->next();
+  const auto second = in->next();
+
+  SystemCallBatchEntry entries[3] = {};
+  entries[0].sysno = asylo::system_call::kSYS_write;
+  entries[0].parameters[0] = fd;
+  entries[0].parameters[1] = reinterpret_cast<uint64_t>(first.data());
+  entries[0].parameters[2] = first.size();
+  entries[1].sysno = asylo::system_call::kSYS_write;
+  entries[1].parameters[0] = fd;
+  entries[1].parameters[1] = reinterpret_cast<uint64_t>(second.data());
+  entries[1].parameters[2] = second.size();
+  entries[2].sysno = asylo::system_call::kSYS_getpid;
+  enc_untrusted_submit_batch(entries, ABSL_ARRAYSIZE(entries));
+
+  for (const auto &entry : entries) {
+    out->Push<int64_t>(entry.result);
+  }
+  return PrimitiveStatus::OkStatus();
+}
+
 }  // namespace
 }  // namespace host_call
 }  // namespace asylo
@@ -1316,6 +1350,12 @@ extern "C" PrimitiveStatus asylo_enclave_init() {
   ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
       asylo::host_call::kTestFXattr,
       EntryHandler{asylo::host_call::TestFXattr}));
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::host_call::kTestInitializeSwitchless,
+      EntryHandler{asylo::host_call::TestInitializeSwitchless}));
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::host_call::kTestSubmitBatch,
+      EntryHandler{asylo::host_call::TestSubmitBatch}));
 
   return PrimitiveStatus::OkStatus();
 }
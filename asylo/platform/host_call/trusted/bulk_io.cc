@@ -0,0 +1,290 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/host_call/trusted/bulk_io.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/str_cat.h"
+#include "asylo/platform/core/trusted_spin_lock.h"
+#include "asylo/platform/host_call/exit_handler_constants.h"
+#include "asylo/platform/host_call/trusted/host_call_dispatcher.h"
+#include "asylo/platform/host_call/trusted/host_calls.h"
+#include "asylo/platform/primitives/trusted_primitives.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/platform/system_call/type_conversions/types_functions.h"
+#include "asylo/util/lock_guard.h"
+
+namespace asylo {
+namespace host_call {
+namespace {
+
+using primitives::MessageReader;
+using primitives::MessageWriter;
+using primitives::TrustedPrimitives;
+
+// Pooled buffers are at least this large, and transfers larger than
+// kMaxPooledBufferSize use a buffer allocated for the duration of the call.
+constexpr size_t kMinPooledBufferSize = 64 * 1024;
+constexpr size_t kMaxPooledBufferSize = 4 * 1024 * 1024;
+
+// Maximum number of idle buffers retained by the pool.
+constexpr int kMaxPooledBuffers = 16;
+
+struct UntrustedBuffer {
+  void *data;
+  size_t capacity;
+};
+
+// Idle buffers available for leasing, guarded by |pool_lock|.
+ABSL_CONST_INIT TrustedSpinLock pool_lock(/*is_recursive=*/false);
+UntrustedBuffer pool[kMaxPooledBuffers];
+int pool_count = 0;
+
+size_t PooledCapacity(size_t size) {
+  size_t capacity = kMinPooledBufferSize;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+// An untrusted buffer leased for a single bulk transfer. The buffer is taken
+// from the pool when one large enough is idle, and returned to it on
+// destruction.
+class BufferLease {
+ public:
+  explicit BufferLease(size_t size) : buffer_{nullptr, 0} {
+    if (size <= kMaxPooledBufferSize) {
+      LockGuard guard(&pool_lock);
+      // Take the smallest idle buffer which fits the transfer.
+      int best = -1;
+      for (int i = 0; i < pool_count; ++i) {
+        if (pool[i].capacity >= size &&
+            (best < 0 || pool[i].capacity < pool[best].capacity)) {
+          best = i;
+        }
+      }
+      if (best >= 0) {
+        buffer_ = pool[best];
+        pool[best] = pool[--pool_count];
+        return;
+      }
+    }
+
+    size_t capacity =
+        size <= kMaxPooledBufferSize ? PooledCapacity(size) : size;
+    void *data = TrustedPrimitives::UntrustedLocalAlloc(capacity);
+    if (!data) {
+      return;
+    }
+    if (!TrustedPrimitives::IsOutsideEnclave(data, capacity)) {
+      TrustedPrimitives::BestEffortAbort(
+          "Bulk I/O buffer is not outside the enclave");
+    }
+    buffer_ = UntrustedBuffer{data, capacity};
+  }
+
+  ~BufferLease() {
+    if (!buffer_.data) {
+      return;
+    }
+    if (buffer_.capacity <= kMaxPooledBufferSize) {
+      LockGuard guard(&pool_lock);
+      if (pool_count < kMaxPooledBuffers) {
+        pool[pool_count++] = buffer_;
+        return;
+      }
+    }
+    TrustedPrimitives::UntrustedLocalFree(buffer_.data);
+  }
+
+  BufferLease(const BufferLease &other) = delete;
+  BufferLease &operator=(const BufferLease &other) = delete;
+
+  // Returns the leased buffer, or nullptr if none could be allocated.
+  void *data() const { return buffer_.data; }
+
+ private:
+  UntrustedBuffer buffer_;
+};
+
+// Invokes the host call |handler| for a transfer of |count| bytes from or into
+// the untrusted buffer |buffer|. |arg| is the handler specific trailing
+// argument (an offset or flags).
+ssize_t DispatchBulkIo(uint64_t handler, const char *name, int fd,
+                       void *buffer, size_t count, int64_t arg) {
+  MessageWriter input;
+  input.Push<int>(fd);
+  input.Push(reinterpret_cast<uint64_t>(buffer));
+  input.Push<uint64_t>(count);
+  input.Push<int64_t>(arg);
+  MessageReader output;
+  const auto status = NonSystemCallDispatcher(handler, &input, &output);
+  CheckStatusAndParamCount(status, output, name, 2);
+
+  int64_t result = output.next<int64_t>();
+  int klinux_errno = output.next<int>();
+  if (result == -1) {
+    errno = FromkLinuxErrno(klinux_errno);
+    return -1;
+  }
+  if (result < 0 || result > count) {
+    std::string message =
+        absl::StrCat(name, ": result exceeds requested transfer size");
+    TrustedPrimitives::BestEffortAbort(message.c_str());
+  }
+  return result;
+}
+
+ssize_t BulkInput(uint64_t handler, const char *name, int fd,
+                  const struct iovec *iov, int iovcnt, size_t count,
+                  int64_t arg) {
+  BufferLease lease(count);
+  if (!lease.data()) {
+    errno = ENOMEM;
+    return -1;
+  }
+  ssize_t result = DispatchBulkIo(handler, name, fd, lease.data(), count, arg);
+  if (result > 0) {
+    ScatterIovec(lease.data(), result, iov, iovcnt);
+  }
+  return result;
+}
+
+ssize_t BulkOutput(uint64_t handler, const char *name, int fd,
+                   const struct iovec *iov, int iovcnt, size_t count,
+                   int64_t arg) {
+  BufferLease lease(count);
+  if (!lease.data()) {
+    errno = ENOMEM;
+    return -1;
+  }
+  GatherIovec(iov, iovcnt, lease.data());
+  return DispatchBulkIo(handler, name, fd, lease.data(), count, arg);
+}
+
+ssize_t BulkInput(uint64_t handler, const char *name, int fd, void *buf,
+                  size_t count, int64_t arg) {
+  struct iovec iov = {buf, count};
+  return BulkInput(handler, name, fd, &iov, 1, count, arg);
+}
+
+ssize_t BulkOutput(uint64_t handler, const char *name, int fd, const void *buf,
+                   size_t count, int64_t arg) {
+  struct iovec iov = {const_cast<void *>(buf), count};
+  return BulkOutput(handler, name, fd, &iov, 1, count, arg);
+}
+
+}  // namespace
+
+ssize_t BulkRead(int fd, void *buf, size_t count) {
+  return BulkInput(kReadWithUntrustedPtr, "enc_untrusted_read", fd, buf, count,
+                   /*offset=*/-1);
+}
+
+ssize_t BulkWrite(int fd, const void *buf, size_t count) {
+  return BulkOutput(kWriteWithUntrustedPtr, "enc_untrusted_write", fd, buf,
+                    count, /*offset=*/-1);
+}
+
+ssize_t BulkPread(int fd, void *buf, size_t count, off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return BulkInput(kReadWithUntrustedPtr, "enc_untrusted_pread64", fd, buf,
+                   count, offset);
+}
+
+ssize_t BulkPwrite(int fd, const void *buf, size_t count, off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return BulkOutput(kWriteWithUntrustedPtr, "enc_untrusted_pwrite64", fd, buf,
+                    count, offset);
+}
+
+ssize_t BulkRecv(int sockfd, void *buf, size_t len, int klinux_flags) {
+  return BulkInput(kRecvWithUntrustedPtr, "enc_untrusted_recvfrom", sockfd,
+                   buf, len, klinux_flags);
+}
+
+ssize_t BulkSend(int sockfd, const void *buf, size_t len, int flags) {
+  return BulkOutput(kSendWithUntrustedPtr, "enc_untrusted_send", sockfd, buf,
+                    len, flags);
+}
+
+ssize_t BulkReadv(int fd, const struct iovec *iov, int iovcnt, size_t count) {
+  return BulkInput(kReadWithUntrustedPtr, "enc_untrusted_readv", fd, iov,
+                   iovcnt, count, /*offset=*/-1);
+}
+
+ssize_t BulkWritev(int fd, const struct iovec *iov, int iovcnt, size_t count) {
+  return BulkOutput(kWriteWithUntrustedPtr, "enc_untrusted_writev", fd, iov,
+                    iovcnt, count, /*offset=*/-1);
+}
+
+ssize_t BulkPreadv(int fd, const struct iovec *iov, int iovcnt, size_t count,
+                   off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return BulkInput(kReadWithUntrustedPtr, "enc_untrusted_preadv", fd, iov,
+                   iovcnt, count, offset);
+}
+
+ssize_t BulkPwritev(int fd, const struct iovec *iov, int iovcnt, size_t count,
+                    off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return BulkOutput(kWriteWithUntrustedPtr, "enc_untrusted_pwritev", fd, iov,
+                    iovcnt, count, offset);
+}
+
+void GatherIovec(const struct iovec *iov, int iovcnt, void *dest) {
+  uint8_t *next = static_cast<uint8_t *>(dest);
+  for (int i = 0; i < iovcnt; ++i) {
+    memcpy(next, iov[i].iov_base, iov[i].iov_len);
+    next += iov[i].iov_len;
+  }
+}
+
+void ScatterIovec(const void *src, size_t count, const struct iovec *iov,
+                  int iovcnt) {
+  const uint8_t *next = static_cast<const uint8_t *>(src);
+  for (int i = 0; i < iovcnt && count > 0; ++i) {
+    size_t length = std::min(count, iov[i].iov_len);
+    memcpy(iov[i].iov_base, next, length);
+    next += length;
+    count -= length;
+  }
+}
+
+}  // namespace host_call
+}  // namespace asylo
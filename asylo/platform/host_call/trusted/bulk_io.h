@@ -0,0 +1,68 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_HOST_CALL_TRUSTED_BULK_IO_H_
+#define ASYLO_PLATFORM_HOST_CALL_TRUSTED_BULK_IO_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+
+namespace asylo {
+namespace host_call {
+
+// Transfers of at least this many bytes are issued through the bulk I/O path
+// by the enc_untrusted_* read and write family of host calls.
+constexpr size_t kBulkIoThreshold = 16 * 1024;
+
+// The following functions perform the corresponding call on the host with the
+// payload staged in an untrusted buffer leased from a pool of reusable buffers.
+// The host reads from or writes into that buffer directly, so the payload
+// crosses the enclave boundary with exactly one copy and is never serialized
+// into the host call message. Flags are passed to the host unmodified. Each
+// returns -1 and sets errno on failure.
+ssize_t BulkRead(int fd, void *buf, size_t count);
+ssize_t BulkWrite(int fd, const void *buf, size_t count);
+ssize_t BulkPread(int fd, void *buf, size_t count, off_t offset);
+ssize_t BulkPwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t BulkRecv(int sockfd, void *buf, size_t len, int klinux_flags);
+ssize_t BulkSend(int sockfd, const void *buf, size_t len, int flags);
+
+// Vectored variants of the above. The buffers of |iov|, of total length
+// |count|, are gathered into or scattered out of a single leased buffer, so the
+// whole vector crosses the enclave boundary with one host call.
+ssize_t BulkReadv(int fd, const struct iovec *iov, int iovcnt, size_t count);
+ssize_t BulkWritev(int fd, const struct iovec *iov, int iovcnt, size_t count);
+ssize_t BulkPreadv(int fd, const struct iovec *iov, int iovcnt, size_t count,
+                   off_t offset);
+ssize_t BulkPwritev(int fd, const struct iovec *iov, int iovcnt, size_t count,
+                    off_t offset);
+
+// Copies the buffers of |iov| into |dest| back to back.
+void GatherIovec(const struct iovec *iov, int iovcnt, void *dest);
+
+// Copies |count| bytes from |src| into the buffers of |iov| in order, filling
+// each before moving on to the next.
+void ScatterIovec(const void *src, size_t count, const struct iovec *iov,
+                  int iovcnt);
+
+}  // namespace host_call
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_HOST_CALL_TRUSTED_BULK_IO_H_
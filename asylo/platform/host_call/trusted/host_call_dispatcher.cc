@@ -20,6 +20,7 @@
 
 #include "absl/status/status.h"
 #include "asylo/platform/host_call/exit_handler_constants.h"
+#include "asylo/platform/host_call/trusted/switchless.h"
 #include "asylo/platform/primitives/extent.h"
 #include "asylo/platform/primitives/primitive_status.h"
 #include "asylo/platform/primitives/trusted_primitives.h"
@@ -40,6 +41,16 @@ primitives::PrimitiveStatus SystemCallDispatcher(const uint8_t* request_buffer,
         "dispatch the host call."};
   }
 
+  // Prefer posting the request to the switchless ring, if one is installed,
+  // and fall back to a regular exit if the ring could not take it.
+  bool dispatched = false;
+  ASYLO_RETURN_IF_ERROR(SwitchlessDispatch(request_buffer, request_size,
+                                           response_buffer, response_size,
+                                           &dispatched));
+  if (dispatched) {
+    return primitives::PrimitiveStatus::OkStatus();
+  }
+
   // |request_buffer| is owned by the caller and only accessible inside the
   // enclave; have parameters own the request to make it accessible by the
   // untrusted code.
@@ -69,6 +80,51 @@ primitives::PrimitiveStatus SystemCallDispatcher(const uint8_t* request_buffer,
   return primitives::PrimitiveStatus::OkStatus();
 }
 
+primitives::PrimitiveStatus SystemCallBatchDispatcher(
+    const primitives::Extent* requests, size_t count,
+    uint8_t** response_buffers, size_t* response_sizes) {
+  if (count == 0 || requests == nullptr) {
+    return primitives::PrimitiveStatus{
+        primitives::AbslStatusCode::kFailedPrecondition,
+        "Empty batch provided. Need at least one request to dispatch the host "
+        "calls."};
+  }
+
+  primitives::MessageWriter input;
+  for (size_t i = 0; i < count; i++) {
+    if (requests[i].empty()) {
+      return primitives::PrimitiveStatus{
+          primitives::AbslStatusCode::kFailedPrecondition,
+          "Zero-sized request provided in batch."};
+    }
+    input.PushByReference(requests[i]);
+  }
+  primitives::MessageReader output;
+  ASYLO_RETURN_IF_ERROR(primitives::TrustedPrimitives::UntrustedCall(
+      kSystemCallBatchHandler, &input, &output));
+
+  // The output should contain exactly one serialized response per request.
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(output, count);
+
+  for (size_t i = 0; i < count; i++) {
+    auto response = output.next();
+    response_sizes[i] = response.size();
+    response_buffers[i] = reinterpret_cast<uint8_t*>(malloc(response.size()));
+    if (!response_buffers[i]) {
+      for (size_t j = 0; j < i; j++) {
+        free(response_buffers[j]);
+        response_buffers[j] = nullptr;
+      }
+      return primitives::PrimitiveStatus{
+          primitives::AbslStatusCode::kResourceExhausted,
+          "Failed to malloc response buffer"};
+    }
+    memcpy(response_buffers[i], response.As<uint8_t>(), response.size());
+  }
+
+  return primitives::PrimitiveStatus::OkStatus();
+}
+
 primitives::PrimitiveStatus NonSystemCallDispatcher(
     uint64_t exit_selector, primitives::MessageWriter* input,
     primitives::MessageReader* output) {
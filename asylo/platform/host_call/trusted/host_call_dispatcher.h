@@ -23,6 +23,7 @@
 
 #include <cstdint>
 
+#include "asylo/platform/primitives/extent.h"
 #include "asylo/platform/primitives/primitive_status.h"
 #include "asylo/platform/primitives/trusted_primitives.h"
 #include "asylo/platform/primitives/util/message.h"
@@ -43,6 +44,16 @@ primitives::PrimitiveStatus SystemCallDispatcher(const uint8_t* request_buffer,
                                                  uint8_t** response_buffer,
                                                  size_t* response_size);
 
+// Provides the dispatcher used for making batches of host calls that are system
+// calls. This dispatcher is installed as a callback by the |system_call|
+// library. Takes in |count| serialized |requests| and crosses the enclave
+// boundary once to execute all of them in order. On success, populates the
+// i-th entries of |response_buffers| and |response_sizes| with the serialized
+// response to the i-th request, allocated by malloc() and owned by the caller.
+primitives::PrimitiveStatus SystemCallBatchDispatcher(
+    const primitives::Extent* requests, size_t count,
+    uint8_t** response_buffers, size_t* response_sizes);
+
 // Provides a dispatcher to wrap the UntrustedCall function and perform basic
 // validations. Used for host calls which are not implemented using syscalls.
 primitives::PrimitiveStatus NonSystemCallDispatcher(
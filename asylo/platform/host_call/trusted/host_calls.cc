@@ -26,20 +26,39 @@
 #include <sys/statfs.h>
 
 #include <algorithm>
+#include <climits>
+#include <memory>
 
 #include "absl/types/optional.h"
+#include "asylo/platform/common/iovec_util.h"
 #include "asylo/platform/host_call/exit_handler_constants.h"
 #include "asylo/platform/host_call/serializer_functions.h"
+#include "asylo/platform/host_call/trusted/bulk_io.h"
 #include "asylo/platform/primitives/trusted_primitives.h"
 #include "asylo/platform/system_call/type_conversions/generated_types_functions.h"
 #include "asylo/platform/system_call/type_conversions/types_functions.h"
 
+using ::asylo::IovecLength;
+using ::asylo::host_call::GatherIovec;
+using ::asylo::host_call::kBulkIoThreshold;
 using ::asylo::host_call::NonSystemCallDispatcher;
+using ::asylo::host_call::ScatterIovec;
 using ::asylo::primitives::Extent;
 using ::asylo::primitives::MessageReader;
 using ::asylo::primitives::MessageWriter;
 using ::asylo::primitives::TrustedPrimitives;
 
+void EnsureInitializedAndDispatchSyscallBatch(SystemCallBatchEntry *entries,
+                                              size_t count) {
+  if (!enc_is_syscall_batch_dispatcher_set()) {
+    enc_set_dispatch_syscall_batch(asylo::host_call::SystemCallBatchDispatcher);
+  }
+  if (!enc_is_error_handler_set()) {
+    enc_set_error_handler(TrustedPrimitives::BestEffortAbort);
+  }
+  enc_untrusted_syscall_batch(entries, count);
+}
+
 void CheckStatusAndParamCount(const asylo::primitives::PrimitiveStatus &status,
                               const MessageReader &output, const char *name,
                               int expected_params, bool match_exact_params) {
@@ -234,6 +253,9 @@ int enc_untrusted_rename(const char *oldpath, const char *newpath) {
 }
 
 ssize_t enc_untrusted_read(int fd, void *buf, size_t count) {
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkRead(fd, buf, count);
+  }
   ssize_t ret = static_cast<ssize_t>(EnsureInitializedAndDispatchSyscall(
       asylo::system_call::kSYS_read, fd, buf, count));
   if (ret != -1 && ret > count) {
@@ -244,6 +266,9 @@ ssize_t enc_untrusted_read(int fd, void *buf, size_t count) {
 }
 
 ssize_t enc_untrusted_write(int fd, const void *buf, size_t count) {
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkWrite(fd, buf, count);
+  }
   ssize_t ret = static_cast<ssize_t>(EnsureInitializedAndDispatchSyscall(
       asylo::system_call::kSYS_write, fd, buf, count));
   if (ret != -1 && ret > count) {
@@ -322,6 +347,9 @@ int enc_untrusted_shutdown(int sockfd, int how) {
 }
 
 ssize_t enc_untrusted_send(int sockfd, const void *buf, size_t len, int flags) {
+  if (len >= kBulkIoThreshold) {
+    return asylo::host_call::BulkSend(sockfd, buf, len, flags);
+  }
   return EnsureInitializedAndDispatchSyscall(asylo::system_call::kSYS_sendto,
                                              sockfd, buf, len, flags,
                                              /*dest_addr=*/nullptr,
@@ -508,6 +536,9 @@ int enc_untrusted_sched_getaffinity(pid_t pid, size_t cpusetsize,
 }
 
 int enc_untrusted_pread64(int fd, void *buf, size_t count, off_t offset) {
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkPread(fd, buf, count, offset);
+  }
   int ret = EnsureInitializedAndDispatchSyscall(
       asylo::system_call::kSYS_pread64, fd, buf, count, offset);
   if (ret != -1 && ret > count) {
@@ -519,6 +550,9 @@ int enc_untrusted_pread64(int fd, void *buf, size_t count, off_t offset) {
 
 int enc_untrusted_pwrite64(int fd, const void *buf, size_t count,
                            off_t offset) {
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkPwrite(fd, buf, count, offset);
+  }
   int ret = EnsureInitializedAndDispatchSyscall(
       asylo::system_call::kSYS_pwrite64, fd, buf, count, offset);
   if (ret != -1 && ret > count) {
@@ -528,6 +562,80 @@ int enc_untrusted_pwrite64(int fd, const void *buf, size_t count,
   return ret;
 }
 
+ssize_t enc_untrusted_readv(int fd, const struct iovec *iov, int iovcnt) {
+  ssize_t count = IovecLength(iov, iovcnt);
+  if (count <= 0) {
+    return count;
+  }
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkReadv(fd, iov, iovcnt, count);
+  }
+  std::unique_ptr<char[]> buf(new char[count]);
+  ssize_t ret = enc_untrusted_read(fd, buf.get(), count);
+  if (ret > 0) {
+    ScatterIovec(buf.get(), ret, iov, iovcnt);
+  }
+  return ret;
+}
+
+ssize_t enc_untrusted_writev(int fd, const struct iovec *iov, int iovcnt) {
+  ssize_t count = IovecLength(iov, iovcnt);
+  if (count <= 0) {
+    return count;
+  }
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkWritev(fd, iov, iovcnt, count);
+  }
+  std::unique_ptr<char[]> buf(new char[count]);
+  GatherIovec(iov, iovcnt, buf.get());
+  return enc_untrusted_write(fd, buf.get(), count);
+}
+
+ssize_t enc_untrusted_preadv(int fd, const struct iovec *iov, int iovcnt,
+                             off_t offset) {
+  ssize_t count = IovecLength(iov, iovcnt);
+  if (count < 0) {
+    return -1;
+  }
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkPreadv(fd, iov, iovcnt, count, offset);
+  }
+  std::unique_ptr<char[]> buf(new char[count]);
+  ssize_t ret = enc_untrusted_pread64(fd, buf.get(), count, offset);
+  if (ret > 0) {
+    ScatterIovec(buf.get(), ret, iov, iovcnt);
+  }
+  return ret;
+}
+
+ssize_t enc_untrusted_pwritev(int fd, const struct iovec *iov, int iovcnt,
+                              off_t offset) {
+  ssize_t count = IovecLength(iov, iovcnt);
+  if (count < 0) {
+    return -1;
+  }
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  if (count >= kBulkIoThreshold) {
+    return asylo::host_call::BulkPwritev(fd, iov, iovcnt, count, offset);
+  }
+  std::unique_ptr<char[]> buf(new char[count]);
+  GatherIovec(iov, iovcnt, buf.get());
+  return enc_untrusted_pwrite64(fd, buf.get(), count, offset);
+}
+
 int enc_untrusted_isatty(int fd) {
   MessageWriter input;
   input.Push(fd);
@@ -1085,6 +1193,11 @@ ssize_t enc_untrusted_recvfrom(int sockfd, void *buf, size_t len, int flags,
     return -1;
   }
 
+  // Without a source address to report the payload can be received in place.
+  if (src_addr == nullptr && len >= kBulkIoThreshold) {
+    return asylo::host_call::BulkRecv(sockfd, buf, len, *klinux_flags);
+  }
+
   MessageWriter input;
   input.Push<int>(sockfd);
   input.Push<uint64_t>(len);
@@ -1854,4 +1967,8 @@ int enc_untrusted_ioctl1(int fd, uint64_t request) {
                                              request);
 }
 
+void enc_untrusted_submit_batch(SystemCallBatchEntry *entries, size_t count) {
+  EnsureInitializedAndDispatchSyscallBatch(entries, count);
+}
+
 }  // extern "C"
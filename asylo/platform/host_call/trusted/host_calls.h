@@ -31,6 +31,7 @@
 #include <sched.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <cstdarg>
 #include <cstddef>
@@ -68,10 +69,24 @@ struct IsPointerOrInt {
 template <typename... Ts>
 using AllPointerOrInt = AllTrue<IsPointerOrInt<Ts>::value...>;
 
+// Converts a system call parameter to the 64-bit word passed to the system call
+// library.
+template <typename T>
+uint64_t ToParameter(T *value) {
+  return reinterpret_cast<uint64_t>(value);
+}
+
+template <typename T>
+uint64_t ToParameter(T value) {
+  return static_cast<uint64_t>(value);
+}
+
+inline uint64_t ToParameter(std::nullptr_t value) { return 0; }
+
 }  // namespace internal
 
 // Ensures that the host call library is initialized, then dispatches the
-// syscall to enc_untrusted_syscall.
+// syscall to enc_untrusted_syscall_array.
 template <typename... Ts>
 int64_t EnsureInitializedAndDispatchSyscall(
     typename std::enable_if<internal::AllPointerOrInt<Ts...>::value, int>::type
@@ -84,9 +99,18 @@ int64_t EnsureInitializedAndDispatchSyscall(
     enc_set_error_handler(
         asylo::primitives::TrustedPrimitives::BestEffortAbort);
   }
-  return enc_untrusted_syscall(sysno, args...);
+  static_assert(sizeof...(Ts) <= asylo::system_call::kParameterMax,
+                "Too many system call parameters");
+  const uint64_t parameters[asylo::system_call::kParameterMax] = {
+      internal::ToParameter(args)...};
+  return enc_untrusted_syscall_array(sysno, parameters);
 }
 
+// Ensures that the host call library is initialized, then dispatches the batch
+// of syscalls to enc_untrusted_syscall_batch.
+void EnsureInitializedAndDispatchSyscallBatch(SystemCallBatchEntry *entries,
+                                              size_t count);
+
 // Verifies the return status of the host call and checks if the expected number
 // of parameters are received on the MessageReader.
 void CheckStatusAndParamCount(const asylo::primitives::PrimitiveStatus &status,
@@ -165,6 +189,15 @@ ssize_t enc_untrusted_llistxattr(const char *path, char *list, size_t size);
 ssize_t enc_untrusted_flistxattr(int fd, char *list, size_t size);
 int enc_untrusted_pread64(int fd, void *buf, size_t count, off_t offset);
 int enc_untrusted_pwrite64(int fd, const void *buf, size_t count, off_t offset);
+
+// Vectored I/O. Each call transfers the whole of |iov| with a single host call,
+// staging it in one contiguous buffer on the way across the enclave boundary.
+ssize_t enc_untrusted_readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t enc_untrusted_writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t enc_untrusted_preadv(int fd, const struct iovec *iov, int iovcnt,
+                             off_t offset);
+ssize_t enc_untrusted_pwritev(int fd, const struct iovec *iov, int iovcnt,
+                              off_t offset);
 int enc_untrusted_wait(int *wstatus);
 int enc_untrusted_close(int fd);
 int enc_untrusted_nanosleep(const struct timespec *req, struct timespec *rem);
@@ -240,6 +273,14 @@ int enc_untrusted_sys_futex_wait(int32_t *futex, int32_t expected,
                                  int64_t timeout_microsec);
 int enc_untrusted_sys_futex_wake(int32_t *futex, int32_t num);
 
+// Executes the |count| system calls described by |entries| on the host, in
+// order, crossing the enclave boundary once for the whole batch. Each entry
+// holds a system call number from "asylo/platform/system_call/sysno.h" and
+// parameters already converted to their host (kLinux) representation. On
+// return, each entry holds the result of its system call and the errno value
+// it set, if any; errno itself is left unchanged.
+void enc_untrusted_submit_batch(SystemCallBatchEntry *entries, size_t count);
+
 // Calls that are not delegated to the host or depend on other host calls are
 // defined below.
 void enc_freeaddrinfo(struct addrinfo *res);
@@ -0,0 +1,225 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/host_call/trusted/switchless.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "asylo/platform/host_call/exit_handler_constants.h"
+#include "asylo/platform/host_call/switchless_ring.h"
+#include "asylo/platform/host_call/trusted/host_call_dispatcher.h"
+#include "asylo/platform/primitives/trusted_primitives.h"
+#include "asylo/platform/primitives/trusted_runtime.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/platform/system_call/message.h"
+#include "asylo/platform/system_call/sysno.h"
+#include "asylo/util/status_macros.h"
+
+namespace asylo {
+namespace host_call {
+namespace {
+
+// Upper bound on the number of slots accepted from the untrusted side.
+constexpr uint64_t kMaxSwitchlessSlots = 1 << 16;
+
+// Number of busy-wait iterations a trusted thread waits for a worker to claim
+// its request before cancelling it and falling back to a regular exit.
+constexpr int kClaimSpinLimit = 1 << 14;
+
+// Ring installed by InitializeSwitchlessHostCalls, along with its slot count
+// as read (once) at installation time.
+std::atomic<SwitchlessRing *> switchless_ring{nullptr};
+uint64_t switchless_slot_count = 0;
+
+// Returns whether the system call encoded in |request_buffer| may be serviced
+// by a switchless worker. The worker executes the call on its own thread while
+// the trusted caller busy-waits, so only short, non-blocking system calls whose
+// effect does not depend on the calling thread are allowed. Everything else,
+// for instance exit, signal masks, or reads that may block, takes a regular
+// enclave exit.
+bool IsSwitchlessSystemCall(const uint8_t *request_buffer,
+                            size_t request_size) {
+  if (request_size < sizeof(system_call::MessageHeader)) {
+    return false;
+  }
+  system_call::MessageReader reader(
+      primitives::Extent{request_buffer, request_size});
+  switch (reader.sysno()) {
+    case system_call::kSYS_access:
+    case system_call::kSYS_chmod:
+    case system_call::kSYS_fchmod:
+    case system_call::kSYS_fstat:
+    case system_call::kSYS_getcwd:
+    case system_call::kSYS_getegid:
+    case system_call::kSYS_geteuid:
+    case system_call::kSYS_getgid:
+    case system_call::kSYS_getpid:
+    case system_call::kSYS_getppid:
+    case system_call::kSYS_getuid:
+    case system_call::kSYS_link:
+    case system_call::kSYS_lseek:
+    case system_call::kSYS_lstat:
+    case system_call::kSYS_mkdir:
+    case system_call::kSYS_pread64:
+    case system_call::kSYS_pwrite64:
+    case system_call::kSYS_readlink:
+    case system_call::kSYS_rename:
+    case system_call::kSYS_rmdir:
+    case system_call::kSYS_stat:
+    case system_call::kSYS_symlink:
+    case system_call::kSYS_umask:
+    case system_call::kSYS_uname:
+    case system_call::kSYS_unlink:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Reserves a free slot, or returns nullptr if all slots are in use.
+SwitchlessSlot *ReserveSlot(SwitchlessRing *ring, uint64_t slot_count) {
+  uint64_t start = ring->next_slot.fetch_add(1, std::memory_order_relaxed);
+  SwitchlessSlot *slots = ring->slots();
+  for (uint64_t i = 0; i < slot_count; ++i) {
+    SwitchlessSlot *slot = &slots[(start + i) % slot_count];
+    uint32_t expected = kSlotFree;
+    if (slot->state.compare_exchange_strong(expected, kSlotReserved,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+primitives::PrimitiveStatus InitializeSwitchlessHostCalls() {
+  primitives::MessageWriter input;
+  primitives::MessageReader output;
+  ASYLO_RETURN_IF_ERROR(
+      NonSystemCallDispatcher(kSwitchlessRingHandler, &input, &output));
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(output, 1);
+
+  auto ring = reinterpret_cast<SwitchlessRing *>(output.next<uintptr_t>());
+  if (!ring || !primitives::TrustedPrimitives::IsOutsideEnclave(
+                   ring, sizeof(SwitchlessRing))) {
+    return primitives::PrimitiveStatus{
+        primitives::AbslStatusCode::kFailedPrecondition,
+        "Switchless ring is not located in untrusted memory."};
+  }
+
+  // Read the header fields exactly once; the untrusted side may change them.
+  uint64_t magic = ring->magic;
+  uint64_t slot_count = ring->slot_count;
+  if (magic != kSwitchlessRingMagic || slot_count == 0 ||
+      slot_count > kMaxSwitchlessSlots ||
+      !primitives::TrustedPrimitives::IsOutsideEnclave(
+          ring, SwitchlessRing::AllocationSize(slot_count))) {
+    return primitives::PrimitiveStatus{
+        primitives::AbslStatusCode::kFailedPrecondition,
+        "Malformed switchless ring provided by the untrusted side."};
+  }
+
+  switchless_slot_count = slot_count;
+  switchless_ring.store(ring, std::memory_order_release);
+  return primitives::PrimitiveStatus::OkStatus();
+}
+
+bool SwitchlessHostCallsEnabled() {
+  return switchless_ring.load(std::memory_order_acquire) != nullptr;
+}
+
+primitives::PrimitiveStatus SwitchlessDispatch(const uint8_t *request_buffer,
+                                               size_t request_size,
+                                               uint8_t **response_buffer,
+                                               size_t *response_size,
+                                               bool *dispatched) {
+  *dispatched = false;
+  SwitchlessRing *ring = switchless_ring.load(std::memory_order_acquire);
+  if (!ring || request_size > kSwitchlessRequestCapacity ||
+      !IsSwitchlessSystemCall(request_buffer, request_size)) {
+    return primitives::PrimitiveStatus::OkStatus();
+  }
+
+  SwitchlessSlot *slot = ReserveSlot(ring, switchless_slot_count);
+  if (!slot) {
+    // The ring is full.
+    return primitives::PrimitiveStatus::OkStatus();
+  }
+
+  memcpy(slot->request, request_buffer, request_size);
+  slot->request_size = request_size;
+  slot->state.store(kSlotPosted, std::memory_order_release);
+
+  // Wait for a worker to pick up the request. If none does in time, try to
+  // take the request back; failing to do so means it was claimed concurrently.
+  int spins = 0;
+  while (slot->state.load(std::memory_order_acquire) == kSlotPosted) {
+    if (++spins > kClaimSpinLimit) {
+      uint32_t expected = kSlotPosted;
+      if (slot->state.compare_exchange_strong(expected, kSlotFree,
+                                              std::memory_order_acq_rel)) {
+        return primitives::PrimitiveStatus::OkStatus();
+      }
+      break;
+    }
+    enc_pause();
+  }
+
+  // Once a worker has claimed the request the host call must not be issued a
+  // second time, so wait for its completion.
+  while (slot->state.load(std::memory_order_acquire) != kSlotDone) {
+    enc_pause();
+  }
+  *dispatched = true;
+
+  int32_t status_code = slot->status_code;
+  const uint8_t *response = slot->response;
+  uint64_t size = slot->response_size;
+  if (status_code != 0) {
+    slot->state.store(kSlotFree, std::memory_order_release);
+    return primitives::PrimitiveStatus{
+        status_code, "Switchless host call failed on the untrusted side."};
+  }
+  if (size == 0 || !response ||
+      !primitives::TrustedPrimitives::IsOutsideEnclave(response, size)) {
+    slot->state.store(kSlotFree, std::memory_order_release);
+    return primitives::PrimitiveStatus{
+        primitives::AbslStatusCode::kFailedPrecondition,
+        "Invalid switchless host call response."};
+  }
+
+  // *response_buffer is expected to be owned by the caller.
+  *response_buffer = reinterpret_cast<uint8_t *>(malloc(size));
+  if (!*response_buffer) {
+    slot->state.store(kSlotFree, std::memory_order_release);
+    return primitives::PrimitiveStatus{
+        primitives::AbslStatusCode::kResourceExhausted,
+        "Failed to malloc response buffer"};
+  }
+  memcpy(*response_buffer, response, size);
+  *response_size = size;
+  slot->state.store(kSlotFree, std::memory_order_release);
+  return primitives::PrimitiveStatus::OkStatus();
+}
+
+}  // namespace host_call
+}  // namespace asylo
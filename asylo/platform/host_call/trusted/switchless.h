@@ -0,0 +1,58 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_HOST_CALL_TRUSTED_SWITCHLESS_H_
+#define ASYLO_PLATFORM_HOST_CALL_TRUSTED_SWITCHLESS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "asylo/platform/primitives/primitive_status.h"
+
+namespace asylo {
+namespace host_call {
+
+// Fetches the switchless request ring from the untrusted side and installs it
+// for use by SystemCallDispatcher. Makes a single regular host call. Returns
+// an error if the untrusted side has not enabled switchless host calls for this
+// enclave or if the ring it provides is malformed, in which case system calls
+// keep using regular enclave exits.
+primitives::PrimitiveStatus InitializeSwitchlessHostCalls();
+
+// Returns whether a switchless request ring has been installed.
+bool SwitchlessHostCallsEnabled();
+
+// Attempts to execute a serialized system call request through the switchless
+// ring. Sets |*dispatched| to false, without touching the response parameters,
+// if the request could not be posted (ring disabled or full, request too large,
+// or a system call that is not allowed to be switchless) or no worker claimed
+// it in time; the caller is then expected to fall back to a regular host call.
+// Only short, non-blocking system calls that do not depend on the calling
+// thread are allowed to be switchless. Otherwise sets |*dispatched| to true
+// and, on success, populates |response_buffer| and |response_size| with a
+// response allocated by malloc() on the trusted heap.
+primitives::PrimitiveStatus SwitchlessDispatch(const uint8_t *request_buffer,
+                                               size_t request_size,
+                                               uint8_t **response_buffer,
+                                               size_t *response_size,
+                                               bool *dispatched);
+
+}  // namespace host_call
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_HOST_CALL_TRUSTED_SWITCHLESS_H_
@@ -73,6 +73,28 @@ Status SystemCallHandler(const std::shared_ptr<primitives::Client> &client,
   return absl::OkStatus();
 }
 
+Status SystemCallBatchHandler(const std::shared_ptr<primitives::Client> &client,
+                              void *context, primitives::MessageReader *input,
+                              primitives::MessageWriter *output) {
+  ASYLO_RETURN_IF_TOO_FEW_READER_ARGUMENTS(*input, 1);
+
+  // Execute the requests in order, so that the batch has the same semantics as
+  // the equivalent sequence of individual system calls.
+  while (input->hasNext()) {
+    auto request = input->next();
+    Extent response;  // To be owned by untrusted call parameters.
+    primitives::PrimitiveStatus status =
+        system_call::UntrustedInvoke(request, &response);
+    if (!status.ok()) {
+      return primitives::MakeStatus(status);
+    }
+    output->PushByCopy(response);
+    free(response.data());
+  }
+
+  return absl::OkStatus();
+}
+
 Status IsAttyHandler(const std::shared_ptr<primitives::Client> &client,
                      void *context, primitives::MessageReader *input,
                      primitives::MessageWriter *output) {
@@ -107,6 +129,66 @@ Status SysconfHandler(const std::shared_ptr<primitives::Client> &client,
   return absl::OkStatus();
 }
 
+Status ReadWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*input, 4);
+  int fd = input->next<int>();
+  void *buf = input->next<void *>();
+  size_t count = input->next<size_t>();
+  off_t offset = input->next<off_t>();
+
+  ssize_t ret =
+      offset < 0 ? read(fd, buf, count) : pread(fd, buf, count, offset);
+  output->Push<ssize_t>(ret);
+  output->Push<int>(errno);
+  return absl::OkStatus();
+}
+
+Status WriteWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*input, 4);
+  int fd = input->next<int>();
+  const void *buf = input->next<void *>();
+  size_t count = input->next<size_t>();
+  off_t offset = input->next<off_t>();
+
+  ssize_t ret =
+      offset < 0 ? write(fd, buf, count) : pwrite(fd, buf, count, offset);
+  output->Push<ssize_t>(ret);
+  output->Push<int>(errno);
+  return absl::OkStatus();
+}
+
+Status RecvWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*input, 4);
+  int sockfd = input->next<int>();
+  void *buf = input->next<void *>();
+  size_t len = input->next<size_t>();
+  int klinux_flags = static_cast<int>(input->next<int64_t>());
+
+  output->Push<ssize_t>(recv(sockfd, buf, len, klinux_flags));
+  output->Push<int>(errno);
+  return absl::OkStatus();
+}
+
+Status SendWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*input, 4);
+  int sockfd = input->next<int>();
+  const void *buf = input->next<void *>();
+  size_t len = input->next<size_t>();
+  int flags = static_cast<int>(input->next<int64_t>());
+
+  output->Push<ssize_t>(send(sockfd, buf, len, flags));
+  output->Push<int>(errno);
+  return absl::OkStatus();
+}
+
 Status ReallocHandler(const std::shared_ptr<primitives::Client> &client,
                       void *context, primitives::MessageReader *input,
                       primitives::MessageWriter *output) {
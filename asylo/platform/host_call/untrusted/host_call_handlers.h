@@ -37,6 +37,15 @@ Status SystemCallHandler(const std::shared_ptr<primitives::Client> &client,
                          void *context, primitives::MessageReader *input,
                          primitives::MessageWriter *output);
 
+// Host call handler servicing a batch of system calls at once. It receives a
+// MessageReader containing one or more serialized requests, executes them in
+// order, and writes back one serialized response per request on the output
+// MessageWriter. Returns ok status on success, otherwise an error message if a
+// serialization error has occurred for any request.
+Status SystemCallBatchHandler(const std::shared_ptr<primitives::Client> &client,
+                              void *context, primitives::MessageReader *input,
+                              primitives::MessageWriter *output);
+
 // isatty library call handler on the host; expects [int fd] and returns [int].
 Status IsAttyHandler(const std::shared_ptr<primitives::Client> &client,
                      void *context, primitives::MessageReader *input,
@@ -54,6 +63,35 @@ Status SysconfHandler(const std::shared_ptr<primitives::Client> &client,
                       void *context, primitives::MessageReader *input,
                       primitives::MessageWriter *output);
 
+// read/pread syscall handler on the host operating directly on an untrusted
+// buffer; expects [int fd, void *buf, size_t count, off_t offset] and returns
+// [ssize_t, int errno]. A negative |offset| selects read() rather than pread().
+Status ReadWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output);
+
+// write/pwrite syscall handler on the host operating directly on an untrusted
+// buffer; expects [int fd, const void *buf, size_t count, off_t offset] and
+// returns [ssize_t, int errno]. A negative |offset| selects write() rather than
+// pwrite().
+Status WriteWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output);
+
+// recv syscall handler on the host operating directly on an untrusted buffer;
+// expects [int sockfd, void *buf, size_t len, int64_t flags] and returns
+// [ssize_t, int errno].
+Status RecvWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output);
+
+// send syscall handler on the host operating directly on an untrusted buffer;
+// expects [int sockfd, const void *buf, size_t len, int64_t flags] and
+// returns [ssize_t, int errno].
+Status SendWithUntrustedPtrHandler(
+    const std::shared_ptr<primitives::Client> &client, void *context,
+    primitives::MessageReader *input, primitives::MessageWriter *output);
+
 // realloc library call handler on the host; expects [void *ptr, size_t size]
 // and returns [void *output_ptr].
 Status ReallocHandler(const std::shared_ptr<primitives::Client> &client,
@@ -18,9 +18,13 @@
 
 #include "asylo/platform/host_call/untrusted/host_call_handlers_initializer.h"
 
+#include <cstdint>
+
 #include "absl/status/status.h"
 #include "asylo/platform/host_call/exit_handler_constants.h"
 #include "asylo/platform/host_call/untrusted/host_call_handlers.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/platform/system_call/message.h"
 #include "asylo/util/status_macros.h"
 #include "asylo/util/statusor.h"
 
@@ -32,6 +36,10 @@ Status AddHostCallHandlersToExitCallProvider(
   ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
       kSystemCallHandler, primitives::ExitHandler{SystemCallHandler}));
 
+  ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
+      kSystemCallBatchHandler,
+      primitives::ExitHandler{SystemCallBatchHandler}));
+
   ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
       kIsAttyHandler, primitives::ExitHandler{IsAttyHandler}));
 
@@ -41,6 +49,22 @@ Status AddHostCallHandlersToExitCallProvider(
   ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
       kSysconfHandler, primitives::ExitHandler{SysconfHandler}));
 
+  ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
+      kReadWithUntrustedPtr,
+      primitives::ExitHandler{ReadWithUntrustedPtrHandler}));
+
+  ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
+      kWriteWithUntrustedPtr,
+      primitives::ExitHandler{WriteWithUntrustedPtrHandler}));
+
+  ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
+      kRecvWithUntrustedPtr,
+      primitives::ExitHandler{RecvWithUntrustedPtrHandler}));
+
+  ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
+      kSendWithUntrustedPtr,
+      primitives::ExitHandler{SendWithUntrustedPtrHandler}));
+
   ASYLO_RETURN_IF_ERROR(exit_call_provider->RegisterExitHandler(
       kReallocHandler, primitives::ExitHandler{ReallocHandler}));
 
@@ -123,5 +147,17 @@ Status AddHostCallHandlersToExitCallProvider(
   return absl::OkStatus();
 }
 
+int SystemCallNumberOfExit(uint64_t untrusted_selector,
+                           primitives::MessageReader *input) {
+  if (untrusted_selector != kSystemCallHandler || input->size() != 1) {
+    return -1;
+  }
+  primitives::Extent request = input->peek();
+  if (request.size() < sizeof(system_call::MessageHeader)) {
+    return -1;
+  }
+  return system_call::MessageReader(request).sysno();
+}
+
 }  // namespace host_call
 }  // namespace asylo
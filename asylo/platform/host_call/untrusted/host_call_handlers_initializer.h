@@ -19,7 +19,10 @@
 #ifndef ASYLO_PLATFORM_HOST_CALL_UNTRUSTED_HOST_CALL_HANDLERS_INITIALIZER_H_
 #define ASYLO_PLATFORM_HOST_CALL_UNTRUSTED_HOST_CALL_HANDLERS_INITIALIZER_H_
 
+#include <cstdint>
+
 #include "asylo/platform/primitives/util/dispatch_table.h"
+#include "asylo/platform/primitives/util/message.h"
 
 namespace asylo {
 namespace host_call {
@@ -29,6 +32,12 @@ namespace host_call {
 Status AddHostCallHandlersToExitCallProvider(
     primitives::Client::ExitCallProvider* exit_call_provider);
 
+// Returns the system call number carried by an exit to the system call host
+// call handler, or -1 for any other exit. Suitable as the classifier of a
+// primitives::ProfilingDispatchTable; |input| is peeked at but not consumed.
+int SystemCallNumberOfExit(uint64_t untrusted_selector,
+                           primitives::MessageReader* input);
+
 }  // namespace host_call
 }  // namespace asylo
 
@@ -19,8 +19,11 @@
 #include "asylo/platform/host_call/untrusted/host_call_handlers.h"
 
 #include <sys/syscall.h>
+#include <unistd.h>
 
+#include <cstdint>
 #include <functional>
+#include <string>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -135,6 +138,37 @@ TEST(HostCallHandlersTest, SyscallHandlerInvalidRequestTest) {
   EXPECT_THAT(output, IsEmpty());
 }
 
+TEST(HostCallHandlersTest, SyscallBatchHandlerEmptyMessageTest) {
+  MessageReader empty_input;
+  MessageWriter empty_output;
+  EXPECT_THAT(
+      SystemCallBatchHandler(nullptr, nullptr, &empty_input, &empty_output),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               "At least1 item(s) expected on the MessageReader."));
+}
+
+// Invokes a batch of host calls for valid serialized requests, and verifies
+// that one response is produced for each request.
+TEST(HostCallHandlersTest, SyscallBatchHandlerValidRequestsTest) {
+  std::array<uint64_t, system_call::kParameterMax> request_params;
+  MessageReader input;
+  FillInput(
+      [&request_params](MessageWriter *params) {
+        for (int i = 0; i < 3; ++i) {
+          primitives::Extent request;  // To be allocated by Serialize.
+          ASYLO_ASSERT_OK(primitives::MakeStatus(system_call::SerializeRequest(
+              SYS_getpid, request_params, &request)));
+          params->PushByCopy(request);
+          free(request.data());
+        }
+      },
+      &input);
+  MessageWriter output;
+  ASSERT_THAT(SystemCallBatchHandler(nullptr, nullptr, &input, &output),
+              IsOk());
+  EXPECT_THAT(output, SizeIs(3));  // Contains one response per request.
+}
+
 // Invokes an IsAtty hostcall for an invalid request. It tests that the correct
 // error is returned for an empty input or for an input with more than one item.
 TEST(HostCallHandlersTest, IsAttyIncorrectSizeTest) {
@@ -207,6 +241,73 @@ TEST(HostCallHandlersTest, USleepValidRequestTest) {
       &output);
 }
 
+// Invokes a ReadWithUntrustedPtr hostcall for an invalid request. It tests that
+// the correct error is returned for an input with too few items.
+TEST(HostCallHandlersTest, ReadWithUntrustedPtrIncorrectSizeTest) {
+  MessageReader input;
+  MessageWriter output;
+  EXPECT_THAT(ReadWithUntrustedPtrHandler(nullptr, nullptr, &input, &output),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  FillInput([](MessageWriter *params) { params->Push(0); }, &input);
+  EXPECT_THAT(ReadWithUntrustedPtrHandler(nullptr, nullptr, &input, &output),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+// Writes a buffer through a pipe with WriteWithUntrustedPtr and reads it back
+// with ReadWithUntrustedPtr, and verifies that both handlers operate directly
+// on the buffers they are given.
+TEST(HostCallHandlersTest, WriteAndReadWithUntrustedPtrTest) {
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+  const std::string message(1024, 'x');
+
+  MessageReader write_input;
+  FillInput(
+      [&](MessageWriter *params) {
+        params->Push<int>(pipefd[1]);
+        params->Push(reinterpret_cast<uint64_t>(message.data()));
+        params->Push<uint64_t>(message.size());
+        params->Push<int64_t>(-1);
+      },
+      &write_input);
+  MessageWriter write_output;
+  ASSERT_THAT(WriteWithUntrustedPtrHandler(nullptr, nullptr, &write_input,
+                                           &write_output),
+              IsOk());
+  VerifyOutput(
+      [&](MessageReader *results) {
+        ASSERT_THAT(*results, SizeIs(2));
+        EXPECT_EQ(results->next<ssize_t>(), message.size());
+      },
+      &write_output);
+
+  std::string received(message.size(), '\0');
+  MessageReader read_input;
+  FillInput(
+      [&](MessageWriter *params) {
+        params->Push<int>(pipefd[0]);
+        params->Push(reinterpret_cast<uint64_t>(&received[0]));
+        params->Push<uint64_t>(received.size());
+        params->Push<int64_t>(-1);
+      },
+      &read_input);
+  MessageWriter read_output;
+  ASSERT_THAT(ReadWithUntrustedPtrHandler(nullptr, nullptr, &read_input,
+                                          &read_output),
+              IsOk());
+  VerifyOutput(
+      [&](MessageReader *results) {
+        ASSERT_THAT(*results, SizeIs(2));
+        EXPECT_EQ(results->next<ssize_t>(), received.size());
+      },
+      &read_output);
+  EXPECT_EQ(received, message);
+
+  close(pipefd[0]);
+  close(pipefd[1]);
+}
+
 }  // namespace
 
 }  // namespace host_call
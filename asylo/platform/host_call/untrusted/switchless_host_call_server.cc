@@ -0,0 +1,216 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/host_call/untrusted/switchless_host_call_server.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "absl/status/status.h"
+#include "asylo/platform/host_call/exit_handler_constants.h"
+#include "asylo/platform/primitives/extent.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/platform/primitives/util/status_conversions.h"
+#include "asylo/util/status_macros.h"
+
+namespace asylo {
+namespace host_call {
+namespace {
+
+// Number of empty polls of the ring after which an idle worker starts yielding
+// the CPU, and after which it starts sleeping between polls.
+constexpr int kIdleYieldThreshold = 1 << 10;
+constexpr int kIdleSleepThreshold = 1 << 12;
+constexpr std::chrono::microseconds kIdleSleep{50};
+
+}  // namespace
+
+struct SwitchlessHostCallServer::State {
+  State(const std::shared_ptr<primitives::Client> &client, SwitchlessRing *ring)
+      : client(client), ring(ring), stop(false), requests_handled(0) {}
+
+  ~State() {
+    SwitchlessSlot *slots = ring->slots();
+    for (uint64_t i = 0; i < ring->slot_count; ++i) {
+      free(slots[i].response);
+    }
+    free(ring);
+  }
+
+  // Executes the request held by |slot|, which the calling worker has claimed,
+  // and publishes its response.
+  void Execute(SwitchlessSlot *slot) {
+    Status status = absl::OkStatus();
+    std::shared_ptr<primitives::Client> locked_client = client.lock();
+    if (!locked_client) {
+      status = absl::FailedPreconditionError("Enclave client destroyed");
+    }
+
+    uint64_t request_size = slot->request_size;
+    if (status.ok() && request_size > kSwitchlessRequestCapacity) {
+      status = absl::InvalidArgumentError("Switchless request too large");
+    }
+
+    primitives::MessageWriter output;
+    if (status.ok()) {
+      primitives::MessageReader input;
+      input.Deserialize(1, [slot, request_size](size_t i) {
+        return primitives::Extent{slot->request, request_size};
+      });
+      status = locked_client->exit_call_provider()->InvokeExitHandler(
+          kSystemCallHandler, &input, &output, locked_client.get());
+    }
+    if (status.ok() && output.size() != 1) {
+      status = absl::InternalError("Unexpected switchless response");
+    }
+
+    if (status.ok()) {
+      output.Serialize([slot, &status](primitives::Extent response) {
+        if (response.size() > slot->response_capacity) {
+          void *buffer = realloc(slot->response, response.size());
+          if (!buffer) {
+            status = absl::ResourceExhaustedError(
+                "Failed to allocate switchless response");
+            return;
+          }
+          slot->response = static_cast<uint8_t *>(buffer);
+          slot->response_capacity = response.size();
+        }
+        memcpy(slot->response, response.data(), response.size());
+        slot->response_size = response.size();
+      });
+    }
+
+    slot->status_code = primitives::MakePrimitiveStatus(status).error_code();
+    requests_handled.fetch_add(1, std::memory_order_relaxed);
+    slot->state.store(kSlotDone, std::memory_order_release);
+  }
+
+  // Polls the ring for posted requests until asked to stop.
+  void Run() {
+    SwitchlessSlot *slots = ring->slots();
+    const uint64_t slot_count = ring->slot_count;
+    int idle_polls = 0;
+    while (!stop.load(std::memory_order_acquire)) {
+      bool found = false;
+      for (uint64_t i = 0; i < slot_count; ++i) {
+        uint32_t expected = kSlotPosted;
+        if (slots[i].state.load(std::memory_order_relaxed) == kSlotPosted &&
+            slots[i].state.compare_exchange_strong(expected, kSlotClaimed,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+          Execute(&slots[i]);
+          found = true;
+        }
+      }
+      if (found) {
+        idle_polls = 0;
+      } else if (++idle_polls > kIdleSleepThreshold) {
+        std::this_thread::sleep_for(kIdleSleep);
+      } else if (idle_polls > kIdleYieldThreshold) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // The client is not owned; it owns the server through its exit handlers.
+  const std::weak_ptr<primitives::Client> client;
+  SwitchlessRing *const ring;
+  std::atomic<bool> stop;
+  std::atomic<uint64_t> requests_handled;
+};
+
+StatusOr<std::shared_ptr<SwitchlessHostCallServer>>
+SwitchlessHostCallServer::Create(
+    const std::shared_ptr<primitives::Client> &client,
+    const SwitchlessHostCallConfig &config) {
+  if (config.ring_slots() == 0) {
+    return absl::InvalidArgumentError(
+        "Switchless host calls require at least one ring slot");
+  }
+  if (config.worker_threads() == 0) {
+    return absl::InvalidArgumentError(
+        "Switchless host calls require at least one worker thread");
+  }
+
+  size_t size = SwitchlessRing::AllocationSize(config.ring_slots());
+  void *memory = aligned_alloc(alignof(SwitchlessRing), size);
+  if (!memory) {
+    return absl::ResourceExhaustedError(
+        "Failed to allocate switchless host call ring");
+  }
+  auto ring = new (memory) SwitchlessRing();
+  ring->magic = kSwitchlessRingMagic;
+  ring->slot_count = config.ring_slots();
+  for (uint64_t i = 0; i < ring->slot_count; ++i) {
+    new (&ring->slots()[i]) SwitchlessSlot();
+  }
+
+  auto state = std::make_shared<State>(client, ring);
+  std::shared_ptr<SwitchlessHostCallServer> server(
+      new SwitchlessHostCallServer(state));
+  for (uint32_t i = 0; i < config.worker_threads(); ++i) {
+    server->workers_.emplace_back([state] { state->Run(); });
+  }
+  return server;
+}
+
+SwitchlessHostCallServer::~SwitchlessHostCallServer() {
+  state_->stop.store(true, std::memory_order_release);
+  for (auto &worker : workers_) {
+    // The server may be destroyed by one of its own workers if that worker
+    // held the last reference to the client. The worker keeps the state alive
+    // and exits on its own.
+    if (worker.get_id() == std::this_thread::get_id()) {
+      worker.detach();
+    } else {
+      worker.join();
+    }
+  }
+}
+
+SwitchlessRing *SwitchlessHostCallServer::ring() const { return state_->ring; }
+
+uint64_t SwitchlessHostCallServer::requests_handled() const {
+  return state_->requests_handled.load(std::memory_order_relaxed);
+}
+
+StatusOr<std::shared_ptr<SwitchlessHostCallServer>> EnableSwitchlessHostCalls(
+    const std::shared_ptr<primitives::Client> &client,
+    const SwitchlessHostCallConfig &config) {
+  std::shared_ptr<SwitchlessHostCallServer> server;
+  ASYLO_ASSIGN_OR_RETURN(server,
+                         SwitchlessHostCallServer::Create(client, config));
+  ASYLO_RETURN_IF_ERROR(client->exit_call_provider()->RegisterExitHandler(
+      kSwitchlessRingHandler,
+      primitives::ExitHandler{
+          [server](std::shared_ptr<primitives::Client> enclave, void *context,
+                   primitives::MessageReader *input,
+                   primitives::MessageWriter *output) -> Status {
+            ASYLO_RETURN_IF_READER_NOT_EMPTY(*input);
+            output->Push(reinterpret_cast<uintptr_t>(server->ring()));
+            return absl::OkStatus();
+          }}));
+  return server;
+}
+
+}  // namespace host_call
+}  // namespace asylo
@@ -0,0 +1,83 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_HOST_CALL_UNTRUSTED_SWITCHLESS_HOST_CALL_SERVER_H_
+#define ASYLO_PLATFORM_HOST_CALL_UNTRUSTED_SWITCHLESS_HOST_CALL_SERVER_H_
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "asylo/enclave.pb.h"
+#include "asylo/platform/host_call/switchless_ring.h"
+#include "asylo/platform/primitives/untrusted_primitives.h"
+#include "asylo/util/status.h"
+#include "asylo/util/statusor.h"
+
+namespace asylo {
+namespace host_call {
+
+// Services switchless host calls posted by an enclave. Owns the request ring
+// in untrusted memory and a pool of worker threads which poll it and execute
+// each request through the |kSystemCallHandler| exit handler registered with
+// the client's exit call provider, so that exit hooks still observe every
+// call.
+class SwitchlessHostCallServer {
+ public:
+  // Creates a server for |client| and starts its worker threads.
+  static StatusOr<std::shared_ptr<SwitchlessHostCallServer>> Create(
+      const std::shared_ptr<primitives::Client> &client,
+      const SwitchlessHostCallConfig &config);
+
+  // Stops and joins the worker threads.
+  ~SwitchlessHostCallServer();
+
+  SwitchlessHostCallServer(const SwitchlessHostCallServer &other) = delete;
+  SwitchlessHostCallServer &operator=(const SwitchlessHostCallServer &other) =
+      delete;
+
+  // Returns the ring shared with the enclave.
+  SwitchlessRing *ring() const;
+
+  // Returns the number of requests executed by the workers so far.
+  uint64_t requests_handled() const;
+
+ private:
+  struct State;
+
+  explicit SwitchlessHostCallServer(std::shared_ptr<State> state)
+      : state_(std::move(state)) {}
+
+  // Worker state is shared with the worker threads, which may outlive the
+  // server if the last reference to the client is dropped by a worker.
+  std::shared_ptr<State> state_;
+  std::vector<std::thread> workers_;
+};
+
+// Creates a SwitchlessHostCallServer for |client| and registers the
+// |kSwitchlessRingHandler| exit handler through which the enclave fetches the
+// ring. The server lives as long as the client's exit call provider.
+StatusOr<std::shared_ptr<SwitchlessHostCallServer>> EnableSwitchlessHostCalls(
+    const std::shared_ptr<primitives::Client> &client,
+    const SwitchlessHostCallConfig &config);
+
+}  // namespace host_call
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_HOST_CALL_UNTRUSTED_SWITCHLESS_HOST_CALL_SERVER_H_
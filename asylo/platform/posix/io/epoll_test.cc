@@ -17,6 +17,7 @@
  */
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include <chrono>
@@ -291,5 +292,85 @@ TEST_F(EpollTest, LevelTriggeredBehavior) { LevelEdgeBehaviorTest(false); }
 
 TEST_F(EpollTest, EdgeTriggeredBehavior) { LevelEdgeBehaviorTest(true); }
 
+TEST_F(EpollTest, EventFdLevelTriggered) {
+  int efd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_NE(efd, -1);
+  int epfd = epoll_create(1);
+  ASSERT_NE(epfd, -1);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = efd;
+  ASSERT_NE(epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev), -1);
+  struct epoll_event events[1];
+  EXPECT_EQ(epoll_wait(epfd, events, 1, 0), 0);
+
+  uint64_t value = 1;
+  ASSERT_EQ(write(efd, &value, sizeof(value)), sizeof(value));
+  // The eventfd stays readable until it is read.
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(epoll_wait(epfd, events, 1, 0), 1);
+    EXPECT_EQ(events[0].events, EPOLLIN);
+    EXPECT_EQ(events[0].data.fd, efd);
+  }
+  ASSERT_EQ(read(efd, &value, sizeof(value)), sizeof(value));
+  EXPECT_EQ(epoll_wait(epfd, events, 1, 0), 0);
+  ASSERT_EQ(close(epfd), 0);
+  ASSERT_EQ(close(efd), 0);
+}
+
+TEST_F(EpollTest, EventFdOneShot) {
+  int efd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_NE(efd, -1);
+  int epfd = epoll_create(1);
+  ASSERT_NE(epfd, -1);
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.fd = efd;
+  ASSERT_NE(epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev), -1);
+  uint64_t value = 1;
+  ASSERT_EQ(write(efd, &value, sizeof(value)), sizeof(value));
+  struct epoll_event events[1];
+  ASSERT_EQ(epoll_wait(epfd, events, 1, 0), 1);
+  // The registration is disabled until it is modified.
+  EXPECT_EQ(epoll_wait(epfd, events, 1, 0), 0);
+  ASSERT_NE(epoll_ctl(epfd, EPOLL_CTL_MOD, efd, &ev), -1);
+  EXPECT_EQ(epoll_wait(epfd, events, 1, 0), 1);
+  ASSERT_EQ(close(epfd), 0);
+  ASSERT_EQ(close(efd), 0);
+}
+
+// Waits on pipes and an eventfd, and checks that writing to the eventfd wakes
+// the waiter.
+TEST_F(EpollTest, EventFdWakesWaiterOnPipes) {
+  InitializePipes();
+  int epfd = epoll_create(1);
+  ASSERT_NE(epfd, -1);
+  RegisterFds(epfd, kRead);
+  int efd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_NE(efd, -1);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = efd;
+  ASSERT_NE(epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev), -1);
+
+  for (int i = 0; i < 4; ++i) {
+    std::thread writer([efd]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      uint64_t value = 1;
+      write(efd, &value, sizeof(value));
+    });
+    struct epoll_event events[kNumPipes + 1];
+    int num_events = epoll_wait(epfd, events, kNumPipes + 1, -1);
+    writer.join();
+    ASSERT_EQ(num_events, 1);
+    EXPECT_EQ(events[0].data.fd, efd);
+    uint64_t value;
+    ASSERT_EQ(read(efd, &value, sizeof(value)), sizeof(value));
+  }
+  ASSERT_EQ(close(epfd), 0);
+  ASSERT_EQ(close(efd), 0);
+  ClosePipes();
+}
+
 }  // namespace
 }  // namespace asylo
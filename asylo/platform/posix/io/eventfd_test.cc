@@ -21,9 +21,11 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <thread>
 #include <vector>
 
+#include <benchmark/benchmark.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "absl/container/flat_hash_set.h"
@@ -196,5 +198,87 @@ TEST_F(EventFdTest, MaxCounterNonBlock) {
   EXPECT_EQ(errno, EAGAIN);
 }
 
+// Ensure that with several producers and consumers, every value written is
+// read exactly once, whether or not the counter is in semaphore mode.
+TEST_F(EventFdTest, MultipleProducersAndConsumers) {
+  constexpr int kWritesPerProducer = 20000;
+  for (bool semaphore : {false, true}) {
+    InitializeEventFd(semaphore, 0);
+    uint64_t total = 0;
+    for (int i = 0; i < kWritesPerProducer; ++i) {
+      total += 1 + i % 3;
+    }
+    total *= kNumWorkers / 2;
+
+    std::atomic<uint64_t> consumed(0);
+    std::atomic<uint64_t> release_writes(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < kNumWorkers / 2; ++i) {
+      workers.emplace_back([this] {
+        for (int j = 0; j < kWritesPerProducer; ++j) {
+          EXPECT_EQ(Write(1 + j % 3), sizeof(uint64_t));
+        }
+      });
+    }
+    for (int i = 0; i < kNumWorkers / 2; ++i) {
+      workers.emplace_back([this, semaphore, total, &consumed,
+                            &release_writes] {
+        while (consumed.load() < total) {
+          uint64_t value = Read();
+          if (semaphore) {
+            EXPECT_EQ(value, 1);
+          }
+          // Once everything has been consumed, each consumer releases the
+          // next, which may be blocked in Read(), with a value which does not
+          // count.
+          if (consumed.fetch_add(value) + value >= total) {
+            EXPECT_EQ(Write(1), sizeof(uint64_t));
+            ++release_writes;
+          }
+        }
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    // Every value written by a producer was read, and besides those only the
+    // release writes, some of which may be left unread.
+    EXPECT_GE(consumed.load(), total);
+    EXPECT_LE(consumed.load(), total + release_writes.load());
+    EXPECT_LE(release_writes.load(), static_cast<uint64_t>(kNumWorkers / 2));
+    close(event_fd_);
+  }
+}
+
+// Measures the round trip of a value between two threads over a pair of
+// eventfds, so that each side blocks until the other writes.
+void BM_EventFdPingPong(benchmark::State &state) {
+  int ping = eventfd(0, 0);
+  int pong = eventfd(0, 0);
+  if (ping == -1 || pong == -1) {
+    state.SkipWithError("Could not create eventfds");
+    return;
+  }
+  std::thread echo([ping, pong] {
+    uint64_t value = 0;
+    while (read(ping, &value, sizeof(value)) == sizeof(value) && value == 1) {
+      write(pong, &value, sizeof(value));
+    }
+  });
+  uint64_t value = 1;
+  for (auto _ : state) {
+    write(ping, &value, sizeof(value));
+    read(pong, &value, sizeof(value));
+  }
+  // Any value other than 1 stops the echo thread.
+  value = 2;
+  write(ping, &value, sizeof(value));
+  echo.join();
+  close(ping);
+  close(pong);
+}
+
+BENCHMARK(BM_EventFdPingPong)->UseRealTime();
+
 }  // namespace
 }  // namespace asylo
@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/posix/io/hazard_pointers.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace asylo {
+namespace io {
+namespace {
+
+// The number of retired objects, beyond the number of hazard pointers, which
+// may await reclamation before the retired objects are scanned.
+constexpr size_t kReclaimSlack = 16;
+
+// The source of domain identifiers. Zero is not a valid identifier.
+std::atomic<uint64_t> next_domain_id{1};
+
+// The record last used by the calling thread, and the identifier of the
+// domain it belongs to.
+thread_local struct {
+  uint64_t domain_id;
+  void *record;
+} cached_record = {0, nullptr};
+
+}  // namespace
+
+HazardPointerDomain::Guard::Guard(HazardPointerDomain *domain)
+    : domain_(domain), record_(domain->AcquireRecord()) {}
+
+HazardPointerDomain::Guard::~Guard() { domain_->ReleaseRecord(record_); }
+
+HazardPointerDomain::HazardPointerDomain()
+    : id_(next_domain_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+HazardPointerDomain::~HazardPointerDomain() {
+  for (Retired &retired : retired_) {
+    retired.deleter(retired.object);
+  }
+  Record *record = records_.load();
+  while (record) {
+    Record *next = record->next;
+    delete record;
+    record = next;
+  }
+}
+
+HazardPointerDomain::Record *HazardPointerDomain::AcquireRecord() {
+  // Try the record cached by this thread first, then any free record, and
+  // only allocate a record if every record is in use.
+  Record *record = nullptr;
+  if (cached_record.domain_id == id_) {
+    auto cached = static_cast<Record *>(cached_record.record);
+    if (!cached->in_use.exchange(true, std::memory_order_acquire)) {
+      return cached;
+    }
+  }
+  for (record = records_.load(std::memory_order_acquire); record;
+       record = record->next) {
+    if (!record->in_use.load(std::memory_order_relaxed) &&
+        !record->in_use.exchange(true, std::memory_order_acquire)) {
+      break;
+    }
+  }
+  if (!record) {
+    record = new Record;
+    record->in_use.store(true, std::memory_order_relaxed);
+    record->next = records_.load(std::memory_order_relaxed);
+    while (!records_.compare_exchange_weak(record->next, record,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+    num_records_.fetch_add(1, std::memory_order_relaxed);
+  }
+  cached_record.domain_id = id_;
+  cached_record.record = record;
+  return record;
+}
+
+void HazardPointerDomain::ReleaseRecord(Record *record) {
+  record->hazard.store(nullptr, std::memory_order_release);
+  record->in_use.store(false, std::memory_order_release);
+}
+
+void HazardPointerDomain::Retire(void *object,
+                                 std::function<void(void *)> deleter) {
+  absl::MutexLock lock(&retired_lock_);
+  retired_.push_back({object, std::move(deleter)});
+  if (retired_.size() >=
+      static_cast<size_t>(num_records_.load(std::memory_order_relaxed)) +
+          kReclaimSlack) {
+    Reclaim();
+  }
+}
+
+void HazardPointerDomain::Reclaim() {
+  // Pairs with the fence implied by the sequentially consistent stores in
+  // Guard::Protect(): either the reader sees the object unpublished and
+  // retries, or the object's address is seen here.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::vector<const void *> hazards;
+  for (Record *record = records_.load(std::memory_order_acquire); record;
+       record = record->next) {
+    const void *hazard = record->hazard.load(std::memory_order_seq_cst);
+    if (hazard) {
+      hazards.push_back(hazard);
+    }
+  }
+  std::sort(hazards.begin(), hazards.end());
+
+  std::vector<Retired> protected_objects;
+  for (Retired &retired : retired_) {
+    if (std::binary_search(hazards.begin(), hazards.end(), retired.object)) {
+      protected_objects.push_back(std::move(retired));
+    } else {
+      retired.deleter(retired.object);
+    }
+  }
+  retired_ = std::move(protected_objects);
+}
+
+}  // namespace io
+}  // namespace asylo
@@ -0,0 +1,135 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_POSIX_IO_HAZARD_POINTERS_H_
+#define ASYLO_PLATFORM_POSIX_IO_HAZARD_POINTERS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace asylo {
+namespace io {
+
+// A domain of hazard pointers, which lets readers use objects published
+// through atomic pointers without locking or reference counting while writers
+// concurrently unpublish and retire them.
+//
+// A reader protects an object by publishing its address in a hazard pointer
+// before using it, and a retired object is only deleted once no hazard
+// pointer holds its address. Unlike epoch-based reclamation, a reader which
+// blocks while holding a hazard pointer only delays the reclamation of the
+// object it protects.
+//
+// Each thread caches the hazard pointer it last used, so protecting an object
+// touches no cache line shared with other readers.
+class HazardPointerDomain {
+ private:
+  struct Record;
+
+ public:
+  // Protects at most one object at a time for the lifetime of the guard.
+  class Guard {
+   public:
+    explicit Guard(HazardPointerDomain *domain);
+    ~Guard();
+
+    Guard(const Guard &other) = delete;
+    Guard &operator=(const Guard &other) = delete;
+
+    // Loads |source| and protects the loaded object, which remains valid until
+    // the guard protects another object or is destroyed, even if it is
+    // concurrently unpublished from |source| and retired.
+    template <typename T>
+    T *Protect(const std::atomic<T *> &source) {
+      T *object = source.load(std::memory_order_acquire);
+      while (true) {
+        record_->hazard.store(object, std::memory_order_seq_cst);
+        T *reloaded = source.load(std::memory_order_seq_cst);
+        if (reloaded == object) {
+          return object;
+        }
+        object = reloaded;
+      }
+    }
+
+   private:
+    HazardPointerDomain *const domain_;
+    Record *const record_;
+  };
+
+  HazardPointerDomain();
+
+  // Destroys every retired object. No guard may be alive.
+  ~HazardPointerDomain();
+
+  HazardPointerDomain(const HazardPointerDomain &other) = delete;
+  HazardPointerDomain &operator=(const HazardPointerDomain &other) = delete;
+
+  // Schedules |object|, which must no longer be reachable by readers which
+  // are not already protecting it, to be destroyed by |deleter| once no guard
+  // protects it.
+  void Retire(void *object, std::function<void(void *)> deleter);
+
+  // Retires |object|, which is destroyed with delete.
+  template <typename T>
+  void Retire(T *object) {
+    Retire(object, [](void *ptr) { delete static_cast<T *>(ptr); });
+  }
+
+ private:
+  struct Record {
+    std::atomic<const void *> hazard{nullptr};
+    std::atomic<bool> in_use{false};
+    Record *next = nullptr;
+  };
+
+  struct Retired {
+    void *object;
+    std::function<void(void *)> deleter;
+  };
+
+  // Returns a record owned by the caller until it is released.
+  Record *AcquireRecord();
+
+  // Releases a record returned by AcquireRecord().
+  void ReleaseRecord(Record *record);
+
+  // Destroys the retired objects which are not protected by any guard.
+  void Reclaim() ABSL_EXCLUSIVE_LOCKS_REQUIRED(retired_lock_);
+
+  // Distinguishes this domain in the record cached by each thread.
+  const uint64_t id_;
+
+  // Every record ever allocated by this domain. Records are never freed before
+  // the domain is destroyed.
+  std::atomic<Record *> records_{nullptr};
+  std::atomic<int> num_records_{0};
+
+  absl::Mutex retired_lock_;
+  std::vector<Retired> retired_ ABSL_GUARDED_BY(retired_lock_);
+};
+
+}  // namespace io
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_POSIX_IO_HAZARD_POINTERS_H_
@@ -0,0 +1,151 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/posix/io/hazard_pointers.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+
+namespace asylo {
+namespace io {
+namespace {
+
+using ::testing::Eq;
+
+constexpr int kLive = 0x11fe;
+
+// An object which counts the live instances of its type and poisons itself
+// when destroyed.
+struct Tracked {
+  explicit Tracked(std::atomic<int> *live) : live(live) { live->fetch_add(1); }
+  ~Tracked() {
+    state = 0;
+    live->fetch_sub(1);
+  }
+
+  std::atomic<int> *const live;
+  volatile int state = kLive;
+};
+
+// Retires enough objects to make |domain| scan the objects retired before.
+void RetireMany(HazardPointerDomain *domain, std::atomic<int> *live) {
+  for (int i = 0; i < 64; ++i) {
+    domain->Retire(new Tracked(live));
+  }
+}
+
+TEST(HazardPointersTest, ProtectedObjectsAreNotReclaimed) {
+  std::atomic<int> live(0);
+  HazardPointerDomain domain;
+  std::atomic<Tracked *> published(new Tracked(&live));
+  bool reclaimed = false;
+  {
+    HazardPointerDomain::Guard guard(&domain);
+    Tracked *protected_object = guard.Protect(published);
+
+    domain.Retire(published.exchange(nullptr), [&reclaimed](void *object) {
+      delete static_cast<Tracked *>(object);
+      reclaimed = true;
+    });
+    RetireMany(&domain, &live);
+    EXPECT_THAT(protected_object->state, Eq(kLive));
+    EXPECT_FALSE(reclaimed);
+  }
+  RetireMany(&domain, &live);
+  EXPECT_TRUE(reclaimed);
+}
+
+TEST(HazardPointersTest, NestedGuardsProtectDistinctObjects) {
+  std::atomic<int> live(0);
+  HazardPointerDomain domain;
+  std::atomic<Tracked *> first(new Tracked(&live));
+  std::atomic<Tracked *> second(new Tracked(&live));
+  {
+    HazardPointerDomain::Guard outer(&domain);
+    Tracked *first_object = outer.Protect(first);
+    {
+      HazardPointerDomain::Guard inner(&domain);
+      Tracked *second_object = inner.Protect(second);
+      domain.Retire(first.exchange(nullptr));
+      domain.Retire(second.exchange(nullptr));
+      RetireMany(&domain, &live);
+      EXPECT_THAT(second_object->state, Eq(kLive));
+    }
+    RetireMany(&domain, &live);
+    EXPECT_THAT(first_object->state, Eq(kLive));
+  }
+}
+
+TEST(HazardPointersTest, DestroyingDomainReclaimsRetiredObjects) {
+  std::atomic<int> live(0);
+  {
+    HazardPointerDomain domain;
+    domain.Retire(new Tracked(&live));
+    RetireMany(&domain, &live);
+  }
+  EXPECT_THAT(live.load(), Eq(0));
+}
+
+TEST(HazardPointersTest, ReadersNeverSeeReclaimedObjects) {
+  constexpr int kReaders = 4;
+  constexpr int kSlots = 16;
+  constexpr int kReplacements = 20000;
+  std::atomic<int> live(0);
+  auto domain = absl::make_unique<HazardPointerDomain>();
+  std::vector<std::atomic<Tracked *>> slots(kSlots);
+  for (auto &slot : slots) {
+    slot.store(new Tracked(&live));
+  }
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < kReaders; ++i) {
+    readers.emplace_back([&] {
+      while (!done.load()) {
+        for (auto &slot : slots) {
+          HazardPointerDomain::Guard guard(domain.get());
+          Tracked *object = guard.Protect(slot);
+          EXPECT_THAT(object->state, Eq(kLive));
+        }
+      }
+    });
+  }
+  for (int i = 0; i < kReplacements; ++i) {
+    domain->Retire(slots[i % kSlots].exchange(new Tracked(&live)));
+  }
+  done.store(true);
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  for (auto &slot : slots) {
+    domain->Retire(slot.exchange(nullptr));
+  }
+  domain.reset();
+  EXPECT_THAT(live.load(), Eq(0));
+}
+
+}  // namespace
+}  // namespace io
+}  // namespace asylo
@@ -18,73 +18,394 @@
 #include "asylo/platform/posix/io/io_context_epoll.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <openssl/rand.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "asylo/platform/host_call/trusted/host_calls.h"
 
 namespace asylo {
 namespace io {
+namespace {
 
-int IOContextEpoll::EpollCtl(int op, int hostfd, struct epoll_event *event) {
-  struct epoll_event event_copy = {};
-  if (event) {
-    event_copy.events = event->events;
-  }
-  if (op == EPOLL_CTL_ADD) {
-    uint64_t key = 0;
-    do {
-      if (RAND_bytes(reinterpret_cast<uint8_t *>(&key),
-                     sizeof(uint64_t)) != 1) {
-        errno = EBADE;
-        return -1;
-      }
-    } while (key_to_data.find(key) != key_to_data.end());
-    key_to_data[key] = event->data.u64;
-    fd_to_key[hostfd] = key;
-    event_copy.data.u64 = key;
-  } else if (op == EPOLL_CTL_MOD) {
-    if (fd_to_key.find(hostfd) == fd_to_key.end()) {
+// The key of the host pipe used to wake waiting threads. Registrations of
+// streams backed by the host never use this key.
+constexpr uint64_t kWakeupKey = 0;
+
+// The events which are reported whether or not they are requested.
+constexpr uint32_t kAlwaysReported = EPOLLERR | EPOLLHUP;
+
+}  // namespace
+
+int IOContextEpoll::EpollCtl(int op, int fd, std::shared_ptr<IOContext> target,
+                             struct epoll_event *event) {
+  if (target.get() == this) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (op != EPOLL_CTL_DEL && !event) {
+    errno = EFAULT;
+    return -1;
+  }
+  absl::MutexLock lock(&ctl_lock_);
+  switch (op) {
+    case EPOLL_CTL_ADD:
+      return Add(fd, target, event);
+    case EPOLL_CTL_MOD:
+      return Modify(fd, target, event);
+    case EPOLL_CTL_DEL:
+      return Delete(fd, target);
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+int IOContextEpoll::Add(int fd, const std::shared_ptr<IOContext> &target,
+                        struct epoll_event *event) {
+  ReadinessNotifier *notifier = target->GetReadinessNotifier();
+  int target_host_fd = target->GetHostFileDescriptor();
+  if (!notifier && target_host_fd < 0) {
+    // Like regular files on Linux, streams which are neither implemented
+    // inside the enclave nor backed by the host do not support epoll.
+    errno = EPERM;
+    return -1;
+  }
+  if (notifier && InitializeWakeup() != 0) {
+    return -1;
+  }
+
+  auto registration = absl::make_unique<Registration>();
+  registration->epoll = this;
+  registration->context = target;
+  registration->host_fd = notifier ? -1 : target_host_fd;
+  registration->events = event->events;
+  registration->data = event->data.u64;
+  registration->key = kWakeupKey;
+  registration->ready = false;
+  registration->disarmed = false;
+  registration->registered = true;
+  Registration *added = registration.get();
+
+  std::unique_ptr<Registration> stale;
+  {
+    absl::MutexLock lock(&lock_);
+    if (Find(fd, target)) {
+      errno = EEXIST;
+      return -1;
+    }
+    if (!notifier) {
+      do {
+        if (RAND_bytes(reinterpret_cast<uint8_t *>(&added->key),
+                       sizeof(added->key)) != 1) {
+          errno = EBADE;
+          return -1;
+        }
+      } while (added->key == kWakeupKey ||
+               key_to_registration_.find(added->key) !=
+                   key_to_registration_.end());
+      key_to_registration_[added->key] = added;
+      ++num_host_registrations_;
+      // Threads waiting only on streams inside the enclave must start waiting
+      // on the host.
+      ready_cond_.SignalAll();
+    }
+    // A registration of a stream which is no longer open as |fd| is left
+    // behind when |fd| is closed, and is replaced here. The host removed the
+    // closed descriptor from its interest list already, and the same host
+    // descriptor number may now belong to the stream being added.
+    stale = Detach(fd);
+    registrations_[fd] = std::move(registration);
+  }
+  if (stale) {
+    Unregister(std::move(stale), /*remove_from_host=*/false);
+  }
+
+  if (notifier) {
+    notifier->AddObserver(added);
+    // The stream may have become ready before it was observed.
+    MarkReady(added);
+    return 0;
+  }
+  struct epoll_event host_event = {};
+  host_event.events = added->events;
+  host_event.data.u64 = added->key;
+  if (enc_untrusted_epoll_ctl(host_fd_, EPOLL_CTL_ADD, target_host_fd,
+                              &host_event) != 0) {
+    int error = errno;
+    {
+      absl::MutexLock lock(&lock_);
+      registration = Detach(fd);
+    }
+    Unregister(std::move(registration), /*remove_from_host=*/false);
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+int IOContextEpoll::Modify(int fd, const std::shared_ptr<IOContext> &target,
+                           struct epoll_event *event) {
+  Registration *registration;
+  {
+    absl::MutexLock lock(&lock_);
+    registration = Find(fd, target);
+    if (!registration) {
       errno = ENOENT;
       return -1;
     }
-    uint64_t key = fd_to_key[hostfd];
-    key_to_data[key] = event->data.u64;
-    event_copy.data.u64 = key;
-  } else if (op == EPOLL_CTL_DEL) {
-    if (fd_to_key.find(hostfd) == fd_to_key.end()) {
+    registration->events = event->events;
+    registration->data = event->data.u64;
+    registration->disarmed = false;
+  }
+  if (registration->key == kWakeupKey) {
+    MarkReady(registration);
+    return 0;
+  }
+  struct epoll_event host_event = {};
+  host_event.events = event->events;
+  host_event.data.u64 = registration->key;
+  return enc_untrusted_epoll_ctl(host_fd_, EPOLL_CTL_MOD, registration->host_fd,
+                                 &host_event);
+}
+
+int IOContextEpoll::Delete(int fd, const std::shared_ptr<IOContext> &target) {
+  std::unique_ptr<Registration> registration;
+  {
+    absl::MutexLock lock(&lock_);
+    if (!Find(fd, target)) {
       errno = ENOENT;
       return -1;
     }
-    uint64_t key = fd_to_key[hostfd];
-    event_copy.data.u64 = key;
-    fd_to_key.erase(hostfd);
-    key_to_data.erase(key);
-  } else {
+    registration = Detach(fd);
+  }
+  Unregister(std::move(registration), /*remove_from_host=*/true);
+  return 0;
+}
+
+IOContextEpoll::Registration *IOContextEpoll::Find(
+    int fd, const std::shared_ptr<IOContext> &target) {
+  auto it = registrations_.find(fd);
+  if (it == registrations_.end() || it->second->context.lock() != target) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+std::unique_ptr<IOContextEpoll::Registration> IOContextEpoll::Detach(int fd) {
+  auto it = registrations_.find(fd);
+  if (it == registrations_.end()) {
+    return nullptr;
+  }
+  std::unique_ptr<Registration> registration = std::move(it->second);
+  registrations_.erase(it);
+  registration->registered = false;
+  if (registration->key != kWakeupKey) {
+    key_to_registration_.erase(registration->key);
+    --num_host_registrations_;
+  }
+  if (registration->ready) {
+    ready_.erase(std::find(ready_.begin(), ready_.end(), registration.get()));
+  }
+  return registration;
+}
+
+void IOContextEpoll::Unregister(std::unique_ptr<Registration> registration,
+                                bool remove_from_host) {
+  if (registration->key != kWakeupKey) {
+    // The host file descriptor may already be closed, in which case the host
+    // has already removed it.
+    if (remove_from_host) {
+      struct epoll_event host_event = {};
+      enc_untrusted_epoll_ctl(host_fd_, EPOLL_CTL_DEL, registration->host_fd,
+                              &host_event);
+    }
+    return;
+  }
+  // Once the observer is removed no notification refers to |registration|.
+  std::shared_ptr<IOContext> context = registration->context.lock();
+  if (context) {
+    context->GetReadinessNotifier()->RemoveObserver(registration.get());
+  }
+}
+
+int IOContextEpoll::InitializeWakeup() {
+  {
+    absl::MutexLock lock(&lock_);
+    if (wakeup_read_fd_ >= 0) {
+      return 0;
+    }
+  }
+  int pipefd[2];
+  if (enc_untrusted_pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) != 0) {
+    return -1;
+  }
+  struct epoll_event host_event = {};
+  host_event.events = EPOLLIN;
+  host_event.data.u64 = kWakeupKey;
+  if (enc_untrusted_epoll_ctl(host_fd_, EPOLL_CTL_ADD, pipefd[0],
+                              &host_event) != 0) {
+    int error = errno;
+    enc_untrusted_close(pipefd[0]);
+    enc_untrusted_close(pipefd[1]);
+    errno = error;
     return -1;
   }
-  return enc_untrusted_epoll_ctl(host_fd_, op, hostfd, &event_copy);
+  absl::MutexLock lock(&lock_);
+  wakeup_read_fd_ = pipefd[0];
+  wakeup_write_fd_ = pipefd[1];
+  return 0;
+}
+
+void IOContextEpoll::MarkReady(Registration *registration) {
+  int wakeup_fd = -1;
+  {
+    absl::MutexLock lock(&lock_);
+    if (!registration->registered || registration->ready) {
+      return;
+    }
+    registration->ready = true;
+    ready_.push_back(registration);
+    ready_cond_.SignalAll();
+    if (host_waiters_ > 0 && !wakeup_pending_) {
+      wakeup_pending_ = true;
+      wakeup_fd = wakeup_write_fd_;
+    }
+  }
+  // The pipe is only closed after every observer is removed, so it is still
+  // open here.
+  if (wakeup_fd >= 0) {
+    char wakeup = 0;
+    enc_untrusted_write(wakeup_fd, &wakeup, sizeof(wakeup));
+  }
+}
+
+int IOContextEpoll::CollectReady(struct epoll_event *events, int maxevents) {
+  int count = 0;
+  // Level-triggered registrations which are still ready are queued again, so
+  // only look at the registrations which were ready on entry.
+  size_t pending = ready_.size();
+  while (pending > 0 && count < maxevents) {
+    --pending;
+    Registration *registration = ready_.front();
+    ready_.pop_front();
+    registration->ready = false;
+    if (registration->disarmed) {
+      continue;
+    }
+    std::shared_ptr<IOContext> context = registration->context.lock();
+    if (!context) {
+      continue;
+    }
+    uint32_t ready_events =
+        context->GetReadiness() & (registration->events | kAlwaysReported);
+    if (!ready_events) {
+      continue;
+    }
+    events[count].events = ready_events;
+    events[count].data.u64 = registration->data;
+    ++count;
+    if (registration->events & EPOLLONESHOT) {
+      registration->disarmed = true;
+    } else if (!(registration->events & EPOLLET)) {
+      registration->ready = true;
+      ready_.push_back(registration);
+    }
+  }
+  return count;
+}
+
+int IOContextEpoll::TranslateHostEvents(struct epoll_event *events,
+                                        int count) {
+  int translated = 0;
+  for (int i = 0; i < count; ++i) {
+    auto it = key_to_registration_.find(events[i].data.u64);
+    // Skip wakeups, and events of streams removed since the host returned.
+    if (it == key_to_registration_.end()) {
+      continue;
+    }
+    events[translated].events = events[i].events;
+    events[translated].data.u64 = it->second->data;
+    ++translated;
+  }
+  return translated;
 }
 
 int IOContextEpoll::EpollWait(struct epoll_event *events, int maxevents,
                               int timeout) {
-  int ret = enc_untrusted_epoll_wait(host_fd_, events, maxevents, timeout);
-  if (ret == -1) {
-    // errno is set in enc_untrusted_epoll_wait.
+  if (maxevents <= 0) {
+    errno = EINVAL;
     return -1;
   }
-  // Convert the random bits in the data field back to the original data using
-  // the key_to_data map.
-  for (int i = 0; i < ret; ++i) {
-    uint64_t key = events[i].data.u64;
-    if (key_to_data.find(key) == key_to_data.end()) {
-      errno = EBADE;
+  const absl::Time deadline = timeout < 0
+                                  ? absl::InfiniteFuture()
+                                  : absl::Now() + absl::Milliseconds(timeout);
+  absl::MutexLock lock(&lock_);
+  while (true) {
+    int count = CollectReady(events, maxevents);
+    if (num_host_registrations_ == 0 || count == maxevents) {
+      if (count > 0) {
+        return count;
+      }
+      if (ready_cond_.WaitWithDeadline(&lock_, deadline)) {
+        return 0;
+      }
+      continue;
+    }
+
+    // Streams backed by the host are only polled when no stream inside the
+    // enclave is ready, so that ready streams are delivered without delay.
+    int host_timeout = 0;
+    if (count == 0) {
+      host_timeout = deadline == absl::InfiniteFuture()
+                         ? -1
+                         : absl::ToInt64Milliseconds(absl::Ceil(
+                               std::max(deadline - absl::Now(),
+                                        absl::ZeroDuration()),
+                               absl::Milliseconds(1)));
+    }
+    int wakeup_fd = wakeup_read_fd_;
+    ++host_waiters_;
+    lock_.Unlock();
+    int host_count = enc_untrusted_epoll_wait(
+        host_fd_, events + count, maxevents - count, host_timeout);
+    int error = errno;
+    bool woken = false;
+    for (int i = 0; i < host_count; ++i) {
+      woken |= events[count + i].data.u64 == kWakeupKey;
+    }
+    if (woken) {
+      uint64_t drained;
+      enc_untrusted_read(wakeup_fd, &drained, sizeof(drained));
+    }
+    lock_.Lock();
+    --host_waiters_;
+    if (woken) {
+      wakeup_pending_ = false;
+    }
+
+    if (host_count < 0) {
+      if (count > 0) {
+        return count;
+      }
+      errno = error;
       return -1;
     }
-    events[i].data.u64 = key_to_data[key];
+    count += TranslateHostEvents(events + count, host_count);
+    if (count > 0) {
+      return count;
+    }
+    if (host_timeout == 0 || absl::Now() >= deadline) {
+      return 0;
+    }
   }
-  return ret;
 }
 
 int IOContextEpoll::GetHostFileDescriptor() { return host_fd_; }
@@ -100,7 +421,31 @@ ssize_t IOContextEpoll::Write(const void *buf, size_t count) {
   return -1;
 }
 
-int IOContextEpoll::Close() { return enc_untrusted_close(host_fd_); }
+int IOContextEpoll::Close() {
+  absl::MutexLock lock(&ctl_lock_);
+  std::vector<std::unique_ptr<Registration>> registrations;
+  int wakeup_fds[2];
+  {
+    absl::MutexLock lock(&lock_);
+    while (!registrations_.empty()) {
+      registrations.push_back(Detach(registrations_.begin()->first));
+    }
+    wakeup_fds[0] = wakeup_read_fd_;
+    wakeup_fds[1] = wakeup_write_fd_;
+    wakeup_read_fd_ = -1;
+    wakeup_write_fd_ = -1;
+  }
+  // Closing the host epoll instance removes every stream backed by the host.
+  for (auto &registration : registrations) {
+    Unregister(std::move(registration), /*remove_from_host=*/false);
+  }
+  for (int wakeup_fd : wakeup_fds) {
+    if (wakeup_fd >= 0) {
+      enc_untrusted_close(wakeup_fd);
+    }
+  }
+  return enc_untrusted_close(host_fd_);
+}
 
 }  // namespace io
 }  // namespace asylo
@@ -19,33 +19,130 @@
 #ifndef ASYLO_PLATFORM_POSIX_IO_IO_CONTEXT_EPOLL_H_
 #define ASYLO_PLATFORM_POSIX_IO_IO_CONTEXT_EPOLL_H_
 
+#include <deque>
+#include <memory>
 #include <unordered_map>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
 #include "asylo/platform/posix/io/io_manager.h"
+#include "asylo/platform/posix/io/readiness_notifier.h"
 
 namespace asylo {
 namespace io {
-// IOContext implementation wrapping an epoll file descriptor
+
+// IOContext implementation of an epoll instance, which keeps its registrations
+// across calls to epoll_wait.
+//
+// Streams backed by a host file descriptor are registered with an epoll
+// instance on the host. Streams implemented inside the enclave, such as
+// eventfds, report changes in their readiness through a ReadinessNotifier and
+// are delivered from a ready list in trusted memory, so waiting on them alone
+// never exits the enclave. A thread waiting on both kinds of streams blocks on
+// the host and is woken through a host pipe when an enclave stream becomes
+// ready.
 class IOContextEpoll : public IOManager::IOContext {
  public:
   explicit IOContextEpoll(int host_fd) : host_fd_(host_fd) {}
-  // It's important to note that adding dup'd file descriptors here won't work
-  // the same as it would in POSIX.
-  int EpollCtl(int op, int hostfd, struct epoll_event *event) override;
+
+  // It's important to note that adding dup'd file descriptors backed by the
+  // host here won't work the same as it would in POSIX.
+  int EpollCtl(int op, int fd, std::shared_ptr<IOContext> target,
+               struct epoll_event *event) override ABSL_LOCKS_EXCLUDED(lock_);
   int EpollWait(struct epoll_event *events, int maxevents,
-                int timeout) override;
+                int timeout) override ABSL_LOCKS_EXCLUDED(lock_);
   int GetHostFileDescriptor() override;
   ssize_t Read(void *buf, size_t count);
   ssize_t Write(const void *buf, size_t count);
-  int Close();
+  int Close() ABSL_LOCKS_EXCLUDED(lock_);
 
  private:
+  // The registration of a stream, keyed by its enclave file descriptor.
+  struct Registration : public ReadinessObserver {
+    void OnReadinessChanged() override { epoll->MarkReady(this); }
+
+    IOContextEpoll *epoll;
+    std::weak_ptr<IOContext> context;
+    // The host file descriptor of a stream backed by the host.
+    int host_fd;
+    // The events and user data passed to epoll_ctl.
+    uint32_t events;
+    uint64_t data;
+    // The key identifying this registration to the host, or zero for a stream
+    // implemented inside the enclave.
+    uint64_t key;
+    // Whether the registration is in |ready_|.
+    bool ready;
+    // Whether an EPOLLONESHOT registration has delivered its event.
+    bool disarmed;
+    // Whether the registration is still in |registrations_|.
+    bool registered;
+  };
+
+  int Add(int fd, const std::shared_ptr<IOContext> &target,
+          struct epoll_event *event) ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctl_lock_);
+  int Modify(int fd, const std::shared_ptr<IOContext> &target,
+             struct epoll_event *event)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctl_lock_);
+  int Delete(int fd, const std::shared_ptr<IOContext> &target)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctl_lock_);
+
+  // Returns the registration of |target| as |fd|, or nullptr if it is not
+  // registered.
+  Registration *Find(int fd, const std::shared_ptr<IOContext> &target)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Removes the registration of |fd| from the tables shared with waiters.
+  std::unique_ptr<Registration> Detach(int fd)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Stops observing the stream of a detached |registration| and destroys it.
+  void Unregister(std::unique_ptr<Registration> registration,
+                  bool remove_from_host)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctl_lock_) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Creates the host pipe used to wake threads waiting on the host.
+  int InitializeWakeup() ABSL_EXCLUSIVE_LOCKS_REQUIRED(ctl_lock_);
+
+  // Queues |registration| to have its readiness checked by the next waiter.
+  void MarkReady(Registration *registration) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Stores up to |maxevents| events of ready streams implemented inside the
+  // enclave in |events|, and returns the number of events stored.
+  int CollectReady(struct epoll_event *events, int maxevents)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Translates the |count| events returned by the host into |events| and
+  // returns the number of events left.
+  int TranslateHostEvents(struct epoll_event *events, int count)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
   // Host file descriptor implementing this stream.
   int host_fd_;
-  std::unordered_map<uint64_t, uint64_t> key_to_data;
-  // Manages a mapping from the host file descriptor to a random key to enable
-  // updates to the above map durring deletions/modifications.
-  std::unordered_map<int, uint64_t> fd_to_key;
+
+  // Serializes changes to the registrations. Acquired before |lock_| and
+  // before the locks of readiness notifiers, which are in turn acquired before
+  // |lock_|. Host calls are made without holding |lock_|.
+  absl::Mutex ctl_lock_ ABSL_ACQUIRED_BEFORE(lock_);
+
+  absl::Mutex lock_;
+  absl::CondVar ready_cond_;
+  std::unordered_map<int, std::unique_ptr<Registration>> registrations_
+      ABSL_GUARDED_BY(lock_);
+  std::unordered_map<uint64_t, Registration *> key_to_registration_
+      ABSL_GUARDED_BY(lock_);
+  int num_host_registrations_ ABSL_GUARDED_BY(lock_) = 0;
+  std::deque<Registration *> ready_ ABSL_GUARDED_BY(lock_);
+
+  // The number of threads blocked in a host epoll_wait, and whether a wakeup
+  // has been written to the host pipe and not yet consumed.
+  int host_waiters_ ABSL_GUARDED_BY(lock_) = 0;
+  bool wakeup_pending_ ABSL_GUARDED_BY(lock_) = false;
+
+  // The host pipe written to wake threads waiting on the host, which is
+  // created when the first stream implemented inside the enclave is added.
+  int wakeup_read_fd_ ABSL_GUARDED_BY(lock_) = -1;
+  int wakeup_write_fd_ ABSL_GUARDED_BY(lock_) = -1;
 };
 
 }  // namespace io
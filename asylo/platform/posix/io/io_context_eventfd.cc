@@ -17,32 +17,64 @@
  */
 #include "asylo/platform/posix/io/io_context_eventfd.h"
 
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+
+#include "asylo/platform/host_call/trusted/host_calls.h"
+#include "asylo/platform/primitives/trusted_runtime.h"
+
 constexpr uint64_t kMaxCounter = 0xfffffffffffffffe;
 constexpr ssize_t kCounterBufSize = sizeof(uint64_t);
 
 namespace asylo {
 namespace io {
+namespace {
+
+// A blocked read or write checks the counter up to kSpinCount times before
+// parking on the host. The thread which unblocks it usually runs on another
+// core, and parking and waking each cost an enclave exit, so spinning first
+// keeps most hand-offs inside the enclave. On a single core spinning only
+// delays the thread it waits for, so it is skipped.
+constexpr int kSpinCount = 1000;
+
+int SpinCount() {
+  static const int spin_count =
+      sysconf(_SC_NPROCESSORS_ONLN) > 1 ? kSpinCount : 0;
+  return spin_count;
+}
+
+}  // namespace
+
+IOContextEventFd::IOContextEventFd(unsigned int initval, int flags)
+    : counter_(initval),
+      semaphore_(flags & EFD_SEMAPHORE),
+      nonblock_(flags & EFD_NONBLOCK),
+      waiting_readers_(0),
+      waiting_writers_(0),
+      readable_futex_(enc_untrusted_create_wait_queue()),
+      writable_futex_(enc_untrusted_create_wait_queue()) {}
+
+IOContextEventFd::~IOContextEventFd() {
+  enc_untrusted_destroy_wait_queue(readable_futex_);
+  enc_untrusted_destroy_wait_queue(writable_futex_);
+}
 
 ssize_t IOContextEventFd::Read(void *buf, size_t count) {
   if (count < kCounterBufSize) {
     errno = EINVAL;
     return -1;
   }
-  absl::MutexLock counter_mutex_lock(&counter_mutex_);
-  if (nonblock_ && (counter_ == 0)) {
+  uint64_t value = Take();
+  if (value == 0) {
     errno = EAGAIN;
     return -1;
-  } else {
-    auto ready = [this]() { return counter_ > 0; };
-    counter_mutex_.Await(absl::Condition(&ready));
-  }
-  if (semaphore_) {
-    *reinterpret_cast<uint64_t *>(buf) = 1;
-    --counter_;
-  } else {
-    *reinterpret_cast<uint64_t *>(buf) = counter_;
-    counter_ = 0;
   }
+  *reinterpret_cast<uint64_t *>(buf) = value;
+  // Reading may make the eventfd writable.
+  notifier_.Notify();
   return kCounterBufSize;
 }
 
@@ -56,21 +88,114 @@ ssize_t IOContextEventFd::Write(const void *buf, size_t count) {
     errno = EINVAL;
     return -1;
   }
-  absl::MutexLock counter_mutex_lock(&counter_mutex_);
-  if (nonblock_ && (counter_ + add > kMaxCounter)) {
+  if (!Add(add)) {
     errno = EAGAIN;
     return -1;
-  } else {
-    auto ready = [this, add]() { return (counter_ + add) <= kMaxCounter; };
-    counter_mutex_.Await(absl::Condition(&ready));
   }
-  counter_ += add;
+  notifier_.Notify();
   return kCounterBufSize;
 }
 
+uint32_t IOContextEventFd::GetReadiness() {
+  uint64_t value = counter_.load();
+  uint32_t events = 0;
+  if (value > 0) {
+    events |= EPOLLIN;
+  }
+  if (value < kMaxCounter) {
+    events |= EPOLLOUT;
+  }
+  return events;
+}
+
 int IOContextEventFd::Close() {
   return 0;
 }
 
+uint64_t IOContextEventFd::Take() {
+  uint64_t value = counter_.load(std::memory_order_relaxed);
+  while (true) {
+    if (value == 0) {
+      if (nonblock_) {
+        return 0;
+      }
+      Wait([](uint64_t counter) { return counter > 0; }, &waiting_readers_,
+           readable_futex_);
+      value = counter_.load(std::memory_order_relaxed);
+      continue;
+    }
+    uint64_t taken = semaphore_ ? 1 : value;
+    if (counter_.compare_exchange_weak(value, value - taken)) {
+      // In semaphore mode, pass what is left on to another waiting reader.
+      if (value > taken) {
+        Wake(waiting_readers_, readable_futex_, 1);
+      }
+      Wake(waiting_writers_, writable_futex_, INT32_MAX);
+      return taken;
+    }
+  }
+}
+
+bool IOContextEventFd::Add(uint64_t add) {
+  auto has_room = [add](uint64_t counter) {
+    return add <= kMaxCounter - counter;
+  };
+  uint64_t value = counter_.load(std::memory_order_relaxed);
+  while (true) {
+    if (!has_room(value)) {
+      if (nonblock_) {
+        return false;
+      }
+      Wait(has_room, &waiting_writers_, writable_futex_);
+      value = counter_.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (counter_.compare_exchange_weak(value, value + add)) {
+      break;
+    }
+  }
+  if (add > 0) {
+    Wake(waiting_readers_, readable_futex_, 1);
+  }
+  return true;
+}
+
+template <typename Predicate>
+void IOContextEventFd::Wait(Predicate ready, std::atomic<uint32_t> *waiters,
+                            int32_t *futex) {
+  for (int i = 0, spin_count = SpinCount(); i < spin_count; ++i) {
+    if (ready(counter_.load(std::memory_order_relaxed))) {
+      return;
+    }
+    enc_pause();
+  }
+
+  // Registering as a waiter before checking the counter guarantees that either
+  // this thread observes the counter change, or the thread changing it
+  // observes the waiter and wakes it.
+  waiters->fetch_add(1);
+  while (true) {
+    // The futex word must be read before the counter, so that a wake-up
+    // between the two reads changes it and the wait below returns immediately.
+    int32_t sequence = __atomic_load_n(futex, __ATOMIC_SEQ_CST);
+    if (ready(counter_.load())) {
+      break;
+    }
+    enc_untrusted_sys_futex_wait(futex, sequence, /*timeout_microsec=*/0);
+  }
+  waiters->fetch_sub(1);
+}
+
+void IOContextEventFd::Wake(const std::atomic<uint32_t> &waiters,
+                            int32_t *futex, int count) {
+  // Waking parked threads requires an enclave exit, so only do so if a thread
+  // is parked or about to park.
+  if (waiters.load() == 0) {
+    return;
+  }
+  __atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+  enc_untrusted_sys_futex_wake(futex, count);
+}
+
 }  // namespace io
 }  // namespace asylo
@@ -21,40 +21,70 @@
 
 #include <sys/eventfd.h>
 
-#include <thread>
+#include <atomic>
+#include <cstdint>
 
-#include "absl/synchronization/mutex.h"
 #include "asylo/platform/posix/io/io_manager.h"
+#include "asylo/platform/posix/io/readiness_notifier.h"
 
 namespace asylo {
 namespace io {
-// IOContext implementation wrapping an epoll file descriptor
+
+// IOContext implementation of an eventfd, whose counter lives in the enclave.
+//
+// The counter is updated with atomic operations alone, so reads and writes from
+// any number of threads never take a lock. A blocking read of a zero counter,
+// or write which would overflow it, spins briefly and then parks on a futex
+// word in untrusted memory. As with TrustedMutex, the futex word is only a
+// wake-up hint and the counter remains the source of truth. Reads and writes
+// exit the enclave to wake parked threads only when some are registered as
+// waiting, so an eventfd which never blocks never leaves the enclave.
 class IOContextEventFd : public IOManager::IOContext {
  public:
-  explicit IOContextEventFd(unsigned int initval, int flags)
-      : counter_(initval) {
-    if (flags & EFD_SEMAPHORE) {
-      semaphore_ = true;
-    } else {
-      semaphore_ = false;
-    }
-    if (flags & EFD_NONBLOCK) {
-      nonblock_ = true;
-    } else {
-      nonblock_ = false;
-    }
-  }
+  IOContextEventFd(unsigned int initval, int flags);
+  ~IOContextEventFd() override;
 
   ssize_t Read(void *buf, size_t count) override;
   ssize_t Write(const void *buf, size_t count) override;
   int Close() override;
+  ReadinessNotifier *GetReadinessNotifier() override { return &notifier_; }
+  uint32_t GetReadiness() override;
 
  private:
-  // Host file descriptor implementing this stream.
-  uint64_t counter_;
-  bool semaphore_;
-  bool nonblock_;
-  absl::Mutex counter_mutex_;
+  // Takes the whole counter, or one in semaphore mode, once it is nonzero.
+  // Returns the value taken, or 0 if the eventfd is non-blocking and the
+  // counter is zero.
+  uint64_t Take();
+
+  // Adds |add| to the counter once it would not exceed the maximum. Returns
+  // false if the eventfd is non-blocking and the counter is too large.
+  bool Add(uint64_t add);
+
+  // Waits until |ready| returns true for the value of the counter, first
+  // spinning and then parking on |futex|. |waiters| counts the threads parked
+  // on |futex|.
+  template <typename Predicate>
+  void Wait(Predicate ready, std::atomic<uint32_t> *waiters, int32_t *futex);
+
+  // Wakes up to |count| threads parked on |futex| if |waiters| is nonzero.
+  void Wake(const std::atomic<uint32_t> &waiters, int32_t *futex, int count);
+
+  std::atomic<uint64_t> counter_;
+  const bool semaphore_;
+  const bool nonblock_;
+
+  // The number of threads parked, or about to park, until the counter becomes
+  // nonzero, and until it has room for their write.
+  std::atomic<uint32_t> waiting_readers_;
+  std::atomic<uint32_t> waiting_writers_;
+
+  // Futex words in untrusted memory which waiting readers and writers sleep
+  // on. Each is incremented before its waiters are woken, so a waiter which
+  // read it before the counter changed does not go to sleep.
+  int32_t *const readable_futex_;
+  int32_t *const writable_futex_;
+
+  ReadinessNotifier notifier_;
 };
 
 }  // namespace io
@@ -0,0 +1,366 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/posix/io/io_context_trusted_pipe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <climits>
+#include <utility>
+
+namespace asylo {
+namespace io {
+
+ssize_t TrustedPipe::Read(void *buf, size_t count, bool nonblock) {
+  if (count == 0) {
+    return 0;
+  }
+  if (nonblock) {
+    if (!read_lock_.TryLock()) {
+      // Another reader is either reading or waiting for the pipe to become
+      // readable.
+      errno = EAGAIN;
+      return -1;
+    }
+  } else {
+    read_lock_.Lock();
+  }
+  ssize_t result = ReadLocked(static_cast<uint8_t *>(buf), count, nonblock);
+  read_lock_.Unlock();
+  return result;
+}
+
+ssize_t TrustedPipe::ReadLocked(uint8_t *buf, size_t count, bool nonblock) {
+  while (true) {
+    if (buffer_.is_closed_for_read()) {
+      return 0;
+    }
+    size_t num_read = buffer_.NonBlockingRead(buf, count);
+    if (num_read > 0) {
+      WakeWriters();
+      return num_read;
+    }
+    if (buffer_.is_closed_for_write()) {
+      // Bytes written before the writing end was closed are still delivered.
+      num_read = buffer_.NonBlockingRead(buf, count);
+      if (num_read > 0) {
+        WakeWriters();
+      }
+      return num_read;
+    }
+    if (nonblock) {
+      errno = EAGAIN;
+      return -1;
+    }
+    // Registering as a waiter before checking the buffer again pairs with the
+    // writer adding to the buffer before checking for waiters, so one of the
+    // two always sees the other.
+    waiting_readers_.fetch_add(1);
+    {
+      absl::MutexLock lock(&wait_lock_);
+      while (buffer_.empty() && !buffer_.is_closed_for_write() &&
+             !buffer_.is_closed_for_read()) {
+        readable_.Wait(&wait_lock_);
+      }
+    }
+    waiting_readers_.fetch_sub(1);
+  }
+}
+
+ssize_t TrustedPipe::Write(const void *buf, size_t count, bool nonblock) {
+  if (count == 0) {
+    return 0;
+  }
+  if (nonblock) {
+    if (!write_lock_.TryLock()) {
+      errno = EAGAIN;
+      return -1;
+    }
+  } else {
+    write_lock_.Lock();
+  }
+  ssize_t result =
+      WriteLocked(static_cast<const uint8_t *>(buf), count, nonblock);
+  write_lock_.Unlock();
+  return result;
+}
+
+ssize_t TrustedPipe::WriteLocked(const uint8_t *buf, size_t count,
+                                 bool nonblock) {
+  size_t written = 0;
+  while (written < count) {
+    if (buffer_.is_closed_for_read() || buffer_.is_closed_for_write()) {
+      if (written > 0) {
+        return written;
+      }
+      errno = EPIPE;
+      return -1;
+    }
+    // Writes of at most PIPE_BUF bytes are never split.
+    size_t needed = written == 0 && count <= PIPE_BUF ? count : 1;
+    if (buffer_.available() >= needed) {
+      written += buffer_.NonBlockingWrite(buf + written, count - written);
+      WakeReaders();
+      continue;
+    }
+    if (nonblock) {
+      if (written > 0) {
+        return written;
+      }
+      errno = EAGAIN;
+      return -1;
+    }
+    waiting_writers_.fetch_add(1);
+    {
+      absl::MutexLock lock(&wait_lock_);
+      while (buffer_.available() < needed && !buffer_.is_closed_for_read() &&
+             !buffer_.is_closed_for_write()) {
+        writable_.Wait(&wait_lock_);
+      }
+    }
+    waiting_writers_.fetch_sub(1);
+  }
+  return written;
+}
+
+void TrustedPipe::CloseReadEnd() {
+  buffer_.close_for_read();
+  {
+    absl::MutexLock lock(&wait_lock_);
+    readable_.SignalAll();
+    writable_.SignalAll();
+  }
+  reader_notifier_->Notify();
+  writer_notifier_->Notify();
+}
+
+void TrustedPipe::CloseWriteEnd() {
+  buffer_.close_for_write();
+  {
+    absl::MutexLock lock(&wait_lock_);
+    readable_.SignalAll();
+    writable_.SignalAll();
+  }
+  reader_notifier_->Notify();
+  writer_notifier_->Notify();
+}
+
+uint32_t TrustedPipe::ReadReadiness() const {
+  uint32_t events = 0;
+  if (!buffer_.empty() || buffer_.is_closed_for_read()) {
+    events |= EPOLLIN;
+  }
+  if (buffer_.is_closed_for_write()) {
+    events |= EPOLLHUP;
+  }
+  return events;
+}
+
+uint32_t TrustedPipe::WriteReadiness() const {
+  if (buffer_.is_closed_for_read()) {
+    return EPOLLERR;
+  }
+  return buffer_.available() >= PIPE_BUF ? EPOLLOUT : 0;
+}
+
+void TrustedPipe::WakeReaders() {
+  if (waiting_readers_.load() > 0) {
+    absl::MutexLock lock(&wait_lock_);
+    readable_.SignalAll();
+  }
+  reader_notifier_->Notify();
+}
+
+void TrustedPipe::WakeWriters() {
+  if (waiting_writers_.load() > 0) {
+    absl::MutexLock lock(&wait_lock_);
+    writable_.SignalAll();
+  }
+  writer_notifier_->Notify();
+}
+
+IOContextTrustedPipe::IOContextTrustedPipe(
+    std::shared_ptr<TrustedPipe> in, std::shared_ptr<TrustedPipe> out,
+    std::shared_ptr<ReadinessNotifier> notifier, bool nonblock, bool cloexec,
+    bool is_socket)
+    : in_(std::move(in)),
+      out_(std::move(out)),
+      notifier_(std::move(notifier)),
+      nonblock_(nonblock),
+      fd_flags_(cloexec ? FD_CLOEXEC : 0),
+      is_socket_(is_socket) {}
+
+void IOContextTrustedPipe::CreatePipe(
+    bool nonblock, bool cloexec,
+    std::unique_ptr<IOContextTrustedPipe> *read_end,
+    std::unique_ptr<IOContextTrustedPipe> *write_end) {
+  auto read_notifier = std::make_shared<ReadinessNotifier>();
+  auto write_notifier = std::make_shared<ReadinessNotifier>();
+  auto pipe = std::make_shared<TrustedPipe>(read_notifier, write_notifier);
+  read_end->reset(new IOContextTrustedPipe(pipe, nullptr, read_notifier,
+                                           nonblock, cloexec,
+                                           /*is_socket=*/false));
+  write_end->reset(new IOContextTrustedPipe(nullptr, pipe, write_notifier,
+                                            nonblock, cloexec,
+                                            /*is_socket=*/false));
+}
+
+void IOContextTrustedPipe::CreateSocketPair(
+    bool nonblock, bool cloexec, std::unique_ptr<IOContextTrustedPipe> *first,
+    std::unique_ptr<IOContextTrustedPipe> *second) {
+  auto first_notifier = std::make_shared<ReadinessNotifier>();
+  auto second_notifier = std::make_shared<ReadinessNotifier>();
+  // Each end reads from one pipe and writes to the other, so it is notified
+  // both as the reader of one and as the writer of the other.
+  auto to_first =
+      std::make_shared<TrustedPipe>(first_notifier, second_notifier);
+  auto to_second =
+      std::make_shared<TrustedPipe>(second_notifier, first_notifier);
+  first->reset(new IOContextTrustedPipe(to_first, to_second, first_notifier,
+                                        nonblock, cloexec,
+                                        /*is_socket=*/true));
+  second->reset(new IOContextTrustedPipe(to_second, to_first, second_notifier,
+                                         nonblock, cloexec,
+                                         /*is_socket=*/true));
+}
+
+ssize_t IOContextTrustedPipe::Read(void *buf, size_t count) {
+  if (!in_) {
+    errno = EBADF;
+    return -1;
+  }
+  return in_->Read(buf, count, nonblock_);
+}
+
+ssize_t IOContextTrustedPipe::Write(const void *buf, size_t count) {
+  if (!out_) {
+    errno = EBADF;
+    return -1;
+  }
+  return out_->Write(buf, count, nonblock_);
+}
+
+int IOContextTrustedPipe::Close() {
+  if (in_) {
+    in_->CloseReadEnd();
+  }
+  if (out_) {
+    out_->CloseWriteEnd();
+  }
+  return 0;
+}
+
+int IOContextTrustedPipe::FCntl(int cmd, int64_t arg) {
+  switch (cmd) {
+    case F_GETFL: {
+      int flags = in_ && out_ ? O_RDWR : in_ ? O_RDONLY : O_WRONLY;
+      return nonblock_ ? flags | O_NONBLOCK : flags;
+    }
+    case F_SETFL:
+      nonblock_ = (arg & O_NONBLOCK) != 0;
+      return 0;
+    case F_GETFD:
+      return fd_flags_;
+    case F_SETFD:
+      fd_flags_ = arg & FD_CLOEXEC;
+      return 0;
+    case F_GETPIPE_SZ:
+      if (!is_socket_) {
+        return TrustedPipe::kCapacity;
+      }
+      break;
+    case F_SETPIPE_SZ:
+      if (!is_socket_) {
+        // The capacity of a trusted pipe is fixed.
+        if (arg > static_cast<int64_t>(TrustedPipe::kCapacity)) {
+          errno = EPERM;
+          return -1;
+        }
+        return TrustedPipe::kCapacity;
+      }
+      break;
+    default:
+      break;
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+int IOContextTrustedPipe::Shutdown(int how) {
+  if (!is_socket_) {
+    errno = ENOTSOCK;
+    return -1;
+  }
+  if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (how != SHUT_WR) {
+    in_->CloseReadEnd();
+  }
+  if (how != SHUT_RD) {
+    out_->CloseWriteEnd();
+  }
+  return 0;
+}
+
+ssize_t IOContextTrustedPipe::Send(const void *buf, size_t len, int flags) {
+  if (!is_socket_) {
+    errno = ENOTSOCK;
+    return -1;
+  }
+  return out_->Write(buf, len, nonblock_ || (flags & MSG_DONTWAIT));
+}
+
+ssize_t IOContextTrustedPipe::RecvFrom(void *buf, size_t len, int flags,
+                                       struct sockaddr *src_addr,
+                                       socklen_t *addrlen) {
+  if (!is_socket_) {
+    errno = ENOTSOCK;
+    return -1;
+  }
+  // The peer of a socket pair is unnamed.
+  if (addrlen) {
+    *addrlen = 0;
+  }
+  return in_->Read(buf, len, nonblock_ || (flags & MSG_DONTWAIT));
+}
+
+uint32_t IOContextTrustedPipe::GetReadiness() {
+  if (!is_socket_) {
+    return in_ ? in_->ReadReadiness() : out_->WriteReadiness();
+  }
+  uint32_t read_events = in_->ReadReadiness();
+  uint32_t write_events = out_->WriteReadiness();
+  uint32_t events = (read_events & EPOLLIN) | (write_events & EPOLLOUT);
+  // A socket whose peer stopped writing is readable, and only hangs up once
+  // neither direction is open.
+  if (read_events & EPOLLHUP) {
+    events |= EPOLLIN | EPOLLRDHUP;
+    if (write_events & EPOLLERR) {
+      events |= EPOLLHUP;
+    }
+  }
+  return events;
+}
+
+}  // namespace io
+}  // namespace asylo
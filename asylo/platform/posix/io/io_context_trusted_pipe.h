@@ -0,0 +1,163 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_POSIX_IO_IO_CONTEXT_TRUSTED_PIPE_H_
+#define ASYLO_PLATFORM_POSIX_IO_IO_CONTEXT_TRUSTED_PIPE_H_
+
+#include <atomic>
+#include <memory>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "asylo/platform/common/ring_buffer.h"
+#include "asylo/platform/posix/io/io_manager.h"
+#include "asylo/platform/posix/io/readiness_notifier.h"
+
+namespace asylo {
+namespace io {
+
+// A unidirectional stream of bytes held in trusted memory.
+//
+// Bytes are passed through a lock-free single-producer single-consumer ring
+// buffer. Concurrent readers, and concurrent writers, are serialized among
+// themselves so that the ring buffer only ever has one of each. A reader which
+// finds the buffer empty, or a writer which finds it full, parks until the
+// other side makes progress; the other side only takes a lock to wake it when
+// it has registered as waiting.
+class TrustedPipe {
+ public:
+  // The capacity of the pipe, which matches the default on Linux.
+  static constexpr size_t kCapacity = 1 << 16;
+
+  // Constructs a pipe whose reading and writing ends report changes in their
+  // readiness through |reader_notifier| and |writer_notifier|.
+  TrustedPipe(std::shared_ptr<ReadinessNotifier> reader_notifier,
+              std::shared_ptr<ReadinessNotifier> writer_notifier)
+      : reader_notifier_(std::move(reader_notifier)),
+        writer_notifier_(std::move(writer_notifier)) {}
+
+  TrustedPipe(const TrustedPipe &other) = delete;
+  TrustedPipe &operator=(const TrustedPipe &other) = delete;
+
+  // Implements read(2) on the reading end of the pipe.
+  ssize_t Read(void *buf, size_t count, bool nonblock)
+      ABSL_LOCKS_EXCLUDED(read_lock_, wait_lock_);
+
+  // Implements write(2) on the writing end of the pipe. Writes of at most
+  // PIPE_BUF bytes are atomic.
+  ssize_t Write(const void *buf, size_t count, bool nonblock)
+      ABSL_LOCKS_EXCLUDED(write_lock_, wait_lock_);
+
+  // Closes the reading end of the pipe. Reads then return end of file and
+  // writes fail with EPIPE. Closing an end more than once has no effect.
+  void CloseReadEnd() ABSL_LOCKS_EXCLUDED(wait_lock_);
+
+  // Closes the writing end of the pipe. Reads then return end of file once the
+  // pipe is drained.
+  void CloseWriteEnd() ABSL_LOCKS_EXCLUDED(wait_lock_);
+
+  // Returns the epoll events for which the reading end is ready.
+  uint32_t ReadReadiness() const;
+
+  // Returns the epoll events for which the writing end is ready.
+  uint32_t WriteReadiness() const;
+
+ private:
+  ssize_t ReadLocked(uint8_t *buf, size_t count, bool nonblock)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(read_lock_) ABSL_LOCKS_EXCLUDED(wait_lock_);
+  ssize_t WriteLocked(const uint8_t *buf, size_t count, bool nonblock)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(write_lock_)
+          ABSL_LOCKS_EXCLUDED(wait_lock_);
+
+  // Wakes readers after the pipe became readable.
+  void WakeReaders() ABSL_LOCKS_EXCLUDED(wait_lock_);
+
+  // Wakes writers after the pipe became writable.
+  void WakeWriters() ABSL_LOCKS_EXCLUDED(wait_lock_);
+
+  RingBuffer<kCapacity> buffer_;
+
+  // Keep the ring buffer single-producer single-consumer. A blocking reader or
+  // writer holds its lock while it waits, which keeps blocking writes
+  // contiguous; non-blocking calls fail with EAGAIN rather than wait for it.
+  absl::Mutex read_lock_ ABSL_ACQUIRED_BEFORE(wait_lock_);
+  absl::Mutex write_lock_ ABSL_ACQUIRED_BEFORE(wait_lock_);
+
+  // Parked readers and writers wait on |wait_lock_|. The counts of waiting
+  // threads let the other side skip the lock when nobody is waiting.
+  absl::Mutex wait_lock_;
+  absl::CondVar readable_;
+  absl::CondVar writable_;
+  std::atomic<int> waiting_readers_{0};
+  std::atomic<int> waiting_writers_{0};
+
+  const std::shared_ptr<ReadinessNotifier> reader_notifier_;
+  const std::shared_ptr<ReadinessNotifier> writer_notifier_;
+};
+
+// IOContext implementation of one end of a pipe or a socket pair whose data
+// never leaves the enclave.
+class IOContextTrustedPipe : public IOManager::IOContext {
+ public:
+  // Creates the reading and writing ends of a pipe. |cloexec| sets the
+  // FD_CLOEXEC file descriptor flag of both ends.
+  static void CreatePipe(bool nonblock, bool cloexec,
+                         std::unique_ptr<IOContextTrustedPipe> *read_end,
+                         std::unique_ptr<IOContextTrustedPipe> *write_end);
+
+  // Creates the two ends of a connected stream socket pair. |cloexec| sets the
+  // FD_CLOEXEC file descriptor flag of both ends.
+  static void CreateSocketPair(bool nonblock, bool cloexec,
+                               std::unique_ptr<IOContextTrustedPipe> *first,
+                               std::unique_ptr<IOContextTrustedPipe> *second);
+
+  ssize_t Read(void *buf, size_t count) override;
+  ssize_t Write(const void *buf, size_t count) override;
+  int Close() override;
+  int FCntl(int cmd, int64_t arg) override;
+  int Shutdown(int how) override;
+  ssize_t Send(const void *buf, size_t len, int flags) override;
+  ssize_t RecvFrom(void *buf, size_t len, int flags, struct sockaddr *src_addr,
+                   socklen_t *addrlen) override;
+  ReadinessNotifier *GetReadinessNotifier() override {
+    return notifier_.get();
+  }
+  uint32_t GetReadiness() override;
+
+ private:
+  // Constructs an end which reads from |in| and writes to |out|, either of
+  // which may be null.
+  IOContextTrustedPipe(std::shared_ptr<TrustedPipe> in,
+                       std::shared_ptr<TrustedPipe> out,
+                       std::shared_ptr<ReadinessNotifier> notifier,
+                       bool nonblock, bool cloexec, bool is_socket);
+
+  const std::shared_ptr<TrustedPipe> in_;
+  const std::shared_ptr<TrustedPipe> out_;
+  const std::shared_ptr<ReadinessNotifier> notifier_;
+  std::atomic<bool> nonblock_;
+  // File descriptor flags, as set by F_SETFD. An enclave never executes
+  // another program, so FD_CLOEXEC is only recorded.
+  std::atomic<int> fd_flags_;
+  const bool is_socket_;
+};
+
+}  // namespace io
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_POSIX_IO_IO_CONTEXT_TRUSTED_PIPE_H_
@@ -21,18 +21,23 @@
 #include <fcntl.h>
 #include <poll.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdint>
 #include <memory>
 #include <unordered_set>
+#include <utility>
 
 #include "absl/algorithm/container.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "asylo/platform/host_call/trusted/host_calls.h"
 #include "asylo/platform/posix/io/io_context_epoll.h"
 #include "asylo/platform/posix/io/io_context_eventfd.h"
 #include "asylo/platform/posix/io/io_context_inotify.h"
+#include "asylo/platform/posix/io/io_context_trusted_pipe.h"
 #include "asylo/platform/posix/io/native_paths.h"
 #include "asylo/platform/posix/io/util.h"
 #include "asylo/util/posix_errors.h"
@@ -42,26 +47,46 @@ namespace asylo {
 namespace io {
 
 IOManager::FileDescriptorTable::FileDescriptorTable()
-    : maximum_fd_soft_limit(kMaxOpenFiles),
-      maximum_fd_hard_limit(kMaxOpenFiles) {}
+    : maximum_fd_soft_limit(kDefaultOpenFilesLimit),
+      maximum_fd_hard_limit(kMaxOpenFiles) {
+  chunks_[0].store(new Chunk(), std::memory_order_release);
+}
+
+IOManager::FileDescriptorTable::~FileDescriptorTable() {
+  for (std::atomic<Chunk *> &chunk : chunks_) {
+    Chunk *slots = chunk.load();
+    if (!slots) continue;
+    for (std::atomic<OpenFileDescription *> &slot : *slots) {
+      OpenFileDescription *description = slot.exchange(nullptr);
+      if (description) {
+        Release(description);
+      }
+    }
+    delete slots;
+  }
+}
 
 std::shared_ptr<IOManager::IOContext> IOManager::FileDescriptorTable::Get(
     int fd) {
-  if (!IsFileDescriptorValid(fd) || !fd_table_[fd]) return nullptr;
-  return fd_table_[fd]->Get();
+  HazardPointerDomain::Guard guard(&hazard_pointers_);
+  std::atomic<OpenFileDescription *> *slot = Slot(fd);
+  OpenFileDescription *description = slot ? guard.Protect(*slot) : nullptr;
+  return description ? description->shared_context() : nullptr;
 }
 
 int IOManager::FileDescriptorTable::Delete(int fd) {
-  if (!IsFileDescriptorValid(fd)) return 0;
-  int close_result = 0;
-  fd_table_[fd]->WriteCloseResultTo(&close_result);
-  fd_table_[fd] = nullptr;
-  return close_result;
+  std::atomic<OpenFileDescription *> *slot = Slot(fd);
+  OpenFileDescription *description =
+      slot ? slot->exchange(nullptr, std::memory_order_acq_rel) : nullptr;
+  if (!description) return 0;
+  lowest_free_fd_ = std::min(lowest_free_fd_, fd);
+  return Release(description);
 }
 
 bool IOManager::FileDescriptorTable::IsFileDescriptorUnused(int fd) {
   if (!IsFileDescriptorValid(fd)) return false;
-  return !fd_table_[fd];
+  std::atomic<OpenFileDescription *> *slot = Slot(fd);
+  return !slot || !slot->load(std::memory_order_relaxed);
 }
 
 int IOManager::FileDescriptorTable::Insert(IOContext *context) {
@@ -69,26 +94,49 @@ int IOManager::FileDescriptorTable::Insert(IOContext *context) {
   if (fd < 0) {
     return -1;
   }
-  fd_table_[fd] = std::make_shared<AutoCloseIOContext>(context);
+  Assign(fd, new OpenFileDescription(context));
   return fd;
 }
 
 int IOManager::FileDescriptorTable::CopyFileDescriptor(int oldfd, int startfd) {
   int newfd = GetNextFreeFileDescriptor(startfd);
-  if (!IsFileDescriptorValid(oldfd) || newfd == -1) {
+  std::atomic<OpenFileDescription *> *oldslot = Slot(oldfd);
+  if (!oldslot || !oldslot->load(std::memory_order_relaxed) || newfd == -1) {
     return -1;
   }
-  fd_table_[newfd] = fd_table_[oldfd];
+  OpenFileDescription *description = oldslot->load(std::memory_order_relaxed);
+  description->AddReference();
+  Assign(newfd, description);
   return newfd;
 }
 
 int IOManager::FileDescriptorTable::CopyFileDescriptorToSpecifiedTarget(
     int oldfd, int newfd) {
-  if (!IsFileDescriptorValid(oldfd) || !IsFileDescriptorValid(newfd) ||
-      fd_table_[newfd]) {
+  std::atomic<OpenFileDescription *> *oldslot = Slot(oldfd);
+  if (!oldslot || !oldslot->load(std::memory_order_relaxed) ||
+      !IsFileDescriptorUnused(newfd)) {
     return -1;
   }
-  fd_table_[newfd] = fd_table_[oldfd];
+  OpenFileDescription *description = oldslot->load(std::memory_order_relaxed);
+  description->AddReference();
+  Assign(newfd, description);
+  return newfd;
+}
+
+int IOManager::FileDescriptorTable::ReplaceFileDescriptor(int oldfd,
+                                                          int newfd) {
+  std::atomic<OpenFileDescription *> *oldslot = Slot(oldfd);
+  std::atomic<OpenFileDescription *> *newslot = Slot(newfd);
+  if (!oldslot || !oldslot->load(std::memory_order_relaxed) || !newslot) {
+    return -1;
+  }
+  OpenFileDescription *description = oldslot->load(std::memory_order_relaxed);
+  description->AddReference();
+  OpenFileDescription *replaced =
+      newslot->exchange(description, std::memory_order_acq_rel);
+  if (replaced) {
+    Release(replaced);
+  }
   return newfd;
 }
 
@@ -118,13 +166,45 @@ int IOManager::FileDescriptorTable::get_maximum_fd_hard_limit() {
   return maximum_fd_hard_limit;
 }
 
+std::atomic<IOManager::FileDescriptorTable::OpenFileDescription *>
+    *IOManager::FileDescriptorTable::AllocateSlot(int fd) {
+  std::atomic<Chunk *> &chunk = chunks_[fd / kChunkSize];
+  if (!chunk.load(std::memory_order_relaxed)) {
+    chunk.store(new Chunk(), std::memory_order_release);
+  }
+  return Slot(fd);
+}
+
+void IOManager::FileDescriptorTable::Assign(
+    int fd, OpenFileDescription *description) {
+  AllocateSlot(fd)->store(description, std::memory_order_release);
+  if (fd == lowest_free_fd_) {
+    ++lowest_free_fd_;
+  }
+}
+
+int IOManager::FileDescriptorTable::Release(
+    OpenFileDescription *description) {
+  if (!description->RemoveReference()) {
+    return 0;
+  }
+  int close_result = description->context()->Close() == -1 ? -1 : 0;
+  hazard_pointers_.Retire(description);
+  return close_result;
+}
+
 bool IOManager::FileDescriptorTable::IsFileDescriptorValid(int fd) {
   return fd >= 0 && fd < kMaxOpenFiles;
 }
 
 int IOManager::FileDescriptorTable::GetHighestFileDescriptorUsed() {
   for (int i = kMaxOpenFiles - 1; i >= 0; --i) {
-    if (fd_table_[i]) {
+    if (!chunks_[i / kChunkSize].load(std::memory_order_relaxed)) {
+      // Skip the rest of the unallocated chunk.
+      i -= i % kChunkSize;
+      continue;
+    }
+    if (!IsFileDescriptorUnused(i)) {
       return i;
     }
   }
@@ -135,14 +215,13 @@ int IOManager::FileDescriptorTable::GetNextFreeFileDescriptor(int startfd) {
   if (startfd < 0) {
     return -1;
   }
-  int fd = -1;
-  for (int i = startfd; i < maximum_fd_soft_limit; ++i) {
-    if (!fd_table_[i]) {
-      fd = i;
-      break;
+  for (int i = std::max(startfd, lowest_free_fd_); i < maximum_fd_soft_limit;
+       ++i) {
+    if (IsFileDescriptorUnused(i)) {
+      return i;
     }
   }
-  return fd;
+  return -1;
 }
 
 int IOManager::Access(const char *path, int mode) {
@@ -153,14 +232,19 @@ int IOManager::Access(const char *path, int mode) {
 }
 
 int IOManager::CloseFileDescriptor(int fd) {
-  std::shared_ptr<IOContext> context = fd_table_.Get(fd);
-  if (context) {
+  if (!fd_table_.IsFileDescriptorUnused(fd)) {
     return fd_table_.Delete(fd);
   }
   errno = EBADF;
   return -1;
 }
 
+int IOManager::GetHostFileDescriptor(int fd) {
+  return fd_table_.WithContext(fd, [](IOContext *context) {
+    return context ? context->GetHostFileDescriptor() : -1;
+  });
+}
+
 int IOManager::Close(int fd) {
   absl::WriterMutexLock lock(&fd_table_lock_);
   return CloseFileDescriptor(fd);
@@ -254,9 +338,10 @@ int IOManager::Dup2(int oldfd, int newfd) {
     if (oldfd == newfd) {
       return newfd;
     }
-    if (!fd_table_.IsFileDescriptorUnused(newfd) &&
-        CloseFileDescriptor(newfd) == -1) {
-      return -1;
+    if (!fd_table_.IsFileDescriptorUnused(newfd)) {
+      // Replace |newfd| in one step, so that concurrent calls on it never find
+      // it closed. As on Linux, errors closing the replaced file are ignored.
+      return fd_table_.ReplaceFileDescriptor(oldfd, newfd);
     }
     int ret = fd_table_.CopyFileDescriptorToSpecifiedTarget(oldfd, newfd);
     if (ret < 0) {
@@ -268,7 +353,36 @@ int IOManager::Dup2(int oldfd, int newfd) {
   return -1;
 }
 
+int IOManager::InsertPair(std::unique_ptr<IOContext> first,
+                          std::unique_ptr<IOContext> second, int fds[2]) {
+  absl::WriterMutexLock lock(&fd_table_lock_);
+  fds[0] = fd_table_.Insert(first.get());
+  if (fds[0] < 0) {
+    errno = EMFILE;
+    return -1;
+  }
+  first.release();
+  fds[1] = fd_table_.Insert(second.get());
+  if (fds[1] < 0) {
+    fd_table_.Delete(fds[0]);
+    errno = EMFILE;
+    return -1;
+  }
+  second.release();
+  return 0;
+}
+
 int IOManager::Pipe(int pipefd[2], int flags) {
+  if (trusted_pipes_) {
+    if (flags & ~(O_CLOEXEC | O_NONBLOCK)) {
+      errno = EINVAL;
+      return -1;
+    }
+    std::unique_ptr<IOContextTrustedPipe> read_end, write_end;
+    IOContextTrustedPipe::CreatePipe(flags & O_NONBLOCK, flags & O_CLOEXEC,
+                                     &read_end, &write_end);
+    return InsertPair(std::move(read_end), std::move(write_end), pipefd);
+  }
   int res = enc_untrusted_pipe2(pipefd, flags);
   if (res != -1) {
     pipefd[0] = RegisterHostFileDescriptor(pipefd[0]);
@@ -297,25 +411,22 @@ int IOManager::Select(int nfds, fd_set *readfds, fd_set *writefds,
   int host_nfds = 0;
   for (int fd = 0; fd < nfds; ++fd) {
     if (readfds && FD_ISSET(fd, readfds)) {
-      std::shared_ptr<IOContext> context = fd_table_.Get(fd);
-      if (context) {
-        int host_fd = context->GetHostFileDescriptor();
+      int host_fd = GetHostFileDescriptor(fd);
+      if (host_fd >= 0) {
         FD_SET(host_fd, &host_readfds);
         host_nfds = std::max(host_nfds, host_fd + 1);
       }
     }
     if (writefds && FD_ISSET(fd, writefds)) {
-      std::shared_ptr<IOContext> context = fd_table_.Get(fd);
-      if (context) {
-        int host_fd = context->GetHostFileDescriptor();
+      int host_fd = GetHostFileDescriptor(fd);
+      if (host_fd >= 0) {
         FD_SET(host_fd, &host_writefds);
         host_nfds = std::max(host_nfds, host_fd + 1);
       }
     }
     if (exceptfds && FD_ISSET(fd, exceptfds)) {
-      std::shared_ptr<IOContext> context = fd_table_.Get(fd);
-      if (context) {
-        int host_fd = context->GetHostFileDescriptor();
+      int host_fd = GetHostFileDescriptor(fd);
+      if (host_fd >= 0) {
         FD_SET(host_fd, &host_exceptfds);
         host_nfds = std::max(host_nfds, host_fd + 1);
       }
@@ -335,10 +446,8 @@ int IOManager::Select(int nfds, fd_set *readfds, fd_set *writefds,
   std::unordered_set<int> host_readfds_set, host_writefds_set,
       host_exceptfds_set;
   for (int fd = 0; fd < nfds; ++fd) {
-    std::shared_ptr<IOContext> context = fd_table_.Get(fd);
-    if (context) {
-      int host_fd = context->GetHostFileDescriptor();
-      if (host_fd < 0) continue;
+    int host_fd = GetHostFileDescriptor(fd);
+    if (host_fd >= 0) {
       if (FD_ISSET(host_fd, &host_readfds)) {
         host_readfds_set.insert(host_fd);
       }
@@ -364,9 +473,8 @@ int IOManager::Select(int nfds, fd_set *readfds, fd_set *writefds,
   // included in any of the sets, add the corresponding enclave fd to the
   // enclave fd_set.
   for (int fd = 0; fd < nfds; ++fd) {
-    std::shared_ptr<IOContext> context = fd_table_.Get(fd);
-    if (context) {
-      int host_fd = context->GetHostFileDescriptor();
+    int host_fd = GetHostFileDescriptor(fd);
+    if (host_fd >= 0) {
       if (readfds && host_readfds_set.find(host_fd) != host_readfds_set.end()) {
         FD_SET(fd, readfds);
       }
@@ -383,19 +491,105 @@ int IOManager::Select(int nfds, fd_set *readfds, fd_set *writefds,
   return ret;
 }
 
-int IOManager::Poll(struct pollfd *fds, nfds_t nfds, int timeout) {
-  std::vector<int> enclave_fd(nfds);
-  {
-    absl::ReaderMutexLock lock(&fd_table_lock_);
-    for (int i = 0; i < nfds; ++i) {
-      enclave_fd[i] = fds[i].fd;
-      std::shared_ptr<IOContext> context = fd_table_.Get(enclave_fd[i]);
-      if (context) {
-        fds[i].fd = context->GetHostFileDescriptor();
-      } else {
-        fds[i].fd = -1;
+namespace {
+
+// Converts the epoll events reported by a stream implemented inside the
+// enclave to poll events.
+short EpollToPollEvents(uint32_t events) {
+  short poll_events = 0;
+  if (events & EPOLLIN) poll_events |= POLLIN;
+  if (events & EPOLLPRI) poll_events |= POLLPRI;
+  if (events & EPOLLOUT) poll_events |= POLLOUT;
+  if (events & EPOLLERR) poll_events |= POLLERR;
+  if (events & EPOLLHUP) poll_events |= POLLHUP;
+  if (events & EPOLLRDHUP) poll_events |= POLLRDHUP;
+  return poll_events;
+}
+
+// Wakes a thread in poll() when a stream it polls may have become ready. A
+// thread blocked on the host is woken by writing to |wakeup_fd|, the write end
+// of a host pipe it polls.
+class PollObserver : public ReadinessObserver {
+ public:
+  explicit PollObserver(int wakeup_fd) : wakeup_fd_(wakeup_fd) {}
+
+  void OnReadinessChanged() override {
+    bool wake = false;
+    {
+      absl::MutexLock lock(&mutex_);
+      changed_ = true;
+      if (host_waiting_ && !wakeup_pending_) {
+        wakeup_pending_ = true;
+        wake = true;
       }
     }
+    if (wake) {
+      char wakeup = 0;
+      enc_untrusted_write(wakeup_fd_, &wakeup, sizeof(wakeup));
+    }
+  }
+
+  // Forgets the changes observed so far.
+  void Reset() {
+    absl::MutexLock lock(&mutex_);
+    changed_ = false;
+  }
+
+  // Waits until a change is observed or |deadline| passes, and resets the
+  // observed change.
+  void Wait(absl::Time deadline) {
+    absl::MutexLock lock(&mutex_);
+    mutex_.AwaitWithDeadline(absl::Condition(&changed_), deadline);
+    changed_ = false;
+  }
+
+  // Marks the start of a wait on the host. Returns false if a change was
+  // observed since the last reset, in which case the host must not block.
+  bool BeginHostWait() {
+    absl::MutexLock lock(&mutex_);
+    host_waiting_ = true;
+    return !changed_;
+  }
+
+  // Marks the end of a wait on the host, after which the wakeup pipe was
+  // drained if |woken| is true.
+  void EndHostWait(bool woken) {
+    absl::MutexLock lock(&mutex_);
+    host_waiting_ = false;
+    if (woken) {
+      wakeup_pending_ = false;
+    }
+  }
+
+  // Returns whether a wakeup has been written and not drained.
+  bool wakeup_pending() {
+    absl::MutexLock lock(&mutex_);
+    return wakeup_pending_;
+  }
+
+ private:
+  const int wakeup_fd_;
+  absl::Mutex mutex_;
+  bool changed_ ABSL_GUARDED_BY(mutex_) = false;
+  bool host_waiting_ ABSL_GUARDED_BY(mutex_) = false;
+  bool wakeup_pending_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+// Consumes the wakeup written to the host pipe read through |read_fd|.
+void DrainWakeup(int read_fd) {
+  char wakeup;
+  enc_untrusted_read(read_fd, &wakeup, sizeof(wakeup));
+}
+
+}  // namespace
+
+int IOManager::PollHost(struct pollfd *fds, nfds_t nfds,
+                        const std::vector<bool> &skip, int timeout) {
+  std::vector<int> enclave_fd(nfds);
+  for (int i = 0; i < nfds; ++i) {
+    enclave_fd[i] = fds[i].fd;
+    // The host ignores entries with a negative file descriptor.
+    fds[i].fd = skip[i] ? -1 : GetHostFileDescriptor(enclave_fd[i]);
   }
   int ret = enc_untrusted_poll(fds, nfds, timeout);
   for (int i = 0; i < nfds; ++i) {
@@ -404,6 +598,156 @@ int IOManager::Poll(struct pollfd *fds, nfds_t nfds, int timeout) {
   return ret;
 }
 
+int IOManager::AcquireWakeupPipe(WakeupPipe *pipe) {
+  {
+    absl::MutexLock lock(&wakeup_pipes_lock_);
+    if (!wakeup_pipes_.empty()) {
+      *pipe = wakeup_pipes_.back();
+      wakeup_pipes_.pop_back();
+      return 0;
+    }
+  }
+  int pipefd[2];
+  if (enc_untrusted_pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) != 0) {
+    return -1;
+  }
+  pipe->read_fd = pipefd[0];
+  pipe->write_fd = pipefd[1];
+  return 0;
+}
+
+void IOManager::ReleaseWakeupPipe(const WakeupPipe &pipe) {
+  absl::MutexLock lock(&wakeup_pipes_lock_);
+  wakeup_pipes_.push_back(pipe);
+}
+
+int IOManager::Poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+  // Streams implemented inside the enclave are polled without host calls.
+  std::vector<std::shared_ptr<IOContext>> trusted(nfds);
+  std::vector<bool> skip(nfds);
+  bool poll_trusted = false;
+  bool poll_host = false;
+  for (int i = 0; i < nfds; ++i) {
+    if (fds[i].fd < 0) {
+      continue;
+    }
+    std::shared_ptr<IOContext> context = fd_table_.Get(fds[i].fd);
+    if (context && context->GetReadinessNotifier()) {
+      trusted[i] = std::move(context);
+      skip[i] = true;
+      poll_trusted = true;
+    } else {
+      poll_host = true;
+    }
+  }
+  if (!poll_trusted) {
+    return PollHost(fds, nfds, skip, timeout);
+  }
+
+  // Streams backed by the host are polled along with a wakeup pipe, which is
+  // written when a stream inside the enclave may have become ready.
+  WakeupPipe wakeup = {-1, -1};
+  std::vector<struct pollfd> host_fds;
+  if (poll_host) {
+    if (AcquireWakeupPipe(&wakeup) != 0) {
+      return -1;
+    }
+    host_fds.resize(nfds + 1);
+    for (int i = 0; i < nfds; ++i) {
+      host_fds[i] = fds[i];
+      host_fds[i].fd = skip[i] ? -1 : GetHostFileDescriptor(fds[i].fd);
+    }
+    host_fds[nfds] = {wakeup.read_fd, POLLIN, 0};
+  }
+
+  PollObserver observer(wakeup.write_fd);
+  for (const auto &context : trusted) {
+    if (context) {
+      context->GetReadinessNotifier()->AddObserver(&observer);
+    }
+  }
+  const absl::Time deadline = timeout < 0
+                                  ? absl::InfiniteFuture()
+                                  : absl::Now() + absl::Milliseconds(timeout);
+  // Avoids reading the clock, which may exit the enclave, without a timeout.
+  auto expired = [deadline]() {
+    return deadline != absl::InfiniteFuture() && absl::Now() >= deadline;
+  };
+  std::vector<short> trusted_revents(nfds);
+  int ret;
+  while (true) {
+    observer.Reset();
+    ret = 0;
+    for (int i = 0; i < nfds; ++i) {
+      fds[i].revents = 0;
+      if (trusted[i]) {
+        trusted_revents[i] = EpollToPollEvents(trusted[i]->GetReadiness()) &
+                             (fds[i].events | POLLERR | POLLHUP);
+        ret += trusted_revents[i] != 0;
+      }
+    }
+    bool timed_out = expired();
+    if (poll_host) {
+      // Block on the host only if no stream is ready yet, including streams
+      // inside the enclave which changed since they were checked above.
+      int host_timeout = 0;
+      if (observer.BeginHostWait() && ret == 0 && !timed_out) {
+        host_timeout = deadline == absl::InfiniteFuture()
+                           ? -1
+                           : absl::ToInt64Milliseconds(absl::Ceil(
+                                 std::max(deadline - absl::Now(),
+                                          absl::ZeroDuration()),
+                                 absl::Milliseconds(1)));
+      }
+      int host_ret =
+          enc_untrusted_poll(host_fds.data(), host_fds.size(), host_timeout);
+      bool woken = host_ret > 0 && host_fds[nfds].revents != 0;
+      if (woken) {
+        DrainWakeup(wakeup.read_fd);
+        --host_ret;
+      }
+      observer.EndHostWait(woken);
+      if (host_ret < 0) {
+        ret = -1;
+        break;
+      }
+      for (int i = 0; i < nfds; ++i) {
+        if (!trusted[i]) {
+          fds[i].revents = host_fds[i].revents;
+        }
+      }
+      ret += host_ret;
+      timed_out = expired();
+    }
+    if (ret > 0 || timed_out) {
+      for (int i = 0; i < nfds; ++i) {
+        if (trusted[i]) {
+          fds[i].revents = trusted_revents[i];
+        }
+      }
+      break;
+    }
+    if (!poll_host) {
+      observer.Wait(deadline);
+    }
+  }
+  for (const auto &context : trusted) {
+    if (context) {
+      context->GetReadinessNotifier()->RemoveObserver(&observer);
+    }
+  }
+  if (poll_host) {
+    // No wakeup is written once the observer is removed.
+    int error = errno;
+    if (observer.wakeup_pending()) {
+      DrainWakeup(wakeup.read_fd);
+    }
+    ReleaseWakeupPipe(wakeup);
+    errno = error;
+  }
+  return ret;
+}
+
 int IOManager::EpollCreate(int size) {
   if (size < 1) {
     errno = EINVAL;
@@ -425,26 +769,21 @@ int IOManager::EpollCreate(int size) {
 }
 
 int IOManager::EpollCtl(int epfd, int op, int fd, struct epoll_event *event) {
-  std::shared_ptr<IOContext> context;
-  {
-    absl::ReaderMutexLock lock(&fd_table_lock_);
-    context = fd_table_.Get(fd);
-  }
-  int hostfd = context ? context->GetHostFileDescriptor() : -1;
-  if (hostfd == -1) {
+  std::shared_ptr<IOContext> target = fd_table_.Get(fd);
+  if (!target) {
     errno = EBADF;
     return -1;
   }
   return CallWithContext(
-      epfd, [op, hostfd, event](std::shared_ptr<IOContext> epoll_context) {
-        return epoll_context->EpollCtl(op, hostfd, event);
+      epfd, [op, fd, &target, event](IOContext *epoll_context) {
+        return epoll_context->EpollCtl(op, fd, target, event);
       });
 }
 
 int IOManager::EpollWait(int epfd, struct epoll_event *events, int maxevents,
                          int timeout) {
   return CallWithContext(
-      epfd, [events, maxevents, timeout](std::shared_ptr<IOContext> context) {
+      epfd, [events, maxevents, timeout](IOContext *context) {
         return context->EpollWait(events, maxevents, timeout);
       });
 }
@@ -478,19 +817,21 @@ int IOManager::InotifyInit(bool non_block) {
 }
 
 int IOManager::InotifyAddWatch(int fd, const char *pathname, uint32_t mask) {
-  return CallWithContext(
-      fd, [this, pathname, mask](std::shared_ptr<IOContext> inotify_context) {
-        return CallWithHandler(
-            pathname, [inotify_context, mask](VirtualPathHandler *handler,
-                                              const char *canonical_path) {
-              return handler->InotifyAddWatch(inotify_context, canonical_path,
-                                              mask);
-            });
+  // Handlers are passed shared ownership of the inotify context.
+  std::shared_ptr<IOContext> inotify_context = fd_table_.Get(fd);
+  if (!inotify_context) {
+    errno = EBADF;
+    return -1;
+  }
+  return CallWithHandler(
+      pathname, [inotify_context, mask](VirtualPathHandler *handler,
+                                        const char *canonical_path) {
+        return handler->InotifyAddWatch(inotify_context, canonical_path, mask);
       });
 }
 
 int IOManager::InotifyRmWatch(int fd, int wd) {
-  return CallWithContext(fd, [wd](std::shared_ptr<IOContext> inotify_context) {
+  return CallWithContext(fd, [wd](IOContext *inotify_context) {
     return inotify_context->InotifyRmWatch(wd);
   });
 }
@@ -520,16 +861,14 @@ struct ErrorValue<Type,
 
 template <typename IOAction, typename ReturnType>
 ReturnType IOManager::CallWithContext(int fd, IOAction action) {
-  std::shared_ptr<IOContext> context;
-  {
-    absl::ReaderMutexLock lock(&fd_table_lock_);
-    context = fd_table_.Get(fd);
-  }
-  if (context) {
-    return action(context);
-  }
-  errno = EBADF;
-  return ErrorValue<ReturnType>::value;
+  return fd_table_.WithContext(
+      fd, [&action](IOContext *context) -> ReturnType {
+        if (context) {
+          return action(context);
+        }
+        errno = EBADF;
+        return ErrorValue<ReturnType>::value;
+      });
 }
 
 template <typename IOAction, typename ReturnType>
@@ -584,7 +923,7 @@ ReturnType IOManager::CallWithHandler(const char *path1, const char *path2,
 }
 
 int IOManager::Read(int fd, char *buf, size_t count) {
-  return CallWithContext(fd, [buf, count](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [buf, count](IOContext *context) {
     return context->Read(buf, count);
   });
 }
@@ -665,7 +1004,7 @@ StatusOr<std::string> IOManager::CanonicalizePath(
 }
 
 int IOManager::Write(int fd, const char *buf, size_t count) {
-  return CallWithContext(fd, [buf, count](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [buf, count](IOContext *context) {
     return context->Write(buf, count);
   });
 }
@@ -732,7 +1071,7 @@ int IOManager::Truncate(const char *path, off_t length) {
 }
 
 int IOManager::FTruncate(int fd, off_t length) {
-  return CallWithContext(fd, [length](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [length](IOContext *context) {
     return context->FTruncate(length);
   });
 }
@@ -815,20 +1154,20 @@ int IOManager::ChMod(const char *pathname, mode_t mode) {
 
 int IOManager::FChOwn(int fd, uid_t owner, gid_t group) {
   return CallWithContext(fd,
-                         [owner, group](std::shared_ptr<IOContext> context) {
+                         [owner, group](IOContext *context) {
                            return context->FChOwn(owner, group);
                          });
 }
 
 int IOManager::FChMod(int fd, mode_t mode) {
-  return CallWithContext(fd, [mode](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [mode](IOContext *context) {
     return context->FChMod(mode);
   });
 }
 
 int IOManager::LSeek(int fd, off_t offset, int whence) {
   return CallWithContext(fd,
-                         [offset, whence](std::shared_ptr<IOContext> context) {
+                         [offset, whence](IOContext *context) {
                            return context->LSeek(offset, whence);
                          });
 }
@@ -846,24 +1185,24 @@ int IOManager::FCntl(int fd, int cmd, int64_t arg) {
     errno = EBADF;
     return -1;
   }
-  return CallWithContext(fd, [cmd, arg](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [cmd, arg](IOContext *context) {
     return context->FCntl(cmd, arg);
   });
 }
 
 int IOManager::FSync(int fd) {
   return CallWithContext(
-      fd, [](std::shared_ptr<IOContext> context) { return context->FSync(); });
+      fd, [](IOContext *context) { return context->FSync(); });
 }
 
 int IOManager::FDataSync(int fd) {
-  return CallWithContext(fd, [](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [](IOContext *context) {
     return context->FDataSync();
   });
 }
 
 int IOManager::FStat(int fd, struct stat *stat_buffer) {
-  return CallWithContext(fd, [stat_buffer](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [stat_buffer](IOContext *context) {
     return context->FStat(stat_buffer);
   });
 }
@@ -871,7 +1210,7 @@ int IOManager::FStat(int fd, struct stat *stat_buffer) {
 ssize_t IOManager::FGetXattr(int fd, const char *name, void *value,
                              size_t size) {
   return CallWithContext(
-      fd, [name, value, size](std::shared_ptr<IOContext> context) {
+      fd, [name, value, size](IOContext *context) {
         return context->FGetXattr(name, value, size);
       });
 }
@@ -879,38 +1218,38 @@ ssize_t IOManager::FGetXattr(int fd, const char *name, void *value,
 int IOManager::FSetXattr(int fd, const char *name, const void *value,
                          size_t size, int flags) {
   return CallWithContext(
-      fd, [name, value, size, flags](std::shared_ptr<IOContext> context) {
+      fd, [name, value, size, flags](IOContext *context) {
         return context->FSetXattr(name, value, size, flags);
       });
 }
 
 ssize_t IOManager::FListXattr(int fd, char *list, size_t size) {
-  return CallWithContext(fd, [list, size](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [list, size](IOContext *context) {
     return context->FListXattr(list, size);
   });
 }
 
 int IOManager::FStatFs(int fd, struct statfs *statfs_buffer) {
   return CallWithContext(fd,
-                         [statfs_buffer](std::shared_ptr<IOContext> context) {
+                         [statfs_buffer](IOContext *context) {
                            return context->FStatFs(statfs_buffer);
                          });
 }
 
 int IOManager::Isatty(int fd) {
   return CallWithContext(
-      fd, [](std::shared_ptr<IOContext> context) { return context->Isatty(); });
+      fd, [](IOContext *context) { return context->Isatty(); });
 }
 
 int IOManager::FLock(int fd, int operation) {
-  return CallWithContext(fd, [operation](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [operation](IOContext *context) {
     return context->FLock(operation);
   });
 }
 
 int IOManager::Ioctl(int fd, int request, void *argp) {
   return CallWithContext(fd,
-                         [request, argp](std::shared_ptr<IOContext> context) {
+                         [request, argp](IOContext *context) {
                            return context->Ioctl(request, argp);
                          });
 }
@@ -953,24 +1292,38 @@ int IOManager::Utimes(const char *filename, const struct timeval times[2]) {
 }
 
 ssize_t IOManager::Writev(int fd, const struct iovec *iov, int iovcnt) {
-  return CallWithContext(fd, [iov, iovcnt](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [iov, iovcnt](IOContext *context) {
     return context->Writev(iov, iovcnt);
   });
 }
 
 ssize_t IOManager::Readv(int fd, const struct iovec *iov, int iovcnt) {
-  return CallWithContext(fd, [iov, iovcnt](std::shared_ptr<IOContext> context) {
+  return CallWithContext(fd, [iov, iovcnt](IOContext *context) {
     return context->Readv(iov, iovcnt);
   });
 }
 
 ssize_t IOManager::PRead(int fd, void *buf, size_t count, off_t offset) {
   return CallWithContext(
-      fd, [buf, count, offset](std::shared_ptr<IOContext> context) {
+      fd, [buf, count, offset](IOContext *context) {
         return context->PRead(buf, count, offset);
       });
 }
 
+ssize_t IOManager::PReadv(int fd, const struct iovec *iov, int iovcnt,
+                          off_t offset) {
+  return CallWithContext(fd, [iov, iovcnt, offset](IOContext *context) {
+    return context->PReadv(iov, iovcnt, offset);
+  });
+}
+
+ssize_t IOManager::PWritev(int fd, const struct iovec *iov, int iovcnt,
+                           off_t offset) {
+  return CallWithContext(fd, [iov, iovcnt, offset](IOContext *context) {
+    return context->PWritev(iov, iovcnt, offset);
+  });
+}
+
 mode_t IOManager::Umask(mode_t mask) { return enc_untrusted_umask(mask); }
 
 int IOManager::GetRLimit(int resource, struct rlimit *rlim) {
@@ -1017,7 +1370,7 @@ int IOManager::SetRLimit(int resource, const struct rlimit *rlim) {
 int IOManager::SetSockOpt(int sockfd, int level, int option_name,
                           const void *option_value, socklen_t option_len) {
   return CallWithContext(sockfd, [level, option_name, option_value, option_len](
-                                     std::shared_ptr<IOContext> context) {
+                                     IOContext *context) {
     return context->SetSockOpt(level, option_name, option_value, option_len);
   });
 }
@@ -1025,20 +1378,20 @@ int IOManager::SetSockOpt(int sockfd, int level, int option_name,
 int IOManager::Connect(int sockfd, const struct sockaddr *addr,
                        socklen_t addrlen) {
   return CallWithContext(sockfd,
-                         [addr, addrlen](std::shared_ptr<IOContext> context) {
+                         [addr, addrlen](IOContext *context) {
                            return context->Connect(addr, addrlen);
                          });
 }
 
 int IOManager::Shutdown(int sockfd, int how) {
-  return CallWithContext(sockfd, [how](std::shared_ptr<IOContext> context) {
+  return CallWithContext(sockfd, [how](IOContext *context) {
     return context->Shutdown(how);
   });
 }
 
 ssize_t IOManager::Send(int sockfd, const void *buf, size_t len, int flags) {
   return CallWithContext(sockfd,
-                         [buf, len, flags](std::shared_ptr<IOContext> context) {
+                         [buf, len, flags](IOContext *context) {
                            return context->Send(buf, len, flags);
                          });
 }
@@ -1056,17 +1409,36 @@ int IOManager::Socket(int domain, int type, int protocol) {
   return ret;
 }
 
+int IOManager::SocketPair(int domain, int type, int protocol, int sv[2]) {
+  if (domain != AF_UNIX) {
+    errno = EAFNOSUPPORT;
+    return -1;
+  }
+  if ((type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != SOCK_STREAM) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  if (protocol != 0) {
+    errno = EPROTONOSUPPORT;
+    return -1;
+  }
+  std::unique_ptr<IOContextTrustedPipe> first, second;
+  IOContextTrustedPipe::CreateSocketPair(type & SOCK_NONBLOCK,
+                                         type & SOCK_CLOEXEC, &first, &second);
+  return InsertPair(std::move(first), std::move(second), sv);
+}
+
 int IOManager::GetSockOpt(int sockfd, int level, int optname, void *optval,
                           socklen_t *optlen) {
   return CallWithContext(sockfd, [level, optname, optval,
-                                  optlen](std::shared_ptr<IOContext> context) {
+                                  optlen](IOContext *context) {
     return context->GetSockOpt(level, optname, optval, optlen);
   });
 }
 
 int IOManager::Accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
   int ret = CallWithContext(
-      sockfd, [addr, addrlen](std::shared_ptr<IOContext> context) {
+      sockfd, [addr, addrlen](IOContext *context) {
         return context->Accept(addr, addrlen);
       });
   if (ret < 0) {
@@ -1082,27 +1454,27 @@ int IOManager::Accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 int IOManager::Bind(int sockfd, const struct sockaddr *addr,
                     socklen_t addrlen) {
   return CallWithContext(sockfd,
-                         [addr, addrlen](std::shared_ptr<IOContext> context) {
+                         [addr, addrlen](IOContext *context) {
                            return context->Bind(addr, addrlen);
                          });
 }
 
 int IOManager::Listen(int sockfd, int backlog) {
-  return CallWithContext(sockfd, [backlog](std::shared_ptr<IOContext> context) {
+  return CallWithContext(sockfd, [backlog](IOContext *context) {
     return context->Listen(backlog);
   });
 }
 
 ssize_t IOManager::SendMsg(int sockfd, const struct msghdr *msg, int flags) {
   return CallWithContext(sockfd,
-                         [msg, flags](std::shared_ptr<IOContext> context) {
+                         [msg, flags](IOContext *context) {
                            return context->SendMsg(msg, flags);
                          });
 }
 
 ssize_t IOManager::RecvMsg(int sockfd, struct msghdr *msg, int flags) {
   return CallWithContext(sockfd,
-                         [msg, flags](std::shared_ptr<IOContext> context) {
+                         [msg, flags](IOContext *context) {
                            return context->RecvMsg(msg, flags);
                          });
 }
@@ -1110,7 +1482,7 @@ ssize_t IOManager::RecvMsg(int sockfd, struct msghdr *msg, int flags) {
 int IOManager::GetSockName(int sockfd, struct sockaddr *addr,
                            socklen_t *addrlen) {
   return CallWithContext(sockfd,
-                         [addr, addrlen](std::shared_ptr<IOContext> context) {
+                         [addr, addrlen](IOContext *context) {
                            return context->GetSockName(addr, addrlen);
                          });
 }
@@ -1118,7 +1490,7 @@ int IOManager::GetSockName(int sockfd, struct sockaddr *addr,
 int IOManager::GetPeerName(int sockfd, struct sockaddr *addr,
                            socklen_t *addrlen) {
   return CallWithContext(sockfd,
-                         [addr, addrlen](std::shared_ptr<IOContext> context) {
+                         [addr, addrlen](IOContext *context) {
                            return context->GetPeerName(addr, addrlen);
                          });
 }
@@ -1126,7 +1498,7 @@ int IOManager::GetPeerName(int sockfd, struct sockaddr *addr,
 ssize_t IOManager::RecvFrom(int sockfd, void *buf, size_t len, int flags,
                             struct sockaddr *src_addr, socklen_t *addrlen) {
   return CallWithContext(sockfd, [buf, len, flags, src_addr,
-                                  addrlen](std::shared_ptr<IOContext> context) {
+                                  addrlen](IOContext *context) {
     return context->RecvFrom(buf, len, flags, src_addr, addrlen);
   });
 }
@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <utime.h>
 
+#include <array>
 #include <atomic>
 #include <cerrno>
 #include <cstdint>
@@ -38,11 +39,14 @@
 #include <memory>
 #include <queue>
 #include <type_traits>
+#include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "asylo/platform/posix/io/hazard_pointers.h"
+#include "asylo/platform/posix/io/readiness_notifier.h"
 #include "asylo/platform/storage/secure/enclave_storage_secure.h"
 #include "asylo/util/statusor.h"
 
@@ -54,8 +58,12 @@ namespace io {
 class IOManager {
  public:
   // The maximum number of virtual file descriptors which may be open at any one
-  // time.
-  static const constexpr int kMaxOpenFiles = 1024;
+  // time, and so the highest limit which may be set with
+  // setrlimit(RLIMIT_NOFILE).
+  static const constexpr int kMaxOpenFiles = 1 << 16;
+
+  // The initial soft limit on the number of open virtual file descriptors.
+  static const constexpr int kDefaultOpenFilesLimit = 1024;
 
   // An IOContext object represents an abstract I/O stream. Different concrete
   // implementations might wrap a native file descriptor on the host, a virtual
@@ -144,6 +152,17 @@ class IOManager {
       return -1;
     }
 
+    virtual ssize_t PReadv(const struct iovec *iov, int iovcnt, off_t offset) {
+      errno = ENOSYS;
+      return -1;
+    }
+
+    virtual ssize_t PWritev(const struct iovec *iov, int iovcnt,
+                            off_t offset) {
+      errno = ENOSYS;
+      return -1;
+    }
+
     virtual ssize_t FGetXattr(const char *name, void *value, size_t size) {
       errno = ENOSYS;
       return -1;
@@ -222,7 +241,10 @@ class IOManager {
       return -1;
     }
 
-    virtual int EpollCtl(int op, int hostfd, struct epoll_event *event) {
+    // Adds, modifies or removes the registration of the stream |target|, open
+    // as enclave file descriptor |fd|, in this epoll instance.
+    virtual int EpollCtl(int op, int fd, std::shared_ptr<IOContext> target,
+                         struct epoll_event *event) {
       // EINVAL since file descriptors do not by default support epoll behavior.
       errno = EINVAL;
       return -1;
@@ -253,7 +275,17 @@ class IOManager {
 
     virtual int GetHostFileDescriptor() { return -1; }
 
+    // Returns the notifier through which a stream implemented inside the
+    // enclave reports that its readiness may have changed, or nullptr if the
+    // readiness of the stream is only known to the host.
+    virtual ReadinessNotifier *GetReadinessNotifier() { return nullptr; }
+
+    // Returns the epoll events for which a stream with a readiness notifier is
+    // currently ready.
+    virtual uint32_t GetReadiness() { return 0; }
+
    private:
+    friend class IOContextEpoll;
     friend class IOManager;
     friend class NativePathHandler;
   };
@@ -393,11 +425,31 @@ class IOManager {
   };
 
   // A table of virtual file descriptors managed by the IOManager.
-  // This class is not thread safe. IOManager is responsible for locking the
-  // access to objects of this class.
+  //
+  // Looking up a file descriptor is lock free and may happen concurrently with
+  // other lookups and with changes to the table, but IOManager is responsible
+  // for serializing the methods which change the table. The table is made of
+  // chunks of file descriptors allocated as they are first used, so it only
+  // takes memory for as many file descriptors as have been used. Closed
+  // contexts are reclaimed through hazard pointers, so that lookups neither
+  // lock nor touch reference counts shared with other threads.
   class FileDescriptorTable {
    public:
     FileDescriptorTable();
+    ~FileDescriptorTable();
+
+    // Calls |action| with the IOContext associated with a file descriptor, or
+    // with nullptr if no such context exists, and returns its result. The
+    // context remains valid until |action| returns, even if the file
+    // descriptor is concurrently closed.
+    template <typename Action>
+    auto WithContext(int fd, Action action) -> decltype(action(nullptr)) {
+      HazardPointerDomain::Guard guard(&hazard_pointers_);
+      std::atomic<OpenFileDescription *> *slot = Slot(fd);
+      OpenFileDescription *description =
+          slot ? guard.Protect(*slot) : nullptr;
+      return action(description ? description->context() : nullptr);
+    }
 
     // Returns the IOContext associated with a file descriptor, or nullptr if
     // no such context exists.
@@ -433,6 +485,11 @@ class IOManager {
     // is already used.
     int CopyFileDescriptorToSpecifiedTarget(int oldfd, int newfd);
 
+    // Makes |newfd|, which must be in use, reference the I/O context of
+    // |oldfd| in a single step, then releases the context |newfd| referenced as
+    // Delete() does. Returns |newfd|, or -1 if |oldfd| is not valid.
+    int ReplaceFileDescriptor(int oldfd, int newfd);
+
     bool SetFileDescriptorLimits(const struct rlimit *rlim);
 
     int get_maximum_fd_soft_limit();
@@ -440,48 +497,64 @@ class IOManager {
     int get_maximum_fd_hard_limit();
 
    private:
-    // A wrapper around IOContext that ensures that the IOContext is destroyed
-    // when there are no longer any references to it.
+    // An open file description, which holds the IOContext referenced by one or
+    // more file descriptors and closes it when the last of them is deleted.
     //
-    // A shared_ptr<AutoCloseIOContext> represents a file descriptor referring
-    // to a backing IOContext, whereas a shared_ptr<IOContext> keeps the
-    // IOContext alive, even if there are no file descriptors referencing it.
-    class AutoCloseIOContext {
+    // A shared_ptr<IOContext> keeps the IOContext alive, even if there are no
+    // file descriptors referencing it.
+    class OpenFileDescription {
      public:
-      explicit AutoCloseIOContext(IOContext *context)
-          : close_result_(nullptr), context_(context) {}
-
-      ~AutoCloseIOContext() {
-        if (context_->Close() == -1) {
-          int *close_result = close_result_.load();
-          if (close_result) {
-            *close_result = -1;
-          }
-        }
-      }
-
-      std::shared_ptr<IOContext> Get() { return context_; }
-
-      // Indicates that if the Close() call in the destructor fails, then -1
-      // should be written to |close_result|. If called multiple times, only the
-      // most recent |close_result| pointer is used.
-      void WriteCloseResultTo(int *close_result) {
-        close_result_.store(close_result);
-      }
+      explicit OpenFileDescription(IOContext *context) : context_(context) {}
+
+      IOContext *context() const { return context_.get(); }
+
+      std::shared_ptr<IOContext> shared_context() const { return context_; }
+
+      // Adds a file descriptor referencing this description.
+      void AddReference() { ++references_; }
+
+      // Removes a file descriptor referencing this description. Returns true
+      // if it was the last one.
+      bool RemoveReference() { return --references_ == 0; }
 
      private:
-      // Where to write the result of the Close() call in the destructor if it
-      // fails. May be nullptr, in which case any Close() failures are silent.
-      std::atomic<int *> close_result_;
-
-      // The IOContext to wrap. A shared_ptr is used to ensure that calls using
-      // the context object don't end up with dangling pointers if the wrapping
-      // AutoCloseIOContext gets destroyed.
-      std::shared_ptr<IOContext> context_;
+      // The IOContext to wrap. A shared_ptr is used to ensure that callers of
+      // Get() don't end up with dangling pointers if the description gets
+      // destroyed.
+      const std::shared_ptr<IOContext> context_;
+
+      // The number of file descriptors referencing this description. Only
+      // changed by the methods which change the table.
+      int references_ = 1;
     };
 
+    // The number of file descriptors in each chunk of the table.
+    static constexpr int kChunkSize = 1024;
+
+    using Chunk = std::array<std::atomic<OpenFileDescription *>, kChunkSize>;
+
+    // Returns the slot of |fd|, or nullptr if |fd| is not valid or its chunk
+    // has not been allocated, in which case it is unused.
+    std::atomic<OpenFileDescription *> *Slot(int fd) const {
+      if (!IsFileDescriptorValid(fd)) return nullptr;
+      Chunk *chunk = chunks_[fd / kChunkSize].load(std::memory_order_acquire);
+      return chunk ? &(*chunk)[fd % kChunkSize] : nullptr;
+    }
+
+    // Returns the slot of |fd|, which must be valid, allocating its chunk if
+    // needed.
+    std::atomic<OpenFileDescription *> *AllocateSlot(int fd);
+
+    // Associates the unused file descriptor |fd| with |description|.
+    void Assign(int fd, OpenFileDescription *description);
+
+    // Removes a file descriptor referencing |description|, closing its
+    // IOContext and retiring it if it was the last one. Returns -1 if the
+    // close fails, and 0 otherwise.
+    int Release(OpenFileDescription *description);
+
     // Returns whether |fd| is in expected range.
-    bool IsFileDescriptorValid(int fd);
+    static bool IsFileDescriptorValid(int fd);
 
     // Returns current highest file descriptor number. Returns -1 if no file
     // descriptors are used.
@@ -491,7 +564,14 @@ class IOManager {
     // |startfd|. Returns -1 if there is no file descriptor available.
     int GetNextFreeFileDescriptor(int startfd);
 
-    std::array<std::shared_ptr<AutoCloseIOContext>, kMaxOpenFiles> fd_table_;
+    std::array<std::atomic<Chunk *>, kMaxOpenFiles / kChunkSize> chunks_ = {};
+
+    // Every file descriptor below this one is in use.
+    int lowest_free_fd_ = 0;
+
+    // Reclaims the descriptions removed from the table once no lookup uses
+    // them.
+    HazardPointerDomain hazard_pointers_;
 
     // The maximum file descriptor number allowed.
     int maximum_fd_soft_limit;
@@ -556,8 +636,15 @@ class IOManager {
   // combination of O_CLOEXEC, O_DIRECT, and O_NONBLOCK. The array |pipefd| is
   // used to return two file descriptors referring to the ends of the pipe.
   // |pipefd[0]| refers to the read end while |pipefd[1]| refers to the write
-  // end.
-  virtual int Pipe(int pipefd[2], int flags);
+  // end. If trusted pipes are enabled, O_DIRECT is not supported.
+  virtual int Pipe(int pipefd[2], int flags)
+      ABSL_LOCKS_EXCLUDED(fd_table_lock_);
+
+  // Makes Pipe() create pipes whose data never leaves the enclave instead of
+  // host pipes. Reading and writing a trusted pipe makes no host calls, but
+  // trusted pipes cannot be shared with the host, and select() does not
+  // report their readiness. Disabled by default.
+  void SetTrustedPipes(bool enabled) { trusted_pipes_ = enabled; }
 
   // Reads up to |count| bytes from the stream into |buf|, returning the number
   // of bytes read on success or -1 on error.
@@ -651,6 +738,14 @@ class IOManager {
   // Implements pread(2).
   virtual ssize_t PRead(int fd, void *buf, size_t count, off_t offset);
 
+  // Implements preadv(2).
+  virtual ssize_t PReadv(int fd, const struct iovec *iov, int iovcnt,
+                         off_t offset);
+
+  // Implements pwritev(2).
+  virtual ssize_t PWritev(int fd, const struct iovec *iov, int iovcnt,
+                          off_t offset);
+
   // Implements umask(2).
   virtual mode_t Umask(mode_t mask);
 
@@ -747,6 +842,11 @@ class IOManager {
   // Implements socket(2).
   virtual int Socket(int domain, int type, int protocol);
 
+  // Implements socketpair(2). Only AF_UNIX stream sockets are supported, and
+  // are implemented inside the enclave like trusted pipes.
+  virtual int SocketPair(int domain, int type, int protocol, int sv[2])
+      ABSL_LOCKS_EXCLUDED(fd_table_lock_);
+
   // Implements eventfd(2).
   virtual int EventFd(unsigned int initval, int flags)
       ABSL_LOCKS_EXCLUDED(fd_table_lock_);
@@ -803,15 +903,46 @@ class IOManager {
   // for obtaining |fd_table_lock_|.
   int CloseFileDescriptor(int fd) ABSL_EXCLUSIVE_LOCKS_REQUIRED(fd_table_lock_);
 
+  // Returns the host file descriptor backing |fd|, or -1 if |fd| is not open or
+  // not backed by a host file descriptor.
+  int GetHostFileDescriptor(int fd);
+
+  // Inserts |first| and |second| into the file descriptor table, and stores
+  // their file descriptors in |fds|. Inserts neither if both cannot be
+  // inserted.
+  int InsertPair(std::unique_ptr<IOContext> first,
+                 std::unique_ptr<IOContext> second, int fds[2])
+      ABSL_LOCKS_EXCLUDED(fd_table_lock_);
+
+  // Polls |fds| on the host, skipping the entries for which |skip| is true.
+  int PollHost(struct pollfd *fds, nfds_t nfds, const std::vector<bool> &skip,
+               int timeout);
+
+  // A host pipe whose read end is polled along with streams backed by the host,
+  // so that a stream inside the enclave which becomes ready wakes the poll.
+  struct WakeupPipe {
+    int read_fd;
+    int write_fd;
+  };
+
+  // Takes an unused wakeup pipe, creating one if there is none. Returns -1 and
+  // sets errno if a pipe cannot be created.
+  int AcquireWakeupPipe(WakeupPipe *pipe)
+      ABSL_LOCKS_EXCLUDED(wakeup_pipes_lock_);
+
+  // Returns |pipe|, which must be empty, for use by later polls.
+  void ReleaseWakeupPipe(const WakeupPipe &pipe)
+      ABSL_LOCKS_EXCLUDED(wakeup_pipes_lock_);
+
   // Fetches the VirtualFileHandler associated with a given path, or
   // nullptr if no entry is found.
   VirtualPathHandler *HandlerForPath(absl::string_view path) const;
 
-  // Locks the mutex corresponding to |fd| and performs thread safe action.
+  // Looks up the IOContext of |fd| without locking and calls the given function
+  // on it. Sets errno to EBADF and returns an error value if |fd| is not open.
   template <typename IOAction, typename ReturnType = typename std::result_of<
-                                   IOAction(std::shared_ptr<IOContext>)>::type>
-  ReturnType CallWithContext(int fd, IOAction action)
-      ABSL_LOCKS_EXCLUDED(fd_table_lock_);
+                                   IOAction(IOContext *)>::type>
+  ReturnType CallWithContext(int fd, IOAction action);
 
   // Looks up the appropriate VirtualPathHandler and calls the given function on
   // it.  Errors related to path resolution and handler lookups are handled.
@@ -836,10 +967,16 @@ class IOManager {
 
   FileDescriptorTable fd_table_;
 
-  // A mutex that locks the fd_table_.
+  // A mutex that serializes changes to the fd_table_. Lookups do not take it.
   absl::Mutex fd_table_lock_;
 
   std::string current_working_directory_;
+
+  std::atomic<bool> trusted_pipes_{false};
+
+  // Wakeup pipes not used by any poll.
+  absl::Mutex wakeup_pipes_lock_;
+  std::vector<WakeupPipe> wakeup_pipes_ ABSL_GUARDED_BY(wakeup_pipes_lock_);
 };
 
 }  // namespace io
@@ -52,6 +52,8 @@ class IOContextNative : public IOManager::IOContext {
   ssize_t Writev(const struct iovec *iov, int iovcnt) override;
   ssize_t Readv(const struct iovec *iov, int iovcnt) override;
   ssize_t PRead(void *buf, size_t count, off_t offset) override;
+  ssize_t PReadv(const struct iovec *iov, int iovcnt, off_t offset) override;
+  ssize_t PWritev(const struct iovec *iov, int iovcnt, off_t offset) override;
   int SetSockOpt(int level, int option_name, const void *option_value,
                  socklen_t option_len) override;
   int Connect(const struct sockaddr *addr, socklen_t addrlen) override;
@@ -73,7 +75,6 @@ class IOContextNative : public IOManager::IOContext {
  private:
   // Host file descriptor implementing this stream.
   int host_fd_;
-  void FillIov(const char *buf, int size, const struct iovec *iov, int iovcnt);
 };
 
 // VirtualPathHandler implementation handling paths to be forwarded to the host.
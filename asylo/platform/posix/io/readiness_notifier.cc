@@ -0,0 +1,54 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/posix/io/readiness_notifier.h"
+
+#include <algorithm>
+
+namespace asylo {
+namespace io {
+
+void ReadinessNotifier::AddObserver(ReadinessObserver *observer) {
+  absl::MutexLock lock(&lock_);
+  observers_.push_back(observer);
+  num_observers_.store(observers_.size());
+}
+
+void ReadinessNotifier::RemoveObserver(ReadinessObserver *observer) {
+  absl::MutexLock lock(&lock_);
+  observers_.erase(std::remove(observers_.begin(), observers_.end(), observer),
+                   observers_.end());
+  num_observers_.store(observers_.size());
+}
+
+void ReadinessNotifier::Notify() {
+  // An observer added concurrently checks the readiness of the stream after it
+  // is added, so it cannot miss a change made before this load.
+  if (num_observers_.load() == 0) {
+    return;
+  }
+  // Holding |lock_| while notifying guarantees that observers are not notified
+  // after RemoveObserver() returns.
+  absl::MutexLock lock(&lock_);
+  for (ReadinessObserver *observer : observers_) {
+    observer->OnReadinessChanged();
+  }
+}
+
+}  // namespace io
+}  // namespace asylo
@@ -0,0 +1,72 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_POSIX_IO_READINESS_NOTIFIER_H_
+#define ASYLO_PLATFORM_POSIX_IO_READINESS_NOTIFIER_H_
+
+#include <atomic>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace asylo {
+namespace io {
+
+// Receives notifications from a ReadinessNotifier.
+class ReadinessObserver {
+ public:
+  virtual ~ReadinessObserver() = default;
+
+  // Called when the readiness of the observed stream may have changed. Must not
+  // call back into the notifier or the observed stream.
+  virtual void OnReadinessChanged() = 0;
+};
+
+// Tracks the observers of a stream implemented inside the enclave, such as an
+// eventfd, so that event engines learn about changes in its readiness without
+// a host round trip.
+class ReadinessNotifier {
+ public:
+  ReadinessNotifier() = default;
+  ReadinessNotifier(const ReadinessNotifier &other) = delete;
+  ReadinessNotifier &operator=(const ReadinessNotifier &other) = delete;
+
+  void AddObserver(ReadinessObserver *observer) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Removes |observer|. Once this returns, |observer| is not being notified
+  // and will not be notified again.
+  void RemoveObserver(ReadinessObserver *observer) ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Notifies every observer. Streams call this after a change which may have
+  // made them ready, without holding any lock of their own.
+  void Notify() ABSL_LOCKS_EXCLUDED(lock_);
+
+ private:
+  absl::Mutex lock_;
+  std::vector<ReadinessObserver *> observers_ ABSL_GUARDED_BY(lock_);
+
+  // The size of |observers_|, which lets Notify() skip taking |lock_| when
+  // nobody is observing the stream.
+  std::atomic<int> num_observers_{0};
+};
+
+}  // namespace io
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_POSIX_IO_READINESS_NOTIFIER_H_
@@ -46,11 +46,31 @@ ssize_t IOContextSecure::Write(const void *buf, size_t count) {
   return platform::storage::secure_write(host_fd_, buf, count);
 }
 
+ssize_t IOContextSecure::Readv(const struct iovec *iov, int iovcnt) {
+  return platform::storage::secure_readv(host_fd_, iov, iovcnt);
+}
+
+ssize_t IOContextSecure::Writev(const struct iovec *iov, int iovcnt) {
+  return platform::storage::secure_writev(host_fd_, iov, iovcnt);
+}
+
+ssize_t IOContextSecure::PReadv(const struct iovec *iov, int iovcnt,
+                                off_t offset) {
+  return platform::storage::secure_preadv(host_fd_, iov, iovcnt, offset);
+}
+
+ssize_t IOContextSecure::PWritev(const struct iovec *iov, int iovcnt,
+                                 off_t offset) {
+  return platform::storage::secure_pwritev(host_fd_, iov, iovcnt, offset);
+}
+
 int IOContextSecure::LSeek(off_t offset, int whence) {
   return platform::storage::secure_lseek(host_fd_, offset, whence);
 }
 
-int IOContextSecure::FSync() { return enc_untrusted_fsync(host_fd_); }
+int IOContextSecure::FSync() {
+  return platform::storage::secure_fsync(host_fd_);
+}
 
 int IOContextSecure::FStat(struct stat *st) {
   return platform::storage::secure_fstat(host_fd_, st);
@@ -65,6 +85,14 @@ int IOContextSecure::Ioctl(int request, void *argp) {
       return AeadHandler::GetInstance().SetMasterKey(
           host_fd_, ioctl_param->data, ioctl_param->length);
     }
+    case ENCLAVE_STORAGE_SET_BLOCK_LENGTH: {
+      if (!argp) {
+        errno = EINVAL;
+        return -1;
+      }
+      return AeadHandler::GetInstance().SetBlockLength(
+          host_fd_, *reinterpret_cast<uint32_t *>(argp));
+    }
     default:
       if (argp != nullptr) {
         errno = ENOSYS;
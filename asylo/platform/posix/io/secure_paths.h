@@ -40,6 +40,10 @@ class IOContextSecure : public IOManager::IOContext {
  protected:
   ssize_t Read(void *buf, size_t count) override;
   ssize_t Write(const void *buf, size_t count) override;
+  ssize_t Readv(const struct iovec *iov, int iovcnt) override;
+  ssize_t Writev(const struct iovec *iov, int iovcnt) override;
+  ssize_t PReadv(const struct iovec *iov, int iovcnt, off_t offset) override;
+  ssize_t PWritev(const struct iovec *iov, int iovcnt, off_t offset) override;
   int Close() override;
   int LSeek(off_t offset, int whence) override;
   int FSync() override;
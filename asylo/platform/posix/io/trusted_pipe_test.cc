@@ -0,0 +1,229 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "asylo/platform/posix/io/io_manager.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+using ::testing::Gt;
+
+constexpr int kRead = 0;
+constexpr int kWrite = 1;
+
+class TrustedPipeTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    io::IOManager::GetInstance().SetTrustedPipes(true);
+  }
+
+  void TearDown() override {
+    io::IOManager::GetInstance().SetTrustedPipes(false);
+  }
+};
+
+TEST_F(TrustedPipeTest, ReadsWhatWasWritten) {
+  int fds[2];
+  ASSERT_THAT(pipe(fds), Eq(0));
+  const char kMessage[] = "Thread to thread";
+  ASSERT_THAT(write(fds[kWrite], kMessage, sizeof(kMessage)),
+              Eq(sizeof(kMessage)));
+  char buf[sizeof(kMessage)];
+  ASSERT_THAT(read(fds[kRead], buf, sizeof(buf)), Eq(sizeof(kMessage)));
+  EXPECT_THAT(buf, ElementsAreArray(kMessage));
+
+  // Writing to the read end, or reading from the write end, fails.
+  EXPECT_THAT(write(fds[kRead], kMessage, sizeof(kMessage)), Eq(-1));
+  EXPECT_THAT(errno, Eq(EBADF));
+  EXPECT_THAT(read(fds[kWrite], buf, sizeof(buf)), Eq(-1));
+  EXPECT_THAT(errno, Eq(EBADF));
+
+  ASSERT_THAT(close(fds[kWrite]), Eq(0));
+  EXPECT_THAT(read(fds[kRead], buf, sizeof(buf)), Eq(0));
+  ASSERT_THAT(close(fds[kRead]), Eq(0));
+}
+
+TEST_F(TrustedPipeTest, NonBlockingEnds) {
+  int fds[2];
+  ASSERT_THAT(pipe2(fds, O_NONBLOCK), Eq(0));
+  char buf[PIPE_BUF];
+  EXPECT_THAT(read(fds[kRead], buf, sizeof(buf)), Eq(-1));
+  EXPECT_THAT(errno, Eq(EAGAIN));
+
+  int capacity = fcntl(fds[kWrite], F_GETPIPE_SZ);
+  ASSERT_THAT(capacity, Gt(0));
+  std::vector<char> data(capacity + 1);
+  EXPECT_THAT(write(fds[kWrite], data.data(), data.size()), Eq(capacity));
+  EXPECT_THAT(write(fds[kWrite], data.data(), 1), Eq(-1));
+  EXPECT_THAT(errno, Eq(EAGAIN));
+
+  ASSERT_THAT(close(fds[kRead]), Eq(0));
+  EXPECT_THAT(write(fds[kWrite], data.data(), 1), Eq(-1));
+  EXPECT_THAT(errno, Eq(EPIPE));
+  ASSERT_THAT(close(fds[kWrite]), Eq(0));
+}
+
+TEST_F(TrustedPipeTest, KeepsFileDescriptorFlags) {
+  int fds[2];
+  ASSERT_THAT(pipe2(fds, O_CLOEXEC), Eq(0));
+  EXPECT_THAT(fcntl(fds[kRead], F_GETFD), Eq(FD_CLOEXEC));
+  EXPECT_THAT(fcntl(fds[kWrite], F_GETFD), Eq(FD_CLOEXEC));
+
+  ASSERT_THAT(fcntl(fds[kRead], F_SETFD, 0), Eq(0));
+  EXPECT_THAT(fcntl(fds[kRead], F_GETFD), Eq(0));
+  EXPECT_THAT(fcntl(fds[kWrite], F_GETFD), Eq(FD_CLOEXEC));
+  ASSERT_THAT(close(fds[kRead]), Eq(0));
+  ASSERT_THAT(close(fds[kWrite]), Eq(0));
+
+  int sv[2];
+  ASSERT_THAT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), Eq(0));
+  EXPECT_THAT(fcntl(sv[0], F_GETFD), Eq(0));
+  ASSERT_THAT(fcntl(sv[0], F_SETFD, FD_CLOEXEC), Eq(0));
+  EXPECT_THAT(fcntl(sv[0], F_GETFD), Eq(FD_CLOEXEC));
+  ASSERT_THAT(close(sv[0]), Eq(0));
+  ASSERT_THAT(close(sv[1]), Eq(0));
+}
+
+TEST_F(TrustedPipeTest, BlockingReaderIsWoken) {
+  int fds[2];
+  ASSERT_THAT(pipe(fds), Eq(0));
+  constexpr int kMessages = 1000;
+  std::thread writer([&fds]() {
+    for (uint32_t i = 0; i < kMessages; ++i) {
+      write(fds[kWrite], &i, sizeof(i));
+    }
+  });
+  for (uint32_t i = 0; i < kMessages; ++i) {
+    uint32_t value;
+    ASSERT_THAT(read(fds[kRead], &value, sizeof(value)), Eq(sizeof(value)));
+    EXPECT_THAT(value, Eq(i));
+  }
+  writer.join();
+  ASSERT_THAT(close(fds[kRead]), Eq(0));
+  ASSERT_THAT(close(fds[kWrite]), Eq(0));
+}
+
+TEST_F(TrustedPipeTest, PollAndEpollReportReadiness) {
+  int fds[2];
+  ASSERT_THAT(pipe(fds), Eq(0));
+  struct pollfd pfd = {fds[kRead], POLLIN, 0};
+  EXPECT_THAT(poll(&pfd, 1, 0), Eq(0));
+
+  int epfd = epoll_create(1);
+  ASSERT_THAT(epfd, Gt(-1));
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fds[kRead];
+  ASSERT_THAT(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[kRead], &ev), Eq(0));
+
+  std::thread writer([&fds]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    write(fds[kWrite], "x", 1);
+  });
+  EXPECT_THAT(poll(&pfd, 1, -1), Eq(1));
+  EXPECT_THAT(pfd.revents, Eq(POLLIN));
+  writer.join();
+  struct epoll_event events[1];
+  ASSERT_THAT(epoll_wait(epfd, events, 1, 0), Eq(1));
+  EXPECT_THAT(events[0].data.fd, Eq(fds[kRead]));
+
+  ASSERT_THAT(close(fds[kWrite]), Eq(0));
+  EXPECT_THAT(poll(&pfd, 1, 0), Eq(1));
+  EXPECT_THAT(pfd.revents & POLLHUP, Eq(POLLHUP));
+  ASSERT_THAT(close(epfd), Eq(0));
+  ASSERT_THAT(close(fds[kRead]), Eq(0));
+}
+
+TEST_F(TrustedPipeTest, PollWithHostStreamsWakesOnTrustedPipe) {
+  int fds[2];
+  ASSERT_THAT(pipe(fds), Eq(0));
+  int host_fds[2];
+  io::IOManager::GetInstance().SetTrustedPipes(false);
+  ASSERT_THAT(pipe(host_fds), Eq(0));
+  io::IOManager::GetInstance().SetTrustedPipes(true);
+
+  // A poll blocked on the host returns once the pipe inside the enclave
+  // becomes ready.
+  struct pollfd pfds[2] = {{fds[kRead], POLLIN, 0},
+                           {host_fds[kRead], POLLIN, 0}};
+  std::thread writer([&fds]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    write(fds[kWrite], "x", 1);
+  });
+  EXPECT_THAT(poll(pfds, 2, -1), Eq(1));
+  EXPECT_THAT(pfds[0].revents, Eq(POLLIN));
+  EXPECT_THAT(pfds[1].revents, Eq(0));
+  writer.join();
+
+  // Streams of both kinds are reported together.
+  ASSERT_THAT(write(host_fds[kWrite], "y", 1), Eq(1));
+  EXPECT_THAT(poll(pfds, 2, -1), Eq(2));
+  EXPECT_THAT(pfds[0].revents, Eq(POLLIN));
+  EXPECT_THAT(pfds[1].revents, Eq(POLLIN));
+
+  for (int fd : {fds[kRead], fds[kWrite], host_fds[kRead], host_fds[kWrite]}) {
+    ASSERT_THAT(close(fd), Eq(0));
+  }
+}
+
+TEST(TrustedSocketPairTest, IsBidirectional) {
+  int sv[2];
+  ASSERT_THAT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), Eq(0));
+  char buf[4];
+  ASSERT_THAT(send(sv[0], "ping", 4, 0), Eq(4));
+  ASSERT_THAT(recv(sv[1], buf, sizeof(buf), 0), Eq(4));
+  ASSERT_THAT(write(sv[1], "pong", 4), Eq(4));
+  ASSERT_THAT(read(sv[0], buf, sizeof(buf)), Eq(4));
+  EXPECT_THAT(recv(sv[0], buf, sizeof(buf), MSG_DONTWAIT), Eq(-1));
+  EXPECT_THAT(errno, Eq(EAGAIN));
+
+  ASSERT_THAT(shutdown(sv[0], SHUT_WR), Eq(0));
+  EXPECT_THAT(read(sv[1], buf, sizeof(buf)), Eq(0));
+  ASSERT_THAT(write(sv[1], "more", 4), Eq(4));
+  ASSERT_THAT(read(sv[0], buf, sizeof(buf)), Eq(4));
+  ASSERT_THAT(close(sv[0]), Eq(0));
+  ASSERT_THAT(close(sv[1]), Eq(0));
+}
+
+TEST(TrustedSocketPairTest, RejectsUnsupportedSockets) {
+  int sv[2];
+  EXPECT_THAT(socketpair(AF_INET, SOCK_STREAM, 0, sv), Eq(-1));
+  EXPECT_THAT(errno, Eq(EAFNOSUPPORT));
+  EXPECT_THAT(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv), Eq(-1));
+  EXPECT_THAT(errno, Eq(EOPNOTSUPP));
+}
+
+}  // namespace
+}  // namespace asylo
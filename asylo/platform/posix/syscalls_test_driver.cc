@@ -972,6 +972,24 @@ TEST_F(SyscallsTest, Writev) {
       IsOk());
 }
 
+// Tests preadv() by writing a message to a file, and then reading part of it
+// into a scattered array at an offset.
+TEST_F(SyscallsTest, PReadv) {
+  EXPECT_THAT(
+      RunSyscallInsideEnclave(
+          "preadv", absl::GetFlag(FLAGS_test_tmpdir) + "/preadv", nullptr),
+      IsOk());
+}
+
+// Tests pwritev() by writing a scattered array at an offset, and then reading
+// the file to compare the content.
+TEST_F(SyscallsTest, PWritev) {
+  EXPECT_THAT(
+      RunSyscallInsideEnclave(
+          "pwritev", absl::GetFlag(FLAGS_test_tmpdir) + "/pwritev", nullptr),
+      IsOk());
+}
+
 //////////////////////////////////////
 //          sys/utsname.h           //
 //////////////////////////////////////
@@ -136,6 +136,10 @@ class SyscallsEnclave : public EnclaveTestCase {
       return RunReadvTest(test_input.path_name());
     } else if (test_input.test_target() == "writev") {
       return RunWritevTest(test_input.path_name());
+    } else if (test_input.test_target() == "preadv") {
+      return RunPReadvTest(test_input.path_name());
+    } else if (test_input.test_target() == "pwritev") {
+      return RunPWritevTest(test_input.path_name());
     } else if (test_input.test_target() == "uname") {
       return RunUnameTest(output);
     } else if (test_input.test_target() == "dup") {
@@ -820,8 +824,8 @@ class SyscallsEnclave : public EnclaveTestCase {
 
     // setrlimit should fail if the limit is set to be greater than the maximum
     // allowed file descriptor number inside the enclave.
-    set_limit.rlim_cur = 2000;
-    set_limit.rlim_max = 2000;
+    set_limit.rlim_cur = 100000;
+    set_limit.rlim_max = 100000;
     if (setrlimit(RLIMIT_NOFILE, &set_limit) != -1) {
       return Status(absl::StatusCode::kInternal,
                     "setrlimit with limit higher than the maximum allowed "
@@ -1243,6 +1247,97 @@ class SyscallsEnclave : public EnclaveTestCase {
     return absl::OkStatus();
   }
 
+  Status RunPReadvTest(const std::string &path) {
+    int fd;
+    ASYLO_ASSIGN_OR_RETURN(fd, OpenFile(path, O_CREAT | O_RDWR, 0644));
+    platform::storage::FdCloser fd_closer(fd);
+    const std::string message1 = "First preadv message";
+    const std::string message2 = "Second preadv message";
+    const std::string message = message1 + message2;
+    ssize_t rc = write(fd, message.c_str(), message.size());
+    if (rc != message.size()) {
+      return Status(absl::StatusCode::kInternal,
+                    "Bytes written to file does not match message size");
+    }
+    // Read the second message, split across two buffers, from its offset.
+    const size_t split = message2.size() / 2;
+    std::vector<char> buf1(split);
+    std::vector<char> buf2(message2.size() - split);
+    struct iovec iov[2];
+    iov[0].iov_base = buf1.data();
+    iov[0].iov_len = buf1.size();
+    iov[1].iov_base = buf2.data();
+    iov[1].iov_len = buf2.size();
+    rc = preadv(fd, iov, 2, message1.size());
+    if (rc != message2.size()) {
+      return Status(
+          absl::StatusCode::kInternal,
+          absl::StrCat("preadv return:", rc,
+                       " does not match message size:", message2.size()));
+    }
+    if (std::string(buf1.begin(), buf1.end()) +
+            std::string(buf2.begin(), buf2.end()) !=
+        message2) {
+      return Status(absl::StatusCode::kInternal,
+                    "Messages from preadv do not match the expected message.");
+    }
+    if (lseek(fd, 0, SEEK_CUR) != message.size()) {
+      return Status(absl::StatusCode::kInternal,
+                    "preadv changed the file offset");
+    }
+    return absl::OkStatus();
+  }
+
+  Status RunPWritevTest(const std::string &path) {
+    int fd;
+    ASYLO_ASSIGN_OR_RETURN(fd, OpenFile(path, O_CREAT | O_RDWR, 0644));
+    platform::storage::FdCloser fd_closer(fd);
+    const std::string message1 = "First pwritev message";
+    const std::string message2 = "Second pwritev message";
+    const std::string message = message1 + message2;
+    ssize_t rc = write(fd, message1.c_str(), message1.size());
+    if (rc != message1.size()) {
+      return Status(absl::StatusCode::kInternal,
+                    "Bytes written to file does not match message size");
+    }
+    // Write the second message split across two buffers, followed by a buffer
+    // large enough to be transferred through an untrusted buffer.
+    const size_t split = message2.size() / 2;
+    std::vector<char> large(64 * 1024, 'x');
+    struct iovec iov[3];
+    iov[0].iov_base = const_cast<char *>(message2.data());
+    iov[0].iov_len = split;
+    iov[1].iov_base = const_cast<char *>(message2.data() + split);
+    iov[1].iov_len = message2.size() - split;
+    iov[2].iov_base = large.data();
+    iov[2].iov_len = large.size();
+    rc = pwritev(fd, iov, 3, message1.size());
+    if (rc != message2.size() + large.size()) {
+      return LastPosixError(
+          absl::StrCat("pwritev return:", rc, " does not match message size:",
+                       message2.size() + large.size()));
+    }
+    if (lseek(fd, 0, SEEK_CUR) != message1.size()) {
+      return Status(absl::StatusCode::kInternal,
+                    "pwritev changed the file offset");
+    }
+
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+      return LastPosixError(
+          absl::StrCat("Moving to beginning of fd:", fd, " failed"));
+    }
+    std::vector<char> buf(message.size() + large.size());
+    ASYLO_RETURN_IF_ERROR(ReadFile(fd, buf.data(), buf.size()));
+    if (std::string(buf.begin(), buf.begin() + message.size()) != message ||
+        std::string(buf.begin() + message.size(), buf.end()) !=
+            std::string(large.begin(), large.end())) {
+      return Status(absl::StatusCode::kInternal,
+                    absl::StrCat("Message read from fd:", fd,
+                                 " is different from the message of pwritev."));
+    }
+    return absl::OkStatus();
+  }
+
   //////////////////////////////////////
   //          sys/utsname.h           //
   //////////////////////////////////////
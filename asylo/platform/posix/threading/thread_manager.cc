@@ -33,6 +33,13 @@
 namespace asylo {
 namespace {
 
+constexpr int kNotAWorker = WorkStealingQueue<int>::kSharedDeque;
+
+// The persistent worker slot held by the calling thread, or kNotAWorker if it
+// is not a persistent worker. Threads created by a worker are queued on its own
+// deque.
+thread_local int current_worker = kNotAWorker;
+
 // Returns when |predicate| returns true. |mutex| must be locked.
 void WaitFor(const std::function<bool()> &predicate, pthread_cond_t *cond,
              pthread_mutex_t *mutex) {
@@ -192,9 +199,14 @@ std::shared_ptr<ThreadManager::Thread> ThreadManager::DequeueThread(pid_t tid) {
 
   std::shared_ptr<Thread> thread = queued_threads_.front();
   queued_threads_.pop();
+  BindThread(thread, tid);
+  return thread;
+}
 
-  // Bind the Thread we just took off the queue to the thread id of the donated
-  // enclave thread we're running under.
+void ThreadManager::BindThread(const std::shared_ptr<Thread> &thread,
+                               pid_t tid) {
+  // Bind the Thread to the thread id of the donated enclave thread we're
+  // running under.
   const pthread_t thread_id = pthread_self();
   thread->UpdateThreadId(thread_id);
 
@@ -204,7 +216,6 @@ std::shared_ptr<ThreadManager::Thread> ThreadManager::DequeueThread(pid_t tid) {
       thread_id;
 
   pthread_cond_broadcast(&threads_cond_);
-  return thread;
 }
 
 int ThreadManager::CreateThread(const std::function<int()> &start_routine,
@@ -214,11 +225,51 @@ int ThreadManager::CreateThread(const std::function<int()> &start_routine,
   if (attr && attr->detach_state == PTHREAD_CREATE_DETACHED) {
     options.detached = true;
   }
-  std::shared_ptr<Thread> thread = EnqueueThread(options, start_routine, tls);
+
+  std::shared_ptr<Thread> thread;
+  bool persistent = false;
+  bool request_thread = true;
+  {
+    PthreadMutexLock lock(&workers_lock_);
+    if (max_workers_ > 0) {
+      thread = std::make_shared<Thread>(options, start_routine, tls);
+      CHECK(thread != nullptr);
+      persistent_queue_.Push(current_worker, thread);
+      persistent = true;
+
+      // Wake an idle worker to run the thread, and ask the host for another
+      // thread only if the idle and incoming threads cannot take every queued
+      // thread; a queued thread must not wait for a busy worker, which might
+      // be waiting for it.
+      if (idle_workers_ > 0) {
+        pthread_cond_signal(&workers_cond_);
+      }
+      request_thread = persistent_queue_.Size() >
+                       static_cast<size_t>(idle_workers_ + requested_workers_);
+      if (request_thread) {
+        ++requested_workers_;
+      }
+    }
+  }
+  if (!thread) {
+    thread = EnqueueThread(options, start_routine, tls);
+  }
 
   // Exit and create a thread to enter with EnclaveCall DonateThread.
-  if (asylo::primitives::TrustedPrimitives::CreateThread()) {
-    return ECHILD;
+  if (request_thread && asylo::primitives::TrustedPrimitives::CreateThread()) {
+    if (!persistent) {
+      return ECHILD;
+    }
+    // Withdraw the request even if Finalize has since disabled persistent
+    // workers, as Finalize waits for every request to be matched. The thread
+    // is never run unless a worker took it in the meantime.
+    PthreadMutexLock lock(&workers_lock_);
+    --requested_workers_;
+    bool dequeued = persistent_queue_.Remove(current_worker, thread);
+    pthread_cond_broadcast(&workers_cond_);
+    if (dequeued) {
+      return ECHILD;
+    }
   }
 
   // Wait until a thread enters and executes the job.
@@ -234,8 +285,82 @@ int ThreadManager::CreateThread(const std::function<int()> &start_routine,
 // StartThread is called from trusted_application.cc as the start routine when
 // a new thread is donated to the Enclave.
 int ThreadManager::StartThread(pid_t tid) {
-  std::shared_ptr<Thread> thread = DequeueThread(tid);
+  // Threads requested for persistent worker mode take a free worker slot as
+  // they enter, or else run a single queued thread and leave. Which donated
+  // thread takes which role does not matter, as long as each request is
+  // matched by one donation.
+  bool persistent = false;
+  int worker = kNotAWorker;
+  {
+    PthreadMutexLock lock(&workers_lock_);
+    if (requested_workers_ > 0) {
+      --requested_workers_;
+      persistent = true;
+      if (num_workers_ < max_workers_) {
+        ++num_workers_;
+        worker =
+            std::find(worker_slots_, worker_slots_ + kMaxPersistentWorkers,
+                      false) -
+            worker_slots_;
+        worker_slots_[worker] = true;
+      } else {
+        ++transient_workers_;
+      }
+    }
+  }
+  if (!persistent) {
+    RunThread(DequeueThread(tid));
+  } else if (worker != kNotAWorker) {
+    RunPersistentWorker(worker, tid);
+  } else {
+    // The queued thread may already have been taken by a worker.
+    std::shared_ptr<Thread> thread;
+    if (persistent_queue_.Pop(kNotAWorker, &thread)) {
+      {
+        PthreadMutexLock lock(&threads_lock_);
+        BindThread(thread, tid);
+      }
+      RunThread(thread);
+    }
+    PthreadMutexLock lock(&workers_lock_);
+    --transient_workers_;
+    pthread_cond_broadcast(&workers_cond_);
+  }
+  return 0;
+}
 
+void ThreadManager::RunPersistentWorker(int worker, pid_t tid) {
+  current_worker = worker;
+  while (true) {
+    std::shared_ptr<Thread> thread;
+    if (!persistent_queue_.Pop(worker, &thread)) {
+      PthreadMutexLock lock(&workers_lock_);
+      ++idle_workers_;
+      WaitFor(
+          [this, worker, &thread]() {
+            return persistent_queue_.Pop(worker, &thread) ||
+                   finalizing_.load() || num_workers_ > max_workers_;
+          },
+          &workers_cond_, &workers_lock_);
+      --idle_workers_;
+      if (!thread) {
+        // The worker is no longer needed; leave the enclave.
+        --num_workers_;
+        worker_slots_[worker] = false;
+        pthread_cond_broadcast(&workers_cond_);
+        break;
+      }
+    }
+    {
+      PthreadMutexLock lock(&threads_lock_);
+      BindThread(thread, tid);
+    }
+    RunThread(thread);
+  }
+  current_worker = kNotAWorker;
+}
+
+void ThreadManager::RunThread(const std::shared_ptr<Thread> &thread) {
   // Update the thread info in pthread_self.
   enc_update_pthread_info(thread->GetThreadTls());
 
@@ -276,6 +401,16 @@ int ThreadManager::StartThread(pid_t tid) {
   // Thread finished execution, reset the thread ID and release the TLS memory.
   munmap(reinterpret_cast<struct __pthread_info *>(pthread_self())->self,
          reinterpret_cast<struct __pthread_info *>(pthread_self())->tls_size);
+}
+
+int ThreadManager::SetMaxPersistentWorkers(int max_workers) {
+  if (max_workers < 0 || max_workers > kMaxPersistentWorkers) {
+    return EINVAL;
+  }
+  PthreadMutexLock lock(&workers_lock_);
+  max_workers_ = max_workers;
+  // Let idle workers beyond the new maximum leave.
+  pthread_cond_broadcast(&workers_cond_);
   return 0;
 }
 
@@ -367,18 +502,36 @@ void ThreadManager::PopCleanupRoutine(bool execute) {
 
 void ThreadManager::Finalize() {
   finalizing_.store(true);
-  PthreadMutexLock lock(&threads_lock_);
+  {
+    // Let idle persistent workers leave.
+    PthreadMutexLock lock(&workers_lock_);
+    pthread_cond_broadcast(&workers_cond_);
+  }
+
+  {
+    PthreadMutexLock lock(&threads_lock_);
+
+    // In case any threads are waiting to be joined, let's signal them now so
+    // they stop waiting while we finalize.
+    for (auto &thread : threads_) {
+      thread.second->SignalStateWaiters();
+    }
 
-  // In case any threads are waiting to be joined, let's signal them now so they
-  // stop waiting while we finalize.
-  for (auto &thread : threads_) {
-    thread.second->SignalStateWaiters();
+    // Wait for any expected threads to be donated and all threads to return
+    // from start_routine.
+    WaitFor([this]() { return queued_threads_.empty() && threads_.empty(); },
+            &threads_cond_, &threads_lock_);
   }
 
-  // Wait for any expected threads to be donated and all threads to return from
-  // start_routine.
-  WaitFor([this]() { return queued_threads_.empty() && threads_.empty(); },
-          &threads_cond_, &threads_lock_);
+  // Wait for busy persistent workers, and those still being donated, to run
+  // every queued thread and leave in turn.
+  PthreadMutexLock lock(&workers_lock_);
+  WaitFor(
+      [this]() {
+        return num_workers_ == 0 && transient_workers_ == 0 &&
+               requested_workers_ == 0 && persistent_queue_.Size() == 0;
+      },
+      &workers_cond_, &workers_lock_);
 }
 
 }  // namespace asylo
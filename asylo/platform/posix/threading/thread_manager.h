@@ -30,14 +30,21 @@
 #include <unordered_set>
 #include <utility>
 
+#include "asylo/platform/posix/threading/work_stealing_queue.h"
+
 namespace asylo {
 
 bool ReturnFalse();
 
 // ThreadManager class is a singleton responsible for:
 // - Maintaining a queue of thread start_routine functions.
+// - Optionally, keeping threads donated to the enclave as persistent workers
+//   which run the start_routine functions of many threads in turn.
 class ThreadManager {
  public:
+  // The largest value accepted by SetMaxPersistentWorkers().
+  static constexpr int kMaxPersistentWorkers = 256;
+
   static ThreadManager *GetInstance();
 
   // ThreadOptions contains options for configuring new threads.
@@ -55,9 +62,31 @@ class ThreadManager {
 
   // Removes a function from the start_routine queue and runs it. If no
   // start_routine is present this function will abort(). |tid| is the system
-  // thread ID from the host.
+  // thread ID from the host. If the thread was donated to become a persistent
+  // worker, it instead runs queued start_routine functions until it is no
+  // longer needed.
   int StartThread(pid_t tid);
 
+  // Sets the maximum number of persistent workers. A persistent worker is a
+  // thread donated to the enclave which, once its start_routine has returned
+  // and it has been joined or detached, parks inside the enclave rather than
+  // leaving it, and runs the start_routine of a later CreateThread() call.
+  // While a worker is idle, CreateThread() neither exits the enclave nor waits
+  // for the host to spawn a thread. Once every worker is busy, CreateThread()
+  // requests a thread from the host as usual; that thread becomes a worker if
+  // fewer than |max_workers| exist, and otherwise leaves the enclave once its
+  // start_routine is done. Idle workers count towards the number of threads
+  // the enclave can host, so |max_workers| should leave room for the threads
+  // entering the enclave from the host.
+  //
+  // Setting |max_workers| to 0, the default, disables persistent workers, and
+  // lowering it makes idle workers beyond the new maximum leave the enclave.
+  //
+  // Threads which run on the same worker in turn have the same pthread_t and
+  // share its thread_local variables. Returns EINVAL if |max_workers| is
+  // negative or greater than kMaxPersistentWorkers.
+  int SetMaxPersistentWorkers(int max_workers);
+
   // Updates the result of start function in the ThreadManager.
   void UpdateThreadResult(pthread_t thread_id, void *ret);
 
@@ -192,6 +221,18 @@ class ThreadManager {
   // Guaranteed to return a valid std::shared_ptr or this function will abort.
   std::shared_ptr<Thread> DequeueThread(pid_t tid);
 
+  // Sets up |thread| with pthread_self() as the thread id and adds it to the
+  // threads_ map. threads_lock_ must be held.
+  void BindThread(const std::shared_ptr<Thread> &thread, pid_t tid);
+
+  // Runs |thread| on the calling donated thread, then waits until it is joined
+  // or detached and releases it.
+  void RunThread(const std::shared_ptr<Thread> &thread);
+
+  // Runs queued start_routines on the calling donated thread, which holds
+  // persistent worker slot |worker|, until the worker is no longer needed.
+  void RunPersistentWorker(int worker, pid_t tid);
+
   // Returns a Thread pointer for a given |thread_id|.
   std::shared_ptr<Thread> GetThread(pthread_t thread_id);
 
@@ -219,6 +260,32 @@ class ThreadManager {
   // that don't join all their threads. While finalizing, join becomes a noop
   // and threads are treated as detached as they complete.
   std::atomic<bool> finalizing_{false};
+
+  // Guards the persistent worker state below, and signals idle workers and
+  // changes in the number of workers.
+  pthread_mutex_t workers_lock_ = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t workers_cond_ = PTHREAD_COND_INITIALIZER;
+
+  // Maximum number of persistent workers; persistent workers are disabled if
+  // zero.
+  int max_workers_ = 0;
+
+  // Number of persistent workers inside the enclave, of workers parked waiting
+  // for a start_routine, of threads requested from the host in persistent
+  // worker mode which have not entered yet, and of such threads which entered
+  // when no worker slot was free and run a single start_routine.
+  int num_workers_ = 0;
+  int idle_workers_ = 0;
+  int requested_workers_ = 0;
+  int transient_workers_ = 0;
+
+  // Whether each persistent worker slot is held by a worker.
+  bool worker_slots_[kMaxPersistentWorkers] = {};
+
+  // Threads waiting to be run by a persistent worker, with one deque per
+  // worker slot.
+  WorkStealingQueue<std::shared_ptr<Thread>> persistent_queue_{
+      kMaxPersistentWorkers};
 };
 
 }  // namespace asylo
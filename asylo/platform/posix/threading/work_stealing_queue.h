@@ -0,0 +1,144 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_POSIX_THREADING_WORK_STEALING_QUEUE_H_
+#define ASYLO_PLATFORM_POSIX_THREADING_WORK_STEALING_QUEUE_H_
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <utility>
+
+#include "asylo/platform/posix/pthread_impl.h"
+
+namespace asylo {
+
+// A queue of work items made of one deque per worker and one deque shared by
+// producers which are not workers.
+//
+// A worker pushes the items it produces onto the back of its own deque and
+// pops from the back of it, so recently produced work tends to run on the
+// worker which produced it. When its own deque is empty a worker takes from the
+// front of the shared deque, then steals from the front of the deques of the
+// other workers. Each deque has its own lock, so workers operating on their own
+// deques do not contend with each other.
+//
+// WorkStealingQueue is used in trusted contexts where system calls might not be
+// available, and so only uses pthread locks and standard containers.
+template <typename T>
+class WorkStealingQueue {
+ public:
+  // The index to push to for producers which are not workers.
+  static constexpr int kSharedDeque = -1;
+
+  // Creates a queue for workers with indices in [0, |num_workers|).
+  explicit WorkStealingQueue(int num_workers)
+      : num_deques_(num_workers + 1), deques_(new Deque[num_deques_]) {}
+
+  WorkStealingQueue(const WorkStealingQueue &other) = delete;
+  WorkStealingQueue &operator=(const WorkStealingQueue &other) = delete;
+
+  // Pushes |item| onto the deque of |worker|, or onto the shared deque if
+  // |worker| is kSharedDeque. Only the worker itself may push onto the deque of
+  // a worker.
+  void Push(int worker, T item) {
+    Deque *deque = DequeOf(worker);
+    pthread_impl::PthreadMutexLock lock(&deque->lock);
+    deque->items.push_back(std::move(item));
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Takes an item on behalf of |worker|, or of a producer which is not a worker
+  // if |worker| is kSharedDeque, and stores it in |item|. Returns false if
+  // every deque was empty.
+  bool Pop(int worker, T *item) {
+    if (PopBack(DequeOf(worker), item) ||
+        PopFront(DequeOf(kSharedDeque), item)) {
+      return true;
+    }
+    const int num_workers = num_deques_ - 1;
+    for (int i = 1; i <= num_workers; ++i) {
+      int victim = (worker + i) % num_workers;
+      if (victim != worker && PopFront(DequeOf(victim), item)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Removes |item| from the deque of |worker|, or from the shared deque if
+  // |worker| is kSharedDeque, where it must have been pushed. Returns false if
+  // it was taken already.
+  bool Remove(int worker, const T &item) {
+    Deque *deque = DequeOf(worker);
+    pthread_impl::PthreadMutexLock lock(&deque->lock);
+    auto it = std::find(deque->items.begin(), deque->items.end(), item);
+    if (it == deque->items.end()) {
+      return false;
+    }
+    deque->items.erase(it);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Returns the number of queued items. The result may be stale by the time it
+  // is returned if other threads are pushing or popping concurrently.
+  size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Deque {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    std::deque<T> items;
+  };
+
+  Deque *DequeOf(int worker) { return &deques_[worker + 1]; }
+
+  bool PopBack(Deque *deque, T *item) {
+    pthread_impl::PthreadMutexLock lock(&deque->lock);
+    if (deque->items.empty()) {
+      return false;
+    }
+    *item = std::move(deque->items.back());
+    deque->items.pop_back();
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool PopFront(Deque *deque, T *item) {
+    pthread_impl::PthreadMutexLock lock(&deque->lock);
+    if (deque->items.empty()) {
+      return false;
+    }
+    *item = std::move(deque->items.front());
+    deque->items.pop_front();
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  const int num_deques_;
+  const std::unique_ptr<Deque[]> deques_;
+  std::atomic<size_t> size_{0};
+};
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_POSIX_THREADING_WORK_STEALING_QUEUE_H_
@@ -18,6 +18,7 @@
 
 #include "asylo/platform/primitives/remote/communicator.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <queue>
@@ -25,6 +26,8 @@
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/hash/hash.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -47,6 +50,13 @@
 #include "include/grpcpp/security/server_credentials.h"
 #include "include/grpcpp/server_builder.h"
 
+ABSL_FLAG(int32_t, communicator_max_worker_threads, 0,
+          "For target side only: maximum number of worker threads running "
+          "Invocations at once, one for each host thread. Messages of up to "
+          "as many further host threads wait for a worker thread to exit, "
+          "which requires a host thread to exit; Invocations of host threads "
+          "beyond that fail with RESOURCE_EXHAUSTED. 0 means no limit");
+
 namespace asylo {
 namespace primitives {
 
@@ -70,7 +80,21 @@ class Communicator::ThreadActivityWorkQueue {
  public:
   // Pushes a message to be processed in the context of this thread.
   Status QueueMessage(CommunicationMessagePtr wrapped_message) {
-    wrapped_messages_queue_.Lock()->queue.emplace(std::move(wrapped_message));
+    CommunicationMessagePtr delivered_message;
+    {
+      auto locked_message_queue = wrapped_messages_queue_.Lock();
+      if (locked_message_queue->is_waiting_for_worker) {
+        // Confirm delivery of the message right away rather than once a worker
+        // thread starts, which may take longer than the counterpart waits for
+        // the confirmation.
+        auto *const owned_message = new CommunicationMessage(*wrapped_message);
+        delivered_message = std::move(wrapped_message);
+        wrapped_message = CommunicationMessagePtr(
+            owned_message,
+            WrappedMessageDeleter([owned_message] { delete owned_message; }));
+      }
+      locked_message_queue->queue.emplace(std::move(wrapped_message));
+    }
     return absl::OkStatus();
   }
 
@@ -117,6 +141,16 @@ class Communicator::ThreadActivityWorkQueue {
 
   Thread::Id GetHostThreadId() const { return host_thread_id_; }
 
+  void SetWaitingForWorker(bool is_waiting_for_worker) {
+    wrapped_messages_queue_.Lock()->is_waiting_for_worker =
+        is_waiting_for_worker;
+  }
+
+  // Returns the number of messages waiting to be processed.
+  size_t QueueDepth() const {
+    return wrapped_messages_queue_.ReaderLock()->queue.size();
+  }
+
   void SignalExit() { wrapped_messages_queue_.Lock()->is_exiting = true; }
 
   explicit ThreadActivityWorkQueue(Thread::Id host_thread_id)
@@ -138,6 +172,13 @@ class Communicator::ThreadActivityWorkQueue {
   ThreadActivityWorkQueue &operator=(const ThreadActivityWorkQueue &other) =
       delete;
 
+  using Map =
+      absl::flat_hash_map<Thread::Id, std::unique_ptr<ThreadActivityWorkQueue>>;
+
+  // Number of shards of the static map, each guarded by its own mutex so that
+  // threads looking up their contexts rarely contend.
+  static constexpr size_t kMapShards = 16;
+
   // Static map of per-thread activity thread contexts: each participating
   // thread is added when the thread first shows up on Communicator. Keyed by
   // the thread id which made the outermost Invoke call. While processing that
@@ -145,15 +186,15 @@ class Communicator::ThreadActivityWorkQueue {
   // counterpart with an expectation that they will be handled by the same
   // thread on each side. 'invocation_thread_id' is passed with every Invoke RPC
   // request and allows Communicator to assign the handling to the matching
-  // worker thread.
-  static MutexGuarded<
-      absl::flat_hash_map<Thread::Id, std::unique_ptr<ThreadActivityWorkQueue>>>
-      *map() {
-    static const auto static_map = new MutexGuarded<absl::flat_hash_map<
-        Thread::Id, std::unique_ptr<ThreadActivityWorkQueue>>>(
-        absl::flat_hash_map<Thread::Id,
-                            std::unique_ptr<ThreadActivityWorkQueue>>());
-    return static_map;
+  // worker thread. Returns the shard holding |thread_id|.
+  static MutexGuarded<Map> *map(Thread::Id thread_id) {
+    return &shards()[absl::Hash<Thread::Id>()(thread_id) % kMapShards];
+  }
+
+  // Returns all kMapShards shards of the static map.
+  static MutexGuarded<Map> *shards() {
+    static const auto static_shards = new MutexGuarded<Map>[kMapShards];
+    return static_shards;
   }
 
  private:
@@ -172,6 +213,9 @@ class Communicator::ThreadActivityWorkQueue {
 
     // Flag inidicating that the thread needs to exit.
     bool is_exiting = false;
+
+    // Target only: flag indicating that no worker thread is available yet.
+    bool is_waiting_for_worker = false;
   };
   MutexGuarded<WrappedMessageQueue> wrapped_messages_queue_;
 
@@ -187,7 +231,8 @@ class Communicator::ThreadActivityWorkQueue {
 StatusOr<Communicator::ThreadActivityWorkQueue *>
 Communicator::LocateOrCreateThreadActivityWorkQueue(
     Thread::Id invocation_thread_id) {
-  auto locked_threads_map = ThreadActivityWorkQueue::map()->Lock();
+  auto locked_threads_map =
+      ThreadActivityWorkQueue::map(invocation_thread_id)->Lock();
   auto it = locked_threads_map->find(invocation_thread_id);
   if (it == locked_threads_map->end()) {
     auto ins = locked_threads_map->emplace(
@@ -201,42 +246,122 @@ Communicator::LocateOrCreateThreadActivityWorkQueue(
     if (is_host()) {
       // Before recording current_thread_context_, set a thread exit callback
       // which will signal the target side that the matching thread is no longer
-      // needed. This callback will be invoked on that host thread when it is
-      // exiting.
+      // needed, and discard the context of the thread. This callback will be
+      // invoked on that host thread when it is exiting. A callback left from
+      // an earlier context of the thread is not run, since the thread is
+      // still alive.
+      if (thread_exiter_) {
+        thread_exiter_->release();
+      }
       thread_exiter_ = absl::make_unique<Cleanup>([invocation_thread_id]() {
         for (auto communicator : *active_communicators()->ReaderLock()) {
           if (communicator->IsConnected()) {
             communicator->client_->SendDisposeOfThread(invocation_thread_id);
           }
         }
+        current_thread_context_ = nullptr;
+        ThreadActivityWorkQueue::map(invocation_thread_id)
+            ->Lock()
+            ->erase(invocation_thread_id);
       });
     } else {
-      // Create new thread to handle requests associated with that thread_id.
-      // On a host side we are always called by that very thread (when we first
-      // send something from it).
-      auto *const thread_activity_context = it->second.get();
-      auto new_worker =
-          absl::make_unique<Thread>([this, thread_activity_context] {
-            CHECK(!current_thread_context_);
-            current_thread_context_ = thread_activity_context;
-            auto message_result = MessageLoop();
-            current_thread_context_ = nullptr;
-            // May not end receiving a message.
-            CHECK(!message_result.ok())
-                << "Received a message that is not a request, ignored:"
-                << message_result.status();
-          });
-      if (!new_worker) {
+      // Start a thread to handle requests associated with that thread_id, or
+      // queue them until one can be started. On a host side we are always
+      // called by that very thread (when we first send something from it).
+      const Status worker_status = StartOrQueueWorker(it->second.get());
+      if (!worker_status.ok()) {
         locked_threads_map->erase(it);
-        return Status(absl::StatusCode::kResourceExhausted,
-                      "Failed to start worker thread to handle requests");
+        return worker_status;
       }
-      it->second->SetWorkerThread(std::move(new_worker));
     }
   }
   return it->second.get();
 }
 
+Status Communicator::StartOrQueueWorker(
+    ThreadActivityWorkQueue *thread_context) {
+  {
+    auto locked_worker_slots = worker_slots_.Lock();
+    if (locked_worker_slots->is_stopping) {
+      return Status(absl::StatusCode::kCancelled, "Communicator is stopping");
+    }
+    const int32_t max_workers =
+        absl::GetFlag(FLAGS_communicator_max_worker_threads);
+    if (max_workers > 0 &&
+        locked_worker_slots->running >= static_cast<size_t>(max_workers)) {
+      if (locked_worker_slots->pending.size() >=
+          static_cast<size_t>(max_workers)) {
+        return Status(absl::StatusCode::kResourceExhausted,
+                      absl::StrCat("All ", max_workers,
+                                   " worker threads are in use and as many "
+                                   "host threads wait for one"));
+      }
+      locked_worker_slots->pending.push_back(thread_context->GetHostThreadId());
+      thread_context->SetWaitingForWorker(true);
+      return absl::OkStatus();
+    }
+    ++locked_worker_slots->running;
+  }
+  const Status worker_status = StartWorker(thread_context);
+  if (!worker_status.ok()) {
+    --worker_slots_.Lock()->running;
+  }
+  return worker_status;
+}
+
+Status Communicator::StartWorker(ThreadActivityWorkQueue *thread_context) {
+  auto new_worker = absl::make_unique<Thread>([this, thread_context] {
+    CHECK(!current_thread_context_);
+    current_thread_context_ = thread_context;
+    auto message_result = MessageLoop();
+    current_thread_context_ = nullptr;
+    // May not end receiving a message.
+    CHECK(!message_result.ok())
+        << "Received a message that is not a request, ignored:"
+        << message_result.status();
+    ReleaseWorker();
+  });
+  if (!new_worker) {
+    return Status(absl::StatusCode::kResourceExhausted,
+                  "Failed to start worker thread to handle requests");
+  }
+  thread_context->SetWorkerThread(std::move(new_worker));
+  return absl::OkStatus();
+}
+
+void Communicator::ReleaseWorker() {
+  for (;;) {
+    Thread::Id pending_thread_id;
+    {
+      auto locked_worker_slots = worker_slots_.Lock();
+      if (locked_worker_slots->is_stopping ||
+          locked_worker_slots->pending.empty()) {
+        --locked_worker_slots->running;
+        return;
+      }
+      // The slot is handed over rather than released.
+      pending_thread_id = locked_worker_slots->pending.front();
+      locked_worker_slots->pending.pop_front();
+    }
+    // The host thread may have been disposed of while waiting, in which case
+    // the slot goes to the next one.
+    auto locked_threads_map =
+        ThreadActivityWorkQueue::map(pending_thread_id)->Lock();
+    auto it = locked_threads_map->find(pending_thread_id);
+    if (it == locked_threads_map->end()) {
+      continue;
+    }
+    it->second->SetWaitingForWorker(false);
+    const Status worker_status = StartWorker(it->second.get());
+    if (worker_status.ok()) {
+      return;
+    }
+    LOG(ERROR) << "Dropped messages of thread " << pending_thread_id << ": "
+               << worker_status;
+    locked_threads_map->erase(it);
+  }
+}
+
 StatusOr<Communicator::CommunicationMessagePtr> Communicator::MessageLoop() {
   return current_thread_context_->MessageLoop(this);
 }
@@ -258,7 +383,20 @@ void Communicator::QueueMessageForThread(
   }
   const auto thread_context_result =
       LocateOrCreateThreadActivityWorkQueue(invocation_thread_id);
-  ASYLO_CHECK_OK(thread_context_result.status());
+  if (!thread_context_result.ok()) {
+    // No worker thread could be started or queued for on the target. Answer
+    // the request with the error, so that the host thread waiting for it does
+    // not hang.
+    LOG(ERROR) << "Rejected message of thread " << invocation_thread_id
+               << ", status=" << thread_context_result.status();
+    if (!wrapped_message->has_status() ||
+        StatusFromProto(wrapped_message->status()).code() ==
+            absl::StatusCode::kUnknown) {
+      service_->RejectInvocation(std::move(wrapped_message),
+                                 thread_context_result.status());
+    }
+    return;
+  }
   thread_context_result.value()->QueueMessage(std::move(wrapped_message));
 }
 
@@ -322,7 +460,13 @@ Communicator::~Communicator() {
   // For target Communicator or the last active Communicator in host: signal
   // created threads that they need to stop (when thread contexts are
   // destructed on target, they will wait for stoppage to occur).
-  ThreadActivityWorkQueue::map()->Release().clear();
+  worker_slots_.Lock()->is_stopping = true;
+  for (size_t shard = 0; shard < ThreadActivityWorkQueue::kMapShards;
+       ++shard) {
+    ThreadActivityWorkQueue::Map threads_map;
+    std::swap(threads_map, *ThreadActivityWorkQueue::shards()[shard].Lock());
+    threads_map.clear();
+  }
 }
 
 void Communicator::set_handler(
@@ -351,7 +495,8 @@ void Communicator::DisposeOfThread(Thread::Id exiting_thread_id) {
   CHECK(!is_host());
   std::unique_ptr<ThreadActivityWorkQueue> thread_context;
   {
-    auto locked_threads_map = ThreadActivityWorkQueue::map()->Lock();
+    auto locked_threads_map =
+        ThreadActivityWorkQueue::map(exiting_thread_id)->Lock();
     auto it = locked_threads_map->find(exiting_thread_id);
     if (it == locked_threads_map->end()) {
       return;
@@ -416,6 +561,29 @@ Status Communicator::SendCommunication(const CommunicationMessage &message) {
 
 int Communicator::server_port() const { return service_->server_port(); }
 
+Communicator::DispatchStats Communicator::dispatch_stats() const {
+  DispatchStats stats;
+  for (size_t shard = 0; shard < ThreadActivityWorkQueue::kMapShards;
+       ++shard) {
+    auto locked_threads_map =
+        ThreadActivityWorkQueue::shards()[shard].ReaderLock();
+    stats.threads += locked_threads_map->size();
+    for (const auto &thread : *locked_threads_map) {
+      const size_t depth = thread.second->QueueDepth();
+      stats.queued_messages += depth;
+      stats.max_queue_depth = std::max(stats.max_queue_depth, depth);
+    }
+  }
+  auto locked_worker_slots = worker_slots_.ReaderLock();
+  stats.worker_threads = locked_worker_slots->running;
+  stats.pending_threads = locked_worker_slots->pending.size();
+  return stats;
+}
+
+bool Communicator::uses_shared_memory() const {
+  return client_ && client_->uses_shared_memory();
+}
+
 Status Communicator::IsMessageValid(const CommunicationMessage &message) {
   if (!message.has_request_sequence_number()) {
     return Status{absl::StatusCode::kFailedPrecondition,
@@ -21,7 +21,9 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <string>
@@ -30,6 +32,7 @@
 #include "absl/base/attributes.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/flags/declare.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
@@ -53,6 +56,9 @@
 #include "include/grpcpp/server.h"
 #include "include/grpcpp/support/channel_arguments.h"
 
+ABSL_DECLARE_FLAG(bool, communicator_streaming);
+ABSL_DECLARE_FLAG(int32_t, communicator_max_worker_threads);
+
 namespace asylo {
 namespace primitives {
 
@@ -67,6 +73,25 @@ namespace primitives {
 // Communicator object's client. The role of the client is to issue RPCs to the
 // counterpart.
 //
+// By default each message is sent with its own RPC. When
+// --communicator_streaming is set at the time Connect() is called, messages
+// are instead sent over a single long-lived bidirectional stream, and messages
+// sent concurrently by different threads are coalesced into batches. A
+// Communicator serves both kinds of RPCs, so the two sides may differ.
+//
+// When the RemoteProxyClientConfig passed to Connect() on the host enables the
+// shared-memory transport, the host offers the target a SharedMemoryChannel.
+// If the target runs on the same machine it attaches to the channel, and both
+// sides then exchange messages over it instead of gRPC, without serializing
+// them. Otherwise messages continue to be sent over gRPC.
+//
+// The target runs the Invocations of each host thread on a worker thread of its
+// own (see set_handler()), which exits once the host thread does. When
+// --communicator_max_worker_threads is set on the target, at most that many
+// worker threads run at once: the messages of up to as many further host
+// threads are queued until a running worker thread exits, and Invocations of
+// host threads beyond that fail with RESOURCE_EXHAUSTED.
+//
 // Thread safety: All methods of the Communicator class are thread safe.
 // Reliability: Provided the network is unpartitioned and bandwidth is
 // available, Communicator guarantees transfer of complete messages.
@@ -112,6 +137,21 @@ class Communicator {
   using CommunicationMessagePtr =
       std::unique_ptr<CommunicationMessage, WrappedMessageDeleter>;
 
+  // Snapshot of the messages queued for the threads of this process, as
+  // returned by dispatch_stats().
+  struct DispatchStats {
+    // Number of host threads with a queue of messages.
+    size_t threads = 0;
+    // Target only: number of worker threads running.
+    size_t worker_threads = 0;
+    // Target only: number of host threads waiting for a worker thread.
+    size_t pending_threads = 0;
+    // Number of messages queued and not yet picked up by their thread.
+    size_t queued_messages = 0;
+    // Largest number of messages queued for a single thread.
+    size_t max_queue_depth = 0;
+  };
+
   explicit Communicator(bool is_host);
   ~Communicator();
 
@@ -200,9 +240,15 @@ class Communicator {
   // Returns true if running on the host side of the communicator.
   bool is_host() const { return is_host_; }
 
+  // Returns true if messages are sent to the counterpart over shared memory.
+  bool uses_shared_memory() const;
+
   // Returns port assigned when creating the server.
   int server_port() const;
 
+  // Returns the current number of threads and queued messages.
+  DispatchStats dispatch_stats() const;
+
   // Accessor to the last time received from the host (valid only
   // on target Communicator, has no use on the host one).
   absl::optional<int64_t> last_host_time_nanos() const {
@@ -230,6 +276,22 @@ class Communicator {
   ASYLO_MUST_USE_RESULT StatusOr<ThreadActivityWorkQueue *>
   LocateOrCreateThreadActivityWorkQueue(Thread::Id invocation_thread_id);
 
+  // Target-side only: starts a worker thread running the MessageLoop of
+  // |thread_context|, unless --communicator_max_worker_threads are running
+  // already, in which case |thread_context| waits for one of them to exit.
+  // Fails with RESOURCE_EXHAUSTED if as many host threads are waiting already.
+  ASYLO_MUST_USE_RESULT Status
+  StartOrQueueWorker(ThreadActivityWorkQueue *thread_context);
+
+  // Target-side only: starts a worker thread for |thread_context|, which must
+  // hold a slot in worker_slots_.
+  ASYLO_MUST_USE_RESULT Status
+  StartWorker(ThreadActivityWorkQueue *thread_context);
+
+  // Target-side only: called by a worker thread about to exit, hands its slot
+  // over to the first host thread waiting for a worker thread, if any.
+  void ReleaseWorker();
+
   // Runs a loop getting wrapped messages and processing requests on the current
   // thread until response is received (returns it) or thread is signaled
   // to exit (returning status).
@@ -271,6 +333,16 @@ class Communicator {
   std::atomic<bool> is_server_ready_;
   std::atomic<bool> is_client_ready_;
 
+  // Target-side only: the number of worker threads running, and the host
+  // threads waiting for one to exit, oldest first. Once the Communicator
+  // starts destructing, no more worker threads are started.
+  struct WorkerSlots {
+    size_t running = 0;
+    std::deque<Thread::Id> pending;
+    bool is_stopping = false;
+  };
+  MutexGuarded<WorkerSlots> worker_slots_;
+
   // Last time stamp received from the host (set only on target Communicator).
   // Expires after time specified by --host_time_nanos_expiration flag.
   MutexGuarded<absl::optional<int64_t>> last_host_time_nanos_;
@@ -38,10 +38,12 @@
 #include <gtest/gtest.h>
 #include "absl/base/macros.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "asylo/util/logging.h"
@@ -73,6 +75,7 @@ using ::testing::NotNull;
 using ::testing::Pointee;
 using ::testing::RegisterTest;
 using ::testing::SizeIs;
+using ::testing::UnorderedElementsAre;
 
 namespace asylo {
 namespace primitives {
@@ -159,11 +162,24 @@ class CommunicatorTestFixture : public ::testing::Test {
   // Runs host-side action. Must be overridden.
   virtual void RunAction(Communicator *communicator) = 0;
 
+  // Returns whether both sides send messages over streams rather than with
+  // one RPC each.
+  virtual bool streaming() const { return false; }
+
+  // Returns whether the host offers the target a shared-memory channel.
+  virtual bool shared_memory() const { return false; }
+
+  // Returns the maximum number of worker threads the target runs at once, or 0
+  // for no limit.
+  virtual int32_t max_worker_threads() const { return 0; }
+
   // Runs the host or target side of the test, expecting fds_ socketpair
   // to be set for the cross-process communication.
   // Creates Communicator, starts its server, exchanges ports with counterpart,
   // connects to the counterpart.
   void TestBody() final {
+    absl::SetFlag(&FLAGS_communicator_streaming, streaming());
+    absl::SetFlag(&FLAGS_communicator_max_worker_threads, max_worker_threads());
     auto communicator = absl::make_unique<Communicator>(
         /*is_host=*/(child_pid_ != 0));
 
@@ -196,9 +212,14 @@ class CommunicatorTestFixture : public ::testing::Test {
                                      RemoteProvision::Instantiate()));
       proxy_config->EnableOpenCensusMetricsCollection(absl::Seconds(1),
                                                       "test_name");
+      if (shared_memory()) {
+        proxy_config->EnableSharedMemoryTransport();
+      }
 
-      // Establish connection to the target server.
+      // Establish connection to the target server. The target runs on the
+      // same machine, so it accepts the shared-memory channel if offered.
       ASYLO_ASSERT_OK(communicator->Connect(*proxy_config, end_point));
+      EXPECT_THAT(communicator->uses_shared_memory(), Eq(shared_memory()));
     } else {
       // For target: receive host server port.
       int host_server_port = 0;
@@ -760,6 +781,178 @@ class OpenCensusClientTest : public CommunicatorTestFixture {
   }
 };
 
+// Limits the target to a single worker thread, taken by the first host thread
+// that invokes, and to a single host thread waiting for it. Of two more host
+// threads invoking while the first one is alive, one waits for the worker
+// thread and the other one fails.
+class WorkerLimitTest : public CommunicatorTestFixture {
+ public:
+  WorkerLimitTest() = default;
+
+ private:
+  const uint64_t kSelector = 1234;
+
+  int32_t max_worker_threads() const override { return 1; }
+
+  void SetTargetHandler(ServerHandlerMock *handler,
+                        Communicator *communicator) override {
+    EXPECT_CALL(*handler, Call(NotNull()))
+        .Times(2)
+        .WillRepeatedly([communicator](
+                            std::unique_ptr<Communicator::Invocation>
+                                invocation) {
+          ASYLO_ASSERT_OK(invocation->status);
+          const Communicator::DispatchStats stats =
+              communicator->dispatch_stats();
+          EXPECT_THAT(stats.worker_threads, Eq(1));
+          EXPECT_THAT(stats.pending_threads, Eq(0));
+        });
+  }
+
+  void RunAction(Communicator *communicator) override {
+    absl::Notification first_invoked;
+    absl::Notification one_rejected;
+    Thread first_thread([this, communicator, &first_invoked, &one_rejected] {
+      communicator->Invoke(
+          kSelector, [](Communicator::Invocation *invocation) {},
+          [](std::unique_ptr<Communicator::Invocation> invocation) {
+            ASYLO_EXPECT_OK(invocation->status);
+          });
+      first_invoked.Notify();
+      // The worker thread stays with this thread until it exits.
+      one_rejected.WaitForNotification();
+    });
+    first_invoked.WaitForNotification();
+
+    MutexGuarded<std::vector<Status>> statuses(std::vector<Status>{});
+    std::vector<Thread> threads;
+    for (int i = 0; i < 2; ++i) {
+      threads.emplace_back([this, communicator, &one_rejected, &statuses] {
+        communicator->Invoke(
+            kSelector, [](Communicator::Invocation *invocation) {},
+            [&one_rejected, &statuses](
+                std::unique_ptr<Communicator::Invocation> invocation) {
+              statuses.Lock()->push_back(invocation->status);
+              if (!invocation->status.ok()) {
+                one_rejected.Notify();
+              }
+            });
+      });
+    }
+    first_thread.Join();
+    for (auto &thread : threads) {
+      thread.Join();
+    }
+    threads.clear();
+
+    // The waiting host thread got the worker thread once the first one exited.
+    EXPECT_THAT(*statuses.ReaderLock(),
+                UnorderedElementsAre(
+                    IsOk(), StatusIs(absl::StatusCode::kResourceExhausted)));
+  }
+};
+
+// Runs a test with messages sent over streams on both sides.
+template <typename Test>
+class Streaming : public Test {
+ private:
+  bool streaming() const override { return true; }
+};
+
+// Runs a test with messages exchanged over shared memory.
+template <typename Test>
+class SharedMemory : public Test {
+ private:
+  bool shared_memory() const override { return true; }
+};
+
+// Ways messages are exchanged between host and target.
+enum class Transport { kUnary, kStreaming, kSharedMemory };
+
+// Measures the rate of invocations echoed by the target, made one at a time by
+// a single thread and concurrently by many threads, with messages sent with
+// one RPC each, over streams or over shared memory. The rates are logged for
+// comparison.
+template <Transport kTransport>
+class InvokeRateTest : public CommunicatorTestFixture {
+ public:
+  InvokeRateTest() = default;
+
+ private:
+  const uint64_t kSelector = 1234;
+  const int64_t kSequentialInvokes = 1000;
+  const int64_t kThreads = 32;
+  const int64_t kConcurrentInvokes = 250;
+
+  bool streaming() const override {
+    return kTransport == Transport::kStreaming;
+  }
+  bool shared_memory() const override {
+    return kTransport == Transport::kSharedMemory;
+  }
+
+  void SetTargetHandler(ServerHandlerMock *handler,
+                        Communicator *communicator) override {
+    EXPECT_CALL(*handler, Call(NotNull()))
+        .Times(kSequentialInvokes + kThreads * kConcurrentInvokes)
+        .WillRepeatedly(
+            [](std::unique_ptr<Communicator::Invocation> invocation) {
+              // Make output identical to input.
+              while (invocation->reader.hasNext()) {
+                invocation->writer.PushByCopy(invocation->reader.next());
+              }
+            });
+  }
+
+  // Makes |count| invocations on the current thread.
+  static void InvokeRepeatedly(Communicator *communicator, uint64_t selector,
+                               int64_t count) {
+    for (int64_t i = 0; i < count; ++i) {
+      communicator->Invoke(
+          selector,
+          [i](Communicator::Invocation *invocation) {
+            invocation->writer.Push(i);
+          },
+          [i](std::unique_ptr<Communicator::Invocation> invocation) {
+            ASYLO_ASSERT_OK(invocation->status);
+            ASSERT_THAT(invocation->reader, SizeIs(1));
+            EXPECT_THAT(invocation->reader.next<int64_t>(), Eq(i));
+          });
+    }
+  }
+
+  void RunAction(Communicator *communicator) override {
+    const char *const mode = kTransport == Transport::kUnary ? "unary"
+                             : kTransport == Transport::kStreaming
+                                 ? "streaming"
+                                 : "shared memory";
+
+    absl::Time start = absl::Now();
+    InvokeRepeatedly(communicator, kSelector, kSequentialInvokes);
+    absl::Duration elapsed = absl::Now() - start;
+    LOG(INFO) << "Sequential invocations, " << mode << ": "
+              << absl::ToDoubleMicroseconds(elapsed / kSequentialInvokes)
+              << " us each";
+
+    start = absl::Now();
+    std::vector<Thread> threads;
+    for (int64_t thread_index = 0; thread_index < kThreads; ++thread_index) {
+      threads.emplace_back([this, communicator] {
+        InvokeRepeatedly(communicator, kSelector, kConcurrentInvokes);
+      });
+    }
+    for (auto &thread : threads) {
+      thread.Join();
+    }
+    threads.clear();
+    elapsed = absl::Now() - start;
+    LOG(INFO) << "Concurrent invocations on " << kThreads << " threads, "
+              << mode << ": "
+              << kThreads * kConcurrentInvokes / absl::ToDoubleSeconds(elapsed)
+              << " per second";
+  }
+};
+
 void RegisterAllTests() {
   // Prepare all the tests (before forking the process - so that both host and
   // target processes see them), do not store pointers - they are handed over
@@ -772,6 +965,27 @@ void RegisterAllTests() {
   CommunicatorTestFixture::Register<DuplexNestedMultithreadedInvokesTest>();
   CommunicatorTestFixture::Register<UnknownSelectorTest>();
   CommunicatorTestFixture::Register<OpenCensusClientTest>();
+  CommunicatorTestFixture::Register<Streaming<SingleInvokeTest>>();
+  CommunicatorTestFixture::Register<
+      Streaming<MultithreadedInvokesAndCheckBackTest>>();
+  CommunicatorTestFixture::Register<
+      Streaming<MultithreadedWithThreadLocalStorageTest>>();
+  CommunicatorTestFixture::Register<
+      Streaming<DuplexNestedMultithreadedInvokesTest>>();
+  CommunicatorTestFixture::Register<Streaming<UnknownSelectorTest>>();
+  CommunicatorTestFixture::Register<SharedMemory<SingleInvokeTest>>();
+  CommunicatorTestFixture::Register<
+      SharedMemory<MultithreadedInvokesAndCheckBackTest>>();
+  CommunicatorTestFixture::Register<
+      SharedMemory<MultithreadedWithThreadLocalStorageTest>>();
+  CommunicatorTestFixture::Register<
+      SharedMemory<DuplexNestedMultithreadedInvokesTest>>();
+  CommunicatorTestFixture::Register<SharedMemory<UnknownSelectorTest>>();
+  CommunicatorTestFixture::Register<WorkerLimitTest>();
+  CommunicatorTestFixture::Register<InvokeRateTest<Transport::kUnary>>();
+  CommunicatorTestFixture::Register<InvokeRateTest<Transport::kStreaming>>();
+  CommunicatorTestFixture::Register<
+      InvokeRateTest<Transport::kSharedMemory>>();
 }
 
 }  // namespace test
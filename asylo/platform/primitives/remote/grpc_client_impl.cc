@@ -18,11 +18,17 @@
 
 #include "asylo/platform/primitives/remote/grpc_client_impl.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <iterator>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -32,7 +38,9 @@
 #include "asylo/platform/primitives/remote/grpc_service.grpc.pb.h"
 #include "asylo/platform/primitives/remote/grpc_service.pb.h"
 #include "asylo/platform/primitives/remote/metrics/clients/opencensus_client.h"
+#include "asylo/platform/primitives/remote/shared_memory_channel.h"
 #include "asylo/platform/primitives/util/message.h"
+#include "asylo/util/mutex_guarded.h"
 #include "asylo/util/remote/remote_proxy_config.h"
 #include "asylo/util/status.h"
 #include "asylo/util/status_helpers.h"
@@ -41,19 +49,110 @@
 #include "asylo/util/thread.h"
 #include "include/grpc/support/time.h"
 #include "include/grpcpp/support/status.h"
+#include "include/grpcpp/client_context.h"
 #include "include/grpcpp/create_channel.h"
 #include "include/grpcpp/security/credentials.h"
 #include "include/grpcpp/support/channel_arguments.h"
+#include "include/grpcpp/support/sync_stream.h"
+
+ABSL_FLAG(bool, communicator_streaming, false,
+          "Send Communicator messages to the counterpart over a single "
+          "bidirectional stream rather than as one RPC per message");
 
 namespace asylo {
 namespace primitives {
 
 namespace {
 
+// Limits applied to a MessageStream. Send() blocks while more than
+// kMaxQueuedBytes of messages are waiting to be written, unless none are.
+// Messages are coalesced into batches of up to kMaxBatchBytes, unless a single
+// message is larger, and at most kMaxUnacknowledgedBatches batches are written
+// before the counterpart acknowledges them.
+constexpr size_t kMaxQueuedBytes = 4 << 20;
+constexpr size_t kMaxBatchBytes = 1 << 20;
+constexpr int kMaxUnacknowledgedBatches = 16;
+
+// Size of each of the rings of a SharedMemoryChannel. Messages larger than
+// this are still sent, but wait for the counterpart to receive part of them.
+constexpr size_t kSharedMemoryRingBytes = 1 << 20;
+
+// Fixed-size part of a CommunicationMessage sent over shared memory. It is
+// followed by the serialized status, if kHasStatus is set, and by each item,
+// preceded by its size as a uint32_t.
+struct SharedMemoryMessageHeader {
+  enum Flags : uint32_t {
+    kHasHostTime = 1,
+    // The message is a request, so its status is the one of every request.
+    kIsRequest = 2,
+    kHasStatus = 4,
+  };
+
+  uint64_t invocation_thread_id;
+  uint64_t selector;
+  uint64_t request_sequence_number;
+  int64_t host_time_nanos;
+  uint32_t flags;
+  uint32_t status_size;
+  uint32_t item_count;
+};
+
+// Returns the status which marks a CommunicationMessage as a request.
+const StatusProto &RequestStatusProto() {
+  static const StatusProto *const request_status = new StatusProto(
+      StatusToProto(Status{absl::StatusCode::kUnknown, "Invocation request"}));
+  return *request_status;
+}
+
+// Reconstructs in |message| a CommunicationMessage sent over shared memory as
+// |record|.
+Status DecodeSharedMemoryMessage(absl::string_view record,
+                                 CommunicationMessage *message) {
+  const Status truncated{absl::StatusCode::kDataLoss,
+                         "Message received over shared memory is truncated"};
+  SharedMemoryMessageHeader header;
+  if (record.size() < sizeof(header)) {
+    return truncated;
+  }
+  memcpy(&header, record.data(), sizeof(header));
+  record.remove_prefix(sizeof(header));
+
+  message->set_invocation_thread_id(header.invocation_thread_id);
+  message->set_selector(header.selector);
+  message->set_request_sequence_number(header.request_sequence_number);
+  if (header.flags & SharedMemoryMessageHeader::kHasHostTime) {
+    message->set_host_time_nanos(header.host_time_nanos);
+  }
+  if (header.flags & SharedMemoryMessageHeader::kIsRequest) {
+    *message->mutable_status() = RequestStatusProto();
+  }
+  if (header.flags & SharedMemoryMessageHeader::kHasStatus) {
+    if (record.size() < header.status_size ||
+        !message->mutable_status()->ParseFromArray(record.data(),
+                                                   header.status_size)) {
+      return truncated;
+    }
+    record.remove_prefix(header.status_size);
+  }
+  for (uint32_t i = 0; i < header.item_count; ++i) {
+    uint32_t size;
+    if (record.size() < sizeof(size)) {
+      return truncated;
+    }
+    memcpy(&size, record.data(), sizeof(size));
+    record.remove_prefix(sizeof(size));
+    if (record.size() < size) {
+      return truncated;
+    }
+    message->add_items()->assign(record.data(), size);
+    record.remove_prefix(size);
+  }
+  return absl::OkStatus();
+}
+
 void SerializeIntoRequest(CommunicationMessage *request,
                           Communicator::Invocation *invocation) {
-  *request->mutable_status() =
-      StatusToProto(Status{absl::StatusCode::kUnknown, "Invocation request"});
+  *request->mutable_status() = RequestStatusProto();
   request->set_invocation_thread_id(invocation->invocation_thread_id);
   request->set_selector(invocation->selector);
   // Parameters are OK, serialize them into request.
@@ -82,6 +181,182 @@ void DeserializeFromReply(const CommunicationMessage &reply,
 
 }  // namespace
 
+// Sends CommunicationMessages to the counterpart over a CommunicateStream RPC.
+//
+// Messages sent concurrently are coalesced: the first sender to find no batch
+// being written becomes the writer and writes every message queued so far as
+// one batch, while the other senders wait for the batch holding their message
+// to be written. An idle stream therefore writes each message as soon as it is
+// sent, and a busy one writes fewer, larger batches.
+//
+// Send() returns once the message has been written to the stream, or fails if
+// the stream fails first, so that errors are reported to the sender as they
+// are for unary RPCs.
+class Communicator::ClientImpl::MessageStream {
+ public:
+  // Starts a CommunicateStream RPC with |stub|.
+  MessageStream(CommunicatorService::Stub *stub, Communicator *communicator)
+      : state_(State()), communicator_(communicator) {
+    stream_ = stub->CommunicateStream(&context_);
+    reader_ = absl::make_unique<Thread>([this] { ReadAcknowledgements(); });
+  }
+
+  ~MessageStream() { Close(); }
+
+  MessageStream(const MessageStream &other) = delete;
+  MessageStream &operator=(const MessageStream &other) = delete;
+
+  Status Send(const CommunicationMessage &message) {
+    const size_t size = message.ByteSizeLong();
+    uint64_t ticket;
+    {
+      auto locked_state = state_.LockWhen([size](const State &state) {
+        return !state.status.ok() || state.closing || state.queue.empty() ||
+               state.queued_bytes + size <= kMaxQueuedBytes;
+      });
+      if (!locked_state->status.ok()) {
+        return locked_state->status;
+      }
+      if (locked_state->closing) {
+        return Status{absl::StatusCode::kCancelled, "Stream closed"};
+      }
+      locked_state->queue.push_back(QueuedMessage{message, size});
+      locked_state->queued_bytes += size;
+      ticket = ++locked_state->queued_count;
+    }
+
+    for (;;) {
+      CommunicationBatch batch;
+      uint64_t batch_end;
+      {
+        auto locked_state = state_.LockWhen([ticket](const State &state) {
+          return state.written_count >= ticket || !state.status.ok() ||
+                 !state.writing;
+        });
+        if (locked_state->written_count >= ticket) {
+          return absl::OkStatus();
+        }
+        if (!locked_state->status.ok()) {
+          return locked_state->status;
+        }
+        // Become the writer, and wait for the counterpart to acknowledge
+        // enough of the batches written before.
+        locked_state->writing = true;
+        locked_state.Await([](const State &state) {
+          return !state.status.ok() ||
+                 state.unacknowledged_batches < kMaxUnacknowledgedBatches;
+        });
+        if (!locked_state->status.ok()) {
+          locked_state->writing = false;
+          return locked_state->status;
+        }
+        size_t batch_bytes = 0;
+        while (!locked_state->queue.empty()) {
+          QueuedMessage &queued = locked_state->queue.front();
+          if (batch.messages_size() > 0 &&
+              batch_bytes + queued.size > kMaxBatchBytes) {
+            break;
+          }
+          batch_bytes += queued.size;
+          batch.add_messages()->Swap(&queued.message);
+          locked_state->queue.pop_front();
+        }
+        locked_state->queued_bytes -= batch_bytes;
+        locked_state->unacknowledged_batches++;
+        batch_end = locked_state->written_count + batch.messages_size();
+      }
+
+      if (communicator_->is_host()) {
+        batch.set_host_time_nanos(absl::GetCurrentTimeNanos());
+      }
+      const bool written = stream_->Write(batch);
+
+      auto locked_state = state_.Lock();
+      locked_state->writing = false;
+      if (written) {
+        locked_state->written_count = batch_end;
+      } else if (locked_state->status.ok()) {
+        locked_state->status =
+            Status{absl::StatusCode::kInternal, "Failed to write to stream"};
+      }
+    }
+  }
+
+  void Close() {
+    {
+      auto locked_state = state_.Lock();
+      if (locked_state->closing) {
+        return;
+      }
+      // Let messages already queued be written.
+      locked_state->closing = true;
+      locked_state.Await([](const State &state) {
+        return !state.writing &&
+               (state.queue.empty() || !state.status.ok());
+      });
+    }
+    stream_->WritesDone();
+    reader_->Join();
+    const ::grpc::Status grpc_status = stream_->Finish();
+    LOG_IF(ERROR, !grpc_status.ok())
+        << "CommunicateStream error="
+        << ConvertStatus<absl::Status>(grpc_status);
+  }
+
+ private:
+  struct QueuedMessage {
+    CommunicationMessage message;
+    size_t size;
+  };
+
+  struct State {
+    // Messages waiting to be written, oldest first, and their total size.
+    std::deque<QueuedMessage> queue;
+    size_t queued_bytes = 0;
+
+    // Number of messages ever queued, and ever written to the stream.
+    uint64_t queued_count = 0;
+    uint64_t written_count = 0;
+
+    // True while a sender is writing a batch, or waiting to write one.
+    bool writing = false;
+
+    // Number of batches written and not yet acknowledged.
+    int unacknowledged_batches = 0;
+
+    // Set once Close() is called, after which no messages are queued.
+    bool closing = false;
+
+    // The first error encountered on the stream.
+    Status status;
+  };
+
+  // Receives acknowledgements of the batches written until the stream ends.
+  void ReadAcknowledgements() {
+    CommunicationBatchAck ack;
+    while (stream_->Read(&ack)) {
+      // If host acknowledged with time stamp, process it.
+      if (!communicator_->is_host() && ack.has_host_time_nanos()) {
+        communicator_->set_host_time_nanos(ack.host_time_nanos());
+      }
+      state_.Lock()->unacknowledged_batches--;
+    }
+    auto locked_state = state_.Lock();
+    if (locked_state->status.ok()) {
+      locked_state->status =
+          Status{absl::StatusCode::kCancelled, "Stream closed"};
+    }
+  }
+
+  ::grpc::ClientContext context_;
+  std::unique_ptr<
+      ::grpc::ClientReaderWriter<CommunicationBatch, CommunicationBatchAck>>
+      stream_;
+  MutexGuarded<State> state_;
+  std::unique_ptr<Thread> reader_;
+  Communicator *const communicator_;
+};
+
 Status Communicator::ClientImpl::RunInvocation(
     Communicator::Invocation *invocation) {
   if (!communicator_->is_client_ready_.load()) {
@@ -119,7 +394,7 @@ Status Communicator::ClientImpl::RunInvocation(
   return invocation->status;
 }
 
-Communicator::ClientImpl::~ClientImpl() = default;
+Communicator::ClientImpl::~ClientImpl() { CloseStream(); }
 Communicator::ClientImpl::ClientImpl(Communicator *communicator)
     : sequence_number_(0), communicator_(CHECK_NOTNULL(communicator)) {}
 
@@ -138,6 +413,10 @@ Communicator::ClientImpl::Create(const RemoteProxyConfig &config,
   }
   client->grpc_stub_ =
       CommunicatorService::NewStub(client->grpc_channel_);
+  if (absl::GetFlag(FLAGS_communicator_streaming)) {
+    client->stream_ = absl::make_unique<MessageStream>(
+        client->grpc_stub_.get(), communicator);
+  }
 
   if (communicator->is_host()) {
     const RemoteProxyClientConfig &client_config =
@@ -148,6 +427,9 @@ Communicator::ClientImpl::Create(const RemoteProxyConfig &config,
       client->open_census_client_ = OpenCensusClient::Create(
           client->grpc_channel_, config_result.value());
     }
+    if (client_config.IsSharedMemoryTransportEnabled()) {
+      client->OfferSharedMemory();
+    }
   }
 
   return std::move(client);
@@ -156,6 +438,12 @@ Communicator::ClientImpl::Create(const RemoteProxyConfig &config,
 Status Communicator::ClientImpl::SendCommunication(
     const CommunicationMessage &message) {
   ASYLO_RETURN_IF_ERROR(IsMessageValid(message));
+  if (shared_memory_.load(std::memory_order_acquire) != nullptr) {
+    return SendOverSharedMemory(message);
+  }
+  if (stream_) {
+    return stream_->Send(message);
+  }
   CommunicationConfirmation confirmation;
   if (communicator_->is_host()) {
     confirmation.set_host_time_nanos(absl::GetCurrentTimeNanos());
@@ -178,7 +466,145 @@ Status Communicator::ClientImpl::SendCommunication(
   return absl::OkStatus();
 }
 
+void Communicator::ClientImpl::OfferSharedMemory() {
+  auto channel_result = SharedMemoryChannel::Create(kSharedMemoryRingBytes);
+  if (!channel_result.ok()) {
+    LOG(WARNING) << "Failed to create shared memory, sending messages over "
+                    "gRPC, status="
+                 << channel_result.status();
+    return;
+  }
+  std::unique_ptr<SharedMemoryChannel> channel =
+      std::move(channel_result).value();
+  SharedMemoryReply reply;
+  ::grpc::ClientContext context;
+  gpr_timespec absolute_deadline = gpr_time_add(
+      gpr_now(GPR_CLOCK_REALTIME), gpr_time_from_seconds(5, GPR_TIMESPAN));
+  context.set_deadline(absolute_deadline);
+  const auto grpc_status =
+      grpc_stub_->AttachSharedMemory(&context, channel->offer(), &reply);
+  if (!grpc_status.ok()) {
+    LOG(ERROR) << "OfferSharedMemory error="
+               << ConvertStatus<absl::Status>(grpc_status);
+    return;
+  }
+  if (!reply.attached()) {
+    LOG(INFO) << "Counterpart did not attach to shared memory, sending "
+                 "messages over gRPC";
+    return;
+  }
+  Status status = StartSharedMemory(std::move(channel));
+  LOG_IF(ERROR, !status.ok())
+      << "Failed to start shared memory, status=" << status;
+}
+
+Status Communicator::ClientImpl::AttachSharedMemory(
+    const SharedMemoryOffer &offer) {
+  if (shared_memory_.load() != nullptr) {
+    return Status{absl::StatusCode::kAlreadyExists,
+                  "Already attached to shared memory"};
+  }
+  std::unique_ptr<SharedMemoryChannel> channel;
+  ASYLO_ASSIGN_OR_RETURN(channel, SharedMemoryChannel::Attach(offer));
+  return StartSharedMemory(std::move(channel));
+}
+
+Status Communicator::ClientImpl::StartSharedMemory(
+    std::unique_ptr<SharedMemoryChannel> channel) {
+  auto locked_state = shared_memory_state_.Lock();
+  if (locked_state->channel) {
+    return Status{absl::StatusCode::kAlreadyExists,
+                  "Already attached to shared memory"};
+  }
+  locked_state->channel = std::move(channel);
+  shared_memory_.store(locked_state->channel.get(), std::memory_order_release);
+  locked_state->receiver =
+      absl::make_unique<Thread>([this] { ReceiveFromSharedMemory(); });
+  return absl::OkStatus();
+}
+
+Status Communicator::ClientImpl::SendOverSharedMemory(
+    const CommunicationMessage &message) {
+  SharedMemoryMessageHeader header = {};
+  header.invocation_thread_id = message.invocation_thread_id();
+  header.selector = message.selector();
+  header.request_sequence_number = message.request_sequence_number();
+  if (communicator_->is_host()) {
+    header.flags |= SharedMemoryMessageHeader::kHasHostTime;
+    header.host_time_nanos = absl::GetCurrentTimeNanos();
+  }
+  std::string status;
+  if (message.has_status()) {
+    if (StatusFromProto(message.status()).code() ==
+        absl::StatusCode::kUnknown) {
+      header.flags |= SharedMemoryMessageHeader::kIsRequest;
+    } else {
+      header.flags |= SharedMemoryMessageHeader::kHasStatus;
+      status = message.status().SerializeAsString();
+      header.status_size = status.size();
+    }
+  }
+  header.item_count = message.items_size();
+
+  // Items are copied straight from the message into shared memory.
+  std::vector<uint32_t> item_sizes;
+  item_sizes.reserve(message.items_size());
+  std::vector<Extent> parts;
+  parts.reserve(2 + 2 * message.items_size());
+  parts.emplace_back(&header);
+  parts.emplace_back(status.data(), status.size());
+  for (const std::string &item : message.items()) {
+    item_sizes.push_back(item.size());
+    parts.emplace_back(&item_sizes.back());
+    parts.emplace_back(item.data(), item.size());
+  }
+  return shared_memory_.load(std::memory_order_acquire)->Send(parts);
+}
+
+void Communicator::ClientImpl::ReceiveFromSharedMemory() {
+  SharedMemoryChannel *const shared_memory =
+      shared_memory_.load(std::memory_order_acquire);
+  std::string record;
+  for (;;) {
+    Status status = shared_memory->Receive(&record);
+    if (!status.ok()) {
+      LOG_IF(ERROR, status.code() != absl::StatusCode::kCancelled)
+          << "Failed to receive over shared memory, status=" << status;
+      return;
+    }
+    auto *const message = new CommunicationMessage;
+    status = DecodeSharedMemoryMessage(record, message);
+    if (!status.ok()) {
+      LOG(ERROR) << "Malformed message ignored, status=" << status;
+      delete message;
+      continue;
+    }
+    // If received time stamp from host with message, store it.
+    if (!communicator_->is_host() && message->has_host_time_nanos()) {
+      communicator_->set_host_time_nanos(message->host_time_nanos());
+    }
+    communicator_->QueueMessageForThread(CommunicationMessagePtr(
+        message, WrappedMessageDeleter([message] { delete message; })));
+  }
+}
+
+void Communicator::ClientImpl::CloseStream() {
+  if (stream_) {
+    stream_->Close();
+  }
+  SharedMemoryChannel *const shared_memory = shared_memory_.load();
+  if (shared_memory != nullptr) {
+    shared_memory->Close();
+  }
+  std::unique_ptr<Thread> receiver =
+      std::move(shared_memory_state_.Lock()->receiver);
+  if (receiver) {
+    receiver->Join();
+  }
+}
+
 void Communicator::ClientImpl::SendDisconnect() {
+  CloseStream();
   DisconnectRequest request;
   DisconnectReply reply;
   ::grpc::ClientContext context;
@@ -28,7 +28,9 @@
 #include "asylo/platform/primitives/remote/grpc_service.grpc.pb.h"
 #include "asylo/platform/primitives/remote/grpc_service.pb.h"
 #include "asylo/platform/primitives/remote/metrics/clients/opencensus_client.h"
+#include "asylo/platform/primitives/remote/shared_memory_channel.h"
 #include "asylo/util/asylo_macros.h"
+#include "asylo/util/mutex_guarded.h"
 #include "asylo/util/remote/remote_loader.pb.h"
 #include "asylo/util/status.h"
 #include "asylo/util/statusor.h"
@@ -57,8 +59,26 @@ class Communicator::ClientImpl {
   // Communicator.
   Status SendCommunication(const CommunicationMessage &message);
 
+  // Offers the counterpart a channel in shared memory, and sends messages over
+  // it from then on if the counterpart attaches to it. Otherwise, messages
+  // continue to be sent over gRPC.
+  void OfferSharedMemory();
+
+  // Attaches to the channel in shared memory offered by the counterpart, and
+  // sends messages over it from then on.
+  Status AttachSharedMemory(const SharedMemoryOffer &offer);
+
+  // Returns true if messages are sent over shared memory.
+  bool uses_shared_memory() const { return shared_memory_.load() != nullptr; }
+
+  // Closes the stream messages are sent over, if any, once every message
+  // already queued on it has been sent, and closes the channel in shared
+  // memory, if any. Subsequent calls to SendCommunication fail. The
+  // counterpart cannot shut its server down while the stream is open.
+  void CloseStream();
+
   // Sends disconnect request to the Communicator counterpart, triggering it to
-  // shut down.
+  // shut down. Closes the stream messages are sent over first.
   void SendDisconnect();
 
   // Sends end point address to the counterpart. Not mandatory, expected to be
@@ -75,6 +95,10 @@ class Communicator::ClientImpl {
   Status RunInvocation(Communicator::Invocation *invocation);
 
  private:
+  // Sends messages over a single CommunicateStream RPC, used when
+  // --communicator_streaming is set.
+  class MessageStream;
+
   // Constructor, used by factory method only.
   explicit ClientImpl(Communicator *communicator);
 
@@ -82,10 +106,40 @@ class Communicator::ClientImpl {
   // for request-response match verification.
   uint64_t GenerateSequenceNumber();
 
+  // Sends messages over |channel| from then on, and starts a thread receiving
+  // messages from it. Fails if a channel is already in use.
+  Status StartSharedMemory(std::unique_ptr<SharedMemoryChannel> channel);
+
+  // Sends |message| over shared memory, without serializing it to protobuf
+  // wire format.
+  Status SendOverSharedMemory(const CommunicationMessage &message);
+
+  // Queues each message received over shared memory for processing, until the
+  // channel is closed.
+  void ReceiveFromSharedMemory();
+
   // gRPC client stub used for writing messages over gRPC.
   std::shared_ptr<::grpc::Channel> grpc_channel_;
   std::unique_ptr<CommunicatorService::Stub> grpc_stub_;
 
+  // Stream used to send messages instead of unary Communicate RPCs, if any.
+  std::unique_ptr<MessageStream> stream_;
+
+  // Channel in shared memory used to exchange messages instead of gRPC, if
+  // any, and the thread receiving messages from it.
+  struct SharedMemoryState {
+    std::unique_ptr<SharedMemoryChannel> channel;
+    std::unique_ptr<Thread> receiver;
+  };
+  MutexGuarded<SharedMemoryState> shared_memory_state_;
+
+  // The channel owned by |shared_memory_state_|, published once it is ready.
+  // The target attaches to the channel from the server's completion queue
+  // thread while other threads send messages, so senders read this pointer
+  // rather than the guarded state. The channel is not destroyed before the
+  // client.
+  std::atomic<SharedMemoryChannel *> shared_memory_{nullptr};
+
   // SequenceNumber generation.
   std::atomic<uint64_t> sequence_number_;
 
@@ -32,6 +32,7 @@
 #include "absl/time/time.h"
 #include "asylo/util/logging.h"
 #include "asylo/platform/primitives/extent.h"
+#include "asylo/platform/primitives/remote/grpc_client_impl.h"
 #include "asylo/platform/primitives/remote/grpc_service.grpc.pb.h"
 #include "asylo/platform/primitives/remote/grpc_service.pb.h"
 #include "asylo/platform/primitives/remote/metrics/proc_system_service.h"
@@ -45,6 +46,7 @@
 #include "include/grpcpp/impl/codegen/completion_queue.h"
 #include "include/grpcpp/support/status.h"
 #include "include/grpcpp/create_channel.h"
+#include "include/grpcpp/impl/codegen/async_stream.h"
 #include "include/grpcpp/impl/codegen/async_unary_call.h"
 #include "include/grpcpp/impl/codegen/server_context.h"
 #include "include/grpcpp/security/server_credentials.h"
@@ -124,9 +126,7 @@ void Communicator::ServiceImpl::StartInvocation(
     CommunicationMessagePtr wrapped_message) {
   auto invocation = absl::make_unique<ServerInvocation>(
       *wrapped_message, [this](const CommunicationMessage &response) {
-        const Status send_status = communicator_->SendCommunication(response);
-        LOG_IF(ERROR, !send_status.ok())
-            << "Failed to send response, status=" << send_status;
+        SendResponse(response);
       });
   // The request message has been deserialized, drop it letting the RPC finish
   // and send confirmation to the caller.
@@ -141,6 +141,24 @@ void Communicator::ServiceImpl::StartInvocation(
   handler_(std::move(invocation));
 }
 
+void Communicator::ServiceImpl::SendResponse(
+    const CommunicationMessage &response) {
+  const Status send_status = communicator_->SendCommunication(response);
+  LOG_IF(ERROR, !send_status.ok())
+      << "Failed to send response, status=" << send_status;
+}
+
+void Communicator::ServiceImpl::RejectInvocation(
+    CommunicationMessagePtr wrapped_message, const Status &status) {
+  auto invocation = absl::make_unique<ServerInvocation>(
+      *wrapped_message, [this](const CommunicationMessage &response) {
+        SendResponse(response);
+      });
+  wrapped_message.reset();
+  // The response is sent when |invocation| is destroyed.
+  invocation->status = status;
+}
+
 // Server-side instance base that asynchronously processes one RPC call through
 // its stages.
 class Communicator::ServiceImpl::RpcInstance {
@@ -159,7 +177,7 @@ class Communicator::ServiceImpl::RpcInstance {
     RespondRpc();
   }
 
-  void ProcessRpc(bool ok) {
+  virtual void ProcessRpc(bool ok) {
     if (!ok || completed_) {
       // Once failed or completed, deallocate ourselves (RpcInstance).
       delete this;
@@ -250,6 +268,115 @@ class Communicator::ServiceImpl::CommunicationRpcInstance
   ::grpc::ServerAsyncResponseWriter<CommunicationConfirmation> responder_;
 };
 
+// Serves a CommunicateStream RPC, which carries batches of messages for the
+// lifetime of the counterpart's client. Unlike other RPCs it takes several
+// steps: each batch received is dispatched like the message of a Communicate
+// RPC and then acknowledged, until the client closes the stream. Only one
+// operation on the stream is outstanding at a time, so the instance is the tag
+// of each.
+class Communicator::ServiceImpl::CommunicationStreamRpcInstance
+    : public Communicator::ServiceImpl::RpcInstance {
+ public:
+  // Take in the "service" instance (in this case representing an asynchronous
+  // server) and the "completion_queue" used for asynchronous communication
+  // with the gRPC runtime.
+  explicit CommunicationStreamRpcInstance(Communicator::ServiceImpl *service)
+      : Communicator::ServiceImpl::RpcInstance(service),
+        state_(State::kConnecting),
+        stream_(context()) {
+    service->RequestCommunicateStream(context(), &stream_, completion_queue(),
+                                      completion_queue(), this);
+  }
+
+  void ProcessRpc(bool ok) override {
+    switch (state_) {
+      case State::kConnecting:
+        if (!ok) {
+          delete this;
+          return;
+        }
+        // Spawn a new CommunicationStreamRpcInstance instance to serve other
+        // clients. The instance will deallocate itself once completed.
+        new CommunicationStreamRpcInstance(service());
+        ReadBatch();
+        return;
+      case State::kReading:
+        if (!ok) {
+          // The client has closed the stream.
+          Finish();
+          return;
+        }
+        ExecuteRpc();
+        RespondRpc();
+        return;
+      case State::kAcknowledging:
+        if (!ok) {
+          Finish();
+          return;
+        }
+        ReadBatch();
+        return;
+      case State::kFinishing:
+        delete this;
+        return;
+    }
+  }
+
+ private:
+  enum class State { kConnecting, kReading, kAcknowledging, kFinishing };
+
+  void ReadBatch() {
+    state_ = State::kReading;
+    stream_.Read(&batch_, this);
+  }
+
+  void Finish() {
+    state_ = State::kFinishing;
+    stream_.Finish(::grpc::Status::OK, this);
+  }
+
+  // Dispatches the messages of the batch received, in order.
+  void ExecuteRpc() override {
+    // If received time stamp from host with batch, store it.
+    if (!service()->communicator_->is_host() && batch_.has_host_time_nanos()) {
+      service()->communicator_->set_host_time_nanos(batch_.host_time_nanos());
+    }
+
+    for (CommunicationMessage &message : *batch_.mutable_messages()) {
+      auto *const owned_message = new CommunicationMessage;
+      owned_message->Swap(&message);
+      service()->communicator_->QueueMessageForThread(CommunicationMessagePtr(
+          owned_message,
+          WrappedMessageDeleter([owned_message] { delete owned_message; })));
+    }
+    batch_.Clear();
+  }
+
+  // Acknowledges the batch received.
+  void RespondRpc() override {
+    state_ = State::kAcknowledging;
+    ack_.Clear();
+    // If host acknowledges the target, add time stamp.
+    if (service()->communicator_->is_host()) {
+      ack_.set_host_time_nanos(absl::GetCurrentTimeNanos());
+    }
+    stream_.Write(ack_, this);
+  }
+
+  State state_;
+
+  // The batch being received from the client.
+  CommunicationBatch batch_;
+
+  // The acknowledgement being sent back to the client.
+  CommunicationBatchAck ack_;
+
+  // The means to get back to the client (must always be the last: destruct
+  // it before batch_ and ack_).
+  ::grpc::ServerAsyncReaderWriter<CommunicationBatchAck, CommunicationBatch>
+      stream_;
+};
+
 class Communicator::ServiceImpl::DisconnectRpcInstance
     : public Communicator::ServiceImpl::RpcInstance {
  public:
@@ -281,6 +408,11 @@ class Communicator::ServiceImpl::DisconnectRpcInstance
     // deallocate itself once completed.
     new DisconnectRpcInstance(service());
 
+    // Close the stream to the counterpart first, if any, since it cannot shut
+    // its server down while the stream is open.
+    if (service()->communicator_->client_) {
+      service()->communicator_->client_->CloseStream();
+    }
     service()->communicator_->is_client_ready_.store(false);
     service()->communicator_->is_server_ready_.store(false);
     // Copy service() out, because after Complete() we cannot rely on 'this'
@@ -396,6 +528,62 @@ class Communicator::ServiceImpl::EndPointAddressRpcInstance
   ::grpc::ServerAsyncResponseWriter<EndPointAddressReply> responder_;
 };
 
+class Communicator::ServiceImpl::AttachSharedMemoryRpcInstance
+    : public Communicator::ServiceImpl::RpcInstance {
+ public:
+  // Take in the "service" instance (in this case representing an asynchronous
+  // server) and the "completion_queue" used for asynchronous communication
+  // with the gRPC runtime.
+  explicit AttachSharedMemoryRpcInstance(Communicator::ServiceImpl *service)
+      : Communicator::ServiceImpl::RpcInstance(service), responder_(context()) {
+    // Request* that the system start processing Send requests. In this request,
+    // "this" acts as the tag uniquely identifying the request (so that
+    // different AttachSharedMemoryRpcInstance instances can serve different
+    // requests concurrently), in this case the memory address of this
+    // AttachSharedMemoryRpcInstance.
+    service->RequestAttachSharedMemory(context(), &request_, &responder_,
+                                       completion_queue(), completion_queue(),
+                                       this);
+  }
+
+ private:
+  void RespondRpc() override {
+    // And we are done! Let the gRPC runtime know we've finished, using the
+    // memory address of this instance as the uniquely identifying tag for
+    // the event.
+    responder_.Finish(confirmation_, ::grpc::Status::OK, this);
+  }
+
+  void ExecuteRpc() override {
+    // Spawn a new AttachSharedMemoryRpcInstance instance to serve new clients
+    // while we process the one for this AttachSharedMemoryRpcInstance. The
+    // instance will deallocate itself once completed.
+    new AttachSharedMemoryRpcInstance(service());
+
+    // Messages received over the channel are answered over it, so the offer
+    // is declined if the client is not connected yet.
+    const auto &client = service()->communicator_->client_;
+    const Status status =
+        client ? client->AttachSharedMemory(request_)
+               : Status{absl::StatusCode::kFailedPrecondition,
+                        "Client is not connected"};
+    LOG_IF(WARNING, !status.ok())
+        << "Not attaching to shared memory, status=" << status;
+    confirmation_.set_attached(status.ok());
+    Complete();
+  }
+
+  // What we get from the client.
+  SharedMemoryOffer request_;
+
+  // What we send back to the client.
+  SharedMemoryReply confirmation_;
+
+  // The means to get back to the client (must always be the last: destruct
+  // it before request_ and confirmation_).
+  ::grpc::ServerAsyncResponseWriter<SharedMemoryReply> responder_;
+};
+
 StatusOr<std::unique_ptr<Communicator::ServiceImpl>>
 Communicator::ServiceImpl::Create(
     int requested_port, const std::shared_ptr<::grpc::ServerCredentials> &creds,
@@ -430,9 +618,11 @@ Communicator::ServiceImpl::Create(
 void Communicator::ServiceImpl::ServerRpcLoop() {
   // Spawn new RpcInstances for all possible RPCs to serve new clients.
   new CommunicationRpcInstance(this);
+  new CommunicationStreamRpcInstance(this);
   new DisconnectRpcInstance(this);
   new DisposeOfThreadRpcInstance(this);
   new EndPointAddressRpcInstance(this);
+  new AttachSharedMemoryRpcInstance(this);
 
   void *tag;  // uniquely identifies a request.
   bool ok;
@@ -51,6 +51,11 @@ class Communicator::ServiceImpl
 
   void StartInvocation(CommunicationMessagePtr wrapped_message);
 
+  // Responds to the request in |wrapped_message| with |status| without
+  // running it.
+  void RejectInvocation(CommunicationMessagePtr wrapped_message,
+                        const Status &status);
+
   // Main loop that retrieves asynchronous RPC calls from completion queue and
   // dispatches them for processesing. It is expected that the host side of
   // the Communicator will create a dedicated thread to run ServerRpcLoop, while
@@ -85,7 +90,9 @@ class Communicator::ServiceImpl
   class RpcInstance;
 
   // Classes for all supported RPC calls.
+  class AttachSharedMemoryRpcInstance;
   class CommunicationRpcInstance;
+  class CommunicationStreamRpcInstance;
   class DisconnectRpcInstance;
   class DisposeOfThreadRpcInstance;
   class EndPointAddressRpcInstance;
@@ -98,6 +105,9 @@ class Communicator::ServiceImpl
 
   void RecordEndPointAddress(absl::string_view address);
 
+  // Sends the |response| to an Invocation to the counterpart.
+  void SendResponse(const CommunicationMessage &response);
+
   // Request handler provided by the caller.
   std::function<void(std::unique_ptr<Invocation> invocation)> handler_;
 
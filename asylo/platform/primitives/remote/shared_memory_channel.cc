@@ -0,0 +1,417 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/primitives/remote/shared_memory_channel.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <new>
+
+#include "absl/memory/memory.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "asylo/platform/common/futex.h"
+#include "asylo/util/posix_errors.h"
+#include "asylo/util/status_macros.h"
+
+namespace asylo {
+namespace primitives {
+namespace {
+
+constexpr uint64_t kMagic = 0x414c5953484d454dULL;  // "ALYSHMEM"
+constexpr size_t kTokenSize = 16;
+
+// Offset of the first ring in the region, which leaves the first page to the
+// header.
+constexpr size_t kDataOffset = 4096;
+
+// Largest record the channel carries. Records may be larger than a ring, but
+// the receiver allocates the length announced by the sender up front, so the
+// length is bounded.
+constexpr uint32_t kMaxRecordSize = 64 << 20;
+
+constexpr char kBootIdFile[] = "/proc/sys/kernel/random/boot_id";
+
+// A side waiting for the other checks the ring up to kSpinCount times before
+// sleeping on a futex, since both sleeping and waking are system calls. On a
+// single core spinning only delays the other side, so it is skipped.
+constexpr int kSpinCount = 1000;
+
+int SpinCount() {
+  static const int spin_count =
+      sysconf(_SC_NPROCESSORS_ONLN) > 1 ? kSpinCount : 0;
+  return spin_count;
+}
+
+StatusOr<std::string> ReadBootId() {
+  int fd = open(kBootIdFile, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return LastPosixError(absl::StrCat("Failed to open ", kBootIdFile));
+  }
+  char buffer[64];
+  ssize_t size = read(fd, buffer, sizeof(buffer));
+  close(fd);
+  if (size <= 0) {
+    return LastPosixError(absl::StrCat("Failed to read ", kBootIdFile));
+  }
+  return std::string(buffer, size);
+}
+
+// Copies |size| bytes from |data| to the ring of |ring_size| bytes at |ring|,
+// starting at stream position |position|.
+void CopyToRing(uint8_t *ring, uint64_t ring_size, uint64_t position,
+                const uint8_t *data, size_t size) {
+  const size_t offset = position % ring_size;
+  const size_t first = std::min<size_t>(size, ring_size - offset);
+  memcpy(ring + offset, data, first);
+  memcpy(ring, data + first, size - first);
+}
+
+// Copies |size| bytes starting at stream position |position| from the ring of
+// |ring_size| bytes at |ring| to |data|.
+void CopyFromRing(const uint8_t *ring, uint64_t ring_size, uint64_t position,
+                  uint8_t *data, size_t size) {
+  const size_t offset = position % ring_size;
+  const size_t first = std::min<size_t>(size, ring_size - offset);
+  memcpy(data, ring + offset, first);
+  memcpy(data + first, ring, size - first);
+}
+
+}  // namespace
+
+// One direction of the channel. The atomics are lock-free, so they work across
+// processes.
+struct SharedMemoryChannel::Ring {
+  // Number of bytes ever written to and read from the ring. Only the sender
+  // advances |head|, and only the receiver advances |tail|. Each is on its own
+  // cache line, to avoid false sharing between the two sides.
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+
+  // Futex words changed whenever the ring becomes readable or writable, and
+  // the number of threads sleeping on each.
+  alignas(64) int32_t readable_futex;
+  std::atomic<uint32_t> waiting_readers;
+  alignas(64) int32_t writable_futex;
+  std::atomic<uint32_t> waiting_writers;
+};
+
+struct SharedMemoryChannel::Header {
+  uint64_t magic;
+  uint64_t ring_size;
+  uint8_t token[kTokenSize];
+  std::atomic<uint32_t> closed;
+
+  // The creator of the region sends over the first ring and receives from the
+  // second.
+  Ring rings[2];
+};
+
+StatusOr<std::unique_ptr<SharedMemoryChannel>> SharedMemoryChannel::Create(
+    size_t ring_size) {
+  static_assert(sizeof(Header) <= kDataOffset,
+                "Shared memory header does not fit before the rings");
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Shared memory channel requires lock-free atomics");
+  if (ring_size == 0) {
+    return Status{absl::StatusCode::kInvalidArgument,
+                  "Ring size must be positive"};
+  }
+  std::string boot_id;
+  ASYLO_ASSIGN_OR_RETURN(boot_id, ReadBootId());
+
+  int fd = memfd_create("asylo_communicator", MFD_CLOEXEC);
+  if (fd < 0) {
+    return LastPosixError("Failed to create shared memory");
+  }
+  const size_t region_size = kDataOffset + 2 * ring_size;
+  if (ftruncate(fd, region_size) != 0) {
+    Status status = LastPosixError("Failed to size shared memory");
+    close(fd);
+    return status;
+  }
+  void *region =
+      mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED) {
+    Status status = LastPosixError("Failed to map shared memory");
+    close(fd);
+    return status;
+  }
+
+  // The file is zero-filled, which is the initial state of the rings.
+  Header *header = new (region) Header;
+  header->magic = kMagic;
+  header->ring_size = ring_size;
+  absl::BitGen generator;
+  for (uint8_t &byte : header->token) {
+    byte = absl::Uniform<uint8_t>(generator);
+  }
+
+  std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel(
+      fd, region, region_size, ring_size, /*is_creator=*/true));
+  channel->boot_id_ = std::move(boot_id);
+  return std::move(channel);
+}
+
+StatusOr<std::unique_ptr<SharedMemoryChannel>> SharedMemoryChannel::Attach(
+    const SharedMemoryOffer &offer) {
+  std::string boot_id;
+  ASYLO_ASSIGN_OR_RETURN(boot_id, ReadBootId());
+  if (boot_id != offer.boot_id()) {
+    return Status{absl::StatusCode::kFailedPrecondition,
+                  "Shared memory was created on another machine"};
+  }
+  if (offer.token().size() != kTokenSize) {
+    return Status{absl::StatusCode::kInvalidArgument,
+                  "Shared memory token has the wrong size"};
+  }
+
+  // The descriptor may refer to anything if the creator runs in another PID
+  // namespace, so avoid blocking on it and check what it is before use.
+  const std::string path =
+      absl::StrCat("/proc/", offer.pid(), "/fd/", offer.fd());
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0) {
+    return LastPosixError(absl::StrCat("Failed to open ", path));
+  }
+  struct stat stat_buffer;
+  if (fstat(fd, &stat_buffer) != 0 || !S_ISREG(stat_buffer.st_mode) ||
+      stat_buffer.st_size <= static_cast<off_t>(kDataOffset)) {
+    close(fd);
+    return Status{absl::StatusCode::kFailedPrecondition,
+                  absl::StrCat(path, " is not shared memory")};
+  }
+  const size_t region_size = stat_buffer.st_size;
+  void *region =
+      mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED) {
+    Status status = LastPosixError("Failed to map shared memory");
+    close(fd);
+    return status;
+  }
+
+  const Header *header = static_cast<const Header *>(region);
+  const uint64_t ring_size = header->ring_size;
+  if (ring_size == 0 || header->magic != kMagic ||
+      memcmp(header->token, offer.token().data(), kTokenSize) != 0 ||
+      ring_size != (region_size - kDataOffset) / 2 ||
+      (region_size - kDataOffset) % 2 != 0) {
+    munmap(region, region_size);
+    close(fd);
+    return Status{absl::StatusCode::kFailedPrecondition,
+                  absl::StrCat(path, " is not the shared memory offered")};
+  }
+  // The counterpart may change the header at any time, so the ring size that
+  // was checked is the one used from now on.
+  return absl::WrapUnique(new SharedMemoryChannel(
+      fd, region, region_size, ring_size, /*is_creator=*/false));
+}
+
+SharedMemoryChannel::SharedMemoryChannel(int fd, void *region,
+                                         size_t region_size, uint64_t ring_size,
+                                         bool is_creator)
+    : fd_(fd),
+      region_(region),
+      region_size_(region_size),
+      header_(static_cast<Header *>(region)),
+      ring_size_(ring_size),
+      send_ring_(&header_->rings[is_creator ? 0 : 1]),
+      receive_ring_(&header_->rings[is_creator ? 1 : 0]),
+      send_data_(static_cast<uint8_t *>(region) + kDataOffset +
+                 (is_creator ? 0 : ring_size_)),
+      receive_data_(static_cast<uint8_t *>(region) + kDataOffset +
+                    (is_creator ? ring_size_ : 0)) {}
+
+SharedMemoryChannel::~SharedMemoryChannel() {
+  Close();
+  munmap(region_, region_size_);
+  close(fd_);
+}
+
+SharedMemoryOffer SharedMemoryChannel::offer() const {
+  SharedMemoryOffer offer;
+  offer.set_boot_id(boot_id_);
+  offer.set_pid(getpid());
+  offer.set_fd(fd_);
+  offer.set_token(header_->token, kTokenSize);
+  return offer;
+}
+
+Status SharedMemoryChannel::Send(absl::Span<const Extent> parts) {
+  uint64_t size = 0;
+  for (const Extent &part : parts) {
+    size += part.size();
+  }
+  if (size > kMaxRecordSize) {
+    return Status{absl::StatusCode::kInvalidArgument,
+                  "Record is too large for shared memory"};
+  }
+  const uint32_t length = size;
+  absl::MutexLock lock(&send_mu_);
+  ASYLO_RETURN_IF_ERROR(Write(&length, sizeof(length)));
+  for (const Extent &part : parts) {
+    ASYLO_RETURN_IF_ERROR(Write(part.data(), part.size()));
+  }
+  return absl::OkStatus();
+}
+
+Status SharedMemoryChannel::Receive(std::string *record) {
+  uint32_t length;
+  ASYLO_RETURN_IF_ERROR(Read(&length, sizeof(length)));
+  if (length > kMaxRecordSize) {
+    return Corrupted("Record length in shared memory is too large");
+  }
+  record->resize(length);
+  return Read(&(*record)[0], length);
+}
+
+void SharedMemoryChannel::Close() {
+  if (header_->closed.exchange(1) != 0) {
+    return;
+  }
+  // Threads of both sides may be sleeping on any of the futexes.
+  for (Ring &ring : header_->rings) {
+    for (int32_t *futex : {&ring.readable_futex, &ring.writable_futex}) {
+      __atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+      sys_futex_wake(futex, INT32_MAX);
+    }
+  }
+}
+
+Status SharedMemoryChannel::Write(const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    const uint64_t head = send_ring_->head.load(std::memory_order_relaxed);
+    uint64_t room = 0;
+    bool corrupted = false;
+    if (!Wait(
+            [this, head, &room, &corrupted] {
+              const uint64_t used = head - send_ring_->tail.load();
+              corrupted = used > ring_size_;
+              room = corrupted ? 0 : ring_size_ - used;
+              return corrupted || room > 0;
+            },
+            &send_ring_->waiting_writers, &send_ring_->writable_futex)) {
+      return Status{absl::StatusCode::kCancelled, "Channel closed"};
+    }
+    if (corrupted) {
+      return Corrupted("Send ring positions in shared memory are invalid");
+    }
+    const size_t chunk = std::min<uint64_t>(size, room);
+    CopyToRing(send_data_, ring_size_, head, bytes, chunk);
+    send_ring_->head.store(head + chunk);
+    Wake(send_ring_->waiting_readers, &send_ring_->readable_futex);
+    bytes += chunk;
+    size -= chunk;
+  }
+  return absl::OkStatus();
+}
+
+Status SharedMemoryChannel::Read(void *data, size_t size) {
+  uint8_t *bytes = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    const uint64_t tail = receive_ring_->tail.load(std::memory_order_relaxed);
+    uint64_t available = 0;
+    bool corrupted = false;
+    if (!Wait(
+            [this, tail, &available, &corrupted] {
+              available = receive_ring_->head.load() - tail;
+              corrupted = available > ring_size_;
+              return corrupted || available > 0;
+            },
+            &receive_ring_->waiting_readers, &receive_ring_->readable_futex)) {
+      return Status{absl::StatusCode::kCancelled, "Channel closed"};
+    }
+    if (corrupted) {
+      return Corrupted("Receive ring positions in shared memory are invalid");
+    }
+    const size_t chunk = std::min<uint64_t>(size, available);
+    CopyFromRing(receive_data_, ring_size_, tail, bytes, chunk);
+    receive_ring_->tail.store(tail + chunk);
+    Wake(receive_ring_->waiting_writers, &receive_ring_->writable_futex);
+    bytes += chunk;
+    size -= chunk;
+  }
+  return absl::OkStatus();
+}
+
+Status SharedMemoryChannel::Corrupted(absl::string_view message) {
+  Close();
+  return Status{absl::StatusCode::kDataLoss, message};
+}
+
+template <typename Predicate>
+bool SharedMemoryChannel::Wait(Predicate ready, std::atomic<uint32_t> *waiters,
+                               int32_t *futex) {
+  for (int i = 0, spin_count = SpinCount();; ++i) {
+    if (header_->closed.load(std::memory_order_relaxed) != 0) {
+      return false;
+    }
+    if (ready()) {
+      return true;
+    }
+    if (i >= spin_count) {
+      break;
+    }
+    __builtin_ia32_pause();
+  }
+
+  // Registering as a waiter before checking the ring guarantees that either
+  // this thread observes the other side's progress, or the other side observes
+  // the waiter and wakes it.
+  waiters->fetch_add(1);
+  bool result;
+  while (true) {
+    // The futex word must be read before the ring, so that a wake-up between
+    // the two reads changes it and the wait below returns immediately.
+    int32_t sequence = __atomic_load_n(futex, __ATOMIC_SEQ_CST);
+    if (header_->closed.load() != 0) {
+      result = false;
+      break;
+    }
+    if (ready()) {
+      result = true;
+      break;
+    }
+    sys_futex_wait(futex, sequence, /*timeout_microsec=*/0);
+  }
+  waiters->fetch_sub(1);
+  return result;
+}
+
+void SharedMemoryChannel::Wake(const std::atomic<uint32_t> &waiters,
+                               int32_t *futex) {
+  // Waking is a system call, so only make it if a thread is sleeping or about
+  // to sleep.
+  if (waiters.load() == 0) {
+    return;
+  }
+  __atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+  sys_futex_wake(futex, 1);
+}
+
+}  // namespace primitives
+}  // namespace asylo
@@ -0,0 +1,144 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_PRIMITIVES_REMOTE_SHARED_MEMORY_CHANNEL_H_
+#define ASYLO_PLATFORM_PRIMITIVES_REMOTE_SHARED_MEMORY_CHANNEL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "asylo/platform/primitives/extent.h"
+#include "asylo/platform/primitives/remote/grpc_service.pb.h"
+#include "asylo/util/status.h"
+#include "asylo/util/statusor.h"
+
+namespace asylo {
+namespace primitives {
+
+// A duplex channel carrying records between two processes on the same machine
+// through a shared-memory region, without system calls unless one side has to
+// wait for the other.
+//
+// The region is an anonymous file created with memfd_create() by one process,
+// which the other opens through /proc/<pid>/fd/<fd> as described by the
+// SharedMemoryOffer of the creator. It holds one ring buffer for each
+// direction. Records are written to a ring as a stream of bytes, so a record
+// may be larger than the ring: the sender waits for the receiver to consume
+// earlier bytes whenever the ring is full. A side waiting for the other spins
+// briefly, then sleeps on a futex in the region, which the other side wakes
+// only when it has registered as a waiter.
+//
+// Send() is thread-safe. Receive() must not be called concurrently with
+// itself. Once either side calls Close(), all pending and subsequent calls on
+// both sides fail with CANCELLED.
+//
+// The counterpart can write to the whole region, so every ring position and
+// record length read from it is checked before use. If one is invalid, the
+// call fails with DATA_LOSS and the channel is closed.
+class SharedMemoryChannel {
+ public:
+  // Creates a region with rings of |ring_size| bytes each.
+  static StatusOr<std::unique_ptr<SharedMemoryChannel>> Create(
+      size_t ring_size);
+
+  // Opens the region described by |offer|, which was created by another
+  // process. Fails if that process runs on another machine, or if the region
+  // cannot be opened or does not carry the token of |offer|.
+  static StatusOr<std::unique_ptr<SharedMemoryChannel>> Attach(
+      const SharedMemoryOffer &offer);
+
+  ~SharedMemoryChannel();
+
+  SharedMemoryChannel(const SharedMemoryChannel &other) = delete;
+  SharedMemoryChannel &operator=(const SharedMemoryChannel &other) = delete;
+
+  // Returns the description of the region for the counterpart to Attach() to.
+  // Only meaningful on the side which created the region.
+  SharedMemoryOffer offer() const;
+
+  // Sends a record made of the concatenation of |parts|. Returns once the
+  // whole record is in the ring, which may require the counterpart to consume
+  // part of it first. Records are limited to 64 MB, well above what gRPC
+  // accepts by default.
+  Status Send(absl::Span<const Extent> parts);
+
+  // Waits for the next record and stores it in |record|.
+  Status Receive(std::string *record);
+
+  // Closes the channel on both sides, waking any thread waiting on it.
+  // Repeated calls have no effect.
+  void Close();
+
+ private:
+  // Layout of the region shared by the two processes.
+  struct Ring;
+  struct Header;
+
+  SharedMemoryChannel(int fd, void *region, size_t region_size,
+                      uint64_t ring_size, bool is_creator);
+
+  // Writes |size| bytes to the ring the channel sends over.
+  Status Write(const void *data, size_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(send_mu_);
+
+  // Reads |size| bytes from the ring the channel receives from.
+  Status Read(void *data, size_t size);
+
+  // Closes the channel after the counterpart left the region in an invalid
+  // state, and returns a DATA_LOSS error with |message|.
+  Status Corrupted(absl::string_view message);
+
+  // Waits until |ready| returns true or the channel is closed, returning false
+  // in the latter case. |waiters| counts the threads sleeping on |futex|.
+  template <typename Predicate>
+  bool Wait(Predicate ready, std::atomic<uint32_t> *waiters, int32_t *futex);
+
+  // Wakes a thread sleeping on |futex|, if |waiters| indicates there may be
+  // one.
+  static void Wake(const std::atomic<uint32_t> &waiters, int32_t *futex);
+
+  // The descriptor of the region and its mapping.
+  const int fd_;
+  void *const region_;
+  const size_t region_size_;
+
+  Header *const header_;
+  const uint64_t ring_size_;
+  Ring *const send_ring_;
+  Ring *const receive_ring_;
+  uint8_t *const send_data_;
+  uint8_t *const receive_data_;
+
+  // Serializes writers, so that records are not interleaved.
+  absl::Mutex send_mu_;
+
+  // Contents of /proc/sys/kernel/random/boot_id, set on the creator only.
+  std::string boot_id_;
+};
+
+}  // namespace primitives
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_PRIMITIVES_REMOTE_SHARED_MEMORY_CHANNEL_H_
@@ -0,0 +1,187 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/primitives/remote/shared_memory_channel.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/status/status.h"
+#include "asylo/platform/primitives/extent.h"
+#include "asylo/platform/primitives/remote/grpc_service.pb.h"
+#include "asylo/test/util/status_matchers.h"
+
+namespace asylo {
+namespace primitives {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Not;
+
+constexpr size_t kRingSize = 64;
+
+// Returns a record of |size| bytes, whose contents depend on |seed|.
+std::string MakeRecord(size_t size, int seed) {
+  std::string record(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    record[i] = static_cast<char>(seed * 31 + i);
+  }
+  return record;
+}
+
+// Sends each record of |records| over |channel|, in two parts.
+void SendRecords(SharedMemoryChannel *channel,
+                 const std::vector<std::string> &records) {
+  for (const std::string &record : records) {
+    const size_t half = record.size() / 2;
+    std::vector<Extent> parts = {
+        Extent(record.data(), half),
+        Extent(record.data() + half, record.size() - half)};
+    ASYLO_ASSERT_OK(channel->Send(parts));
+  }
+}
+
+// Receives records over |channel| and expects them to match |records|.
+void ExpectRecords(SharedMemoryChannel *channel,
+                   const std::vector<std::string> &records) {
+  std::string received;
+  for (const std::string &record : records) {
+    ASYLO_ASSERT_OK(channel->Receive(&received));
+    EXPECT_THAT(received, Eq(record));
+  }
+}
+
+// Ensure that records of any size, including ones larger than the ring, are
+// received intact and in order in both directions at once.
+TEST(SharedMemoryChannelTest, SendsRecordsBothWays) {
+  std::unique_ptr<SharedMemoryChannel> creator;
+  ASYLO_ASSERT_OK_AND_ASSIGN(creator, SharedMemoryChannel::Create(kRingSize));
+  std::unique_ptr<SharedMemoryChannel> attached;
+  ASYLO_ASSERT_OK_AND_ASSIGN(attached,
+                             SharedMemoryChannel::Attach(creator->offer()));
+
+  std::vector<std::string> records;
+  for (int i = 0; i < 200; ++i) {
+    records.push_back(MakeRecord((i * 37) % (4 * kRingSize), i));
+  }
+
+  std::thread creator_sender(
+      [&creator, &records] { SendRecords(creator.get(), records); });
+  std::thread attached_sender(
+      [&attached, &records] { SendRecords(attached.get(), records); });
+  ExpectRecords(attached.get(), records);
+  ExpectRecords(creator.get(), records);
+  creator_sender.join();
+  attached_sender.join();
+}
+
+// Ensure that records sent concurrently by several threads are not
+// interleaved.
+TEST(SharedMemoryChannelTest, ConcurrentSendersDoNotInterleave) {
+  constexpr int kThreads = 4;
+  constexpr int kRecordsPerThread = 100;
+  std::unique_ptr<SharedMemoryChannel> creator;
+  ASYLO_ASSERT_OK_AND_ASSIGN(creator, SharedMemoryChannel::Create(kRingSize));
+  std::unique_ptr<SharedMemoryChannel> attached;
+  ASYLO_ASSERT_OK_AND_ASSIGN(attached,
+                             SharedMemoryChannel::Attach(creator->offer()));
+
+  std::vector<std::thread> senders;
+  for (int thread = 0; thread < kThreads; ++thread) {
+    senders.emplace_back([&creator, thread] {
+      for (int i = 0; i < kRecordsPerThread; ++i) {
+        std::string record(kRingSize + thread, static_cast<char>(thread));
+        ASYLO_ASSERT_OK(creator->Send({Extent(record.data(), record.size())}));
+      }
+    });
+  }
+  std::string received;
+  for (int i = 0; i < kThreads * kRecordsPerThread; ++i) {
+    ASYLO_ASSERT_OK(attached->Receive(&received));
+    ASSERT_FALSE(received.empty());
+    const char thread = received[0];
+    EXPECT_THAT(received, Eq(std::string(kRingSize + thread, thread)));
+  }
+  for (auto &sender : senders) {
+    sender.join();
+  }
+}
+
+// Ensure that closing either side wakes threads waiting on the other, and
+// fails later calls.
+TEST(SharedMemoryChannelTest, CloseWakesWaiters) {
+  std::unique_ptr<SharedMemoryChannel> creator;
+  ASYLO_ASSERT_OK_AND_ASSIGN(creator, SharedMemoryChannel::Create(kRingSize));
+  std::unique_ptr<SharedMemoryChannel> attached;
+  ASYLO_ASSERT_OK_AND_ASSIGN(attached,
+                             SharedMemoryChannel::Attach(creator->offer()));
+
+  std::thread receiver([&attached] {
+    std::string record;
+    EXPECT_THAT(attached->Receive(&record),
+                StatusIs(absl::StatusCode::kCancelled));
+  });
+  std::thread sender([&attached] {
+    // The record does not fit in the ring, and is never received.
+    std::string record(2 * kRingSize, 'x');
+    EXPECT_THAT(attached->Send({Extent(record.data(), record.size())}),
+                StatusIs(absl::StatusCode::kCancelled));
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  creator->Close();
+  receiver.join();
+  sender.join();
+
+  std::string record;
+  EXPECT_THAT(creator->Receive(&record),
+              StatusIs(absl::StatusCode::kCancelled));
+  EXPECT_THAT(creator->Send({}), StatusIs(absl::StatusCode::kCancelled));
+}
+
+// Ensure that an offer is rejected unless it comes from the same machine and
+// identifies the region.
+TEST(SharedMemoryChannelTest, AttachVerifiesOffer) {
+  std::unique_ptr<SharedMemoryChannel> creator;
+  ASYLO_ASSERT_OK_AND_ASSIGN(creator, SharedMemoryChannel::Create(kRingSize));
+
+  SharedMemoryOffer offer = creator->offer();
+  offer.set_boot_id("another machine");
+  EXPECT_THAT(SharedMemoryChannel::Attach(offer),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+
+  offer = creator->offer();
+  std::string token = offer.token();
+  token[0] ^= 1;
+  offer.set_token(token);
+  EXPECT_THAT(SharedMemoryChannel::Attach(offer),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+
+  offer = creator->offer();
+  offer.set_fd(-1);
+  EXPECT_THAT(SharedMemoryChannel::Attach(offer), Not(IsOk()));
+}
+
+}  // namespace
+}  // namespace primitives
+}  // namespace asylo
@@ -20,6 +20,7 @@
 
 #include "absl/status/status.h"
 #include "asylo/enclave.pb.h"
+#include "asylo/platform/host_call/untrusted/switchless_host_call_server.h"
 #include "asylo/platform/primitives/sgx/loader.pb.h"
 #include "asylo/platform/primitives/sgx/untrusted_sgx.h"
 #include "asylo/platform/primitives/untrusted_primitives.h"
@@ -72,6 +73,13 @@ StatusOr<std::shared_ptr<Client>> LoadEnclave(
   } else {
     return absl::InvalidArgumentError("SGX enclave source not set");
   }
+
+  if (enclave_config.switchless_host_call_config().enabled()) {
+    ASYLO_RETURN_IF_ERROR(
+        host_call::EnableSwitchlessHostCalls(
+            primitive_client, enclave_config.switchless_host_call_config())
+            .status());
+  }
   return std::move(primitive_client);
 }
 
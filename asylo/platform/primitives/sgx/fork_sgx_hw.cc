@@ -931,6 +931,9 @@ Status TransferSecureSnapshotKey(
   options.self_assertions.push_back(description);
   options.accepted_peer_assertions.push_back(description);
 
+  // The record protocol key is used as an AES-GCM key below.
+  options.record_protocols = {ALTSRP_AES128_GCM};
+
   // Create an EkepHandshaker based on whether the enclave is parent or child.
   // The parent enclave acts as the client, since the parent enclave will
   // initialize the handshake. The child enclave acts as the server.
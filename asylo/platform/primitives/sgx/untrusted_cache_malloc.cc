@@ -20,6 +20,7 @@
 #include <cstdlib>
 #include <memory>
 
+#include "absl/base/attributes.h"
 #include "absl/memory/memory.h"
 #include "asylo/platform/core/trusted_spin_lock.h"
 #include "asylo/platform/posix/memory/memory.h"
@@ -46,11 +47,61 @@ void untrusted_cache_free(void *buffer) {
 }  // extern "C"
 
 namespace asylo {
+namespace {
+
+// Increments a counter which is only written by the calling thread but may be
+// read concurrently by other threads.
+void Increment(std::atomic<uint64_t> *counter) {
+  counter->store(counter->load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+}
+
+}  // namespace
 
 using primitives::TrustedPrimitives;
 
+struct UntrustedCacheMalloc::Magazine {
+  int count = 0;
+  void *blocks[kMagazineCapacity];
+  // Next magazine in a depot stack.
+  Magazine *next = nullptr;
+};
+
+struct UntrustedCacheMalloc::ThreadCache {
+  Magazine *magazines[kNumSizeClasses];
+  std::atomic<uint64_t> allocations[kNumSizeClasses];
+  std::atomic<uint64_t> frees[kNumSizeClasses];
+  // Neighbours in the list of live thread caches.
+  ThreadCache *prev = nullptr;
+  ThreadCache *next = nullptr;
+};
+
+struct UntrustedCacheMalloc::Depot {
+  TrustedSpinLock lock{/*is_recursive=*/false};
+  // Stacks of non-empty and empty magazines. Magazines of exited threads and
+  // magazines holding blocks returned while the pool is bypassed may be
+  // partially filled.
+  Magazine *full = nullptr;
+  Magazine *empty = nullptr;
+  uint64_t full_count = 0;
+  // Blocks of the current slab which have not been handed out yet.
+  char *next_block = nullptr;
+  char *slab_end = nullptr;
+  uint64_t slabs = 0;
+  uint64_t exchanges = 0;
+  // Counters of exited threads and of blocks returned directly to the depot.
+  uint64_t allocations = 0;
+  uint64_t frees = 0;
+};
+
 bool UntrustedCacheMalloc::is_destroyed_ = false;
 
+std::atomic<uintptr_t>
+    UntrustedCacheMalloc::slab_table_[UntrustedCacheMalloc::kSlabTableSize];
+
+ABSL_CONST_INIT thread_local UntrustedCacheMalloc::ThreadCache
+    *UntrustedCacheMalloc::thread_cache_ = nullptr;
+
 UntrustedCacheMalloc *UntrustedCacheMalloc::Instance() {
   static TrustedSpinLock lock(/*is_recursive=*/false);
   static UntrustedCacheMalloc *instance = nullptr;
@@ -63,10 +114,24 @@ UntrustedCacheMalloc *UntrustedCacheMalloc::Instance() {
   return instance;
 }
 
-UntrustedCacheMalloc::UntrustedCacheMalloc() : lock_(/*is_recursive=*/true) {
+UntrustedCacheMalloc::UntrustedCacheMalloc()
+    : thread_caches_lock_(/*is_recursive=*/false),
+      thread_caches_(nullptr),
+      thread_count_(0),
+      has_thread_cache_key_(false),
+      regions_lock_(/*is_recursive=*/false),
+      region_count_(0),
+      next_slab_(nullptr),
+      regions_end_(nullptr),
+      direct_allocations_(0),
+      free_list_lock_(/*is_recursive=*/false) {
   if (is_destroyed_) {
     return;
   }
+  depots_ = absl::make_unique<Depot[]>(kNumSizeClasses);
+  has_thread_cache_key_ =
+      pthread_key_create(&thread_cache_key_, &ReleaseThreadCache) == 0;
+
   // Initialize a free list object in the trusted heap. The free list object
   // stores an array of buffers stored in the untrusted heap.
   free_list_ = absl::make_unique<FreeList>();
@@ -77,9 +142,39 @@ UntrustedCacheMalloc::UntrustedCacheMalloc() : lock_(/*is_recursive=*/true) {
 }
 
 UntrustedCacheMalloc::~UntrustedCacheMalloc() {
-  while (!buffer_pool_.empty()) {
-    PushToFreeList(buffer_pool_.top());
-    buffer_pool_.pop();
+  // Blocks still in use keep their regions alive. Thread caches and magazines
+  // live in the trusted heap and are released regardless.
+  uint64_t blocks_in_use = 0;
+  if (has_thread_cache_key_) {
+    pthread_key_delete(thread_cache_key_);
+  }
+  for (ThreadCache *cache = thread_caches_; cache;) {
+    for (int i = 0; i < kNumSizeClasses; ++i) {
+      blocks_in_use += cache->allocations[i].load(std::memory_order_relaxed);
+      blocks_in_use -= cache->frees[i].load(std::memory_order_relaxed);
+      delete cache->magazines[i];
+    }
+    ThreadCache *next = cache->next;
+    delete cache;
+    cache = next;
+  }
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    blocks_in_use += depots_[i].allocations;
+    blocks_in_use -= depots_[i].frees;
+    for (Magazine *stack : {depots_[i].full, depots_[i].empty}) {
+      while (stack) {
+        Magazine *next = stack->next;
+        delete stack;
+        stack = next;
+      }
+    }
+  }
+
+  LockGuard guard(&free_list_lock_);
+  if (blocks_in_use == 0) {
+    for (int i = 0; i < region_count_; ++i) {
+      PushToFreeList(regions_[i]);
+    }
   }
 
   // Free remaining elements in the free_list_.
@@ -92,47 +187,264 @@ UntrustedCacheMalloc::~UntrustedCacheMalloc() {
   is_destroyed_ = true;
 }
 
-void *UntrustedCacheMalloc::GetBuffer() {
-  void **buffers = nullptr;
-  void *buffer;
-  bool is_pool_empty;
+int UntrustedCacheMalloc::SizeClass(size_t size) {
+  int size_class = 0;
+  for (size_t block_size = kMinBlockSize; block_size < size; block_size <<= 1) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+size_t UntrustedCacheMalloc::SlabTableIndex(uintptr_t slab) {
+  // Fibonacci hashing of the slab number.
+  return ((slab / kSlabSize) * 0x9e3779b97f4a7c15ULL) >> (64 - kSlabTableBits);
+}
+
+int UntrustedCacheMalloc::LookupSizeClass(const void *buffer) {
+  uintptr_t slab = reinterpret_cast<uintptr_t>(buffer) & ~(kSlabSize - 1);
+  if (slab == 0) {
+    return -1;
+  }
+  // Slabs are inserted by a single writer at a time and never removed, so
+  // lookups need no lock.
+  size_t index = SlabTableIndex(slab);
+  while (true) {
+    uintptr_t entry = slab_table_[index].load(std::memory_order_acquire);
+    if (entry == 0) {
+      return -1;
+    }
+    if ((entry & ~(kSlabSize - 1)) == slab) {
+      return static_cast<int>(entry & (kSlabSize - 1)) - 1;
+    }
+    index = (index + 1) & (kSlabTableSize - 1);
+  }
+}
+
+UntrustedCacheMalloc::ThreadCache *UntrustedCacheMalloc::GetThreadCache() {
+  if (thread_cache_) {
+    return thread_cache_;
+  }
+  auto cache = new ThreadCache();
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    cache->magazines[i] = new Magazine();
+    cache->allocations[i].store(0, std::memory_order_relaxed);
+    cache->frees[i].store(0, std::memory_order_relaxed);
+  }
+  {
+    LockGuard guard(&thread_caches_lock_);
+    cache->next = thread_caches_;
+    if (thread_caches_) {
+      thread_caches_->prev = cache;
+    }
+    thread_caches_ = cache;
+    ++thread_count_;
+  }
+  thread_cache_ = cache;
+  if (has_thread_cache_key_) {
+    pthread_setspecific(thread_cache_key_, cache);
+  }
+  return cache;
+}
+
+void UntrustedCacheMalloc::ReleaseThreadCache(void *cache_ptr) {
+  auto cache = static_cast<ThreadCache *>(cache_ptr);
+  if (thread_cache_ == cache) {
+    thread_cache_ = nullptr;
+  }
+  if (is_destroyed_) {
+    // The destructor has already released all thread caches.
+    return;
+  }
+  UntrustedCacheMalloc *instance = Instance();
 
   {
-    LockGuard spin_lock(&lock_);
-    is_pool_empty = buffer_pool_.empty();
-    if (is_pool_empty) {
-      buffers =
-          primitives::AllocateUntrustedBuffers(kPoolIncrement, kPoolEntrySize);
-      for (int i = 0; i < kPoolIncrement; i++) {
-        void *buf = buffers[i];
-        if (!buf || !TrustedPrimitives::IsOutsideEnclave(buf, kPoolEntrySize)) {
-          TrustedPrimitives::BestEffortAbort(
-              "Cached buffer is not outside the enclave");
-        }
-        buffer_pool_.push(buf);
+    LockGuard guard(&instance->thread_caches_lock_);
+    if (cache->prev) {
+      cache->prev->next = cache->next;
+    } else {
+      instance->thread_caches_ = cache->next;
+    }
+    if (cache->next) {
+      cache->next->prev = cache->prev;
+    }
+  }
+
+  // GetStats may briefly miss the exiting thread's counters until they are
+  // added to the depots.
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    Depot *depot = &instance->depots_[i];
+    Magazine *magazine = cache->magazines[i];
+    LockGuard guard(&depot->lock);
+    depot->allocations += cache->allocations[i].load(std::memory_order_relaxed);
+    depot->frees += cache->frees[i].load(std::memory_order_relaxed);
+    if (magazine->count > 0) {
+      magazine->next = depot->full;
+      depot->full = magazine;
+      ++depot->full_count;
+    } else {
+      magazine->next = depot->empty;
+      depot->empty = magazine;
+    }
+  }
+  delete cache;
+}
+
+char *UntrustedCacheMalloc::AllocateSlab(int size_class) {
+  void **buffers = nullptr;
+  char *slab = nullptr;
+  {
+    LockGuard guard(&regions_lock_);
+    if (next_slab_ == regions_end_) {
+      if (region_count_ == kMaxRegions) {
+        return nullptr;
       }
+      // Over-allocate by one slab so that the region can be aligned.
+      constexpr size_t kRegionSize = (kSlabsPerRegion + 1) * kSlabSize;
+      buffers = primitives::AllocateUntrustedBuffers(1, kRegionSize);
+      void *region = buffers[0];
+      if (!region ||
+          !TrustedPrimitives::IsOutsideEnclave(region, kRegionSize)) {
+        TrustedPrimitives::BestEffortAbort(
+            "Cached region is not outside the enclave");
+      }
+      regions_[region_count_++] = region;
+      uintptr_t aligned =
+          (reinterpret_cast<uintptr_t>(region) + kSlabSize - 1) &
+          ~(kSlabSize - 1);
+      next_slab_ = reinterpret_cast<char *>(aligned);
+      regions_end_ = next_slab_ + kSlabsPerRegion * kSlabSize;
+    }
+    slab = next_slab_;
+    next_slab_ += kSlabSize;
+
+    // Publish the slab's size class. Insertions are serialized by
+    // |regions_lock_|.
+    uintptr_t entry = reinterpret_cast<uintptr_t>(slab);
+    size_t index = SlabTableIndex(entry);
+    while (slab_table_[index].load(std::memory_order_relaxed) != 0) {
+      index = (index + 1) & (kSlabTableSize - 1);
     }
-    buffer = buffer_pool_.top();
-    buffer_pool_.pop();
-    busy_buffers_.insert(buffer);
+    slab_table_[index].store(entry | (size_class + 1),
+                             std::memory_order_release);
   }
 
-  if (is_pool_empty) {
+  if (buffers) {
     // Free memory held by the array of buffer pointers returned by
     // AllocateUntrustedBuffers.
     Free(buffers);
   }
-  return buffer;
+  return slab;
+}
+
+UntrustedCacheMalloc::Magazine *UntrustedCacheMalloc::Refill(int size_class,
+                                                             Magazine *empty) {
+  Depot *depot = &depots_[size_class];
+  LockGuard guard(&depot->lock);
+  ++depot->exchanges;
+  if (depot->full) {
+    Magazine *full = depot->full;
+    depot->full = full->next;
+    --depot->full_count;
+    empty->next = depot->empty;
+    depot->empty = empty;
+    return full;
+  }
+
+  const size_t block_size = kMinBlockSize << size_class;
+  while (empty->count < kMagazineCapacity) {
+    if (depot->next_block == depot->slab_end) {
+      char *slab = AllocateSlab(size_class);
+      if (!slab) {
+        break;
+      }
+      ++depot->slabs;
+      depot->next_block = slab;
+      depot->slab_end = slab + kSlabSize;
+    }
+    empty->blocks[empty->count++] = depot->next_block;
+    depot->next_block += block_size;
+  }
+  return empty->count > 0 ? empty : nullptr;
+}
+
+UntrustedCacheMalloc::Magazine *UntrustedCacheMalloc::Flush(int size_class,
+                                                            Magazine *full) {
+  Depot *depot = &depots_[size_class];
+  LockGuard guard(&depot->lock);
+  ++depot->exchanges;
+  full->next = depot->full;
+  depot->full = full;
+  ++depot->full_count;
+  if (!depot->empty) {
+    return new Magazine();
+  }
+  Magazine *empty = depot->empty;
+  depot->empty = empty->next;
+  return empty;
+}
+
+void UntrustedCacheMalloc::ReturnToDepot(int size_class, void *block) {
+  Depot *depot = &depots_[size_class];
+  LockGuard guard(&depot->lock);
+  ++depot->frees;
+  Magazine *magazine = depot->full;
+  if (!magazine || magazine->count == kMagazineCapacity) {
+    // Magazines cannot be allocated while the pool is bypassed, so take one
+    // from the empty stack.
+    magazine = depot->empty;
+    if (!magazine) {
+      // The block is lost to the pool but still counted as freed, so that it
+      // does not keep the regions alive on destruction.
+      return;
+    }
+    depot->empty = magazine->next;
+    magazine->next = depot->full;
+    depot->full = magazine;
+    ++depot->full_count;
+  }
+  magazine->blocks[magazine->count++] = block;
+}
+
+void *UntrustedCacheMalloc::AllocateBlock(int size_class) {
+  ThreadCache *cache = GetThreadCache();
+  Magazine *magazine = cache->magazines[size_class];
+  if (magazine->count == 0) {
+    magazine = Refill(size_class, magazine);
+    if (!magazine) {
+      return nullptr;
+    }
+    cache->magazines[size_class] = magazine;
+  }
+  Increment(&cache->allocations[size_class]);
+  return magazine->blocks[--magazine->count];
+}
+
+void UntrustedCacheMalloc::FreeBlock(int size_class, void *block) {
+  ThreadCache *cache = GetThreadCache();
+  Magazine *magazine = cache->magazines[size_class];
+  if (magazine->count == kMagazineCapacity) {
+    magazine = Flush(size_class, magazine);
+    cache->magazines[size_class] = magazine;
+  }
+  Increment(&cache->frees[size_class]);
+  magazine->blocks[magazine->count++] = block;
 }
 
 void *UntrustedCacheMalloc::Malloc(size_t size) {
   // Don't access UnturstedCacheMalloc if not running on normal heap, otherwise
   // it will cause error when UntrustedCacheMalloc tries to free the memory on
   // the normal heap.
-  if (is_destroyed_ || (size > kPoolEntrySize) || GetSwitchedHeapNext()) {
+  if (is_destroyed_ || GetSwitchedHeapNext()) {
     return primitives::TrustedPrimitives::UntrustedLocalAlloc(size);
   }
-  return GetBuffer();
+  if (size <= kMaxBlockSize) {
+    void *block = AllocateBlock(SizeClass(size));
+    if (block) {
+      return block;
+    }
+  }
+  direct_allocations_.fetch_add(1, std::memory_order_relaxed);
+  return primitives::TrustedPrimitives::UntrustedLocalAlloc(size);
 }
 
 void UntrustedCacheMalloc::PushToFreeList(void *buffer) {
@@ -147,21 +459,67 @@ void UntrustedCacheMalloc::PushToFreeList(void *buffer) {
 }
 
 void UntrustedCacheMalloc::Free(void *buffer) {
+  // Blocks are parts of slabs and cannot be released to the host one by one.
+  int size_class = LookupSizeClass(buffer);
   if (is_destroyed_ || GetSwitchedHeapNext()) {
-    primitives::TrustedPrimitives::UntrustedLocalFree(buffer);
+    // Trusted memory cannot be allocated while the pool is bypassed, so blocks
+    // go to the thread's magazine only if it has room, and to the depot
+    // otherwise.
+    if (size_class < 0) {
+      primitives::TrustedPrimitives::UntrustedLocalFree(buffer);
+    } else if (is_destroyed_) {
+      // Blocks are reclaimed with their regions.
+    } else if (thread_cache_ && thread_cache_->magazines[size_class]->count <
+                                    kMagazineCapacity) {
+      FreeBlock(size_class, buffer);
+    } else {
+      ReturnToDepot(size_class, buffer);
+    }
     return;
   }
-  LockGuard spin_lock(&lock_);
 
-  // Add the buffer to the free list if it was not allocated from the buffer
-  // pool and was allocated via UntrustedLocalAlloc. If the
-  // buffer was allocated from the buffer pool push it back to the pool.
-  if (busy_buffers_.find(buffer) == busy_buffers_.end()) {
-    PushToFreeList(buffer);
+  if (size_class >= 0) {
+    FreeBlock(size_class, buffer);
     return;
   }
-  busy_buffers_.erase(buffer);
-  buffer_pool_.push(buffer);
+
+  // Add the buffer to the free list if it was not allocated from the pool and
+  // was allocated via UntrustedLocalAlloc.
+  LockGuard guard(&free_list_lock_);
+  PushToFreeList(buffer);
+}
+
+UntrustedCacheMalloc::Stats UntrustedCacheMalloc::GetStats() {
+  Stats stats = {};
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    SizeClassStats *size_class = &stats.size_classes[i];
+    size_class->block_size = kMinBlockSize << i;
+    LockGuard guard(&depots_[i].lock);
+    size_class->slabs = depots_[i].slabs;
+    size_class->depot_exchanges = depots_[i].exchanges;
+    size_class->depot_magazines = depots_[i].full_count;
+    size_class->allocations = depots_[i].allocations;
+    size_class->frees = depots_[i].frees;
+  }
+  {
+    LockGuard guard(&thread_caches_lock_);
+    for (ThreadCache *cache = thread_caches_; cache; cache = cache->next) {
+      for (int i = 0; i < kNumSizeClasses; ++i) {
+        stats.size_classes[i].allocations +=
+            cache->allocations[i].load(std::memory_order_relaxed);
+        stats.size_classes[i].frees +=
+            cache->frees[i].load(std::memory_order_relaxed);
+      }
+    }
+    stats.threads = thread_count_;
+  }
+  {
+    LockGuard guard(&regions_lock_);
+    stats.regions = region_count_;
+  }
+  stats.direct_allocations =
+      direct_allocations_.load(std::memory_order_relaxed);
+  return stats;
 }
 
 }  // namespace asylo
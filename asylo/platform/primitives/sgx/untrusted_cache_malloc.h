@@ -19,9 +19,12 @@
 #ifndef ASYLO_PLATFORM_PRIMITIVES_SGX_UNTRUSTED_CACHE_MALLOC_H_
 #define ASYLO_PLATFORM_PRIMITIVES_SGX_UNTRUSTED_CACHE_MALLOC_H_
 
+#include <pthread.h>
+
+#include <atomic>
 #include <cstddef>
-#include <stack>
-#include <unordered_set>
+#include <cstdint>
+#include <memory>
 
 #include "asylo/platform/core/trusted_spin_lock.h"
 #include "asylo/platform/primitives/sgx/trusted_sgx.h"
@@ -33,20 +36,59 @@ namespace asylo {
 // class optimizes the common case of small allocations on backends where the
 // trusted and untrusted application partitions share an address space.
 //
-// For smaller allocations, the implementation allocates memory from a buffer
-// pool maintained by the class. The buffer pool is implemented as a stack
-// of untrusted buffers.
+// Allocations of up to |kMaxBlockSize| bytes are served from a pool of blocks
+// in power-of-two size classes. Blocks are carved out of slabs, which are in
+// turn carved out of large regions of untrusted memory requested from the host
+// in a single exit. All bookkeeping is kept in trusted memory.
+//
+// Each thread caches a magazine of free blocks per size class, so that Malloc
+// and Free take no lock in the common case. A thread which frees a block
+// allocated by another thread keeps it in its own magazine. Full and empty
+// magazines are exchanged with a per size class depot, which is the only
+// shared state touched by the pool, once per |kMagazineCapacity| operations.
+// When a thread exits, its magazines are handed over to the depots.
 //
-// This class is initialized in the trusted space and manages the buffers
-// in untrusted memory 1) assigning buffers to threads requesting memory and
-// 2) pushing back buffers to the pool (for reuse) when they are requested to
-// be freed.
+// Larger allocations are forwarded to the host, and their release is batched
+// through a free list.
 class UntrustedCacheMalloc {
  public:
+  // Block sizes of the smallest and largest size classes. Size classes are
+  // spaced by powers of two.
+  static constexpr size_t kMinBlockSize = 64;
+  static constexpr size_t kMaxBlockSize = 64 * 1024;
+  static constexpr int kNumSizeClasses = 11;
+
+  // Usage statistics of a size class, aggregated over all threads.
+  struct SizeClassStats {
+    // Size of the blocks in this size class.
+    size_t block_size;
+    // Number of blocks handed out by Malloc and returned by Free.
+    uint64_t allocations;
+    uint64_t frees;
+    // Number of slabs carved into blocks of this size class.
+    uint64_t slabs;
+    // Number of magazines exchanged with the depot, and number of full
+    // magazines currently held by the depot.
+    uint64_t depot_exchanges;
+    uint64_t depot_magazines;
+  };
+
+  // Usage statistics of the allocator, intended for tuning the pool sizes.
+  struct Stats {
+    SizeClassStats size_classes[kNumSizeClasses];
+    // Number of allocations which were not served from the pool.
+    uint64_t direct_allocations;
+    // Number of regions requested from the host to back slabs.
+    uint64_t regions;
+    // Number of threads which have allocated from or freed to the pool.
+    uint64_t threads;
+  };
+
   UntrustedCacheMalloc(UntrustedCacheMalloc const &) = delete;
   UntrustedCacheMalloc &operator=(UntrustedCacheMalloc const &) = delete;
 
-  // The destructor frees all buffers in the buffer pool and the free list.
+  // The destructor frees all memory held by the pool and the free list.
+  // Regions are only released if no block is still in use.
   ~UntrustedCacheMalloc();
 
   // Returns the UntrustedCacheMalloc singleton instance.
@@ -62,19 +104,43 @@ class UntrustedCacheMalloc {
   // Releases memory on the untrusted heap.
   void Free(void *buffer);
 
+  // Returns a snapshot of the usage statistics of the allocator. Counters of
+  // other threads are read without synchronizing with them, so the snapshot
+  // may be slightly stale.
+  Stats GetStats();
+
  private:
+  // A stack of free blocks of one size class.
+  struct Magazine;
+
+  // Per-thread magazines and counters.
+  struct ThreadCache;
+
+  // Shared magazines of one size class.
+  struct Depot;
+
   struct FreeList {
     primitives::UntrustedUniquePtr<void *> buffers;
     int count;
   };
 
-  TrustedSpinLock lock_;
+  // Number of blocks held by a magazine.
+  static constexpr int kMagazineCapacity = 16;
 
-  // Number of entries added to the buffer pool when it's depleted.
-  static constexpr size_t kPoolIncrement = 1024;
+  // Size of a slab in bytes. Slabs are aligned to their size, which allows a
+  // block to be mapped to its slab by masking its address.
+  static constexpr size_t kSlabSize = 256 * 1024;
 
-  // Size of a buffer pool entry in bytes.
-  static constexpr size_t kPoolEntrySize = 4096;
+  // Number of slabs in a region, and maximum number of regions in the pool.
+  static constexpr int kSlabsPerRegion = 16;
+  static constexpr int kMaxRegions = 256;
+
+  // log2 of the number of entries in the slab table, which is kept at most
+  // half full.
+  static constexpr int kSlabTableBits = 13;
+  static constexpr size_t kSlabTableSize = size_t{1} << kSlabTableBits;
+  static_assert(kSlabTableSize >= 2 * kSlabsPerRegion * kMaxRegions,
+                "Slab table is too small for the maximum number of slabs");
 
   // Maximum entries in the free list. When this limit is reached, all memory
   // held by the pointers in the free list is freed.
@@ -85,30 +151,93 @@ class UntrustedCacheMalloc {
   // (de)allocation to the native malloc/free implementation.
   static bool is_destroyed_;
 
+  // Maps the address of every slab to its size class. Entries hold the slab
+  // address with the size class plus one stored in the low bits, and are never
+  // removed. Static so that blocks can be recognized after destruction.
+  static std::atomic<uintptr_t> slab_table_[kSlabTableSize];
+
+  // The calling thread's cache, or nullptr if it has not used the pool yet.
+  static thread_local ThreadCache *thread_cache_;
+
   UntrustedCacheMalloc();
 
-  // Returns a buffer from the pool. If no buffers are available in the pool,
-  // this function is responsible for adding new buffers to the pool before
-  // returning the buffer.
-  void *GetBuffer();
+  // Returns the size class serving allocations of |size| bytes.
+  static int SizeClass(size_t size);
+
+  // Returns the slot at which lookups for |slab| start in the slab table.
+  static size_t SlabTableIndex(uintptr_t slab);
+
+  // Returns the size class of the slab containing |buffer|, or -1 if |buffer|
+  // was not allocated from the pool.
+  static int LookupSizeClass(const void *buffer);
+
+  // Returns the cache of the calling thread, creating it if necessary.
+  ThreadCache *GetThreadCache();
+
+  // Thread-specific data destructor of |thread_cache_key_|. Hands the
+  // magazines and counters of the exiting thread's |cache| over to the depots
+  // and releases it.
+  static void ReleaseThreadCache(void *cache);
+
+  // Returns a block of |size_class| from the calling thread's magazine,
+  // refilling it from the depot if needed. Returns nullptr if the pool is
+  // exhausted.
+  void *AllocateBlock(int size_class);
+
+  // Returns |block| of |size_class| to the calling thread's magazine, flushing
+  // it to the depot if it is full.
+  void FreeBlock(int size_class, void *block);
+
+  // Exchanges the empty magazine |empty| for a full magazine from the depot,
+  // or fills it with blocks carved from slabs. Returns nullptr, leaving
+  // |empty| untouched, if no block is available.
+  Magazine *Refill(int size_class, Magazine *empty);
+
+  // Exchanges the full magazine |full| for an empty one from the depot.
+  Magazine *Flush(int size_class, Magazine *full);
+
+  // Returns |block| of |size_class| directly to the depot without allocating
+  // trusted memory, for use while the pool is bypassed.
+  void ReturnToDepot(int size_class, void *block);
+
+  // Returns a new slab for |size_class|, allocating a region from the host if
+  // needed, or nullptr if the pool has reached its maximum size.
+  char *AllocateSlab(int size_class);
 
   // Pushes |buffer| to the free list. If the free list capacity is reached,
   // this function is also responsible for first emptying the free list by
   // freeing all buffer pointers stored in the list before pushing |buffer| to
-  // the list.
+  // the list. Must be called with |free_list_lock_| held.
   void PushToFreeList(void *buffer);
 
-  // List of pointers to untrusted buffers which need to be freed.
+  // One depot per size class.
+  std::unique_ptr<Depot[]> depots_;
+
+  // List of all live thread caches, guarded by |thread_caches_lock_|.
+  TrustedSpinLock thread_caches_lock_;
+  ThreadCache *thread_caches_;
+  uint64_t thread_count_;
+
+  // Key whose destructor releases the cache of an exiting thread. Only valid
+  // if |has_thread_cache_key_| is true.
+  pthread_key_t thread_cache_key_;
+  bool has_thread_cache_key_;
+
+  // Regions allocated from the host and the not yet used part of the latest
+  // region, guarded by |regions_lock_|.
+  TrustedSpinLock regions_lock_;
+  void *regions_[kMaxRegions];
+  int region_count_;
+  char *next_slab_;
+  char *regions_end_;
+
+  // Number of allocations not served from the pool.
+  std::atomic<uint64_t> direct_allocations_;
+
+  // List of pointers to untrusted buffers which need to be freed, guarded by
+  // |free_list_lock_|.
+  TrustedSpinLock free_list_lock_;
   std::unique_ptr<FreeList> free_list_;
-
-  // Pool of pointers to free buffers allocated on the untrusted heap. The
-  // buffer pool is implemented as a stack. This allows for a warmer cache as a
-  // recently returned buffer which is hot in the cache is the first to get
-  // reassigned to a thread requesting a buffer.
-  std::stack<void *> buffer_pool_;
-
-  // Set of buffers returned to and owned by buffer pool clients.
-  std::unordered_set<void *> busy_buffers_;
 };
 
 }  // namespace asylo
@@ -20,6 +20,7 @@
 
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <random>
 #include <thread>
 #include <vector>
@@ -67,5 +68,100 @@ TEST_F(UntrustedCacheMallocTest, StressTest) {
   }
 }
 
+// Checks that allocations across all size classes are usable, are accounted to
+// their size class, and that larger allocations bypass the pool.
+TEST_F(UntrustedCacheMallocTest, SizeClasses) {
+  UntrustedCacheMalloc::Stats before = untrusted_cache_malloc_->GetStats();
+
+  std::vector<void *> buffers;
+  for (size_t size = 1; size <= 2 * UntrustedCacheMalloc::kMaxBlockSize;
+       size = size * 2 + 1) {
+    void *buffer = untrusted_cache_malloc_->Malloc(size);
+    ASSERT_NE(buffer, nullptr);
+    memset(buffer, 0xa5, size);
+    buffers.push_back(buffer);
+  }
+  for (void *buffer : buffers) {
+    untrusted_cache_malloc_->Free(buffer);
+  }
+
+  UntrustedCacheMalloc::Stats after = untrusted_cache_malloc_->GetStats();
+  uint64_t pool_allocations = 0;
+  for (int i = 0; i < UntrustedCacheMalloc::kNumSizeClasses; ++i) {
+    EXPECT_EQ(after.size_classes[i].block_size,
+              UntrustedCacheMalloc::kMinBlockSize << i);
+    pool_allocations += after.size_classes[i].allocations -
+                        before.size_classes[i].allocations;
+  }
+  EXPECT_EQ(pool_allocations + after.direct_allocations -
+                before.direct_allocations,
+            buffers.size());
+  EXPECT_GT(after.direct_allocations, before.direct_allocations);
+}
+
+// Frees blocks on threads other than the ones which allocated them, and checks
+// that the blocks are accounted as returned to the pool.
+TEST_F(UntrustedCacheMallocTest, CrossThreadFrees) {
+  constexpr int kNumThreads = 8;
+  constexpr int kAllocations = 1000;
+  constexpr size_t kSize = 200;
+
+  std::vector<std::vector<void *>> buffers(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([this, &buffers, i] {
+      for (int j = 0; j < kAllocations; j++) {
+        buffers[i].push_back(untrusted_cache_malloc_->Malloc(kSize));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+
+  UntrustedCacheMalloc::Stats before = untrusted_cache_malloc_->GetStats();
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([this, &buffers, i] {
+      for (void *buffer : buffers[(i + 1) % kNumThreads]) {
+        untrusted_cache_malloc_->Free(buffer);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  UntrustedCacheMalloc::Stats after = untrusted_cache_malloc_->GetStats();
+  uint64_t frees = 0;
+  for (int i = 0; i < UntrustedCacheMalloc::kNumSizeClasses; ++i) {
+    frees += after.size_classes[i].frees - before.size_classes[i].frees;
+  }
+  EXPECT_EQ(frees, kNumThreads * kAllocations);
+  EXPECT_GT(after.threads, 0);
+}
+
+// Checks that the blocks cached by a thread are handed over to the depot when
+// the thread exits, and that its counters are kept.
+TEST_F(UntrustedCacheMallocTest, ThreadExitReturnsMagazines) {
+  constexpr size_t kSize = 1000;
+  const int size_class = 4;
+  ASSERT_EQ(UntrustedCacheMalloc::kMinBlockSize << size_class, 1024);
+
+  UntrustedCacheMalloc::Stats before = untrusted_cache_malloc_->GetStats();
+  std::thread thread([this] {
+    untrusted_cache_malloc_->Free(untrusted_cache_malloc_->Malloc(kSize));
+  });
+  thread.join();
+
+  UntrustedCacheMalloc::Stats after = untrusted_cache_malloc_->GetStats();
+  EXPECT_EQ(after.size_classes[size_class].allocations,
+            before.size_classes[size_class].allocations + 1);
+  EXPECT_EQ(after.size_classes[size_class].frees,
+            before.size_classes[size_class].frees + 1);
+  EXPECT_GT(after.size_classes[size_class].depot_magazines,
+            before.size_classes[size_class].depot_magazines);
+}
+
 }  // namespace
 }  // namespace asylo
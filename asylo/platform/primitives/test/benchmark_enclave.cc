@@ -0,0 +1,159 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Enclave exposing one entry handler per primitive operation measured by
+// primitives_benchmark.cc. Each handler performs its operation once per entry,
+// so the cost of the operation is the latency of its entry less that of
+// kBenchmarkEmptyCall.
+
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "asylo/platform/host_call/trusted/host_calls.h"
+#include "asylo/platform/primitives/primitive_status.h"
+#include "asylo/platform/primitives/test/test_selectors.h"
+#include "asylo/platform/primitives/trusted_primitives.h"
+#include "asylo/platform/primitives/trusted_runtime.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/util/status_macros.h"
+
+using ::asylo::primitives::EntryHandler;
+using ::asylo::primitives::PrimitiveStatus;
+using ::asylo::primitives::TrustedPrimitives;
+
+namespace asylo {
+namespace primitives {
+namespace {
+
+// Largest read issued by kBenchmarkRead.
+constexpr size_t kMaxReadSize = 1024 * 1024;
+
+// Trusted destination of kBenchmarkRead, allocated on initialization.
+char *read_buffer = nullptr;
+
+// Host file descriptor of /dev/zero read by kBenchmarkRead, opened on
+// initialization.
+int zero_fd = -1;
+
+// Mutex and the state it guards, contended by kBenchmarkMutexRoundTrip.
+pthread_mutex_t benchmark_mutex = PTHREAD_MUTEX_INITIALIZER;
+uint64_t benchmark_counter = 0;
+
+// Returns immediately, measuring the cost of entering and leaving the enclave.
+PrimitiveStatus EmptyCall(void *context, MessageReader *in,
+                          MessageWriter *out) {
+  ASYLO_RETURN_IF_READER_NOT_EMPTY(*in);
+  return PrimitiveStatus::OkStatus();
+}
+
+// Issues an untrusted call carrying no parameters.
+PrimitiveStatus EmptyUntrustedCall(void *context, MessageReader *in,
+                                   MessageWriter *out) {
+  ASYLO_RETURN_IF_READER_NOT_EMPTY(*in);
+  MessageWriter untrusted_in;
+  MessageReader untrusted_out;
+  return TrustedPrimitives::UntrustedCall(kUntrustedEmpty, &untrusted_in,
+                                          &untrusted_out);
+}
+
+// Retrieves the host process id through the host call library.
+PrimitiveStatus Getpid(void *context, MessageReader *in, MessageWriter *out) {
+  ASYLO_RETURN_IF_READER_NOT_EMPTY(*in);
+  out->Push<int64_t>(enc_untrusted_getpid());
+  return PrimitiveStatus::OkStatus();
+}
+
+// Reads the requested number of bytes from /dev/zero on the host into trusted
+// memory, failing unless the whole read succeeds.
+PrimitiveStatus Read(void *context, MessageReader *in, MessageWriter *out) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*in, 1);
+  size_t count = in->next<uint64_t>();
+  if (count > kMaxReadSize) {
+    return {AbslStatusCode::kInvalidArgument,
+            "Read size exceeds the read buffer"};
+  }
+  if (enc_untrusted_read(zero_fd, read_buffer, count) !=
+      static_cast<ssize_t>(count)) {
+    return {AbslStatusCode::kInternal, "Short read from /dev/zero"};
+  }
+  return PrimitiveStatus::OkStatus();
+}
+
+// Acquires and releases |benchmark_mutex| the requested number of times. When
+// several threads are inside this handler the mutex is contended, and waiters
+// block on the host through the futex host calls.
+PrimitiveStatus MutexRoundTrip(void *context, MessageReader *in,
+                               MessageWriter *out) {
+  ASYLO_RETURN_IF_INCORRECT_READER_ARGUMENTS(*in, 1);
+  uint64_t rounds = in->next<uint64_t>();
+  for (uint64_t i = 0; i < rounds; ++i) {
+    pthread_mutex_lock(&benchmark_mutex);
+    ++benchmark_counter;
+    pthread_mutex_unlock(&benchmark_mutex);
+  }
+  return PrimitiveStatus::OkStatus();
+}
+
+}  // namespace
+}  // namespace primitives
+}  // namespace asylo
+
+// Implements the required enclave initialization function.
+extern "C" PrimitiveStatus asylo_enclave_init() {
+  asylo::primitives::read_buffer =
+      static_cast<char *>(malloc(asylo::primitives::kMaxReadSize));
+  if (!asylo::primitives::read_buffer) {
+    return {asylo::primitives::AbslStatusCode::kResourceExhausted,
+            "Could not allocate the read buffer"};
+  }
+  asylo::primitives::zero_fd = enc_untrusted_open("/dev/zero", O_RDONLY);
+  if (asylo::primitives::zero_fd < 0) {
+    return {asylo::primitives::AbslStatusCode::kFailedPrecondition,
+            "Could not open /dev/zero"};
+  }
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::primitives::kBenchmarkEmptyCall,
+      EntryHandler{asylo::primitives::EmptyCall}));
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::primitives::kBenchmarkUntrustedCall,
+      EntryHandler{asylo::primitives::EmptyUntrustedCall}));
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::primitives::kBenchmarkGetpid,
+      EntryHandler{asylo::primitives::Getpid}));
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::primitives::kBenchmarkRead,
+      EntryHandler{asylo::primitives::Read}));
+  ASYLO_RETURN_IF_ERROR(TrustedPrimitives::RegisterEntryHandler(
+      asylo::primitives::kBenchmarkMutexRoundTrip,
+      EntryHandler{asylo::primitives::MutexRoundTrip}));
+  return PrimitiveStatus::OkStatus();
+}
+
+// Implements the required enclave finalization function.
+extern "C" PrimitiveStatus asylo_enclave_fini() {
+  if (asylo::primitives::zero_fd >= 0) {
+    enc_untrusted_close(asylo::primitives::zero_fd);
+    asylo::primitives::zero_fd = -1;
+  }
+  free(asylo::primitives::read_buffer);
+  asylo::primitives::read_buffer = nullptr;
+  return PrimitiveStatus::OkStatus();
+}
@@ -0,0 +1,278 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Latency benchmarks of the enclave boundary crossings and host calls every
+// backend provides. The backend is selected by the TestBackend implementation
+// linked into the binary, so the same cases run against each backend.
+//
+// Besides the mean reported by Google Benchmark, every case reports the 50th,
+// 90th and 99th percentile and the maximum latency of a single iteration as
+// the p50_ns, p90_ns, p99_ns and max_ns counters. Passing
+// --max_p99_latency_ns=<benchmark>=<nanoseconds>,... makes the binary exit with
+// an error when a listed benchmark exceeds its 99th percentile budget, which
+// allows it to serve as a regression gate.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "asylo/platform/host_call/untrusted/host_call_handlers_initializer.h"
+#include "asylo/platform/primitives/test/test_backend.h"
+#include "asylo/platform/primitives/test/test_selectors.h"
+#include "asylo/platform/primitives/untrusted_primitives.h"
+#include "asylo/platform/primitives/util/dispatch_table.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/util/logging.h"
+#include "asylo/util/status.h"
+
+ABSL_FLAG(std::string, max_p99_latency_ns, "",
+          "Comma-separated list of <benchmark>=<nanoseconds> pairs. The "
+          "benchmark exits with an error if the 99th percentile latency of a "
+          "listed benchmark exceeds its budget.");
+
+namespace asylo {
+namespace primitives {
+namespace {
+
+// The enclave under benchmark, loaded once by main().
+std::shared_ptr<Client> *benchmark_client = nullptr;
+
+// Records the latency of each benchmark iteration and reports its percentiles
+// as counters of the benchmark.
+class LatencyRecorder {
+ public:
+  explicit LatencyRecorder(benchmark::State *state) : state_(state) {
+    samples_.reserve(std::min<benchmark::IterationCount>(state->max_iterations,
+                                                         kMaxReservedSamples));
+  }
+
+  // Runs |operation| once per iteration of the benchmark, stopping the
+  // benchmark with an error if it returns a non-OK status.
+  template <typename Operation>
+  void Run(Operation operation) {
+    for (auto _ : *state_) {
+      const auto start = std::chrono::steady_clock::now();
+      Status status = operation();
+      const auto end = std::chrono::steady_clock::now();
+      if (!status.ok()) {
+        state_->SkipWithError(status.ToString().c_str());
+        return;
+      }
+      samples_.push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+              .count());
+    }
+    Report();
+  }
+
+ private:
+  static constexpr benchmark::IterationCount kMaxReservedSamples = 1 << 24;
+
+  void Report() {
+    if (samples_.empty()) {
+      return;
+    }
+    std::sort(samples_.begin(), samples_.end());
+    for (const auto &percentile :
+         {std::make_pair("p50_ns", 50), std::make_pair("p90_ns", 90),
+          std::make_pair("p99_ns", 99)}) {
+      size_t index = (samples_.size() - 1) * percentile.second / 100;
+      state_->counters[percentile.first] = benchmark::Counter(
+          samples_[index], benchmark::Counter::kAvgThreads);
+    }
+    state_->counters["max_ns"] =
+        benchmark::Counter(samples_.back(), benchmark::Counter::kAvgThreads);
+  }
+
+  benchmark::State *state_;
+  std::vector<int64_t> samples_;
+};
+
+// Enters the enclave with the |selector| entry handler and |input|.
+Status EnclaveCall(uint64_t selector, MessageWriter *input) {
+  MessageReader output;
+  return (*benchmark_client)->EnclaveCall(selector, input, &output);
+}
+
+// Enters the enclave and returns without doing any work.
+void BM_EnclaveCall(benchmark::State &state) {
+  LatencyRecorder(&state).Run([] {
+    MessageWriter input;
+    return EnclaveCall(kBenchmarkEmptyCall, &input);
+  });
+}
+
+// Enters the enclave, which makes an untrusted call handled by an empty exit
+// handler.
+void BM_UntrustedCall(benchmark::State &state) {
+  LatencyRecorder(&state).Run([] {
+    MessageWriter input;
+    return EnclaveCall(kBenchmarkUntrustedCall, &input);
+  });
+}
+
+// Enters the enclave, which calls enc_untrusted_getpid().
+void BM_Getpid(benchmark::State &state) {
+  LatencyRecorder(&state).Run([] {
+    MessageWriter input;
+    return EnclaveCall(kBenchmarkGetpid, &input);
+  });
+}
+
+// Enters the enclave, which reads |state.range(0)| bytes from /dev/zero into
+// trusted memory. The enclave opens /dev/zero through a host call on
+// initialization, so the descriptor belongs to the process hosting the enclave,
+// and fails the iteration unless the whole read succeeds.
+void BM_Read(benchmark::State &state) {
+  const uint64_t size = state.range(0);
+  LatencyRecorder(&state).Run([size] {
+    MessageWriter input;
+    input.Push(size);
+    return EnclaveCall(kBenchmarkRead, &input);
+  });
+  state.SetBytesProcessed(state.iterations() * size);
+}
+
+// Enters the enclave, which acquires and releases a mutex shared by all
+// benchmark threads |state.range(0)| times.
+void BM_MutexRoundTrip(benchmark::State &state) {
+  const uint64_t rounds = state.range(0);
+  LatencyRecorder(&state).Run([rounds] {
+    MessageWriter input;
+    input.Push(rounds);
+    return EnclaveCall(kBenchmarkMutexRoundTrip, &input);
+  });
+  state.SetItemsProcessed(state.iterations() * rounds);
+}
+
+BENCHMARK(BM_EnclaveCall)->UseRealTime();
+BENCHMARK(BM_UntrustedCall)->UseRealTime();
+BENCHMARK(BM_Getpid)->UseRealTime();
+BENCHMARK(BM_Read)->Arg(4 * 1024)->Arg(1024 * 1024)->UseRealTime();
+BENCHMARK(BM_MutexRoundTrip)
+    ->Arg(1)
+    ->Arg(64)
+    ->ThreadRange(1, 4)
+    ->UseRealTime();
+
+// Console reporter that additionally checks the 99th percentile latency of
+// each run against the budgets given by --max_p99_latency_ns.
+class LatencyGateReporter : public benchmark::ConsoleReporter {
+ public:
+  explicit LatencyGateReporter(absl::flat_hash_map<std::string, double> budgets)
+      : budgets_(std::move(budgets)) {}
+
+  void ReportRuns(const std::vector<Run> &reports) override {
+    ConsoleReporter::ReportRuns(reports);
+    for (const Run &run : reports) {
+      auto budget = budgets_.find(run.benchmark_name());
+      if (budget == budgets_.end()) {
+        continue;
+      }
+      if (run.error_occurred) {
+        LOG(ERROR) << run.benchmark_name() << " failed: " << run.error_message;
+        failed_ = true;
+        continue;
+      }
+      auto p99 = run.counters.find("p99_ns");
+      if (p99 != run.counters.end() && p99->second.value > budget->second) {
+        LOG(ERROR) << run.benchmark_name() << " p99 latency of "
+                   << p99->second.value << "ns exceeds its budget of "
+                   << budget->second << "ns";
+        failed_ = true;
+      }
+    }
+  }
+
+  // Returns true if any run exceeded its budget or failed.
+  bool failed() const { return failed_; }
+
+ private:
+  const absl::flat_hash_map<std::string, double> budgets_;
+  bool failed_ = false;
+};
+
+// Parses the value of --max_p99_latency_ns, aborting if it is malformed.
+absl::flat_hash_map<std::string, double> ParseLatencyBudgets(
+    absl::string_view flag) {
+  absl::flat_hash_map<std::string, double> budgets;
+  for (absl::string_view entry : absl::StrSplit(flag, ',', absl::SkipEmpty())) {
+    std::pair<absl::string_view, absl::string_view> budget =
+        absl::StrSplit(entry, absl::MaxSplits('=', 1));
+    double nanoseconds;
+    if (budget.first.empty() ||
+        !absl::SimpleAtod(budget.second, &nanoseconds)) {
+      LOG(QFATAL) << "Malformed --max_p99_latency_ns entry: " << entry;
+    }
+    budgets[std::string(budget.first)] = nanoseconds;
+  }
+  return budgets;
+}
+
+// Loads the benchmark enclave with the host call handlers and the empty exit
+// handler targeted by BM_UntrustedCall.
+std::shared_ptr<Client> LoadBenchmarkEnclaveOrDie() {
+  auto exit_call_provider = absl::make_unique<DispatchTable>();
+  ASYLO_CHECK_OK(exit_call_provider->RegisterExitHandler(
+      kUntrustedEmpty,
+      ExitHandler{[](std::shared_ptr<Client> client, void *context,
+                     MessageReader *input, MessageWriter *output) {
+        return absl::OkStatus();
+      }}));
+  ASYLO_CHECK_OK(
+      host_call::AddHostCallHandlersToExitCallProvider(
+          exit_call_provider.get()));
+  return test::TestBackend::Get()->LoadTestEnclaveOrDie(
+      /*enclave_name=*/"primitives_benchmark", std::move(exit_call_provider));
+}
+
+}  // namespace
+}  // namespace primitives
+}  // namespace asylo
+
+int main(int argc, char *argv[]) {
+  benchmark::Initialize(&argc, argv);
+  absl::ParseCommandLine(argc, argv);
+
+  using asylo::primitives::benchmark_client;
+  benchmark_client = new std::shared_ptr<asylo::primitives::Client>(
+      asylo::primitives::LoadBenchmarkEnclaveOrDie());
+
+  asylo::primitives::LatencyGateReporter reporter(
+      asylo::primitives::ParseLatencyBudgets(
+          absl::GetFlag(FLAGS_max_p99_latency_ns)));
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+
+  (*benchmark_client)->Destroy();
+  delete benchmark_client;
+  delete asylo::primitives::test::TestBackend::Get();
+  return reporter.failed() ? 1 : 0;
+}
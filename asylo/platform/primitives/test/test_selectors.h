@@ -37,12 +37,20 @@ constexpr uint64_t kCopyMultipleParamsSelector = kSelectorUser + 7;
 constexpr uint64_t kStressMallocs = kSelectorUser + 8;
 constexpr uint64_t kInsideOutsideTest = kSelectorUser + 9;
 
+// Entry points registered by the benchmark enclave.
+constexpr uint64_t kBenchmarkEmptyCall = kSelectorUser + 10;
+constexpr uint64_t kBenchmarkUntrustedCall = kSelectorUser + 11;
+constexpr uint64_t kBenchmarkGetpid = kSelectorUser + 12;
+constexpr uint64_t kBenchmarkRead = kSelectorUser + 13;
+constexpr uint64_t kBenchmarkMutexRoundTrip = kSelectorUser + 14;
+
 // Entry point with no registered handler.
 constexpr uint64_t kNotRegisteredSelector = kSelectorUser + 100;
 
 // Exit points registered by untrusted code.
 constexpr uint64_t kUntrustedInit = kSelectorUser + 1;
 constexpr uint64_t kUntrustedFibonacci = kSelectorUser + 2;
+constexpr uint64_t kUntrustedEmpty = kSelectorUser + 3;
 
 }  // namespace primitives
 }  // namespace asylo
@@ -19,6 +19,7 @@
 #include "asylo/platform/primitives/util/dispatch_table.h"
 
 #include <memory>
+#include <utility>
 
 #include "absl/status/status.h"
 #include "absl/types/optional.h"
@@ -72,8 +73,14 @@ Status DispatchTable::InvokeExitHandler(uint64_t untrusted_selector,
   if (exit_hook_factory_) {
     auto hook = exit_hook_factory_->CreateExitHook();
     ASYLO_RETURN_IF_ERROR(hook->PreExit(untrusted_selector));
-    return hook->PostExit(
-        PerformExit(untrusted_selector, input, output, client));
+    if (input) {
+      hook->InspectInput(input);
+    }
+    Status result = PerformExit(untrusted_selector, input, output, client);
+    if (output) {
+      hook->InspectOutput(*output);
+    }
+    return hook->PostExit(std::move(result));
   } else {
     return PerformExit(untrusted_selector, input, output, client);
   }
@@ -43,6 +43,16 @@ class DispatchTable : public Client::ExitCallProvider {
     // returned back to the enclave.
     virtual Status PreExit(uint64_t untrusted_selector) = 0;
 
+    // InspectInput is called with the input of the exit call, if any, after
+    // PreExit has returned an OK status. Implementations may peek at |input|
+    // but must not consume it. The default implementation does nothing.
+    virtual void InspectInput(MessageReader *input) {}
+
+    // InspectOutput is called with the output of the exit call, if any, after
+    // that call is made and before PostExit. The default implementation does
+    // nothing.
+    virtual void InspectOutput(const MessageWriter &output) {}
+
     // PostExit is called with the result of the external exit call,
     // after that call is made (but before returning to the
     // enclave). PostExit returns a status as well, which will be
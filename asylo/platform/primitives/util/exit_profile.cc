@@ -0,0 +1,313 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/primitives/util/exit_profile.h"
+
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "asylo/platform/primitives/util/dispatch_table.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/util/logging.h"
+#include "asylo/util/posix_errors.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+namespace primitives {
+
+struct ExitProfile::AtomicCounters {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> errors{0};
+  std::atomic<uint64_t> input_bytes{0};
+  std::atomic<uint64_t> output_bytes{0};
+  std::atomic<uint64_t> total_ns{0};
+  std::atomic<uint64_t> max_ns{0};
+  std::array<std::atomic<uint64_t>, kHistogramBuckets> histogram{};
+};
+
+namespace {
+
+using SystemCallClassifier = ProfilingDispatchTable::SystemCallClassifier;
+
+// Each power of two is divided into 2^kSubBucketBits buckets.
+constexpr int kSubBucketBits = 3;
+constexpr int kSubBuckets = 1 << kSubBucketBits;
+
+// Returns the histogram bucket of a latency. Latencies below kSubBuckets have
+// a bucket each; above that, each power of two is split into kSubBuckets
+// buckets of equal width.
+int BucketOf(uint64_t ns) {
+  if (ns < kSubBuckets) {
+    return ns;
+  }
+  int msb = 63 - __builtin_clzll(ns);
+  int shift = msb - kSubBucketBits;
+  int bucket = (shift + 1) * kSubBuckets + ((ns >> shift) & (kSubBuckets - 1));
+  return std::min(bucket, ExitProfile::kHistogramBuckets - 1);
+}
+
+// Returns the largest latency recorded in |bucket|.
+uint64_t BucketUpperBound(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  int shift = bucket / kSubBuckets - 1;
+  uint64_t sub_bucket = bucket % kSubBuckets;
+  return ((kSubBuckets + sub_bucket + 1) << shift) - 1;
+}
+
+void Add(std::atomic<uint64_t> *counter, uint64_t value) {
+  counter->fetch_add(value, std::memory_order_relaxed);
+}
+
+void RecordInto(ExitProfile::AtomicCounters *counters, size_t input_bytes,
+                size_t output_bytes, bool ok, uint64_t latency_ns) {
+  Add(&counters->calls, 1);
+  if (!ok) {
+    Add(&counters->errors, 1);
+  }
+  Add(&counters->input_bytes, input_bytes);
+  Add(&counters->output_bytes, output_bytes);
+  Add(&counters->total_ns, latency_ns);
+  Add(&counters->histogram[BucketOf(latency_ns)], 1);
+  uint64_t max_ns = counters->max_ns.load(std::memory_order_relaxed);
+  while (latency_ns > max_ns &&
+         !counters->max_ns.compare_exchange_weak(max_ns, latency_ns,
+                                                 std::memory_order_relaxed)) {
+  }
+}
+
+ExitProfile::Counters Snapshot(const ExitProfile::AtomicCounters &counters) {
+  ExitProfile::Counters result;
+  result.calls = counters.calls.load(std::memory_order_relaxed);
+  result.errors = counters.errors.load(std::memory_order_relaxed);
+  result.input_bytes = counters.input_bytes.load(std::memory_order_relaxed);
+  result.output_bytes = counters.output_bytes.load(std::memory_order_relaxed);
+  result.total_ns = counters.total_ns.load(std::memory_order_relaxed);
+  result.max_ns = counters.max_ns.load(std::memory_order_relaxed);
+  for (int i = 0; i < ExitProfile::kHistogramBuckets; ++i) {
+    result.histogram[i] = counters.histogram[i].load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+template <typename Key>
+std::vector<std::pair<Key, ExitProfile::Counters>> Snapshots(
+    const ExitProfile::AtomicCounters *counters, size_t size) {
+  std::vector<std::pair<Key, ExitProfile::Counters>> result;
+  for (size_t i = 0; i < size; ++i) {
+    if (counters[i].calls.load(std::memory_order_relaxed) > 0) {
+      result.emplace_back(static_cast<Key>(i), Snapshot(counters[i]));
+    }
+  }
+  return result;
+}
+
+template <typename Key>
+void DumpTable(const char *title, const char *key_name,
+               std::vector<std::pair<Key, ExitProfile::Counters>> table,
+               std::ostream *os) {
+  std::sort(table.begin(), table.end(), [](const auto &lhs, const auto &rhs) {
+    return lhs.second.total_ns > rhs.second.total_ns;
+  });
+  *os << title << ":\n"
+      << absl::StrFormat("%10s %12s %8s %14s %14s %12s %10s %10s %10s %10s\n",
+                         key_name, "calls", "errors", "input_bytes",
+                         "output_bytes", "total_ms", "mean_us", "p50_us",
+                         "p99_us", "max_us");
+  for (const auto &entry : table) {
+    const ExitProfile::Counters &counters = entry.second;
+    *os << absl::StrFormat(
+        "%10d %12d %8d %14d %14d %12.3f %10.3f %10.3f %10.3f %10.3f\n",
+        entry.first, counters.calls, counters.errors, counters.input_bytes,
+        counters.output_bytes, counters.total_ns / 1e6,
+        counters.total_ns / 1e3 / counters.calls,
+        counters.PercentileNs(50) / 1e3, counters.PercentileNs(99) / 1e3,
+        counters.max_ns / 1e3);
+  }
+}
+
+// The profile dumped on signal, if any.
+std::atomic<ExitProfile *> signal_profile{nullptr};
+
+void RequestSignalProfileDump(int signum) {
+  ExitProfile *profile = signal_profile.load();
+  if (profile) {
+    profile->RequestDump();
+  }
+}
+
+// A hook which records a single exit call in an ExitProfile.
+class ExitProfileHook : public DispatchTable::ExitHook {
+ public:
+  ExitProfileHook(ExitProfile *profile, const SystemCallClassifier *classifier)
+      : profile_(profile), classifier_(classifier) {}
+
+  Status PreExit(uint64_t untrusted_selector) override {
+    untrusted_selector_ = untrusted_selector;
+    start_ = std::chrono::steady_clock::now();
+    return absl::OkStatus();
+  }
+
+  void InspectInput(MessageReader *input) override {
+    input_bytes_ = input->MessageSize();
+    if (*classifier_ && input->hasNext()) {
+      sysno_ = (*classifier_)(untrusted_selector_, input);
+    }
+  }
+
+  void InspectOutput(const MessageWriter &output) override {
+    output_bytes_ = output.MessageSize();
+  }
+
+  Status PostExit(Status result) override {
+    auto latency = std::chrono::steady_clock::now() - start_;
+    profile_->Record(
+        untrusted_selector_, sysno_, input_bytes_, output_bytes_, result.ok(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    profile_->MaybeDump();
+    return result;
+  }
+
+ private:
+  ExitProfile *const profile_;
+  const SystemCallClassifier *const classifier_;
+  uint64_t untrusted_selector_ = 0;
+  int sysno_ = -1;
+  size_t input_bytes_ = 0;
+  size_t output_bytes_ = 0;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// A hook factory which will generate one hook object per exit call, all
+// recording into the same profile.
+class ExitProfileHookFactory : public DispatchTable::ExitHookFactory {
+ public:
+  ExitProfileHookFactory(std::shared_ptr<ExitProfile> profile,
+                         SystemCallClassifier classifier)
+      : profile_(std::move(profile)), classifier_(std::move(classifier)) {}
+
+  std::unique_ptr<DispatchTable::ExitHook> CreateExitHook() override {
+    return absl::make_unique<ExitProfileHook>(profile_.get(), &classifier_);
+  }
+
+ private:
+  const std::shared_ptr<ExitProfile> profile_;
+  const SystemCallClassifier classifier_;
+};
+
+}  // namespace
+
+uint64_t ExitProfile::Counters::PercentileNs(double percentile) const {
+  uint64_t total = 0;
+  for (uint64_t count : histogram) {
+    total += count;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(total * percentile / 100));
+  uint64_t seen = 0;
+  for (int i = 0; i < kHistogramBuckets; ++i) {
+    seen += histogram[i];
+    if (seen >= rank) {
+      return std::min(BucketUpperBound(i), max_ns);
+    }
+  }
+  return max_ns;
+}
+
+ExitProfile::ExitProfile()
+    : selectors_(absl::make_unique<AtomicCounters[]>(kMaxSelector + 1)),
+      system_calls_(absl::make_unique<AtomicCounters[]>(kMaxSysno + 1)),
+      dump_requested_(false) {}
+
+ExitProfile::~ExitProfile() {
+  ExitProfile *expected = this;
+  signal_profile.compare_exchange_strong(expected, nullptr);
+}
+
+void ExitProfile::Record(uint64_t untrusted_selector, int sysno,
+                         size_t input_bytes, size_t output_bytes, bool ok,
+                         uint64_t latency_ns) {
+  RecordInto(&selectors_[std::min(untrusted_selector, kMaxSelector)],
+             input_bytes, output_bytes, ok, latency_ns);
+  if (sysno >= 0) {
+    RecordInto(&system_calls_[std::min(sysno, kMaxSysno)], input_bytes,
+               output_bytes, ok, latency_ns);
+  }
+}
+
+std::vector<std::pair<uint64_t, ExitProfile::Counters>>
+ExitProfile::SelectorCounters() const {
+  return Snapshots<uint64_t>(selectors_.get(), kMaxSelector + 1);
+}
+
+std::vector<std::pair<int, ExitProfile::Counters>>
+ExitProfile::SystemCallCounters() const {
+  return Snapshots<int>(system_calls_.get(), kMaxSysno + 1);
+}
+
+void ExitProfile::Dump(std::ostream *os) const {
+  DumpTable("Exit calls by selector", "selector", SelectorCounters(), os);
+  DumpTable("Exit calls by system call", "sysno", SystemCallCounters(), os);
+}
+
+void ExitProfile::MaybeDump() {
+  if (!dump_requested_.load(std::memory_order_relaxed) ||
+      !dump_requested_.exchange(false)) {
+    return;
+  }
+  std::ostringstream report;
+  Dump(&report);
+  LOG(INFO) << report.str();
+}
+
+Status ExitProfile::DumpOnSignal(int signum) {
+  signal_profile.store(this);
+  struct sigaction action = {};
+  action.sa_handler = RequestSignalProfileDump;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction(signum, &action, nullptr) != 0) {
+    return LastPosixError("Failed to install the exit profile signal handler");
+  }
+  return absl::OkStatus();
+}
+
+ProfilingDispatchTable::ProfilingDispatchTable(
+    std::shared_ptr<ExitProfile> profile, SystemCallClassifier classifier)
+    : DispatchTable(absl::make_unique<ExitProfileHookFactory>(
+          std::move(profile), std::move(classifier))) {}
+
+}  // namespace primitives
+}  // namespace asylo
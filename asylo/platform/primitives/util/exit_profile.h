@@ -0,0 +1,138 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_PRIMITIVES_UTIL_EXIT_PROFILE_H_
+#define ASYLO_PLATFORM_PRIMITIVES_UTIL_EXIT_PROFILE_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "asylo/platform/primitives/util/dispatch_table.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/util/status.h"
+
+namespace asylo {
+namespace primitives {
+
+// Aggregate statistics of the exit calls made by an enclave, kept per exit
+// selector and, for exits carrying a system call, per system call number.
+//
+// Recording an exit only increments relaxed atomic counters, so an ExitProfile
+// may be shared by all threads exiting the enclave and left enabled in
+// production. Latencies are recorded in log-linear histograms whose buckets
+// have a relative width of 1/8, in the style of HDR histograms.
+class ExitProfile {
+ public:
+  // Selectors at or above kMaxSelector are tallied together under
+  // kMaxSelector.
+  static constexpr uint64_t kMaxSelector = 256;
+
+  // System call numbers at or above kMaxSysno are tallied together under
+  // kMaxSysno.
+  static constexpr int kMaxSysno = 512;
+
+  // Number of latency histogram buckets: 8 for latencies below 8 ns, then 8
+  // for each power of two from 2^3 to 2^36 ns, so the buckets cover latencies
+  // below 2^37 ns (about 137 seconds). Longer latencies are recorded in the
+  // last bucket.
+  static constexpr int kHistogramBuckets = 280;
+
+  // A snapshot of the statistics of one selector or system call.
+  struct Counters {
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, kHistogramBuckets> histogram = {};
+
+    // Returns an upper bound on the |percentile|th percentile latency in
+    // nanoseconds, accurate to the width of its histogram bucket.
+    uint64_t PercentileNs(double percentile) const;
+  };
+
+  // The lock-free counters of one selector or system call, defined in
+  // exit_profile.cc.
+  struct AtomicCounters;
+
+  ExitProfile();
+  ~ExitProfile();
+
+  ExitProfile(const ExitProfile &other) = delete;
+  ExitProfile &operator=(const ExitProfile &other) = delete;
+
+  // Records an exit through |untrusted_selector| which took |latency_ns|
+  // nanoseconds. |sysno| is the system call carried by the exit, or -1 if
+  // it did not carry one.
+  void Record(uint64_t untrusted_selector, int sysno, size_t input_bytes,
+              size_t output_bytes, bool ok, uint64_t latency_ns);
+
+  // Returns the statistics of every selector with at least one recorded exit,
+  // in increasing selector order.
+  std::vector<std::pair<uint64_t, Counters>> SelectorCounters() const;
+
+  // Returns the statistics of every system call with at least one recorded
+  // exit, in increasing system call number order.
+  std::vector<std::pair<int, Counters>> SystemCallCounters() const;
+
+  // Writes a human readable report of the profile to |os|, ordering selectors
+  // and system calls by the total time spent in them.
+  void Dump(std::ostream *os) const;
+
+  // Requests that the profile be logged once the next exit completes. Safe to
+  // call from a signal handler.
+  void RequestDump() { dump_requested_.store(true, std::memory_order_relaxed); }
+
+  // Logs the profile if a dump has been requested since the last one.
+  void MaybeDump();
+
+  // Installs a handler for |signum| which requests a dump of this profile.
+  // Only one profile may be dumped on signal at a time; a later call replaces
+  // the profile dumped by an earlier one.
+  Status DumpOnSignal(int signum);
+
+ private:
+  std::unique_ptr<AtomicCounters[]> selectors_;
+  std::unique_ptr<AtomicCounters[]> system_calls_;
+  std::atomic<bool> dump_requested_;
+};
+
+// A variation of DispatchTable that records every exit call in an ExitProfile.
+// |classifier|, if provided, returns the system call number carried by an exit
+// with the given selector and input, or -1 if it does not carry one; it may
+// peek at but must not consume the input.
+class ProfilingDispatchTable : public DispatchTable {
+ public:
+  using SystemCallClassifier =
+      std::function<int(uint64_t untrusted_selector, MessageReader *input)>;
+
+  explicit ProfilingDispatchTable(std::shared_ptr<ExitProfile> profile,
+                                  SystemCallClassifier classifier = nullptr);
+};
+
+}  // namespace primitives
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_PRIMITIVES_UTIL_EXIT_PROFILE_H_
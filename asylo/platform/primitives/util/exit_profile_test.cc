@@ -0,0 +1,214 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/primitives/util/exit_profile.h"
+
+#include <signal.h>
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "asylo/platform/primitives/untrusted_primitives.h"
+#include "asylo/platform/primitives/util/message.h"
+#include "asylo/test/util/status_matchers.h"
+#include "asylo/util/status.h"
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::HasSubstr;
+using ::testing::Le;
+using ::testing::Pair;
+using ::testing::SizeIs;
+
+namespace asylo {
+namespace primitives {
+namespace {
+
+constexpr uint64_t kSystemCallSelector = 10;
+constexpr uint64_t kFailingSelector = 20;
+
+class ProfiledClient : public Client {
+ public:
+  explicit ProfiledClient(std::shared_ptr<ExitProfile> profile)
+      : Client(/*name=*/"profiled_enclave",
+               absl::make_unique<ProfilingDispatchTable>(
+                   std::move(profile),
+                   [](uint64_t untrusted_selector, MessageReader *input) {
+                     return untrusted_selector == kSystemCallSelector
+                                ? input->peek<int>()
+                                : -1;
+                   })) {}
+
+  bool IsClosed() const override { return false; }
+  Status Destroy() override { return absl::OkStatus(); }
+  Status EnclaveCallInternal(uint64_t selector, MessageWriter *in,
+                             MessageReader *out) override {
+    return absl::OkStatus();
+  }
+};
+
+// Transfers |writer| into a MessageReader, as the backends do on exit.
+MessageReader ToReader(const MessageWriter &writer) {
+  std::vector<char> buffer(writer.MessageSize());
+  writer.Serialize(buffer.data());
+  MessageReader reader;
+  reader.Deserialize(buffer.data(), buffer.size());
+  return reader;
+}
+
+class ExitProfileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    profile_ = std::make_shared<ExitProfile>();
+    client_ = std::make_shared<ProfiledClient>(profile_);
+    ASSERT_THAT(client_->exit_call_provider()->RegisterExitHandler(
+                    kSystemCallSelector,
+                    ExitHandler{[](std::shared_ptr<Client> client,
+                                   void *context, MessageReader *in,
+                                   MessageWriter *out) {
+                      // Consume the input, as a real handler would.
+                      in->next<int>();
+                      out->Push<int64_t>(0);
+                      return absl::OkStatus();
+                    }}),
+                IsOk());
+    ASSERT_THAT(client_->exit_call_provider()->RegisterExitHandler(
+                    kFailingSelector,
+                    ExitHandler{[](std::shared_ptr<Client> client,
+                                   void *context, MessageReader *in,
+                                   MessageWriter *out) {
+                      return absl::InternalError("Exit failed");
+                    }}),
+                IsOk());
+  }
+
+  Status SystemCall(int sysno) {
+    MessageWriter writer;
+    writer.Push(sysno);
+    MessageReader input = ToReader(writer);
+    MessageWriter output;
+    return client_->exit_call_provider()->InvokeExitHandler(
+        kSystemCallSelector, &input, &output, client_.get());
+  }
+
+  std::shared_ptr<ExitProfile> profile_;
+  std::shared_ptr<ProfiledClient> client_;
+};
+
+TEST_F(ExitProfileTest, CountsExitsBySelectorAndSystemCall) {
+  ASSERT_THAT(SystemCall(0), IsOk());
+  ASSERT_THAT(SystemCall(39), IsOk());
+  ASSERT_THAT(SystemCall(39), IsOk());
+  MessageWriter output;
+  EXPECT_THAT(client_->exit_call_provider()->InvokeExitHandler(
+                  kFailingSelector, nullptr, &output, client_.get()),
+              StatusIs(absl::StatusCode::kInternal));
+
+  auto selectors = profile_->SelectorCounters();
+  ASSERT_THAT(selectors, SizeIs(2));
+  EXPECT_THAT(selectors[0].first, Eq(kSystemCallSelector));
+  EXPECT_THAT(selectors[0].second.calls, Eq(3));
+  EXPECT_THAT(selectors[0].second.errors, Eq(0));
+  // Every input carries one int and every output one int64_t, each preceded
+  // by its size.
+  EXPECT_THAT(selectors[0].second.input_bytes, Eq(3 * (8 + sizeof(int))));
+  EXPECT_THAT(selectors[0].second.output_bytes, Eq(3 * (8 + 8)));
+  EXPECT_THAT(selectors[1].first, Eq(kFailingSelector));
+  EXPECT_THAT(selectors[1].second.calls, Eq(1));
+  EXPECT_THAT(selectors[1].second.errors, Eq(1));
+
+  auto system_calls = profile_->SystemCallCounters();
+  ASSERT_THAT(system_calls, SizeIs(2));
+  EXPECT_THAT(system_calls[0].first, Eq(0));
+  EXPECT_THAT(system_calls[0].second.calls, Eq(1));
+  EXPECT_THAT(system_calls[1].first, Eq(39));
+  EXPECT_THAT(system_calls[1].second.calls, Eq(2));
+}
+
+TEST_F(ExitProfileTest, FoldsOutOfRangeKeys) {
+  profile_->Record(ExitProfile::kMaxSelector + 7, ExitProfile::kMaxSysno + 3,
+                   0, 0, true, 1);
+  EXPECT_THAT(profile_->SelectorCounters(),
+              ElementsAre(Pair(ExitProfile::kMaxSelector, testing::_)));
+  EXPECT_THAT(profile_->SystemCallCounters(),
+              ElementsAre(Pair(ExitProfile::kMaxSysno, testing::_)));
+}
+
+TEST_F(ExitProfileTest, PercentilesAreWithinBucketPrecision) {
+  for (uint64_t latency_ns = 1; latency_ns <= 100000; ++latency_ns) {
+    profile_->Record(kSystemCallSelector, -1, 0, 0, true, latency_ns);
+  }
+  auto selectors = profile_->SelectorCounters();
+  ASSERT_THAT(selectors, SizeIs(1));
+  const ExitProfile::Counters &counters = selectors[0].second;
+  EXPECT_THAT(counters.max_ns, Eq(100000));
+  EXPECT_THAT(counters.total_ns, Eq(100000ull * 100001 / 2));
+  for (double percentile : {1.0, 50.0, 90.0, 99.0}) {
+    const double expected = percentile * 1000;
+    EXPECT_THAT(counters.PercentileNs(percentile), Ge(expected));
+    EXPECT_THAT(counters.PercentileNs(percentile), Le(expected * 1.125));
+  }
+  EXPECT_THAT(counters.PercentileNs(100), Eq(100000));
+}
+
+TEST_F(ExitProfileTest, CountsConcurrentExits) {
+  constexpr int kThreads = 8;
+  constexpr int kExitsPerThread = 1000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([this, i] {
+      for (int j = 0; j < kExitsPerThread; ++j) {
+        ASSERT_THAT(SystemCall(i), IsOk());
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto selectors = profile_->SelectorCounters();
+  ASSERT_THAT(selectors, SizeIs(1));
+  EXPECT_THAT(selectors[0].second.calls, Eq(kThreads * kExitsPerThread));
+  for (const auto &system_call : profile_->SystemCallCounters()) {
+    EXPECT_THAT(system_call.second.calls, Eq(kExitsPerThread));
+  }
+}
+
+TEST_F(ExitProfileTest, DumpsOnSignal) {
+  ASSERT_THAT(profile_->DumpOnSignal(SIGUSR2), IsOk());
+  ASSERT_THAT(SystemCall(1), IsOk());
+  ASSERT_THAT(raise(SIGUSR2), Eq(0));
+  // The dump is logged when the next exit completes.
+  ASSERT_THAT(SystemCall(1), IsOk());
+
+  std::ostringstream report;
+  profile_->Dump(&report);
+  EXPECT_THAT(report.str(), HasSubstr("Exit calls by selector"));
+  EXPECT_THAT(report.str(), HasSubstr("Exit calls by system call"));
+}
+
+}  // namespace
+}  // namespace primitives
+}  // namespace asylo
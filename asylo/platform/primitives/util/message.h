@@ -24,12 +24,15 @@
 #include <sys/un.h>
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/container/inlined_vector.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
@@ -51,6 +54,11 @@ namespace primitives {
 // from the writer is disallowed. The message writer does not perform memory
 // allocation for the serialized message. Extents can be pushed by reference or
 // by copy, in which case they are owned by the MessageWriter.
+//
+// Copied extents are bump-allocated from an arena owned by the writer. The
+// first |kInlineArenaSize| bytes of the arena and the first |kInlineExtents|
+// extents are stored inline, so that typical messages of a few scalar values
+// are built without any heap allocation.
 class MessageWriter {
  public:
   MessageWriter() = default;
@@ -59,9 +67,15 @@ class MessageWriter {
   MessageWriter(const MessageWriter &other) = delete;
   MessageWriter operator=(const MessageWriter &other) = delete;
 
-  // Allow moving.
-  MessageWriter(MessageWriter &&other) noexcept = default;
-  MessageWriter &operator=(MessageWriter &&other) = default;
+  // Allow moving. Extents copied into the inline arena of |other| are moved
+  // into the inline arena of this writer.
+  MessageWriter(MessageWriter &&other) noexcept { MoveFrom(&other); }
+  MessageWriter &operator=(MessageWriter &&other) noexcept {
+    if (this != &other) {
+      MoveFrom(&other);
+    }
+    return *this;
+  }
 
   // Returns true if no output has been written to the MessageWriter.
   bool empty() const { return extents_.empty(); }
@@ -107,9 +121,10 @@ class MessageWriter {
   // Pushes an extent to the MessageWriter by copy. Data is copied and owned by
   // the MessageWriter.
   void PushByCopy(Extent extent) {
-    char *extent_data = new char[extent.size()];
-    copied_data_owner_.emplace_back(extent_data);
-    memcpy(extent_data, extent.data(), extent.size());
+    char *extent_data = Allocate(extent.size());
+    if (extent.size() > 0) {
+      memcpy(extent_data, extent.data(), extent.size());
+    }
     PushByReference(Extent{extent_data, extent.size()});
   }
 
@@ -173,8 +188,90 @@ class MessageWriter {
   }
 
  private:
-  std::vector<Extent> extents_;
-  std::vector<std::unique_ptr<char[]>> copied_data_owner_;
+  // Number of extents and bytes of copied data stored inline.
+  static constexpr size_t kInlineExtents = 8;
+  static constexpr size_t kInlineArenaSize = 256;
+
+  // Alignment of copied extents, which allows them to be accessed in place.
+  static constexpr size_t kArenaAlignment = alignof(std::max_align_t);
+
+  // Size of the first arena block allocated once the inline arena is full.
+  // Subsequent blocks double in size up to |kMaxArenaBlockSize|. Copies larger
+  // than half a block get a block of their own.
+  static constexpr size_t kMinArenaBlockSize = 1024;
+  static constexpr size_t kMaxArenaBlockSize = 64 * 1024;
+
+  // Returns |size| bytes of storage owned by the writer.
+  char *Allocate(size_t size) {
+    size_t aligned_size = (size + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+    if (aligned_size > static_cast<size_t>(arena_end_ - arena_next_)) {
+      size_t block_size = std::min(kMinArenaBlockSize << arena_blocks_.size(),
+                                   kMaxArenaBlockSize);
+      if (aligned_size > block_size / 2) {
+        arena_blocks_.emplace_back(new char[size]);
+        return arena_blocks_.back().get();
+      }
+      arena_blocks_.emplace_back(new char[block_size]);
+      arena_next_ = arena_blocks_.back().get();
+      arena_end_ = arena_next_ + block_size;
+    }
+    char *result = arena_next_;
+    arena_next_ += aligned_size;
+    return result;
+  }
+
+  // Returns true if |data| points into the inline arena. An address just past
+  // its end may belong to unrelated memory, such as a buffer passed by the
+  // caller, so it is not included.
+  bool InInlineArena(const void *data) const {
+    auto address = reinterpret_cast<uintptr_t>(data);
+    auto begin = reinterpret_cast<uintptr_t>(inline_arena_);
+    return address >= begin && address < begin + kInlineArenaSize;
+  }
+
+  // Returns true if copies are still allocated from the inline arena, which
+  // may be full.
+  bool AllocatesInline() const {
+    return arena_end_ == inline_arena_ + kInlineArenaSize;
+  }
+
+  // Takes over the extents and arena of |other|, leaving it empty.
+  void MoveFrom(MessageWriter *other) {
+    extents_ = std::move(other->extents_);
+    arena_blocks_ = std::move(other->arena_blocks_);
+    memcpy(inline_arena_, other->inline_arena_,
+           other->AllocatesInline() ? other->arena_next_ - other->inline_arena_
+                                    : kInlineArenaSize);
+    for (auto &extent : extents_) {
+      if (other->InInlineArena(extent.data())) {
+        size_t offset = extent.As<char>() - other->inline_arena_;
+        extent = Extent{inline_arena_ + offset, extent.size()};
+      }
+    }
+    if (other->AllocatesInline()) {
+      arena_next_ = inline_arena_ + (other->arena_next_ - other->inline_arena_);
+      arena_end_ = inline_arena_ + kInlineArenaSize;
+    } else {
+      arena_next_ = other->arena_next_;
+      arena_end_ = other->arena_end_;
+    }
+
+    other->extents_.clear();
+    other->arena_blocks_.clear();
+    other->arena_next_ = other->inline_arena_;
+    other->arena_end_ = other->inline_arena_ + kInlineArenaSize;
+  }
+
+  absl::InlinedVector<Extent, kInlineExtents> extents_;
+
+  // Blocks of the arena allocated on the heap.
+  std::vector<std::unique_ptr<char[]>> arena_blocks_;
+
+  // Unused part of the current arena block.
+  char *arena_next_ = inline_arena_;
+  char *arena_end_ = inline_arena_ + kInlineArenaSize;
+
+  alignas(kArenaAlignment) char inline_arena_[kInlineArenaSize];
 };
 
 // A message reader that consumes a serialized message and generates extents.
@@ -236,6 +333,16 @@ class MessageReader {
   // Returns the number of extents read.
   size_t size() const { return extents_.size(); }
 
+  // Returns the size of the serialized message the extents were read from, as
+  // computed by MessageWriter::MessageSize().
+  size_t MessageSize() const {
+    size_t result = sizeof(uint64_t) * extents_.size();
+    for (const auto &extent : extents_) {
+      result += extent.second;
+    }
+    return result;
+  }
+
   // Returns the next extent in the MessageReader. The MessageReader may only be
   // traversed once. The returned extent remains owned by the MessageReader and
   // its lifetime is the lifetime of the MessageReader.
@@ -0,0 +1,83 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include "absl/memory/memory.h"
+#include "asylo/platform/primitives/util/message.h"
+
+namespace asylo {
+namespace primitives {
+namespace {
+
+// Serializes |writer| into a freshly allocated buffer and deserializes it into
+// |reader|, as the backends do when a message crosses the enclave boundary.
+void Transfer(const MessageWriter &writer, MessageReader *reader) {
+  const size_t size = writer.MessageSize();
+  const auto buffer = absl::make_unique<char[]>(size);
+  writer.Serialize(buffer.get());
+  reader->Deserialize(buffer.get(), size);
+}
+
+// Models the message handling of a host call with |state.range(0)| scalar
+// parameters and a two-value response, as issued by the host call library.
+void BM_HostCallRoundTrip(benchmark::State &state) {
+  const int num_params = state.range(0);
+  for (auto _ : state) {
+    MessageWriter input;
+    for (int i = 0; i < num_params; ++i) {
+      input.Push<uint64_t>(i);
+    }
+    MessageReader request;
+    Transfer(input, &request);
+
+    MessageWriter output;
+    output.Push<int64_t>(request.next<int64_t>());
+    output.Push<int>(0);
+    MessageReader response;
+    Transfer(output, &response);
+    benchmark::DoNotOptimize(response.next<int64_t>());
+  }
+}
+
+// Measures building a message with |state.range(0)| scalar parameters and a
+// path string, without the boundary crossing.
+void BM_BuildMessage(benchmark::State &state) {
+  const int num_params = state.range(0);
+  const std::string path = "/tmp/asylo/message_benchmark";
+  for (auto _ : state) {
+    MessageWriter writer;
+    writer.PushString(path);
+    for (int i = 0; i < num_params; ++i) {
+      writer.Push(i);
+    }
+    benchmark::DoNotOptimize(writer.MessageSize());
+  }
+}
+
+BENCHMARK(BM_HostCallRoundTrip)->DenseRange(1, 10, 3)->Arg(32);
+BENCHMARK(BM_BuildMessage)->DenseRange(1, 10, 3)->Arg(32);
+
+}  // namespace
+}  // namespace primitives
+}  // namespace asylo
+
+BENCHMARK_MAIN();
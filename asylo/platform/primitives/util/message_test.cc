@@ -20,6 +20,8 @@
 
 #include <cstddef>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -190,6 +192,80 @@ TEST(MessageTest, PushPopStrings) {
   EXPECT_THAT(reader.next().As<char>(), StrEq("moon"));
 }
 
+// Pushes enough data to overflow the inline storage of the writer, including
+// extents larger than an arena block, and checks every extent round trips.
+TEST(MessageTest, PushBeyondInlineStorage) {
+  constexpr int kNumValues = 200;
+  const std::string large(100 * 1024, 'x');
+  MessageWriter writer;
+  for (int i = 0; i < kNumValues; ++i) {
+    writer.Push(i);
+    if (i % 50 == 0) {
+      writer.PushString(large);
+    }
+  }
+
+  MessageReader reader = BuildMessageReader(writer);
+  ASSERT_THAT(reader, SizeIs(kNumValues + kNumValues / 50));
+  for (int i = 0; i < kNumValues; ++i) {
+    EXPECT_THAT(reader.next<int>(), Eq(i));
+    if (i % 50 == 0) {
+      EXPECT_THAT(reader.next().As<char>(), StrEq(large));
+    }
+  }
+}
+
+// Checks that extents copied into the inline storage of a writer remain valid
+// after the writer is moved, and that the moved-from writer is reusable.
+TEST(MessageTest, MoveWriter) {
+  MessageWriter writer;
+  writer.Push(1);
+  writer.PushString("inline");
+  writer.PushString(std::string(4096, 'y'));
+
+  MessageWriter moved(std::move(writer));
+  moved.Push(2);
+  EXPECT_THAT(writer, IsEmpty());
+  writer.Push(3);
+
+  MessageWriter assigned;
+  assigned.Push(4);
+  assigned = std::move(moved);
+
+  MessageReader reader = BuildMessageReader(assigned);
+  ASSERT_THAT(reader, SizeIs(4));
+  EXPECT_THAT(reader.next<int>(), Eq(1));
+  EXPECT_THAT(reader.next().As<char>(), StrEq("inline"));
+  EXPECT_THAT(reader.next().As<char>(), StrEq(std::string(4096, 'y')));
+  EXPECT_THAT(reader.next<int>(), Eq(2));
+
+  MessageReader other = BuildMessageReader(writer);
+  ASSERT_THAT(other, SizeIs(1));
+  EXPECT_THAT(other.next<int>(), Eq(3));
+}
+
+// Checks that a writer whose inline storage is exactly full is moved correctly,
+// and that later copies go to the heap.
+TEST(MessageTest, MoveWriterWithFullInlineStorage) {
+  // Each string takes 16 bytes, so that 16 of them fill the 256 inline bytes.
+  const std::string chunk(15, 'z');
+  constexpr int kNumChunks = 16;
+  MessageWriter writer;
+  for (int i = 0; i < kNumChunks; ++i) {
+    writer.PushString(chunk);
+  }
+
+  MessageWriter moved(std::move(writer));
+  moved.PushString("heap");
+
+  MessageReader reader = BuildMessageReader(moved);
+  ASSERT_THAT(reader, SizeIs(kNumChunks + 1));
+  for (int i = 0; i < kNumChunks; ++i) {
+    EXPECT_THAT(reader.next().As<char>(), StrEq(chunk));
+  }
+  EXPECT_THAT(reader.next().As<char>(), StrEq("heap"));
+}
+
 }  // namespace
 }  // namespace primitives
 }  // namespace asylo
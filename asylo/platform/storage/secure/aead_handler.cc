@@ -22,16 +22,19 @@
 
 // IO syscall interface constants.
 #include <fcntl.h>
+#include <unistd.h>
 
-#include <iomanip>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <memory>
+#include <vector>
 
 #include "absl/strings/escaping.h"
 #include "absl/synchronization/mutex.h"
-#include "asylo/crypto/util/byte_container_view.h"
 #include "asylo/crypto/util/bytes.h"
+#include "asylo/platform/common/iovec_util.h"
 #include "asylo/platform/host_call/trusted/host_calls.h"
-#include "asylo/platform/storage/utils/fd_closer.h"
 
 namespace asylo {
 namespace platform {
@@ -42,108 +45,96 @@ using crypto::gcmlib::GcmCryptorRegistry;
 
 namespace {
 
+// Identifies the layout of a file header that records the block length.
+// Headers of files with kLegacyBlockLength blocks begin with the file hash
+// instead.
+constexpr uint8_t kFileMagic[8] = {'A', 'S', 'Y', 'L', 'O', 'S', 'F', '1'};
+
+// Set in the flags of a file header when the leaf hashes of the AD are stored
+// after the last block. The hashes are not trusted until the root computed from
+// them is validated against the file hash.
+constexpr uint32_t kFileHeaderFlagHashCache = 1;
+
+// Maximum number of bytes to read from the host at once when collecting
+// integrity metadata.
+constexpr size_t kMaxMetadataReadLength = 256 * 1024;
+
 // Perform a weak validation that the path is canonical.
 bool IsPathNameValid(const char *path_name) {
   return path_name && strlen(path_name) && path_name[0] == '/';
 }
 
+bool IsBlockLengthValid(size_t block_length) {
+  return block_length >= kMinBlockLength && block_length <= kMaxBlockLength &&
+         (block_length & (block_length - 1)) == 0;
+}
+
 bool is_transient_error(int err) { return (err == EAGAIN) || (err == EINTR); }
 
 // Returns -1 on failure, or min(|len|, bytes to EOF) on success.
-ssize_t read_all(int fd, void *buf, size_t len) {
+ssize_t pread_all(int fd, void *buf, size_t len, off_t offset) {
   size_t bytes_to_read = len;
-  size_t offset = 0;
+  size_t bytes_done = 0;
 
   while (bytes_to_read > 0) {
     ssize_t bytes_read;
     do {
-      bytes_read = enc_untrusted_read(fd, static_cast<uint8_t *>(buf) + offset,
-                                      bytes_to_read);
+      bytes_read = enc_untrusted_pread64(
+          fd, static_cast<uint8_t *>(buf) + bytes_done, bytes_to_read,
+          offset + bytes_done);
     } while ((bytes_read == -1) && is_transient_error(errno));
     if (bytes_read == -1) {
       return -1;
     }
     if (bytes_read == 0) {
-      return offset;
+      return bytes_done;
     }
 
     bytes_to_read -= bytes_read;
-    offset += bytes_read;
+    bytes_done += bytes_read;
   }
 
-  return offset;
+  return bytes_done;
 }
 
 // Returns -1 on failure, or |len| on success.
-ssize_t write_all(int fd, const void *buf, size_t len) {
+ssize_t pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
   size_t bytes_to_write = len;
-  size_t offset = 0;
+  size_t bytes_done = 0;
 
   while (bytes_to_write > 0) {
     ssize_t bytes_written;
     do {
-      bytes_written = enc_untrusted_write(
-          fd, static_cast<const uint8_t *>(buf) + offset, bytes_to_write);
+      bytes_written = enc_untrusted_pwrite64(
+          fd, static_cast<const uint8_t *>(buf) + bytes_done, bytes_to_write,
+          offset + bytes_done);
     } while ((bytes_written == -1) && is_transient_error(errno));
     if (bytes_written == -1) {
       return -1;
     }
 
     bytes_to_write -= bytes_written;
-    offset += bytes_written;
+    bytes_done += bytes_written;
   }
 
   // Coherence check.
-  if (offset != len) {
+  if (bytes_done != len) {
     return -1;
   }
 
-  return offset;
-}
-
-// Returns offset to the plaintext buffer associated with the |block_index| of
-// a full block.
-const uint8_t *GetPlaintextBuffer(size_t first_partial_block_bytes_count,
-                                  int64_t block_index, const void *buf) {
-  const uint8_t *plaintext_data = reinterpret_cast<const uint8_t *>(buf);
-  if (first_partial_block_bytes_count > 0) {
-    if (block_index > 0) {
-      plaintext_data += first_partial_block_bytes_count;
-    }
-    if (block_index > 1) {
-      plaintext_data += (block_index - 1) * kBlockLength;
-    }
-  } else {
-    plaintext_data += block_index * kBlockLength;
-  }
-
-  return plaintext_data;
-}
-
-uint8_t *GetPlaintextBuffer(size_t first_partial_block_bytes_count,
-                            int64_t block_index, void *buf) {
-  return const_cast<uint8_t *>(
-      GetPlaintextBuffer(first_partial_block_bytes_count, block_index,
-                         const_cast<const void *>(buf)));
+  return bytes_done;
 }
 
 }  // namespace
 
-using Tag = UnsafeBytes<kTagLength>;
-using Token = UnsafeBytes<kTokenLength>;
-using Block = UnsafeBytes<kBlockLength>;
-using Ciphertext = UnsafeBytes<kCipherBlockLength>;
-using SecureBlock = UnsafeBytes<kSecureBlockLength>;
-
-using TagView = ByteContainerView;
-using TokenView = ByteContainerView;
-using BlockView = ByteContainerView;
-using CiphertextView = ByteContainerView;
-using SecureBlockView = ByteContainerView;
-
-AeadHandler::AeadHandler()
-    : offset_translator_(OffsetTranslator::Create(
-          sizeof(FileHeader), kBlockLength, kSecureBlockLength)) {}
+std::shared_ptr<AeadHandler::FileControl> AeadHandler::GetFileControl(int fd) {
+  absl::MutexLock global_lock(&mu_);
+  auto entry = fmap_.find(fd);
+  if (entry == fmap_.end()) {
+    return nullptr;
+  }
+  return entry->second;
+}
 
 bool AeadHandler::Deserialize(FileControl *file_ctrl) {
   if (!file_ctrl) {
@@ -152,12 +143,15 @@ bool AeadHandler::Deserialize(FileControl *file_ctrl) {
   }
   file_ctrl->mu.AssertHeld();
 
-  const GcmCryptor *cryptor = GetGcmCryptor(*file_ctrl);
-  if (!cryptor) {
-    return false;
-  }
-
   if (file_ctrl->is_new) {
+    file_ctrl->offset_translator =
+        OffsetTranslator::Create(kFileHeaderLength, file_ctrl->block_length,
+                                 file_ctrl->secure_block_length());
+    const GcmCryptor *cryptor = GetGcmCryptor(*file_ctrl);
+    if (!cryptor) {
+      return false;
+    }
+
     if (!UpdateDigest(file_ctrl, *cryptor)) {
       LOG(ERROR) << "Failed to update header on a new file, path="
                  << file_ctrl->path << ", errno = " << errno;
@@ -170,86 +164,217 @@ bool AeadHandler::Deserialize(FileControl *file_ctrl) {
     return true;
   }
 
-  // Rebuild the Merkle tree.
-  int fd = enc_untrusted_open(file_ctrl->path.c_str(), O_RDONLY);
+  int fd = GetHostFd(file_ctrl);
   if (fd == -1) {
-    LOG(ERROR) << "Failed to open file for collecting security metadata, path="
-               << file_ctrl->path << ", errno = " << errno;
     return false;
   }
 
-  FdCloser fd_closer(fd, &enc_untrusted_close);
-
-  // Read the header with digest.
+  // Read the header with digest. The header of a legacy file is shorter, and
+  // does not begin with kFileMagic.
   FileHeader file_header;
-  ssize_t bytes_read = read_all(fd, file_header.data(), sizeof(FileHeader));
-  if (bytes_read != sizeof(FileHeader)) {
+  ssize_t bytes_read = pread_all(fd, &file_header, sizeof(FileHeader), 0);
+  if (bytes_read < kLegacyFileHeaderLength) {
     LOG(ERROR) << "Failed to read the file header, bytes read = " << bytes_read;
     return false;
   }
 
+  FileHash file_hash;
+  uint64_t file_size;
+  uint32_t flags = 0;
+  if (bytes_read == sizeof(FileHeader) &&
+      memcmp(file_header.magic, kFileMagic, sizeof(kFileMagic)) == 0) {
+    if (!IsBlockLengthValid(file_header.block_length)) {
+      LOG(ERROR) << "Invalid block length in the file header, path="
+                 << file_ctrl->path
+                 << ", block length = " << file_header.block_length;
+      return false;
+    }
+    file_ctrl->block_length = file_header.block_length;
+    file_hash = file_header.file_hash;
+    file_size = file_header.file_size;
+    flags = file_header.flags;
+  } else {
+    LegacyFileHeader legacy_header;
+    memcpy(&legacy_header, &file_header, sizeof(LegacyFileHeader));
+    file_ctrl->is_legacy = true;
+    file_ctrl->block_length = kLegacyBlockLength;
+    file_hash = legacy_header.file_hash;
+    file_size = legacy_header.file_size;
+  }
+  file_ctrl->offset_translator = OffsetTranslator::Create(
+      file_ctrl->header_length(), file_ctrl->block_length,
+      file_ctrl->secure_block_length());
+
+  const GcmCryptor *cryptor = GetGcmCryptor(*file_ctrl);
+  if (!cryptor) {
+    return false;
+  }
+
   // In order to validate the integrity metadata and the file size have to first
   // collect integrity metadata across the file using the initially untrusted
   // value of the file size - then validation of the hash of the file digest
   // confirms validity of both the file size and the integrity metadata.
-  const int64_t blocks_count =
-      (file_header.file_size + kBlockLength - 1) / kBlockLength;
-  Tag tag;
-  for (int64_t block_index = 0; block_index < blocks_count; block_index++) {
-    off_t offset = enc_untrusted_lseek(fd, kBlockLength, SEEK_CUR);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek past block when collecting integrity metadata.";
-      return false;
+  const int64_t blocks_count = file_size / file_ctrl->block_length +
+                               (file_size % file_ctrl->block_length != 0);
+  // Prefer the leaf hashes persisted when the file was last closed, and fall
+  // back to the auth tags of the blocks if they are missing or out of date.
+  if (flags & kFileHeaderFlagHashCache) {
+    if (LoadHashCache(file_ctrl, blocks_count) &&
+        IsDigestValid(file_ctrl, *cryptor, file_hash, file_size)) {
+      VLOG(2) << "Loaded leaf hashes on initialization.";
+      file_ctrl->logical_size = file_size;
+      return true;
     }
+    LOG(WARNING) << "Ignoring stale leaf hashes of file " << file_ctrl->path;
+    file_ctrl->ad = absl::make_unique<CTMMTAuthenticatedDictionary>();
+  }
+
+  if (!LoadAuthTags(file_ctrl, blocks_count)) {
+    return false;
+  }
+
+  VLOG(2) << "Pushed block auth tags on initialization.";
+
+  // Validate AD root, the file size and the block length.
+  if (!IsDigestValid(file_ctrl, *cryptor, file_hash, file_size)) {
+    LOG(ERROR) << "Failure validating integrity root for file "
+               << file_ctrl->path << ", current root: "
+               << absl::BytesToHexString(file_ctrl->ad->CurrentRoot());
+    return false;
+  }
+
+  file_ctrl->logical_size = file_size;
+  return true;
+}
+
+bool AeadHandler::LoadAuthTags(FileControl *file_ctrl,
+                               int64_t blocks_count) const {
+  file_ctrl->mu.AssertHeld();
+  if (blocks_count == 0) {
+    return true;
+  }
+
+  int fd = GetHostFd(file_ctrl);
+  if (fd == -1) {
+    return false;
+  }
 
-    bytes_read = read_all(fd, tag.data(), kTagLength);
-    if (bytes_read != kTagLength) {
+  // Read whole secure blocks, several at a time, rather than issue a host call
+  // per auth tag.
+  const size_t secure_block_length = file_ctrl->secure_block_length();
+  const int64_t blocks_per_read = std::max<int64_t>(
+      kMaxMetadataReadLength / secure_block_length, 1);
+  std::vector<uint8_t> buffer(std::min(blocks_count, blocks_per_read) *
+                              secure_block_length);
+  for (int64_t first = 0; first < blocks_count; first += blocks_per_read) {
+    const int64_t count = std::min(blocks_per_read, blocks_count - first);
+    const size_t length = count * secure_block_length;
+    ssize_t bytes_read = pread_all(fd, buffer.data(), length,
+                                   file_ctrl->block_offset(first));
+    if (bytes_read != length) {
       LOG(ERROR) << "Failed to read integrity metadata, bytes_read="
                  << bytes_read;
       return false;
     }
 
-    std::string tag_string(reinterpret_cast<char *>(tag.data()), kTagLength);
-    VLOG(2) << "Adding auth tag as leaf to rebuild Merkle tree: "
-            << absl::BytesToHexString(tag_string);
-    file_ctrl->ad->AddLeaf(tag_string);
+    for (int64_t block_index = 0; block_index < count; block_index++) {
+      std::string tag_string(
+          reinterpret_cast<const char *>(buffer.data()) +
+              block_index * secure_block_length + file_ctrl->block_length,
+          kTagLength);
+      VLOG(2) << "Adding auth tag as leaf to rebuild Merkle tree: "
+              << absl::BytesToHexString(tag_string);
+      file_ctrl->ad->AddLeaf(tag_string);
+    }
+  }
+
+  return true;
+}
+
+bool AeadHandler::LoadHashCache(FileControl *file_ctrl,
+                                int64_t blocks_count) const {
+  file_ctrl->mu.AssertHeld();
+  int fd = GetHostFd(file_ctrl);
+  if (fd == -1) {
+    return false;
+  }
+
+  const off_t cache_offset = file_ctrl->block_offset(blocks_count);
+  const int64_t hashes_per_read = kMaxMetadataReadLength / kRootHashLength;
+  std::vector<char> buffer(std::min(blocks_count, hashes_per_read) *
+                           kRootHashLength);
+  for (int64_t first = 0; first < blocks_count; first += hashes_per_read) {
+    const int64_t count = std::min(hashes_per_read, blocks_count - first);
+    const size_t length = count * kRootHashLength;
+    ssize_t bytes_read = pread_all(fd, buffer.data(), length,
+                                   cache_offset + first * kRootHashLength);
+    if (bytes_read != length) {
+      LOG(ERROR) << "Failed to read leaf hashes, bytes_read=" << bytes_read;
+      return false;
+    }
+    for (int64_t i = 0; i < count; i++) {
+      if (file_ctrl->ad->AddLeafHash(std::string(
+              buffer.data() + i * kRootHashLength, kRootHashLength)) == 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool AeadHandler::PersistHashCache(FileControl *file_ctrl) const {
+  file_ctrl->mu.AssertHeld();
+  int fd = GetHostFd(file_ctrl);
+  if (fd == -1) {
+    return false;
+  }
 
-    offset = enc_untrusted_lseek(fd, kTokenLength, SEEK_CUR);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek past token when collecting integrity metadata.";
+  const int64_t blocks_count = file_ctrl->ad->LeafCount();
+  const off_t cache_offset = file_ctrl->block_offset(blocks_count);
+  const int64_t hashes_per_write = kMaxMetadataReadLength / kRootHashLength;
+  std::string buffer;
+  for (int64_t first = 0; first < blocks_count; first += hashes_per_write) {
+    const int64_t count = std::min(hashes_per_write, blocks_count - first);
+    buffer.clear();
+    for (int64_t i = 0; i < count; i++) {
+      buffer.append(file_ctrl->ad->LeafHash(first + i + 1));
+    }
+    ssize_t bytes_written = pwrite_all(fd, buffer.data(), buffer.size(),
+                                       cache_offset + first * kRootHashLength);
+    if (bytes_written != buffer.size()) {
+      LOG(ERROR) << "Failed to write leaf hashes, path=" << file_ctrl->path
+                 << ", bytes written = " << bytes_written;
       return false;
     }
   }
+  return true;
+}
 
-  VLOG(2) << "Pushed block auth tags on initialization.";
+bool AeadHandler::IsDigestValid(FileControl *file_ctrl,
+                                const GcmCryptor &cryptor,
+                                const FileHash &file_hash,
+                                uint64_t file_size) const {
+  file_ctrl->mu.AssertHeld();
+  std::string root = file_ctrl->ad->CurrentRoot();
+  if (root.size() != kRootHashLength) {
+    return false;
+  }
 
   // Prepare file data digest.
   DataDigest data_digest;
-  std::copy_n(
-      reinterpret_cast<const uint8_t *>(file_ctrl->ad->CurrentRoot().data()),
-      kRootHashLength, data_digest.data());
-  data_digest.file_size = file_header.file_size;
+  std::copy_n(reinterpret_cast<const uint8_t *>(root.data()), kRootHashLength,
+              data_digest.data());
+  data_digest.file_size = file_size;
+  data_digest.block_length = file_ctrl->block_length;
 
-  // Validate AD root and the file size.
   FileHash new_hash;
-  if (!cryptor->GetAuthTag(new_hash.data(), data_digest.data(),
-                           sizeof(DataDigest))) {
+  if (!cryptor.GetAuthTag(new_hash.data(), data_digest.data(),
+                          file_ctrl->digest_length())) {
     LOG(ERROR) << "Failed to generate CMAC for integrity verification, root="
-               << file_ctrl->ad->CurrentRoot();
+               << absl::BytesToHexString(root);
     return false;
   }
-
-  if (new_hash != file_header.file_hash) {
-    LOG(ERROR) << "Failure validating integrity root for file "
-               << file_ctrl->path << ", current root: "
-               << absl::BytesToHexString(file_ctrl->ad->CurrentRoot());
-    return false;
-  }
-
-  file_ctrl->logical_size = file_header.file_size;
-  return true;
+  return new_hash == file_hash;
 }
 
 bool AeadHandler::InitializeFile(int fd, const char *path_name,
@@ -282,26 +407,8 @@ bool AeadHandler::InitializeFile(int fd, const char *path_name,
   fmap_.emplace(fd, file_ctrl);
   opened_files_.emplace(path_name, file_ctrl);
 
-  return true;
-}
-
-bool AeadHandler::RetrieveLogicalOffset(int fd, off_t *logical_offset) const {
-  if (fd < 0) {
-    errno = EINVAL;
-    return false;
-  }
-
-  off_t physical_offset = enc_untrusted_lseek(fd, 0, SEEK_CUR);
-  if (physical_offset == -1) {
-    LOG(ERROR) << "Failed to retrieve SEEK_CUR offset on descriptor: " << fd;
-    return false;
-  }
-
-  *logical_offset = offset_translator_->PhysicalToLogical(physical_offset);
-  if (*logical_offset == OffsetTranslator::kInvalidOffset) {
-    LOG(ERROR) << "The file is corrupted, fd = " << fd;
-    return false;
-  }
+  absl::MutexLock lock(&file_ctrl->mu);
+  file_ctrl->offsets[fd] = 0;
 
   return true;
 }
@@ -314,7 +421,7 @@ GcmCryptor *AeadHandler::GetGcmCryptor(const FileControl &file_ctrl) const {
   }
 
   GcmCryptor *cryptor = GcmCryptorRegistry::GetInstance().GetGcmCryptor(
-      kBlockLength, *file_ctrl.master_key);
+      file_ctrl.block_length, *file_ctrl.master_key);
   if (!cryptor) {
     LOG(ERROR) << "Unable to instantiate GCM cryptor.";
   }
@@ -322,237 +429,445 @@ GcmCryptor *AeadHandler::GetGcmCryptor(const FileControl &file_ctrl) const {
   return cryptor;
 }
 
-ssize_t AeadHandler::DecryptAndVerify(int fd, void *buf, size_t count) {
-  if (!buf) {
-    errno = EINVAL;
-    return -1;
+int AeadHandler::GetHostFd(FileControl *file_ctrl) const {
+  file_ctrl->mu.AssertHeld();
+  if (file_ctrl->host_fd != -1) {
+    return file_ctrl->host_fd;
   }
 
-  off_t logical_offset;
-  if (!RetrieveLogicalOffset(fd, &logical_offset)) {
+  // The descriptors open on the file may be write-only, so the file is opened
+  // again to both fill partially written blocks and write blocks back.
+  int fd = enc_untrusted_open(file_ctrl->path.c_str(), O_RDWR);
+  if (fd == -1 && errno == EACCES) {
+    fd = enc_untrusted_open(file_ctrl->path.c_str(), O_RDONLY);
+  }
+  if (fd == -1) {
+    LOG(ERROR) << "Failed to open file to access file data, path="
+               << file_ctrl->path << ", errno = " << errno;
     return -1;
   }
 
-  std::shared_ptr<FileControl> file_ctrl;
-  {
-    absl::MutexLock global_lock(&mu_);
+  file_ctrl->host_fd = fd;
+  return fd;
+}
 
-    auto entry = fmap_.find(fd);
-    if (entry == fmap_.end()) {
-      LOG(ERROR) << "Attempt made to read from an unopened file, fd = " << fd;
-      errno = ENOENT;
-      return -1;
+AeadHandler::CachedBlock *AeadHandler::LookupBlock(FileControl *file_ctrl,
+                                                   int64_t index) const {
+  file_ctrl->mu.AssertHeld();
+  auto entry = file_ctrl->cache_index.find(index);
+  if (entry == file_ctrl->cache_index.end()) {
+    return nullptr;
+  }
+
+  file_ctrl->cache.splice(file_ctrl->cache.begin(), file_ctrl->cache,
+                          entry->second);
+  return &*entry->second;
+}
+
+AeadHandler::CachedBlock *AeadHandler::GetBlock(FileControl *file_ctrl,
+                                                GcmCryptor *cryptor,
+                                                int64_t index,
+                                                bool load) const {
+  file_ctrl->mu.AssertHeld();
+  CachedBlock *block = LookupBlock(file_ctrl, index);
+  if (block) {
+    return block;
+  }
+
+  if (!load) {
+    return InsertBlock(file_ctrl, cryptor, index);
+  }
+
+  if (!LoadBlocks(file_ctrl, cryptor, index, 1)) {
+    return nullptr;
+  }
+  return LookupBlock(file_ctrl, index);
+}
+
+AeadHandler::CachedBlock *AeadHandler::InsertBlock(FileControl *file_ctrl,
+                                                   GcmCryptor *cryptor,
+                                                   int64_t index) const {
+  file_ctrl->mu.AssertHeld();
+  std::vector<uint8_t> data;
+  if (file_ctrl->cache.size() >= file_ctrl->cache_capacity()) {
+    // Evicting a dirty block writes back all dirty blocks, so that writes
+    // reach the host in as few calls as possible. The digest is updated along
+    // with them, so that the file stays valid if it is not closed.
+    CachedBlock &victim = file_ctrl->cache.back();
+    if (victim.dirty && (!WriteBackBlocks(file_ctrl, cryptor) ||
+                         !UpdateDigest(file_ctrl, *cryptor))) {
+      return nullptr;
     }
 
-    file_ctrl = entry->second;
+    data = std::move(victim.data);
+    std::fill(data.begin(), data.end(), 0);
+    file_ctrl->cache_index.erase(victim.index);
+    file_ctrl->cache.pop_back();
+  } else {
+    data.resize(file_ctrl->block_length);
   }
 
-  absl::MutexLock lock(&file_ctrl->mu);
-  return DecryptAndVerifyInternal(fd, buf, count, *file_ctrl, logical_offset);
+  file_ctrl->cache.push_front(CachedBlock{index, false, std::move(data)});
+  file_ctrl->cache_index[index] = file_ctrl->cache.begin();
+  return &file_ctrl->cache.front();
 }
 
-ssize_t AeadHandler::DecryptAndVerifyInternal(int fd, void *buf, size_t count,
-                                              const FileControl &file_ctrl,
-                                              off_t logical_offset) const {
-  file_ctrl.mu.AssertHeld();
-  if (count == 0) {
-    return 0;
+bool AeadHandler::LoadBlocks(FileControl *file_ctrl, GcmCryptor *cryptor,
+                             int64_t first, int64_t count) const {
+  file_ctrl->mu.AssertHeld();
+  const size_t block_length = file_ctrl->block_length;
+  const size_t secure_block_length = file_ctrl->secure_block_length();
+
+  // Only blocks which have been written to the file need to be read.
+  const int64_t leaf_count = file_ctrl->ad->LeafCount();
+  const int64_t persisted_count =
+      std::max<int64_t>(std::min(first + count, leaf_count) - first, 0);
+  std::vector<uint8_t> buffer(persisted_count * secure_block_length);
+  ssize_t bytes_read = 0;
+  if (persisted_count > 0) {
+    int fd = GetHostFd(file_ctrl);
+    if (fd == -1) {
+      return false;
+    }
+
+    bytes_read = pread_all(fd, buffer.data(), buffer.size(),
+                           file_ctrl->block_offset(first));
+    if (bytes_read == -1) {
+      LOG(ERROR) << "Failed to read file data, path = " << file_ctrl->path;
+      return false;
+    }
   }
 
-  // Check for logical EOF.
-  if (logical_offset >= file_ctrl.logical_size) {
-    return 0;
+  // Verify the auth tags of the blocks, then decrypt them as one batch.
+  std::vector<const uint8_t *> ciphertexts;
+  std::vector<const uint8_t *> tokens;
+  std::vector<uint8_t *> plaintexts;
+  bool verified = true;
+  for (int64_t block_index = 0; block_index < count && verified;
+       block_index++) {
+    const int64_t index = first + block_index;
+    CachedBlock *block = InsertBlock(file_ctrl, cryptor, index);
+    if (!block) {
+      verified = false;
+      break;
+    }
+
+    // Blocks past the end of the written data, and blocks that belong to
+    // sparse regions in the file, read as zeros - no need to decrypt.
+    if (index >= leaf_count ||
+        file_ctrl->ad->LeafHash(index + 1) == file_ctrl->zero_hash) {
+      continue;
+    }
+
+    const uint8_t *secure_block =
+        buffer.data() + block_index * secure_block_length;
+    verified = (block_index + 1) * secure_block_length <=
+               static_cast<size_t>(bytes_read);
+    if (!verified) {
+      LOG(ERROR) << "Cannot verify data - data has not been read, path = "
+                 << file_ctrl->path;
+      break;
+    }
+    std::string tag_string(
+        reinterpret_cast<const char *>(secure_block) + block_length,
+        kTagLength);
+    verified = file_ctrl->ad->LeafHash(index + 1) ==
+               file_ctrl->ad->LeafHash(tag_string);
+    if (!verified) {
+      LOG(ERROR) << "Integrity verification failed, path = "
+                 << file_ctrl->path;
+      break;
+    }
+    ciphertexts.push_back(secure_block);
+    tokens.push_back(secure_block + block_length + kTagLength);
+    plaintexts.push_back(block->data.data());
   }
 
-  // Do not read beyond the EOF.
-  if (logical_offset + count >= file_ctrl.logical_size) {
-    count = file_ctrl.logical_size - logical_offset;
-  }
-
-  // Determine data breakdown into logical blocks.
-  size_t first_partial_block_bytes_count;
-  size_t last_partial_block_bytes_count;
-  size_t full_inclusive_blocks_bytes_count;
-  offset_translator_->ReduceLogicalRangeToFullLogicalBlocks(
-      logical_offset, count, &first_partial_block_bytes_count,
-      &last_partial_block_bytes_count, &full_inclusive_blocks_bytes_count);
-
-  // Use single read buffer to minimize the number of read calls to the host.
-  std::vector<uint8_t> buffer;
-  const size_t physical_bytes_count =
-      (full_inclusive_blocks_bytes_count / kBlockLength) * kSecureBlockLength;
-  buffer.resize(physical_bytes_count);
-
-  // Move cursor to the first full block to read.
-  const off_t first_logical_block_offset =
-      (first_partial_block_bytes_count > 0)
-          ? (logical_offset + first_partial_block_bytes_count - kBlockLength)
-          : logical_offset;
-  const off_t first_physical_block_offset =
-      offset_translator_->LogicalToPhysical(first_logical_block_offset);
-  if (first_partial_block_bytes_count > 0) {
-    off_t offset =
-        enc_untrusted_lseek(fd, first_physical_block_offset, SEEK_SET);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek to the fist block offset when reading file data.";
-      return -1;
+  if (verified) {
+    verified = cryptor->DecryptBlocks(ciphertexts.size(), ciphertexts.data(),
+                                      tokens.data(), plaintexts.data());
+    if (!verified) {
+      LOG(ERROR) << "Decryption failed, path = " << file_ctrl->path;
     }
   }
 
-  // Perform the read. Read may have been requested beyond EOF - cannot require
-  // that bytes_read is equal to physical_bytes_count. The read was not
-  // requested at EOF - checked this above.
-  ssize_t bytes_read =
-      enc_untrusted_read(fd, buffer.data(), physical_bytes_count);
-  if (bytes_read <= 0) {
-    LOG(ERROR) << "Cannot verify data - data has not been read, fd = " << fd;
+  if (!verified) {
+    // Do not leave unverified blocks in the cache.
+    for (int64_t index = first; index < first + count; index++) {
+      auto entry = file_ctrl->cache_index.find(index);
+      if (entry != file_ctrl->cache_index.end()) {
+        file_ctrl->cache.erase(entry->second);
+        file_ctrl->cache_index.erase(entry);
+      }
+    }
+    errno = EIO;
+    return false;
+  }
+
+  return true;
+}
+
+bool AeadHandler::WriteBackBlocks(FileControl *file_ctrl,
+                                  GcmCryptor *cryptor) const {
+  file_ctrl->mu.AssertHeld();
+  std::vector<CachedBlock *> dirty_blocks;
+  for (CachedBlock &block : file_ctrl->cache) {
+    if (block.dirty) {
+      dirty_blocks.push_back(&block);
+    }
+  }
+  if (dirty_blocks.empty()) {
+    return true;
+  }
+
+  int fd = GetHostFd(file_ctrl);
+  if (fd == -1) {
+    return false;
+  }
+
+  std::sort(dirty_blocks.begin(), dirty_blocks.end(),
+            [](const CachedBlock *lhs, const CachedBlock *rhs) {
+              return lhs->index < rhs->index;
+            });
+
+  // Encrypt all dirty blocks as one batch, in order of their index.
+  const size_t block_length = file_ctrl->block_length;
+  const size_t secure_block_length = file_ctrl->secure_block_length();
+  std::vector<uint8_t> buffer(dirty_blocks.size() * secure_block_length);
+  std::vector<const uint8_t *> plaintexts(dirty_blocks.size());
+  std::vector<uint8_t *> tokens(dirty_blocks.size());
+  std::vector<uint8_t *> ciphertexts(dirty_blocks.size());
+  for (size_t i = 0; i < dirty_blocks.size(); i++) {
+    uint8_t *secure_block = buffer.data() + i * secure_block_length;
+    plaintexts[i] = dirty_blocks[i]->data.data();
+    tokens[i] = secure_block + block_length + kTagLength;
+    ciphertexts[i] = secure_block;
+  }
+  if (!cryptor->EncryptBlocks(dirty_blocks.size(), plaintexts.data(),
+                              tokens.data(), ciphertexts.data())) {
+    LOG(ERROR) << "Encryption failed, path = " << file_ctrl->path;
+    return false;
+  }
+
+  size_t run_start = 0;
+  while (run_start < dirty_blocks.size()) {
+    size_t run_end = run_start + 1;
+    while (run_end < dirty_blocks.size() &&
+           dirty_blocks[run_end]->index ==
+               dirty_blocks[run_end - 1]->index + 1) {
+      run_end++;
+    }
+
+    // Write each run of consecutive blocks with a single write call to the
+    // host.
+    const int64_t first_index = dirty_blocks[run_start]->index;
+    const size_t run_length = run_end - run_start;
+    const uint8_t *run_data = buffer.data() + run_start * secure_block_length;
+    ssize_t bytes_written =
+        pwrite_all(fd, run_data, run_length * secure_block_length,
+                   file_ctrl->block_offset(first_index));
+    if (bytes_written != run_length * secure_block_length) {
+      LOG(ERROR) << "Failed to write encrypted data to file, path="
+                 << file_ctrl->path << ", bytes written = " << bytes_written;
+      return false;
+    }
+
+    for (size_t block_index = 0; block_index < run_length; block_index++) {
+      const int64_t index = first_index + block_index;
+      std::string tag_string(reinterpret_cast<const char *>(run_data) +
+                                 block_index * secure_block_length +
+                                 block_length,
+                             kTagLength);
+      // Append leafs to the Merkle Tree to account for sparse region blocks.
+      while (file_ctrl->ad->LeafCount() < index) {
+        VLOG(2) << "Adding an empty auth tag to AD for a block "
+                   "from a sparse region: "
+                << absl::BytesToHexString(file_ctrl->zero_hash);
+        file_ctrl->ad->AddLeafHash(file_ctrl->zero_hash);
+      }
+      if (index < file_ctrl->ad->LeafCount()) {
+        VLOG(2) << "Updating auth tag on AD: "
+                << absl::BytesToHexString(tag_string);
+        file_ctrl->ad->UpdateLeaf(index + 1, tag_string);
+      } else {
+        VLOG(2) << "Appending auth tag to AD: "
+                << absl::BytesToHexString(tag_string);
+        file_ctrl->ad->AddLeaf(tag_string);
+      }
+      dirty_blocks[run_start + block_index]->dirty = false;
+    }
+
+    run_start = run_end;
+  }
+
+  VLOG(2) << "Wrote back dirty blocks, path = " << file_ctrl->path
+          << ", blocks = " << dirty_blocks.size();
+  return true;
+}
+
+bool AeadHandler::FlushLocked(FileControl *file_ctrl, bool closing) const {
+  file_ctrl->mu.AssertHeld();
+  if (!file_ctrl->is_deserialized) {
+    // Nothing can have been written to the file.
+    return true;
+  }
+
+  GcmCryptor *cryptor = GetGcmCryptor(*file_ctrl);
+  if (!cryptor) {
+    return false;
+  }
+
+  if (!WriteBackBlocks(file_ctrl, cryptor)) {
+    return false;
+  }
+
+  // Store the leaf hashes of large files modified since they were opened. All
+  // blocks are persisted at this point, so there is a leaf per block.
+  const int64_t blocks_count =
+      (file_ctrl->logical_size + file_ctrl->block_length - 1) /
+      file_ctrl->block_length;
+  bool hash_cache =
+      closing && !file_ctrl->is_legacy &&
+      (file_ctrl->is_digest_stale || file_ctrl->is_hash_cache_stale) &&
+      blocks_count >= kHashCacheMinBlocks &&
+      file_ctrl->ad->LeafCount() == blocks_count;
+  if (hash_cache && !PersistHashCache(file_ctrl)) {
+    hash_cache = false;
+  }
+
+  if ((file_ctrl->is_digest_stale || hash_cache) &&
+      !UpdateDigest(file_ctrl, *cryptor, hash_cache)) {
+    return false;
+  }
+
+  return true;
+}
+
+ssize_t AeadHandler::ReadLocked(FileControl *file_ctrl, GcmCryptor *cryptor,
+                                uint8_t *buf, off_t logical_offset,
+                                size_t count, int64_t last_index) const {
+  const size_t block_length = file_ctrl->block_length;
+  size_t read_count = 0;
+  while (read_count < count) {
+    const int64_t index = (logical_offset + read_count) / block_length;
+    const size_t offset_in_block = (logical_offset + read_count) % block_length;
+    const size_t length =
+        std::min(block_length - offset_in_block, count - read_count);
+
+    CachedBlock *block = LookupBlock(file_ctrl, index);
+    if (!block) {
+      // Load the run of uncached blocks the read covers with a single read
+      // from the host.
+      const int64_t max_run_length = file_ctrl->cache_capacity();
+      int64_t run_length = 1;
+      while (index + run_length <= last_index &&
+             run_length < max_run_length &&
+             file_ctrl->cache_index.count(index + run_length) == 0) {
+        run_length++;
+      }
+      if (!LoadBlocks(file_ctrl, cryptor, index, run_length)) {
+        return -1;
+      }
+      block = LookupBlock(file_ctrl, index);
+      if (!block) {
+        errno = EIO;
+        return -1;
+      }
+    }
+
+    memcpy(buf + read_count, block->data.data() + offset_in_block, length);
+    read_count += length;
+  }
+  return read_count;
+}
+
+ssize_t AeadHandler::DecryptAndVerify(int fd, void *buf, size_t count) {
+  if (!buf) {
+    errno = EINVAL;
     return -1;
   }
+  struct iovec iov = {buf, count};
+  return DecryptAndVerifyVector(fd, &iov, 1, /*offset=*/-1);
+}
 
-  // Process only complete blocks read, since need per-block metadata to decrypt
-  // the block.
-  bytes_read = (bytes_read / kSecureBlockLength) * kSecureBlockLength;
-  if (bytes_read == 0) {
-    LOG(ERROR) << "Cannot verify data - data has not been read, fd = " << fd;
+ssize_t AeadHandler::DecryptAndVerifyVector(int fd, const struct iovec *iov,
+                                            int iovcnt, off_t offset) {
+  ssize_t total_length = IovecLength(iov, iovcnt);
+  if (total_length < 0) {
     return -1;
   }
+  size_t count = total_length;
 
-  // Move cursor to the position of the end of the read range.
-  off_t new_cur_logical_offset = logical_offset + count;
-  if (bytes_read != physical_bytes_count) {
-    int64_t blocks_not_read =
-        (physical_bytes_count - bytes_read) / kSecureBlockLength;
-    if (last_partial_block_bytes_count > 0) {
-      new_cur_logical_offset -= last_partial_block_bytes_count;
-      blocks_not_read--;
-    }
-    new_cur_logical_offset -= blocks_not_read * kBlockLength;
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to read from an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
   }
-  const off_t new_cur_physical_offset =
-      offset_translator_->LogicalToPhysical(new_cur_logical_offset);
-  off_t offset = enc_untrusted_lseek(fd, new_cur_physical_offset, SEEK_SET);
-  if (offset == -1) {
-    LOG(ERROR) << "Failed lseek to the end of read range.";
+
+  absl::MutexLock lock(&file_ctrl->mu);
+  auto fd_offset = file_ctrl->offsets.find(fd);
+  if (fd_offset == file_ctrl->offsets.end()) {
+    errno = EBADF;
     return -1;
   }
 
-  GcmCryptor *cryptor = GetGcmCryptor(file_ctrl);
+  GcmCryptor *cryptor = GetGcmCryptor(*file_ctrl);
   if (!cryptor) {
     return -1;
   }
+  if (!file_ctrl->is_deserialized) {
+    LOG(ERROR) << "Integrity metadata has not been loaded, fd = " << fd;
+    errno = EPERM;
+    return -1;
+  }
 
-  // Cycle through blocks.
-  const int64_t blocks_read = bytes_read / kSecureBlockLength;
-  const int64_t blocks_read_max = physical_bytes_count / kSecureBlockLength;
-  const off_t first_block_index =
-      (first_physical_block_offset - sizeof(FileHeader)) / kSecureBlockLength;
-  size_t read_count = 0;
-  for (int64_t block_index = 0; block_index < blocks_read; block_index++) {
-    const size_t merkle_block_idx = first_block_index + block_index + 1;
-
-    uint8_t *plaintext_data =
-        GetPlaintextBuffer(first_partial_block_bytes_count, block_index, buf);
-
-    // Detect full blocks that belong to sparse regions in the file - no need to
-    // decrypt.
-    if (file_ctrl.ad->LeafHash(merkle_block_idx) == file_ctrl.zero_hash) {
-      VLOG(2) << "A sparse region block detected.";
-      memset(plaintext_data, 0, kBlockLength);
-      read_count += kBlockLength;
-      continue;
-    }
+  // Check for logical EOF.
+  const off_t logical_offset = offset < 0 ? fd_offset->second : offset;
+  if (count == 0 || logical_offset >= file_ctrl->logical_size) {
+    return 0;
+  }
 
-    CiphertextView ciphertext(buffer.data() + block_index * kSecureBlockLength,
-                              kCipherBlockLength);
-    VLOG(2) << "Ciphertext read: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char *>(ciphertext.data()),
-                   kCipherBlockLength));
-
-    TagView tag(buffer.data() + block_index * kSecureBlockLength + kBlockLength,
-                kTagLength);
-    VLOG(2) << "Auth tag read: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char *>(tag.data()), kTagLength));
-
-    TokenView token(
-        buffer.data() + block_index * kSecureBlockLength + kCipherBlockLength,
-        kTokenLength);
-    VLOG(2) << "Token read: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char *>(token.data()), kTokenLength));
-
-    // Note: Verifying integrity tag will be replaced with integrity
-    // verification against AD root if/when AD tree will be stored in a file
-    // (i.e. if/when optimizing integrity assurance for large files).
-    if (file_ctrl.ad->LeafHash(merkle_block_idx) !=
-        file_ctrl.ad->LeafHash(std::string(
-            reinterpret_cast<const char *>(tag.data()), kTagLength))) {
-      LOG(ERROR) << "Integrity verification failed, fd = " << fd;
-      return -1;
-    }
+  // Do not read beyond the EOF.
+  count = std::min<size_t>(count, file_ctrl->logical_size - logical_offset);
 
-    // Bounce block for reading partial blocks at the ends of the full range.
-    Block bounce_block;
-    // Target for decryption - bounce block or the supplied buffer.
-    uint8_t *decrypt_target;
-    // Determine the target depending on whether the read block is at the end of
-    // the full range.
-    if ((block_index == 0 && first_partial_block_bytes_count > 0) ||
-        (block_index == blocks_read_max - 1 &&
-         last_partial_block_bytes_count > 0)) {
-      decrypt_target = bounce_block.data();
-    } else {
-      decrypt_target = plaintext_data;
-    }
-
-    // Decrypt the block.
-    if (!cryptor->DecryptBlock(ciphertext.data(), token.data(),
-                               decrypt_target)) {
-      LOG(ERROR) << "Decryption failed, fd = " << fd;
+  // Runs of uncached blocks are loaded across the boundaries of the buffers.
+  const int64_t last_index =
+      (logical_offset + count - 1) / file_ctrl->block_length;
+  size_t read_count = 0;
+  for (int i = 0; i < iovcnt && read_count < count; ++i) {
+    const size_t length = std::min(iov[i].iov_len, count - read_count);
+    ssize_t result = ReadLocked(
+        file_ctrl.get(), cryptor, static_cast<uint8_t *>(iov[i].iov_base),
+        logical_offset + read_count, length, last_index);
+    if (result < 0) {
+      LOG(ERROR) << "Cannot verify data, fd = " << fd;
       return -1;
     }
-
-    // Copy content from the bounce buffer, if used. Increment the count of read
-    // bytes.
-    if (block_index == 0 && first_partial_block_bytes_count > 0) {
-      std::copy_n(
-          bounce_block.begin() + kBlockLength - first_partial_block_bytes_count,
-          first_partial_block_bytes_count, plaintext_data);
-      read_count += first_partial_block_bytes_count;
-    } else if (block_index == blocks_read_max - 1 &&
-               last_partial_block_bytes_count > 0) {
-      std::copy_n(bounce_block.begin(), last_partial_block_bytes_count,
-                  plaintext_data);
-      read_count += last_partial_block_bytes_count;
-    } else {
-      read_count += kBlockLength;
-    }
+    read_count += result;
   }
 
-  VLOG(2) << "Verified read blocks, blocks_read = " << blocks_read
-          << ", bytes_read = " << bytes_read;
+  if (offset < 0) {
+    fd_offset->second += read_count;
+  }
+  VLOG(2) << "Verified read blocks, bytes_read = " << read_count;
   return read_count;
 }
 
 bool AeadHandler::UpdateDigest(FileControl *file_ctrl,
-                               const GcmCryptor &cryptor) const {
+                               const GcmCryptor &cryptor,
+                               bool hash_cache) const {
   if (!file_ctrl) {
     errno = EINVAL;
     return false;
   }
   file_ctrl->mu.AssertHeld();
 
-  int fd = enc_untrusted_open(file_ctrl->path.c_str(), O_WRONLY);
+  int fd = GetHostFd(file_ctrl);
   if (fd == -1) {
-    LOG(ERROR) << "Failed to open file to save data digest, path="
-               << file_ctrl->path << ", errno = " << errno;
     return false;
   }
 
-  FdCloser fd_closer(fd, &enc_untrusted_close);
-
   std::string root = file_ctrl->ad->CurrentRoot();
   if (root.size() != kRootHashLength) {
     LOG(ERROR) << "Unexpected size of root hash encountered, size="
@@ -565,68 +880,78 @@ bool AeadHandler::UpdateDigest(FileControl *file_ctrl,
   std::copy_n(reinterpret_cast<const uint8_t *>(root.data()), kRootHashLength,
               data_digest.data());
   data_digest.file_size = file_ctrl->logical_size;
+  data_digest.block_length = file_ctrl->block_length;
 
-  FileHeader header;
-  if (!cryptor.GetAuthTag(header.data(), data_digest.data(),
-                          sizeof(DataDigest))) {
+  FileHash file_hash;
+  if (!cryptor.GetAuthTag(file_hash.data(), data_digest.data(),
+                          file_ctrl->digest_length())) {
     LOG(ERROR) << "Failed to generate CMAC, root = " << root;
     return false;
   }
-  header.file_size = file_ctrl->logical_size;
 
   VLOG(2) << "Updating the digest for file: " << file_ctrl->path
           << ", root hash: " << absl::BytesToHexString(root);
-  ssize_t bytes_written = write_all(fd, header.data(), sizeof(FileHeader));
-  if (bytes_written != sizeof(FileHeader)) {
+  static_assert(sizeof(FileHeader) == kFileHeaderLength,
+                "FileHeader contains unexpected padding.");
+  static_assert(sizeof(LegacyFileHeader) == kLegacyFileHeaderLength,
+                "LegacyFileHeader contains unexpected padding.");
+  ssize_t bytes_written;
+  if (file_ctrl->is_legacy) {
+    LegacyFileHeader header;
+    header.file_hash = file_hash;
+    header.file_size = file_ctrl->logical_size;
+    bytes_written = pwrite_all(fd, &header, sizeof(LegacyFileHeader), 0);
+  } else {
+    FileHeader header;
+    memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+    header.file_hash = file_hash;
+    header.file_size = file_ctrl->logical_size;
+    header.block_length = file_ctrl->block_length;
+    header.flags = hash_cache ? kFileHeaderFlagHashCache : 0;
+    bytes_written = pwrite_all(fd, &header, sizeof(FileHeader), 0);
+  }
+  if (bytes_written != file_ctrl->header_length()) {
     LOG(ERROR) << "Failed to write full digest to file, path="
                << file_ctrl->path << ", bytes written = " << bytes_written;
     return false;
   }
 
-  if (!fd_closer.reset()) {
-    LOG(ERROR) << "Failed to close the file after digest update, path="
-               << file_ctrl->path;
-    return false;
-  }
-
+  file_ctrl->is_digest_stale = false;
+  file_ctrl->is_hash_cache_stale = !hash_cache;
   return true;
 }
 
-bool AeadHandler::ReadFullBlock(const FileControl &file_ctrl,
-                                off_t logical_offset, Block *block) const {
-  file_ctrl.mu.AssertHeld();
-  if (logical_offset < 0 || logical_offset % kBlockLength != 0) {
-    errno = EINVAL;
-    return false;
-  }
-
-  int fd = enc_untrusted_open(file_ctrl.path.c_str(), O_RDONLY);
-  if (fd == -1) {
-    LOG(ERROR) << "Failed to open file to read a block, path=" << file_ctrl.path
-               << ", errno = " << errno;
-    return false;
-  }
-
-  FdCloser fd_closer(fd, &enc_untrusted_close);
+size_t AeadHandler::WriteLocked(FileControl *file_ctrl, GcmCryptor *cryptor,
+                                 const uint8_t *buf, off_t logical_offset,
+                                 size_t count) const {
+  const size_t block_length = file_ctrl->block_length;
+  size_t write_count = 0;
+  while (write_count < count) {
+    const int64_t index = (logical_offset + write_count) / block_length;
+    const size_t offset_in_block =
+        (logical_offset + write_count) % block_length;
+    const size_t length =
+        std::min(block_length - offset_in_block, count - write_count);
+
+    // Only blocks written partially need to be read from the file first.
+    CachedBlock *block =
+        GetBlock(file_ctrl, cryptor, index, /*load=*/length != block_length);
+    if (!block) {
+      LOG(ERROR) << "Failed to read a misaligned block when writing";
+      break;
+    }
 
-  off_t physical_offset = offset_translator_->LogicalToPhysical(logical_offset);
-  off_t offset = enc_untrusted_lseek(fd, physical_offset, SEEK_SET);
-  if (offset == -1) {
-    LOG(ERROR) << "Failed lseek when reading a full block.";
-    return false;
-  }
+    memcpy(block->data.data() + offset_in_block, buf + write_count, length);
+    block->dirty = true;
+    write_count += length;
 
-  ssize_t bytes_read = DecryptAndVerifyInternal(fd, block->data(), kBlockLength,
-                                                file_ctrl, logical_offset);
-  if (bytes_read == -1) {
-    return -1;
+    // Grow the file as blocks are written, so that a digest written when a
+    // later block of this write evicts them covers all of their leaves.
+    file_ctrl->logical_size = std::max<size_t>(file_ctrl->logical_size,
+                                               logical_offset + write_count);
+    file_ctrl->is_digest_stale = true;
   }
-
-  if (bytes_read < kBlockLength) {
-    memset(block->data() + bytes_read, 0, kBlockLength - bytes_read);
-  }
-
-  return true;
+  return write_count;
 }
 
 ssize_t AeadHandler::EncryptAndPersist(int fd, const void *buf, size_t count) {
@@ -634,253 +959,180 @@ ssize_t AeadHandler::EncryptAndPersist(int fd, const void *buf, size_t count) {
     errno = EINVAL;
     return -1;
   }
+  struct iovec iov = {const_cast<void *>(buf), count};
+  return EncryptAndPersistVector(fd, &iov, 1, /*offset=*/-1);
+}
 
-  off_t logical_offset;
-  if (!RetrieveLogicalOffset(fd, &logical_offset)) {
+ssize_t AeadHandler::EncryptAndPersistVector(int fd, const struct iovec *iov,
+                                             int iovcnt, off_t offset) {
+  ssize_t total_length = IovecLength(iov, iovcnt);
+  if (total_length < 0) {
     return -1;
   }
+  size_t count = total_length;
 
-  std::shared_ptr<FileControl> file_ctrl;
-  {
-    absl::MutexLock global_lock(&mu_);
-
-    auto entry = fmap_.find(fd);
-    if (entry == fmap_.end()) {
-      LOG(ERROR) << "Attempt made to write to an unopened file, fd = " << fd;
-      errno = ENOENT;
-      return -1;
-    }
-
-    file_ctrl = entry->second;
-  }
-
-  if (count == 0) {
-    return 0;
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to write to an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
   }
 
   absl::MutexLock lock(&file_ctrl->mu);
-
-  // Determine data breakdown into logical blocks.
-  size_t first_partial_block_bytes_count;
-  size_t last_partial_block_bytes_count;
-  size_t full_inclusive_blocks_bytes_count;
-  offset_translator_->ReduceLogicalRangeToFullLogicalBlocks(
-      logical_offset, count, &first_partial_block_bytes_count,
-      &last_partial_block_bytes_count, &full_inclusive_blocks_bytes_count);
-
-  // Bounce block for writing the first partial block in the range, if any.
-  Block first_block;
-  if (first_partial_block_bytes_count > 0) {
-    if (!ReadFullBlock(
-            *file_ctrl,
-            logical_offset + first_partial_block_bytes_count - kBlockLength,
-            &first_block)) {
-      LOG(ERROR)
-          << "failed to read the first misaligned block when writing, fd = "
-          << fd;
-      return -1;
-    }
-
-    std::copy_n(
-        reinterpret_cast<const uint8_t *>(buf), first_partial_block_bytes_count,
-        first_block.data() + kBlockLength - first_partial_block_bytes_count);
+  auto fd_offset = file_ctrl->offsets.find(fd);
+  if (fd_offset == file_ctrl->offsets.end()) {
+    errno = EBADF;
+    return -1;
   }
 
-  // Bounce block for writing the last partial block in the range, if any.
-  Block last_block;
-  if (last_partial_block_bytes_count > 0) {
-    if (!ReadFullBlock(*file_ctrl,
-                       logical_offset + count - last_partial_block_bytes_count,
-                       &last_block)) {
-      LOG(ERROR)
-          << "failed to read the last misaligned block when writing, fd = "
-          << fd;
-      return -1;
-    }
-
-    std::copy_n(reinterpret_cast<const uint8_t *>(buf) + count -
-                    last_partial_block_bytes_count,
-                last_partial_block_bytes_count, last_block.data());
-  }
-
-  const off_t first_logical_block_offset =
-      (first_partial_block_bytes_count > 0)
-          ? (logical_offset + first_partial_block_bytes_count - kBlockLength)
-          : logical_offset;
-  const off_t first_physical_block_offset =
-      offset_translator_->LogicalToPhysical(first_logical_block_offset);
-  const int64_t eof_block_index = file_ctrl->ad->LeafCount();
-  int64_t start_block_to_write = 0;
-  if (first_physical_block_offset > file_ctrl->physical_size()) {
-    // Append leafs to the Merkle Tree to account for sparse region blocks.
-    int64_t sparse_blocks_count =
-        (first_physical_block_offset - file_ctrl->physical_size()) /
-        kSecureBlockLength;
-    for (int64_t idx = 0; idx < sparse_blocks_count; idx++) {
-      VLOG(2) << "Adding an empty auth tag to AD for a block "
-                 "from a sparse region: "
-              << absl::BytesToHexString(file_ctrl->zero_hash);
-      file_ctrl->ad->AddLeafHash(file_ctrl->zero_hash);
-    }
-    start_block_to_write = eof_block_index + sparse_blocks_count;
-  } else {
-    int64_t blocks_to_eof =
-        (file_ctrl->physical_size() - first_physical_block_offset) /
-        kSecureBlockLength;
-    start_block_to_write = eof_block_index - blocks_to_eof;
+  if (count == 0) {
+    return 0;
   }
 
   GcmCryptor *cryptor = GetGcmCryptor(*file_ctrl);
   if (!cryptor) {
     return -1;
   }
+  if (!file_ctrl->is_deserialized) {
+    LOG(ERROR) << "Integrity metadata has not been loaded, fd = " << fd;
+    errno = EPERM;
+    return -1;
+  }
 
   VLOG(2) << "Writing data to file, count = " << count << ", fd = " << fd;
 
-  // Use single write buffer to minimize the number of write calls to the host.
-  std::vector<uint8_t> buffer;
-  const int64_t blocks_to_write =
-      full_inclusive_blocks_bytes_count / kBlockLength;
-  const size_t physical_bytes_count = blocks_to_write * kSecureBlockLength;
-  buffer.resize(physical_bytes_count);
-
-  // Cycle through blocks.
-  std::vector<Tag> tags;
-  for (int64_t block_index = 0; block_index < blocks_to_write; block_index++) {
-    const uint8_t *plaintext_data =
-        GetPlaintextBuffer(first_partial_block_bytes_count, block_index, buf);
-
-    // Source for encryption - bounce block or the supplied buffer.
-    const uint8_t *encrypt_source;
-    // Determine the source depending on whether the written block is at the end
-    // of the full range.
-    if (block_index == 0 && first_partial_block_bytes_count > 0) {
-      encrypt_source = first_block.data();
-    } else if (block_index == blocks_to_write - 1 &&
-               last_partial_block_bytes_count > 0) {
-      encrypt_source = last_block.data();
-    } else {
-      encrypt_source = plaintext_data;
-    }
-
-    Ciphertext *ciphertext =
-        Ciphertext::Place(&buffer, block_index * kSecureBlockLength);
-    Token *token = Token::Place(
-        &buffer, block_index * kSecureBlockLength + kCipherBlockLength);
-
-    // Encrypt the block.
-    if (!cryptor->EncryptBlock(encrypt_source, token->data(),
-                               ciphertext->data())) {
-      LOG(ERROR) << "Encryption failed, fd = " << fd;
-      return -1;
-    }
-    VLOG(2) << "Ciphertext generated: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char *>(ciphertext->data()),
-                   kBlockLength));
-    VLOG(2) << "Token generated: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char *>(token->data()),
-                   kTokenLength));
-
-    TagView tag(ciphertext->data() + kBlockLength, kTagLength);
-    tags.push_back(tag);
-    VLOG(2) << "Auth tag generated: "
-            << absl::BytesToHexString(absl::string_view(
-                   reinterpret_cast<const char *>(tag.data()), kTagLength));
-  }
-
-  // Move cursor to the first full block to write.
-  if (first_partial_block_bytes_count > 0) {
-    off_t offset =
-        enc_untrusted_lseek(fd, first_physical_block_offset, SEEK_SET);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek to the fist block offset when writing file data.";
-      return -1;
+  // All buffers are copied into cached blocks under a single acquisition of the
+  // file lock, so that the blocks they modify are encrypted together when they
+  // are written back.
+  const off_t logical_offset = offset < 0 ? fd_offset->second : offset;
+  size_t write_count = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    size_t result = WriteLocked(
+        file_ctrl.get(), cryptor, static_cast<const uint8_t *>(iov[i].iov_base),
+        logical_offset + write_count, iov[i].iov_len);
+    write_count += result;
+    if (result < iov[i].iov_len) {
+      LOG(ERROR) << "Failed to write all data, fd = " << fd;
+      break;
     }
   }
 
-  // Note: with block alignment constraint in place, partial block writes are
-  // not permissible - complete blocks must be written. Thus, the options are:
-  // 1. Allow partial yet block-aligned writes - this would require truncating
-  //    partially written blocks, which has a perf impact.
-  // 2. Require complete data to be written in a write loop that terminates only
-  //    on error or when all data has been written, following the POSIX model -
-  //    this may lead to "long" writes when "large" amount of data is written.
-  // In this code optimize operation for full writes - i.e. the option #2.
-  ssize_t bytes_written = write_all(fd, buffer.data(), physical_bytes_count);
-  if (bytes_written != physical_bytes_count) {
-    LOG(ERROR) << "Failed to write encrypted data to file, path="
-               << file_ctrl->path << ", bytes written = " << bytes_written;
+  if (write_count == 0) {
     return -1;
   }
 
-  // Move cursor to the position of the end of the write range.
-  if (last_partial_block_bytes_count > 0) {
-    off_t new_cur_logical_offset = logical_offset + count;
-    off_t new_cur_physical_offset =
-        offset_translator_->LogicalToPhysical(new_cur_logical_offset);
-    off_t offset = enc_untrusted_lseek(fd, new_cur_physical_offset, SEEK_SET);
-    if (offset == -1) {
-      LOG(ERROR)
-          << "Failed lseek to the last block offset when reading file data.";
-      return -1;
-    }
+  if (offset < 0) {
+    fd_offset->second += write_count;
   }
 
-  for (int64_t idx = 0; idx < tags.size(); idx++) {
-    std::string tag_string(reinterpret_cast<char *>(tags[idx].data()),
-                           kTagLength);
-    int64_t block_index = start_block_to_write + idx;
-    if (block_index < eof_block_index) {
-      VLOG(2) << "Updating auth tag on AD: "
-              << absl::BytesToHexString(tag_string);
-      file_ctrl->ad->UpdateLeaf(block_index + 1, tag_string);
-    } else {
-      VLOG(2) << "Appending auth tag to AD: "
-              << absl::BytesToHexString(tag_string);
-      file_ctrl->ad->AddLeaf(tag_string);
-    }
+  VLOG(2) << "Wrote data to file, bytes_written = " << write_count;
+  return write_count;
+}
+
+off_t AeadHandler::Seek(int fd, off_t offset, int whence) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to seek on an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
   }
 
-  file_ctrl->logical_size = logical_offset + count;
+  absl::MutexLock lock(&file_ctrl->mu);
+  auto current = file_ctrl->offsets.find(fd);
+  if (current == file_ctrl->offsets.end()) {
+    errno = EBADF;
+    return -1;
+  }
 
-  if (!UpdateDigest(file_ctrl.get(), *cryptor)) {
+  // The net logical offset to which lseek has been requested.
+  off_t logical_offset;
+  switch (whence) {
+    case SEEK_SET:
+      logical_offset = offset;
+      break;
+    case SEEK_CUR:
+      logical_offset = current->second + offset;
+      break;
+    case SEEK_END:
+      logical_offset = file_ctrl->logical_size + offset;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (logical_offset < 0) {
+    errno = EINVAL;
     return -1;
   }
 
-  VLOG(2) << "Wrote data to file, bytes_written = " << bytes_written;
+  current->second = logical_offset;
+  return logical_offset;
+}
+
+bool AeadHandler::Flush(int fd) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to flush an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return false;
+  }
 
-  return count;
+  absl::MutexLock lock(&file_ctrl->mu);
+  return FlushLocked(file_ctrl.get(), /*closing=*/false);
 }
 
 bool AeadHandler::FinalizeFile(int fd) {
-  absl::MutexLock global_lock(&mu_);
-
   if (fd < 0) {
     errno = EINVAL;
     return false;
   }
 
-  auto entry = fmap_.find(fd);
-  if (entry == fmap_.end()) {
-    LOG(ERROR) << "Attempt made to finalize uninitialized file, fd = " << fd;
-    errno = ENOENT;
-    return false;
+  std::shared_ptr<FileControl> file_ctrl;
+  {
+    absl::MutexLock global_lock(&mu_);
+    auto entry = fmap_.find(fd);
+    if (entry == fmap_.end()) {
+      LOG(ERROR) << "Attempt made to finalize uninitialized file, fd = " << fd;
+      errno = ENOENT;
+      return false;
+    }
+
+    // Do not need to wait until the file is no longer operated on - shared_ptr
+    // taken by the operator will keep file_ctrl alive and allow it to take and
+    // release the lock on its own schedule. Removal from the map here will not
+    // impact that ability.
+    VLOG(2) << "Finalizing secure file, fd = " << fd
+            << ", pathname = " << entry->second->path;
+    file_ctrl = entry->second;
+    fmap_.erase(entry);
   }
 
-  // Do not need to wait until the file is no longer operated on - shared_ptr
-  // taken by the operator will keep file_ctrl alive and allow it to take and
-  // release the lock on its own schedule. Removal from the maps here will not
-  // impact that ability.
+  bool result;
+  {
+    absl::MutexLock lock(&file_ctrl->mu);
+    file_ctrl->offsets.erase(fd);
+    result = FlushLocked(file_ctrl.get(), file_ctrl->offsets.empty());
+  }
 
-  VLOG(2) << "Finalizing secure file, fd = " << fd
-          << ", pathname = " << entry->second->path;
-  opened_files_.erase(entry->second->path);
-  fmap_.erase(entry);
+  // Release the file once the last descriptor open on it is closed. The file
+  // may have been opened again while it was being flushed.
+  absl::MutexLock global_lock(&mu_);
+  absl::MutexLock lock(&file_ctrl->mu);
+  if (file_ctrl->offsets.empty()) {
+    auto path_it = opened_files_.find(file_ctrl->path);
+    if (path_it != opened_files_.end() && path_it->second == file_ctrl) {
+      opened_files_.erase(path_it);
+    }
+    if (file_ctrl->host_fd != -1) {
+      enc_untrusted_close(file_ctrl->host_fd);
+      file_ctrl->host_fd = -1;
+    }
+    file_ctrl->cache_index.clear();
+    file_ctrl->cache.clear();
+  }
 
-  return true;
+  return result;
 }
 
 // Note: questionable whether to allow setting the key only on newly opened
@@ -895,18 +1147,11 @@ int AeadHandler::SetMasterKey(int fd, const uint8_t *key_data,
     return -1;
   }
 
-  std::shared_ptr<FileControl> file_ctrl;
-  {
-    absl::MutexLock global_lock(&mu_);
-
-    auto entry = fmap_.find(fd);
-    if (entry == fmap_.end()) {
-      LOG(ERROR) << "Attempt made to set key on an unopened file, fd = " << fd;
-      errno = ENOENT;
-      return -1;
-    }
-
-    file_ctrl = entry->second;
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to set key on an unopened file, fd = " << fd;
+    errno = ENOENT;
+    return -1;
   }
 
   absl::MutexLock lock(&file_ctrl->mu);
@@ -933,20 +1178,52 @@ int AeadHandler::SetMasterKey(int fd, const uint8_t *key_data,
   return 0;
 }
 
-const OffsetTranslator &AeadHandler::GetOffsetTranslator() const {
-  return *offset_translator_;
+int AeadHandler::SetBlockLength(int fd, size_t block_length) {
+  if (!IsBlockLengthValid(block_length)) {
+    LOG(ERROR) << "Attempt made to set an invalid block length: "
+               << block_length;
+    errno = EINVAL;
+    return -1;
+  }
+
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
+    LOG(ERROR) << "Attempt made to set block length on an unopened file, fd = "
+               << fd;
+    errno = ENOENT;
+    return -1;
+  }
+
+  absl::MutexLock lock(&file_ctrl->mu);
+
+  if (!file_ctrl->is_new) {
+    if (file_ctrl->is_deserialized &&
+        file_ctrl->block_length == block_length) {
+      return 0;
+    }
+
+    LOG(ERROR) << "Attempt made to set the block length of an existing file, "
+                  "fd = "
+               << fd;
+    errno = EPERM;
+    return -1;
+  }
+
+  file_ctrl->block_length = block_length;
+  return 0;
 }
 
 off_t AeadHandler::GetLogicalFileSize(int fd) {
-  absl::MutexLock global_lock(&mu_);
-  auto entry = fmap_.find(fd);
-  if (entry == fmap_.end()) {
+  std::shared_ptr<FileControl> file_ctrl = GetFileControl(fd);
+  if (!file_ctrl) {
     LOG(ERROR)
         << "Attempt made to get logical file size on an unopened file, fd = "
         << fd;
     return -1;
   }
-  return entry->second->logical_size;
+
+  absl::MutexLock lock(&file_ctrl->mu);
+  return file_ctrl->logical_size;
 }
 
 }  // namespace storage
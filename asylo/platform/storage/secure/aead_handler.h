@@ -20,12 +20,18 @@
 #define ASYLO_PLATFORM_STORAGE_SECURE_AEAD_HANDLER_H_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
+#include <algorithm>
+#include <list>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "absl/base/attributes.h"
+#include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
 #include "asylo/crypto/util/bytes.h"
 #include "asylo/platform/crypto/gcmlib/gcm_cryptor.h"
@@ -43,21 +49,45 @@ using crypto::gcmlib::kKeyLength;
 using crypto::gcmlib::kTagLength;
 using crypto::gcmlib::kTokenLength;
 
-// Length of file blocks to encrypt/decrypt.
-constexpr size_t kBlockLength = 128;
-using Block = UnsafeBytes<kBlockLength>;
+// Length of file blocks to encrypt/decrypt in newly created files, unless
+// another length is set with AeadHandler::SetBlockLength.
+constexpr size_t kDefaultBlockLength = 4096;
 
-// Length of the file digest (of the AD root).
+// Range of supported block lengths. Block lengths must be powers of two.
+constexpr size_t kMinBlockLength = 128;
+constexpr size_t kMaxBlockLength = 64 * 1024;
+
+// Length of file blocks in files created before the block length became
+// configurable.
+constexpr size_t kLegacyBlockLength = 128;
+
+// Maximum number of bytes of decrypted file data cached in the enclave for
+// each open file.
+constexpr size_t kBlockCacheCapacity = 256 * 1024;
+
+// Length of the file digest (of the AD root), and of the leaf hashes of the
+// AD.
 constexpr int64_t kRootHashLength = 32;
 
 // Length of the hash of the file digest (of the AD root).
 constexpr int64_t kFileHashLength = 16;
 
-// Constants for the secure block structure - the secure block consists of
-// the ciphertext of the same length as the original plaintext, followed by the
-// integrity tag, followed by the encryption token.
-constexpr size_t kCipherBlockLength = kBlockLength + kTagLength;
-constexpr size_t kSecureBlockLength = kCipherBlockLength + kTokenLength;
+// Length of the file header, which records the block length of the file.
+constexpr int64_t kFileHeaderLength = 40;
+
+// Files with at least this many blocks persist the leaf hashes of their AD
+// after the last block when closed, so that reopening them does not require
+// reading the auth tag of every block.
+constexpr int64_t kHashCacheMinBlocks = 1024;
+
+// Length of the file header of files with kLegacyBlockLength blocks, which
+// consists of the hash of the file digest followed by the logical file size.
+constexpr int64_t kLegacyFileHeaderLength = kFileHashLength + sizeof(uint64_t);
+
+// Each block is stored as a secure block - the ciphertext of the same length
+// as the original plaintext, followed by the integrity tag, followed by the
+// encryption token.
+constexpr size_t kBlockMetadataLength = kTagLength + kTokenLength;
 
 using FileHash = UnsafeBytes<kFileHashLength>;
 using FileDigest = UnsafeBytes<kRootHashLength>;
@@ -68,8 +98,12 @@ using FileDigest = UnsafeBytes<kRootHashLength>;
 // supplied file data. Uses enclave-to-host IO delegates to propagate IO calls
 // over the enclave boundary to access file storage outside the enclave.
 //
-// Tracked feature work:
-//
+// Decrypted and verified blocks are kept in a per-file LRU cache in trusted
+// memory shared by all descriptors open on the file. Writes modify cached
+// blocks, which are encrypted and written back to the host when evicted, and
+// together with the file digest when the file is flushed or closed. The file
+// offset of each descriptor is tracked in the enclave, and the host is accessed
+// with positional IO through a single host descriptor per file.
 class AeadHandler {
  public:
   static AeadHandler &GetInstance() {
@@ -84,67 +118,136 @@ class AeadHandler {
   bool InitializeFile(int fd, const char *path_name, bool is_new_file)
       ABSL_LOCKS_EXCLUDED(mu_);
 
-  // Decrypts read data in-place, verifies data has not been tampered with,
-  // returns the size of data verified, or -1 on failure.
+  // Reads data at the file offset of |fd|, verifies data has not been tampered
+  // with, returns the size of data verified, or -1 on failure.
   ssize_t DecryptAndVerify(int fd, void *buf, size_t count)
       ABSL_LOCKS_EXCLUDED(mu_);
 
-  // Encrypts data and generates integrity metadata for it in memory, writes
-  // encrypted data to disk, returns the size of data written, or -1 on failure.
+  // Writes data at the file offset of |fd|, returns the size of data written,
+  // or -1 on failure. The data is encrypted and persisted when its blocks are
+  // evicted from the cache, or the file is flushed.
   ssize_t EncryptAndPersist(int fd, const void *buf, size_t count)
       ABSL_LOCKS_EXCLUDED(mu_);
 
-  // Frees resources used to assure integrity of an opened file, persists
-  // integrity metadata to a designated location on disk, returns false on
-  // failure. Does not modify the state of the file descriptor.
+  // Vectored variants of DecryptAndVerify and EncryptAndPersist, which transfer
+  // the buffers of |iov| in order as a single operation under the file lock.
+  // They read or write at |offset|, leaving the file offset of |fd| unchanged,
+  // or at and advancing the file offset if |offset| is negative.
+  ssize_t DecryptAndVerifyVector(int fd, const struct iovec *iov, int iovcnt,
+                                 off_t offset) ABSL_LOCKS_EXCLUDED(mu_);
+  ssize_t EncryptAndPersistVector(int fd, const struct iovec *iov, int iovcnt,
+                                  off_t offset) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Repositions the logical file offset of |fd| as lseek(2) does. Returns the
+  // new offset, or -1 on failure.
+  off_t Seek(int fd, off_t offset, int whence) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Encrypts and persists all modified blocks of the file, then persists its
+  // integrity metadata. Returns false on failure.
+  bool Flush(int fd) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Flushes the file and frees resources used to assure integrity of an opened
+  // file, returns false on failure. Does not modify the state of the file
+  // descriptor.
   bool FinalizeFile(int fd) ABSL_LOCKS_EXCLUDED(mu_);
 
   // Sets the master key for a newly opened file.
   int SetMasterKey(int fd, const uint8_t *key_data, uint32_t key_length)
       ABSL_LOCKS_EXCLUDED(mu_);
 
+  // Sets the block length of a newly created file. Must be called before the
+  // master key is set. The block length of an existing file is read from the
+  // file.
+  int SetBlockLength(int fd, size_t block_length) ABSL_LOCKS_EXCLUDED(mu_);
+
   // Returns the logical file size, or -1 on failure.
   off_t GetLogicalFileSize(int fd) ABSL_LOCKS_EXCLUDED(mu_);
 
-  const OffsetTranslator &GetOffsetTranslator() const;
-
  private:
   // Structure represents the file header layout.
   struct FileHeader {
+    // Identifies the layout of the header.
+    uint8_t magic[8];
+
     // Hash of the DataDigest.
     FileHash file_hash;
 
     // Logical file size - is incorporated into DataDigest and is protected by
     // FileHash.
-    size_t file_size;
+    uint64_t file_size;
+
+    // Length of file blocks - is incorporated into DataDigest and is protected
+    // by FileHash.
+    uint32_t block_length;
+
+    // Bitwise OR of kFileHeaderFlag* values.
+    uint32_t flags;
+  } ABSL_ATTRIBUTE_PACKED;
 
-    // Returns the address of the FileHeader instance.
-    uint8_t *data() { return file_hash.data(); }
+  // Structure represents the header layout of files with kLegacyBlockLength
+  // blocks.
+  struct LegacyFileHeader {
+    FileHash file_hash;
+    uint64_t file_size;
   } ABSL_ATTRIBUTE_PACKED;
 
   // Structure represents the file data digest from which the file hash used for
-  // integrity validation is calculated.
+  // integrity validation is calculated. The block length is not part of the
+  // digest of files with a legacy header.
   struct DataDigest {
     // AD digest of the file data.
     FileDigest file_digest;
 
     // Logical file size.
-    size_t file_size;
+    uint64_t file_size;
+
+    // Length of file blocks.
+    uint32_t block_length;
 
     // Returns the address of the DataDigest instance.
     uint8_t *data() { return file_digest.data(); }
   } ABSL_ATTRIBUTE_PACKED;
 
+  // A decrypted block of file data.
+  struct CachedBlock {
+    int64_t index;
+
+    // Whether the block was modified since it was last persisted.
+    bool dirty;
+
+    std::vector<uint8_t> data;
+  };
+
   // File (data set) control structure for an opened file.
   struct FileControl {
     const std::string path;
     size_t logical_size;
     bool is_new;
     bool is_deserialized;
+    bool is_legacy;
+    size_t block_length;
+    std::unique_ptr<OffsetTranslator> offset_translator;
     std::unique_ptr<AuthenticatedDictionary> ad;
     std::string zero_hash;
     std::unique_ptr<GcmCryptorKey> master_key;
 
+    // Logical file offsets of the descriptors open on the file.
+    std::unordered_map<int, off_t> offsets;
+
+    // Host descriptor used to access file data, or -1 if not open yet.
+    int host_fd;
+
+    // Cached blocks, most recently used first, and their index.
+    std::list<CachedBlock> cache;
+    std::unordered_map<int64_t, std::list<CachedBlock>::iterator> cache_index;
+
+    // Whether the digest persisted in the file header is out of date.
+    bool is_digest_stale;
+
+    // Whether the file digest changed since the leaf hashes of the AD were
+    // last stored after the last block, or loaded from there.
+    bool is_hash_cache_stale;
+
     // Mutex for protecting FileControl instance.
     absl::Mutex mu;
 
@@ -153,35 +256,81 @@ class AeadHandler {
           logical_size(0),
           is_new(is_new_file),
           is_deserialized(false),
-          ad(absl::make_unique<CTMMTAuthenticatedDictionary>()) {
+          is_legacy(false),
+          block_length(kDefaultBlockLength),
+          ad(absl::make_unique<CTMMTAuthenticatedDictionary>()),
+          host_fd(-1),
+          is_digest_stale(false),
+          is_hash_cache_stale(false) {
       UnsafeBytes<kTagLength> tag;
       memset(tag.data(), 0, kTagLength);
       std::string tag_string(reinterpret_cast<char *>(tag.data()), kTagLength);
       zero_hash = ad->LeafHash(tag_string);
     }
 
-    // NOTE: The physical_size is on block granularity because the block
-    // metadata is placed after the block data, hence, only full blocks are
-    // written - there are no partial blocks.
-    size_t physical_size() {
-      return sizeof(FileHeader) + ad->LeafCount() * kSecureBlockLength;
+    size_t header_length() const {
+      return is_legacy ? kLegacyFileHeaderLength : kFileHeaderLength;
+    }
+
+    size_t secure_block_length() const {
+      return block_length + kBlockMetadataLength;
+    }
+
+    // Length of the prefix of DataDigest from which the file hash is
+    // calculated.
+    size_t digest_length() const {
+      return is_legacy ? sizeof(DataDigest) - sizeof(uint32_t)
+                       : sizeof(DataDigest);
+    }
+
+    // Maximum number of cached blocks.
+    size_t cache_capacity() const {
+      return std::max<size_t>(kBlockCacheCapacity / block_length, 1);
+    }
+
+    // Returns the physical offset of the block at |index|.
+    off_t block_offset(int64_t index) const {
+      return offset_translator->LogicalToPhysical(index * block_length);
     }
   };
 
-  AeadHandler();
+  AeadHandler() = default;
   AeadHandler(AeadHandler const &) = delete;
   void operator=(AeadHandler const &) = delete;
 
+  // Returns the control structure of the file open on |fd|, or nullptr if
+  // there is none.
+  std::shared_ptr<FileControl> GetFileControl(int fd) ABSL_LOCKS_EXCLUDED(mu_);
+
   // Loads and validates integrity metadata, returns false on failure.
   bool Deserialize(FileControl *file_ctrl)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
 
-  // Retrieves logical cursor offset associated with a file descriptor |fd|.
-  // Returns false on failure.
-  bool RetrieveLogicalOffset(int fd, off_t *logical_offset) const;
+  // Rebuilds the Merkle tree from the auth tags of the first |blocks_count|
+  // blocks of the file. Returns false on failure.
+  bool LoadAuthTags(FileControl *file_ctrl, int64_t blocks_count) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Rebuilds the Merkle tree from the |blocks_count| leaf hashes stored after
+  // the last block of the file. Returns false on failure.
+  bool LoadHashCache(FileControl *file_ctrl, int64_t blocks_count) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Stores the leaf hashes of the Merkle tree after the last block of the
+  // file. Returns false on failure.
+  bool PersistHashCache(FileControl *file_ctrl) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
 
-  // Updates digest of the file data in the secure file header.
-  bool UpdateDigest(FileControl *file_ctrl, const GcmCryptor &cryptor) const
+  // Returns whether |file_hash| is the hash of the digest of the file data,
+  // given the current root of the Merkle tree and |file_size|.
+  bool IsDigestValid(FileControl *file_ctrl, const GcmCryptor &cryptor,
+                     const FileHash &file_hash, uint64_t file_size) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Updates digest of the file data in the secure file header. |hash_cache|
+  // indicates whether the leaf hashes of the Merkle tree were just persisted.
+  bool UpdateDigest(FileControl *file_ctrl, const GcmCryptor &cryptor,
+                    bool hash_cache = false) const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
 
   // Returns an instance of GcmCryptor associated with a file, or nullptr if was
@@ -189,19 +338,64 @@ class AeadHandler {
   GcmCryptor *GetGcmCryptor(const FileControl &file_ctrl) const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl.mu);
 
-  // Similar to DecryptAndVerify, but is called by internal implementation, and
-  // as such does not take a file lock. The cursor associated with the file
-  // descriptor |fd| is expected to be at the position of |logical_offset|.
-  ssize_t DecryptAndVerifyInternal(int fd, void *buf, size_t count,
-                                   const FileControl &file_ctrl,
-                                   off_t logical_offset) const
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl.mu);
+  // Returns the host descriptor used to access the data of a file, opening it
+  // if needed, or -1 on failure.
+  int GetHostFd(FileControl *file_ctrl) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
 
-  // Reads a single full block of a file at a specified logical offset. Returns
-  // false on failure.
-  bool ReadFullBlock(const FileControl &file_ctrl, off_t logical_offset,
-                     Block *block) const
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl.mu);
+  // Returns the cached block at |index|, or nullptr if it is not cached. Marks
+  // the block as the most recently used.
+  CachedBlock *LookupBlock(FileControl *file_ctrl, int64_t index) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Returns the block at |index|, loading it into the cache if needed. When
+  // |load| is false, a block that is not cached is added as zeros rather than
+  // read from the file. Returns nullptr on failure.
+  CachedBlock *GetBlock(FileControl *file_ctrl, GcmCryptor *cryptor,
+                        int64_t index, bool load) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Adds a zeroed block at |index| to the cache, first evicting the least
+  // recently used block if the cache is full. Returns nullptr on failure.
+  CachedBlock *InsertBlock(FileControl *file_ctrl, GcmCryptor *cryptor,
+                           int64_t index) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Reads, verifies and caches the |count| uncached blocks starting at |first|
+  // with a single host read. |count| may not exceed the cache capacity.
+  // Returns false on failure.
+  bool LoadBlocks(FileControl *file_ctrl, GcmCryptor *cryptor, int64_t first,
+                  int64_t count) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Copies |count| bytes of file data at |logical_offset|, which must not
+  // extend past the logical EOF, into |buf|. Uncached blocks are loaded in
+  // runs which may extend up to the block at |last_index|. Returns |count|, or
+  // -1 on failure.
+  ssize_t ReadLocked(FileControl *file_ctrl, GcmCryptor *cryptor, uint8_t *buf,
+                     off_t logical_offset, size_t count,
+                     int64_t last_index) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Copies |count| bytes from |buf| into the cached blocks of file data at
+  // |logical_offset| and marks them dirty. Returns the number of bytes copied,
+  // which is less than |count| only on failure.
+  size_t WriteLocked(FileControl *file_ctrl, GcmCryptor *cryptor,
+                     const uint8_t *buf, off_t logical_offset,
+                     size_t count) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Encrypts and writes all dirty cached blocks to the file, writing each run
+  // of consecutive blocks with a single host write, and updates the Merkle
+  // tree. Returns false on failure.
+  bool WriteBackBlocks(FileControl *file_ctrl, GcmCryptor *cryptor) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
+
+  // Writes back all dirty blocks, then the file digest if it changed. When
+  // |closing| is set, large files also persist their leaf hashes. Returns false
+  // on failure.
+  bool FlushLocked(FileControl *file_ctrl, bool closing) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_ctrl->mu);
 
   // Map of file (data set) controls for opened files keyed on int identity of
   // files. Avoid using absl based containers which may perform system calls, as
@@ -217,9 +411,6 @@ class AeadHandler {
   std::unordered_map<std::string, std::shared_ptr<FileControl>> opened_files_
       ABSL_GUARDED_BY(mu_);
 
-  // An instance that performs operations on untrusted file offset.
-  std::unique_ptr<OffsetTranslator> offset_translator_;
-
   // Mutex for protecting map members of the class.
   absl::Mutex mu_;
 };
@@ -18,16 +18,104 @@
 
 #include "asylo/platform/storage/secure/ctmmt_authenticated_dictionary.h"
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
-#include <merkletree/merkle_tree.h>
+#include <merkletree/serial_hasher.h>
 
 namespace asylo {
 namespace platform {
 namespace storage {
 
+CTMMTAuthenticatedDictionary::CTMMTAuthenticatedDictionary()
+    : hasher_(absl::make_unique<Sha256Hasher>()),
+      hash_length_(hasher_.DigestSize()),
+      leaf_count_(0),
+      levels_(1) {}
+
+size_t CTMMTAuthenticatedDictionary::AddLeaf(const std::string &data) {
+  return AddLeafHash(hasher_.HashLeaf(data));
+}
+
+size_t CTMMTAuthenticatedDictionary::AddLeafHash(const std::string &hash) {
+  if (hash.size() != hash_length_) {
+    return 0;
+  }
+  levels_[0].append(hash);
+  stale_leaves_.push_back(leaf_count_);
+  return ++leaf_count_;
+}
+
+std::string CTMMTAuthenticatedDictionary::CurrentRoot() {
+  if (leaf_count_ == 0) {
+    return hasher_.HashEmpty();
+  }
+
+  // Rehash the stale nodes level by level. The stale nodes of the next level
+  // are the parents of the stale nodes of this one.
+  std::vector<size_t> stale;
+  stale.swap(stale_leaves_);
+  std::sort(stale.begin(), stale.end());
+  size_t level = 0;
+  size_t node_count = leaf_count_;
+  while (node_count > 1) {
+    const size_t parent_count = (node_count + 1) / 2;
+    if (levels_.size() == level + 1) {
+      levels_.emplace_back();
+    }
+    levels_[level + 1].resize(parent_count * hash_length_);
+
+    size_t parents = 0;
+    for (size_t index : stale) {
+      const size_t parent = index / 2;
+      if (parents > 0 && stale[parents - 1] == parent) {
+        continue;
+      }
+      const size_t left = parent * 2;
+      SetNode(level + 1, parent,
+              left + 1 < node_count
+                  ? hasher_.HashChildren(Node(level, left),
+                                         Node(level, left + 1))
+                  : Node(level, left));
+      stale[parents++] = parent;
+    }
+    stale.resize(parents);
+    node_count = parent_count;
+    level++;
+  }
+  return Node(level, 0);
+}
+
+std::string CTMMTAuthenticatedDictionary::LeafHash(size_t leaf) const {
+  if (leaf == 0 || leaf > leaf_count_) {
+    return std::string();
+  }
+  return Node(0, leaf - 1);
+}
+
+std::string CTMMTAuthenticatedDictionary::LeafHash(
+    const std::string &data) const {
+  return hasher_.HashLeaf(data);
+}
+
 bool CTMMTAuthenticatedDictionary::UpdateLeaf(size_t leaf,
                                               const std::string &data) {
-  return mtree_->UpdateLeafHash(leaf, mtree_->LeafHash(data));
+  if (leaf == 0 || leaf > leaf_count_) {
+    return false;
+  }
+  SetNode(0, leaf - 1, hasher_.HashLeaf(data));
+  stale_leaves_.push_back(leaf - 1);
+  return true;
+}
+
+std::string CTMMTAuthenticatedDictionary::Node(size_t level,
+                                               size_t index) const {
+  return levels_[level].substr(index * hash_length_, hash_length_);
+}
+
+void CTMMTAuthenticatedDictionary::SetNode(size_t level, size_t index,
+                                           const std::string &hash) {
+  levels_[level].replace(index * hash_length_, hash_length_, hash);
 }
 
 }  // namespace storage
@@ -19,46 +19,65 @@
 #ifndef ASYLO_PLATFORM_STORAGE_SECURE_CTMMT_AUTHENTICATED_DICTIONARY_H_
 #define ASYLO_PLATFORM_STORAGE_SECURE_CTMMT_AUTHENTICATED_DICTIONARY_H_
 
-#include "absl/memory/memory.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
 #include "asylo/platform/storage/secure/authenticated_dictionary.h"
-#include <merkletree/merkle_tree.h>
+#include <merkletree/tree_hasher.h>
 
 namespace asylo {
 namespace platform {
 namespace storage {
 
-// Authenticated Dictionary implementation backed by Certificate Transparency
-// Mutable Merkle Tree.
+// Authenticated Dictionary implementation computing the root of a Certificate
+// Transparency Merkle tree (RFC 6962) over SHA-256 leaf hashes.
+//
+// The tree keeps its interior nodes between calls. Adding or updating a leaf
+// only marks its path to the root as stale, and CurrentRoot() rehashes the
+// stale paths together, so updating d leaves of an n leaf tree costs
+// O(d log n) hashes rather than O(n).
 class CTMMTAuthenticatedDictionary : public AuthenticatedDictionary {
  public:
-  CTMMTAuthenticatedDictionary()
-      : mtree_(absl::make_unique<MutableMerkleTree>(
-            absl::make_unique<Sha256Hasher>())) {}
+  CTMMTAuthenticatedDictionary();
 
-  size_t LeafCount() const final { return mtree_->LeafCount(); }
+  size_t LeafCount() const final { return leaf_count_; }
 
-  size_t AddLeaf(const std::string &data) final {
-    return mtree_->AddLeaf(data);
-  }
+  size_t AddLeaf(const std::string &data) final;
 
-  size_t AddLeafHash(const std::string &hash) final {
-    return mtree_->AddLeafHash(hash);
-  }
+  size_t AddLeafHash(const std::string &hash) final;
 
-  std::string CurrentRoot() final { return mtree_->CurrentRoot(); }
+  std::string CurrentRoot() final;
 
-  std::string LeafHash(size_t leaf) const final {
-    return mtree_->LeafHash(leaf);
-  }
+  std::string LeafHash(size_t leaf) const final;
 
-  std::string LeafHash(const std::string &data) const final {
-    return mtree_->LeafHash(data);
-  }
+  std::string LeafHash(const std::string &data) const final;
 
   bool UpdateLeaf(size_t leaf, const std::string &data) final;
 
  private:
-  std::unique_ptr<MutableMerkleTree> mtree_;
+  // Returns the hash of the |index|th node of |level|, indexed from 0.
+  std::string Node(size_t level, size_t index) const;
+
+  // Sets the hash of the |index|th node of |level|, indexed from 0.
+  void SetNode(size_t level, size_t index, const std::string &hash);
+
+  TreeHasher hasher_;
+
+  // Length of the hashes stored in the tree.
+  const size_t hash_length_;
+
+  size_t leaf_count_;
+
+  // The hashes of each level of the tree, concatenated. levels_[0] holds the
+  // leaf hashes, and levels_[i + 1] the parents of the nodes of levels_[i]. A
+  // node without a sibling is carried up to the next level unchanged, which
+  // yields the same root as the RFC 6962 definition.
+  std::vector<std::string> levels_;
+
+  // Indices of the leaves whose paths to the root are stale, in no particular
+  // order and possibly repeated.
+  std::vector<size_t> stale_leaves_;
 };
 
 }  // namespace storage
@@ -0,0 +1,133 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Test suite for the CTMMTAuthenticatedDictionary class.
+#include "asylo/platform/storage/secure/ctmmt_authenticated_dictionary.h"
+
+#include <string>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include <merkletree/serial_hasher.h>
+#include <merkletree/tree_hasher.h>
+
+namespace asylo {
+namespace {
+
+using platform::storage::CTMMTAuthenticatedDictionary;
+using ::testing::Eq;
+using ::testing::IsEmpty;
+
+class CTMMTAuthenticatedDictionaryTest : public ::testing::Test {
+ protected:
+  CTMMTAuthenticatedDictionaryTest()
+      : hasher_(absl::make_unique<Sha256Hasher>()) {}
+
+  // Returns the RFC 6962 root of the tree with |leaves| as leaf data, computed
+  // from scratch.
+  std::string ExpectedRoot(const std::vector<std::string> &leaves) {
+    if (leaves.empty()) {
+      return hasher_.HashEmpty();
+    }
+    return SubtreeRoot(leaves, 0, leaves.size());
+  }
+
+  std::string SubtreeRoot(const std::vector<std::string> &leaves,
+                          size_t begin, size_t end) {
+    if (end - begin == 1) {
+      return hasher_.HashLeaf(leaves[begin]);
+    }
+    // The left subtree has the largest power of two leaves less than the
+    // number of leaves.
+    size_t split = 1;
+    while (split * 2 < end - begin) {
+      split *= 2;
+    }
+    return hasher_.HashChildren(SubtreeRoot(leaves, begin, begin + split),
+                                SubtreeRoot(leaves, begin + split, end));
+  }
+
+  TreeHasher hasher_;
+};
+
+TEST_F(CTMMTAuthenticatedDictionaryTest, EmptyTree) {
+  CTMMTAuthenticatedDictionary ad;
+  EXPECT_THAT(ad.LeafCount(), Eq(0));
+  EXPECT_THAT(ad.CurrentRoot(), Eq(hasher_.HashEmpty()));
+  EXPECT_THAT(ad.LeafHash(1), IsEmpty());
+  EXPECT_FALSE(ad.UpdateLeaf(1, "data"));
+}
+
+TEST_F(CTMMTAuthenticatedDictionaryTest, RootMatchesAsLeavesAreAdded) {
+  CTMMTAuthenticatedDictionary ad;
+  std::vector<std::string> leaves;
+  for (size_t i = 0; i < 70; i++) {
+    leaves.push_back(absl::StrCat("leaf", i));
+    // Alternate between adding data and adding its hash.
+    if (i % 2 == 0) {
+      EXPECT_THAT(ad.AddLeaf(leaves.back()), Eq(leaves.size()));
+    } else {
+      EXPECT_THAT(ad.AddLeafHash(ad.LeafHash(leaves.back())),
+                  Eq(leaves.size()));
+    }
+    // Check the root after a varying number of additions.
+    if (i % 3 == 0) {
+      EXPECT_THAT(ad.CurrentRoot(), Eq(ExpectedRoot(leaves))) << i;
+    }
+  }
+  EXPECT_THAT(ad.CurrentRoot(), Eq(ExpectedRoot(leaves)));
+  EXPECT_THAT(ad.LeafHash(5), Eq(hasher_.HashLeaf(leaves[4])));
+}
+
+TEST_F(CTMMTAuthenticatedDictionaryTest, RootMatchesAfterUpdates) {
+  CTMMTAuthenticatedDictionary ad;
+  std::vector<std::string> leaves;
+  for (size_t i = 0; i < 37; i++) {
+    leaves.push_back(absl::StrCat("leaf", i));
+    ad.AddLeaf(leaves.back());
+  }
+  ASSERT_THAT(ad.CurrentRoot(), Eq(ExpectedRoot(leaves)));
+
+  // Update single leaves, including the first and the last, and batches of
+  // leaves between computations of the root.
+  for (size_t leaf : {1, 37, 17, 32, 33}) {
+    leaves[leaf - 1] = absl::StrCat("updated", leaf);
+    ASSERT_TRUE(ad.UpdateLeaf(leaf, leaves[leaf - 1]));
+    EXPECT_THAT(ad.CurrentRoot(), Eq(ExpectedRoot(leaves))) << leaf;
+  }
+  for (size_t leaf = 2; leaf <= 37; leaf += 5) {
+    leaves[leaf - 1] = absl::StrCat("batch", leaf);
+    ASSERT_TRUE(ad.UpdateLeaf(leaf, leaves[leaf - 1]));
+  }
+  leaves.push_back("appended");
+  ad.AddLeaf(leaves.back());
+  EXPECT_THAT(ad.CurrentRoot(), Eq(ExpectedRoot(leaves)));
+  EXPECT_FALSE(ad.UpdateLeaf(leaves.size() + 1, "data"));
+}
+
+TEST_F(CTMMTAuthenticatedDictionaryTest, RejectsMalformedLeafHash) {
+  CTMMTAuthenticatedDictionary ad;
+  EXPECT_THAT(ad.AddLeafHash("short"), Eq(0));
+  EXPECT_THAT(ad.LeafCount(), Eq(0));
+}
+
+}  // namespace
+}  // namespace asylo
@@ -22,6 +22,7 @@
 #include <sys/types.h>
 
 // IO syscall interface constants.
+#include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
 
@@ -29,7 +30,6 @@
 #include "asylo/platform/host_call/trusted/host_calls.h"
 #include "asylo/platform/storage/secure/aead_handler.h"
 #include "asylo/platform/storage/utils/fd_closer.h"
-#include "asylo/platform/storage/utils/offset_translator.h"
 
 namespace asylo {
 namespace platform {
@@ -62,13 +62,7 @@ int secure_open(const char *pathname, int flags, ...) {
 
   FdCloser fd_closer(fd, &enc_untrusted_close);
 
-  // Set cursor to the logical offset of 0.
-  if (secure_lseek(fd, 0, SEEK_SET) == -1) {
-    LOG(ERROR) << "Failed to initialize cursor to the logical offset of 0, fd="
-               << fd;
-    return -1;
-  }
-
+  // The cursor is initialized to the logical offset of 0.
   if (!AeadHandler::GetInstance().InitializeFile(fd, pathname, is_new_file)) {
     LOG(ERROR) << "Failed to initialize secure handling of file: " << pathname;
     return -1;
@@ -86,52 +80,50 @@ ssize_t secure_write(int fd, const void *buf, size_t count) {
   return AeadHandler::GetInstance().EncryptAndPersist(fd, buf, count);
 }
 
-int secure_close(int fd) {
-  bool finalize_result = AeadHandler::GetInstance().FinalizeFile(fd);
-  return (finalize_result && enc_untrusted_close(fd) == 0) ? 0 : -1;
+ssize_t secure_readv(int fd, const struct iovec *iov, int iovcnt) {
+  return AeadHandler::GetInstance().DecryptAndVerifyVector(fd, iov, iovcnt,
+                                                           /*offset=*/-1);
 }
 
-off_t secure_lseek(int fd, off_t offset, int whence) {
+ssize_t secure_writev(int fd, const struct iovec *iov, int iovcnt) {
+  return AeadHandler::GetInstance().EncryptAndPersistVector(fd, iov, iovcnt,
+                                                            /*offset=*/-1);
+}
+
+ssize_t secure_preadv(int fd, const struct iovec *iov, int iovcnt,
+                      off_t offset) {
   if (offset < 0) {
+    errno = EINVAL;
     return -1;
   }
+  return AeadHandler::GetInstance().DecryptAndVerifyVector(fd, iov, iovcnt,
+                                                           offset);
+}
 
-  const OffsetTranslator &offset_translator =
-      AeadHandler::GetInstance().GetOffsetTranslator();
-
-  // The net logical offset to which lseek has been requested.
-  off_t logical_offset;
-  switch (whence) {
-    case SEEK_SET: {
-      logical_offset = offset;
-    } break;
-    case SEEK_CUR: {
-      off_t physical_cur_offset = enc_untrusted_lseek(fd, 0, SEEK_CUR);
-      if (physical_cur_offset == -1) {
-        LOG(ERROR) << "Failed to retrieve cursor offset on descriptor: " << fd;
-        return -1;
-      }
-      off_t logical_cur_offset =
-          offset_translator.PhysicalToLogical(physical_cur_offset);
-      logical_offset = logical_cur_offset + offset;
-    } break;
-    case SEEK_END: {
-      off_t logical_eof_offset =
-          AeadHandler::GetInstance().GetLogicalFileSize(fd);
-      logical_offset = logical_eof_offset + offset;
-    } break;
-    default: logical_offset = 0;  // Satisfy -Wmaybe-uninitialized
+ssize_t secure_pwritev(int fd, const struct iovec *iov, int iovcnt,
+                       off_t offset) {
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
   }
+  return AeadHandler::GetInstance().EncryptAndPersistVector(fd, iov, iovcnt,
+                                                            offset);
+}
+
+int secure_close(int fd) {
+  bool finalize_result = AeadHandler::GetInstance().FinalizeFile(fd);
+  return (finalize_result && enc_untrusted_close(fd) == 0) ? 0 : -1;
+}
+
+off_t secure_lseek(int fd, off_t offset, int whence) {
+  return AeadHandler::GetInstance().Seek(fd, offset, whence);
+}
 
-  // The net physical offset that corresponds to the requested logical offset.
-  off_t physical_offset = offset_translator.LogicalToPhysical(logical_offset);
-  physical_offset = enc_untrusted_lseek(fd, physical_offset, SEEK_SET);
-  if (physical_offset == -1) {
-    LOG(ERROR) << "enclave_lseek failed, fd = " << fd
-               << ", offset = " << offset;
+int secure_fsync(int fd) {
+  if (!AeadHandler::GetInstance().Flush(fd)) {
     return -1;
   }
-  return offset_translator.PhysicalToLogical(physical_offset);
+  return enc_untrusted_fsync(fd);
 }
 
 int secure_fstat(int fd, struct stat *st) {
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 // IO syscall interface types.
 #include <sys/types.h>
+#include <sys/uio.h>
 
 namespace asylo {
 namespace platform {
@@ -43,10 +44,25 @@ ssize_t secure_read(int fd, void *buf, size_t count);
 // responsibility to explicitly set file offset on error as the client desires.
 ssize_t secure_write(int fd, const void *buf, size_t count);
 
+// Vectored IO. The buffers of |iov| are transferred in order as a single
+// operation, so a write of several buffers is encrypted and persisted as one.
+ssize_t secure_readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t secure_writev(int fd, const struct iovec *iov, int iovcnt);
+
+// Positional vectored IO, which leaves the file offset unchanged.
+ssize_t secure_preadv(int fd, const struct iovec *iov, int iovcnt,
+                      off_t offset);
+ssize_t secure_pwritev(int fd, const struct iovec *iov, int iovcnt,
+                       off_t offset);
+
 int secure_close(int fd);
 
 off_t secure_lseek(int fd, off_t offset, int whence);
 
+// Persists data written to the file, which is otherwise only persisted when
+// the file is closed.
+int secure_fsync(int fd);
+
 // |st->st_size| will be set to logical file size on success.
 int secure_fstat(int fd, struct stat* st);
 
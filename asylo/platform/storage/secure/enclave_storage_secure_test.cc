@@ -23,7 +23,12 @@
 
 #include <fcntl.h>
 #include <openssl/rand.h>
+#include <sys/uio.h>
 
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "absl/base/macros.h"
@@ -43,30 +48,54 @@ namespace asylo {
 namespace {
 
 using platform::crypto::gcmlib::kKeyLength;
+using platform::crypto::gcmlib::kTagLength;
 using platform::storage::AeadHandler;
-using platform::storage::kBlockLength;
-using platform::storage::kCipherBlockLength;
-using platform::storage::kFileHashLength;
+using platform::storage::kBlockCacheCapacity;
+using platform::storage::kBlockMetadataLength;
+using platform::storage::kDefaultBlockLength;
+using platform::storage::kFileHeaderLength;
+using platform::storage::kHashCacheMinBlocks;
+using platform::storage::kLegacyBlockLength;
+using platform::storage::kMinBlockLength;
+using platform::storage::kRootHashLength;
 using platform::storage::secure_close;
 using platform::storage::secure_fstat;
+using platform::storage::secure_fsync;
 using platform::storage::secure_lseek;
 using platform::storage::secure_open;
+using platform::storage::secure_preadv;
+using platform::storage::secure_pwritev;
 using platform::storage::secure_read;
+using platform::storage::secure_readv;
 using platform::storage::secure_write;
+using platform::storage::secure_writev;
 using ::testing::Not;
 
+// Block length which the offsets of the tests of files with the default block
+// length are expressed in.
+constexpr size_t kBlockLength = kLegacyBlockLength;
+
 constexpr size_t kMaxTestBufLen = 1000;
 constexpr char kTamperData[] = "Exceedingly rare string";
 
+// Returns the size of the file at |path| on the host.
+off_t GetPhysicalFileSize(const std::string &path) {
+  struct stat file_stat;
+  if (enc_untrusted_stat(path.c_str(), &file_stat) != 0) {
+    return -1;
+  }
+  return file_stat.st_size;
+}
+
 class EnclaveStorageSecureTest : public ::testing::Test,
                                  public ::testing::WithParamInterface<size_t> {
  protected:
   void SetUp() override { PrepareTest(); }
   void PrepareTest();
+  Status CreateEmptyFile(size_t block_length);
   Status OpenWriteClose(off_t offset);
   Status OpenReadVerifyClose(off_t offset, size_t bytes_expected);
 
-  const int64_t kFileHeaderLength = kFileHashLength + sizeof(size_t);
   const std::string &GetPath() const { return path_; }
   const void *GetWriteBuffer() const {
     return reinterpret_cast<const void *>(write_buffer_);
@@ -119,6 +148,30 @@ void EnclaveStorageSecureTest::PrepareTest() {
   memset(zero_buffer_, 0, kMaxTestBufLen);
 }
 
+Status EnclaveStorageSecureTest::CreateEmptyFile(size_t block_length) {
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("Secure open path ", GetPath(), " failed."));
+  }
+
+  platform::storage::FdCloser fd_closer(fd, &secure_close);
+
+  if (AeadHandler::GetInstance().SetBlockLength(fd, block_length) != 0) {
+    return absl::InternalError("Set block length failed.");
+  }
+  if (EmulateSetKeyIoctl(fd) != 0) {
+    return absl::InternalError("Set Master Key failed.");
+  }
+
+  fd_closer.release();
+  if (secure_close(fd) != 0) {
+    return absl::InternalError("Secure close failed.");
+  }
+  return absl::OkStatus();
+}
+
 Status EnclaveStorageSecureTest::OpenWriteClose(off_t offset) {
   // Open for write.
   int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
@@ -482,6 +535,37 @@ TEST_P(EnclaveStorageSecureTest, SimpleMisalignedReadSuccess) {
   EXPECT_THAT(OpenReadVerifyClose(offset, test_buf_len_ - offset), IsOk());
 }
 
+TEST_P(EnclaveStorageSecureTest, MinBlockLengthModificationWriteSuccess) {
+  ASSERT_THAT(CreateEmptyFile(kMinBlockLength), IsOk());
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+
+  // Test update-only write.
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+
+  // Test mixed update-append write from the middle of a block.
+  off_t offset = test_buf_len_ / 2 + kMinBlockLength / 4;
+  EXPECT_THAT(OpenWriteClose(offset), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(offset, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, MinBlockLengthMisalignedWriteSuccess) {
+  ASSERT_THAT(CreateEmptyFile(kMinBlockLength), IsOk());
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  // Lseek to the middle of the last block.
+  off_t offset = test_buf_len_ - kMinBlockLength / 2;
+  EXPECT_THAT(OpenWriteClose(offset), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(offset, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, MinBlockLengthMisalignedReadSuccess) {
+  ASSERT_THAT(CreateEmptyFile(kMinBlockLength), IsOk());
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  // Lseek to the middle of the first block.
+  off_t offset = kMinBlockLength / 2;
+  EXPECT_THAT(OpenReadVerifyClose(offset, test_buf_len_ - offset), IsOk());
+}
+
 TEST_P(EnclaveStorageSecureTest, StatReturnLogicalFileSizeSuccess) {
   EXPECT_THAT(OpenWriteClose(0), IsOk());
   int fd = secure_open(GetPath().c_str(), O_RDONLY);
@@ -503,6 +587,236 @@ TEST_P(EnclaveStorageSecureTest, LseekEndSuccess) {
   EXPECT_EQ(secure_close(fd), 0);
 }
 
+TEST_P(EnclaveStorageSecureTest, BlockLengthSetOnNewFileSuccess) {
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(AeadHandler::GetInstance().SetBlockLength(fd, kMinBlockLength), 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, GetWriteBuffer(), test_buf_len_), test_buf_len_);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // Each block is stored with its metadata after the header.
+  const size_t blocks = (test_buf_len_ + kMinBlockLength - 1) / kMinBlockLength;
+  EXPECT_EQ(GetPhysicalFileSize(GetPath()),
+            kFileHeaderLength +
+                blocks * (kMinBlockLength + kBlockMetadataLength));
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+  EXPECT_THAT(OpenReadVerifyClose(kMinBlockLength / 2,
+                                  test_buf_len_ - kMinBlockLength / 2),
+              IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, WritesVisibleAcrossDescriptorsSuccess) {
+  int write_fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                             S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(write_fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(write_fd), 0);
+  EXPECT_EQ(secure_write(write_fd, GetWriteBuffer(), test_buf_len_),
+            test_buf_len_);
+
+  // The write has not been flushed, but is visible through another descriptor
+  // open on the file.
+  int read_fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(read_fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(read_fd), 0);
+  EXPECT_EQ(secure_read(read_fd, GetReadBuffer(), test_buf_len_),
+            test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+
+  EXPECT_EQ(secure_close(read_fd), 0);
+  EXPECT_EQ(secure_close(write_fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, FsyncPersistsWritesSuccess) {
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_write(fd, GetWriteBuffer(), test_buf_len_), test_buf_len_);
+
+  // Written blocks are cached until the file is flushed.
+  EXPECT_EQ(GetPhysicalFileSize(GetPath()), kFileHeaderLength);
+  EXPECT_EQ(secure_fsync(fd), 0);
+  EXPECT_EQ(GetPhysicalFileSize(GetPath()),
+            kFileHeaderLength + kDefaultBlockLength + kBlockMetadataLength);
+  EXPECT_EQ(secure_close(fd), 0);
+  EXPECT_THAT(OpenReadVerifyClose(0, test_buf_len_), IsOk());
+}
+
+TEST_P(EnclaveStorageSecureTest, VectoredReadWriteSuccess) {
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+
+  // Write the buffer split unevenly, at the file offset and then after it.
+  const size_t split = test_buf_len_ / 3;
+  struct iovec write_iov[3] = {{write_buffer_, split},
+                               {write_buffer_ + split, 0},
+                               {write_buffer_ + split, test_buf_len_ - split}};
+  EXPECT_EQ(secure_writev(fd, write_iov, 3), test_buf_len_);
+  EXPECT_EQ(secure_pwritev(fd, write_iov, 3, test_buf_len_), test_buf_len_);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_CUR), test_buf_len_);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  struct iovec read_iov[2] = {{read_buffer_, test_buf_len_ - split},
+                              {read_buffer_ + test_buf_len_ - split, split}};
+  EXPECT_EQ(secure_preadv(fd, read_iov, 2, test_buf_len_), test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_CUR), 0);
+
+  memset(read_buffer_, 0, kMaxTestBufLen);
+  EXPECT_EQ(secure_readv(fd, read_iov, 2), test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+  EXPECT_EQ(secure_lseek(fd, 0, SEEK_CUR), test_buf_len_);
+
+  // A read past the end of the file is short.
+  memset(read_buffer_, 0, kMaxTestBufLen);
+  read_iov[1].iov_len = kMaxTestBufLen - (test_buf_len_ - split);
+  EXPECT_EQ(secure_readv(fd, read_iov, 2), test_buf_len_);
+  EXPECT_EQ(memcmp(GetWriteBuffer(), GetReadBuffer(), test_buf_len_), 0);
+
+  EXPECT_EQ(secure_preadv(fd, read_iov, 2, -1), -1);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, FileLargerThanCacheSuccess) {
+  // Write a file several times larger than the block cache in misaligned
+  // chunks, then read it back in a different order.
+  const size_t chunks = 4 * kBlockCacheCapacity / test_buf_len_;
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  std::vector<char> chunk(test_buf_len_);
+  for (size_t i = 0; i < chunks; i++) {
+    memset(chunk.data(), static_cast<int>(i % 251), chunk.size());
+    ASSERT_EQ(secure_write(fd, chunk.data(), chunk.size()), chunk.size());
+  }
+  EXPECT_EQ(secure_close(fd), 0);
+
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  std::vector<char> expected(test_buf_len_);
+  for (size_t i = 0; i < chunks; i++) {
+    // Visit every chunk, striding backwards through the file.
+    const size_t index = (chunks - 1) - (i * 7) % chunks;
+    memset(expected.data(), static_cast<int>(index % 251), expected.size());
+    ASSERT_EQ(secure_lseek(fd, index * test_buf_len_, SEEK_SET),
+              index * test_buf_len_);
+    ASSERT_EQ(secure_read(fd, chunk.data(), chunk.size()), chunk.size());
+    EXPECT_EQ(memcmp(expected.data(), chunk.data(), chunk.size()), 0)
+        << "chunk " << index;
+  }
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, EvictedBlocksValidBeforeCloseSuccess) {
+  // Write a file larger than the block cache without closing it, so that some
+  // of its blocks are written back when they are evicted.
+  const size_t chunks = 4 * kBlockCacheCapacity / test_buf_len_;
+  int fd = secure_open(GetPath().c_str(), O_RDWR | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  std::vector<char> chunk(test_buf_len_);
+  for (size_t i = 0; i < chunks; i++) {
+    memset(chunk.data(), static_cast<int>(i % 251), chunk.size());
+    ASSERT_EQ(secure_write(fd, chunk.data(), chunk.size()), chunk.size());
+  }
+
+  // Snapshot the file on the host, as left by a crash before it is closed.
+  const std::string copy_path = absl::StrCat(GetPath(), ".copy");
+  remove(copy_path.c_str());
+  const off_t physical_size = GetPhysicalFileSize(GetPath());
+  ASSERT_GT(physical_size, kFileHeaderLength);
+  std::vector<char> physical_data(physical_size);
+  int host_fd = enc_untrusted_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(host_fd, 0);
+  EXPECT_EQ(enc_untrusted_pread64(host_fd, physical_data.data(),
+                                  physical_data.size(), 0),
+            physical_size);
+  ASSERT_EQ(enc_untrusted_close(host_fd), 0);
+  host_fd = enc_untrusted_open(copy_path.c_str(), O_WRONLY | O_CREAT,
+                               S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(host_fd, 0);
+  EXPECT_EQ(enc_untrusted_write(host_fd, physical_data.data(),
+                                physical_data.size()),
+            physical_size);
+  ASSERT_EQ(enc_untrusted_close(host_fd), 0);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // The snapshot passes verification and holds a prefix of the chunks.
+  fd = secure_open(copy_path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  struct stat file_stat;
+  ASSERT_EQ(secure_fstat(fd, &file_stat), 0);
+  EXPECT_GT(file_stat.st_size, 0);
+  std::vector<char> expected(test_buf_len_);
+  for (size_t i = 0; i < file_stat.st_size / test_buf_len_; i++) {
+    memset(expected.data(), static_cast<int>(i % 251), expected.size());
+    ASSERT_EQ(secure_read(fd, chunk.data(), chunk.size()), chunk.size());
+    EXPECT_EQ(memcmp(expected.data(), chunk.data(), chunk.size()), 0)
+        << "chunk " << i;
+  }
+  EXPECT_EQ(secure_close(fd), 0);
+  remove(copy_path.c_str());
+}
+
+TEST_P(EnclaveStorageSecureTest, LargeFileHashCacheSuccess) {
+  // Write a file with enough blocks to persist its leaf hashes when closed.
+  const size_t file_length = kHashCacheMinBlocks * kMinBlockLength;
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(AeadHandler::GetInstance().SetBlockLength(fd, kMinBlockLength), 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  std::vector<char> data(file_length);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>(i % 251);
+  }
+  EXPECT_EQ(secure_write(fd, data.data(), data.size()), data.size());
+  EXPECT_EQ(secure_close(fd), 0);
+
+  const size_t data_end =
+      kFileHeaderLength +
+      kHashCacheMinBlocks * (kMinBlockLength + kBlockMetadataLength);
+  EXPECT_EQ(GetPhysicalFileSize(GetPath()),
+            data_end + kHashCacheMinBlocks * kRootHashLength);
+
+  // The file is reopened from the leaf hashes.
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  std::vector<char> read_data(file_length);
+  EXPECT_EQ(secure_read(fd, read_data.data(), read_data.size()),
+            read_data.size());
+  EXPECT_EQ(data, read_data);
+  EXPECT_EQ(secure_close(fd), 0);
+
+  // Corrupted leaf hashes are ignored in favor of the auth tags.
+  fd = enc_untrusted_open(GetPath().c_str(), O_WRONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(enc_untrusted_pwrite64(fd, kTamperData, ABSL_ARRAYSIZE(kTamperData),
+                                   data_end),
+            ABSL_ARRAYSIZE(kTamperData));
+  ASSERT_EQ(enc_untrusted_close(fd), 0) << strerror(errno);
+  fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(EmulateSetKeyIoctl(fd), 0);
+  EXPECT_EQ(secure_read(fd, read_data.data(), read_data.size()),
+            read_data.size());
+  EXPECT_EQ(data, read_data);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
 //
 // Failure cases.
 //
@@ -540,7 +854,8 @@ TEST_P(EnclaveStorageSecureTest, ReadWriteAuthTagsModified) {
   // Modify an auth tag - form of tampering.
   int fd = enc_untrusted_open(GetPath().c_str(), O_WRONLY);
   ASSERT_GE(fd, 0);
-  EXPECT_GT(enc_untrusted_lseek(fd, kFileHeaderLength + kBlockLength, SEEK_SET),
+  EXPECT_GT(enc_untrusted_lseek(fd, kFileHeaderLength + kDefaultBlockLength,
+                                SEEK_SET),
             0);
   EXPECT_GT(enc_untrusted_write(fd, kTamperData, ABSL_ARRAYSIZE(kTamperData)),
             0);
@@ -556,9 +871,10 @@ TEST_P(EnclaveStorageSecureTest, ReadWriteTokensModified) {
   // Modify a token - form of tampering.
   int fd = enc_untrusted_open(GetPath().c_str(), O_WRONLY);
   ASSERT_GE(fd, 0);
-  EXPECT_GT(
-      enc_untrusted_lseek(fd, kFileHeaderLength + kCipherBlockLength, SEEK_SET),
-      0);
+  EXPECT_GT(enc_untrusted_lseek(
+                fd, kFileHeaderLength + kDefaultBlockLength + kTagLength,
+                SEEK_SET),
+            0);
   EXPECT_GT(enc_untrusted_write(fd, kTamperData, ABSL_ARRAYSIZE(kTamperData)),
             0);
   ASSERT_EQ(enc_untrusted_fsync(fd), 0) << strerror(errno);
@@ -606,6 +922,27 @@ TEST_P(EnclaveStorageSecureTest, RedundantIoctlFailure) {
   EXPECT_EQ(secure_close(fd), 0);
 }
 
+TEST_P(EnclaveStorageSecureTest, BlockLengthSetOnExistingFileFailure) {
+  EXPECT_THAT(OpenWriteClose(0), IsOk());
+  int fd = secure_open(GetPath().c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(AeadHandler::GetInstance().SetBlockLength(fd, kMinBlockLength),
+            -1);
+  EXPECT_EQ(errno, EPERM);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
+TEST_P(EnclaveStorageSecureTest, InvalidBlockLengthFailure) {
+  int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
+                       S_IRWXU | S_IRWXG | S_IRWXO);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(AeadHandler::GetInstance().SetBlockLength(fd, 1000), -1);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(AeadHandler::GetInstance().SetBlockLength(fd, 64), -1);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(secure_close(fd), 0);
+}
+
 TEST_P(EnclaveStorageSecureTest, UnknownFdIoctlFailure) {
   // Open for write.
   int fd = secure_open(GetPath().c_str(), O_WRONLY | O_CREAT,
@@ -631,5 +968,122 @@ TEST_P(EnclaveStorageSecureTest, UnsupportedFileCreationFlagFailure) {
   EXPECT_EQ(fd, -1);
 }
 
+constexpr size_t kBenchmarkFileLength = 4 * 1024 * 1024;
+
+// Creates a secure file of kBenchmarkFileLength bytes and returns a read-write
+// descriptor open on it, or -1 on failure.
+int CreateBenchmarkFile(const std::string &path, size_t block_length) {
+  remove(path.c_str());
+  int fd = secure_open(path.c_str(), O_RDWR | O_CREAT, S_IRWXU);
+  if (fd < 0) {
+    return -1;
+  }
+  CleansingVector<uint8_t> key(kKeyLength);
+  std::vector<uint8_t> data(kBenchmarkFileLength);
+  if (AeadHandler::GetInstance().SetBlockLength(fd, block_length) != 0 ||
+      RAND_bytes(key.data(), key.size()) != 1 ||
+      AeadHandler::GetInstance().SetMasterKey(fd, key.data(), key.size()) !=
+          0 ||
+      secure_write(fd, data.data(), data.size()) != data.size() ||
+      secure_fsync(fd) != 0) {
+    secure_close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+std::string GetBenchmarkPath() {
+  return absl::StrCat(absl::GetFlag(FLAGS_test_tmpdir),
+                      "/EnclaveStorageSecureBenchmark.txt");
+}
+
+// The benchmarks below measure the throughput of a secure file with blocks of
+// |state.range(0)| bytes, transferring |state.range(1)| bytes per call.
+
+// Overwrites the file from start to end, wrapping around at its end.
+void BM_SecureSequentialWrite(benchmark::State &state) {
+  int fd = CreateBenchmarkFile(GetBenchmarkPath(), state.range(0));
+  if (fd < 0) {
+    state.SkipWithError("Could not create the benchmark file");
+    return;
+  }
+  std::vector<uint8_t> buffer(state.range(1), 0xa5);
+  off_t offset = 0;
+  for (auto _ : state) {
+    if (offset + buffer.size() > kBenchmarkFileLength) {
+      offset = 0;
+      secure_lseek(fd, 0, SEEK_SET);
+    }
+    benchmark::DoNotOptimize(secure_write(fd, buffer.data(), buffer.size()));
+    offset += buffer.size();
+  }
+  secure_fsync(fd);
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+  secure_close(fd);
+}
+
+// Reads the file from start to end, wrapping around at its end.
+void BM_SecureSequentialRead(benchmark::State &state) {
+  int fd = CreateBenchmarkFile(GetBenchmarkPath(), state.range(0));
+  if (fd < 0) {
+    state.SkipWithError("Could not create the benchmark file");
+    return;
+  }
+  std::vector<uint8_t> buffer(state.range(1));
+  for (auto _ : state) {
+    if (secure_read(fd, buffer.data(), buffer.size()) <= 0) {
+      secure_lseek(fd, 0, SEEK_SET);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+  secure_close(fd);
+}
+
+// Overwrites the file at random offsets aligned to the transfer size.
+void BM_SecureRandomWrite(benchmark::State &state) {
+  int fd = CreateBenchmarkFile(GetBenchmarkPath(), state.range(0));
+  if (fd < 0) {
+    state.SkipWithError("Could not create the benchmark file");
+    return;
+  }
+  std::vector<uint8_t> buffer(state.range(1), 0x5a);
+  const size_t slots = kBenchmarkFileLength / buffer.size();
+  uint64_t random = 1;
+  for (auto _ : state) {
+    random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+    secure_lseek(fd, (random >> 33) % slots * buffer.size(), SEEK_SET);
+    benchmark::DoNotOptimize(secure_write(fd, buffer.data(), buffer.size()));
+  }
+  secure_fsync(fd);
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+  secure_close(fd);
+}
+
+// Reads the file at random offsets aligned to the transfer size.
+void BM_SecureRandomRead(benchmark::State &state) {
+  int fd = CreateBenchmarkFile(GetBenchmarkPath(), state.range(0));
+  if (fd < 0) {
+    state.SkipWithError("Could not create the benchmark file");
+    return;
+  }
+  std::vector<uint8_t> buffer(state.range(1));
+  const size_t slots = kBenchmarkFileLength / buffer.size();
+  uint64_t random = 1;
+  for (auto _ : state) {
+    random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+    secure_lseek(fd, (random >> 33) % slots * buffer.size(), SEEK_SET);
+    benchmark::DoNotOptimize(secure_read(fd, buffer.data(), buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+  secure_close(fd);
+}
+
+BENCHMARK(BM_SecureSequentialWrite)
+    ->ArgsProduct({{128, 4096}, {512, 4096, 64 * 1024}});
+BENCHMARK(BM_SecureSequentialRead)
+    ->ArgsProduct({{128, 4096}, {512, 4096, 64 * 1024}});
+BENCHMARK(BM_SecureRandomWrite)->ArgsProduct({{128, 4096}, {512, 4096}});
+BENCHMARK(BM_SecureRandomRead)->ArgsProduct({{128, 4096}, {512, 4096}});
+
 }  // namespace
 }  // namespace asylo
@@ -0,0 +1,283 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/utils/async_storage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "asylo/util/logging.h"
+
+namespace asylo {
+
+AsyncStorage::AsyncStorage(RandomAccessStorage *io, size_t max_pending_bytes,
+                           size_t read_ahead_bytes)
+    : io_(io),
+      max_pending_bytes_(max_pending_bytes),
+      read_ahead_bytes_(read_ahead_bytes),
+      pending_bytes_(0),
+      next_read_offset_(-1),
+      read_ahead_offset_(0),
+      read_ahead_pending_(false),
+      pending_read_ahead_offset_(0),
+      read_ahead_generation_(0),
+      stopping_(false) {
+  has_worker_ = pthread_create(&worker_, nullptr, RunWorker, this) == 0;
+  LOG_IF(WARNING, !has_worker_)
+      << "Could not start a thread for AsyncStorage, falling back to "
+         "synchronous I/O";
+}
+
+AsyncStorage::~AsyncStorage() {
+  if (has_worker_) {
+    {
+      absl::MutexLock lock(&mu_);
+      stopping_ = true;
+      work_queued_.Signal();
+    }
+    pthread_join(worker_, nullptr);
+  }
+  absl::MutexLock lock(&mu_);
+  LOG_IF(ERROR, !error_.ok()) << "Could not apply queued writes: " << error_;
+}
+
+StatusOr<size_t> AsyncStorage::Size() const {
+  {
+    absl::MutexLock lock(&mu_);
+    WaitForWrites();
+  }
+  absl::MutexLock io_lock(&io_mu_);
+  return io_->Size();
+}
+
+Status AsyncStorage::Read(void *buffer, off_t offset, size_t size) {
+  if (size == 0) {
+    return absl::OkStatus();
+  }
+  uint8_t *bytes = static_cast<uint8_t *>(buffer);
+  bool sequential;
+  {
+    absl::MutexLock lock(&mu_);
+    sequential = offset == next_read_offset_;
+    next_read_offset_ = offset + size;
+    auto read_ahead_covers = [this, offset, size]() {
+      return offset >= read_ahead_offset_ &&
+             offset + size <= read_ahead_offset_ + read_ahead_.size();
+    };
+    // Wait for a read-ahead which will cover this read, unless queued writes
+    // must be applied before it starts.
+    while (!read_ahead_covers() && read_ahead_pending_ && writes_.empty() &&
+           offset >= pending_read_ahead_offset_ &&
+           offset + size <= pending_read_ahead_offset_ + read_ahead_bytes_) {
+      work_done_.Wait(&mu_);
+    }
+    if (read_ahead_covers()) {
+      memcpy(bytes, &read_ahead_[offset - read_ahead_offset_], size);
+      ApplyPendingWrites(bytes, offset, size);
+      if (sequential) {
+        MaybeReadAhead(offset + size);
+      }
+      return absl::OkStatus();
+    }
+  }
+
+  {
+    // Writes applied after the read are still queued when |mu_| is acquired,
+    // since the background thread holds |io_mu_| until it dequeues a write.
+    absl::MutexLock io_lock(&io_mu_);
+    if (io_->Read(bytes, offset, size).ok()) {
+      absl::MutexLock lock(&mu_);
+      ApplyPendingWrites(bytes, offset, size);
+      if (sequential) {
+        MaybeReadAhead(offset + size);
+      }
+      return absl::OkStatus();
+    }
+  }
+
+  // The read may extend past the end of the underlying storage into a range
+  // covered by queued writes, so retry once they have been applied.
+  {
+    absl::MutexLock lock(&mu_);
+    WaitForWrites();
+  }
+  absl::MutexLock io_lock(&io_mu_);
+  return io_->Read(bytes, offset, size);
+}
+
+Status AsyncStorage::Write(const void *buffer, off_t offset, size_t size) {
+  if (!has_worker_) {
+    absl::MutexLock io_lock(&io_mu_);
+    return io_->Write(buffer, offset, size);
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(buffer);
+  absl::MutexLock lock(&mu_);
+  // A write larger than the queue is accepted once the queue is empty.
+  while (error_.ok() && !writes_.empty() &&
+         pending_bytes_ + size > max_pending_bytes_) {
+    work_done_.Wait(&mu_);
+  }
+  if (!error_.ok()) {
+    return error_;
+  }
+  InvalidateReadAhead(offset, size);
+  writes_.push_back(
+      PendingWrite{offset, std::vector<uint8_t>(bytes, bytes + size)});
+  pending_bytes_ += size;
+  work_queued_.Signal();
+  return absl::OkStatus();
+}
+
+Status AsyncStorage::Sync() {
+  {
+    absl::MutexLock lock(&mu_);
+    WaitForWrites();
+    if (!error_.ok()) {
+      return error_;
+    }
+  }
+  absl::MutexLock io_lock(&io_mu_);
+  return io_->Sync();
+}
+
+Status AsyncStorage::Truncate(size_t size) {
+  {
+    absl::MutexLock lock(&mu_);
+    WaitForWrites();
+    if (!error_.ok()) {
+      return error_;
+    }
+    InvalidateReadAhead(0, 0);
+  }
+  absl::MutexLock io_lock(&io_mu_);
+  return io_->Truncate(size);
+}
+
+void *AsyncStorage::RunWorker(void *storage) {
+  static_cast<AsyncStorage *>(storage)->Work();
+  return nullptr;
+}
+
+void AsyncStorage::Work() {
+  absl::MutexLock lock(&mu_);
+  while (true) {
+    if (!writes_.empty()) {
+      // References to elements of a deque are not invalidated by push_back(),
+      // so |write| remains valid while Write() queues more data.
+      const PendingWrite &write = writes_.front();
+      mu_.Unlock();
+      io_mu_.Lock();
+      Status status =
+          io_->Write(write.data.data(), write.offset, write.data.size());
+      mu_.Lock();
+      io_mu_.Unlock();
+      pending_bytes_ -= write.data.size();
+      writes_.pop_front();
+      if (!status.ok()) {
+        // Discard later writes so that the underlying storage holds a prefix
+        // of the writes issued.
+        error_ = status;
+        writes_.clear();
+        pending_bytes_ = 0;
+      }
+      work_done_.SignalAll();
+    } else if (read_ahead_pending_) {
+      off_t offset = pending_read_ahead_offset_;
+      uint64_t generation = read_ahead_generation_;
+      mu_.Unlock();
+      std::vector<uint8_t> data;
+      bool read_ok;
+      {
+        absl::MutexLock io_lock(&io_mu_);
+        StatusOr<size_t> size = io_->Size();
+        read_ok = size.ok();
+        if (read_ok && size.value() > static_cast<size_t>(offset)) {
+          data.resize(std::min(read_ahead_bytes_, size.value() - offset));
+          read_ok = io_->Read(data.data(), offset, data.size()).ok();
+        }
+      }
+      mu_.Lock();
+      if (generation == read_ahead_generation_) {
+        read_ahead_pending_ = false;
+        if (read_ok) {
+          read_ahead_offset_ = offset;
+          read_ahead_ = std::move(data);
+        }
+      }
+      work_done_.SignalAll();
+    } else if (stopping_) {
+      return;
+    } else {
+      work_queued_.Wait(&mu_);
+    }
+  }
+}
+
+void AsyncStorage::WaitForWrites() const {
+  while (!writes_.empty()) {
+    work_done_.Wait(&mu_);
+  }
+}
+
+void AsyncStorage::ApplyPendingWrites(uint8_t *buffer, off_t offset,
+                                      size_t size) const {
+  for (const PendingWrite &write : writes_) {
+    off_t begin = std::max(offset, write.offset);
+    off_t end =
+        std::min<off_t>(offset + size, write.offset + write.data.size());
+    if (begin < end) {
+      memcpy(buffer + (begin - offset), &write.data[begin - write.offset],
+             end - begin);
+    }
+  }
+}
+
+void AsyncStorage::MaybeReadAhead(off_t offset) {
+  if (!has_worker_ || read_ahead_bytes_ == 0 || read_ahead_pending_) {
+    return;
+  }
+  // Start the next read-ahead once half of the current one has been consumed,
+  // so that it overlaps with reads of the other half.
+  if (offset >= read_ahead_offset_ &&
+      offset + read_ahead_bytes_ / 2 <
+          read_ahead_offset_ + read_ahead_.size()) {
+    return;
+  }
+  read_ahead_pending_ = true;
+  pending_read_ahead_offset_ = offset;
+  work_queued_.Signal();
+}
+
+void AsyncStorage::InvalidateReadAhead(off_t offset, size_t size) {
+  auto overlaps = [offset, size](off_t begin, size_t length) {
+    return offset < static_cast<off_t>(begin + length) &&
+           begin < static_cast<off_t>(offset + size);
+  };
+  bool buffered = overlaps(read_ahead_offset_, read_ahead_.size());
+  bool pending = read_ahead_pending_ &&
+                 overlaps(pending_read_ahead_offset_, read_ahead_bytes_);
+  if (size == 0 || buffered || pending) {
+    read_ahead_.clear();
+    read_ahead_pending_ = false;
+    read_ahead_generation_++;
+  }
+}
+
+}  // namespace asylo
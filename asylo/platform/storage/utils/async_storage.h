@@ -0,0 +1,172 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ASYLO_PLATFORM_STORAGE_UTILS_ASYNC_STORAGE_H_
+#define ASYLO_PLATFORM_STORAGE_UTILS_ASYNC_STORAGE_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "asylo/platform/storage/utils/random_access_storage.h"
+#include "asylo/util/status.h"
+#include "asylo/util/statusor.h"
+
+namespace asylo {
+
+// An implementation of RandomAccessStorage which defers writes to, and reads
+// ahead from, another RandomAccessStorage on a background thread, so that
+// callers streaming through a storage resource backed by host calls do not
+// wait on each of them.
+//
+// Writes are copied into a bounded write-behind queue and applied to the
+// underlying storage by the background thread in the order they were issued.
+// Write() blocks while the queue holds more than its capacity. Reads always
+// reflect every preceding write, whether or not it has been applied yet. When
+// reads are sequential, the range following each read is fetched in the
+// background so the next read can be served from memory.
+//
+// Sync() waits for all preceding writes to be applied and then synchronizes
+// the underlying storage, so when it succeeds those writes are as durable as
+// the underlying storage makes them. If execution stops before Sync() returns,
+// the underlying storage holds every write issued before the previous
+// successful Sync() and some prefix, possibly empty, of the writes issued
+// since; later writes are never applied ahead of earlier ones. If applying a
+// write fails, no further writes are applied and every subsequent Write() and
+// Sync() returns the error.
+//
+// Size() and Truncate() wait for the queue to drain. If a background thread
+// cannot be started, all operations are performed synchronously.
+//
+// Calls into the underlying storage are serialized, so it need not be
+// thread-safe, but it must not be accessed other than through this instance
+// while the instance exists. Like other RandomAccessStorage implementations,
+// this class is not thread-safe: its methods must not be called concurrently.
+class AsyncStorage : public RandomAccessStorage {
+ public:
+  // Constructs an AsyncStorage over |io|, which remains owned by the caller and
+  // must outlive this instance. Up to |max_pending_bytes| of written data are
+  // queued before Write() blocks, and sequential reads are followed by
+  // fetching the next |read_ahead_bytes| bytes, or none if it is zero.
+  AsyncStorage(RandomAccessStorage *io, size_t max_pending_bytes,
+               size_t read_ahead_bytes);
+
+  // Applies any queued writes and stops the background thread. The underlying
+  // storage is not synchronized.
+  ~AsyncStorage() override;
+
+  AsyncStorage(const AsyncStorage &) = delete;
+  AsyncStorage &operator=(const AsyncStorage &) = delete;
+
+  StatusOr<size_t> Size() const override;
+
+  Status Read(void *buffer, off_t offset, size_t size) override;
+
+  Status Write(const void *buffer, off_t offset, size_t size) override;
+
+  Status Sync() override;
+
+  Status Truncate(size_t size) override;
+
+ private:
+  // A write queued for the background thread.
+  struct PendingWrite {
+    off_t offset;
+    std::vector<uint8_t> data;
+  };
+
+  static void *RunWorker(void *storage);
+
+  // Applies queued writes and performs read-ahead until the instance is
+  // destroyed.
+  void Work();
+
+  // Waits until every queued write has been applied or discarded.
+  void WaitForWrites() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Copies the parts of queued writes overlapping [|offset|, |offset| + |size|)
+  // into |buffer|, in the order they were issued.
+  void ApplyPendingWrites(uint8_t *buffer, off_t offset, size_t size) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Requests a read-ahead starting at |offset| following a sequential read,
+  // unless enough data from |offset| on has already been read ahead.
+  void MaybeReadAhead(off_t offset) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Discards read-ahead data and any read-ahead in progress if they overlap
+  // [|offset|, |offset| + |size|), or unconditionally if |size| is zero.
+  void InvalidateReadAhead(off_t offset, size_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  RandomAccessStorage *const io_;
+  const size_t max_pending_bytes_;
+  const size_t read_ahead_bytes_;
+
+  // Serializes calls into |io_|. Acquired before |mu_| when both are held.
+  mutable absl::Mutex io_mu_;
+
+  mutable absl::Mutex mu_ ABSL_ACQUIRED_AFTER(io_mu_);
+
+  // Signaled when work is queued for the background thread.
+  absl::CondVar work_queued_;
+
+  // Signaled when the background thread completes a write or a read-ahead.
+  mutable absl::CondVar work_done_;
+
+  // Writes not yet applied to |io_|, oldest first. The oldest is being applied
+  // while the background thread is writing.
+  std::deque<PendingWrite> writes_ ABSL_GUARDED_BY(mu_);
+
+  // Total size of the data in |writes_|.
+  size_t pending_bytes_ ABSL_GUARDED_BY(mu_);
+
+  // The first error returned by |io_| for a queued write.
+  Status error_ ABSL_GUARDED_BY(mu_);
+
+  // Offset just past the end of the last read, to detect sequential reads.
+  off_t next_read_offset_ ABSL_GUARDED_BY(mu_);
+
+  // Data read ahead from |io_| starting at |read_ahead_offset_|, including
+  // every write applied before it was read.
+  off_t read_ahead_offset_ ABSL_GUARDED_BY(mu_);
+  std::vector<uint8_t> read_ahead_ ABSL_GUARDED_BY(mu_);
+
+  // True while a read-ahead starting at |pending_read_ahead_offset_| is
+  // requested or in progress.
+  bool read_ahead_pending_ ABSL_GUARDED_BY(mu_);
+  off_t pending_read_ahead_offset_ ABSL_GUARDED_BY(mu_);
+
+  // Incremented whenever read-ahead data is invalidated, so that a read-ahead
+  // in progress at the time is discarded when it completes.
+  uint64_t read_ahead_generation_ ABSL_GUARDED_BY(mu_);
+
+  bool stopping_ ABSL_GUARDED_BY(mu_);
+
+  bool has_worker_;
+  pthread_t worker_;
+};
+
+}  // namespace asylo
+
+#endif  // ASYLO_PLATFORM_STORAGE_UTILS_ASYNC_STORAGE_H_
@@ -0,0 +1,210 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "asylo/platform/storage/utils/async_storage.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/status/status.h"
+#include "absl/synchronization/notification.h"
+#include "asylo/platform/storage/utils/test_utils.h"
+#include "asylo/test/util/status_matchers.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::Eq;
+using ::testing::Le;
+using ::testing::SizeIs;
+
+constexpr size_t kRecordSize = 64;
+
+// Writes a record filled with |value| at |offset| to |storage| and to |model|.
+Status WriteRecord(RandomAccessStorage *storage, std::vector<uint8_t> *model,
+                   off_t offset, uint8_t value) {
+  std::vector<uint8_t> record(kRecordSize, value);
+  if (offset + kRecordSize > model->size()) {
+    model->resize(offset + kRecordSize);
+  }
+  memcpy(&(*model)[offset], record.data(), kRecordSize);
+  return storage->Write(record.data(), offset, kRecordSize);
+}
+
+// Ensure that every write issued before Sync() returns is durable, and that
+// writes issued since are applied in order, so that stopping at any point
+// leaves the storage as of the last Sync() plus a prefix of later writes.
+TEST(AsyncStorageTest, SyncBoundaries) {
+  MemoryStorage fake;
+  AsyncStorage storage(&fake, 16 * kRecordSize, 0);
+  std::vector<uint8_t> model;
+  std::vector<off_t> issued;
+
+  // Overlapping writes make the final contents depend on their order.
+  for (int i = 0; i < 200; i++) {
+    off_t offset = (i * 7 % 50) * kRecordSize / 2;
+    ASYLO_ASSERT_OK(WriteRecord(&storage, &model, offset, i));
+    issued.push_back(offset);
+  }
+  ASYLO_ASSERT_OK(storage.Sync());
+  EXPECT_THAT(fake.durable(), Eq(model));
+  EXPECT_THAT(fake.write_log(), ElementsAreArray(issued));
+  std::vector<uint8_t> synced = model;
+
+  for (int i = 0; i < 200; i++) {
+    off_t offset = (i * 11 % 60) * kRecordSize / 2;
+    ASYLO_ASSERT_OK(WriteRecord(&storage, &model, offset, 200 - i));
+    issued.push_back(offset);
+  }
+  // Without a Sync(), none of the writes since the last one are durable, and
+  // those applied so far are the earliest ones issued.
+  EXPECT_THAT(fake.durable(), Eq(synced));
+  std::vector<off_t> applied = fake.write_log();
+  ASSERT_THAT(applied.size(), Le(issued.size()));
+  EXPECT_THAT(applied, ElementsAreArray(issued.begin(),
+                                        issued.begin() + applied.size()));
+
+  ASYLO_ASSERT_OK(storage.Sync());
+  EXPECT_THAT(fake.durable(), Eq(model));
+  EXPECT_THAT(fake.write_log(), ElementsAreArray(issued));
+}
+
+// Ensure that a failed write is reported by Sync() and later calls, and that no
+// later write is applied after it.
+TEST(AsyncStorageTest, FailedWrite) {
+  MemoryStorage fake;
+  AsyncStorage storage(&fake, 4 * kRecordSize, 0);
+  std::vector<uint8_t> model;
+  ASYLO_ASSERT_OK(WriteRecord(&storage, &model, 0, 1));
+  ASYLO_ASSERT_OK(storage.Sync());
+  std::vector<uint8_t> synced = model;
+
+  fake.FailWritesAfter(3);
+  Status status;
+  for (int i = 0; i < 10 && status.ok(); i++) {
+    status = WriteRecord(&storage, &model, i * kRecordSize, i + 2);
+  }
+  EXPECT_THAT(storage.Sync(), StatusIs(error::INTERNAL));
+  EXPECT_THAT(fake.durable(), Eq(synced));
+  EXPECT_THAT(fake.write_log(), SizeIs(4));
+  EXPECT_THAT(WriteRecord(&storage, &model, 0, 0), StatusIs(error::INTERNAL));
+}
+
+// Ensure that Write() blocks while the write-behind queue is full.
+TEST(AsyncStorageTest, WriteBlocksWhenQueueIsFull) {
+  MemoryStorage fake;
+  absl::Notification gate;
+  fake.set_gate(&gate);
+  AsyncStorage storage(&fake, 2 * kRecordSize, 0);
+  std::vector<uint8_t> model;
+  ASYLO_ASSERT_OK(WriteRecord(&storage, &model, 0, 1));
+  ASYLO_ASSERT_OK(WriteRecord(&storage, &model, kRecordSize, 2));
+
+  absl::Notification writing;
+  std::thread writer([&storage, &model, &gate, &writing] {
+    writing.Notify();
+    ASYLO_EXPECT_OK(WriteRecord(&storage, &model, 2 * kRecordSize, 3));
+    // The queue has room only once the first write passes the gate.
+    EXPECT_TRUE(gate.HasBeenNotified());
+  });
+  writing.WaitForNotification();
+
+  gate.Notify();
+  writer.join();
+  ASYLO_ASSERT_OK(storage.Sync());
+  EXPECT_THAT(fake.durable(), Eq(model));
+}
+
+// Ensure that sequential reads are served from data read ahead, and reflect
+// writes made since it was read.
+TEST(AsyncStorageTest, SequentialReadAhead) {
+  constexpr size_t kChunkSize = 4096;
+  constexpr size_t kChunkCount = 256;
+  MemoryStorage fake;
+  std::vector<uint8_t> model(kChunkSize * kChunkCount);
+  for (size_t i = 0; i < model.size(); i++) {
+    model[i] = i % 251;
+  }
+  ASYLO_ASSERT_OK(fake.Write(model.data(), 0, model.size()));
+
+  AsyncStorage storage(&fake, 16 * kRecordSize, 16 * kChunkSize);
+  std::vector<uint8_t> chunk(kChunkSize);
+  for (size_t i = 0; i < kChunkCount; i++) {
+    if (i % 64 == 8) {
+      // Overwrite data just ahead, which has likely been read ahead.
+      ASYLO_ASSERT_OK(
+          WriteRecord(&storage, &model, (i + 1) * kChunkSize + 100, i));
+    }
+    ASYLO_ASSERT_OK(storage.Read(chunk.data(), i * kChunkSize, kChunkSize));
+    ASSERT_THAT(chunk, ElementsAreArray(&model[i * kChunkSize], kChunkSize))
+        << i;
+  }
+  EXPECT_THAT(fake.read_count(), Le(kChunkCount / 4));
+}
+
+// Ensure that reads, Size() and Truncate() reflect all preceding writes under
+// a random mix of operations.
+TEST(AsyncStorageTest, RandomOperations) {
+  MemoryStorage fake;
+  AsyncStorage storage(&fake, 8 * kRecordSize, 8 * kRecordSize);
+  std::vector<uint8_t> model;
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<int> operation(0, 99);
+  std::uniform_int_distribution<off_t> position(0, 63);
+
+  std::vector<uint8_t> buffer(2 * kRecordSize);
+  off_t next_read = 0;
+  for (int i = 0; i < 5000; i++) {
+    int choice = operation(generator);
+    if (choice < 45) {
+      ASYLO_ASSERT_OK(WriteRecord(&storage, &model,
+                                  position(generator) * kRecordSize / 2, i));
+    } else if (choice < 95) {
+      // Mix sequential and random reads of the part of the model written.
+      off_t offset = choice < 70 ? next_read : position(generator) * 8;
+      if (offset + buffer.size() > model.size()) {
+        offset = 0;
+      }
+      if (offset + buffer.size() > model.size()) {
+        continue;
+      }
+      ASYLO_ASSERT_OK(storage.Read(buffer.data(), offset, buffer.size()));
+      ASSERT_THAT(buffer, ElementsAreArray(&model[offset], buffer.size())) << i;
+      next_read = offset + buffer.size();
+    } else if (choice < 97) {
+      EXPECT_THAT(storage.Size(), IsOkAndHolds(model.size()));
+    } else if (choice < 98) {
+      model.resize(model.size() / 2);
+      ASYLO_ASSERT_OK(storage.Truncate(model.size()));
+    } else {
+      ASYLO_ASSERT_OK(storage.Sync());
+      EXPECT_THAT(fake.durable(), Eq(model));
+    }
+  }
+  ASYLO_ASSERT_OK(storage.Sync());
+  EXPECT_THAT(fake.data(), Eq(model));
+}
+
+}  // namespace
+}  // namespace asylo
@@ -20,11 +20,12 @@
 #define ASYLO_PLATFORM_STORAGE_UTILS_RECORD_STORE_H_
 
 #include <algorithm>
-#include <iterator>
-#include <list>
+#include <cstdint>
+#include <cstring>
 #include <type_traits>
+#include <vector>
 
-#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
 #include "absl/status/status.h"
 #include "asylo/util/logging.h"
 #include "asylo/platform/storage/utils/random_access_storage.h"
@@ -49,7 +50,8 @@ namespace asylo {
 // Read and write operations are performed via a fixed-size cache using a least-
 // recently-used eviction policy. The cache may be flushed to disk explicitly
 // via Flush(), and is automatically flushed when the RecordStore passes out of
-// scope.
+// scope. Flush() writes dirty records in order of their offsets and coalesces
+// records that are adjacent in storage into a single write.
 //
 // This class is not thread-safe. It is the responsibility of the caller to
 // ensure that its methods are not called concurrently.
@@ -67,7 +69,17 @@ class RecordStore {
   // RecordStore does not take ownership of |io| and it is the responsibility of
   // the caller to ensure it remains valid over the lifetime of the RecordStore.
   RecordStore(size_t capacity, RandomAccessStorage *io)
-      : capacity_(std::max<size_t>(capacity, 1)), count_(0), io_(io) {}
+      : capacity_(std::max<size_t>(capacity, 1)),
+        head_(kNone),
+        tail_(kNone),
+        free_(0),
+        io_(io),
+        slab_(capacity_),
+        index_(IndexSize(capacity_), IndexEntry{0, kNone}) {
+    for (size_t slot = 0; slot < capacity_; slot++) {
+      slab_[slot].next = slot + 1 < capacity_ ? slot + 1 : kNone;
+    }
+  }
 
   RecordStore(const RecordStore<T> &) = delete;
 
@@ -88,8 +100,27 @@ class RecordStore {
   // Flushes the cache to persistent storage and ensures the underlying storage
   // resource has been synchronized. Returns an error status on failure.
   ASYLO_MUST_USE_RESULT Status Flush() {
-    for (auto it = cache_.begin(); it != cache_.end(); it++) {
-      ASYLO_RETURN_IF_ERROR(Commit(it));
+    std::vector<size_t> dirty;
+    for (size_t slot = 0; slot < slab_.size(); slot++) {
+      if (slab_[slot].dirty) {
+        dirty.push_back(slot);
+      }
+    }
+    std::sort(dirty.begin(), dirty.end(), [this](size_t lhs, size_t rhs) {
+      return slab_[lhs].offset < slab_[rhs].offset;
+    });
+
+    // Write each run of records that are contiguous in storage at once.
+    size_t begin = 0;
+    while (begin < dirty.size()) {
+      size_t end = begin + 1;
+      while (end < dirty.size() &&
+             slab_[dirty[end]].offset ==
+                 slab_[dirty[end - 1]].offset + sizeof(T)) {
+        end++;
+      }
+      ASYLO_RETURN_IF_ERROR(CommitRun(&dirty[begin], end - begin));
+      begin = end;
     }
     ASYLO_RETURN_IF_ERROR(io_->Sync());
     return absl::OkStatus();
@@ -101,31 +132,27 @@ class RecordStore {
   // reflect the value written via this instance and not the value on disk if it
   // has been modified otherwise.
   ASYLO_MUST_USE_RESULT Status Read(off_t offset, T *item) {
-    auto it = index_.find(offset);
-    if (it != index_.end()) {
-      MoveToFront(it->second);
+    size_t slot = Find(offset);
+    if (slot != kNone) {
+      MoveToFront(slot);
     } else {
-      if (count_ < capacity_) {
-        cache_.emplace_front();
-        count_++;
-      } else {
-        ASYLO_RETURN_IF_ERROR(Evict());
+      if (free_ == kNone && slab_[tail_].dirty) {
+        ASYLO_RETURN_IF_ERROR(Commit(tail_));
       }
-      auto first = cache_.begin();
-      Status status = io_->Read(&first->value, offset, sizeof(T));
+      slot = Allocate();
+      Status status = io_->Read(&slab_[slot].value, offset, sizeof(T));
       if (!status.ok()) {
-        // On read failure, the contents of the head node are undefined. Discard
-        // the cache head node to ensure garbage data is not evicted and written
-        // back to disk.
-        cache_.pop_front();
-        count_--;
+        // On read failure, the contents of the slot are undefined. Release it
+        // without indexing it to ensure garbage data is not evicted and
+        // written back to disk.
+        Release(slot);
         return status;
       }
-      first->offset = offset;
-      first->dirty = false;
-      index_[offset] = first;
+      slab_[slot].offset = offset;
+      slab_[slot].dirty = false;
+      Insert(slot);
     }
-    *item = cache_.begin()->value;
+    *item = slab_[slot].value;
     return absl::OkStatus();
   }
 
@@ -136,87 +163,209 @@ class RecordStore {
   // RecordStore. Writes are cached and may not be persisted to storage until
   // Flush() is called or the RecordStore is destroyed.
   ASYLO_MUST_USE_RESULT Status Write(off_t offset, const T &item) {
-    auto it = index_.find(offset);
-    if (it != index_.end()) {
-      MoveToFront(it->second);
+    size_t slot = Find(offset);
+    if (slot != kNone) {
+      MoveToFront(slot);
     } else {
-      if (count_ < capacity_) {
-        // Allocate a new cache entry. Note that existing iterators into cache_
-        // are not invalidated.
-        cache_.emplace_front();
-        count_++;
-      } else {
-        ASYLO_RETURN_IF_ERROR(Evict());
+      if (free_ == kNone && slab_[tail_].dirty) {
+        ASYLO_RETURN_IF_ERROR(Commit(tail_));
       }
-      cache_.begin()->offset = offset;
-      index_[offset] = cache_.begin();
+      slot = Allocate();
+      slab_[slot].offset = offset;
+      Insert(slot);
     }
-    auto first = cache_.begin();
-    first->value = item;
-    first->dirty = true;
+    slab_[slot].value = item;
+    slab_[slot].dirty = true;
     return absl::OkStatus();
   }
 
   // Returns true if a record specified by its byte-offset is present in the
   // cache.
-  bool IsCached(off_t offset) const { return index_.contains(offset); }
+  bool IsCached(off_t offset) const { return Find(offset) != kNone; }
 
  private:
+  // Sentinel for an absent slot in the slab or in the index.
+  static constexpr size_t kNone = SIZE_MAX;
+
   struct CacheEntry {
     off_t offset;  // Byte offset of this record.
     T value;       // Cached record value.
     bool dirty;    // True if this entry has been modified.
+    size_t prev;   // Next more recently used slot, or kNone.
+    size_t next;   // Next less recently used slot, or the next free slot.
   };
 
-  using NodeRef = typename std::list<CacheEntry>::iterator;
-  using ConstNodeRef = typename std::list<CacheEntry>::const_iterator;
+  // A bucket in the index. Offsets are stored alongside slots so that probing
+  // does not touch the slab.
+  struct IndexEntry {
+    off_t offset;  // Byte offset of the indexed record.
+    size_t slot;   // Slot caching the record, or kNone if the bucket is empty.
+  };
 
-  // Writes a cache entry to storage, returning an error status on failure.
-  ASYLO_MUST_USE_RESULT Status Commit(NodeRef entry) {
-    ASYLO_RETURN_IF_ERROR(io_->Write(&entry->value, entry->offset, sizeof(T)));
-    entry->dirty = false;
+  // Returns the number of buckets in an index for |capacity| records, which is
+  // a power of two keeping the load factor at or below one half.
+  static size_t IndexSize(size_t capacity) {
+    size_t size = 2;
+    while (size < 2 * capacity) {
+      size *= 2;
+    }
+    return size;
+  }
+
+  size_t Bucket(off_t offset) const {
+    return absl::Hash<off_t>()(offset) & (index_.size() - 1);
+  }
+
+  // Returns the index bucket holding the slot of the record at |offset|, or the
+  // empty bucket where it would be inserted.
+  size_t Probe(off_t offset) const {
+    size_t mask = index_.size() - 1;
+    size_t bucket = Bucket(offset);
+    while (index_[bucket].slot != kNone && index_[bucket].offset != offset) {
+      bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+  }
+
+  // Returns the slot caching the record at |offset|, or kNone if the record is
+  // not cached.
+  size_t Find(off_t offset) const {
+    if (index_.empty()) {
+      return kNone;
+    }
+    return index_[Probe(offset)].slot;
+  }
+
+  // Adds |slot| to the index under the offset of its record.
+  void Insert(size_t slot) {
+    off_t offset = slab_[slot].offset;
+    index_[Probe(offset)] = IndexEntry{offset, slot};
+  }
+
+  // Removes the record at |offset| from the index. Subsequent entries in the
+  // same probe sequence are shifted back so lookups need no tombstones.
+  void Erase(off_t offset) {
+    size_t mask = index_.size() - 1;
+    size_t hole = Probe(offset);
+    index_[hole].slot = kNone;
+    for (size_t bucket = (hole + 1) & mask; index_[bucket].slot != kNone;
+         bucket = (bucket + 1) & mask) {
+      size_t home = Bucket(index_[bucket].offset);
+      if (((bucket - home) & mask) >= ((bucket - hole) & mask)) {
+        index_[hole] = index_[bucket];
+        index_[bucket].slot = kNone;
+        hole = bucket;
+      }
+    }
+  }
+
+  // Writes |count| dirty entries holding contiguous records, sorted by offset,
+  // to storage with a single write. Returns an error status on failure.
+  ASYLO_MUST_USE_RESULT Status CommitRun(const size_t *slots, size_t count) {
+    if (count == 1) {
+      return Commit(slots[0]);
+    }
+    buffer_.resize(count * sizeof(T));
+    for (size_t i = 0; i < count; i++) {
+      memcpy(&buffer_[i * sizeof(T)], &slab_[slots[i]].value, sizeof(T));
+    }
+    ASYLO_RETURN_IF_ERROR(
+        io_->Write(buffer_.data(), slab_[slots[0]].offset, buffer_.size()));
+    for (size_t i = 0; i < count; i++) {
+      slab_[slots[i]].dirty = false;
+    }
     return absl::OkStatus();
   }
 
-  // Evicts an entry from the cache and moves the evicted cache node to the
-  // front of the LRU list. Returns an error status on failure.
-  ASYLO_MUST_USE_RESULT Status Evict() {
-    auto last = std::prev(cache_.end());
-    ASYLO_RETURN_IF_ERROR(Commit(last));
-    index_.erase(last->offset);
-    MoveToFront(last);
+  // Writes a cache entry to storage, returning an error status on failure.
+  ASYLO_MUST_USE_RESULT Status Commit(size_t slot) {
+    CacheEntry &entry = slab_[slot];
+    ASYLO_RETURN_IF_ERROR(io_->Write(&entry.value, entry.offset, sizeof(T)));
+    entry.dirty = false;
     return absl::OkStatus();
   }
 
+  // Returns a slot linked at the front of the LRU list for a record not yet in
+  // the cache. If the cache is full, the least-recently-used record is evicted,
+  // which the caller must first have committed if it was dirty.
+  size_t Allocate() {
+    size_t slot = free_;
+    if (slot != kNone) {
+      free_ = slab_[slot].next;
+    } else {
+      slot = tail_;
+      Erase(slab_[slot].offset);
+      Unlink(slot);
+    }
+    LinkFront(slot);
+    return slot;
+  }
+
+  // Moves |slot|, obtained from Allocate() but not yet indexed, to the free
+  // list.
+  void Release(size_t slot) {
+    Unlink(slot);
+    slab_[slot].dirty = false;
+    slab_[slot].next = free_;
+    free_ = slot;
+  }
+
   // Moves an LRU list node to the front of the list.
-  void MoveToFront(ConstNodeRef node) {
-    if (node != cache_.begin()) {
-      // Splice node onto the front of the list. Note that splice does not
-      // invalidate existing iterators into cache_.
-      cache_.splice(cache_.begin(), cache_, node);
+  void MoveToFront(size_t slot) {
+    if (slot != head_) {
+      Unlink(slot);
+      LinkFront(slot);
+    }
+  }
+
+  void LinkFront(size_t slot) {
+    slab_[slot].prev = kNone;
+    slab_[slot].next = head_;
+    if (head_ != kNone) {
+      slab_[head_].prev = slot;
+    } else {
+      tail_ = slot;
+    }
+    head_ = slot;
+  }
+
+  void Unlink(size_t slot) {
+    const CacheEntry &entry = slab_[slot];
+    if (entry.prev != kNone) {
+      slab_[entry.prev].next = entry.next;
+    } else {
+      head_ = entry.next;
+    }
+    if (entry.next != kNone) {
+      slab_[entry.next].prev = entry.prev;
+    } else {
+      tail_ = entry.prev;
     }
   }
 
   size_t capacity_;  // Size of the cache in items of type T.
 
-  // Number of items present in the cache. Although std::list::size() is
-  // required to have constant time complexity since C++11, not all library
-  // implementions conform to this requirement. In particular, libstdc++
-  // versions <= 4.8 implement size() as std::distance(head, tail).
-  size_t count_;
+  size_t head_;  // Most recently used slot, or kNone if the cache is empty.
+  size_t tail_;  // Least recently used slot, or kNone if the cache is empty.
+  size_t free_;  // First slot never used or released, or kNone.
 
   RandomAccessStorage *io_;  // Record backing store.
 
-  // Entries in the cache, maintained in LRU order. This implementation does not
-  // preallocate the cache at the time it is created, opting instead to allocate
-  // entries and add them to a list lazily as they are referenced. This enables
-  // overcommitment of heap capacity at the cost of greater overhead incurred
-  // by the default allocator.
-  std::list<CacheEntry> cache_;
+  // Entries in the cache, allocated as one contiguous slab when the store is
+  // created and linked into an intrusive list in LRU order. Unused slots are
+  // chained through |next| into a free list.
+  std::vector<CacheEntry> slab_;
 
-  absl::flat_hash_map<off_t, ConstNodeRef> index_;  // Index by record offset.
+  // Open-addressed index of slots by record offset, using linear probing.
+  std::vector<IndexEntry> index_;
+
+  // Staging buffer for coalesced writes in Flush().
+  std::vector<uint8_t> buffer_;
 };
 
+template <typename T>
+constexpr size_t RecordStore<T>::kNone;
+
 }  // namespace asylo
 
 #endif  // ASYLO_PLATFORM_STORAGE_UTILS_RECORD_STORE_H_
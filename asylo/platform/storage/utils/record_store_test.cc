@@ -16,13 +16,22 @@
  *
  */
 
+#include "asylo/platform/storage/utils/record_store.h"
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <random>
+#include <vector>
 
+#include <benchmark/benchmark.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "absl/container/flat_hash_map.h"
 #include "asylo/platform/storage/utils/fd_closer.h"
-#include "asylo/platform/storage/utils/record_store.h"
 #include "asylo/platform/storage/utils/test_utils.h"
 #include "asylo/platform/storage/utils/untrusted_file.h"
 #include "asylo/test/util/status_matchers.h"
@@ -119,5 +128,246 @@ TEST(RecordStoreTest, Flush) {
   }
 }
 
+// Ensure that a failed read does not leave a record in the cache.
+TEST(RecordStoreTest, ReadFailure) {
+  MemoryStorage storage;
+  constexpr size_t kCapacity = 4;
+  RecordStore<size_t> records(kCapacity, &storage);
+
+  size_t record;
+  EXPECT_THAT(records.Read(0, &record), StatusIs(error::NOT_FOUND));
+  EXPECT_FALSE(records.IsCached(0));
+
+  // The slot used by the failed read is reused, and the cache still holds
+  // |kCapacity| records.
+  for (size_t i = 0; i <= kCapacity; i++) {
+    ASYLO_EXPECT_OK(records.Write(i * sizeof(size_t), i));
+  }
+  EXPECT_FALSE(records.IsCached(0));
+  for (size_t i = 1; i <= kCapacity; i++) {
+    EXPECT_TRUE(records.IsCached(i * sizeof(size_t)));
+  }
+}
+
+// Ensure that Flush() writes records adjacent in storage with a single write.
+TEST(RecordStoreTest, FlushCoalescesAdjacentRecords) {
+  MemoryStorage storage;
+  constexpr size_t kCapacity = 64;
+  RecordStore<size_t> records(kCapacity, &storage);
+
+  // Three runs of records, written out of order.
+  std::vector<size_t> indices;
+  for (size_t i = 16; i > 0; i--) {
+    indices.push_back(i - 1);
+  }
+  indices.insert(indices.end(), {40, 21, 20, 23, 22});
+  for (size_t i : indices) {
+    ASYLO_EXPECT_OK(records.Write(i * sizeof(size_t), i));
+  }
+  ASYLO_ASSERT_OK(records.Flush());
+  EXPECT_EQ(storage.write_log().size(), 3);
+
+  for (size_t i : indices) {
+    size_t record;
+    ASYLO_EXPECT_OK(storage.Read(&record, i * sizeof(size_t), sizeof(size_t)));
+    EXPECT_EQ(record, i);
+  }
+
+  // Clean records are not written again.
+  ASYLO_ASSERT_OK(records.Flush());
+  EXPECT_EQ(storage.write_log().size(), 3);
+}
+
+// Ensure that the cache returns the last value written to each record under a
+// random access pattern that causes many evictions.
+TEST(RecordStoreTest, RandomAccess) {
+  MemoryStorage storage;
+  constexpr size_t kCapacity = 37;
+  constexpr size_t kRecordCount = 512;
+  std::vector<size_t> expected(kRecordCount);
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<size_t> distribution(0, kRecordCount - 1);
+
+  {
+    RecordStore<size_t> records(kCapacity, &storage);
+    for (size_t i = 0; i < kRecordCount; i++) {
+      ASYLO_ASSERT_OK(records.Write(i * sizeof(size_t), i));
+      expected[i] = i;
+    }
+    for (size_t i = 0; i < 20 * kRecordCount; i++) {
+      size_t index = distribution(generator);
+      off_t offset = index * sizeof(size_t);
+      if (i % 3 == 0) {
+        expected[index] = i;
+        ASYLO_ASSERT_OK(records.Write(offset, i));
+      } else {
+        size_t record;
+        ASYLO_ASSERT_OK(records.Read(offset, &record));
+        EXPECT_EQ(record, expected[index]);
+      }
+      EXPECT_TRUE(records.IsCached(offset));
+    }
+  }
+
+  for (size_t i = 0; i < kRecordCount; i++) {
+    size_t record;
+    ASYLO_EXPECT_OK(storage.Read(&record, i * sizeof(size_t), sizeof(size_t)));
+    EXPECT_EQ(record, expected[i]);
+  }
+}
+
+// A record store caching records in a std::list indexed by a hash map, as the
+// RecordStore did before it was backed by a slab. Kept as a baseline for the
+// benchmarks below.
+template <typename T>
+class ListRecordStore {
+ public:
+  ListRecordStore(size_t capacity, RandomAccessStorage *io)
+      : capacity_(capacity), io_(io) {}
+
+  Status Flush() {
+    for (CacheEntry &entry : cache_) {
+      ASYLO_RETURN_IF_ERROR(io_->Write(&entry.value, entry.offset, sizeof(T)));
+      entry.dirty = false;
+    }
+    return io_->Sync();
+  }
+
+  Status Read(off_t offset, T *item) {
+    if (!MoveToFront(offset)) {
+      ASYLO_RETURN_IF_ERROR(Allocate(offset));
+      ASYLO_RETURN_IF_ERROR(
+          io_->Read(&cache_.front().value, offset, sizeof(T)));
+      cache_.front().dirty = false;
+    }
+    *item = cache_.front().value;
+    return absl::OkStatus();
+  }
+
+  Status Write(off_t offset, const T &item) {
+    if (!MoveToFront(offset)) {
+      ASYLO_RETURN_IF_ERROR(Allocate(offset));
+    }
+    cache_.front().value = item;
+    cache_.front().dirty = true;
+    return absl::OkStatus();
+  }
+
+ private:
+  struct CacheEntry {
+    off_t offset;
+    T value;
+    bool dirty;
+  };
+
+  // Moves the entry for |offset| to the front of the list if it is cached.
+  bool MoveToFront(off_t offset) {
+    auto it = index_.find(offset);
+    if (it == index_.end()) {
+      return false;
+    }
+    cache_.splice(cache_.begin(), cache_, it->second);
+    return true;
+  }
+
+  // Adds an entry for |offset| at the front of the list, evicting the last
+  // entry if the cache is full.
+  Status Allocate(off_t offset) {
+    if (index_.size() < capacity_) {
+      cache_.emplace_front();
+    } else {
+      auto last = std::prev(cache_.end());
+      ASYLO_RETURN_IF_ERROR(io_->Write(&last->value, last->offset, sizeof(T)));
+      index_.erase(last->offset);
+      cache_.splice(cache_.begin(), cache_, last);
+    }
+    cache_.front().offset = offset;
+    index_[offset] = cache_.begin();
+    return absl::OkStatus();
+  }
+
+  size_t capacity_;
+  RandomAccessStorage *io_;
+  std::list<CacheEntry> cache_;
+  absl::flat_hash_map<off_t, typename std::list<CacheEntry>::iterator> index_;
+};
+
+// Benchmarks comparing RecordStore with ListRecordStore, for 64-byte records
+// cached in a store of 4096 records.
+using BenchmarkRecord = std::array<uint64_t, 8>;
+constexpr size_t kBenchmarkCapacity = 4096;
+
+// Returns the offsets of |count| records in a fixed pseudo-random order.
+std::vector<off_t> ShuffledOffsets(size_t count) {
+  std::vector<off_t> offsets(count);
+  for (size_t i = 0; i < count; i++) {
+    offsets[i] = i * sizeof(BenchmarkRecord);
+  }
+  std::shuffle(offsets.begin(), offsets.end(), std::mt19937(1));
+  return offsets;
+}
+
+// Reads records from a working set of |state.range(0)| times the capacity of
+// the store, so all reads hit the cache for 1 and all reads miss for 4.
+template <typename Store>
+void BM_RecordStoreRead(benchmark::State &state) {
+  const size_t record_count = kBenchmarkCapacity * state.range(0);
+  MemoryStorage storage;
+  std::vector<uint8_t> zeros(record_count * sizeof(BenchmarkRecord));
+  if (!storage.Write(zeros.data(), 0, zeros.size()).ok()) {
+    state.SkipWithError("Could not initialize storage");
+    return;
+  }
+
+  std::vector<off_t> offsets = ShuffledOffsets(record_count);
+  Store store(kBenchmarkCapacity, &storage);
+  BenchmarkRecord record;
+  for (auto _ : state) {
+    for (off_t offset : offsets) {
+      if (!store.Read(offset, &record).ok()) {
+        state.SkipWithError("Could not read record");
+        return;
+      }
+      benchmark::DoNotOptimize(record);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * record_count);
+}
+
+BENCHMARK_TEMPLATE(BM_RecordStoreRead, RecordStore<BenchmarkRecord>)
+    ->Arg(1)
+    ->Arg(4);
+BENCHMARK_TEMPLATE(BM_RecordStoreRead, ListRecordStore<BenchmarkRecord>)
+    ->Arg(1)
+    ->Arg(4);
+
+// Fills the cache with dirty records and flushes them to a file.
+template <typename Store>
+void BM_RecordStoreFlush(benchmark::State &state) {
+  int fd = CreateEmptyTempFileOrDie("flush_benchmark.tmp");
+  platform::storage::FdCloser closer(fd);
+  UntrustedFile file(fd);
+  std::vector<off_t> offsets = ShuffledOffsets(kBenchmarkCapacity);
+  Store store(kBenchmarkCapacity, &file);
+  BenchmarkRecord record = {};
+  for (auto _ : state) {
+    for (off_t offset : offsets) {
+      record[0]++;
+      if (!store.Write(offset, record).ok()) {
+        state.SkipWithError("Could not write record");
+        return;
+      }
+    }
+    if (!store.Flush().ok()) {
+      state.SkipWithError("Could not flush records");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kBenchmarkCapacity);
+}
+
+BENCHMARK_TEMPLATE(BM_RecordStoreFlush, RecordStore<BenchmarkRecord>);
+BENCHMARK_TEMPLATE(BM_RecordStoreFlush, ListRecordStore<BenchmarkRecord>);
+
 }  // namespace
 }  // namespace asylo
@@ -16,6 +16,8 @@
  *
  */
 
+#include "asylo/platform/storage/utils/test_utils.h"
+
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -24,9 +26,11 @@
 
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "absl/flags/flag.h"
+#include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "asylo/util/logging.h"
 #include "asylo/test/util/test_flags.h"
@@ -44,4 +48,73 @@ int CreateEmptyTempFileOrDie(absl::string_view basename) {
   return fd;
 }
 
+StatusOr<size_t> MemoryStorage::Size() const {
+  absl::MutexLock lock(&mu_);
+  return data_.size();
+}
+
+Status MemoryStorage::Read(void *buffer, off_t offset, size_t size) {
+  absl::MutexLock lock(&mu_);
+  read_count_++;
+  if (offset + size > data_.size()) {
+    return Status{error::NOT_FOUND, "Read past the end of storage"};
+  }
+  memcpy(buffer, &data_[offset], size);
+  return absl::OkStatus();
+}
+
+Status MemoryStorage::Write(const void *buffer, off_t offset, size_t size) {
+  if (gate_) {
+    gate_->WaitForNotification();
+  }
+  absl::MutexLock lock(&mu_);
+  if (writes_before_failure_ == 0) {
+    return Status{error::INTERNAL, "Injected write failure"};
+  }
+  writes_before_failure_--;
+  if (offset + size > data_.size()) {
+    data_.resize(offset + size);
+  }
+  memcpy(&data_[offset], buffer, size);
+  write_log_.push_back(offset);
+  return absl::OkStatus();
+}
+
+Status MemoryStorage::Sync() {
+  absl::MutexLock lock(&mu_);
+  durable_ = data_;
+  return absl::OkStatus();
+}
+
+Status MemoryStorage::Truncate(size_t size) {
+  absl::MutexLock lock(&mu_);
+  data_.resize(size);
+  return absl::OkStatus();
+}
+
+void MemoryStorage::FailWritesAfter(int count) {
+  absl::MutexLock lock(&mu_);
+  writes_before_failure_ = count;
+}
+
+std::vector<uint8_t> MemoryStorage::durable() const {
+  absl::MutexLock lock(&mu_);
+  return durable_;
+}
+
+std::vector<uint8_t> MemoryStorage::data() const {
+  absl::MutexLock lock(&mu_);
+  return data_;
+}
+
+std::vector<off_t> MemoryStorage::write_log() const {
+  absl::MutexLock lock(&mu_);
+  return write_log_;
+}
+
+int MemoryStorage::read_count() const {
+  absl::MutexLock lock(&mu_);
+  return read_count_;
+}
+
 }  // namespace asylo
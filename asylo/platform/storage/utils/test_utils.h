@@ -19,7 +19,19 @@
 #ifndef ASYLO_PLATFORM_STORAGE_UTILS_TEST_UTILS_H_
 #define ASYLO_PLATFORM_STORAGE_UTILS_TEST_UTILS_H_
 
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "asylo/platform/storage/utils/random_access_storage.h"
+#include "asylo/util/status.h"
+#include "asylo/util/statusor.h"
 
 // Common utility functions shared across multiple storage tests.
 namespace asylo {
@@ -27,6 +39,43 @@ namespace asylo {
 // Creates and opens an empty temporary file, returning a file descriptor.
 int CreateEmptyTempFileOrDie(absl::string_view basename);
 
+// A RandomAccessStorage held in memory, which models losing every write since
+// the last call to Sync() if execution stops. It logs the offsets of writes in
+// the order they are applied, can be made to fail writes, and can be made to
+// block writes until released.
+class MemoryStorage : public RandomAccessStorage {
+ public:
+  StatusOr<size_t> Size() const override;
+  Status Read(void *buffer, off_t offset, size_t size) override;
+  Status Write(const void *buffer, off_t offset, size_t size) override;
+  Status Sync() override;
+  Status Truncate(size_t size) override;
+
+  // Blocks writes until |gate| is notified.
+  void set_gate(absl::Notification *gate) { gate_ = gate; }
+
+  // Fails every write after the next |count| writes.
+  void FailWritesAfter(int count);
+
+  // Returns the contents that would remain if execution stopped now.
+  std::vector<uint8_t> durable() const;
+
+  std::vector<uint8_t> data() const;
+
+  std::vector<off_t> write_log() const;
+
+  int read_count() const;
+
+ private:
+  mutable absl::Mutex mu_;
+  std::vector<uint8_t> data_ ABSL_GUARDED_BY(mu_);
+  std::vector<uint8_t> durable_ ABSL_GUARDED_BY(mu_);
+  std::vector<off_t> write_log_ ABSL_GUARDED_BY(mu_);
+  int read_count_ ABSL_GUARDED_BY(mu_) = 0;
+  int writes_before_failure_ ABSL_GUARDED_BY(mu_) = -1;
+  absl::Notification *gate_ = nullptr;
+};
+
 }  // namespace asylo
 
 #endif  // ASYLO_PLATFORM_STORAGE_UTILS_TEST_UTILS_H_
@@ -27,6 +27,7 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "asylo/platform/system_call/syscalls.inc"
 
 // This file implements a code generation tool built with a native Linux
@@ -37,6 +38,10 @@
 // generated tables to obtain access to a description of the system interface on
 // the host. This data may then be used to drive automated serialization of
 // system calls across the enclave boundary.
+//
+// When passed the --serializers flag, the generator instead emits a serializer
+// specialized for each system call, which encodes the same messages as the
+// table driven MessageWriter with the parameter layout resolved at build time.
 
 // An entry in a table of system call descriptions.
 struct SystemCallDescription {
@@ -65,6 +70,9 @@ struct ParameterDescription {
 // Flag describing a parameter passing convention.
 enum ConventionFlag { kIn = 1, kOut = 2 };
 
+// Maximum number of parameters expected by a system call.
+constexpr size_t kParameterMax = 6;
+
 // Returns a table mapping a {system call, parameter} pair to a bounding
 // parameter position (relative to the first parameter of the system call).
 absl::flat_hash_map<std::pair<std::string, std::string>, int> *BoundsTable() {
@@ -339,7 +347,206 @@ void EmitParameterTable(std::ostream *os) {
   *os << "};\n";
 }
 
+// Returns true if the flags of a parameter description include |flag|.
+bool HasFlag(const ParameterDescription &desc, absl::string_view flag) {
+  for (absl::string_view value : absl::StrSplit(desc.flags, " | ")) {
+    if (value == flag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the descriptions of the parameters of a system call.
+std::vector<ParameterDescription> Parameters(
+    const SystemCallDescription &syscall) {
+  std::vector<ParameterDescription> parameters;
+  for (int i = 0; i < syscall.parameter_count; i++) {
+    parameters.push_back((*ParameterTable())[syscall.parameter_index + i]);
+  }
+  return parameters;
+}
+
+// Returns the index of the parameter bounding a buffer parameter, exiting with
+// an error if it does not designate a parameter of the system call.
+size_t BoundingIndex(const ParameterDescription &desc) {
+  if (desc.size >= kParameterMax) {
+    std::cerr << absl::StreamFormat(
+                     "Error: Parameter \"%s\" of system call \"%s\" has no "
+                     "valid bounding parameter.",
+                     desc.name, desc.syscall)
+              << std::endl;
+    exit(1);
+  }
+  return desc.size;
+}
+
+// Emits a function serializing a request or a response for a system call, with
+// the same encoding as MessageWriter. The offset of each parameter is a
+// constant expression up to the first parameter whose encoding size depends on
+// the parameter values.
+void EmitSerializer(int sysno, const SystemCallDescription &syscall,
+                    bool is_request, std::ostream *os) {
+  const char *kind = is_request ? "Request" : "Response";
+  *os << absl::StreamFormat("primitives::PrimitiveStatus Serialize%s_%s(",
+                            kind, syscall.name);
+  if (is_request) {
+    *os << "\n    const ParameterList &parameters, "
+           "primitives::Extent *message) {\n";
+  } else {
+    *os << "\n    uint64_t result, uint64_t error_number, "
+           "const ParameterList &parameters,\n    primitives::Extent *message) "
+           "{\n";
+  }
+
+  std::vector<std::string> writes;
+  std::string offset = "sizeof(MessageHeader)";
+  bool constant_offset = true;
+  for (const ParameterDescription &desc : Parameters(syscall)) {
+    int i = desc.index - syscall.parameter_index;
+    if (!HasFlag(desc, is_request ? "kIn" : "kOut")) {
+      continue;
+    }
+
+    // Mirror MessageWriter::ParameterSize(): scalars are always encoded using
+    // 64 bits, and null pointers are encoded as zero size fields.
+    std::string size;
+    bool constant_size = false;
+    if (HasFlag(desc, "kScalar")) {
+      size = "sizeof(uint64_t)";
+      constant_size = true;
+    } else if (HasFlag(desc, "kFixed")) {
+      size = absl::StrFormat("FixedSize(parameters[%i], %llu)", i, desc.size);
+    } else if (HasFlag(desc, "kString")) {
+      size = absl::StrFormat("StringSize(parameters[%i])", i);
+    } else if (HasFlag(desc, "kBounded")) {
+      size = absl::StrFormat(
+          "BoundedSize(parameters[%i], parameters[%i], %llu)", i,
+          BoundingIndex(desc), desc.element_size);
+    } else {
+      std::cerr << absl::StreamFormat(
+                       "Error: Parameter \"%s\" of system call \"%s\" has "
+                       "no serializable encoding.",
+                       desc.name, desc.syscall)
+                << std::endl;
+      exit(1);
+    }
+
+    *os << absl::StreamFormat("  %s offset%i = %s;\n",
+                              constant_offset ? "constexpr size_t"
+                                              : "const size_t",
+                              i, offset);
+    *os << absl::StreamFormat("  %s size%i = %s;\n",
+                              constant_size ? "constexpr size_t"
+                                            : "const size_t",
+                              i, size);
+    constant_offset = constant_offset && constant_size;
+    offset = absl::StrFormat("offset%i + RoundUpToMultipleOf8(size%i)", i, i);
+
+    writes.push_back(absl::StrFormat(
+        HasFlag(desc, "kPointer")
+            ? "  WritePointer(header, %i, offset%i, size%i, parameters[%i]);\n"
+            : "  WriteScalar(header, %i, offset%i, size%i, parameters[%i]);\n",
+        i, i, i, i));
+  }
+
+  *os << absl::StreamFormat("  %s size = %s;\n",
+                            constant_offset ? "constexpr size_t"
+                                            : "const size_t",
+                            offset);
+  *os << absl::StreamFormat(
+      "  MessageHeader *header =\n"
+      "      AllocateMessage(size, %s, %i, %s, message);\n",
+      is_request ? "kSystemCallRequest" : "kSystemCallResponse", sysno,
+      is_request ? "0, 0" : "result, error_number");
+  *os << "  if (!header) {\n"
+         "    return AllocationFailure();\n"
+         "  }\n";
+  for (const std::string &write : writes) {
+    *os << write;
+  }
+  *os << "  return primitives::PrimitiveStatus::OkStatus();\n";
+  *os << "}\n\n";
+}
+
+// Emits a function copying the output parameters of a system call response
+// into the buffers passed to the system call, or returns false if the system
+// call has no output parameters.
+bool EmitOutputCopier(const SystemCallDescription &syscall, std::ostream *os) {
+  std::vector<std::string> copies;
+  for (const ParameterDescription &desc : Parameters(syscall)) {
+    int i = desc.index - syscall.parameter_index;
+    if (!HasFlag(desc, "kOut")) {
+      continue;
+    }
+    // Fixed size parameters are copied in full, and all other output
+    // parameters are sized by their bounding parameter.
+    std::string size =
+        HasFlag(desc, "kFixed")
+            ? absl::StrFormat("%llu", desc.size)
+            : absl::StrFormat("parameters[%i] * %llu", BoundingIndex(desc),
+                              desc.element_size);
+    copies.push_back(absl::StrFormat(
+        "  CopyOutput(response, %i, %s, parameters[%i]);\n", i, size, i));
+  }
+  if (copies.empty()) {
+    return false;
+  }
+
+  *os << absl::StreamFormat(
+      "void CopyOutputs_%s(const MessageReader &response,\n"
+      "    const ParameterList &parameters) {\n",
+      syscall.name);
+  for (const std::string &copy : copies) {
+    *os << copy;
+  }
+  *os << "}\n\n";
+  return true;
+}
+
+// Emits the specialized serializers for each system call, followed by a table
+// of serializers indexed by system call number.
+void EmitSerializers(std::ostream *os) {
+  if (SystemCallTable()->empty()) {
+    std::cerr << "Expected at least one system call to be defined."
+              << std::endl;
+    abort();
+  }
+
+  std::map<int, bool> has_outputs;
+  for (const auto &entry : *SystemCallTable()) {
+    const SystemCallDescription &syscall = entry.second;
+    *os << absl::StreamFormat("// %s\n", syscall.name);
+    EmitSerializer(entry.first, syscall, /*is_request=*/true, os);
+    EmitSerializer(entry.first, syscall, /*is_request=*/false, os);
+    has_outputs[entry.first] = EmitOutputCopier(syscall, os);
+  }
+
+  int last = SystemCallTable()->rbegin()->first;
+  *os << "const size_t kSystemCallSerializersSize = " << last + 1 << ";\n";
+  *os << "\n";
+  *os << "const SystemCallSerializers kSystemCallSerializers[] = {\n";
+  for (int i = 0; i <= last; i++) {
+    auto it = SystemCallTable()->find(i);
+    if (it == SystemCallTable()->end()) {
+      *os << absl::StreamFormat("  /* %i */ {nullptr, nullptr, nullptr},\n", i);
+      continue;
+    }
+    const std::string &name = it->second.name;
+    *os << absl::StreamFormat(
+        "  /* %i */ {SerializeRequest_%s, SerializeResponse_%s, %s},\n", i,
+        name, name,
+        has_outputs[i] ? absl::StrCat("CopyOutputs_", name) : "nullptr");
+  }
+  *os << "};\n";
+}
+
 int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "--serializers") {
+    EmitSerializers(&std::cout);
+    return 0;
+  }
+
   EmitSystemCallTable(&std::cout);
   std::cout << std::endl;
   EmitParameterTable(&std::cout);
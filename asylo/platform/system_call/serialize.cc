@@ -18,69 +18,156 @@
 
 #include "asylo/platform/system_call/serialize.h"
 
-#include <algorithm>
 #include <cstddef>
-#include <numeric>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "asylo/platform/primitives/primitive_status.h"
 #include "asylo/platform/system_call/message.h"
-#include "asylo/platform/system_call/metadata.h"
 
 namespace asylo {
 namespace system_call {
 namespace {
 
-// Returns the sum of the values in a collection.
-template <typename T>
-typename T::value_type Sum(const T &values) {
-  return std::accumulate(values.begin(), values.end(),
-                         static_cast<typename T::value_type>(0));
+// Helpers used by the generated serializers. Each serializer produces exactly
+// the message MessageWriter would build for the same parameters, with the
+// parameter layout of its system call resolved when the serializers are
+// generated.
+
+// Returns the smallest multiple of 8 greater than or equal to |value|.
+constexpr size_t RoundUpToMultipleOf8(size_t value) {
+  return (value + 7) & ~static_cast<size_t>(7);
+}
+
+// Returns the encoding size of a pointer to a fixed size value.
+size_t FixedSize(uint64_t value, size_t size) { return value ? size : 0; }
+
+// Returns the encoding size of a pointer to a null-terminated string.
+size_t StringSize(uint64_t value) {
+  return value ? strlen(reinterpret_cast<const char *>(value)) + 1 : 0;
+}
+
+// Returns the encoding size of a pointer to a buffer of |bound| elements.
+size_t BoundedSize(uint64_t value, uint64_t bound, size_t element_size) {
+  return value ? bound * element_size : 0;
+}
+
+// Allocates a message of |size| bytes with malloc and initializes its header,
+// returning nullptr on allocation failure.
+MessageHeader *AllocateMessage(size_t size, uint32_t flags, int sysno,
+                               uint64_t result, uint64_t error_number,
+                               primitives::Extent *message) {
+  auto *header = static_cast<MessageHeader *>(malloc(size));
+  if (!header) {
+    return nullptr;
+  }
+  memset(header, 0, sizeof(MessageHeader));
+  header->magic = kMessageMagic;
+  header->flags = flags;
+  header->sysno = sysno;
+  header->result = result;
+  header->error_number = error_number;
+  *message = {reinterpret_cast<uint8_t *>(header), size};
+  return header;
 }
+
+primitives::PrimitiveStatus AllocationFailure() {
+  return primitives::PrimitiveStatus{
+      primitives::AbslStatusCode::kResourceExhausted,
+      "Could not allocate a system call message"};
+}
+
+// Writes a scalar parameter, which is encoded using 64 bits.
+void WriteScalar(MessageHeader *header, int index, size_t offset, size_t size,
+                 uint64_t value) {
+  *reinterpret_cast<uint64_t *>(reinterpret_cast<uint8_t *>(header) + offset) =
+      value;
+  header->offset[index] = offset;
+  header->size[index] = size;
+}
+
+// Writes the |size| bytes designated by a pointer parameter. Null pointers are
+// encoded as having a size of zero.
+void WritePointer(MessageHeader *header, int index, size_t offset, size_t size,
+                  uint64_t value) {
+  if (void *src = reinterpret_cast<void *>(value)) {
+    memcpy(reinterpret_cast<uint8_t *>(header) + offset, src, size);
+  }
+  header->offset[index] = offset;
+  header->size[index] = size;
+}
+
+// Copies |size| bytes of an output parameter into the buffer designated by
+// |value|, unless that buffer is null.
+void CopyOutput(const MessageReader &response, int index, size_t size,
+                uint64_t value) {
+  if (void *dst = reinterpret_cast<void *>(value)) {
+    memcpy(dst, response.parameter_address(index), size);
+  }
+}
+
+struct SystemCallSerializers {
+  primitives::PrimitiveStatus (*serialize_request)(
+      const ParameterList &parameters, primitives::Extent *message);
+  primitives::PrimitiveStatus (*serialize_response)(
+      uint64_t result, uint64_t error_number, const ParameterList &parameters,
+      primitives::Extent *message);
+  void (*copy_outputs)(const MessageReader &response,
+                       const ParameterList &parameters);
+};
+
+// Include the serializers generated at build time.
+#include "asylo/platform/system_call/generated_serializers.inc"
+
+// Returns the serializers for a system call, or nullptr if |sysno| is invalid.
+const SystemCallSerializers *FindSerializers(int sysno) {
+  if (sysno < 0 || sysno >= kSystemCallSerializersSize ||
+      !kSystemCallSerializers[sysno].serialize_request) {
+    return nullptr;
+  }
+  return &kSystemCallSerializers[sysno];
+}
+
+primitives::PrimitiveStatus InvalidSysno(int sysno) {
+  return primitives::PrimitiveStatus{
+      primitives::AbslStatusCode::kInvalidArgument,
+      absl::StrCat("Could not infer system call descriptor from the sysno (",
+                   sysno, ") provided.")};
+}
+
 }  // namespace
 
 primitives::PrimitiveStatus SerializeRequest(
     int sysno, const std::array<uint64_t, kParameterMax> &parameters,
     primitives::Extent *request) {
-  SystemCallDescriptor descriptor{sysno};
-  if (!descriptor.is_valid()) {
-    return primitives::PrimitiveStatus{
-        primitives::AbslStatusCode::kInvalidArgument,
-        absl::StrCat("Could not infer system call descriptor from the sysno (",
-                     sysno, ") provided.")};
+  const SystemCallSerializers *serializers = FindSerializers(sysno);
+  if (!serializers) {
+    return InvalidSysno(sysno);
   }
-
-  auto writer = MessageWriter::RequestWriter(sysno, parameters);
-  size_t size = writer.MessageSize();
-
-  *request = {reinterpret_cast<uint8_t *>(malloc(size)), size};
-
-  writer.Write(request);
-  return primitives::PrimitiveStatus::OkStatus();
+  return serializers->serialize_request(parameters, request);
 }
 
 primitives::PrimitiveStatus SerializeResponse(
     int sysno, uint64_t result, uint64_t error_number,
     const std::array<uint64_t, kParameterMax> &parameters,
     primitives::Extent *response) {
-  SystemCallDescriptor descriptor{sysno};
-
-  if (!descriptor.is_valid()) {
-    return primitives::PrimitiveStatus{
-        primitives::AbslStatusCode::kInvalidArgument,
-        absl::StrCat("Could not infer system call descriptor from the sysno (",
-                     sysno, ") provided.")};
+  const SystemCallSerializers *serializers = FindSerializers(sysno);
+  if (!serializers) {
+    return InvalidSysno(sysno);
   }
+  return serializers->serialize_response(result, error_number, parameters,
+                                         response);
+}
 
-  auto writer =
-      MessageWriter::ResponseWriter(sysno, result, error_number, parameters);
-  size_t size = writer.MessageSize();
-
-  *response = {reinterpret_cast<uint8_t *>(malloc(size)), size};
-
-  writer.Write(response);
-  return primitives::PrimitiveStatus::OkStatus();
+void CopyResponseOutputs(const MessageReader &response,
+                         const ParameterList &parameters) {
+  const SystemCallSerializers *serializers = FindSerializers(response.sysno());
+  if (serializers && serializers->copy_outputs) {
+    serializers->copy_outputs(response, parameters);
+  }
 }
 
 }  // namespace system_call
@@ -46,6 +46,13 @@ primitives::PrimitiveStatus SerializeResponse(int sysno, uint64_t result,
                                               const ParameterList &parameters,
                                               primitives::Extent *response);
 
+// Copies the output parameters encoded by a system call response into the
+// buffers designated by `parameters`, the parameter list the request was
+// serialized from. `response` must have been checked by
+// MessageReader::Validate().
+void CopyResponseOutputs(const MessageReader &response,
+                         const ParameterList &parameters);
+
 }  // namespace system_call
 }  // namespace asylo
 
@@ -18,10 +18,18 @@
 
 #include "asylo/platform/system_call/serialize.h"
 
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "absl/strings/str_cat.h"
 #include "asylo/platform/primitives/primitive_status.h"
+#include "asylo/platform/system_call/message.h"
+#include "asylo/platform/system_call/metadata.h"
+#include "asylo/platform/system_call/sysno.h"
 
 namespace asylo {
 namespace system_call {
@@ -58,6 +66,121 @@ TEST(SerializeTest, SerializeResponseInvalidSysnoTest) {
                   10000, ") provided.")));
 }
 
+// Size of the buffer every pointer parameter designates in the tests below.
+constexpr size_t kBufferSize = 4096;
+
+// Value of every scalar parameter in the tests below, which also bounds buffer
+// parameters.
+constexpr uint64_t kScalarValue = 8;
+
+// Returns a parameter list for |sysno| where each pointer parameter designates
+// |buffer|, a null-terminated string of kBufferSize bytes.
+ParameterList MakeParameters(int sysno, std::vector<char> *buffer) {
+  buffer->assign(kBufferSize, 'x');
+  buffer->back() = '\0';
+  SystemCallDescriptor descriptor(sysno);
+  ParameterList parameters{};
+  for (int i = 0; i < descriptor.parameter_count(); i++) {
+    parameters[i] = descriptor.parameter(i).is_pointer()
+                        ? reinterpret_cast<uint64_t>(buffer->data())
+                        : kScalarValue;
+  }
+  return parameters;
+}
+
+// Checks that a message serialized by SerializeRequest() or SerializeResponse()
+// encodes the same header fields and parameters as |expected|, built by
+// MessageWriter.
+void ExpectSameMessage(primitives::Extent actual, primitives::Extent expected) {
+  ASSERT_THAT(actual.size(), Eq(expected.size()));
+  MessageReader actual_reader(actual);
+  MessageReader expected_reader(expected);
+  ASSERT_TRUE(actual_reader.Validate().ok());
+  EXPECT_THAT(actual_reader.header()->magic,
+              Eq(expected_reader.header()->magic));
+  EXPECT_THAT(actual_reader.header()->flags,
+              Eq(expected_reader.header()->flags));
+  EXPECT_THAT(actual_reader.sysno(), Eq(expected_reader.sysno()));
+  if (expected_reader.is_response()) {
+    EXPECT_THAT(actual_reader.result(), Eq(expected_reader.result()));
+    EXPECT_THAT(actual_reader.error_number(),
+                Eq(expected_reader.error_number()));
+  }
+  for (int i = 0; i < kParameterMax; i++) {
+    ASSERT_THAT(actual_reader.parameter_is_used(i),
+                Eq(expected_reader.parameter_is_used(i)));
+    if (!actual_reader.parameter_is_used(i)) {
+      continue;
+    }
+    EXPECT_THAT(actual_reader.header()->offset[i],
+                Eq(expected_reader.header()->offset[i]));
+    ASSERT_THAT(actual_reader.parameter_size(i),
+                Eq(expected_reader.parameter_size(i)));
+    EXPECT_THAT(memcmp(actual_reader.parameter_address(i),
+                       expected_reader.parameter_address(i),
+                       actual_reader.parameter_size(i)),
+                Eq(0));
+  }
+}
+
+// Checks that the generated serializer of every system call builds the same
+// messages as MessageWriter.
+TEST(SerializeTest, MatchesMessageWriter) {
+  for (int sysno = 0; sysno <= LastSystemCall(); sysno++) {
+    if (!SystemCallDescriptor(sysno).is_valid()) {
+      continue;
+    }
+    SCOPED_TRACE(absl::StrCat("sysno ", sysno));
+    std::vector<char> buffer;
+    ParameterList parameters = MakeParameters(sysno, &buffer);
+
+    MessageWriter request_writer =
+        MessageWriter::RequestWriter(sysno, parameters);
+    std::vector<uint8_t> expected_request(request_writer.MessageSize());
+    primitives::Extent expected{expected_request.data(),
+                                expected_request.size()};
+    request_writer.Write(&expected);
+    primitives::Extent request;
+    ASSERT_TRUE(SerializeRequest(sysno, parameters, &request).ok());
+    ExpectSameMessage(request, expected);
+    free(request.data());
+
+    MessageWriter response_writer =
+        MessageWriter::ResponseWriter(sysno, 3, 5, parameters);
+    std::vector<uint8_t> expected_response(response_writer.MessageSize());
+    expected = {expected_response.data(), expected_response.size()};
+    response_writer.Write(&expected);
+    primitives::Extent response;
+    ASSERT_TRUE(SerializeResponse(sysno, 3, 5, parameters, &response).ok());
+    ExpectSameMessage(response, expected);
+    free(response.data());
+  }
+}
+
+// Checks that the outputs of a response are copied into the buffers designated
+// by the parameters of the request, and that null buffers are skipped.
+TEST(SerializeTest, CopyResponseOutputs) {
+  int host_fds[2] = {3, 4};
+  ParameterList host_parameters{};
+  host_parameters[0] = reinterpret_cast<uint64_t>(host_fds);
+  primitives::Extent response;
+  ASSERT_TRUE(
+      SerializeResponse(kSYS_pipe, 0, 0, host_parameters, &response).ok());
+  MessageReader reader(response);
+  ASSERT_TRUE(reader.Validate().ok());
+
+  int fds[2] = {-1, -1};
+  ParameterList parameters{};
+  parameters[0] = reinterpret_cast<uint64_t>(fds);
+  CopyResponseOutputs(reader, parameters);
+  EXPECT_THAT(fds[0], Eq(3));
+  EXPECT_THAT(fds[1], Eq(4));
+
+  parameters[0] = 0;
+  CopyResponseOutputs(reader, parameters);
+  free(response.data());
+}
+
 }  // namespace
 }  // namespace system_call
 }  // namespace asylo
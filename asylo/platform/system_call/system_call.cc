@@ -20,10 +20,12 @@
 
 #include <errno.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdarg>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "asylo/platform/system_call/metadata.h"
 #include "asylo/platform/system_call/serialize.h"
@@ -41,20 +43,88 @@ struct MallocDeleter {
 void default_error_handler(const char *message) { abort(); }
 
 syscall_dispatch_callback global_syscall_callback = nullptr;
+syscall_batch_dispatch_callback global_syscall_batch_callback = nullptr;
 void (*error_handler)(const char *message) = nullptr;
 
+// Serializes a request for system call |sysno|, aborting on failure.
+asylo::primitives::Extent SerializeRequestOrDie(
+    int sysno, const asylo::system_call::ParameterList &parameters) {
+  asylo::primitives::Extent request;
+  asylo::primitives::PrimitiveStatus status =
+      asylo::system_call::SerializeRequest(sysno, parameters, &request);
+  if (!status.ok()) {
+    error_handler(
+        "system_call.cc: Encountered serialization error when serializing "
+        "syscall parameters.");
+  }
+  return request;
+}
+
+// Validates the response to a request for system call |sysno|, copies its
+// outputs back into the pointer parameters, and returns the system call result.
+// Stores the errno value reported by the host in |error_number|, or 0 if the
+// system call succeeded.
+int64_t ProcessResponseOrDie(
+    int sysno, const asylo::system_call::ParameterList &parameters,
+    uint8_t *response_buffer, size_t response_size, int *error_number) {
+  if (!response_buffer) {
+    error_handler(
+        "system_call.cc: null response buffer received for the syscall.");
+  }
+
+  // Copy outputs back into pointer parameters.
+  auto response_reader =
+      asylo::system_call::MessageReader({response_buffer, response_size});
+  if (response_reader.sysno() != sysno) {
+    error_handler("system_call.cc: Unexpected sysno in response");
+  }
+  const asylo::primitives::PrimitiveStatus response_status =
+      response_reader.Validate();
+  if (!response_status.ok()) {
+    error_handler(
+        "system_call.cc: Error deserializing response buffer into response "
+        "reader.");
+  }
+
+  asylo::system_call::CopyResponseOutputs(response_reader, parameters);
+
+  *error_number = 0;
+  uint64_t result = response_reader.header()->result;
+  if (static_cast<int64_t>(result) == -1) {
+    int klinux_errno = response_reader.header()->error_number;
+
+    // Simply having a return value of -1 from a syscall is not a necessary
+    // condition that the syscall failed. Some syscalls can return -1 when
+    // successful (eg., lseek). The reliable way to check for syscall failure is
+    // to therefore check both return value and presence of a non-zero errno.
+    if (klinux_errno != 0) {
+      *error_number = FromkLinuxErrno(klinux_errno);
+    }
+  }
+  return result;
+}
+
 }  // namespace
 
 extern "C" bool enc_is_syscall_dispatcher_set() {
   return global_syscall_callback != nullptr;
 }
 
+extern "C" bool enc_is_syscall_batch_dispatcher_set() {
+  return global_syscall_batch_callback != nullptr;
+}
+
 extern "C" bool enc_is_error_handler_set() { return error_handler != nullptr; }
 
 extern "C" void enc_set_dispatch_syscall(syscall_dispatch_callback callback) {
   global_syscall_callback = callback;
 }
 
+extern "C" void enc_set_dispatch_syscall_batch(
+    syscall_batch_dispatch_callback callback) {
+  global_syscall_batch_callback = callback;
+}
+
 extern "C" void enc_set_error_handler(
     void (*abort_handler)(const char *message)) {
   error_handler = abort_handler;
@@ -71,7 +141,7 @@ extern "C" int64_t enc_untrusted_syscall(int sysno, ...) {
   }
 
   // Collect the passed parameter list into an array.
-  std::array<uint64_t, asylo::system_call::kParameterMax> parameters;
+  asylo::system_call::ParameterList parameters;
   va_list args;
   va_start(args, sysno);
   for (int i = 0; i < descriptor.parameter_count(); i++) {
@@ -79,16 +149,23 @@ extern "C" int64_t enc_untrusted_syscall(int sysno, ...) {
   }
   va_end(args);
 
-  // Allocate a buffer for the serialized request.
-  asylo::primitives::Extent request;
-  asylo::primitives::PrimitiveStatus status;
-  status = asylo::system_call::SerializeRequest(sysno, parameters, &request);
-  if (!status.ok()) {
-    error_handler(
-        "system_call.cc: Encountered serialization error when serializing "
-        "syscall parameters.");
+  return enc_untrusted_syscall_array(sysno, parameters.data());
+}
+
+extern "C" int64_t enc_untrusted_syscall_array(int sysno,
+                                               const uint64_t *parameters) {
+  if (!enc_is_error_handler_set()) {
+    enc_set_error_handler(default_error_handler);
   }
 
+  asylo::system_call::ParameterList parameter_list;
+  std::copy(parameters, parameters + asylo::system_call::kParameterMax,
+            parameter_list.begin());
+
+  // Allocate a buffer for the serialized request. Serialization fails for
+  // invalid system call numbers.
+  asylo::primitives::Extent request =
+      SerializeRequestOrDie(sysno, parameter_list);
   std::unique_ptr<uint8_t, MallocDeleter> request_owner(request.As<uint8_t>());
 
   // Invoke the system call dispatch callback to execute the system call.
@@ -98,8 +175,9 @@ extern "C" int64_t enc_untrusted_syscall(int sysno, ...) {
   if (!enc_is_syscall_dispatcher_set()) {
     error_handler("system_.cc: system call dispatcher not set.");
   }
-  status = global_syscall_callback(request.As<uint8_t>(), request.size(),
-                                   &response_buffer, &response_size);
+  asylo::primitives::PrimitiveStatus status =
+      global_syscall_callback(request.As<uint8_t>(), request.size(),
+                              &response_buffer, &response_size);
   if (!status.ok()) {
     error_handler(
         "system_call.cc: Callback from syscall dispatcher was unsuccessful.");
@@ -107,53 +185,62 @@ extern "C" int64_t enc_untrusted_syscall(int sysno, ...) {
 
   std::unique_ptr<uint8_t, MallocDeleter> response_owner(response_buffer);
 
-  if (!response_buffer) {
-    error_handler(
-        "system_call.cc: null response buffer received for the syscall.");
+  int error_number;
+  int64_t result = ProcessResponseOrDie(sysno, parameter_list,
+                                        response_buffer, response_size,
+                                        &error_number);
+  if (error_number != 0) {
+    errno = error_number;
   }
+  return result;
+}
 
-  // Copy outputs back into pointer parameters.
-  auto response_reader =
-      asylo::system_call::MessageReader({response_buffer, response_size});
-  if (response_reader.sysno() != sysno) {
-    error_handler("system_call.cc: Unexpected sysno in response");
+extern "C" void enc_untrusted_syscall_batch(SystemCallBatchEntry *entries,
+                                            size_t count) {
+  if (!enc_is_error_handler_set()) {
+    enc_set_error_handler(default_error_handler);
   }
-  const asylo::primitives::PrimitiveStatus response_status =
-      response_reader.Validate();
-  if (!response_status.ok()) {
-    error_handler(
-        "system_call.cc: Error deserializing response buffer into response "
-        "reader.");
+  if (count == 0) {
+    return;
   }
 
-  for (int i = 0; i < asylo::system_call::kParameterMax; i++) {
-    asylo::system_call::ParameterDescriptor parameter = descriptor.parameter(i);
-    if (parameter.is_out()) {
-      size_t size;
-      if (parameter.is_fixed()) {
-        size = parameter.size();
-      } else {
-        size = parameters[parameter.size()] * parameter.element_size();
-      }
-      const void *src = response_reader.parameter_address(i);
-      void *dst = reinterpret_cast<void *>(parameters[i]);
-      if (dst != nullptr) {
-        memcpy(dst, src, size);
-      }
+  std::vector<asylo::system_call::ParameterList> parameters(count);
+  std::vector<asylo::primitives::Extent> requests;
+  std::vector<std::unique_ptr<uint8_t, MallocDeleter>> request_owners;
+  requests.reserve(count);
+  request_owners.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    for (int j = 0; j < asylo::system_call::kParameterMax; j++) {
+      parameters[i][j] = entries[i].parameters[j];
     }
+    requests.push_back(SerializeRequestOrDie(entries[i].sysno, parameters[i]));
+    request_owners.emplace_back(requests.back().As<uint8_t>());
   }
 
-  uint64_t result = response_reader.header()->result;
-  if (static_cast<int64_t>(result) == -1) {
-    int klinux_errno = response_reader.header()->error_number;
+  // Invoke the batch dispatch callback to execute all system calls at once.
+  std::vector<uint8_t *> response_buffers(count, nullptr);
+  std::vector<size_t> response_sizes(count, 0);
 
-    // Simply having a return value of -1 from a syscall is not a necessary
-    // condition that the syscall failed. Some syscalls can return -1 when
-    // successful (eg., lseek). The reliable way to check for syscall failure is
-    // to therefore check both return value and presence of a non-zero errno.
-    if (klinux_errno != 0) {
-      errno = FromkLinuxErrno(klinux_errno);
-    }
+  if (!enc_is_syscall_batch_dispatcher_set()) {
+    error_handler("system_call.cc: system call batch dispatcher not set.");
+  }
+  asylo::primitives::PrimitiveStatus status = global_syscall_batch_callback(
+      requests.data(), count, response_buffers.data(), response_sizes.data());
+  if (!status.ok()) {
+    error_handler(
+        "system_call.cc: Callback from syscall batch dispatcher was "
+        "unsuccessful.");
+  }
+
+  std::vector<std::unique_ptr<uint8_t, MallocDeleter>> response_owners;
+  response_owners.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    response_owners.emplace_back(response_buffers[i]);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    entries[i].result = ProcessResponseOrDie(
+        entries[i].sysno, parameters[i], response_buffers[i],
+        response_sizes[i], &entries[i].error_number);
   }
-  return result;
 }
@@ -22,7 +22,9 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "asylo/platform/primitives/extent.h"
 #include "asylo/platform/primitives/primitive_status.h"
+#include "asylo/platform/system_call/metadata.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,9 +39,36 @@ typedef asylo::primitives::PrimitiveStatus (*syscall_dispatch_callback)(
     const uint8_t *request_buffer, size_t request_size,
     uint8_t **response_buffer, size_t *response_size);
 
+// Callback type installed at runtime to dispatch a batch of system calls
+// across the enclave boundary at once. `requests` designates `count` system
+// call requests owned by the caller. On success, the i-th entries of
+// `response_buffers` and `response_sizes` are populated with the response to
+// the i-th request, allocated by malloc() on the trusted heap.
+typedef asylo::primitives::PrimitiveStatus (*syscall_batch_dispatch_callback)(
+    const asylo::primitives::Extent *requests, size_t count,
+    uint8_t **response_buffers, size_t *response_sizes);
+
+// A system call submitted as part of a batch by enc_untrusted_syscall_batch.
+struct SystemCallBatchEntry {
+  // System call number and parameters, as passed to enc_untrusted_syscall.
+  int sysno;
+  uint64_t parameters[asylo::system_call::kParameterMax];
+
+  // System call result, populated by enc_untrusted_syscall_batch.
+  int64_t result;
+
+  // errno value set by the system call, or 0 if the system call did not set
+  // errno. Populated by enc_untrusted_syscall_batch.
+  int error_number;
+};
+
 // Installs a callback as dispatch function for serialized system calls.
 void enc_set_dispatch_syscall(syscall_dispatch_callback callback);
 
+// Installs a callback as dispatch function for batches of serialized system
+// calls.
+void enc_set_dispatch_syscall_batch(syscall_batch_dispatch_callback callback);
+
 // Installs an error handler function that aborts with a message in case of a
 // failure.
 void enc_set_error_handler(void (*abort_handler)(const char *message));
@@ -48,6 +77,10 @@ void enc_set_error_handler(void (*abort_handler)(const char *message));
 // calls.
 bool enc_is_syscall_dispatcher_set();
 
+// Returns whether a dispatch function has been registered for making batches of
+// system calls.
+bool enc_is_syscall_batch_dispatcher_set();
+
 // Returns whether an error handler function has been registered.
 bool enc_is_error_handler_set();
 
@@ -55,6 +88,17 @@ bool enc_is_error_handler_set();
 // callback.
 int64_t enc_untrusted_syscall(int sysno, ...);
 
+// As enc_untrusted_syscall, but takes the system call parameters as an array of
+// `kParameterMax` values, trailing parameters unused by the system call being
+// ignored. This avoids collecting the parameters from a variable argument list.
+int64_t enc_untrusted_syscall_array(int sysno, const uint64_t *parameters);
+
+// Invokes the `count` system calls described by `entries` on the host, in
+// order, via the installed system call batch dispatch callback. Each system
+// call behaves as if made by enc_untrusted_syscall, except that its result and
+// errno value are stored in its entry and errno is left unchanged.
+void enc_untrusted_syscall_batch(SystemCallBatchEntry *entries, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
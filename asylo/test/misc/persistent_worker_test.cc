@@ -0,0 +1,148 @@
+/*
+ *
+ * Copyright 2019 Asylo authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "asylo/platform/posix/threading/thread_manager.h"
+
+namespace asylo {
+namespace {
+
+using ::testing::Eq;
+
+constexpr int kNumWorkers = 4;
+
+void *Increment(void *arg) {
+  static_cast<std::atomic<int> *>(arg)->fetch_add(1);
+  return arg;
+}
+
+// Creates |num_threads| threads running |start_routine| with |arg|, then joins
+// them.
+void CreateAndJoin(int num_threads, void *(*start_routine)(void *),
+                   void *arg) {
+  std::vector<pthread_t> threads(num_threads);
+  for (pthread_t &thread : threads) {
+    ASSERT_THAT(pthread_create(&thread, nullptr, start_routine, arg), Eq(0));
+  }
+  for (pthread_t thread : threads) {
+    void *result;
+    ASSERT_THAT(pthread_join(thread, &result), Eq(0));
+    EXPECT_THAT(result, Eq(arg));
+  }
+}
+
+// Creates and joins threads of its own, so that all persistent workers can be
+// busy waiting for threads which have not started yet.
+void *CreateAndJoinNested(void *arg) {
+  CreateAndJoin(kNumWorkers, Increment, arg);
+  return arg;
+}
+
+class PersistentWorkerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_THAT(
+        ThreadManager::GetInstance()->SetMaxPersistentWorkers(kNumWorkers),
+        Eq(0));
+  }
+
+  void TearDown() override {
+    ASSERT_THAT(ThreadManager::GetInstance()->SetMaxPersistentWorkers(0),
+                Eq(0));
+  }
+};
+
+TEST_F(PersistentWorkerTest, RunsEveryThread) {
+  std::atomic<int> counter(0);
+  for (int i = 0; i < 16; ++i) {
+    CreateAndJoin(kNumWorkers, Increment, &counter);
+  }
+  EXPECT_THAT(counter.load(), Eq(16 * kNumWorkers));
+}
+
+TEST_F(PersistentWorkerTest, RunsMoreThreadsThanWorkers) {
+  std::atomic<int> counter(0);
+  CreateAndJoin(3 * kNumWorkers, Increment, &counter);
+  EXPECT_THAT(counter.load(), Eq(3 * kNumWorkers));
+}
+
+TEST_F(PersistentWorkerTest, RunsThreadsCreatedByWorkers) {
+  std::atomic<int> counter(0);
+  CreateAndJoin(kNumWorkers, CreateAndJoinNested, &counter);
+  EXPECT_THAT(counter.load(), Eq(kNumWorkers * kNumWorkers));
+}
+
+TEST_F(PersistentWorkerTest, RunsDetachedThreads) {
+  std::atomic<int> counter(0);
+  pthread_attr_t attr;
+  ASSERT_THAT(pthread_attr_init(&attr), Eq(0));
+  ASSERT_THAT(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED),
+              Eq(0));
+  for (int i = 0; i < 8; ++i) {
+    pthread_t thread;
+    ASSERT_THAT(pthread_create(&thread, &attr, Increment, &counter), Eq(0));
+  }
+  while (counter.load() < 8) {
+    sched_yield();
+  }
+  ASSERT_THAT(pthread_attr_destroy(&attr), Eq(0));
+}
+
+TEST(PersistentWorkerConfigTest, RejectsInvalidMaximum) {
+  ThreadManager *thread_manager = ThreadManager::GetInstance();
+  EXPECT_THAT(thread_manager->SetMaxPersistentWorkers(-1), Eq(EINVAL));
+  EXPECT_THAT(thread_manager->SetMaxPersistentWorkers(
+                  ThreadManager::kMaxPersistentWorkers + 1),
+              Eq(EINVAL));
+}
+
+void *Noop(void *arg) { return arg; }
+
+// Measures the throughput of creating and joining batches of |state.range(1)|
+// threads with at most |state.range(0)| persistent workers, where 0 disables
+// persistent workers.
+void BM_CreateJoin(benchmark::State &state) {
+  ThreadManager *thread_manager = ThreadManager::GetInstance();
+  thread_manager->SetMaxPersistentWorkers(state.range(0));
+  const int batch = state.range(1);
+  for (auto _ : state) {
+    CreateAndJoin(batch, Noop, nullptr);
+  }
+  thread_manager->SetMaxPersistentWorkers(0);
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK(BM_CreateJoin)
+    ->ArgPair(0, 1)
+    ->ArgPair(0, 8)
+    ->ArgPair(kNumWorkers, 1)
+    ->ArgPair(kNumWorkers, 8)
+    ->ArgPair(2 * kNumWorkers, 8)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace asylo
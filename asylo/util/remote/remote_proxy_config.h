@@ -180,6 +180,17 @@ class RemoteProxyClientConfig : public RemoteProxyConfig {
     return *open_census_config_;
   }
 
+  // EnableSharedMemoryTransport makes the client offer the proxy a channel in
+  // shared memory to exchange messages over instead of gRPC calls, which
+  // avoids serializing them and most system calls. The proxy accepts the offer
+  // only if it runs on the same machine; otherwise, messages continue to be
+  // exchanged over gRPC.
+  void EnableSharedMemoryTransport() { shared_memory_transport_ = true; }
+
+  bool IsSharedMemoryTransportEnabled() const {
+    return shared_memory_transport_;
+  }
+
  private:
   RemoteProxyClientConfig(
       std::unique_ptr<RemoteProxyConnectionConfig> connection_config,
@@ -191,6 +202,9 @@ class RemoteProxyClientConfig : public RemoteProxyConfig {
 
   // Configuration for OpenCensus.
   absl::optional<OpenCensusClientConfig> open_census_config_;
+
+  // Whether to offer the proxy a shared-memory channel.
+  bool shared_memory_transport_ = false;
 };
 
 // |RemoteProxyServerConfig| provides a |RemoteEnclaveProxyServer| with the
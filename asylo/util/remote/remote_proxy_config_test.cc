@@ -104,6 +104,17 @@ TEST(RemoteProxyClientConfigTest, OpenCensusMetricsConfigAddedCorrectly) {
   EXPECT_THAT(config_result.value().view_name_root, StrEq(kViewNameRoot));
 }
 
+TEST(RemoteProxyClientConfigTest, SharedMemoryTransportEnabledCorrectly) {
+  std::unique_ptr<RemoteProxyClientConfig> config;
+  ASYLO_ASSERT_OK_AND_ASSIGN(config,
+                             RemoteProxyClientConfig::DefaultsWithProvision(
+                                 absl::make_unique<MockProvision>()));
+  EXPECT_THAT(config->IsSharedMemoryTransportEnabled(), Eq(false));
+
+  config->EnableSharedMemoryTransport();
+  EXPECT_THAT(config->IsSharedMemoryTransportEnabled(), Eq(true));
+}
+
 TEST(RemoteProxyServerConfigTest, DefaultsAreAsExpected) {
   std::unique_ptr<RemoteProxyServerConfig> config;
   ASYLO_ASSERT_OK_AND_ASSIGN(